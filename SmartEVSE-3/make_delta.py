@@ -0,0 +1,161 @@
+#!/usr/bin/env python3
+#
+# Create delta firmware files for SmartEVSE, see src/delta.h for the format.
+#
+# Usage:
+#   make_delta.py make old.bin new.signed.bin out.bin
+#       Create a delta file that rebuilds new.signed.bin on a device running old.bin.
+#       old.bin may be signed or unsigned. The signature of new.signed.bin is copied to the delta file.
+#       The device looks for <owner>_firmware.[debug.]delta.<first 16 hex digits of the old image SHA-256>.signed.bin
+#       next to the full firmware, that name is printed.
+#
+#   make_delta.py check release1.bin release2.bin [release3.bin ...]
+#       Create a delta between every pair of consecutive releases, rebuild the new image from it
+#       the way the device does, and report the size savings.
+#
+# The old image is compared at every byte offset against an index of its 16 byte blocks at 4 byte steps.
+# Matches are extended while at least half of the bytes are equal; the differences are stored as
+# bytewise diffs, which compress well when code moves and addresses change.
+
+import hashlib
+import struct
+import sys
+import zlib
+
+SIGNATURE_LENGTH = 512
+ESP_IMAGE_MAGIC = 0xE9
+DELTA_MAGIC = b"SEVD"
+BLOCK = 16
+STEP = 4
+
+
+def load_image(filename):
+    """Return (signature, image) of a firmware file, signature is None for unsigned files"""
+    with open(filename, "rb") as f:
+        data = f.read()
+    if data[0] != ESP_IMAGE_MAGIC and len(data) > SIGNATURE_LENGTH and data[SIGNATURE_LENGTH] == ESP_IMAGE_MAGIC:
+        return data[:SIGNATURE_LENGTH], data[SIGNATURE_LENGTH:]
+    if data[0] != ESP_IMAGE_MAGIC:
+        sys.exit("%s is not an ESP32 firmware image" % filename)
+    return None, data
+
+
+def image_sha256(image):
+    """The SHA-256 that esp-idf appends to the image, and that the device reports as its running image hash"""
+    if hashlib.sha256(image[:-32]).digest() != image[-32:]:
+        sys.exit("image has no appended SHA-256")
+    return image[-32:]
+
+
+def find_matches(old, new):
+    """Yield (new_pos, old_pos, length) of approximate matches, in order of new_pos"""
+    index = {}
+    for pos in range(0, len(old) - BLOCK + 1, STEP):
+        index.setdefault(old[pos:pos + BLOCK], pos)
+
+    i = 0
+    last_new = 0
+    while i <= len(new) - BLOCK:
+        j = index.get(new[i:i + BLOCK])
+        if j is None:
+            i += 1
+            continue
+        # extend backwards over exactly equal bytes that would otherwise be stored as extra data
+        while i > last_new and j > 0 and new[i - 1] == old[j - 1]:
+            i -= 1
+            j -= 1
+        # extend forwards while at least half of the bytes match
+        equal = best_score = length = 0
+        k = 0
+        while i + k < len(new) and j + k < len(old) and k - length < 64:
+            if new[i + k] == old[j + k]:
+                equal += 1
+            k += 1
+            if equal * 2 - k > best_score * 2 - length:
+                best_score = equal
+                length = k
+        yield i, j, length
+        last_new = i + length
+        i = last_new
+
+
+def make_patch(old, new):
+    """Return the uncompressed delta stream that turns old into new"""
+    out = [DELTA_MAGIC, struct.pack("<I", len(old)), image_sha256(old), struct.pack("<I", len(new))]
+    diff_new = diff_old = diff_len = 0            # pending record
+
+    def record(extra_end, next_old):
+        diff = bytes((new[diff_new + k] - old[diff_old + k]) & 0xFF for k in range(diff_len))
+        extra = new[diff_new + diff_len:extra_end]
+        out.append(struct.pack("<IIi", diff_len, len(extra), next_old - (diff_old + diff_len)))
+        out.append(diff)
+        out.append(extra)
+
+    for i, j, length in find_matches(old, new):
+        record(i, j)
+        diff_new, diff_old, diff_len = i, j, length
+    record(len(new), diff_old + diff_len)
+    return b"".join(out)
+
+
+def apply_patch(old, patch):
+    """Rebuild the new image from old and the uncompressed delta stream, with the checks the device does"""
+    if patch[:4] != DELTA_MAGIC:
+        raise ValueError("not a delta file")
+    old_size, = struct.unpack_from("<I", patch, 4)
+    if old_size != len(old) or patch[8:40] != image_sha256(old):
+        raise ValueError("made for another firmware")
+    new_size, = struct.unpack_from("<I", patch, 40)
+    pos = 44
+    old_pos = 0
+    new = bytearray()
+    while len(new) < new_size:
+        diff_len, extra_len, seek = struct.unpack_from("<IIi", patch, pos)
+        pos += 12
+        if len(new) + diff_len + extra_len > new_size or old_pos + diff_len > old_size:
+            raise ValueError("record out of range")
+        new += bytes((old[old_pos + k] + patch[pos + k]) & 0xFF for k in range(diff_len))
+        pos += diff_len
+        new += patch[pos:pos + extra_len]
+        pos += extra_len
+        old_pos += diff_len + seek
+        if old_pos < 0 or old_pos > old_size:
+            raise ValueError("seek out of range")
+    if pos != len(patch):
+        raise ValueError("data after the new image")
+    return bytes(new)
+
+
+def make_delta(old_file, new_file):
+    _, old = load_image(old_file)
+    signature, new = load_image(new_file)
+    if signature is None:
+        sys.exit("%s is not signed" % new_file)
+    return old, new, signature + zlib.compress(make_patch(old, new), 9)
+
+
+def main():
+    if len(sys.argv) == 5 and sys.argv[1] == "make":
+        old, _, delta = make_delta(sys.argv[2], sys.argv[3])
+        with open(sys.argv[4], "wb") as f:
+            f.write(delta)
+        print("%s: %d bytes, upload as <owner>_firmware.[debug.]delta.%s.signed.bin"
+              % (sys.argv[4], len(delta), image_sha256(old)[:8].hex()))
+    elif len(sys.argv) >= 4 and sys.argv[1] == "check":
+        failed = False
+        for old_file, new_file in zip(sys.argv[2:], sys.argv[3:]):
+            old, new, delta = make_delta(old_file, new_file)
+            rebuilt = apply_patch(old, zlib.decompress(delta[SIGNATURE_LENGTH:]))
+            ok = rebuilt == new
+            failed |= not ok
+            print("%s -> %s: full %d bytes, delta %d bytes, %.1f%% saved, %s"
+                  % (old_file, new_file, SIGNATURE_LENGTH + len(new), len(delta),
+                     100.0 * (1 - len(delta) / (SIGNATURE_LENGTH + len(new))), "OK" if ok else "MISMATCH"))
+        sys.exit(1 if failed else 0)
+    else:
+        sys.exit("usage: make_delta.py make old.bin new.signed.bin out.bin\n"
+                 "       make_delta.py check release1.bin release2.bin [release3.bin ...]")
+
+
+if __name__ == "__main__":
+    main()
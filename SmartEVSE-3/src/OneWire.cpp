@@ -29,15 +29,16 @@ unsigned char RFID[8] = {0, 0, 0, 0, 0, 0, 0, 0};
 #ifdef SMARTEVSE_VERSION //ESP32
 #include <string.h>
 #include <Preferences.h>
+#include <LittleFS.h>
+#include <esp_heap_caps.h>
 
 #include "esp32.h"
 #include "utils.h"
 #include "OneWire.h"
 #include "OneWireESP32.h"
+#include "session.h"
 
-#define RFIDSIZE 700
-
-unsigned char RFIDlist[RFIDSIZE];                                               // holds up to 100 RFIDs
+#define RFIDSIZE 700                                                            // list of 100 RFIDs in preferences, used by older firmware
 
 extern uint8_t PIN_SW_IN;
 OneWire32& ds() {                                             //gpio pin, tx, rx, parasite power
@@ -88,22 +89,389 @@ unsigned char OneWireReadCardId(void) {
 
 // ############################## RFID functions ##############################
 
+// The stored RFID cards are kept in RAM as an index sorted by UID, so a presented card is found
+// with a binary search. On LittleFS they are a journal of fixed size records: adding, updating or
+// deleting a card appends one record. When the journal holds more than twice the records needed,
+// it is compacted: rewritten with one record per card, in UID order, so it loads in one pass at boot.
+// The name of a card is only kept in the journal.
+//
+// Changes to the journal are made one at a time under RFIDwriteLock. A card presented to the reader
+// only waits for RFIDlock, which guards the index and the journal it refers to. A compacted or uploaded
+// journal is written while the old one is still in use, and RFIDlock is only taken to swap them.
+
+#define RFID_JOURNAL "/rfid.bin"
+#define RFID_JOURNAL_TMP "/rfid.tmp"                                            // compacted journal, replaces RFID_JOURNAL when complete
+#define RFID_IMPORT "/rfid.imp"                                                 // records of an upload in progress
+#define RFID_MAX_CARDS 5000                                                     // index uses 13 bytes per card
+#define RFID_HEAP_RESERVE 32768                                                 // largest free block left for the rest of the firmware
+#define RFID_ADD 0xA5                                                           // any other value (erased or torn) is not a record
+#define RFID_DEL 0xD3
+
+struct __attribute__((packed)) RFIDRecord {                                     // 32 bytes
+    uint8_t Op;                                                                 // RFID_ADD or RFID_DEL
+    uint8_t Uid[7];                                                             // 6 byte UIDs of the old reader end with 0xff
+    uint16_t Slot;
+    uint16_t Expiry;                                                            // last valid day, days since 1/1/2023; 0 = no expiry
+    char Name[RFID_NAME_LEN + 1];
+    uint8_t Crc;                                                                // crc8 of the bytes above
+};
+static_assert(sizeof(RFIDRecord) == 32, "RFIDRecord must be 32 bytes");
+
+struct __attribute__((packed)) RFIDCard {
+    uint8_t Uid[7];
+    uint16_t Slot;                                                              // card number, MatchRFID() returns (Slot + 1) * 7
+    uint16_t Expiry;
+    uint16_t Record;                                                            // its RFID_ADD record in the journal
+};
+
+static RFIDCard *RFIDcards = NULL;                                              // sorted by Uid
+static uint16_t RFIDcount = 0, RFIDcapacity = 0;
+static uint32_t RFIDrecords = 0;                                                // records in the journal
+static SemaphoreHandle_t RFIDlock = xSemaphoreCreateMutex();
+static SemaphoreHandle_t RFIDwriteLock = xSemaphoreCreateMutex();
+
+// bulk upload of rfid.txt
+static RFIDCard *ImportCards = NULL;
+static uint16_t ImportCount = 0, ImportCapacity = 0;
+static File ImportFile;
+static char ImportLine[64];
+static uint8_t ImportLineLen = 0;
+static bool ImportLineTooLong = false;
+
+
+// Days since 1/1/2023 of a date
+static int32_t dayNumber(int year, int month, int day) {
+    // days from civil, see http://howardhinnant.github.io/date_algorithms.html
+    year -= month <= 2;
+    int32_t era = (year >= 0 ? year : year - 399) / 400;
+    int32_t yoe = year - era * 400;
+    int32_t doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468 - 19358;                                 // 19358 days from 1/1/1970 to 1/1/2023
+}
 
+// Parse "YYYY-MM-DD" into a day number, an empty string is no expiry (0). Returns false when invalid.
+static bool parseExpiry(const char *str, uint16_t *expiry) {
+    int year, month, day;
+    int32_t days;
+
+    *expiry = 0;
+    if (!*str) return true;
+    if (sscanf(str, "%4d-%2d-%2d", &year, &month, &day) != 3 || month < 1 || month > 12 || day < 1 || day > 31) return false;
+    days = dayNumber(year, month, day);
+    if (days < 1 || days > 0xffff) return false;
+    *expiry = days;
+    return true;
+}
 
-// Write a list of 20 RFID's to the eeprom
-//
-void WriteRFIDlist(void) {
+static void formatExpiry(uint16_t expiry, char *str) {
+    time_t t = EPOCH2_OFFSET + (time_t) expiry * 86400;
+    struct tm tm;
 
-    if (preferences.begin("RFIDlist", false) ) {                                // read/write
-        preferences.putBytes("RFID", RFIDlist, RFIDSIZE);                       // write 700 bytes to storage
-        preferences.putUChar("RFIDinit", 3);                                    // data initialized to 700byte mode
-        preferences.end();
-    } else {
-        _LOG_A("Error opening preferences!\n");
+    if (!expiry) str[0] = '\0';
+    else strftime(str, 11, "%Y-%m-%d", gmtime_r(&t, &tm));
+}
+
+// Cards can not be checked for expiry until the time is known
+static bool expiredRFID(uint16_t expiry) {
+    time_t now;
+    struct tm tm;
+
+    if (!expiry || !LocalTimeSet) return false;
+    now = time(NULL);
+    localtime_r(&now, &tm);
+    return dayNumber(tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday) > expiry;
+}
+
+// Parse a 12 (old reader) or 14 hex digit UID, returns the number of digits used, or 0 when invalid
+static uint8_t parseUid(const char *str, uint8_t *uid) {
+    uint8_t n = 0;
+
+    while (isxdigit((unsigned char) str[n]) && n < 15) n++;
+    if (n != 12 && n != 14) return 0;
+    for (uint8_t i = 0; i < n / 2; i++) {
+        char hex[3] = {str[i * 2], str[i * 2 + 1], '\0'};
+        uid[i] = strtol(hex, NULL, 16);
+    }
+    if (n == 12) uid[6] = 0xff;
+    return n;
+}
+
+static void formatUid(const uint8_t *uid, char *str) {
+    uint8_t len = uid[6] == 0xff ? 6 : 7;
+
+    for (uint8_t i = 0; i < len; i++) sprintf(str + i * 2, "%02X", uid[i]);
+}
+
+// The UID of the card in RFID as it is stored. Returns the number of bytes to compare:
+// old readers (family code 0x01) only give 6 bytes.
+static uint8_t cardUid(uint8_t *uid) {
+    if (RFID[0] == 0x01) {
+        memcpy(uid, RFID + 1, 6);
+        uid[6] = 0xff;
+        return 6;
+    }
+    memcpy(uid, RFID, 7);
+    return 7;
+}
+
+static void makeRecord(RFIDRecord *rec, uint8_t op, const RFIDCard *card, const char *name) {
+    memset(rec, 0, sizeof(RFIDRecord));
+    rec->Op = op;
+    memcpy(rec->Uid, card->Uid, 7);
+    rec->Slot = card->Slot;
+    rec->Expiry = card->Expiry;
+    if (name) strncpy(rec->Name, name, RFID_NAME_LEN);
+    rec->Crc = crc8((uint8_t *) rec, sizeof(RFIDRecord) - 1);
+}
+
+static bool validRecord(const RFIDRecord *rec) {
+    return (rec->Op == RFID_ADD || rec->Op == RFID_DEL) && crc8((uint8_t *) rec, sizeof(RFIDRecord) - 1) == rec->Crc;
+}
+
+// Position of the first card with a UID >= uid, compared over len bytes
+static uint16_t findRFID(const uint8_t *uid, uint8_t len) {
+    uint16_t lo = 0, hi = RFIDcount;
+
+    while (lo < hi) {
+        uint16_t mid = (lo + hi) / 2;
+        if (memcmp(RFIDcards[mid].Uid, uid, len) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Position of the card with this UID, -1 when not stored. A 6 byte UID of an old reader also matches
+// a 7 byte UID that starts with it, as long as the 6 byte UID itself is not stored.
+static int32_t lookupRFID(const uint8_t *uid, uint8_t len) {
+    uint16_t pos = findRFID(uid, 7);
+
+    if (pos < RFIDcount && !memcmp(RFIDcards[pos].Uid, uid, 7)) return pos;
+    if (len == 7) return -1;
+    pos = findRFID(uid, len);
+    return pos < RFIDcount && !memcmp(RFIDcards[pos].Uid, uid, len) ? pos : -1;
+}
+
+// Make room for one more card. realloc() may need a new block while the old one is still in use, and
+// during an upload the stored cards take up to another RFID_MAX_CARDS * 13 bytes, so the heap is checked first.
+static bool growRFID(RFIDCard **cards, uint16_t count, uint16_t *capacity) {
+    RFIDCard *grown = NULL;
+    uint16_t size;
+
+    if (count < *capacity) return true;
+    if (*capacity >= RFID_MAX_CARDS) return false;
+    size = *capacity ? *capacity * 2 : 16;
+    if (size > RFID_MAX_CARDS) size = RFID_MAX_CARDS;
+    if (heap_caps_get_largest_free_block(MALLOC_CAP_8BIT) >= size * sizeof(RFIDCard) + RFID_HEAP_RESERVE)
+        grown = (RFIDCard *) realloc(*cards, size * sizeof(RFIDCard));
+    if (!grown) {
+        _LOG_A("RFID: no memory for %u cards.\n", size);
+        return false;
+    }
+    *cards = grown;
+    *capacity = size;
+    return true;
+}
+
+static void removeRFID(uint16_t pos) {
+    memmove(RFIDcards + pos, RFIDcards + pos + 1, (RFIDcount - pos - 1) * sizeof(RFIDCard));
+    RFIDcount--;
+}
+
+// Apply a journal record to the index
+static void applyRecord(const RFIDRecord *rec, uint16_t number) {
+    uint16_t pos;
+    bool found;
+
+    if (RFIDcount && memcmp(RFIDcards[RFIDcount - 1].Uid, rec->Uid, 7) < 0) pos = RFIDcount;  // a compacted journal is in UID order
+    else pos = findRFID(rec->Uid, 7);
+    found = pos < RFIDcount && !memcmp(RFIDcards[pos].Uid, rec->Uid, 7);
+
+    if (rec->Op == RFID_DEL) {
+        if (found) removeRFID(pos);
+    } else if (found || growRFID(&RFIDcards, RFIDcount, &RFIDcapacity)) {
+        if (!found) {
+            memmove(RFIDcards + pos + 1, RFIDcards + pos, (RFIDcount - pos) * sizeof(RFIDCard));
+            RFIDcount++;
+        }
+        memcpy(RFIDcards[pos].Uid, rec->Uid, 7);
+        RFIDcards[pos].Slot = rec->Slot;
+        RFIDcards[pos].Expiry = rec->Expiry;
+        RFIDcards[pos].Record = number;
+    }
+}
+
+static bool appendRecord(const RFIDRecord *rec) {
+    File file = LittleFS.open(RFID_JOURNAL, "a");
+    bool ok = file && file.write((const uint8_t *) rec, sizeof(RFIDRecord)) == sizeof(RFIDRecord);
+
+    if (file) file.close();
+    if (!ok) {
+        _LOG_A("RFID: can not write %s.\n", RFID_JOURNAL);
+        return false;
+    }
+    RFIDrecords++;
+    return true;
+}
+
+/**
+ * Write a new journal with one record per card, in UID order, to RFID_JOURNAL_TMP
+ *
+ * @param source journal or upload the names are copied from, NULL when there are no names
+ * @param cards sorted cards
+ * @param count number of cards
+ * @return false when the new journal could not be written
+ */
+static bool writeJournal(const char *source, const RFIDCard *cards, uint16_t count) {
+    File in, out = LittleFS.open(RFID_JOURNAL_TMP, "w");
+    RFIDRecord rec;
+    char name[RFID_NAME_LEN + 1] = "";
+    bool ok = (bool) out;
+
+    if (ok && source && count) {
+        in = LittleFS.open(source, "r");
+        ok = (bool) in;
+    }
+    for (uint16_t i = 0; ok && i < count; i++) {
+        if (in) {
+            ok = in.seek(cards[i].Record * sizeof(rec)) && in.read((uint8_t *) &rec, sizeof(rec)) == sizeof(rec) && validRecord(&rec);
+            memcpy(name, rec.Name, sizeof(name));
+        }
+        if (ok) {
+            makeRecord(&rec, RFID_ADD, &cards[i], name);
+            ok = out.write((const uint8_t *) &rec, sizeof(rec)) == sizeof(rec);
+        }
+    }
+    if (in) in.close();
+    if (out) out.close();
+    if (!ok) {
+        _LOG_A("RFID: can not write %s.\n", RFID_JOURNAL_TMP);
+        LittleFS.remove(RFID_JOURNAL_TMP);
+    }
+    return ok;
+}
+
+/**
+ * Replace the current journal with the one writeJournal() wrote, the caller holds RFIDlock
+ *
+ * @param cards the cards written, their Record is updated to the new journal
+ * @param count number of cards
+ * @return false when the current journal is kept
+ */
+static bool replaceJournal(RFIDCard *cards, uint16_t count) {
+    if (!LittleFS.rename(RFID_JOURNAL_TMP, RFID_JOURNAL)) {
+        _LOG_A("RFID: can not replace %s.\n", RFID_JOURNAL);
+        LittleFS.remove(RFID_JOURNAL_TMP);
+        return false;
+    }
+    for (uint16_t i = 0; i < count; i++) cards[i].Record = i;
+    RFIDrecords = count;
+    return true;
+}
+
+// The caller holds RFIDwriteLock, so the index can be read without RFIDlock
+static void compactRFID(void) {
+    unsigned long start = millis();
+    bool ok = writeJournal(RFID_JOURNAL, RFIDcards, RFIDcount);
+
+    if (ok) {
+        xSemaphoreTake(RFIDlock, portMAX_DELAY);
+        ok = replaceJournal(RFIDcards, RFIDcount);
+        xSemaphoreGive(RFIDlock);
+    }
+    if (ok) _LOG_I("RFID: journal compacted to %u cards in %lu ms.\n", RFIDcount, millis() - start);
+}
+
+// Lowest slot that is not used by a card
+static uint16_t freeSlot(void) {
+    uint8_t *used = (uint8_t *) calloc((RFID_MAX_CARDS + 7) / 8, 1);
+    uint16_t slot = RFIDcount;                                                  // free when all slots below are taken
+
+    if (!used) return slot;
+    for (uint16_t i = 0; i < RFIDcount; i++) {
+        if (RFIDcards[i].Slot < RFID_MAX_CARDS) used[RFIDcards[i].Slot / 8] |= 1 << (RFIDcards[i].Slot % 8);
+    }
+    for (uint16_t i = 0; i < RFID_MAX_CARDS; i++) {
+        if (!(used[i / 8] & (1 << (i % 8)))) {
+            slot = i;
+            break;
+        }
+    }
+    free(used);
+    return slot;
+}
+
+/**
+ * Add a card, or update the name and expiry of a stored card, the caller holds RFIDwriteLock
+ *
+ * @return 1 when added, 2 when it was already stored (and updated when update is set), 0 when full or not written
+ */
+static uint8_t addRFID(const uint8_t *uid, const char *name, uint16_t expiry, bool update) {
+    RFIDRecord rec;
+    RFIDCard card;
+    uint16_t pos = findRFID(uid, 7);
+    bool found = pos < RFIDcount && !memcmp(RFIDcards[pos].Uid, uid, 7), grown;
+
+    if (found && !update) return 2;
+    if (!found) {
+        xSemaphoreTake(RFIDlock, portMAX_DELAY);
+        grown = growRFID(&RFIDcards, RFIDcount, &RFIDcapacity);
+        xSemaphoreGive(RFIDlock);
+        if (!grown) return 0;
     }
-    
 
-    _LOG_I("\nRFID list saved\n");
+    memcpy(card.Uid, uid, 7);
+    card.Slot = found ? RFIDcards[pos].Slot : freeSlot();
+    card.Expiry = expiry;
+    card.Record = RFIDrecords;
+    makeRecord(&rec, RFID_ADD, &card, name);
+    if (!appendRecord(&rec)) return 0;
+
+    xSemaphoreTake(RFIDlock, portMAX_DELAY);
+    if (!found) {
+        memmove(RFIDcards + pos + 1, RFIDcards + pos, (RFIDcount - pos) * sizeof(RFIDCard));
+        RFIDcount++;
+    }
+    RFIDcards[pos] = card;
+    xSemaphoreGive(RFIDlock);
+    if (RFIDrecords > 2UL * RFIDcount + 64) compactRFID();
+    return found ? 2 : 1;
+}
+
+// The caller holds RFIDwriteLock
+static bool deleteRFID(uint16_t pos) {
+    RFIDRecord rec;
+
+    makeRecord(&rec, RFID_DEL, &RFIDcards[pos], NULL);
+    if (!appendRecord(&rec)) return false;
+    xSemaphoreTake(RFIDlock, portMAX_DELAY);
+    removeRFID(pos);
+    xSemaphoreGive(RFIDlock);
+    if (RFIDrecords > 2UL * RFIDcount + 64) compactRFID();
+    return true;
+}
+
+// The caller holds RFIDwriteLock
+static void loadRFID(void) {
+    File file = LittleFS.open(RFID_JOURNAL, "r");
+    RFIDRecord recs[16];
+    uint32_t number = 0;
+    size_t n;
+    bool clean = file && file.size() % sizeof(RFIDRecord) == 0;                 // a torn write at the end leaves a partial record
+    unsigned long start = millis();
+
+    xSemaphoreTake(RFIDlock, portMAX_DELAY);
+    while (file && (n = file.read((uint8_t *) recs, sizeof(recs)) / sizeof(RFIDRecord))) {
+        for (size_t i = 0; i < n; i++, number++) {
+            if (number <= 0xffff && validRecord(&recs[i])) applyRecord(&recs[i], number);
+            else clean = false;
+        }
+    }
+    if (file) file.close();
+    RFIDrecords = number;
+    xSemaphoreGive(RFIDlock);
+    _LOG_I("RFID: %u cards loaded from %u records in %lu ms.\n", RFIDcount, number, millis() - start);
+    if (!clean || RFIDrecords > 2UL * RFIDcount + 64) compactRFID();
 }
 
 
@@ -130,12 +498,17 @@ void expandUIDArray(unsigned char* oldArray, unsigned char* newArray, uint16_t o
 }
 
 
-// Read a list of 100 RFID's from preferences
-//
-void ReadRFIDlist(void) {
+// Move the list of up to 100 cards that older firmware kept in preferences to the journal.
+// A card keeps its position in that list as slot, so CardOffset still points to the same card.
+// The caller holds RFIDwriteLock.
+static void migrateRFID(void) {
     uint8_t initialized = 0;
+    bool written;
+    unsigned char RFIDlist[RFIDSIZE];
     unsigned char RFIDold[600];                                                 // old RFID buffer
+    RFIDRecord rec;
 
+    memset(RFIDlist, 0xff, sizeof(RFIDlist));
     if (preferences.begin("RFIDlist", false) ) {                                // read/write
         initialized = preferences.getUChar("RFIDinit", 0);
         switch (initialized) {
@@ -143,83 +516,88 @@ void ReadRFIDlist(void) {
                 preferences.getBytes("RFID", RFIDold, 120);                     // read 120 bytes from storage
                 //we are now going to convert from RFIDold 120bytes to RFIDlist 700bytes
                 expandUIDArray(RFIDold, RFIDlist, 120);
-                preferences.remove("RFID");
-                preferences.end();
-                WriteRFIDlist();
-                break;
-            case 0:
-                preferences.end();
-                DeleteAllRFID();                                                // when unitialized, delete all cardIDs
-                setItemValue(MENU_RFIDREADER, 0);                               // RFID Reader Disabled
                 break;
             case 2:
                 preferences.getBytes("RFID", RFIDold, 600);                     // expand v2 RFIDlist to 100 card id's with 7 bytes
                 //we are now going to convert from RFIDold 600bytes to RFIDlist 700bytes
                 expandUIDArray(RFIDold, RFIDlist, 600);
-                preferences.remove("RFID");
-                preferences.end();
-                WriteRFIDlist();
                 break;
             case 3:                                                             // extended RFIDlist with room for 100tags of 7 bytes = 700 bytes
                 preferences.getBytes("RFID", RFIDlist, RFIDSIZE);               // read 700 bytes from storage
-                preferences.end();
                 break;
         }
 
+        xSemaphoreTake(RFIDlock, portMAX_DELAY);
+        RFIDcount = 0;
+        for (uint16_t slot = 0; slot < RFIDSIZE / 7; slot++) {
+            static const uint8_t empty[7] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+            RFIDCard card;
+            if (!memcmp(RFIDlist + slot * 7, empty, 7)) continue;
+            memcpy(card.Uid, RFIDlist + slot * 7, 7);
+            card.Slot = slot;
+            card.Expiry = 0;
+            makeRecord(&rec, RFID_ADD, &card, NULL);
+            applyRecord(&rec, 0);
+        }
+        xSemaphoreGive(RFIDlock);
+        written = writeJournal(NULL, RFIDcards, RFIDcount);
+        if (written) {
+            xSemaphoreTake(RFIDlock, portMAX_DELAY);
+            written = replaceJournal(RFIDcards, RFIDcount);
+            xSemaphoreGive(RFIDlock);
+        }
+        if (written) {
+            preferences.remove("RFID");
+            preferences.putUChar("RFIDinit", 4);                                // cards are stored in RFID_JOURNAL
+            if (initialized && initialized < 4) _LOG_I("RFID: %u cards moved from preferences to %s.\n", RFIDcount, RFID_JOURNAL);
+        }
+        preferences.end();
+        if (!initialized) setItemValue(MENU_RFIDREADER, 0);                     // RFID Reader Disabled
     } else {
         _LOG_A("Error opening preferences!\n") ;
     }
 }
 
-// scan for matching RFID in RFIDlist
-// returns offset+7 when found, 0 when not found
-uint16_t MatchRFID(void) {
-    uint16_t offset = 0, r;
 
-    do {
-        if (RFID[0] == 0x01) {  // old reader 6 byte UID starts at RFID[1]
-            r = memcmp(RFID + 1, RFIDlist + offset, 6);                        // compare only 6 bytes
-        } else {                // new reader 7 byte UID starts ar RFID[0]
-            r = memcmp(RFID, RFIDlist + offset, 7);                            // compare 7 bytes
-        }
-        offset += 7;
-    } while (r !=0 && offset < RFIDSIZE-7);
+// Read the stored RFID cards, LittleFS has to be mounted
+//
+void ReadRFIDlist(void) {
+    xSemaphoreTake(RFIDwriteLock, portMAX_DELAY);
+    if (LittleFS.exists(RFID_JOURNAL)) loadRFID();
+    else migrateRFID();
+    xSemaphoreGive(RFIDwriteLock);
+}
 
-    if (r == 0) return offset;                                                  // return offset + 7 in RFIDlist
-    else return 0;
+// search the stored cards for the card in RFID
+// returns (slot + 1) * 7 when found, 0 when not found or expired
+uint16_t MatchRFID(void) {
+    uint8_t uid[7], len = cardUid(uid);
+    uint16_t ret = 0;
+    int32_t pos;
+
+    xSemaphoreTake(RFIDlock, portMAX_DELAY);
+    pos = lookupRFID(uid, len);
+    if (pos >= 0) {
+        if (expiredRFID(RFIDcards[pos].Expiry)) _LOG_A("RFID card expired!\n");
+        else ret = (RFIDcards[pos].Slot + 1) * 7;
+    }
+    xSemaphoreGive(RFIDlock);
+    return ret;
 }
 
 
-// Store RFID card in memory and eeprom
+// Store RFID card in memory and LittleFS
 // returns 1 when successful
 // returns 2 when already stored
 // returns 0 when all slots are full.
 unsigned char StoreRFID(void) {
-    uint16_t offset = 0, r;
-    unsigned char empty[7] = {0xff,0xff,0xff,0xff,0xff,0xff,0xff};
-
-    // first check if the Card ID was already stored.
-    if ( MatchRFID() ) return 2;                                                // already stored, that's ok.
-
-    do {
-        r = memcmp(empty, RFIDlist + offset, 7);
-        offset += 7;
-    } while (r !=0 && offset < RFIDSIZE);
-    if (r != 0) return 0;                                                       // no more room to store RFID
-    offset -= 7;
-    _LOG_A("offset %u ",offset);
-    if (RFID[0] == 0x01) {
-        memcpy(RFIDlist + offset, RFID+1, 6);                                   // Store 6 byte UID
-    } else {
-        memcpy(RFIDlist + offset, RFID, 7);                                     // Store 7 byte UID
-    }
-
+    uint8_t uid[7], r;
 
-    _LOG_I("\nRFIDlist:");
-    for (r=0; r<RFIDSIZE; r++) _LOG_I_NO_FUNC("%02x",RFIDlist[r]);
-
-    WriteRFIDlist();
-    return 1;
+    cardUid(uid);
+    xSemaphoreTake(RFIDwriteLock, portMAX_DELAY);
+    r = addRFID(uid, NULL, 0, false);
+    xSemaphoreGive(RFIDwriteLock);
+    return r;
 }
 
 //load and store parameter RFIDparm into global variable RFID
@@ -229,30 +607,226 @@ void LoadandStoreRFID(unsigned int *RFIDparam) {
     StoreRFID();
 }
 
-// Delete RFID card in memory and eeprom
+// Delete RFID card in memory and LittleFS
 // returns 1 when successful, 0 when RFID was not found
 unsigned char DeleteRFID(void) {
-    uint16_t offset = 0, r;
+    uint8_t uid[7], len = cardUid(uid);
+    int32_t pos;
+    unsigned char r = 0;
+
+    xSemaphoreTake(RFIDwriteLock, portMAX_DELAY);
+    pos = lookupRFID(uid, len);
+    if (pos >= 0) r = deleteRFID(pos);
+    xSemaphoreGive(RFIDwriteLock);
+    return r;
+}
 
-    offset = MatchRFID();                                                       // find RFID in list
-    if (offset) {
-        offset -= 7;
-        for (r = 0; r < 7; r++) RFIDlist[offset + r] = 0xff;
-    } else return 0;
+void DeleteAllRFID(void) {
+    xSemaphoreTake(RFIDwriteLock, portMAX_DELAY);
+    bool written = writeJournal(NULL, RFIDcards, 0);
+    xSemaphoreTake(RFIDlock, portMAX_DELAY);
+    RFIDcount = 0;
+    if (written) replaceJournal(RFIDcards, 0);
+    xSemaphoreGive(RFIDlock);
+    xSemaphoreGive(RFIDwriteLock);
+    _LOG_I("All RFID cards erased!\n");
+}
 
-    _LOG_A("deleted %u ",offset);
-    for (r=0; r<RFIDSIZE; r++) _LOG_A_NO_FUNC("%02x",RFIDlist[r]);
-    
-    WriteRFIDlist();
-    return 1;
+uint16_t RFIDCardCount(void) {
+    return RFIDcount;
 }
 
-void DeleteAllRFID(void) {
-    uint16_t i;
+/**
+ * Read a stored card, for export
+ *
+ * @param index 0 .. RFIDCardCount() - 1, cards are in UID order
+ * @param uid 12 or 14 hex digits, 15 bytes
+ * @param name RFID_NAME_LEN + 1 bytes
+ * @param expiry "YYYY-MM-DD" or empty, 11 bytes
+ * @return false when there is no such card
+ */
+bool GetRFIDCard(uint16_t index, char *uid, char *name, char *expiry) {
+    RFIDRecord rec;
+    bool ok = false;
+
+    xSemaphoreTake(RFIDlock, portMAX_DELAY);
+    if (index < RFIDcount) {
+        File file = LittleFS.open(RFID_JOURNAL, "r");
+        ok = file && file.seek(RFIDcards[index].Record * sizeof(rec)) && file.read((uint8_t *) &rec, sizeof(rec)) == sizeof(rec) && validRecord(&rec);
+        if (file) file.close();
+        formatUid(RFIDcards[index].Uid, uid);
+        formatExpiry(RFIDcards[index].Expiry, expiry);
+        if (ok) memcpy(name, rec.Name, RFID_NAME_LEN + 1);
+        else name[0] = '\0';
+        ok = true;
+    }
+    xSemaphoreGive(RFIDlock);
+    return ok;
+}
 
-    for (i = 0; i < RFIDSIZE; i++) RFIDlist[i] = 0xff;
-    WriteRFIDlist();
-    _LOG_I("All RFID cards erased!\n");
+/**
+ * Add a card, or update the name and expiry of a stored card
+ *
+ * @param uid 12 or 14 hex digits
+ * @param name up to RFID_NAME_LEN characters, longer names are truncated
+ * @param expiry "YYYY-MM-DD", the last day the card is accepted, or empty
+ * @return 1 when added, 2 when updated, 0 when full or storing failed, -1 when a parameter is invalid
+ */
+int8_t SetRFIDCard(const char *uid, const char *name, const char *expiry) {
+    uint8_t id[7], n = parseUid(uid, id);
+    uint16_t days;
+    int8_t r;
+
+    if (!n || n != strlen(uid) || !parseExpiry(expiry, &days)) return -1;
+    xSemaphoreTake(RFIDwriteLock, portMAX_DELAY);
+    r = addRFID(id, name, days, true);
+    xSemaphoreGive(RFIDwriteLock);
+    return r;
+}
+
+// Delete a card by UID, returns false when it is not stored
+bool RemoveRFIDCard(const char *uid) {
+    uint8_t id[7], n = parseUid(uid, id);
+    int32_t pos;
+    bool r = false;
+
+    if (!n || n != strlen(uid)) return false;
+    xSemaphoreTake(RFIDwriteLock, portMAX_DELAY);
+    pos = lookupRFID(id, 7);
+    if (pos >= 0) r = deleteRFID(pos);
+    xSemaphoreGive(RFIDwriteLock);
+    return r;
+}
+
+
+// Start an upload of rfid.txt, which replaces all stored cards
+void ImportRFIDBegin(void) {
+    free(ImportCards);
+    ImportCards = NULL;
+    ImportCount = ImportCapacity = 0;
+    ImportLineLen = 0;
+    ImportLineTooLong = false;
+    if (ImportFile) ImportFile.close();
+    ImportFile = LittleFS.open(RFID_IMPORT, "w");
+    if (!ImportFile) _LOG_A("RFID: can not write %s.\n", RFID_IMPORT);
+}
+
+// One line of rfid.txt: UID[,name[,YYYY-MM-DD]]
+static void importLine(void) {
+    RFIDRecord rec;
+    RFIDCard card;
+    char *name, *expiry = NULL;
+    uint16_t days;
+    uint8_t n;
+
+    ImportLine[ImportLineLen] = '\0';
+    while (ImportLineLen && isspace((unsigned char) ImportLine[ImportLineLen - 1])) ImportLine[--ImportLineLen] = '\0';   // in case of DOS the 0x0D is stripped off here
+    if (!ImportLineLen || ImportLine[0] == '#') return;
+
+    n = parseUid(ImportLine, card.Uid);
+    name = ImportLine + n;
+    if (n && *name == ',') {
+        name++;
+        expiry = strchr(name, ',');
+        if (expiry) *expiry++ = '\0';
+    } else if (*name) n = 0;
+    if (!n || !parseExpiry(expiry ? expiry : "", &days)) {
+        _LOG_A("RFID: invalid line \"%s\" in rfid.txt.\n", ImportLine);
+        return;
+    }
+    if (ImportCount == RFID_MAX_CARDS) return;                                 // the rest of rfid.txt is ignored
+    if (!growRFID(&ImportCards, ImportCount, &ImportCapacity)) {
+        ImportFile.close();                                                     // keep the stored cards
+        return;
+    }
+    card.Slot = 0;
+    card.Expiry = days;
+    card.Record = ImportCount;
+    makeRecord(&rec, RFID_ADD, &card, name);
+    if (ImportFile.write((const uint8_t *) &rec, sizeof(rec)) != sizeof(rec)) {
+        _LOG_A("RFID: can not write %s.\n", RFID_IMPORT);
+        ImportFile.close();
+        return;
+    }
+    ImportCards[ImportCount++] = card;
+}
+
+// Next part of rfid.txt, lines may be split anywhere
+void ImportRFIDData(const char *buf, size_t len) {
+    if (!ImportFile) return;
+    for (size_t i = 0; i < len; i++) {
+        if (buf[i] == '\n') {
+            if (!ImportLineTooLong) importLine();
+            else _LOG_A("RFID: line too long in rfid.txt.\n");
+            ImportLineLen = 0;
+            ImportLineTooLong = false;
+        } else if (ImportLineLen < sizeof(ImportLine) - 1) ImportLine[ImportLineLen++] = buf[i];
+        else ImportLineTooLong = true;
+    }
+}
+
+static int compareImport(const void *a, const void *b) {
+    const RFIDCard *ca = (const RFIDCard *) a, *cb = (const RFIDCard *) b;
+    int r = memcmp(ca->Uid, cb->Uid, 7);
+
+    return r ? r : cb->Record - ca->Record;                                     // the last line of a UID first
+}
+
+/**
+ * Finish the upload of rfid.txt, and replace the stored cards
+ *
+ * The uploaded cards were collected next to the stored ones; when the heap had no room for both, the
+ * upload already failed in growRFID().
+ *
+ * @return number of stored cards, -1 when the upload could not be stored (the old cards are kept)
+ */
+int32_t ImportRFIDEnd(void) {
+    int32_t r = -1;
+    uint16_t count = 0;
+    unsigned long start = millis();
+
+    if (ImportFile) {
+        if (ImportLineLen && !ImportLineTooLong) importLine();                  // last line without a newline
+    }
+    if (ImportFile) {
+        ImportFile.close();
+        // sort by UID, and keep the last line of a UID
+        qsort(ImportCards, ImportCount, sizeof(RFIDCard), compareImport);
+        for (uint16_t i = 0; i < ImportCount; i++) {
+            if (count && !memcmp(ImportCards[count - 1].Uid, ImportCards[i].Uid, 7)) continue;
+            ImportCards[count] = ImportCards[i];
+            ImportCards[count].Slot = count;
+            count++;
+        }
+        xSemaphoreTake(RFIDwriteLock, portMAX_DELAY);
+        if (writeJournal(RFID_IMPORT, ImportCards, count)) {
+            xSemaphoreTake(RFIDlock, portMAX_DELAY);
+            if (replaceJournal(ImportCards, count)) {
+                free(RFIDcards);
+                RFIDcards = ImportCards;
+                RFIDcount = count;
+                RFIDcapacity = ImportCapacity;
+                ImportCards = NULL;
+                r = count;
+            }
+            xSemaphoreGive(RFIDlock);
+        }
+        xSemaphoreGive(RFIDwriteLock);
+        _LOG_I("RFID: %u cards from %u lines stored in %lu ms.\n", count, ImportCount, millis() - start);
+    }
+    LittleFS.remove(RFID_IMPORT);
+    free(ImportCards);
+    ImportCards = NULL;
+    ImportCount = ImportCapacity = 0;
+    return r;
+}
+
+// The card that enabled access is stored with the charging session
+static void sessionCard(void) {
+    uint8_t uid[7];
+
+    cardUid(uid);
+    SessionSetCard(uid);
 }
 
 void CheckRFID(void) {
@@ -290,7 +864,10 @@ void CheckRFID(void) {
                             _LOG_A("RFID card found!\n");
                             if (AccessStatus == ON) {
                                 setAccess(OFF);                                     // Access Off, Switch back to state B1/C1
-                            } else setAccess(ON);
+                            } else {
+                                setAccess(ON);
+                                sessionCard();
+                            }
 
                             RFIDstatus = 1;
                         }  else if (!x) RFIDstatus = 7;                             // invalid card
@@ -303,6 +880,7 @@ void CheckRFID(void) {
                             if (AccessStatus == OFF) {
                                 CardOffset = x;                                     // store cardoffset from current card
                                 setAccess(ON);                                      // Access On
+                                sessionCard();
                             } else if (CardOffset == x) {
                                 setAccess(OFF);                                     // Access Off, Switch back to state B1/C1
                             }
@@ -33,6 +33,16 @@ void ReadRFIDlist(void);
 void DeleteAllRFID(void);
 void CheckRFID(void);
 void LoadandStoreRFID(unsigned int *RFIDparam);
+
+#define RFID_NAME_LEN 18                                                        // optional name of a card
+
+uint16_t RFIDCardCount(void);
+bool GetRFIDCard(uint16_t index, char *uid, char *name, char *expiry);
+int8_t SetRFIDCard(const char *uid, const char *name, const char *expiry);
+bool RemoveRFIDCard(const char *uid);
+void ImportRFIDBegin(void);
+void ImportRFIDData(const char *buf, size_t len);
+int32_t ImportRFIDEnd(void);
 #else
 /*
  * OneWire.h
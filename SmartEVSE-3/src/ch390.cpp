@@ -61,14 +61,27 @@ static esp_err_t ch390_reg_write(uint8_t reg, uint8_t val) {
     return spi_device_polling_transmit(s_spi, &t);
 }
 
+// DMA transfers need a word aligned buffer and length, else the SPI driver allocates a bounce buffer.
+// The word aligned part is read with DMA, the last 1-3 bytes through rx_data.
 static esp_err_t ch390_mem_read(uint8_t *buf, uint32_t len) {
+    esp_err_t ret = ESP_OK;
     spi_transaction_t t = {};
     t.cmd = CH390_SPI_RD;
     t.addr = CH390_MRCMD;
-    t.rx_buffer = buf;
-    t.rxlength = len * 8;
     t.length = 0;
-    return spi_device_polling_transmit(s_spi, &t);
+    if (len & ~3) {
+        t.rx_buffer = buf;
+        t.rxlength = (len & ~3) * 8;
+        ret = spi_device_polling_transmit(s_spi, &t);
+    }
+    if ((len & 3) && ret == ESP_OK) {
+        t.rx_buffer = NULL;
+        t.flags = SPI_TRANS_USE_RXDATA;
+        t.rxlength = (len & 3) * 8;
+        ret = spi_device_polling_transmit(s_spi, &t);
+        memcpy(buf + (len & ~3), t.rx_data, len & 3);
+    }
+    return ret;
 }
 
 static esp_err_t ch390_mem_write(const uint8_t *buf, uint32_t len) {
@@ -127,13 +140,15 @@ typedef struct {
     esp_eth_mediator_t *eth;
     TaskHandle_t rx_task;
     SemaphoreHandle_t spi_lock;
+    SemaphoreHandle_t tx_lock;      // one frame in TX SRAM at a time, from write until TXREQ
+    SemaphoreHandle_t tx_done;      // given by the rx task on ISR_PT
     uint8_t addr[6];
     bool flow_ctrl_enabled;
-    uint8_t *rx_buffer;
 } emac_ch390_t;
 
 static emac_ch390_t *s_emac = NULL;
 static volatile bool s_force_link_down = false;
+static ch390_stats_t s_stats = {};
 
 
 #define CH390_LOCK(emac)   xSemaphoreTake((emac)->spi_lock, portMAX_DELAY)
@@ -150,7 +165,7 @@ static void ch390_stop_locked(emac_ch390_t *emac) {
 static void ch390_start_locked(emac_ch390_t *emac) {
     ch390_reg_write(CH390_MPTRCR, MPTRCR_RST_RX);
     ch390_reg_write(CH390_ISR, ISR_CLR_STATUS);
-    ch390_reg_write(CH390_IMR, IMR_PAR | IMR_ROOI | IMR_ROI | IMR_PRI);
+    ch390_reg_write(CH390_IMR, IMR_PAR | IMR_ROOI | IMR_ROI | IMR_PTI | IMR_PRI);
     uint8_t rcr;
     ch390_reg_read(CH390_RCR, &rcr);
     ch390_reg_write(CH390_RCR, rcr | RCR_RXEN);
@@ -250,6 +265,8 @@ static void IRAM_ATTR ch390_isr_handler(void *arg) {
 }
 
 // RX task — matches reference emac_ch390_task structure
+static esp_err_t ch390_rx_header_locked(emac_ch390_t *emac, uint32_t *length);
+
 static void ch390_rx_task(void *arg) {
     emac_ch390_t *emac = (emac_ch390_t *)arg;
     uint8_t status = 0;
@@ -267,8 +284,12 @@ static void ch390_rx_task(void *arg) {
         ch390_reg_write(CH390_ISR, status);
         CH390_UNLOCK(emac);
 
+        // last frame was sent, a waiting transmit can continue
+        if (status & ISR_PT) xSemaphoreGive(emac->tx_done);
+
         // RX FIFO overflow — reset RX path
         if (status & (ISR_ROS | ISR_ROO)) {
+            s_stats.rx_overflows++;
             _LOG_W("CH390: RX overflow (ISR=0x%02X), resetting RX\n", status);
             CH390_LOCK(emac);
             ch390_stop_locked(emac);
@@ -280,25 +301,36 @@ static void ch390_rx_task(void *arg) {
 
         /* packet received */
         if (status & ISR_PR) {
+            // The frame is read from the RX SRAM straight into the buffer that is passed to the stack,
+            // which frees it. The buffer is word aligned, so the SPI driver can DMA into it.
             do {
                 uint32_t frame_len = 0;
-                if (emac->parent.receive(&emac->parent, emac->rx_buffer, &frame_len) == ESP_OK) {
-                    if (frame_len == 0) {
-                        break;
-                    }
-                    /* allocate memory and check whether allocation failed */
-                    buffer = (uint8_t *)malloc(frame_len);
-                    if (buffer == NULL) {
-                        _LOG_A("CH390: no memory for receive buffer\n");
-                        continue;
-                    }
-                    /* pass the buffer to stack (e.g. TCP/IP layer) */
-                    memcpy(buffer, emac->rx_buffer, frame_len);
-                    emac->eth->stack_input(emac->eth, buffer, frame_len);
-                } else {
+                CH390_LOCK(emac);
+                if (ch390_rx_header_locked(emac, &frame_len) != ESP_OK) {
+                    CH390_UNLOCK(emac);
+                    s_stats.rx_errors++;
                     _LOG_W("CH390: frame read failed\n");
                     break;
                 }
+                if (frame_len == 0) {
+                    CH390_UNLOCK(emac);
+                    break;
+                }
+                buffer = (uint8_t *)malloc((frame_len + 3) & ~3);
+                if (buffer == NULL) {
+                    ch390_drop_frame(frame_len);
+                    CH390_UNLOCK(emac);
+                    s_stats.rx_no_mem++;
+                    _LOG_A("CH390: no memory for receive buffer\n");
+                    continue;
+                }
+                ch390_mem_read(buffer, frame_len);
+                CH390_UNLOCK(emac);
+                frame_len -= ETH_CRC_LEN;
+                s_stats.rx_frames++;
+                s_stats.rx_bytes += frame_len;
+                /* pass the buffer to stack (e.g. TCP/IP layer) */
+                emac->eth->stack_input(emac->eth, buffer, frame_len);
             } while (1);
 
             // Yield briefly after draining all pending packets.
@@ -370,21 +402,31 @@ static esp_err_t ch390_mac_transmit(esp_eth_mac_t *mac, uint8_t *buf, uint32_t l
     emac_ch390_t *emac = __containerof(mac, emac_ch390_t, parent);
     if (length > ETH_MAX_PACKET_SIZE) return ESP_ERR_INVALID_SIZE;
 
+    xSemaphoreTake(emac->tx_lock, portMAX_DELAY);
     CH390_LOCK(emac);
 
-    // Write packet data to TX memory
+    // Write packet data to TX memory, this can be done while the last frame is still being sent
     ch390_mem_write(buf, length);
 
-    // Check if last transmit is complete (poll TCR_TXREQ)
+    // Check if last transmit is complete. If not, release the SPI bus and wait for the
+    // packet transmitted interrupt, instead of polling TCR_TXREQ.
     uint8_t tcr;
-    int64_t wait_time = esp_timer_get_time();
-    do {
-        ch390_reg_read(CH390_TCR, &tcr);
-    } while ((tcr & TCR_TXREQ) && ((esp_timer_get_time() - wait_time) < 1000));
+    ch390_reg_read(CH390_TCR, &tcr);
+    if (tcr & TCR_TXREQ) {
+        s_stats.tx_waits++;
+        for (int i = 0; i < 2 && (tcr & TCR_TXREQ); i++) {
+            CH390_UNLOCK(emac);
+            xSemaphoreTake(emac->tx_done, pdMS_TO_TICKS(1) + 1);
+            CH390_LOCK(emac);
+            ch390_reg_read(CH390_TCR, &tcr);
+        }
+    }
 
     if (tcr & TCR_TXREQ) {
+        s_stats.tx_busy++;
         _LOG_W("CH390: last transmit still in progress, cannot send\n");
         CH390_UNLOCK(emac);
+        xSemaphoreGive(emac->tx_lock);
         return ESP_ERR_INVALID_STATE;
     }
 
@@ -393,19 +435,20 @@ static esp_err_t ch390_mac_transmit(esp_eth_mac_t *mac, uint8_t *buf, uint32_t l
     ch390_reg_write(CH390_TXPLH, (length >> 8) & 0xFF);
 
     // Issue TX polling command
-    ch390_reg_read(CH390_TCR, &tcr);
     ch390_reg_write(CH390_TCR, tcr | TCR_TXREQ);
 
     CH390_UNLOCK(emac);
+    xSemaphoreGive(emac->tx_lock);
+    s_stats.tx_frames++;
+    s_stats.tx_bytes += length;
     return ESP_OK;
 }
 
-// Receive one packet from the CH390 RX SRAM.
+// Read the header of the next packet in the CH390 RX SRAM, and return its length including the CRC,
+// or 0 if there is no packet. The caller reads or drops the data. Caller must hold spi_lock.
 // Matches the Espressif reference emac_ch390_receive pattern.
-static esp_err_t ch390_mac_receive(esp_eth_mac_t *mac, uint8_t *buf, uint32_t *length) {
-    emac_ch390_t *emac = __containerof(mac, emac_ch390_t, parent);
-
-    CH390_LOCK(emac);
+static esp_err_t ch390_rx_header_locked(emac_ch390_t *emac, uint32_t *length) {
+    *length = 0;
 
     // Double dummy read to get the most updated data
     uint8_t rxbyte;
@@ -417,7 +460,6 @@ static esp_err_t ch390_mac_receive(esp_eth_mac_t *mac, uint8_t *buf, uint32_t *l
         ch390_stop_locked(emac);
         esp_rom_delay_us(1000);
         ch390_start_locked(emac);
-        CH390_UNLOCK(emac);
         return ESP_ERR_INVALID_RESPONSE;
     }
 
@@ -427,28 +469,33 @@ static esp_err_t ch390_mac_receive(esp_eth_mac_t *mac, uint8_t *buf, uint32_t *l
         ch390_mem_read(rx_header, CH390_RX_HDR_SIZE);
 
         uint8_t status = rx_header[1];
-        *length = (rx_header[3] << 8) + rx_header[2];
+        uint32_t len = (rx_header[3] << 8) + rx_header[2];
 
         if (status & RSR_ERR_MASK) {
-            ch390_drop_frame(*length);
-            *length = 0;
-            CH390_UNLOCK(emac);
+            ch390_drop_frame(len);
             return ESP_ERR_INVALID_RESPONSE;
-        } else if (*length > ETH_MAX_PACKET_SIZE) {
+        } else if (len > ETH_MAX_PACKET_SIZE || len <= ETH_CRC_LEN) {
             // Reset rx memory pointer
             ch390_reg_write(CH390_MPTRCR, MPTRCR_RST_RX);
-            CH390_UNLOCK(emac);
             return ESP_ERR_INVALID_RESPONSE;
-        } else {
-            ch390_mem_read(buf, *length);
-            *length -= ETH_CRC_LEN;
         }
-    } else {
-        *length = 0;
+        *length = len;
     }
+    return ESP_OK;
+}
 
+// Receive one packet from the CH390 RX SRAM into buf.
+static esp_err_t ch390_mac_receive(esp_eth_mac_t *mac, uint8_t *buf, uint32_t *length) {
+    emac_ch390_t *emac = __containerof(mac, emac_ch390_t, parent);
+
+    CH390_LOCK(emac);
+    esp_err_t ret = ch390_rx_header_locked(emac, length);
+    if (ret == ESP_OK && *length) {
+        ch390_mem_read(buf, *length);
+        *length -= ETH_CRC_LEN;
+    }
     CH390_UNLOCK(emac);
-    return ESP_OK;
+    return ret;
 }
 
 static esp_err_t ch390_mac_set_addr(esp_eth_mac_t *mac, uint8_t *addr) {
@@ -560,7 +607,8 @@ static esp_err_t ch390_mac_del(esp_eth_mac_t *mac) {
     emac_ch390_t *emac = __containerof(mac, emac_ch390_t, parent);
     if (emac->rx_task) vTaskDelete(emac->rx_task);
     if (emac->spi_lock) vSemaphoreDelete(emac->spi_lock);
-    heap_caps_free(emac->rx_buffer);
+    if (emac->tx_lock) vSemaphoreDelete(emac->tx_lock);
+    if (emac->tx_done) vSemaphoreDelete(emac->tx_done);
     free(emac);
     return ESP_OK;
 }
@@ -589,17 +637,15 @@ static esp_eth_mac_t *ch390_mac_new(void) {
     emac->parent.receive             = ch390_mac_receive;
 
     emac->spi_lock = xSemaphoreCreateMutex();
-    if (!emac->spi_lock) { free(emac); return NULL; }
-
-    emac->rx_buffer = (uint8_t *)heap_caps_malloc(1536 + CH390_RX_HDR_SIZE, MALLOC_CAP_DMA);
-    if (!emac->rx_buffer) { vSemaphoreDelete(emac->spi_lock); free(emac); return NULL; }
+    emac->tx_lock = xSemaphoreCreateMutex();
+    emac->tx_done = xSemaphoreCreateBinary();
+    if (!emac->spi_lock || !emac->tx_lock || !emac->tx_done) { ch390_mac_del(&emac->parent); return NULL; }
 
     BaseType_t ret = xTaskCreatePinnedToCore(ch390_rx_task, "ch390_rx", 4096,
                                               emac, 8, &emac->rx_task, 0);
     if (ret != pdPASS) {
-        heap_caps_free(emac->rx_buffer);
-        vSemaphoreDelete(emac->spi_lock);
-        free(emac);
+        emac->rx_task = NULL;
+        ch390_mac_del(&emac->parent);
         return NULL;
     }
 
@@ -891,6 +937,10 @@ static void eth_event_handler(void *arg, esp_event_base_t event_base,
 
 static char eth_ip_str[16] = "";
 
+const ch390_stats_t *ch390_get_stats(void) {
+    return &s_stats;
+}
+
 const char* ch390_get_ip(void) {
     return eth_ip_str;
 }
@@ -153,6 +153,7 @@
 #define IMR_LNKCHGI     (1 << 5)    // Link change interrupt enable
 #define IMR_ROOI        (1 << 3)    // RX overflow counter overflow interrupt enable
 #define IMR_ROI         (1 << 2)    // RX overflow interrupt enable
+#define IMR_PTI         (1 << 1)    // Packet transmitted interrupt enable
 #define IMR_PRI         (1 << 0)    // Packet received interrupt enable
 
 #define EPCR_EPOS       (1 << 3)    // Select PHY (1) or EEPROM (0)
@@ -205,6 +206,20 @@ esp_err_t ch390_eth_init(void);
 // Get the Ethernet IP address string (empty if no IP).
 const char* ch390_get_ip(void);
 
+// Driver counters, since boot
+typedef struct {
+    uint32_t rx_frames;
+    uint32_t rx_bytes;
+    uint32_t rx_errors;     // bad frames, and RX SRAM recoveries
+    uint32_t rx_no_mem;     // frames dropped because no receive buffer could be allocated
+    uint32_t rx_overflows;
+    uint32_t tx_frames;
+    uint32_t tx_bytes;
+    uint32_t tx_waits;      // transmits that had to wait for the previous frame
+    uint32_t tx_busy;       // transmits dropped because the previous frame was not sent in time
+} ch390_stats_t;
+const ch390_stats_t *ch390_get_stats(void);
+
 // Runtime flags
 extern bool EthPresent;     // true if CH390D chip was detected at boot
 extern bool EthConnected;   // true if Ethernet link is up
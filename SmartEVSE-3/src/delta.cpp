@@ -0,0 +1,240 @@
+/*
+;    Project:       Smart EVSE
+;
+;    Delta firmware updates, see delta.h for the file format.
+;
+; Permission is hereby granted, free of charge, to any person obtaining a copy
+; of this software and associated documentation files (the "Software"), to deal
+; in the Software without restriction, including without limitation the rights
+; to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+; copies of the Software, and to permit persons to whom the Software is
+; furnished to do so, subject to the following conditions:
+;
+; The above copyright notice and this permission notice shall be included in
+; all copies or substantial portions of the Software.
+;
+; THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+; IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+; FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+; AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+; LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+; OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+; THE SOFTWARE.
+ */
+
+#ifdef SMARTEVSE_VERSION //ESP32
+
+#include <string.h>
+#include "esp_ota_ops.h"
+#include "esp32.h"
+#include "delta.h"
+
+static uint32_t getU32(const uint8_t *buf) {
+    return buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+
+// SHA-256 of the running firmware image, as appended to the image by esp-idf. Delta files are made against it.
+const uint8_t *runningImageSha256(void) {
+    static uint8_t sha[32];
+    static bool valid = false;
+
+    if (!valid) valid = esp_partition_get_sha256(esp_ota_get_running_partition(), sha) == ESP_OK;
+    return valid ? sha : NULL;
+}
+
+
+/**
+ * Start rebuilding a firmware image from a delta file
+ *
+ * @param output called with every part of the new image, in order
+ * @param arg passed to output
+ * @return false when there is not enough memory
+ */
+bool DeltaPatch::begin(OutputFn output, void *arg) {
+    end();
+    Inflator = (tinfl_decompressor *) malloc(sizeof(tinfl_decompressor));
+    Window = (uint8_t *) malloc(TINFL_LZ_DICT_SIZE);
+    if (!Inflator || !Window) {
+        _LOG_A("Delta: no memory.\n");
+        end();
+        return false;
+    }
+    tinfl_init(Inflator);
+    Output = output;
+    Arg = arg;
+    WindowPos = 0;
+    OldPartition = esp_ota_get_running_partition();
+    OldSize = OldPos = NewSize = Produced = DiffLeft = ExtraLeft = 0;
+    Seek = 0;
+    FieldLen = 0;
+    State = HEADER;
+    StreamEnd = false;
+    return true;
+}
+
+void DeltaPatch::end(void) {
+    free(Inflator);
+    free(Window);
+    Inflator = NULL;
+    Window = NULL;
+    State = FAILED;
+}
+
+// Feed the next part of the zlib stream, which may be split anywhere
+bool DeltaPatch::write(const uint8_t *buf, size_t len) {
+    if (!len) return State != FAILED;
+    if (StreamEnd) {
+        _LOG_A("Delta: data after the end of the stream.\n");
+        State = FAILED;
+    }
+    while (State != FAILED) {
+        size_t in = len, out = TINFL_LZ_DICT_SIZE - WindowPos;
+        tinfl_status status = tinfl_decompress(Inflator, buf, &in, Window, Window + WindowPos, &out,
+                                               TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_HAS_MORE_INPUT);
+        buf += in;
+        len -= in;
+        if (out) process(Window + WindowPos, out);
+        WindowPos = (WindowPos + out) & (TINFL_LZ_DICT_SIZE - 1);
+
+        if (status < TINFL_STATUS_DONE) {
+            _LOG_A("Delta: inflate error %d.\n", status);
+            State = FAILED;
+        } else if (status == TINFL_STATUS_DONE) {
+            StreamEnd = true;
+            if (len) {
+                _LOG_A("Delta: data after the end of the stream.\n");
+                State = FAILED;
+            }
+            break;
+        } else if (status == TINFL_STATUS_NEEDS_MORE_INPUT) break;             // all input is consumed
+    }
+    return State != FAILED;
+}
+
+// True when the whole stream was received, and the new image is complete
+bool DeltaPatch::finish(void) {
+    if (State != DONE || !StreamEnd) _LOG_A("Delta: incomplete, %u/%u bytes.\n", Produced, NewSize);
+    return State == DONE && StreamEnd;
+}
+
+bool DeltaPatch::emit(const uint8_t *buf, size_t len) {
+    Produced += len;
+    if (Output(Arg, buf, len)) return true;
+    State = FAILED;
+    return false;
+}
+
+// Add the diff bytes to the old image, and emit the result
+bool DeltaPatch::applyDiff(const uint8_t *buf, size_t len) {
+    uint8_t block[256];
+
+    while (len) {
+        size_t n = len < sizeof(block) ? len : sizeof(block);
+        if (esp_partition_read(OldPartition, OldPos, block, n) != ESP_OK) {
+            _LOG_A("Delta: can not read the running partition at %u.\n", OldPos);
+            State = FAILED;
+            return false;
+        }
+        for (size_t i = 0; i < n; i++) block[i] += buf[i];
+        if (!emit(block, n)) return false;
+        OldPos += n;
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+void DeltaPatch::parseHeader(void) {
+    const uint8_t *sha = runningImageSha256();
+    const esp_partition_t *target = esp_ota_get_next_update_partition(NULL);
+
+    OldSize = getU32(Field + 4);
+    NewSize = getU32(Field + 40);
+    if (getU32(Field) != DELTA_MAGIC) {
+        _LOG_A("Delta: not a delta file.\n");
+        State = FAILED;
+    } else if (!sha || memcmp(sha, Field + 8, 32)) {
+        _LOG_A("Delta: made for another firmware than the running one.\n");
+        State = FAILED;
+    } else if (!OldPartition || OldSize > OldPartition->size || !target || !NewSize || NewSize > target->size) {
+        _LOG_A("Delta: invalid image size %u -> %u.\n", OldSize, NewSize);
+        State = FAILED;
+    } else {
+        _LOG_I("Delta: rebuilding %u byte image from %u byte running image.\n", NewSize, OldSize);
+        State = RECORD;
+    }
+}
+
+void DeltaPatch::parseRecord(void) {
+    DiffLeft = getU32(Field);
+    ExtraLeft = getU32(Field + 4);
+    Seek = (int32_t) getU32(Field + 8);
+    if ((uint64_t) Produced + DiffLeft + ExtraLeft > NewSize || (uint64_t) OldPos + DiffLeft > OldSize) {
+        _LOG_A("Delta: record out of range.\n");
+        State = FAILED;
+    } else if (DiffLeft) State = DIFF;
+    else if (ExtraLeft) State = EXTRA;
+    else nextRecord();
+}
+
+// The diff and extra data of a record are done, move in the old image
+void DeltaPatch::nextRecord(void) {
+    int64_t pos = (int64_t) OldPos + Seek;
+
+    if (pos < 0 || pos > OldSize) {
+        _LOG_A("Delta: seek out of range.\n");
+        State = FAILED;
+        return;
+    }
+    OldPos = pos;
+    State = Produced == NewSize ? DONE : RECORD;
+}
+
+// Parse the inflated data
+bool DeltaPatch::process(const uint8_t *buf, size_t len) {
+    while (len && State != FAILED) {
+        size_t n;
+
+        switch (State) {
+            case HEADER:
+            case RECORD: {
+                uint8_t size = State == HEADER ? DELTA_HEADER_SIZE : DELTA_RECORD_SIZE;
+                n = len < (size_t)(size - FieldLen) ? len : size - FieldLen;
+                memcpy(Field + FieldLen, buf, n);
+                FieldLen += n;
+                if (FieldLen == size) {
+                    FieldLen = 0;
+                    if (State == HEADER) parseHeader();
+                    else parseRecord();
+                }
+                break;
+            }
+            case DIFF:
+                n = len < DiffLeft ? len : DiffLeft;
+                if (!applyDiff(buf, n)) break;
+                DiffLeft -= n;
+                if (!DiffLeft) {
+                    if (ExtraLeft) State = EXTRA;
+                    else nextRecord();
+                }
+                break;
+            case EXTRA:
+                n = len < ExtraLeft ? len : ExtraLeft;
+                if (!emit(buf, n)) break;
+                ExtraLeft -= n;
+                if (!ExtraLeft) nextRecord();
+                break;
+            default:                                                            // DONE, data after the new image
+                _LOG_A("Delta: data after the new image.\n");
+                State = FAILED;
+                n = len;
+                break;
+        }
+        buf += n;
+        len -= n;
+    }
+    return State != FAILED;
+}
+
+#endif
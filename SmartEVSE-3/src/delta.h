@@ -0,0 +1,71 @@
+/*
+ * Delta firmware updates
+ *
+ * A delta file is the 512 byte RSA signature of the new firmware image, followed by a zlib stream that rebuilds
+ * the new image from the running one. It is created with make_delta.py.
+ *
+ * The zlib stream starts with a header:
+ *   magic "SEVD", u32 old image size, 32 byte SHA-256 of the old image (as appended by esp-idf), u32 new image size
+ * followed by records until the new image is complete:
+ *   u32 diff length, u32 extra length, i32 seek
+ *   diff length bytes that are added to the old image at the current old offset,
+ *   extra length bytes that are copied to the new image,
+ *   after which the old offset is moved by seek.
+ * All values are little endian.
+ *
+ * The new image is produced in order, so it can be written to the OTA partition and hashed while it is downloaded.
+ * RAM use is fixed: the inflate state and its 32 KB window, allocated by begin() and freed by end().
+ */
+
+#ifndef __DELTA_H
+#define __DELTA_H
+
+#include <Arduino.h>
+#include "esp_partition.h"
+#include "rom/miniz.h"
+
+#define DELTA_MAGIC         0x44564553                                          // "SEVD"
+#define DELTA_HEADER_SIZE   44
+#define DELTA_RECORD_SIZE   12
+
+class DeltaPatch {
+public:
+    typedef bool (*OutputFn)(void *arg, const uint8_t *buf, size_t len);
+
+    ~DeltaPatch() { end(); }
+
+    bool begin(OutputFn output, void *arg);
+    bool write(const uint8_t *buf, size_t len);
+    bool finish(void);
+    void end(void);
+    uint32_t newSize(void) const { return NewSize; }
+
+private:
+    enum : uint8_t { HEADER, RECORD, DIFF, EXTRA, DONE, FAILED };
+
+    bool process(const uint8_t *buf, size_t len);
+    bool emit(const uint8_t *buf, size_t len);
+    bool applyDiff(const uint8_t *buf, size_t len);
+    void parseHeader(void);
+    void parseRecord(void);
+    void nextRecord(void);
+
+    OutputFn Output = NULL;
+    void *Arg = NULL;
+    tinfl_decompressor *Inflator = NULL;
+    uint8_t *Window = NULL;
+    size_t WindowPos = 0;
+    const esp_partition_t *OldPartition = NULL;
+    uint32_t OldSize = 0, OldPos = 0;
+    uint32_t NewSize = 0, Produced = 0;
+    uint32_t DiffLeft = 0, ExtraLeft = 0;
+    int32_t Seek = 0;
+    uint8_t Field[DELTA_HEADER_SIZE];
+    uint8_t FieldLen = 0;
+    uint8_t State = FAILED;
+    bool StreamEnd = false;
+};
+
+const uint8_t *runningImageSha256(void);
+
+#endif
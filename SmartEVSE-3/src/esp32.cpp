@@ -29,6 +29,7 @@ int solarPowerW = 0;                                                        // S
 
 #include <WiFi.h>
 #include "network_common.h"
+#include "homewizard.h"
 #include "esp_ota_ops.h"
 #include "mbedtls/md_internal.h"
 
@@ -55,6 +56,10 @@ int solarPowerW = 0;                                                        // S
 #include "OneWireESP32.h"
 #include "modbus.h"
 #include "meter.h"
+#include "delta.h"
+#include "session.h"
+#include "settings.h"
+#include "mqtt_command.h"
 
 //OCPP includes
 #if ENABLE_OCPP && defined(SMARTEVSE_VERSION) //run OCPP only on ESP32
@@ -137,66 +142,7 @@ Preferences preferences;
 static bool SettingsDirty = false;                      // Flag indicating settings need to be written
 static unsigned long LastSettingsWriteTime = 0;         // millis() timestamp of last write
 
-// Cache structure for detecting changed values - only write values that actually changed
-struct SettingsCache {
-    uint8_t Config, Lock, Mode, AccessStatus;
-    uint16_t CardOffset;
-    uint32_t DelayedStartTime, DelayedStopTime;
-    uint16_t DelayedRepeat;
-    uint8_t LoadBl;
-    uint16_t MaxMains, MaxSumMains, MaxSumMainsTime, MaxCurrent, MinCurrent, MaxCircuit;
-    uint8_t Switch, RCmon;
-    uint16_t StartCurrent, StopTime, ImportCurrent;
-    uint8_t Grid, SB2_WIFImode, RFIDReader;
-    uint8_t MainsMeterType, MainsMeterAddress, EVMeterType, EVMeterAddress, CircuitMeterType, CircuitMeterAddress;
-    char MainsMeterDeviceHostName[32];
-    char EVMeterDeviceHostName[32];
-    char CircuitMeterDeviceHostName[32];
-    uint8_t EMEndianness, EMIDivisor, EMUDivisor, EMPDivisor, EMEDivisor, EMDataType, EMFunction;
-    uint16_t EMIRegister, EMURegister, EMPRegister, EMERegister;
-    uint8_t WIFImode;
-    uint8_t CapacityMode;
-    uint16_t EnableC2;
-    char intervals_json[128];
-#if MODEM
-    char RequiredEVCCID[32];
-#endif
-    uint16_t maxTemp;
-    uint8_t AutoUpdate, LCDlock, CableLock;
-    uint16_t LCDPin;
-    bool MQTTSmartServer;
-    uint8_t LedMode;
-#if ENABLE_OCPP && defined(SMARTEVSE_VERSION)
-    uint8_t OcppMode;
-#endif
-    bool valid;  // True once cache is populated from read_settings()
-};
-static SettingsCache settingsCache = {};
-
-// Macros to only write if value changed
-#define PREFS_PUT_UCHAR_IF_CHANGED(key, value, cacheVar) \
-    if (!settingsCache.valid || (value) != settingsCache.cacheVar) { \
-        preferences.putUChar(key, value); \
-        settingsCache.cacheVar = (value); \
-    }
-
-#define PREFS_PUT_USHORT_IF_CHANGED(key, value, cacheVar) \
-    if (!settingsCache.valid || (value) != settingsCache.cacheVar) { \
-        preferences.putUShort(key, value); \
-        settingsCache.cacheVar = (value); \
-    }
-
-#define PREFS_PUT_ULONG_IF_CHANGED(key, value, cacheVar) \
-    if (!settingsCache.valid || (value) != settingsCache.cacheVar) { \
-        preferences.putULong(key, value); \
-        settingsCache.cacheVar = (value); \
-    }
-
-#define PREFS_PUT_BOOL_IF_CHANGED(key, value, cacheVar) \
-    if (!settingsCache.valid || (value) != settingsCache.cacheVar) { \
-        preferences.putBool(key, value); \
-        settingsCache.cacheVar = (value); \
-    }
+static bool SettingsLoaded = false;                                             // the settings store is filled by read_settings()
 
 uint16_t LCDPin = 0;                                                        // PINcode to operate LCD keys from web-interface
 uint8_t PIN_SW_IN, PIN_ACTA, PIN_ACTB, PIN_RCM_FAULT, PIN_RS485_RX; //these pins have to be assigned dynamically because of hw version v3.1
@@ -616,342 +562,426 @@ void writeMqttCaCert(const String& cert) {
 }
 
 #if MQTT
-void mqtt_receive_callback(const String topic, const String payload) {
-    if (topic == MQTTprefix + "/Set/Mode") {
-        if (payload == "Off") {
-#if SMARTEVSE_VERSION >=40 //v4            
-            Serial1.printf("@ResetModemTimers\n");
-#endif            
-            setAccess(OFF);
-        } else if (payload == "Normal") {
-            setMode(MODE_NORMAL);
-        } else if (payload == "Solar") {
-            setOverrideCurrent(0);
-            setMode(MODE_SOLAR);
-        } else if (payload == "Smart") {
-            setMode(MODE_SMART);
-        } else if (payload == "Pause") {
-            setAccess(PAUSE);
-        }
-    } else if (topic == MQTTprefix + "/Set/CustomButton") {
-        if (payload == "On") {
-            CustomButton = true;
-        } else {
-            CustomButton = false;
-        }
-    } else if (topic == MQTTprefix + "/Set/CurrentOverride") {
-        uint16_t RequestedCurrent = payload.toInt();
-        if (RequestedCurrent == 0) {
-            setOverrideCurrent(0);
-        } else if (LoadBl < 2 && (Mode == MODE_NORMAL || Mode == MODE_SMART)) { // OverrideCurrent not possible on Slave
-            if (RequestedCurrent >= (MinCurrent * 10) && RequestedCurrent <= (MaxCurrent * 10)) {
-                setOverrideCurrent(RequestedCurrent);
-            }
-        }
-    } else if (topic == MQTTprefix + "/Set/CurrentMaxSumMains" && LoadBl < 2) {
-        uint16_t RequestedCurrent = payload.toInt();
-        if (RequestedCurrent == 0) {
-            MaxSumMains = 0;
-        } else if (RequestedCurrent == 0 || (RequestedCurrent >= 10 && RequestedCurrent <= 600)) {
-                MaxSumMains = RequestedCurrent;
-        }
-    } else if (topic == MQTTprefix + "/Set/CPPWMOverride") {
-        int pwm = payload.toInt();
-        if (pwm == -1) {
-            SetCPDuty(1024);
-            PILOT_CONNECTED;
-            CPDutyOverride = false;
-        } else if (pwm == 0) {
-            SetCPDuty(0);
-            PILOT_DISCONNECTED;
-            CPDutyOverride = true;
-        } else if (pwm <= 1024) {
-            SetCPDuty(pwm);
-            PILOT_CONNECTED;
-            CPDutyOverride = true;
+// The handlers of the /Set/ commands, see mqtt_command.h; they return false when they reject the payload
+
+static bool mqttSetColor(uint8_t *Color, const char *payload, size_t len) {
+    int32_t RGB[3];
+
+    // R,G,B is between 0..255
+    if (mqttParseList(payload, len, ',', RGB, 3) == 3 && (RGB[0] >= 0 && RGB[0] < 256) && (RGB[1] >= 0 && RGB[1] < 256) && (RGB[2] >= 0 && RGB[2] < 256)) {
+        Color[0] = RGB[0];
+        Color[1] = RGB[1];
+        Color[2] = RGB[2];
+        return true;
+    }
+    return false;
+}
+
+static bool mqttSetMode(const char *payload, size_t len) {
+    if (mqttIs(payload, len, "Off")) {
+#if SMARTEVSE_VERSION >=40 //v4
+        Serial1.printf("@ResetModemTimers\n");
+#endif
+        setAccess(OFF);
+    } else if (mqttIs(payload, len, "Normal")) {
+        setMode(MODE_NORMAL);
+    } else if (mqttIs(payload, len, "Solar")) {
+        setOverrideCurrent(0);
+        setMode(MODE_SOLAR);
+    } else if (mqttIs(payload, len, "Smart")) {
+        setMode(MODE_SMART);
+    } else if (mqttIs(payload, len, "Pause")) {
+        setAccess(PAUSE);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool mqttSetCustomButton(const char *payload, size_t len) {
+    CustomButton = mqttIs(payload, len, "On");
+    return true;
+}
+
+static bool mqttSetCurrentOverride(const char *payload, size_t len) {
+    uint16_t RequestedCurrent = mqttToInt(payload, len);
+    if (RequestedCurrent == 0) {
+        setOverrideCurrent(0);
+    } else if (LoadBl < 2 && (Mode == MODE_NORMAL || Mode == MODE_SMART)) { // OverrideCurrent not possible on Slave
+        if (RequestedCurrent >= (MinCurrent * 10) && RequestedCurrent <= (MaxCurrent * 10)) {
+            setOverrideCurrent(RequestedCurrent);
+            return true;
         }
-    } else if (topic == MQTTprefix + "/Set/MainsMeter") {
-        if (MainsMeter.Type != EM_API || LoadBl >= 2)
-            return;
+    }
+    return RequestedCurrent == 0;
+}
+
+static bool mqttSetCurrentMaxSumMains(const char *payload, size_t len) {
+    if (LoadBl >= 2)
+        return false;
+    uint16_t RequestedCurrent = mqttToInt(payload, len);
+    if (RequestedCurrent == 0 || (RequestedCurrent >= 10 && RequestedCurrent <= 600)) {
+        MaxSumMains = RequestedCurrent;
+        return true;
+    }
+    return false;
+}
 
-        int32_t L1, L2, L3, W, WH;
-        int n = sscanf(payload.c_str(), "%d:%d:%d:%d:%d", &L1, &L2, &L3, &W, &WH);
+static bool mqttSetCPPWMOverride(const char *payload, size_t len) {
+    int pwm = mqttToInt(payload, len);
+    if (pwm == -1) {
+        SetCPDuty(1024);
+        PILOT_CONNECTED;
+        CPDutyOverride = false;
+    } else if (pwm == 0) {
+        SetCPDuty(0);
+        PILOT_DISCONNECTED;
+        CPDutyOverride = true;
+    } else if (pwm <= 1024) {
+        SetCPDuty(pwm);
+        PILOT_CONNECTED;
+        CPDutyOverride = true;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool mqttSetMainsMeter(const char *payload, size_t len) {
+    if (MainsMeter.Type != EM_API || LoadBl >= 2)
+        return false;
 
-        // MainsMeter can measure -200A to +200A per phase
-        if ((n == 3 || n == 5) && (L1 > -2000 && L1 < 2000) && (L2 > -2000 && L2 < 2000) && (L3 > -2000 && L3 < 2000)) {
+    int32_t val[5];
+    uint8_t n = mqttParseList(payload, len, ':', val, 5);
+    int32_t L1 = val[0], L2 = val[1], L3 = val[2];
+
+    // MainsMeter can measure -200A to +200A per phase
+    if ((n == 3 || n == 5) && (L1 > -2000 && L1 < 2000) && (L2 > -2000 && L2 < 2000) && (L3 > -2000 && L3 < 2000)) {
 #if SMARTEVSE_VERSION < 40 //v3
-            // We expect 5 values (and accept -1 for unknown values)
-            if (LoadBl < 2) {
-                MainsMeter.setTimeout(COMM_TIMEOUT);
-                MainsMeter.Irms[0] = L1;
-                MainsMeter.Irms[1] = L2;
-                MainsMeter.Irms[2] = L3;
-                CalcIsum();
+        // We expect 5 values (and accept -1 for unknown values)
+        MainsMeter.setTimeout(COMM_TIMEOUT);
+        MainsMeter.Irms[0] = L1;
+        MainsMeter.Irms[1] = L2;
+        MainsMeter.Irms[2] = L3;
+        CalcIsum();
+        if (n == 5) {
+            int32_t W = val[3], WH = val[4];
+            if (W > -1) {
+                // Power measurement
+                MainsMeter.PowerMeasured = W;
             }
-            if (n == 5) {
-                if (W > -1) {
-                    // Power measurement
-    #if SMARTEVSE_VERSION < 40 //v3
-                    MainsMeter.PowerMeasured = W;
-    #else //v4
-                    Serial1.printf("@PowerMeasured:%03u,%d\n", MainsMeter.Address, W);
-    #endif
-                }
 
-                if (WH > -1) {
-                    // Energy measurement;  //we dont send the energies to CH32 because they are not used there
-                    MainsMeter.Import_active_energy = WH;
-                    MainsMeter.Export_active_energy = 0;
-                    MainsMeter.UpdateEnergies();
-                    MainsMeter.UpdateCapacity();
-                    MainsMeter.UpdatePower();
-                }
+            if (WH > -1) {
+                // Energy measurement;  //we dont send the energies to CH32 because they are not used there
+                MainsMeter.Import_active_energy = WH;
+                MainsMeter.Export_active_energy = 0;
+                MainsMeter.UpdateEnergies();
+                MainsMeter.UpdateCapacity();
+                MainsMeter.UpdatePower();
             }
+        }
 #else //v4
-            Serial1.printf("@Irms:%03u,%d,%d,%d\n", MainsMeter.Address, L1, L2, L3); //Irms:011,312,123,124 means: the meter on address 11(dec) has Irms[0] 312 dA, Irms[1] of 123 dA, Irms[2] of 124 dA
+        Serial1.printf("@Irms:%03u,%d,%d,%d\n", MainsMeter.Address, L1, L2, L3); //Irms:011,312,123,124 means: the meter on address 11(dec) has Irms[0] 312 dA, Irms[1] of 123 dA, Irms[2] of 124 dA
 #endif
-        }
-    } else if (topic == MQTTprefix + "/Set/EVMeter") {
-        if (EVMeter.Type != EM_API)
-            return;
+        return true;
+    }
+    return false;
+}
+
+static bool mqttSetEVMeter(const char *payload, size_t len) {
+    if (EVMeter.Type != EM_API)
+        return false;
 
-        int32_t L1, L2, L3, W, WH;
-        int n = sscanf(payload.c_str(), "%d:%d:%d:%d:%d", &L1, &L2, &L3, &W, &WH);
+    int32_t val[5];
+    // We expect 5 values (and accept -1 for unknown values)
+    if (mqttParseList(payload, len, ':', val, 5) != 5)
+        return false;
+    int32_t L1 = val[0], L2 = val[1], L3 = val[2], W = val[3], WH = val[4];
 
-        // We expect 5 values (and accept -1 for unknown values)
-        if (n == 5) {
-            if ((L1 > -1 && L1 < 1000) && (L2 > -1 && L2 < 1000) && (L3 > -1 && L3 < 1000)) {
+    if ((L1 > -1 && L1 < 1000) && (L2 > -1 && L2 < 1000) && (L3 > -1 && L3 < 1000)) {
 #if SMARTEVSE_VERSION < 40 //v3
-                // RMS currents
-                EVMeter.Irms[0] = L1;
-                EVMeter.Irms[1] = L2;
-                EVMeter.Irms[2] = L3;
-                EVMeter.CalcImeasured();
-                EVMeter.Timeout = COMM_EVTIMEOUT;
+        // RMS currents
+        EVMeter.Irms[0] = L1;
+        EVMeter.Irms[1] = L2;
+        EVMeter.Irms[2] = L3;
+        EVMeter.CalcImeasured();
+        EVMeter.Timeout = COMM_EVTIMEOUT;
 #else //v4
-                Serial1.printf("@Irms:%03u,%d,%d,%d\n", EVMeter.Address, L1, L2, L3); //Irms:011,312,123,124 means: the meter on address 11(dec) has Irms[0] 312 dA, Irms[1] of 123 dA, Irms[2] of 124 dA
+        Serial1.printf("@Irms:%03u,%d,%d,%d\n", EVMeter.Address, L1, L2, L3); //Irms:011,312,123,124 means: the meter on address 11(dec) has Irms[0] 312 dA, Irms[1] of 123 dA, Irms[2] of 124 dA
 #endif
-            }
+    }
 
-            if (W > -1) {
-                // Power measurement
+    if (W > -1) {
+        // Power measurement
 #if SMARTEVSE_VERSION < 40 //v3
-                EVMeter.PowerMeasured = W;
+        EVMeter.PowerMeasured = W;
 #else //v4
-                Serial1.printf("@PowerMeasured:%03u,%d\n", EVMeter.Address, W);
+        Serial1.printf("@PowerMeasured:%03u,%d\n", EVMeter.Address, W);
 #endif
-            }
+    }
 
-            if (WH > -1) {
-                // Energy measurement;  //we dont send the energies to CH32 because they are not used there
-                EVMeter.Import_active_energy = WH;
-                EVMeter.Export_active_energy = 0;
-                EVMeter.UpdateEnergies();
-            }
-        }
-    } else if (topic == MQTTprefix + "/Set/CircuitMeter") {
-        if (CircuitMeter.Type != EM_API)
-            return;
+    if (WH > -1) {
+        // Energy measurement;  //we dont send the energies to CH32 because they are not used there
+        EVMeter.Import_active_energy = WH;
+        EVMeter.Export_active_energy = 0;
+        EVMeter.UpdateEnergies();
+    }
+    return true;
+}
+
+static bool mqttSetCircuitMeter(const char *payload, size_t len) {
+    if (CircuitMeter.Type != EM_API)
+        return false;
 
-        int32_t L1, L2, L3;
-        int n = sscanf(payload.c_str(), "%d:%d:%d", &L1, &L2, &L3);
+    int32_t val[3];
+    uint8_t n = mqttParseList(payload, len, ':', val, 3);
+    int32_t L1 = val[0], L2 = val[1], L3 = val[2];
 
-        // We expect 3 values
-        if ((n == 3) && (L1 > -2000 && L1 < 2000) && (L2 > -2000 && L2 < 2000) && (L3 > -2000 && L3 < 2000)) {
+    // We expect 3 values
+    if ((n == 3) && (L1 > -2000 && L1 < 2000) && (L2 > -2000 && L2 < 2000) && (L3 > -2000 && L3 < 2000)) {
 #if SMARTCircuitSE_VERSION < 40 //v3
-                // RMS currents
-                CircuitMeter.Irms[0] = L1;
-                CircuitMeter.Irms[1] = L2;
-                CircuitMeter.Irms[2] = L3;
-                CircuitMeter.CalcImeasured();
-                CircuitMeter.Timeout = COMM_TIMEOUT;
+        // RMS currents
+        CircuitMeter.Irms[0] = L1;
+        CircuitMeter.Irms[1] = L2;
+        CircuitMeter.Irms[2] = L3;
+        CircuitMeter.CalcImeasured();
+        CircuitMeter.Timeout = COMM_TIMEOUT;
 #else //v4
-                Serial1.printf("@Irms:%03u,%d,%d,%d\n", CircuitMeter.Address, L1, L2, L3); //Irms:011,312,123,124 means: the meter on address 11(dec) has Irms[0] 312 dA, Irms[1] of 123 dA, Irms[2] of 124 dA
+        Serial1.printf("@Irms:%03u,%d,%d,%d\n", CircuitMeter.Address, L1, L2, L3); //Irms:011,312,123,124 means: the meter on address 11(dec) has Irms[0] 312 dA, Irms[1] of 123 dA, Irms[2] of 124 dA
 #endif
-        }
-    } else if (topic == MQTTprefix + "/Set/HomeBatteryCurrent") {
-        if (LoadBl >= 2)
-            return;
-        homeBatteryCurrent = payload.toInt();
-        homeBatteryLastUpdate = time(NULL);
+        return true;
+    }
+    return false;
+}
+
+static bool mqttSetHomeBatteryCurrent(const char *payload, size_t len) {
+    if (LoadBl >= 2)
+        return false;
+    homeBatteryCurrent = mqttToInt(payload, len);
+    homeBatteryLastUpdate = time(NULL);
 #if SMARTEVSE_VERSION >= 40
-        SEND_TO_CH32(homeBatteryCurrent); //we set homeBatteryLastUpdate on CH32 on receipt
+    SEND_TO_CH32(homeBatteryCurrent); //we set homeBatteryLastUpdate on CH32 on receipt
 #endif
-    } else if (topic == MQTTprefix + "/Set/HomeBatterySoc") {
-        // Set home battery State of Charge (0-100%)
-        int8_t soc = payload.toInt();
-        if (soc >= 0 && soc <= 100) {
-            homeBatterySoc = soc;
+    return true;
+}
+
+static bool mqttSetHomeBatterySoc(const char *payload, size_t len) {
+    // Set home battery State of Charge (0-100%)
+    int8_t soc = mqttToInt(payload, len);
+    if (soc >= 0 && soc <= 100) {
+        homeBatterySoc = soc;
 #if SMARTEVSE_VERSION >= 40
-            SEND_TO_CH32(homeBatterySoc); // CH32 uses it for the battery threshold gate
+        SEND_TO_CH32(homeBatterySoc); // CH32 uses it for the battery threshold gate
 #endif
-        }
-    } else if (topic == MQTTprefix + "/Set/HomeBatterySoCThreshold") {
-        // Set home battery SoC threshold (0-100%) above which the car may start charging in SOLAR mode
-        int8_t threshold = payload.toInt();
-        if (threshold >= 0 && threshold <= 100) {
-            homeBatterySoCThreshold = threshold;
+        return true;
+    }
+    return false;
+}
+
+static bool mqttSetHomeBatterySoCThreshold(const char *payload, size_t len) {
+    // Set home battery SoC threshold (0-100%) above which the car may start charging in SOLAR mode
+    int8_t threshold = mqttToInt(payload, len);
+    if (threshold >= 0 && threshold <= 100) {
+        homeBatterySoCThreshold = threshold;
 #if SMARTEVSE_VERSION >= 40
-            SEND_TO_CH32(homeBatterySoCThreshold);
+        SEND_TO_CH32(homeBatterySoCThreshold);
 #endif
-        }
-    } else if (topic == MQTTprefix + "/Set/HomeBatteryThresholdEnabled") {
-        // Enable/disable the home battery SoC threshold gate (only applies in SOLAR mode)
-        if (payload == "0" || payload == "false") {
-            homeBatteryThresholdEnabled = false;
+        return true;
+    }
+    return false;
+}
+
+static bool mqttSetHomeBatteryThresholdEnabled(const char *payload, size_t len) {
+    // Enable/disable the home battery SoC threshold gate (only applies in SOLAR mode)
+    if (mqttIs(payload, len, "0") || mqttIs(payload, len, "false")) {
+        homeBatteryThresholdEnabled = false;
 #if SMARTEVSE_VERSION >= 40
-            SEND_TO_CH32(homeBatteryThresholdEnabled);
+        SEND_TO_CH32(homeBatteryThresholdEnabled);
 #endif
-        } else if (payload == "1" || payload == "true") {
-            homeBatteryThresholdEnabled = true;
+    } else if (mqttIs(payload, len, "1") || mqttIs(payload, len, "true")) {
+        homeBatteryThresholdEnabled = true;
 #if SMARTEVSE_VERSION >= 40
-            SEND_TO_CH32(homeBatteryThresholdEnabled);
+        SEND_TO_CH32(homeBatteryThresholdEnabled);
 #endif
-        }
-    } else if (topic == MQTTprefix + "/Set/EVSoC") {
-        // Set EV/car battery State of Charge (0-100%)
-        int8_t soc = payload.toInt();
-        if (soc >= 0 && soc <= 100) {
-            evSoc = soc;
-        }
-    } else if (topic == MQTTprefix + "/Set/SolarPower") {
-        // Set solar power in Watts (can be negative for export, positive for import)
-        solarPowerW = payload.toInt();
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool mqttSetEVSoC(const char *payload, size_t len) {
+    // Set EV/car battery State of Charge (0-100%)
+    int8_t soc = mqttToInt(payload, len);
+    if (soc >= 0 && soc <= 100) {
+        evSoc = soc;
+        return true;
+    }
+    return false;
+}
+
+static bool mqttSetSolarPower(const char *payload, size_t len) {
+    // Set solar power in Watts (can be negative for export, positive for import)
+    solarPowerW = mqttToInt(payload, len);
+    return true;
+}
+
 #if MODEM
-    } else if (topic == MQTTprefix + "/Set/RequiredEVCCID") {
-        strncpy(RequiredEVCCID, payload.c_str(), sizeof(RequiredEVCCID));
-        Serial1.printf("@RequiredEVCCID:%s\n", RequiredEVCCID);
-        request_write_settings();
+static bool mqttSetRequiredEVCCID(const char *payload, size_t len) {
+    if (len >= sizeof(RequiredEVCCID)) len = sizeof(RequiredEVCCID) - 1;
+    memcpy(RequiredEVCCID, payload, len);
+    RequiredEVCCID[len] = '\0';
+    Serial1.printf("@RequiredEVCCID:%s\n", RequiredEVCCID);
+    request_write_settings();
+    return true;
+}
 #endif
-    } else if (topic == MQTTprefix + "/Set/ColorOff") {
-        int32_t R, G, B;
-        int n = sscanf(payload.c_str(), "%d,%d,%d", &R, &G, &B);
-
-        // R,G,B is between 0..255
-        if (n == 3 && (R >= 0 && R < 256) && (G >= 0 && G < 256) && (B >= 0 && B < 256)) {
-            ColorOff[0] = R;
-            ColorOff[1] = G;
-            ColorOff[2] = B;
-        }
-    } else if (topic == MQTTprefix + "/Set/ColorNormal") {
-        int32_t R, G, B;
-        int n = sscanf(payload.c_str(), "%d,%d,%d", &R, &G, &B);
-
-        // R,G,B is between 0..255
-        if (n == 3 && (R >= 0 && R < 256) && (G >= 0 && G < 256) && (B >= 0 && B < 256)) {
-            ColorNormal[0] = R;
-            ColorNormal[1] = G;
-            ColorNormal[2] = B;
-        }
-    } else if (topic == MQTTprefix + "/Set/ColorSmart") {
-        int32_t R, G, B;
-        int n = sscanf(payload.c_str(), "%d,%d,%d", &R, &G, &B);
-
-        // R,G,B is between 0..255
-        if (n == 3 && (R >= 0 && R < 256) && (G >= 0 && G < 256) && (B >= 0 && B < 256)) {
-            ColorSmart[0] = R;
-            ColorSmart[1] = G;
-            ColorSmart[2] = B;
-        }
-    } else if (topic == MQTTprefix + "/Set/ColorSolar") {
-        int32_t R, G, B;
-        int n = sscanf(payload.c_str(), "%d,%d,%d", &R, &G, &B);
-
-        // R,G,B is between 0..255
-        if (n == 3 && (R >= 0 && R < 256) && (G >= 0 && G < 256) && (B >= 0 && B < 256)) {
-            ColorSolar[0] = R;
-            ColorSolar[1] = G;
-            ColorSolar[2] = B;
-        }
-    } else if (topic == MQTTprefix + "/Set/ColorCustom") {
-        int32_t R, G, B;
-        int n = sscanf(payload.c_str(), "%d,%d,%d", &R, &G, &B);
-
-        // R,G,B is between 0..255
-        if (n == 3 && (R >= 0 && R < 256) && (G >= 0 && G < 256) && (B >= 0 && B < 256)) {
-            ColorCustom[0] = R;
-            ColorCustom[1] = G;
-            ColorCustom[2] = B;
-        }
-    } else if (topic == MQTTprefix + "/Set/CableLock") {
-        if (payload == "1") {
-            CableLock = 1;
-        } else {
-            CableLock = 0;
+
+static bool mqttSetColorOff(const char *payload, size_t len) { return mqttSetColor(ColorOff, payload, len); }
+static bool mqttSetColorNormal(const char *payload, size_t len) { return mqttSetColor(ColorNormal, payload, len); }
+static bool mqttSetColorSmart(const char *payload, size_t len) { return mqttSetColor(ColorSmart, payload, len); }
+static bool mqttSetColorSolar(const char *payload, size_t len) { return mqttSetColor(ColorSolar, payload, len); }
+static bool mqttSetColorCustom(const char *payload, size_t len) { return mqttSetColor(ColorCustom, payload, len); }
+
+static bool mqttSetCableLock(const char *payload, size_t len) {
+    CableLock = mqttIs(payload, len, "1") ? 1 : 0;
+    request_write_settings();
+    return true;
+}
+
+static bool mqttSetEnableC2(const char *payload, size_t len) {
+    // for backwards compatibility we accept both 0-4 as string argument:
+    //{ "Not present", "Always Off", "Solar Off", "Always On", "Auto" }
+    uint8_t value;
+    if (len && isdigit(payload[0])) {
+        value = mqttToInt(payload, len);
+    } else {
+        for (value = 0; value < 5; value++) {
+            if (mqttIs(payload, len, StrEnableC2[value])) break;
         }
-        request_write_settings();
-    } else if (topic == MQTTprefix + "/Set/EnableC2") {
-        // for backwards compatibility we accept both 0-4 as string argument:
-        //{ "Not present", "Always Off", "Solar Off", "Always On", "Auto" }
-        uint8_t value;
-        if (isdigit(payload[0])) {
-            value = payload.toInt();
-            if (value <=4) { //value is always >=0 because unsigned
-                EnableC2 = (EnableC2_t) value;
-            }
-        } else {
-            bool found=false;
-            for (value=0; value<5; value++)
-                if (payload == StrEnableC2[value]) {
-                    found = true;
-                    break;
-                }
-            if (found)
-                EnableC2 = (EnableC2_t) value;
+    }
+    if (value > 4)                                                              // value is always >=0 because unsigned
+        return false;
+    EnableC2 = (EnableC2_t) value;
+    request_write_settings();
+    return true;
+}
+
+static uint8_t mqttHexNibble(char c) {
+    return (c <= '9') ? c - '0' : (c | 0x20) - 'a' + 10;
+}
+
+static bool mqttSetRFID(const char *payload, size_t len) {
+    // Accept RFID card via MQTT to start/stop session
+    // Payload should be hex string: 12 or 14 characters for 6 or 7 byte UID
+    // Examples: "010203040506" (6 bytes) or "01020304050607" (7 bytes)
+    uint8_t RFIDReader = getItemValue(MENU_RFIDREADER);
+    if (!RFIDReader) {
+        _LOG_A("RFID reader not enabled, ignoring MQTT RFID\n");
+        return false;
+    }
+
+    // trim whitespace
+    while (len && isspace(*payload)) { payload++; len--; }
+    while (len && isspace(payload[len - 1])) len--;
+
+    // Check if payload is valid hex and correct length
+    for (size_t i = 0; i < len; i++) {
+        if (!isxdigit(payload[i])) {
+            _LOG_A("Invalid RFID hex string received via MQTT: %.*s\n", (int) len, payload);
+            return false;
         }
-        request_write_settings();
-    } else if (topic == MQTTprefix + "/Set/RFID") {
-        // Accept RFID card via MQTT to start/stop session
-        // Payload should be hex string: 12 or 14 characters for 6 or 7 byte UID
-        // Examples: "010203040506" (6 bytes) or "01020304050607" (7 bytes)
-        uint8_t RFIDReader = getItemValue(MENU_RFIDREADER);
-        if (!RFIDReader) {
-            _LOG_A("RFID reader not enabled, ignoring MQTT RFID\n");
-        } else {
-            String hexString = payload;
-            hexString.trim();
+    }
 
-            // Check if payload is valid hex and correct length
-            bool validHex = true;
-            for (size_t i = 0; i < hexString.length(); i++) {
-                if (!isxdigit(hexString[i])) {
-                    validHex = false;
-                    break;
-                }
-            }
+    if (len != 12 && len != 14) {
+        _LOG_A("Invalid RFID length received via MQTT (expected 12 or 14 hex chars): %.*s\n", (int) len, payload);
+        return false;
+    }
 
-            if (!validHex) {
-                _LOG_A("Invalid RFID hex string received via MQTT: %s\n", hexString.c_str());
-            } else if (hexString.length() == 12 || hexString.length() == 14) {
-                // Parse hex string into RFID array
-                memset(RFID, 0, 8);
+    // Parse hex string into RFID array
+    memset(RFID, 0, 8);
+    // 6 byte UID (old reader format) starts at RFID[1], 7 byte UID (new reader format) at RFID[0]
+    uint8_t offset = (len == 12) ? 1 : 0;
+    if (offset) RFID[0] = 0x01;                                                 // Family code for old reader
+    for (size_t i = 0; i < len / 2; i++) {
+        RFID[i + offset] = (mqttHexNibble(payload[i * 2]) << 4) | mqttHexNibble(payload[i * 2 + 1]);
+    }
+    RFID[7] = crc8((unsigned char *)RFID, 7);
 
-                if (hexString.length() == 12) {
-                    // 6 byte UID (old reader format, starts at RFID[1])
-                    RFID[0] = 0x01; // Family code for old reader
-                    for (int i = 0; i < 6; i++) {
-                        RFID[i + 1] = (uint8_t)strtol(hexString.substring(i * 2, i * 2 + 2).c_str(), NULL, 16);
-                    }
-                    RFID[7] = crc8((unsigned char *)RFID, 7);
-                } else {
-                    // 7 byte UID (new reader format)
-                    for (int i = 0; i < 7; i++) {
-                        RFID[i] = (uint8_t)strtol(hexString.substring(i * 2, i * 2 + 2).c_str(), NULL, 16);
-                    }
-                    RFID[7] = crc8((unsigned char *)RFID, 7);
-                }
+    _LOG_A("RFID received via MQTT: %.*s\n", (int) len, payload);
 
-                _LOG_A("RFID received via MQTT: %s\n", hexString.c_str());
+    // Reset RFIDstatus so CheckRFID processes the card as new
+    RFIDstatus = 0;
 
-                // Reset RFIDstatus so CheckRFID processes the card as new
-                RFIDstatus = 0;
+    // Process RFID using existing logic (whitelist check, OCPP, etc.)
+    CheckRFID();
+    return true;
+}
 
-                // Process RFID using existing logic (whitelist check, OCPP, etc.)
-                CheckRFID();
-            } else {
-                _LOG_A("Invalid RFID length received via MQTT (expected 12 or 14 hex chars): %s\n", hexString.c_str());
-            }
-        }
+// Meter feeds are expected every second or so; more than 4 per second is a misbehaving feeder.
+// RFID swipes are debounced, so a retained or repeated message does not start and then stop a session.
+static const MqttCommand MqttCommands[] = {
+    MQTT_CMD(Mode, 0),
+    MQTT_CMD(CustomButton, 0),
+    MQTT_CMD(CurrentOverride, 0),
+    MQTT_CMD(CurrentMaxSumMains, 0),
+    MQTT_CMD(CPPWMOverride, 0),
+    MQTT_CMD(MainsMeter, 250),
+    MQTT_CMD(EVMeter, 250),
+    MQTT_CMD(CircuitMeter, 250),
+    MQTT_CMD(HomeBatteryCurrent, 250),
+    MQTT_CMD(HomeBatterySoc, 0),
+    MQTT_CMD(HomeBatterySoCThreshold, 0),
+    MQTT_CMD(HomeBatteryThresholdEnabled, 0),
+    MQTT_CMD(EVSoC, 0),
+    MQTT_CMD(SolarPower, 250),
+#if MODEM
+    MQTT_CMD(RequiredEVCCID, 0),
+#endif
+    MQTT_CMD(ColorOff, 0),
+    MQTT_CMD(ColorNormal, 0),
+    MQTT_CMD(ColorSmart, 0),
+    MQTT_CMD(ColorSolar, 0),
+    MQTT_CMD(ColorCustom, 0),
+    MQTT_CMD(CableLock, 0),
+    MQTT_CMD(EnableC2, 0),
+    MQTT_CMD(RFID, 2000),
+};
+
+#define MQTT_CMD_COUNT (sizeof(MqttCommands) / sizeof(MqttCommands[0]))
+static_assert(MQTT_CMD_COUNT <= MQTT_CMD_MAX, "raise MQTT_CMD_SLOTS");
+
+static MqttCommands_t MqttDispatcher(MqttCommands, MQTT_CMD_COUNT);
+
+static void mqttAnnounce(bool force);
+
+void mqtt_receive_callback(const char *topic, size_t topic_len, const char *payload, size_t payload_len) {
+    const size_t prefix_len = MQTTprefix.length();
+
+    // Home Assistant (re)started, and might have lost our retained discovery configs
+    if (mqttIs(topic, topic_len, "homeassistant/status")) {
+        if (mqttIs(payload, payload_len, "online")) mqttAnnounce(true);
+        return;
+    }
+
+    // strip "<MQTTprefix>/Set/" once
+    if (topic_len <= prefix_len + 5 || memcmp(topic, MQTTprefix.c_str(), prefix_len) || memcmp(topic + prefix_len, "/Set/", 5))
+        return;
+    const char *suffix = topic + prefix_len + 5;
+    const size_t suffix_len = topic_len - prefix_len - 5;
+
+    const MqttCommand *cmd;
+    switch (MqttDispatcher.dispatch(suffix, suffix_len, payload, payload_len, millis(), &cmd)) {
+        case MQTT_CMD_UNKNOWN:
+            _LOG_D("MQTT: unknown command %.*s\n", (int) suffix_len, suffix);
+            return;
+        case MQTT_CMD_LIMITED:
+            _LOG_D("MQTT: rate limited %s\n", cmd->suffix);
+            return;
+        case MQTT_CMD_REJECTED:
+            _LOG_D("MQTT: rejected %s %.*s\n", cmd->suffix, (int) payload_len, payload);
+            return;
+        case MQTT_CMD_ACCEPTED:
+            break;
     }
 
     // Make sure MQTT updates directly to prevent debounces
@@ -969,240 +999,210 @@ void printRFID(char *buf) {
 }
 
 
-void SetupMQTTClient() {
-    // Set up subscriptions
-    MQTTclient.subscribe(MQTTprefix + "/Set/#",1);
-    MQTTclient.publish(MQTTprefix+"/connected", "online", true, 0);
-
-    //set the parameters for and announce sensors with device class 'current':
-    String optional_payload = MQTTclient.jsna("device_class","current") + MQTTclient.jsna("state_class","measurement") + MQTTclient.jsna("unit_of_measurement","A") + MQTTclient.jsna("value_template", R"({{ value | int / 10 }})");
-    MQTTclient.announce("Charge Current", "sensor", optional_payload);
-    MQTTclient.announce("Max Current", "sensor", optional_payload);
-    if (MainsMeter.Type) {
-        MQTTclient.announce("Mains Current L1", "sensor", optional_payload);
-        MQTTclient.announce("Mains Current L2", "sensor", optional_payload);
-        MQTTclient.announce("Mains Current L3", "sensor", optional_payload);
-    }
-    if (EVMeter.Type) {
-        MQTTclient.announce("EV Current L1", "sensor", optional_payload);
-        MQTTclient.announce("EV Current L2", "sensor", optional_payload);
-        MQTTclient.announce("EV Current L3", "sensor", optional_payload);
-    }
-    if (CircuitMeter.Type) {
-        MQTTclient.announce("Circuit Current L1", "sensor", optional_payload);
-        MQTTclient.announce("Circuit Current L2", "sensor", optional_payload);
-        MQTTclient.announce("Circuit Current L3", "sensor", optional_payload);
-    }
-    if (homeBatteryLastUpdate) {
-        MQTTclient.announce("Home Battery Current", "sensor", optional_payload);
-    }
-	optional_payload = MQTTclient.jsna("device_class","current") + MQTTclient.jsna("state_class","measurement") + MQTTclient.jsna("unit_of_measurement","A");
-	MQTTclient.announce("Max Sum Mains", "sensor", optional_payload);
-
+#define MQTT_CURRENT        R"(, "device_class" : "current", "state_class" : "measurement", "unit_of_measurement" : "A")"
+#define MQTT_ENERGY_TOTAL   R"(, "device_class" : "energy", "unit_of_measurement" : "Wh", "state_class" : "total_increasing")"
+#define MQTT_NONE_IF_UNSET  R"({{ none if (value | int == -1) else (value | int) }})"
+#define MQTT_DIAGNOSTIC     R"(, "entity_category" : "diagnostic")"
+
+// Home Assistant entities; bump MQTT_ENTITIES_VERSION when changing this table, so it is announced again
+#define MQTT_ENTITIES_VERSION 1
+static constexpr MQTTentity_t MQTTentities[] = {
+    // name                         domain      command topic           value_template                                  other members                                                   flags
+    { "Charge Current",             "sensor",   NULL,                   "{{ value | int / 10 }}",                       MQTT_CURRENT,                                                   0 },
+    { "Max Current",                "sensor",   NULL,                   "{{ value | int / 10 }}",                       MQTT_CURRENT,                                                   0 },
+    { "Mains Current L1",           "sensor",   NULL,                   "{{ value | int / 10 }}",                       MQTT_CURRENT,                                                   MQTT_ENTITY_MAINS },
+    { "Mains Current L2",           "sensor",   NULL,                   "{{ value | int / 10 }}",                       MQTT_CURRENT,                                                   MQTT_ENTITY_MAINS },
+    { "Mains Current L3",           "sensor",   NULL,                   "{{ value | int / 10 }}",                       MQTT_CURRENT,                                                   MQTT_ENTITY_MAINS },
+    { "EV Current L1",              "sensor",   NULL,                   "{{ value | int / 10 }}",                       MQTT_CURRENT,                                                   MQTT_ENTITY_EV },
+    { "EV Current L2",              "sensor",   NULL,                   "{{ value | int / 10 }}",                       MQTT_CURRENT,                                                   MQTT_ENTITY_EV },
+    { "EV Current L3",              "sensor",   NULL,                   "{{ value | int / 10 }}",                       MQTT_CURRENT,                                                   MQTT_ENTITY_EV },
+    { "Circuit Current L1",         "sensor",   NULL,                   "{{ value | int / 10 }}",                       MQTT_CURRENT,                                                   MQTT_ENTITY_CIRCUIT },
+    { "Circuit Current L2",         "sensor",   NULL,                   "{{ value | int / 10 }}",                       MQTT_CURRENT,                                                   MQTT_ENTITY_CIRCUIT },
+    { "Circuit Current L3",         "sensor",   NULL,                   "{{ value | int / 10 }}",                       MQTT_CURRENT,                                                   MQTT_ENTITY_CIRCUIT },
+    { "Home Battery Current",       "sensor",   NULL,                   "{{ value | int / 10 }}",                       MQTT_CURRENT,                                                   MQTT_ENTITY_BATTERY },
+    { "Max Sum Mains",              "sensor",   NULL,                   NULL,                                           MQTT_CURRENT,                                                   0 },
 #if MODEM
-        //set the parameters for modem/SoC sensor entities:
-        optional_payload = MQTTclient.jsna("unit_of_measurement","%") + MQTTclient.jsna("value_template", R"({{ none if (value | int == -1) else (value | int) }})");
-        MQTTclient.announce("EV Initial SoC", "sensor", optional_payload);
-        MQTTclient.announce("EV Full SoC", "sensor", optional_payload);
-        MQTTclient.announce("EV Computed SoC", "sensor", optional_payload);
-        MQTTclient.announce("EV Remaining SoC", "sensor", optional_payload);
-
-        optional_payload = MQTTclient.jsna("device_class","duration") + MQTTclient.jsna("unit_of_measurement","m") + MQTTclient.jsna("value_template", R"({{ none if (value | int == -1) else (value | int / 60) | round }})");
-        MQTTclient.announce("EV Time Until Full", "sensor", optional_payload);
-
-        optional_payload = MQTTclient.jsna("device_class","energy") + MQTTclient.jsna("unit_of_measurement","Wh") + MQTTclient.jsna("value_template", R"({{ none if (value | int == -1) else (value | int) }})");
-        MQTTclient.announce("EV Energy Capacity", "sensor", optional_payload);
-        MQTTclient.announce("EV Energy Request", "sensor", optional_payload);
-
-        optional_payload = MQTTclient.jsna("value_template", R"({{ none if (value == '') else value }})");
-        MQTTclient.announce("EVCCID", "sensor", optional_payload);
-        optional_payload = MQTTclient.jsna("state_topic", String(MQTTprefix + "/RequiredEVCCID")) + MQTTclient.jsna("command_topic", String(MQTTprefix + "/Set/RequiredEVCCID"));
-        MQTTclient.announce("Required EVCCID", "text", optional_payload);
+    { "EV Initial SoC",             "sensor",   NULL,                   MQTT_NONE_IF_UNSET,                             R"(, "unit_of_measurement" : "%")",                             0 },
+    { "EV Full SoC",                "sensor",   NULL,                   MQTT_NONE_IF_UNSET,                             R"(, "unit_of_measurement" : "%")",                             0 },
+    { "EV Computed SoC",            "sensor",   NULL,                   MQTT_NONE_IF_UNSET,                             R"(, "unit_of_measurement" : "%")",                             0 },
+    { "EV Remaining SoC",           "sensor",   NULL,                   MQTT_NONE_IF_UNSET,                             R"(, "unit_of_measurement" : "%")",                             0 },
+    { "EV Time Until Full",         "sensor",   NULL,                   "{{ none if (value | int == -1) else (value | int / 60) | round }}", R"(, "device_class" : "duration", "unit_of_measurement" : "m")", 0 },
+    { "EV Energy Capacity",         "sensor",   NULL,                   MQTT_NONE_IF_UNSET,                             R"(, "device_class" : "energy", "unit_of_measurement" : "Wh")", 0 },
+    { "EV Energy Request",          "sensor",   NULL,                   MQTT_NONE_IF_UNSET,                             R"(, "device_class" : "energy", "unit_of_measurement" : "Wh")", 0 },
+    { "EVCCID",                     "sensor",   NULL,                   "{{ none if (value == '') else value }}",       NULL,                                                           0 },
+    { "Required EVCCID",            "text",     "RequiredEVCCID",       NULL,                                           NULL,                                                           0 },
 #endif
-
-    optional_payload = MQTTclient.jsna("device_class","energy") + MQTTclient.jsna("unit_of_measurement","Wh") + MQTTclient.jsna("state_class","total_increasing");
-    if (MainsMeter.Type) {
-        MQTTclient.announce("Mains Import Active Energy", "sensor", optional_payload);
-        MQTTclient.announce("Mains Export Active Energy", "sensor", optional_payload);
-    }
-
-    if (EVMeter.Type) {
-        MQTTclient.announce("EV Import Active Energy", "sensor", optional_payload);
-        MQTTclient.announce("EV Export Active Energy", "sensor", optional_payload);
-        //set the parameters for and MQTTclient.announce other sensor entities:
-        optional_payload = MQTTclient.jsna("device_class","power") + MQTTclient.jsna("unit_of_measurement","W") + MQTTclient.jsna("state_class","measurement");
-        MQTTclient.announce("EV Charge Power", "sensor", optional_payload);
-        optional_payload = MQTTclient.jsna("device_class","energy") + MQTTclient.jsna("unit_of_measurement","Wh") + MQTTclient.jsna("state_class","total_increasing");
-        MQTTclient.announce("EV Energy Charged", "sensor", optional_payload);
-        optional_payload = MQTTclient.jsna("device_class","energy") + MQTTclient.jsna("unit_of_measurement","Wh") + MQTTclient.jsna("state_class","total_increasing");
-        MQTTclient.announce("EV Total Energy Charged", "sensor", optional_payload);
-    }
-
-    //set the parameters for and MQTTclient.announce sensor entities without device_class or unit_of_measurement:
-    optional_payload = "";
-    MQTTclient.announce("EV Plug State", "sensor", optional_payload);
-    MQTTclient.announce("Access", "sensor", optional_payload);
-    MQTTclient.announce("State", "sensor", optional_payload);
-	MQTTclient.announce("StateID", "sensor", optional_payload);
-    MQTTclient.announce("RFID", "sensor", optional_payload);
-    MQTTclient.announce("RFIDLastRead", "sensor", optional_payload);
-    MQTTclient.announce("NrOfPhases", "sensor", optional_payload);
-
+    { "Mains Import Active Energy", "sensor",   NULL,                   NULL,                                           MQTT_ENERGY_TOTAL,                                              MQTT_ENTITY_MAINS },
+    { "Mains Export Active Energy", "sensor",   NULL,                   NULL,                                           MQTT_ENERGY_TOTAL,                                              MQTT_ENTITY_MAINS },
+    { "EV Import Active Energy",    "sensor",   NULL,                   NULL,                                           MQTT_ENERGY_TOTAL,                                              MQTT_ENTITY_EV },
+    { "EV Export Active Energy",    "sensor",   NULL,                   NULL,                                           MQTT_ENERGY_TOTAL,                                              MQTT_ENTITY_EV },
+    { "EV Charge Power",            "sensor",   NULL,                   NULL,                                           R"(, "device_class" : "power", "unit_of_measurement" : "W", "state_class" : "measurement")", MQTT_ENTITY_EV },
+    { "EV Energy Charged",          "sensor",   NULL,                   NULL,                                           MQTT_ENERGY_TOTAL,                                              MQTT_ENTITY_EV },
+    { "EV Total Energy Charged",    "sensor",   NULL,                   NULL,                                           MQTT_ENERGY_TOTAL,                                              MQTT_ENTITY_EV },
+    { "EV Plug State",              "sensor",   NULL,                   NULL,                                           NULL,                                                           0 },
+    { "Access",                     "sensor",   NULL,                   NULL,                                           NULL,                                                           0 },
+    { "State",                      "sensor",   NULL,                   NULL,                                           NULL,                                                           0 },
+    { "StateID",                    "sensor",   NULL,                   NULL,                                           NULL,                                                           0 },
+    { "RFID",                       "sensor",   NULL,                   NULL,                                           NULL,                                                           0 },
+    { "RFIDLastRead",               "sensor",   NULL,                   NULL,                                           NULL,                                                           0 },
+    { "NrOfPhases",                 "sensor",   NULL,                   NULL,                                           NULL,                                                           0 },
 #if ENABLE_OCPP && defined(SMARTEVSE_VERSION) //run OCPP only on ESP32
-    MQTTclient.announce("OCPP", "sensor", optional_payload);
-    MQTTclient.announce("OCPPConnection", "sensor", optional_payload);
+    { "OCPP",                       "sensor",   NULL,                   NULL,                                           NULL,                                                           0 },
+    { "OCPPConnection",             "sensor",   NULL,                   NULL,                                           NULL,                                                           0 },
 #endif //ENABLE_OCPP
-
-    optional_payload = MQTTclient.jsna("state_topic", String(MQTTprefix + "/LEDColorOff")) + MQTTclient.jsna("command_topic", String(MQTTprefix + "/Set/ColorOff"));
-    MQTTclient.announce("LED Color Off", "text", optional_payload);
-    optional_payload = MQTTclient.jsna("state_topic", String(MQTTprefix + "/LEDColorNormal")) + MQTTclient.jsna("command_topic", String(MQTTprefix + "/Set/ColorNormal"));
-    MQTTclient.announce("LED Color Normal", "text", optional_payload);
-    optional_payload = MQTTclient.jsna("state_topic", String(MQTTprefix + "/LEDColorSmart")) + MQTTclient.jsna("command_topic", String(MQTTprefix + "/Set/ColorSmart"));
-    MQTTclient.announce("LED Color Smart", "text", optional_payload);
-    optional_payload = MQTTclient.jsna("state_topic", String(MQTTprefix + "/LEDColorSolar")) + MQTTclient.jsna("command_topic", String(MQTTprefix + "/Set/ColorSolar"));
-    MQTTclient.announce("LED Color Solar", "text", optional_payload);
-    optional_payload = MQTTclient.jsna("state_topic", String(MQTTprefix + "/LEDColorCustom")) + MQTTclient.jsna("command_topic", String(MQTTprefix + "/Set/ColorCustom"));
-    MQTTclient.announce("LED Color Custom", "text", optional_payload);
-    
-    optional_payload = MQTTclient.jsna("state_topic", String(MQTTprefix + "/CustomButton")) + MQTTclient.jsna("command_topic", String(MQTTprefix + "/Set/CustomButton"));
-    optional_payload += String(R"(, "options" : ["On", "Off"])");
-    MQTTclient.announce("Custom Button", "select", optional_payload);
-
-    optional_payload = MQTTclient.jsna("device_class","duration") + MQTTclient.jsna("unit_of_measurement","s");
-    MQTTclient.announce("SolarStopTimer", "sensor", optional_payload);
-     optional_payload = MQTTclient.jsna("device_class","duration") + MQTTclient.jsna("unit_of_measurement","min");
-	MQTTclient.announce("Max Sum Mains Time", "sensor", optional_payload);
-    //set the parameters for and MQTTclient.announce diagnostic sensor entities:
-    optional_payload = MQTTclient.jsna("entity_category","diagnostic");
-    MQTTclient.announce("Error", "sensor", optional_payload);
-    MQTTclient.announce("WiFi SSID", "sensor", optional_payload);
-    MQTTclient.announce("WiFi BSSID", "sensor", optional_payload);
-    optional_payload = MQTTclient.jsna("entity_category","diagnostic") + MQTTclient.jsna("device_class","signal_strength") + MQTTclient.jsna("unit_of_measurement","dBm") + MQTTclient.jsna("state_class","measurement");
-    MQTTclient.announce("WiFi RSSI", "sensor", optional_payload);
-    optional_payload = MQTTclient.jsna("entity_category","diagnostic") + MQTTclient.jsna("device_class","temperature") + MQTTclient.jsna("unit_of_measurement","°C") + MQTTclient.jsna("state_class","measurement");
-    MQTTclient.announce("ESP Temp", "sensor", optional_payload);
-    optional_payload = MQTTclient.jsna("entity_category","diagnostic") + MQTTclient.jsna("device_class","duration") + MQTTclient.jsna("unit_of_measurement","s") + MQTTclient.jsna("state_class","measurement") + MQTTclient.jsna("entity_registry_enabled_default","False");
-    MQTTclient.announce("ESP Uptime", "sensor", optional_payload);
-
+    { "LED Color Off",              "text",     "ColorOff",             NULL,                                           NULL,                                                           0 },
+    { "LED Color Normal",           "text",     "ColorNormal",          NULL,                                           NULL,                                                           0 },
+    { "LED Color Smart",            "text",     "ColorSmart",           NULL,                                           NULL,                                                           0 },
+    { "LED Color Solar",            "text",     "ColorSolar",           NULL,                                           NULL,                                                           0 },
+    { "LED Color Custom",           "text",     "ColorCustom",          NULL,                                           NULL,                                                           0 },
+    { "Custom Button",              "select",   "CustomButton",         NULL,                                           R"(, "options" : ["On", "Off"])",                               0 },
+    { "SolarStopTimer",             "sensor",   NULL,                   NULL,                                           R"(, "device_class" : "duration", "unit_of_measurement" : "s")", 0 },
+    { "Max Sum Mains Time",         "sensor",   NULL,                   NULL,                                           R"(, "device_class" : "duration", "unit_of_measurement" : "min")", 0 },
+    { "Error",                      "sensor",   NULL,                   NULL,                                           MQTT_DIAGNOSTIC,                                                0 },
+    { "WiFi SSID",                  "sensor",   NULL,                   NULL,                                           MQTT_DIAGNOSTIC,                                                0 },
+    { "WiFi BSSID",                 "sensor",   NULL,                   NULL,                                           MQTT_DIAGNOSTIC,                                                0 },
+    { "WiFi RSSI",                  "sensor",   NULL,                   NULL,                                           MQTT_DIAGNOSTIC R"(, "device_class" : "signal_strength", "unit_of_measurement" : "dBm", "state_class" : "measurement")", 0 },
+    { "ESP Temp",                   "sensor",   NULL,                   NULL,                                           MQTT_DIAGNOSTIC R"(, "device_class" : "temperature", "unit_of_measurement" : "°C", "state_class" : "measurement")", 0 },
+    { "ESP Uptime",                 "sensor",   NULL,                   NULL,                                           MQTT_DIAGNOSTIC R"(, "device_class" : "duration", "unit_of_measurement" : "s", "state_class" : "measurement", "entity_registry_enabled_default" : "False")", 0 },
 #if MODEM
-        optional_payload = MQTTclient.jsna("unit_of_measurement","%") + MQTTclient.jsna("value_template", R"({{ (value | int / 1024 * 100) | round(0) }})");
-        MQTTclient.announce("CP PWM", "sensor", optional_payload);
-
-        optional_payload = MQTTclient.jsna("value_template", R"({{ none if (value | int == -1) else (value | int / 1024 * 100) | round }})");
-        optional_payload += MQTTclient.jsna("command_topic", String(MQTTprefix + "/Set/CPPWMOverride")) + MQTTclient.jsna("min", "-1") + MQTTclient.jsna("max", "100") + MQTTclient.jsna("mode","slider");
-        optional_payload += MQTTclient.jsna("command_template", R"({{ (value | int * 1024 / 100) | round }})");
-        MQTTclient.announce("CP PWM Override", "number", optional_payload);
+    { "CP PWM",                     "sensor",   NULL,                   "{{ (value | int / 1024 * 100) | round(0) }}",  R"(, "unit_of_measurement" : "%")",                             0 },
+    { "CP PWM Override",            "number",   "CPPWMOverride",        "{{ none if (value | int == -1) else (value | int / 1024 * 100) | round }}", R"(, "min" : "-1", "max" : "100", "mode" : "slider", "command_template" : "{{ (value | int * 1024 / 100) | round }}")", 0 },
 #endif
-    //set the parameters for and MQTTclient.announce select entities, overriding automatic state_topic:
-    optional_payload = MQTTclient.jsna("state_topic", String(MQTTprefix + "/Mode")) + MQTTclient.jsna("command_topic", String(MQTTprefix + "/Set/Mode"));
-    optional_payload += String(R"(, "options" : ["Off", "Normal", "Smart", "Solar", "Pause"])");
-    MQTTclient.announce("Mode", "select", optional_payload);
+    { "Mode",                       "select",   "Mode",                 NULL,                                           R"(, "options" : ["Off", "Normal", "Smart", "Solar", "Pause"])", 0 },
+    { "EnableC2",                   "select",   "EnableC2",             NULL,                                           R"(, "options" : ["Not present", "Always Off", "Solar Off", "Always On", "Auto"])", 0 },
+    { "Charge Current Override",    "number",   "CurrentOverride",      "{{ value | int / 10 if value | is_number else none }}", R"(, "min" : "0", "mode" : "slider", "command_template" : "{{ value | int * 10 }}")", MQTT_ENTITY_MAX },
+    { "Cable Lock",                 "select",   "CableLock",            NULL,                                           R"(, "options" : ["0", "1"])",                                  0 },
+};
+
+// Announce the entities to Home Assistant; force when Home Assistant (re)started
+static void mqttAnnounce(bool force) {
+    uint8_t mask = (MainsMeter.Type ? MQTT_ENTITY_MAINS : 0) | (EVMeter.Type ? MQTT_ENTITY_EV : 0) |
+                   (CircuitMeter.Type ? MQTT_ENTITY_CIRCUIT : 0) | (homeBatteryLastUpdate ? MQTT_ENTITY_BATTERY : 0);
+    MQTTclient.startAnnounce(MQTTentities, sizeof(MQTTentities) / sizeof(MQTTentities[0]), MQTT_ENTITIES_VERSION, mask, MaxCurrent, force);
+}
 
-    optional_payload = MQTTclient.jsna("state_topic", String(MQTTprefix + "/EnableC2")) + MQTTclient.jsna("command_topic", String(MQTTprefix + "/Set/EnableC2"));
-    optional_payload += String(R"(, "options" : ["Not present", "Always Off", "Solar Off", "Always On", "Auto"])");
-    MQTTclient.announce("EnableC2", "select", optional_payload);
+void SetupMQTTClient() {
+    // Set up subscriptions
+    MQTTclient.subscribe(MQTTprefix + "/Set/#",1);
+    MQTTclient.subscribe("homeassistant/status", 1);                           // Home Assistant birth message
+    MQTTclient.publish(MQTTprefix+"/connected", "online", true, 0);
+
+    // Discovery configs are sent from MQTTclient.loop(), after the first state messages
+    mqttAnnounce(false);
+}
 
-    //set the parameters for and MQTTclient.announce number entities:
-    optional_payload = MQTTclient.jsna("command_topic", String(MQTTprefix + "/Set/CurrentOverride")) + MQTTclient.jsna("min", "0") + MQTTclient.jsna("max", MaxCurrent ) + MQTTclient.jsna("mode","slider");
-    optional_payload += MQTTclient.jsna("value_template", R"({{ value | int / 10 if value | is_number else none }})") + MQTTclient.jsna("command_template", R"({{ value | int * 10 }})");
-    MQTTclient.announce("Charge Current Override", "number", optional_payload);
+static DynamicJsonDocument *MQTTstateDoc = NULL;                               // aggregated state document, only set while mqttPublishData() runs
 
-    //set the parameters for and MQTTclient.announce Cable Lock:
-    optional_payload = MQTTclient.jsna("cablelock_topic", String(MQTTprefix + "/CableLock")) + MQTTclient.jsna("command_topic", String(MQTTprefix + "/Set/CableLock"));
-    optional_payload += String(R"(, "options" : ["0", "1"])");
-    MQTTclient.announce("Cable Lock", "select", optional_payload);
+// Publish one metric on <prefix>/<key>, and/or add it to the aggregated state document
+template<typename T>
+static void mqttPublishState(const char *key, const T &value, bool retained) {
+    if (MQTTStateMode != MQTT_STATE_JSON)
+        MQTTclient.publish(MQTTprefix + "/" + key, value, retained, 0);
+    if (MQTTstateDoc)
+        (*MQTTstateDoc)[key] = value;
 }
 
 void mqttPublishData() {
     lastMqttUpdate = 0;
 
+    // In the JSON modes all state also goes into one document on <prefix>/Data
+    DynamicJsonDocument doc(MQTTStateMode == MQTT_STATE_TOPICS ? 16 : 2048);
+    MQTTstateDoc = (MQTTStateMode == MQTT_STATE_TOPICS) ? NULL : &doc;
+
         if (MainsMeter.Type) {
-            MQTTclient.publish(MQTTprefix + "/MainsCurrentL1", MainsMeter.Irms[0], false, 0);
-            MQTTclient.publish(MQTTprefix + "/MainsCurrentL2", MainsMeter.Irms[1], false, 0);
-            MQTTclient.publish(MQTTprefix + "/MainsCurrentL3", MainsMeter.Irms[2], false, 0);
+            mqttPublishState("MainsCurrentL1", MainsMeter.Irms[0], false);
+            mqttPublishState("MainsCurrentL2", MainsMeter.Irms[1], false);
+            mqttPublishState("MainsCurrentL3", MainsMeter.Irms[2], false);
             if (MainsMeter.Import_active_energy) //only export when not zero, because after boot it is zero = empty value
-                MQTTclient.publish(MQTTprefix + "/MainsImportActiveEnergy", MainsMeter.Import_active_energy, false, 0);
+                mqttPublishState("MainsImportActiveEnergy", MainsMeter.Import_active_energy, false);
             if (MainsMeter.Export_active_energy) //only export when not zero, because after boot it is zero = empty value
-                MQTTclient.publish(MQTTprefix + "/MainsExportActiveEnergy", MainsMeter.Export_active_energy, false, 0);
+                mqttPublishState("MainsExportActiveEnergy", MainsMeter.Export_active_energy, false);
         }
         if (EVMeter.Type) {
-            MQTTclient.publish(MQTTprefix + "/EVCurrentL1", EVMeter.Irms[0], false, 0);
-            MQTTclient.publish(MQTTprefix + "/EVCurrentL2", EVMeter.Irms[1], false, 0);
-            MQTTclient.publish(MQTTprefix + "/EVCurrentL3", EVMeter.Irms[2], false, 0);
+            mqttPublishState("EVCurrentL1", EVMeter.Irms[0], false);
+            mqttPublishState("EVCurrentL2", EVMeter.Irms[1], false);
+            mqttPublishState("EVCurrentL3", EVMeter.Irms[2], false);
             if (EVMeter.Import_active_energy) //only export when not zero, because after boot it is zero = empty value
-                MQTTclient.publish(MQTTprefix + "/EVImportActiveEnergy", EVMeter.Import_active_energy, false, 0);
+                mqttPublishState("EVImportActiveEnergy", EVMeter.Import_active_energy, false);
             if (EVMeter.Export_active_energy) //only export when not zero, because after boot it is zero = empty value
-                MQTTclient.publish(MQTTprefix + "/EVExportActiveEnergy", EVMeter.Export_active_energy, false, 0);
+                mqttPublishState("EVExportActiveEnergy", EVMeter.Export_active_energy, false);
         }
         if (CircuitMeter.Type) {
-            MQTTclient.publish(MQTTprefix + "/CircuitCurrentL1", CircuitMeter.Irms[0], false, 0);
-            MQTTclient.publish(MQTTprefix + "/CircuitCurrentL2", CircuitMeter.Irms[1], false, 0);
-            MQTTclient.publish(MQTTprefix + "/CircuitCurrentL3", CircuitMeter.Irms[2], false, 0);
-        }
-        MQTTclient.publish(MQTTprefix + "/ESPTemp", TempEVSE, false, 0);
-        MQTTclient.publish(MQTTprefix + "/Mode", AccessStatus == OFF ? "Off" : AccessStatus == PAUSE ? "Pause" : Mode > 3 ? "N/A" : StrMode[Mode], true, 0);
-        MQTTclient.publish(MQTTprefix + "/MaxCurrent", MaxCurrent * 10, true, 0);
-		MQTTclient.publish(MQTTprefix + "/MaxSumMains", String(MaxSumMains), true, 0);
-		MQTTclient.publish(MQTTprefix + "/MaxSumMainsTime", String(MaxSumMainsTime), true, 0);
-        MQTTclient.publish(MQTTprefix + "/CustomButton", CustomButton ? "On" : "Off", false, 0);
-        MQTTclient.publish(MQTTprefix + "/ChargeCurrent", Balanced[0], true, 0);
-        MQTTclient.publish(MQTTprefix + "/ChargeCurrentOverride", OverrideCurrent, true, 0);
-        MQTTclient.publish(MQTTprefix + "/NrOfPhases", Nr_Of_Phases_Charging, true, 0);
-        MQTTclient.publish(MQTTprefix + "/Access", AccessStatus == OFF ? "Deny" : AccessStatus == ON ? "Allow" : AccessStatus == PAUSE ? "Pause" : "N/A", true, 0);
-        MQTTclient.publish(MQTTprefix + "/RFID", !RFIDReader ? "Not Installed" : RFIDstatus >= 8 ? "NOSTATUS" : StrRFIDStatusWeb[RFIDstatus], true, 0);
-        MQTTclient.publish(MQTTprefix + "/EnableC2", StrEnableC2[EnableC2], true, 0);
+            mqttPublishState("CircuitCurrentL1", CircuitMeter.Irms[0], false);
+            mqttPublishState("CircuitCurrentL2", CircuitMeter.Irms[1], false);
+            mqttPublishState("CircuitCurrentL3", CircuitMeter.Irms[2], false);
+        }
+        mqttPublishState("ESPTemp", TempEVSE, false);
+        mqttPublishState("Mode", AccessStatus == OFF ? "Off" : AccessStatus == PAUSE ? "Pause" : Mode > 3 ? "N/A" : StrMode[Mode], true);
+        mqttPublishState("MaxCurrent", MaxCurrent * 10, true);
+		mqttPublishState("MaxSumMains", String(MaxSumMains), true);
+		mqttPublishState("MaxSumMainsTime", String(MaxSumMainsTime), true);
+        mqttPublishState("CustomButton", CustomButton ? "On" : "Off", false);
+        mqttPublishState("ChargeCurrent", Balanced[0], true);
+        mqttPublishState("ChargeCurrentOverride", OverrideCurrent, true);
+        mqttPublishState("NrOfPhases", Nr_Of_Phases_Charging, true);
+        mqttPublishState("Access", AccessStatus == OFF ? "Deny" : AccessStatus == ON ? "Allow" : AccessStatus == PAUSE ? "Pause" : "N/A", true);
+        mqttPublishState("RFID", !RFIDReader ? "Not Installed" : RFIDstatus >= 8 ? "NOSTATUS" : StrRFIDStatusWeb[RFIDstatus], true);
+        mqttPublishState("EnableC2", StrEnableC2[EnableC2], true);
         if (RFIDReader) {
             char buf[15];
             printRFID(buf);
-            MQTTclient.publish(MQTTprefix + "/RFIDLastRead", buf, true, 0);
+            mqttPublishState("RFIDLastRead", String(buf), true);              // String is copied into the state document, buf goes out of scope
         }
-        MQTTclient.publish(MQTTprefix + "/State", getStateNameWeb(State), true, 0);
+        mqttPublishState("State", getStateNameWeb(State), true);
         //try evcc.io 
-		MQTTclient.publish(MQTTprefix + "/StateID", getStateName(State), true, 0);
-        MQTTclient.publish(MQTTprefix + "/Error", getErrorNameWeb(ErrorFlags), true, 0);
-        MQTTclient.publish(MQTTprefix + "/EVPlugState", (pilot != PILOT_12V) ? "Connected" : "Disconnected", true, 0);
-        MQTTclient.publish(MQTTprefix + "/WiFiSSID", String(WiFi.SSID()), true, 0);
-        MQTTclient.publish(MQTTprefix + "/WiFiBSSID", String(WiFi.BSSIDstr()), true, 0);
+		mqttPublishState("StateID", getStateName(State), true);
+        mqttPublishState("Error", getErrorNameWeb(ErrorFlags), true);
+        mqttPublishState("EVPlugState", (pilot != PILOT_12V) ? "Connected" : "Disconnected", true);
+        mqttPublishState("WiFiSSID", String(WiFi.SSID()), true);
+        mqttPublishState("WiFiBSSID", String(WiFi.BSSIDstr()), true);
 #if MODEM
-        MQTTclient.publish(MQTTprefix + "/CPPWM", CurrentPWM, false, 0);
-        MQTTclient.publish(MQTTprefix + "/CPPWMOverride", CPDutyOverride ? String(CurrentPWM) : "-1", true, 0);
-        MQTTclient.publish(MQTTprefix + "/EVInitialSoC", InitialSoC, true, 0);
-        MQTTclient.publish(MQTTprefix + "/EVFullSoC", FullSoC, true, 0);
-        MQTTclient.publish(MQTTprefix + "/EVComputedSoC", ComputedSoC, true, 0);
-        MQTTclient.publish(MQTTprefix + "/EVRemainingSoC", RemainingSoC, true, 0);
-        MQTTclient.publish(MQTTprefix + "/EVTimeUntilFull", TimeUntilFull, false, 0);
-        MQTTclient.publish(MQTTprefix + "/EVEnergyCapacity", EnergyCapacity, true, 0);
-        MQTTclient.publish(MQTTprefix + "/EVEnergyRequest", EnergyRequest, true, 0);
-        MQTTclient.publish(MQTTprefix + "/EVCCID", EVCCID, true, 0);
-        MQTTclient.publish(MQTTprefix + "/RequiredEVCCID", RequiredEVCCID, true, 0);
+        mqttPublishState("CPPWM", CurrentPWM, false);
+        mqttPublishState("CPPWMOverride", CPDutyOverride ? String(CurrentPWM) : "-1", true);
+        mqttPublishState("EVInitialSoC", InitialSoC, true);
+        mqttPublishState("EVFullSoC", FullSoC, true);
+        mqttPublishState("EVComputedSoC", ComputedSoC, true);
+        mqttPublishState("EVRemainingSoC", RemainingSoC, true);
+        mqttPublishState("EVTimeUntilFull", TimeUntilFull, false);
+        mqttPublishState("EVEnergyCapacity", EnergyCapacity, true);
+        mqttPublishState("EVEnergyRequest", EnergyRequest, true);
+        mqttPublishState("EVCCID", EVCCID, true);
+        mqttPublishState("RequiredEVCCID", RequiredEVCCID, true);
 #endif
         if (EVMeter.Type) {
-            MQTTclient.publish(MQTTprefix + "/EVChargePower", EVMeter.PowerMeasured, false, 0);
-            MQTTclient.publish(MQTTprefix + "/EVEnergyCharged", EVMeter.EnergyCharged, true, 0);
-            MQTTclient.publish(MQTTprefix + "/EVTotalEnergyCharged", EVMeter.Energy, false, 0);
+            mqttPublishState("EVChargePower", EVMeter.PowerMeasured, false);
+            mqttPublishState("EVEnergyCharged", EVMeter.EnergyCharged, true);
+            mqttPublishState("EVTotalEnergyCharged", EVMeter.Energy, false);
         }
         if (homeBatteryLastUpdate)
-            MQTTclient.publish(MQTTprefix + "/HomeBatteryCurrent", homeBatteryCurrent, false, 0);
-        MQTTclient.publish(MQTTprefix + "/HomeBatterySoC", homeBatterySoc, false, 0);
-        MQTTclient.publish(MQTTprefix + "/HomeBatterySoCThreshold", homeBatterySoCThreshold, false, 0);
-        MQTTclient.publish(MQTTprefix + "/HomeBatteryThresholdEnabled", homeBatteryThresholdEnabled, false, 0);
+            mqttPublishState("HomeBatteryCurrent", homeBatteryCurrent, false);
+        mqttPublishState("HomeBatterySoC", homeBatterySoc, false);
+        mqttPublishState("HomeBatterySoCThreshold", homeBatterySoCThreshold, false);
+        mqttPublishState("HomeBatteryThresholdEnabled", homeBatteryThresholdEnabled, false);
 #if ENABLE_OCPP && defined(SMARTEVSE_VERSION) //run OCPP only on ESP32
-        MQTTclient.publish(MQTTprefix + "/OCPP", OcppMode ? "Enabled" : "Disabled", true, 0);
-        MQTTclient.publish(MQTTprefix + "/OCPPConnection", (OcppWsClient && OcppWsClient->isConnected()) ? "Connected" : "Disconnected", false, 0);
+        mqttPublishState("OCPP", OcppMode ? "Enabled" : "Disabled", true);
+        mqttPublishState("OCPPConnection", (OcppWsClient && OcppWsClient->isConnected()) ? "Connected" : "Disconnected", false);
 #endif //ENABLE_OCPP
-        MQTTclient.publish(MQTTprefix + "/LEDColorOff", String(ColorOff[0])+","+String(ColorOff[1])+","+String(ColorOff[2]), true, 0);
-        MQTTclient.publish(MQTTprefix + "/LEDColorNormal", String(ColorNormal[0])+","+String(ColorNormal[1])+","+String(ColorNormal[2]), true, 0);
-        MQTTclient.publish(MQTTprefix + "/LEDColorSmart", String(ColorSmart[0])+","+String(ColorSmart[1])+","+String(ColorSmart[2]), true, 0);
-        MQTTclient.publish(MQTTprefix + "/LEDColorSolar", String(ColorSolar[0])+","+String(ColorSolar[1])+","+String(ColorSolar[2]), true, 0);
-        MQTTclient.publish(MQTTprefix + "/LEDColorCustom", String(ColorCustom[0])+","+String(ColorCustom[1])+","+String(ColorCustom[2]), true, 0);
+        mqttPublishState("LEDColorOff", String(ColorOff[0])+","+String(ColorOff[1])+","+String(ColorOff[2]), true);
+        mqttPublishState("LEDColorNormal", String(ColorNormal[0])+","+String(ColorNormal[1])+","+String(ColorNormal[2]), true);
+        mqttPublishState("LEDColorSmart", String(ColorSmart[0])+","+String(ColorSmart[1])+","+String(ColorSmart[2]), true);
+        mqttPublishState("LEDColorSolar", String(ColorSolar[0])+","+String(ColorSolar[1])+","+String(ColorSolar[2]), true);
+        mqttPublishState("LEDColorCustom", String(ColorCustom[0])+","+String(ColorCustom[1])+","+String(ColorCustom[2]), true);
         if (Lock != 0) {
-            MQTTclient.publish(MQTTprefix + "/CableLock", CableLock, true, 0);
+            mqttPublishState("CableLock", CableLock, true);
+        }
+        mqttPublishState("ESPUptime", (int32_t) (esp_timer_get_time() / 1000000), false);
+        mqttPublishState("WiFiRSSI", String(WiFi.RSSI()), false);
+        mqttPublishState("LoadBl", LoadBl, true);
+        mqttPublishState("PairingPin", PairingPin, true);
+        mqttPublishState("SolarStopTimer", SolarStopTimer, false);
+
+        if (MQTTstateDoc) {
+            String json;
+            serializeJson(doc, json);
+            MQTTclient.publish(MQTTprefix + "/Data", json, false, 0);
+            MQTTstateDoc = NULL;
         }
-        MQTTclient.publish(MQTTprefix + "/ESPUptime", esp_timer_get_time() / 1000000, false, 0);
-        MQTTclient.publish(MQTTprefix + "/WiFiRSSI", String(WiFi.RSSI()), false, 0);
-        MQTTclient.publish(MQTTprefix + "/LoadBl", LoadBl, true, 0);
-        MQTTclient.publish(MQTTprefix + "/PairingPin", PairingPin, true, 0);
-        MQTTclient.publish(MQTTprefix + "/SolarStopTimer", SolarStopTimer, false, 0);
 }
 
 // SmartEVSE server MQTT client setup - subscribe to Set topics
@@ -1376,164 +1376,285 @@ void SetIntervalString(String jsonStr) {
 }
 
 
-void read_settings() {
-    
-    // Open preferences. true = read only,  false = read/write
-    // If "settings" does not exist, it will be created, and initialized with the default values
-    if (preferences.begin("settings", false) ) {                                
-        bool Initialized = preferences.isKey("Config");
-        Config = preferences.getUChar("Config", CONFIG); 
-        Lock = preferences.getUChar("Lock", LOCK); 
-        Mode = preferences.getUChar("Mode", MODE); 
-        AccessStatus = (AccessStatus_t) preferences.getUChar("Access", ON);
-        if (preferences.isKey("CardOffset")) {
-            CardOffset = preferences.getUChar("CardOffset", CARD_OFFSET);
-            //write the old 8 bits value to the new 16 bits value
-            preferences.putUShort("CardOffs16", CardOffset);
-            preferences.remove("CardOffset");
-        }
-        else
-            CardOffset = preferences.getUShort("CardOffs16", CARD_OFFSET);
-        LoadBl = preferences.getUChar("LoadBl", LOADBL); 
-        MaxMains = preferences.getUShort("MaxMains", MAX_MAINS); 
-        MaxSumMains = preferences.getUShort("MaxSumMains", MAX_SUMMAINS);
-        if (!preferences.isKey("CapacityMode")) {
-            //old firmware has not yet introduced CapacityMode, so do it here:
-            if (MaxSumMains) //enabled, so CapacityMode FIXED
-                preferences.putUShort("CapacityMode", FIXED);
-            else //disabled so CapacityMode CAP_DISABLED
-                preferences.putUShort("CapacityMode", CAP_DISABLED);
-        }
-        CapacityMode = (CapacityMode_t) preferences.getUShort("CapacityMode", CAP_DISABLED);
-        MaxSumMainsTime = preferences.getUShort("MaxSumMainsTime", MAX_SUMMAINSTIME);
-        MaxCurrent = preferences.getUShort("MaxCurrent", MAX_CURRENT); 
-        MinCurrent = preferences.getUShort("MinCurrent", MIN_CURRENT); 
-        MaxCircuit = preferences.getUShort("MaxCircuit", MAX_CIRCUIT); 
-        Switch = preferences.getUChar("Switch", SWITCH); 
-        RCmon = preferences.getUChar("RCmon", RC_MON); 
-        StartCurrent = preferences.getUShort("StartCurrent", START_CURRENT); 
-        StopTime = preferences.getUShort("StopTime", STOP_TIME); 
-        ImportCurrent = preferences.getUShort("ImportCurrent",IMPORT_CURRENT);
-        Grid = preferences.getUChar("Grid",GRID);
-        SB2_WIFImode = preferences.getUChar("SB2WIFImode",SB2_WIFI_MODE);
-        RFIDReader = preferences.getUChar("RFIDReader",RFID_READER);
-
-        MainsMeter.Type = preferences.getUChar("MainsMeter", MAINS_METER);
-        MainsMeter.Address = preferences.getUChar("MainsMAddress",MAINS_METER_ADDRESS);
-        strncpy(MainsMeter.DeviceHostName, preferences.getString("MainsHostName", "").c_str(), sizeof(MainsMeter.DeviceHostName));
-        MainsMeter.DeviceHostName[sizeof(MainsMeter.DeviceHostName) - 1] = '\0';
-        MainsMeter.HostMenuSelection = 0; // Ensure HostMenuSelection is initialized to 0 so Menu shows the current saved hostname
-        EVMeter.Type = preferences.getUChar("EVMeter",EV_METER);
-        EVMeter.Address = preferences.getUChar("EVMeterAddress",EV_METER_ADDRESS);
-        strncpy(EVMeter.DeviceHostName, preferences.getString("EVMeterHostName", "").c_str(), sizeof(EVMeter.DeviceHostName));
-        EVMeter.DeviceHostName[sizeof(EVMeter.DeviceHostName) - 1] = '\0';
-        EVMeter.HostMenuSelection = 0; // Ensure HostMenuSelection is initialized to 0 so Menu shows the current saved hostname
-        CircuitMeter.Type = preferences.getUChar("CircuitMeter",CIRCUIT_METER);
-        CircuitMeter.Address = preferences.getUChar("CircuitMAddress",CIRCUIT_METER_ADDRESS);
-        strncpy(CircuitMeter.DeviceHostName, preferences.getString("CircuitHostName", "").c_str(), sizeof(CircuitMeter.DeviceHostName));
-        CircuitMeter.DeviceHostName[sizeof(CircuitMeter.DeviceHostName) - 1] = '\0';
-        CircuitMeter.HostMenuSelection = 0; // Ensure HostMenuSelection is initialized to 0 so Menu shows the current saved hostname
-        EMConfig[EM_CUSTOM].Endianness = preferences.getUChar("EMEndianness",EMCUSTOM_ENDIANESS);
-        EMConfig[EM_CUSTOM].IRegister = preferences.getUShort("EMIRegister",EMCUSTOM_IREGISTER);
-        EMConfig[EM_CUSTOM].IDivisor = preferences.getUChar("EMIDivisor",EMCUSTOM_IDIVISOR);
-        EMConfig[EM_CUSTOM].URegister = preferences.getUShort("EMURegister",EMCUSTOM_UREGISTER);
-        EMConfig[EM_CUSTOM].UDivisor = preferences.getUChar("EMUDivisor",EMCUSTOM_UDIVISOR);
-        EMConfig[EM_CUSTOM].PRegister = preferences.getUShort("EMPRegister",EMCUSTOM_PREGISTER);
-        EMConfig[EM_CUSTOM].PDivisor = preferences.getUChar("EMPDivisor",EMCUSTOM_PDIVISOR);
-        EMConfig[EM_CUSTOM].ERegister = preferences.getUShort("EMERegister",EMCUSTOM_EREGISTER);
-        EMConfig[EM_CUSTOM].EDivisor = preferences.getUChar("EMEDivisor",EMCUSTOM_EDIVISOR);
-        EMConfig[EM_CUSTOM].DataType = (mb_datatype)preferences.getUChar("EMDataType",EMCUSTOM_DATATYPE);
-        EMConfig[EM_CUSTOM].Function = preferences.getUChar("EMFunction",EMCUSTOM_FUNCTION);
-        WIFImode = preferences.getUChar("WIFImode",WIFI_MODE);
-        DelayedStartTime.epoch2 = preferences.getULong("DelayedStartTim", DELAYEDSTARTTIME); //epoch2 is 4 bytes long on arduino; NVS key has reached max size
-        DelayedStopTime.epoch2 = preferences.getULong("DelayedStopTime", DELAYEDSTOPTIME);    //epoch2 is 4 bytes long on arduino
-        DelayedRepeat = preferences.getUShort("DelayedRepeat", 0);
-        LCDlock = preferences.getUChar("LCDlock", LCD_LOCK);
-        CableLock = preferences.getUChar("CableLock", CABLE_LOCK);
-        LCDPin = preferences.getUShort("LCDPin", 0);
-        AutoUpdate = preferences.getUChar("AutoUpdate", AUTOUPDATE);
-        MQTTSmartServer = preferences.getBool("MQTTSmartServer", APPSERVER);
-
-        EnableC2 = (EnableC2_t) preferences.getUShort("EnableC2", ENABLE_C2);
-        String Interval = preferences.getString("intervals_json", "");
-        SetIntervalString(Interval);
-        strncpy(settingsCache.intervals_json, Interval.c_str(), sizeof(settingsCache.intervals_json));
+// Read the settings from the old per-key layout, missing keys get their default value.
+// Returns false when the settings were never stored.
+static bool read_settings_keys(void) {
+    bool Initialized = preferences.isKey("Config");
+    Config = preferences.getUChar("Config", CONFIG); 
+    Lock = preferences.getUChar("Lock", LOCK); 
+    LoadBl = preferences.getUChar("LoadBl", LOADBL); 
+    MaxMains = preferences.getUShort("MaxMains", MAX_MAINS); 
+    MaxSumMains = preferences.getUShort("MaxSumMains", MAX_SUMMAINS);
+    if (!preferences.isKey("CapacityMode")) {
+        //old firmware has not yet introduced CapacityMode, so do it here:
+        if (MaxSumMains) //enabled, so CapacityMode FIXED
+            preferences.putUShort("CapacityMode", FIXED);
+        else //disabled so CapacityMode CAP_DISABLED
+            preferences.putUShort("CapacityMode", CAP_DISABLED);
+    }
+    CapacityMode = (CapacityMode_t) preferences.getUShort("CapacityMode", CAP_DISABLED);
+    MaxSumMainsTime = preferences.getUShort("MaxSumMainsTime", MAX_SUMMAINSTIME);
+    MaxCurrent = preferences.getUShort("MaxCurrent", MAX_CURRENT); 
+    MinCurrent = preferences.getUShort("MinCurrent", MIN_CURRENT); 
+    MaxCircuit = preferences.getUShort("MaxCircuit", MAX_CIRCUIT); 
+    Switch = preferences.getUChar("Switch", SWITCH); 
+    RCmon = preferences.getUChar("RCmon", RC_MON); 
+    StartCurrent = preferences.getUShort("StartCurrent", START_CURRENT); 
+    StopTime = preferences.getUShort("StopTime", STOP_TIME); 
+    ImportCurrent = preferences.getUShort("ImportCurrent",IMPORT_CURRENT);
+    Grid = preferences.getUChar("Grid",GRID);
+    SB2_WIFImode = preferences.getUChar("SB2WIFImode",SB2_WIFI_MODE);
+    RFIDReader = preferences.getUChar("RFIDReader",RFID_READER);
+
+    MainsMeter.Type = preferences.getUChar("MainsMeter", MAINS_METER);
+    MainsMeter.Address = preferences.getUChar("MainsMAddress",MAINS_METER_ADDRESS);
+    strncpy(MainsMeter.DeviceHostName, preferences.getString("MainsHostName", "").c_str(), sizeof(MainsMeter.DeviceHostName));
+    MainsMeter.DeviceHostName[sizeof(MainsMeter.DeviceHostName) - 1] = '\0';
+    MainsMeter.HostMenuSelection = 0; // Ensure HostMenuSelection is initialized to 0 so Menu shows the current saved hostname
+    EVMeter.Type = preferences.getUChar("EVMeter",EV_METER);
+    EVMeter.Address = preferences.getUChar("EVMeterAddress",EV_METER_ADDRESS);
+    strncpy(EVMeter.DeviceHostName, preferences.getString("EVMeterHostName", "").c_str(), sizeof(EVMeter.DeviceHostName));
+    EVMeter.DeviceHostName[sizeof(EVMeter.DeviceHostName) - 1] = '\0';
+    EVMeter.HostMenuSelection = 0; // Ensure HostMenuSelection is initialized to 0 so Menu shows the current saved hostname
+    CircuitMeter.Type = preferences.getUChar("CircuitMeter",CIRCUIT_METER);
+    CircuitMeter.Address = preferences.getUChar("CircuitMAddress",CIRCUIT_METER_ADDRESS);
+    strncpy(CircuitMeter.DeviceHostName, preferences.getString("CircuitHostName", "").c_str(), sizeof(CircuitMeter.DeviceHostName));
+    CircuitMeter.DeviceHostName[sizeof(CircuitMeter.DeviceHostName) - 1] = '\0';
+    CircuitMeter.HostMenuSelection = 0; // Ensure HostMenuSelection is initialized to 0 so Menu shows the current saved hostname
+    EMConfig[EM_CUSTOM].Endianness = preferences.getUChar("EMEndianness",EMCUSTOM_ENDIANESS);
+    EMConfig[EM_CUSTOM].IRegister = preferences.getUShort("EMIRegister",EMCUSTOM_IREGISTER);
+    EMConfig[EM_CUSTOM].IDivisor = preferences.getUChar("EMIDivisor",EMCUSTOM_IDIVISOR);
+    EMConfig[EM_CUSTOM].URegister = preferences.getUShort("EMURegister",EMCUSTOM_UREGISTER);
+    EMConfig[EM_CUSTOM].UDivisor = preferences.getUChar("EMUDivisor",EMCUSTOM_UDIVISOR);
+    EMConfig[EM_CUSTOM].PRegister = preferences.getUShort("EMPRegister",EMCUSTOM_PREGISTER);
+    EMConfig[EM_CUSTOM].PDivisor = preferences.getUChar("EMPDivisor",EMCUSTOM_PDIVISOR);
+    EMConfig[EM_CUSTOM].ERegister = preferences.getUShort("EMERegister",EMCUSTOM_EREGISTER);
+    EMConfig[EM_CUSTOM].EDivisor = preferences.getUChar("EMEDivisor",EMCUSTOM_EDIVISOR);
+    EMConfig[EM_CUSTOM].DataType = (mb_datatype)preferences.getUChar("EMDataType",EMCUSTOM_DATATYPE);
+    EMConfig[EM_CUSTOM].Function = preferences.getUChar("EMFunction",EMCUSTOM_FUNCTION);
+    WIFImode = preferences.getUChar("WIFImode",WIFI_MODE);
+    DelayedRepeat = preferences.getUShort("DelayedRepeat", 0);
+    LCDlock = preferences.getUChar("LCDlock", LCD_LOCK);
+    CableLock = preferences.getUChar("CableLock", CABLE_LOCK);
+    LCDPin = preferences.getUShort("LCDPin", 0);
+    AutoUpdate = preferences.getUChar("AutoUpdate", AUTOUPDATE);
+    MQTTSmartServer = preferences.getBool("MQTTSmartServer", APPSERVER);
+
+    EnableC2 = (EnableC2_t) preferences.getUShort("EnableC2", ENABLE_C2);
+    String Interval = preferences.getString("intervals_json", "");
+    SetIntervalString(Interval);
 #if MODEM
-        strncpy(RequiredEVCCID, preferences.getString("RequiredEVCCID", "").c_str(), sizeof(RequiredEVCCID));
-        strncpy(settingsCache.RequiredEVCCID, RequiredEVCCID, sizeof(settingsCache.RequiredEVCCID));
+    strncpy(RequiredEVCCID, preferences.getString("RequiredEVCCID", "").c_str(), sizeof(RequiredEVCCID));
 #endif
-        maxTemp = preferences.getUShort("maxTemp", MAX_TEMPERATURE);
-        LedMode = preferences.getUChar("LedMode", 0);
+    maxTemp = preferences.getUShort("maxTemp", MAX_TEMPERATURE);
+    LedMode = preferences.getUChar("LedMode", 0);
 
 #if ENABLE_OCPP && defined(SMARTEVSE_VERSION) //run OCPP only on ESP32
-        OcppMode = preferences.getUChar("OcppMode", OCPP_MODE);
+    OcppMode = preferences.getUChar("OcppMode", OCPP_MODE);
 #endif //ENABLE_OCPP
+    return Initialized;
+}
+
+// Read the state keys, at boot
+static void read_settings_state(void) {
+    Mode = preferences.getUChar("Mode", MODE);
+    AccessStatus = (AccessStatus_t) preferences.getUChar("Access", ON);
+    if (preferences.isKey("CardOffset")) {
+        CardOffset = preferences.getUChar("CardOffset", CARD_OFFSET);
+        //write the old 8 bits value to the new 16 bits value
+        preferences.putUShort("CardOffs16", CardOffset);
+        preferences.remove("CardOffset");
+    }
+    else
+        CardOffset = preferences.getUShort("CardOffs16", CARD_OFFSET);
+    DelayedStartTime.epoch2 = preferences.getULong("DelayedStartTim", DELAYEDSTARTTIME); //epoch2 is 4 bytes long on arduino; NVS key has reached max size
+    DelayedStopTime.epoch2 = preferences.getULong("DelayedStopTime", DELAYEDSTOPTIME);    //epoch2 is 4 bytes long on arduino
+}
+
+static void settings_to_state(SettingsState &s) {
+    s.Mode = Mode;
+    s.AccessStatus = AccessStatus;
+    s.CardOffset = CardOffset;
+    s.DelayedStartTime = DelayedStartTime.epoch2;
+    s.DelayedStopTime = DelayedStopTime.epoch2;
+}
+
+static void settings_from_state(const SettingsState &s) {
+    Mode = s.Mode;
+    AccessStatus = (AccessStatus_t) s.AccessStatus;
+    CardOffset = s.CardOffset;
+    DelayedStartTime.epoch2 = s.DelayedStartTime;
+    DelayedStopTime.epoch2 = s.DelayedStopTime;
+}
 
-        preferences.end();                                  
-
-        // Populate settings cache with values just read from NVS
-        settingsCache.Config = Config;
-        settingsCache.Lock = Lock;
-        settingsCache.Mode = Mode;
-        settingsCache.AccessStatus = AccessStatus;
-        settingsCache.CardOffset = CardOffset;
-        settingsCache.DelayedStartTime = DelayedStartTime.epoch2;
-        settingsCache.DelayedStopTime = DelayedStopTime.epoch2;
-        settingsCache.DelayedRepeat = DelayedRepeat;
-        settingsCache.LoadBl = LoadBl;
-        settingsCache.MaxMains = MaxMains;
-        settingsCache.MaxSumMains = MaxSumMains;
-        settingsCache.MaxSumMainsTime = MaxSumMainsTime;
-        settingsCache.MaxCurrent = MaxCurrent;
-        settingsCache.MinCurrent = MinCurrent;
-        settingsCache.MaxCircuit = MaxCircuit;
-        settingsCache.Switch = Switch;
-        settingsCache.RCmon = RCmon;
-        settingsCache.StartCurrent = StartCurrent;
-        settingsCache.StopTime = StopTime;
-        settingsCache.ImportCurrent = ImportCurrent;
-        settingsCache.Grid = Grid;
-        settingsCache.SB2_WIFImode = SB2_WIFImode;
-        settingsCache.RFIDReader = RFIDReader;
-        settingsCache.MainsMeterType = MainsMeter.Type;
-        settingsCache.MainsMeterAddress = MainsMeter.Address;
-        strncpy(settingsCache.MainsMeterDeviceHostName, MainsMeter.DeviceHostName, sizeof(settingsCache.MainsMeterDeviceHostName));
-        settingsCache.MainsMeterDeviceHostName[sizeof(settingsCache.MainsMeterDeviceHostName) - 1] = '\0';
-        settingsCache.EVMeterType = EVMeter.Type;
-        settingsCache.EVMeterAddress = EVMeter.Address;
-        strncpy(settingsCache.EVMeterDeviceHostName, EVMeter.DeviceHostName, sizeof(settingsCache.EVMeterDeviceHostName));
-        settingsCache.EVMeterDeviceHostName[sizeof(settingsCache.EVMeterDeviceHostName) - 1] = '\0';
-        settingsCache.CircuitMeterType = CircuitMeter.Type;
-        settingsCache.CircuitMeterAddress = CircuitMeter.Address;
-        strncpy(settingsCache.CircuitMeterDeviceHostName, CircuitMeter.DeviceHostName, sizeof(settingsCache.CircuitMeterDeviceHostName));
-        settingsCache.CircuitMeterDeviceHostName[sizeof(settingsCache.CircuitMeterDeviceHostName) - 1] = '\0';
-        settingsCache.EMEndianness = EMConfig[EM_CUSTOM].Endianness;
-        settingsCache.EMIRegister = EMConfig[EM_CUSTOM].IRegister;
-        settingsCache.EMIDivisor = EMConfig[EM_CUSTOM].IDivisor;
-        settingsCache.EMURegister = EMConfig[EM_CUSTOM].URegister;
-        settingsCache.EMUDivisor = EMConfig[EM_CUSTOM].UDivisor;
-        settingsCache.EMPRegister = EMConfig[EM_CUSTOM].PRegister;
-        settingsCache.EMPDivisor = EMConfig[EM_CUSTOM].PDivisor;
-        settingsCache.EMERegister = EMConfig[EM_CUSTOM].ERegister;
-        settingsCache.EMEDivisor = EMConfig[EM_CUSTOM].EDivisor;
-        settingsCache.EMDataType = EMConfig[EM_CUSTOM].DataType;
-        settingsCache.EMFunction = EMConfig[EM_CUSTOM].Function;
-        settingsCache.WIFImode = WIFImode;
-        settingsCache.EnableC2 = EnableC2;
-        settingsCache.CapacityMode = CapacityMode;
-        strncpy(settingsCache.intervals_json, GetIntervalString().c_str(), sizeof(settingsCache.intervals_json));
-        settingsCache.maxTemp = maxTemp;
-        settingsCache.AutoUpdate = AutoUpdate;
-        settingsCache.LCDlock = LCDlock;
-        settingsCache.CableLock = CableLock;
-        settingsCache.LCDPin = LCDPin;
-        settingsCache.MQTTSmartServer = MQTTSmartServer;
-        settingsCache.LedMode = LedMode;
+static void settings_to_cache(SettingsCache &c) {
+    memset(&c, 0, sizeof(c));                                                   // unused string bytes are compared and stored too
+    c.Config = Config;
+    c.Lock = Lock;
+    c.DelayedRepeat = DelayedRepeat;
+    c.LoadBl = LoadBl;
+    c.MaxMains = MaxMains;
+    c.MaxSumMains = MaxSumMains;
+    c.MaxSumMainsTime = MaxSumMainsTime;
+    c.MaxCurrent = MaxCurrent;
+    c.MinCurrent = MinCurrent;
+    c.MaxCircuit = MaxCircuit;
+    c.Switch = Switch;
+    c.RCmon = RCmon;
+    c.StartCurrent = StartCurrent;
+    c.StopTime = StopTime;
+    c.ImportCurrent = ImportCurrent;
+    c.Grid = Grid;
+    c.SB2_WIFImode = SB2_WIFImode;
+    c.RFIDReader = RFIDReader;
+    c.MainsMeterType = MainsMeter.Type;
+    c.MainsMeterAddress = MainsMeter.Address;
+    strncpy(c.MainsMeterDeviceHostName, MainsMeter.DeviceHostName, sizeof(c.MainsMeterDeviceHostName) - 1);
+    c.EVMeterType = EVMeter.Type;
+    c.EVMeterAddress = EVMeter.Address;
+    strncpy(c.EVMeterDeviceHostName, EVMeter.DeviceHostName, sizeof(c.EVMeterDeviceHostName) - 1);
+    c.CircuitMeterType = CircuitMeter.Type;
+    c.CircuitMeterAddress = CircuitMeter.Address;
+    strncpy(c.CircuitMeterDeviceHostName, CircuitMeter.DeviceHostName, sizeof(c.CircuitMeterDeviceHostName) - 1);
+    c.EMEndianness = EMConfig[EM_CUSTOM].Endianness;
+    c.EMIRegister = EMConfig[EM_CUSTOM].IRegister;
+    c.EMIDivisor = EMConfig[EM_CUSTOM].IDivisor;
+    c.EMURegister = EMConfig[EM_CUSTOM].URegister;
+    c.EMUDivisor = EMConfig[EM_CUSTOM].UDivisor;
+    c.EMPRegister = EMConfig[EM_CUSTOM].PRegister;
+    c.EMPDivisor = EMConfig[EM_CUSTOM].PDivisor;
+    c.EMERegister = EMConfig[EM_CUSTOM].ERegister;
+    c.EMEDivisor = EMConfig[EM_CUSTOM].EDivisor;
+    c.EMDataType = EMConfig[EM_CUSTOM].DataType;
+    c.EMFunction = EMConfig[EM_CUSTOM].Function;
+    c.WIFImode = WIFImode;
+    c.EnableC2 = EnableC2;
+    c.CapacityMode = CapacityMode;
+    strncpy(c.intervals_json, GetIntervalString().c_str(), sizeof(c.intervals_json) - 1);
+#if MODEM
+    strncpy(c.RequiredEVCCID, RequiredEVCCID, sizeof(c.RequiredEVCCID) - 1);
+#endif
+    c.maxTemp = maxTemp;
+    c.AutoUpdate = AutoUpdate;
+    c.LCDlock = LCDlock;
+    c.CableLock = CableLock;
+    c.LCDPin = LCDPin;
+    c.MQTTSmartServer = MQTTSmartServer;
+    c.LedMode = LedMode;
 #if ENABLE_OCPP && defined(SMARTEVSE_VERSION)
-        settingsCache.OcppMode = OcppMode;
+    c.OcppMode = OcppMode;
+#else
+    c.OcppMode = OCPP_MODE;
+#endif
+}
+
+static void settings_from_cache(const SettingsCache &c) {
+    Config = c.Config;
+    Lock = c.Lock;
+    DelayedRepeat = c.DelayedRepeat;
+    LoadBl = c.LoadBl;
+    MaxMains = c.MaxMains;
+    MaxSumMains = c.MaxSumMains;
+    MaxSumMainsTime = c.MaxSumMainsTime;
+    MaxCurrent = c.MaxCurrent;
+    MinCurrent = c.MinCurrent;
+    MaxCircuit = c.MaxCircuit;
+    Switch = c.Switch;
+    RCmon = c.RCmon;
+    StartCurrent = c.StartCurrent;
+    StopTime = c.StopTime;
+    ImportCurrent = c.ImportCurrent;
+    Grid = c.Grid;
+    SB2_WIFImode = c.SB2_WIFImode;
+    RFIDReader = c.RFIDReader;
+    MainsMeter.Type = c.MainsMeterType;
+    MainsMeter.Address = c.MainsMeterAddress;
+    strncpy(MainsMeter.DeviceHostName, c.MainsMeterDeviceHostName, sizeof(MainsMeter.DeviceHostName));
+    MainsMeter.DeviceHostName[sizeof(MainsMeter.DeviceHostName) - 1] = '\0';
+    MainsMeter.HostMenuSelection = 0; // Ensure HostMenuSelection is initialized to 0 so Menu shows the current saved hostname
+    EVMeter.Type = c.EVMeterType;
+    EVMeter.Address = c.EVMeterAddress;
+    strncpy(EVMeter.DeviceHostName, c.EVMeterDeviceHostName, sizeof(EVMeter.DeviceHostName));
+    EVMeter.DeviceHostName[sizeof(EVMeter.DeviceHostName) - 1] = '\0';
+    EVMeter.HostMenuSelection = 0;
+    CircuitMeter.Type = c.CircuitMeterType;
+    CircuitMeter.Address = c.CircuitMeterAddress;
+    strncpy(CircuitMeter.DeviceHostName, c.CircuitMeterDeviceHostName, sizeof(CircuitMeter.DeviceHostName));
+    CircuitMeter.DeviceHostName[sizeof(CircuitMeter.DeviceHostName) - 1] = '\0';
+    CircuitMeter.HostMenuSelection = 0;
+    EMConfig[EM_CUSTOM].Endianness = c.EMEndianness;
+    EMConfig[EM_CUSTOM].IRegister = c.EMIRegister;
+    EMConfig[EM_CUSTOM].IDivisor = c.EMIDivisor;
+    EMConfig[EM_CUSTOM].URegister = c.EMURegister;
+    EMConfig[EM_CUSTOM].UDivisor = c.EMUDivisor;
+    EMConfig[EM_CUSTOM].PRegister = c.EMPRegister;
+    EMConfig[EM_CUSTOM].PDivisor = c.EMPDivisor;
+    EMConfig[EM_CUSTOM].ERegister = c.EMERegister;
+    EMConfig[EM_CUSTOM].EDivisor = c.EMEDivisor;
+    EMConfig[EM_CUSTOM].DataType = (mb_datatype) c.EMDataType;
+    EMConfig[EM_CUSTOM].Function = c.EMFunction;
+    WIFImode = c.WIFImode;
+    EnableC2 = (EnableC2_t) c.EnableC2;
+    CapacityMode = (CapacityMode_t) c.CapacityMode;
+    SetIntervalString(String(c.intervals_json));
+#if MODEM
+    strncpy(RequiredEVCCID, c.RequiredEVCCID, sizeof(RequiredEVCCID));
 #endif
-        settingsCache.valid = true;
-        _LOG_D("Settings cache populated from NVS\n");
+    maxTemp = c.maxTemp;
+    AutoUpdate = c.AutoUpdate;
+    LCDlock = c.LCDlock;
+    CableLock = c.CableLock;
+    LCDPin = c.LCDPin;
+    MQTTSmartServer = c.MQTTSmartServer;
+    LedMode = c.LedMode;
+#if ENABLE_OCPP && defined(SMARTEVSE_VERSION) //run OCPP only on ESP32
+    OcppMode = c.OcppMode;
+#endif //ENABLE_OCPP
+}
+
+/* Write the state keys that changed, before returning.
+ * The state is not part of the settings blob, so it is not lost when the power fails right after a change.
+ */
+void write_settings_state(void) {
+    SettingsState next;
+
+    settings_to_state(next);
+    settings_store_state(next);
+}
+
+void read_settings() {
+    unsigned long start = micros();
+
+    if (SettingsLoaded) {                                                       // restore the stored settings, when the menu is left without saving
+        SettingsCache stored;
+        SettingsState state;
+        settings_store_get(stored, state);
+        settings_from_cache(stored);
+        settings_from_state(state);
+        return;
+    }
+
+    // Open preferences. true = read only,  false = read/write
+    // If "settings" does not exist, it will be created, and initialized with the default values
+    if (preferences.begin("settings", false) ) {
+        SettingsCache stored, current;
+        SettingsState state;
+        bool Initialized = true;
+        size_t len = read_settings_blob(preferences, stored);
+
+        if (len < sizeof(stored)) {                                             // no blob yet, or stored by older firmware
+            Initialized = read_settings_keys();
+            settings_to_cache(current);
+            memcpy(&current, &stored, len);                                     // the blob is newer than the separate keys
+        } else memcpy(&current, &stored, sizeof(stored));
+        settings_from_cache(current);
+        read_settings_state();
+        settings_to_state(state);
+        preferences.end();
+
+        SettingsLoaded = true;
+        _LOG_I("Settings read from %s in %lu us\n", len == sizeof(stored) ? "blob" : "keys", micros() - start);
+        settings_store_begin(current, state, len < sizeof(stored));             // store the separate keys as a blob
 
         // Store settings when not initialized
         if (!Initialized) write_settings();
@@ -1543,109 +1664,20 @@ void read_settings() {
     }
 }
 
+/* Commit the current settings.
+ * The flash write is done by the settings task, write_settings() returns without waiting for it.
+ */
 void write_settings(void) {
+    SettingsCache next;
 
     validate_settings();
-
- if (preferences.begin("settings", false) ) {
-
-    // Only write values that have actually changed from cached values
-    PREFS_PUT_UCHAR_IF_CHANGED("Config", Config, Config);
-    PREFS_PUT_UCHAR_IF_CHANGED("Lock", Lock, Lock);
-    PREFS_PUT_UCHAR_IF_CHANGED("Mode", Mode, Mode);
-    PREFS_PUT_UCHAR_IF_CHANGED("Access", AccessStatus, AccessStatus);
-    PREFS_PUT_USHORT_IF_CHANGED("CardOffs16", CardOffset, CardOffset);
-    PREFS_PUT_ULONG_IF_CHANGED("DelayedStartTim", DelayedStartTime.epoch2, DelayedStartTime);
-    PREFS_PUT_ULONG_IF_CHANGED("DelayedStopTime", DelayedStopTime.epoch2, DelayedStopTime);
-    PREFS_PUT_USHORT_IF_CHANGED("DelayedRepeat", DelayedRepeat, DelayedRepeat);
-    PREFS_PUT_UCHAR_IF_CHANGED("LoadBl", LoadBl, LoadBl);
-    PREFS_PUT_USHORT_IF_CHANGED("MaxMains", MaxMains, MaxMains);
-    PREFS_PUT_USHORT_IF_CHANGED("MaxSumMains", MaxSumMains, MaxSumMains);
-    PREFS_PUT_USHORT_IF_CHANGED("MaxSumMainsTime", MaxSumMainsTime, MaxSumMainsTime);
-    PREFS_PUT_USHORT_IF_CHANGED("MaxCurrent", MaxCurrent, MaxCurrent);
-    PREFS_PUT_USHORT_IF_CHANGED("MinCurrent", MinCurrent, MinCurrent);
-    PREFS_PUT_USHORT_IF_CHANGED("MaxCircuit", MaxCircuit, MaxCircuit);
-    PREFS_PUT_UCHAR_IF_CHANGED("Switch", Switch, Switch);
-    PREFS_PUT_UCHAR_IF_CHANGED("RCmon", RCmon, RCmon);
-    PREFS_PUT_USHORT_IF_CHANGED("StartCurrent", StartCurrent, StartCurrent);
-    PREFS_PUT_USHORT_IF_CHANGED("StopTime", StopTime, StopTime);
-    PREFS_PUT_USHORT_IF_CHANGED("ImportCurrent", ImportCurrent, ImportCurrent);
-    PREFS_PUT_UCHAR_IF_CHANGED("Grid", Grid, Grid);
-    PREFS_PUT_UCHAR_IF_CHANGED("SB2WIFImode", SB2_WIFImode, SB2_WIFImode);
-    PREFS_PUT_UCHAR_IF_CHANGED("RFIDReader", RFIDReader, RFIDReader);
-
-    PREFS_PUT_UCHAR_IF_CHANGED("MainsMeter", MainsMeter.Type, MainsMeterType);
-    PREFS_PUT_UCHAR_IF_CHANGED("MainsMAddress", MainsMeter.Address, MainsMeterAddress);
-        if (!settingsCache.valid || strcmp(MainsMeter.DeviceHostName, settingsCache.MainsMeterDeviceHostName) != 0) {
-        preferences.putString("MainsHostName", MainsMeter.DeviceHostName);
-        strncpy(settingsCache.MainsMeterDeviceHostName, MainsMeter.DeviceHostName, sizeof(settingsCache.MainsMeterDeviceHostName));
-        settingsCache.MainsMeterDeviceHostName[sizeof(settingsCache.MainsMeterDeviceHostName) - 1] = '\0';
-    }
-    PREFS_PUT_UCHAR_IF_CHANGED("EVMeter", EVMeter.Type, EVMeterType);
-    PREFS_PUT_UCHAR_IF_CHANGED("EVMeterAddress", EVMeter.Address, EVMeterAddress);
-    if (!settingsCache.valid || strcmp(EVMeter.DeviceHostName, settingsCache.EVMeterDeviceHostName) != 0) {
-        preferences.putString("EVMeterHostName", EVMeter.DeviceHostName);
-        strncpy(settingsCache.EVMeterDeviceHostName, EVMeter.DeviceHostName, sizeof(settingsCache.EVMeterDeviceHostName));
-        settingsCache.EVMeterDeviceHostName[sizeof(settingsCache.EVMeterDeviceHostName) - 1] = '\0';
-    }
-    if (!settingsCache.valid || strcmp(CircuitMeter.DeviceHostName, settingsCache.CircuitMeterDeviceHostName) != 0) {
-        preferences.putString("CircuitHostName", CircuitMeter.DeviceHostName);
-        strncpy(settingsCache.CircuitMeterDeviceHostName, CircuitMeter.DeviceHostName, sizeof(settingsCache.CircuitMeterDeviceHostName));
-        settingsCache.CircuitMeterDeviceHostName[sizeof(settingsCache.CircuitMeterDeviceHostName) - 1] = '\0';
-    }
-    PREFS_PUT_UCHAR_IF_CHANGED("CircuitMeter", CircuitMeter.Type, CircuitMeterType);
-    PREFS_PUT_UCHAR_IF_CHANGED("CircuitMAddress", CircuitMeter.Address, CircuitMeterAddress);
-    PREFS_PUT_UCHAR_IF_CHANGED("EMEndianness", EMConfig[EM_CUSTOM].Endianness, EMEndianness);
-    PREFS_PUT_USHORT_IF_CHANGED("EMIRegister", EMConfig[EM_CUSTOM].IRegister, EMIRegister);
-    PREFS_PUT_UCHAR_IF_CHANGED("EMIDivisor", EMConfig[EM_CUSTOM].IDivisor, EMIDivisor);
-    PREFS_PUT_USHORT_IF_CHANGED("EMURegister", EMConfig[EM_CUSTOM].URegister, EMURegister);
-    PREFS_PUT_UCHAR_IF_CHANGED("EMUDivisor", EMConfig[EM_CUSTOM].UDivisor, EMUDivisor);
-    PREFS_PUT_USHORT_IF_CHANGED("EMPRegister", EMConfig[EM_CUSTOM].PRegister, EMPRegister);
-    PREFS_PUT_UCHAR_IF_CHANGED("EMPDivisor", EMConfig[EM_CUSTOM].PDivisor, EMPDivisor);
-    PREFS_PUT_USHORT_IF_CHANGED("EMERegister", EMConfig[EM_CUSTOM].ERegister, EMERegister);
-    PREFS_PUT_UCHAR_IF_CHANGED("EMEDivisor", EMConfig[EM_CUSTOM].EDivisor, EMEDivisor);
-    PREFS_PUT_UCHAR_IF_CHANGED("EMDataType", EMConfig[EM_CUSTOM].DataType, EMDataType);
-    PREFS_PUT_UCHAR_IF_CHANGED("EMFunction", EMConfig[EM_CUSTOM].Function, EMFunction);
-    PREFS_PUT_UCHAR_IF_CHANGED("WIFImode", WIFImode, WIFImode);
-    PREFS_PUT_USHORT_IF_CHANGED("EnableC2", EnableC2, EnableC2);
-    PREFS_PUT_USHORT_IF_CHANGED("CapacityMode", CapacityMode, CapacityMode);
-    if (!settingsCache.valid || strcmp(GetIntervalString().c_str(), settingsCache.intervals_json) != 0) {
-        preferences.putString("intervals_json", GetIntervalString());
-        strncpy(settingsCache.intervals_json, GetIntervalString().c_str(), sizeof(settingsCache.intervals_json));
-    }
-#if MODEM
-    if (!settingsCache.valid || strcmp(RequiredEVCCID, settingsCache.RequiredEVCCID) != 0) {
-        preferences.putString("RequiredEVCCID", String(RequiredEVCCID));
-        strncpy(settingsCache.RequiredEVCCID, RequiredEVCCID, sizeof(settingsCache.RequiredEVCCID));
-    }
-#endif
-    PREFS_PUT_USHORT_IF_CHANGED("maxTemp", maxTemp, maxTemp);
-    PREFS_PUT_UCHAR_IF_CHANGED("AutoUpdate", AutoUpdate, AutoUpdate);
-    PREFS_PUT_UCHAR_IF_CHANGED("LCDlock", LCDlock, LCDlock);
-    PREFS_PUT_UCHAR_IF_CHANGED("CableLock", CableLock, CableLock);
-    PREFS_PUT_USHORT_IF_CHANGED("LCDPin", LCDPin, LCDPin);
-    PREFS_PUT_BOOL_IF_CHANGED("MQTTSmartServer", MQTTSmartServer, MQTTSmartServer);
-    PREFS_PUT_UCHAR_IF_CHANGED("LedMode", LedMode, LedMode);
-
-#if ENABLE_OCPP && defined(SMARTEVSE_VERSION) //run OCPP only on ESP32
-    PREFS_PUT_UCHAR_IF_CHANGED("OcppMode", OcppMode, OcppMode);
-#endif //ENABLE_OCPP
-
-    // Mark cache as valid after first write
-    settingsCache.valid = true;
-
-    preferences.end();
-
-    _LOG_I("settings saved\n");
+    settings_to_cache(next);
+    settings_store_put(next);
+    write_settings_state();
 #if SMARTEVSE_VERSION >= 40
     SendConfigToCH32();
 #endif
 
- } else {
-     _LOG_A("Can not open preferences!\n");
- }
-
-
     if (LoadBl == 1) {                                                          // Master mode
         // Broadcast settings to other controllers
         BroadcastSettings();
@@ -1770,6 +1802,31 @@ void DisconnectEvent(void){
 #endif //MODEM
 
 
+// Add a session to the array of a /sessions reply
+static bool sessionToJson(void *arg, const SessionRecord *rec) {
+    JsonObject session = ((JsonArray *) arg)->createNestedObject();
+    char uid[15];
+
+    if (session.isNull()) return false;                                         // document is full
+    session["id"] = rec->Id;
+    if (rec->Start) session["start"] = rec->Start;
+    if (rec->Stop) session["stop"] = rec->Stop;
+    if (rec->Flags & SESSION_EV_METER) {
+        session["meter_start_wh"] = rec->MeterStart;
+        session["energy_wh"] = rec->Energy;
+    }
+    session["peak_current"] = rec->PeakCurrent;
+    session["phases"] = rec->Phases;
+    session["mode"] = rec->Mode < 3 ? StrMode[rec->Mode] : "N/A";
+    SessionFormatCard(rec, uid);
+    if (uid[0]) session["rfid"] = uid;
+    // char * is copied into the document, the record is overwritten by the next read
+    if (rec->IdTag[0]) session["idtag"] = (char *) rec->IdTag;
+    if (rec->EVCCID[0]) session["evccid"] = (char *) rec->EVCCID;
+    if (rec->Flags & SESSION_INTERRUPTED) session["interrupted"] = true;
+    return true;
+}
+
 //make mongoose 7.14 compatible with 7.13
 #define mg_http_match_uri(X,Y) mg_match(X->uri, mg_str(Y), NULL)
 
@@ -1814,8 +1871,14 @@ bool handle_URI(struct mg_connection *c, struct mg_http_message *hm,  webServerR
 
         boolean evConnected = pilot != PILOT_12V;                    //when access bit = 1, p.ex. in OFF mode, the STATEs are no longer updated
 
-        DynamicJsonDocument doc(3072); // https://arduinojson.org/v6/assistant/
+        DynamicJsonDocument doc(3968); // https://arduinojson.org/v6/assistant/
         doc["version"] = String(VERSION);
+        const uint8_t *sha = runningImageSha256();                              // delta updates are made against this image
+        if (sha) {
+            char hex[65];
+            for (int i = 0; i < 32; i++) sprintf(hex + i * 2, "%02x", sha[i]);
+            doc["firmware_sha256"] = hex;
+        }
         doc["serialnr"] = serialnr;
         doc["mode"] = mode;
         doc["mode_id"] = modeId;
@@ -1853,6 +1916,16 @@ bool handle_URI(struct mg_connection *c, struct mg_http_message *hm,  webServerR
             snprintf(mac_str, sizeof(mac_str), "%02X:%02X:%02X:%02X:%02X:%02X",
                      eth_mac[0], eth_mac[1], eth_mac[2], eth_mac[3], eth_mac[4], eth_mac[5]);
             doc["eth"]["mac"] = mac_str;
+            const ch390_stats_t *stats = ch390_get_stats();
+            doc["eth"]["stats"]["rx_frames"] = stats->rx_frames;
+            doc["eth"]["stats"]["rx_bytes"] = stats->rx_bytes;
+            doc["eth"]["stats"]["rx_errors"] = stats->rx_errors;
+            doc["eth"]["stats"]["rx_no_mem"] = stats->rx_no_mem;
+            doc["eth"]["stats"]["rx_overflows"] = stats->rx_overflows;
+            doc["eth"]["stats"]["tx_frames"] = stats->tx_frames;
+            doc["eth"]["stats"]["tx_bytes"] = stats->tx_bytes;
+            doc["eth"]["stats"]["tx_waits"] = stats->tx_waits;
+            doc["eth"]["stats"]["tx_busy"] = stats->tx_busy;
         }
 #endif
         
@@ -1925,6 +1998,13 @@ bool handle_URI(struct mg_connection *c, struct mg_http_message *hm,  webServerR
         doc["mqtt"]["username"] = MQTTuser;
         doc["mqtt"]["password_set"] = MQTTpassword != "";
         doc["mqtt"]["tls"] = MQTTtls;
+        doc["mqtt"]["state_mode"] = MQTTStateMode;
+        doc["mqtt"]["tx_messages"] = MQTTclient.TxMessages;
+        doc["mqtt"]["tx_bytes"] = MQTTclient.TxBytes;
+        doc["mqtt"]["queued"] = MQTTclient.Queue.Queued;
+        doc["mqtt"]["queued_bytes"] = MQTTclient.Queue.QueuedBytes;
+        doc["mqtt"]["coalesced"] = MQTTclient.Queue.Coalesced;
+        doc["mqtt"]["dropped"] = MQTTclient.Queue.Dropped;
         if (MQTTclient.connected) {
             doc["mqtt"]["status"] = "Connected";
         } else {
@@ -1965,6 +2045,7 @@ bool handle_URI(struct mg_connection *c, struct mg_http_message *hm,  webServerR
         doc["ev_meter"]["address"] = EVMeter.Address;
         if (EVMeter.Type == EM_HOMEWIZARD) {
             doc["ev_meter"]["host"] = strlen(EVMeter.DeviceHostName) > 0 ? EVMeter.DeviceHostName : "Not Set";
+            homewizardStats(doc["ev_meter"].createNestedObject("homewizard"), &EVMeter);
         }
         doc["ev_meter"]["import_active_power"] = EVMeter.PowerMeasured; // Watt
         doc["ev_meter"]["total_wh"] = EVMeter.Energy; // Wh
@@ -1985,12 +2066,14 @@ bool handle_URI(struct mg_connection *c, struct mg_http_message *hm,  webServerR
             doc["mains_meter"]["export_active_energy"] = MainsMeter.Export_active_energy; // Wh
         if (MainsMeter.Type == EM_HOMEWIZARD) {
             doc["mains_meter"]["host"] = strlen(MainsMeter.DeviceHostName) > 0 ? MainsMeter.DeviceHostName : "Not Set";
+            homewizardStats(doc["mains_meter"].createNestedObject("homewizard"), &MainsMeter);
         }
         if (CircuitMeter.Type) {
             doc["circuit_meter"]["description"] = EMConfig[CircuitMeter.Type].Desc;
             doc["circuit_meter"]["address"] = CircuitMeter.Address;
             if (CircuitMeter.Type == EM_HOMEWIZARD) {
                 doc["circuit_meter"]["host"] = strlen(CircuitMeter.DeviceHostName) > 0 ? CircuitMeter.DeviceHostName : "Not Set";
+                homewizardStats(doc["circuit_meter"].createNestedObject("homewizard"), &CircuitMeter);
             }
             doc["circuit_meter"]["currents"]["TOTAL"] = CircuitMeter.Irms[0] + CircuitMeter.Irms[1] + CircuitMeter.Irms[2];
             doc["circuit_meter"]["currents"]["L1"] = CircuitMeter.Irms[0];
@@ -2341,6 +2424,7 @@ bool handle_URI(struct mg_connection *c, struct mg_http_message *hm,  webServerR
         String json;
         serializeJson(doc, json);
         mg_http_reply(c, 200, "Content-Type: application/json\r\n", "%s\n", json.c_str());    // Yes. Respond JSON
+        write_settings_state();                                                 // delayed start and stop times
         request_write_settings();
         return true;
       }
@@ -2614,8 +2698,8 @@ bool handle_URI(struct mg_connection *c, struct mg_http_message *hm,  webServerR
             mg_http_reply(c, 200, "Content-Type: application/json\r\n", "%s\r\n", json.c_str());
         } else {
             // Generate BMP image from LCD buffer.
-    		const std::vector<uint8_t> bmpImage = createImageFromGLCDBuffer();
-		    const size_t bmpImageSize = bmpImage.size();
+            size_t bmpImageSize;
+            const uint8_t *bmpImage = createImageFromGLCDBuffer(&bmpImageSize);
 
             // Start the HTTP response with chunked encoding
             mg_printf(c,
@@ -2627,7 +2711,7 @@ bool handle_URI(struct mg_connection *c, struct mg_http_message *hm,  webServerR
                       "\r\n");
 
             // Using chunked transfer encoding to get rid of content-len + keep-alive problems.
-            mg_http_write_chunk(c, reinterpret_cast<const char *>(bmpImage.data()), bmpImageSize);
+            mg_http_write_chunk(c, reinterpret_cast<const char *>(bmpImage), bmpImageSize);
 
             // Send an empty chunk to signal the end of the response.
             mg_http_write_chunk(c, "", 0);
@@ -2668,6 +2752,31 @@ bool handle_URI(struct mg_connection *c, struct mg_http_message *hm,  webServerR
         mg_http_reply(c, 200, "Content-Type: application/json\r\n", "%s\r\n", json.c_str());    // Yes. Respond JSON
         return true;
 
+    } else if (mg_http_match_uri(hm, "/homewizard_pair") && !memcmp("POST", hm->method.buf, hm->method.len)) {
+        // pair with the V2 API of a HomeWizard meter, press the button on the meter within 30 seconds:
+        // curl -X POST "http://smartevse-xxxx.lan/homewizard_pair?meter=mains" (mains, circuit or ev), add &clear=1 to unpair
+        DynamicJsonDocument doc(200);
+        uint8_t device = HOMEWIZARD_DEVICES;
+
+        if (request->hasParam("meter")) {
+            const String meter = request->getParam("meter")->value();
+            if (meter == "mains") device = 0;
+            else if (meter == "circuit") device = 1;
+            else if (meter == "ev") device = 2;
+        }
+        if (device == HOMEWIZARD_DEVICES || !homewizardEnabled(device)) {
+            doc["error"] = "No HomeWizard meter";
+        } else if (!homewizardPair(device, !request->hasParam("clear"))) {
+            doc["error"] = "Meter address unknown";
+        } else {
+            doc["pairing"] = !request->hasParam("clear");
+        }
+
+        String json;
+        serializeJson(doc, json);
+        mg_http_reply(c, 200, "Content-Type: application/json\r\n", "%s\r\n", json.c_str());    // Yes. Respond JSON
+        return true;
+
     } else if (mg_http_match_uri(hm, "/rfid") && !memcmp("POST", hm->method.buf, hm->method.len)) {
         DynamicJsonDocument doc(200);
 
@@ -2730,6 +2839,78 @@ bool handle_URI(struct mg_connection *c, struct mg_http_message *hm,  webServerR
         mg_http_reply(c, 200, "Content-Type: application/json\r\n", "%s\r\n", json.c_str());
         return true;
 
+    } else if (mg_http_match_uri(hm, "/rfid_list") && !memcmp("GET", hm->method.buf, hm->method.len)) {
+        // export the stored cards in pages of at most 50
+        DynamicJsonDocument doc(6144);
+        uint16_t start = 0, count = 50, total = RFIDCardCount();
+        char uid[15], name[RFID_NAME_LEN + 1], expiry[11];
+
+        if (request->hasParam("start")) start = request->getParam("start")->value().toInt();
+        if (request->hasParam("count")) count = constrain(request->getParam("count")->value().toInt(), 0, 50);
+        doc["total"] = total;
+        doc["start"] = start;
+        JsonArray cards = doc.createNestedArray("cards");
+        for (uint16_t i = start; i < total && i - start < count; i++) {
+            if (!GetRFIDCard(i, uid, name, expiry)) break;
+            JsonObject card = cards.createNestedObject();
+            card["uid"] = uid;
+            if (name[0]) card["name"] = name;
+            if (expiry[0]) card["expiry"] = expiry;
+        }
+
+        String json;
+        serializeJson(doc, json);
+        mg_http_reply(c, 200, "Content-Type: application/json\r\n", "%s\r\n", json.c_str());
+        return true;
+
+    } else if (mg_http_match_uri(hm, "/rfid_list") && (!memcmp("POST", hm->method.buf, hm->method.len) || !memcmp("DELETE", hm->method.buf, hm->method.len))) {
+        DynamicJsonDocument doc(200);
+
+        if (!request->hasParam("uid")) {
+            doc["rfid_list_status"] = "Missing uid parameter";
+        } else if (hm->method.buf[0] == 'D') {
+            doc["rfid_list_status"] = RemoveRFIDCard(request->getParam("uid")->value().c_str()) ? "Deleted" : "Not found";
+        } else {
+            String name = request->hasParam("name") ? request->getParam("name")->value() : "";
+            String expiry = request->hasParam("expiry") ? request->getParam("expiry")->value() : "";
+            switch (SetRFIDCard(request->getParam("uid")->value().c_str(), name.c_str(), expiry.c_str())) {
+                case 1: doc["rfid_list_status"] = "Added"; break;
+                case 2: doc["rfid_list_status"] = "Updated"; break;
+                case 0: doc["rfid_list_status"] = "Storage full"; break;
+                default: doc["rfid_list_status"] = "Invalid uid or expiry"; break;
+            }
+        }
+        doc["total"] = RFIDCardCount();
+
+        String json;
+        serializeJson(doc, json);
+        mg_http_reply(c, 200, "Content-Type: application/json\r\n", "%s\r\n", json.c_str());
+        return true;
+
+    } else if ((mg_http_match_uri(hm, "/sessions") || mg_http_match_uri(hm, "/sessions.csv")) && !memcmp("GET", hm->method.buf, hm->method.len)) {
+        // charging sessions: JSON newest first in pages of at most 25, or all as CSV oldest first
+        uint32_t from = 0, to = 0xffffffff, start = 0, count = 25;
+        String card = request->hasParam("card") ? request->getParam("card")->value() : "";
+
+        if (request->hasParam("from")) from = strtoul(request->getParam("from")->value().c_str(), NULL, 10);
+        if (request->hasParam("to")) to = strtoul(request->getParam("to")->value().c_str(), NULL, 10);
+        if (mg_http_match_uri(hm, "/sessions.csv")) {
+            if (!SessionExportBegin(c, from, to, card.c_str())) mg_http_reply(c, 503, "", "Another export is in progress\r\n");
+            return true;
+        }
+        if (request->hasParam("start")) start = request->getParam("start")->value().toInt();
+        if (request->hasParam("count")) count = constrain(request->getParam("count")->value().toInt(), 0, 25);
+
+        DynamicJsonDocument doc(8192);
+        JsonArray sessions = doc.createNestedArray("sessions");
+        doc["start"] = start;
+        doc["total"] = SessionQuery(from, to, card.c_str(), start, count, sessionToJson, &sessions);
+
+        String json;
+        serializeJson(doc, json);
+        mg_http_reply(c, 200, "Content-Type: application/json\r\n", "%s\r\n", json.c_str());
+        return true;
+
 #if MODEM && SMARTEVSE_VERSION < 40
     } else if (mg_http_match_uri(hm, "/ev_state") && !memcmp("POST", hm->method.buf, hm->method.len)) {
         DynamicJsonDocument doc(200);
@@ -2799,6 +2980,12 @@ bool handle_URI(struct mg_connection *c, struct mg_http_message *hm,  webServerR
         _LOG_A("DEBUG: GetState=%u.\n", GetState);
         mg_http_reply(c, 200, "Content-Type: application/json\r\n", "%s\r\n", ""); //json request needs json response
         return true;
+    } else if (mg_http_match_uri(hm, "/modem_timeline") && !memcmp("GET", hm->method.buf, hm->method.len)) {
+        //timeline of the last modem session: curl "http://smartevse-xxxx.lan/modem_timeline"
+        String json;
+        modemTimelineJson(json);
+        mg_http_reply(c, 200, "Content-Type: application/json\r\n", "%s\r\n", json.c_str());
+        return true;
 #endif
 
 #if FAKE_RFID
@@ -3330,6 +3517,7 @@ void ocppLoop() {
     }
 
     auto& transaction = getTransaction(); // Common tx which OCPP is currently processing (or nullptr if no tx is ongoing)
+    if (transaction) SessionSetIdTag(transaction->getIdTag());
 
     // Check if Locking Tx has been invalidated by something other than RFID swipe
     if (OcppLockingTx) {
@@ -3617,7 +3805,7 @@ void setup() {
     QCA_SPI1.begin(SPI_SCK, SPI_MISO, SPI_MOSI, PIN_QCA700X_CS);
     // SPI mode is MODE3 (Idle = HIGH, clock in on rising edge), we use a 10Mhz SPI clock
     QCA_SPI1.beginTransaction(SPISettings(10000000, MSBFIRST, SPI_MODE3));
-    //attachInterrupt(digitalPinToInterrupt(PIN_QCA700X_INT), SPI_InterruptHandler, RISING);
+    // the QCA700X interrupt is attached by the Timer20ms task (qca.cpp)
 
     // Setup SWDIO pin as Power Panic interrupt received from the WCH uC. (unused, we use serial comm)
     //attachInterrupt(WCH_SWDIO, PowerPanicESP, FALLING);
@@ -3668,7 +3856,7 @@ extern void Timer20ms(void * parameter);
     xTaskCreate(
         Timer20ms,      // Function that should be called
         "Timer20ms",    // Name of the task (for debugging)
-        40000,          // Stack size (bytes)
+        MODEM_TASK_STACK, // Stack size (bytes); EXI documents live in a static arena (tcp.cpp)
         NULL,           // Parameter to pass
         1,              // Task priority
         NULL            // Task handle
@@ -3678,12 +3866,13 @@ extern void Timer20ms(void * parameter);
     // Read all settings from non volatile memory; MQTTprefix will be overwritten if stored in NVS
     read_settings();                                                            // initialize with default data when starting for the first time
     validate_settings();
-    ReadRFIDlist();                                                             // Read all stored RFID's from storage
 
     // Note that LittleFS is also used by OCPP
     if(!LittleFS.begin(true)) {
         _LOG_A("LittleFS Mount Failed\n");
     }
+    ReadRFIDlist();                                                             // Read all stored RFID's from storage
+    SessionInit();                                                              // Index the charging sessions, and add one that was interrupted
         
     getButtonState();
 /*     * @param Buttons: < o >
@@ -3834,125 +4023,6 @@ bool fwNeedsUpdate(char * version) {
     return false;
 }
 
-/**
-  * Periodically retrieves current measurements from networked energy meters
-  * and updates the meters' currents and energies.
-  *
-  * This function ensures a delay of at least 1.95 seconds between consecutive data retrieval attempts.
-  */
-static bool homewizardUpdateInProgress = false;
-
-static void homewizard_task(void *parameter) {
-    if (strlen(MainsMeter.DeviceHostName) == 0 && MainsMeter.Type == EM_HOMEWIZARD && LoadBl < 2) { //Mains Initialize
-        // Prevent existing HomeWizard P1 users from having to reconfigure their meter after updating to a version with the new HomeWizard Kwh implementation.
-        // We can remove this code after a few releases, when we are sure most users have updated at least once.
-        _LOG_A("Migrating HomeWizard P1 implementation");
-        //Old implementation just picked the first p1meter entry discovered, so we do the same here
-        const mDNSServiceEntry *service = getmDNSServiceByIndex(EM_HOMEWIZARD, String("p1meter-"), 0, true);
-        if (service != nullptr) {
-            strncpy(MainsMeter.DeviceHostName, service->HostName.c_str(), sizeof(MainsMeter.DeviceHostName));
-            MainsMeter.DeviceHostName[sizeof(MainsMeter.DeviceHostName) - 1] = '\0';
-            write_settings();
-        }
-    }
-
-    if (MainsMeter.Type == EM_HOMEWIZARD && LoadBl < 2) {
-        _LOG_A("Start HomeWizard MainsMeter reading.");
-        const auto evdata = getDataFromHomeWizard(MainsMeter.DeviceHostName);
-#if SMARTEVSE_VERSION < 40 //v3
-        for (int i = 0; i < evdata.first; i++)
-            MainsMeter.Irms[i] = evdata.second[i];
-        if (evdata.first) {
-            CalcIsum();
-            MainsMeter.setTimeout(COMM_TIMEOUT);
-            MainsMeter.Import_active_energy = evdata.second[3];
-            MainsMeter.Export_active_energy = evdata.second[4];
-            MainsMeter.PowerMeasured = evdata.second[5];
-            MainsMeter.UpdateEnergies();
-            _LOG_A("Updated MainsMeter with Irms: %d, %d, %d, ActiveEnergyImport: %u, ActiveEnergyExport: %u, PowerMeasured: %u.\n", evdata.second[0], evdata.second[1], evdata.second[2], evdata.second[3], evdata.second[4], evdata.second[5]);
-        }
-#else
-        Serial1.printf("@Irms:%03u,%d,%d,%d\n", MainsMeter.Address, evdata.second[0], evdata.second[1], evdata.second[2]); //Irms:011,312,123,124 means: the meter on address 11(dec) has Irms[0] 312 dA, Irms[1] of 123 dA, Irms[2] of 124 dA
-#endif
-    }
-
-    if (CircuitMeter.Type == EM_HOMEWIZARD) {
-        _LOG_A("Start HomeWizard CircuitMeter reading.");
-        const auto evdata = getDataFromHomeWizard(CircuitMeter.DeviceHostName);
-#if SMARTEVSE_VERSION < 40 //v3
-        for (int i = 0; i < evdata.first; i++)
-            CircuitMeter.Irms[i] = evdata.second[i];
-        if (evdata.first) {
-            CircuitMeter.CalcImeasured();
-            CircuitMeter.setTimeout(COMM_TIMEOUT);
-            CircuitMeter.Import_active_energy = evdata.second[3];
-            CircuitMeter.Export_active_energy = evdata.second[4];
-            CircuitMeter.PowerMeasured = evdata.second[5];
-            CircuitMeter.UpdateEnergies();
-            _LOG_A("Updated CircuitMeter with Irms: %d, %d, %d, ActiveEnergyImport: %u, ActiveEnergyExport: %u, PowerMeasured: %u.\n", evdata.second[0], evdata.second[1], evdata.second[2], evdata.second[3], evdata.second[4], evdata.second[5]);
-        }
-#else
-        Serial1.printf("@Irms:%03u,%d,%d,%d\n", CircuitMeter.Address, evdata.second[0], evdata.second[1], evdata.second[2]); //Irms:011,312,123,124 means: the meter on address 11(dec) has Irms[0] 312 dA, Irms[1] of 123 dA, Irms[2] of 124 dA
-#endif
-    }
-
-    if (EVMeter.Type == EM_HOMEWIZARD) {
-        _LOG_A("Start HomeWizard EVMeter reading.");
-        const auto evdata = getDataFromHomeWizard(EVMeter.DeviceHostName);
-#if SMARTEVSE_VERSION < 40 //v3
-        for (int i = 0; i < evdata.first; i++)
-            EVMeter.Irms[i] = evdata.second[i];
-        if (evdata.first) {
-            EVMeter.CalcImeasured();
-            EVMeter.setTimeout(COMM_TIMEOUT);
-            EVMeter.Import_active_energy = evdata.second[3];
-            EVMeter.Export_active_energy = evdata.second[4];
-            EVMeter.PowerMeasured = evdata.second[5];
-            EVMeter.UpdateEnergies();
-            _LOG_A("Updated EVMeter with Irms: %d, %d, %d, ActiveEnergyImport: %u, ActiveEnergyExport: %u, PowerMeasured: %u.\n", evdata.second[0], evdata.second[1], evdata.second[2], evdata.second[3], evdata.second[4], evdata.second[5]);
-        }
-#else
-        Serial1.printf("@Irms:%03u,%d,%d,%d\n", EVMeter.Address, evdata.second[0], evdata.second[1], evdata.second[2]); //Irms:011,312,123,124 means: the meter on address 11(dec) has Irms[0] 312 dA, Irms[1] of 123 dA, Irms[2] of 124 dA
-#endif
-    }
-
-    homewizardUpdateInProgress = false;
-    vTaskDelete(NULL);
-}
-
- void homewizard_loop() {
-    static unsigned long lastCheck_homewizard = 0;
-
-    constexpr unsigned long interval = 1950; // 1.95 seconds - With this setting there can be 5 attempts for updating the data before the 10 second Mains Meter timeout.
-    const unsigned long currentTime = millis();
-
-    if (MainsMeter.Type != EM_HOMEWIZARD &&
-            EVMeter.Type != EM_HOMEWIZARD &&
-            CircuitMeter.Type != EM_HOMEWIZARD) {
-        return;
-     }
-
-    if (currentTime - lastCheck_homewizard < interval) {
-        return;
-    }
-    if (homewizardUpdateInProgress) {
-        return;
-    }
-    lastCheck_homewizard = currentTime;
-
-    homewizardUpdateInProgress = true;
-    if (xTaskCreate(
-            homewizard_task,
-            "HomeWizard",
-            3072,
-            NULL,
-            1,
-            NULL) != pdPASS) {
-        _LOG_A("Failed to create HomeWizard task\n");
-        homewizardUpdateInProgress = false;
-    }
-}
-
 void loop() {
 
     network_loop();
@@ -3982,6 +4052,8 @@ void loop() {
         }
 #endif
 
+        SessionTick();
+
          // a reboot is requested, but we kindly wait until EV is not charging
         static uint8_t RebootDelay = 5;      
         if (shouldReboot && State != STATE_C) {                                 //slaves in STATE_C continue charging when Master reboots
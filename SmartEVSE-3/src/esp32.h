@@ -230,6 +230,7 @@ extern struct DelayedTimeStruct DelayedStartTime;
 
 void read_settings();
 void write_settings(void);
+void write_settings_state(void);
 void request_write_settings(void);
 void setSolarStopTimer(uint16_t Timer);
 void setState(uint8_t NewState);
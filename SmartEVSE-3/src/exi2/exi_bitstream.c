@@ -26,65 +26,37 @@
 /*****************************************************************************
  * local functions
  *****************************************************************************/
-static int exi_bitstream_has_overflow(exi_bitstream_t* stream)
+// absolute bit position of the next bit to be read or written
+static size_t exi_bitstream_bit_pos(const exi_bitstream_t* stream)
 {
-    if (stream->bit_count == EXI_BITSTREAM_MAX_BIT_COUNT)
-    {
-        if (stream->byte_pos < stream->data_size)
-        {
-            stream->byte_pos++;
-            stream->bit_count = 0;
-        }
-        else
-        {
-            return EXI_ERROR__BITSTREAM_OVERFLOW;
-        }
-    }
-
-    return EXI_ERROR__NO_ERROR;
+    return stream->byte_pos * EXI_BITSTREAM_MAX_BIT_COUNT + stream->bit_count;
 }
 
-static int exi_bitstream_write_bit(exi_bitstream_t* stream, uint8_t bit)
+// check whether bit_count more bits fit within the stream capacity
+static int exi_bitstream_has_overflow(const exi_bitstream_t* stream, size_t bit_count)
 {
-    // check whether the bit to be written is within the stream capacity
-    if (exi_bitstream_has_overflow(stream))
+    if (exi_bitstream_bit_pos(stream) + bit_count > stream->data_size * EXI_BITSTREAM_MAX_BIT_COUNT)
     {
         return EXI_ERROR__BITSTREAM_OVERFLOW;
     }
 
-    // point to current byte
-    uint8_t* current_byte = stream->data + stream->byte_pos;
-
-    if (stream->bit_count == 0)
-    {
-        // clear everything if at the beginning of a new byte
-        *current_byte = 0;
-    }
-
-    if (bit)
-    {
-        *current_byte = *current_byte | (1u << (EXI_BITSTREAM_MAX_BIT_COUNT - (stream->bit_count + 1u)));
-    }
-
-    stream->bit_count++;
-
     return EXI_ERROR__NO_ERROR;
 }
 
-static int exi_bitstream_read_bit(exi_bitstream_t* stream, uint8_t* bit)
+// move the stream forward by bit_count bits; like the bit-wise implementation
+// the last touched byte stays current (bit_count 1..8), so byte_pos + 1 is the
+// number of bytes used
+static void exi_bitstream_advance(exi_bitstream_t* stream, size_t bit_count)
 {
-    // check whether the bit to be read is within the stream capacity
-    if (exi_bitstream_has_overflow(stream))
+    if (bit_count == 0)
     {
-        return EXI_ERROR__BITSTREAM_OVERFLOW;
+        return;
     }
 
-    uint8_t current_bit = *(stream->data + stream->byte_pos) >> (EXI_BITSTREAM_MAX_BIT_COUNT - (stream->bit_count + 1u));
-    *bit = (current_bit & 1u) ? 1 : 0;
-
-    stream->bit_count++;
+    size_t end = exi_bitstream_bit_pos(stream) + bit_count;
 
-    return EXI_ERROR__NO_ERROR;
+    stream->byte_pos = (end - 1) / EXI_BITSTREAM_MAX_BIT_COUNT;
+    stream->bit_count = (uint8_t)(end - stream->byte_pos * EXI_BITSTREAM_MAX_BIT_COUNT);
 }
 
 /*****************************************************************************
@@ -139,25 +111,58 @@ int exi_bitstream_write_bits(exi_bitstream_t* stream, size_t bit_count, uint32_t
         return EXI_ERROR__BIT_COUNT_LARGER_THAN_TYPE_SIZE;
     }
 
-    int error = EXI_ERROR__NO_ERROR;
+    if (bit_count == 0)
+    {
+        return EXI_ERROR__NO_ERROR;
+    }
+
+    if (exi_bitstream_has_overflow(stream, bit_count))
+    {
+        return EXI_ERROR__BITSTREAM_OVERFLOW;
+    }
 
-    for (size_t n = 0; n < bit_count; n++)
+    size_t pos = exi_bitstream_bit_pos(stream);
+    uint8_t* current_byte = stream->data + pos / EXI_BITSTREAM_MAX_BIT_COUNT;
+    size_t offset = pos % EXI_BITSTREAM_MAX_BIT_COUNT;
+
+    // left align the value within the (at most five) bytes it touches
+    size_t bytes = (offset + bit_count + 7u) / 8u;
+    uint64_t bits = (uint64_t)(value & (0xFFFFFFFFu >> (32u - bit_count)));
+    bits <<= bytes * 8u - offset - bit_count;
+
+    for (size_t n = 0; n < bytes; n++)
     {
-        uint8_t bit;
-        bit = (value & (1u << (bit_count - n - 1))) > 0;
+        uint8_t octet = (uint8_t)(bits >> ((bytes - n - 1u) * 8u));
 
-        error = exi_bitstream_write_bit(stream, bit);
-        if (error != EXI_ERROR__NO_ERROR)
+        if (n == 0 && offset != 0)
+        {
+            // keep the bits already written to the current byte
+            current_byte[n] |= octet;
+        }
+        else
         {
-            break;
+            // new bytes are cleared, so the trailing bits are zero
+            current_byte[n] = octet;
         }
     }
 
-    return error;
+    exi_bitstream_advance(stream, bit_count);
+
+    return EXI_ERROR__NO_ERROR;
 }
 
 int exi_bitstream_write_octet(exi_bitstream_t* stream, uint8_t value)
 {
+    size_t pos = exi_bitstream_bit_pos(stream);
+
+    // fast path for byte aligned octets
+    if ((pos % EXI_BITSTREAM_MAX_BIT_COUNT) == 0 && !exi_bitstream_has_overflow(stream, 8))
+    {
+        stream->data[pos / EXI_BITSTREAM_MAX_BIT_COUNT] = value;
+        exi_bitstream_advance(stream, 8);
+        return EXI_ERROR__NO_ERROR;
+    }
+
     return exi_bitstream_write_bits(stream, 8, (uint32_t)value);
 }
 
@@ -170,39 +175,54 @@ int exi_bitstream_read_bits(exi_bitstream_t* stream, size_t bit_count, uint32_t*
         return EXI_ERROR__BIT_COUNT_LARGER_THAN_TYPE_SIZE;
     }
 
-    int error = EXI_ERROR__NO_ERROR;
+    if (bit_count == 0)
+    {
+        return EXI_ERROR__NO_ERROR;
+    }
 
-    for (size_t n = 0; n < bit_count; n++)
+    if (exi_bitstream_has_overflow(stream, bit_count))
     {
-        uint8_t bit;
-        error = exi_bitstream_read_bit(stream, &bit);
-        if (error != EXI_ERROR__NO_ERROR)
-        {
-            break;
-        }
+        return EXI_ERROR__BITSTREAM_OVERFLOW;
+    }
 
-        *value = (*value << 1u) | bit;
+    size_t pos = exi_bitstream_bit_pos(stream);
+    const uint8_t* current_byte = stream->data + pos / EXI_BITSTREAM_MAX_BIT_COUNT;
+    size_t offset = pos % EXI_BITSTREAM_MAX_BIT_COUNT;
+
+    // gather the (at most five) bytes holding the bits, then shift them out at once
+    size_t bytes = (offset + bit_count + 7u) / 8u;
+    uint64_t bits = 0;
+
+    for (size_t n = 0; n < bytes; n++)
+    {
+        bits = (bits << 8u) | current_byte[n];
     }
-    return error;
+
+    bits >>= bytes * 8u - offset - bit_count;
+    *value = (uint32_t)bits & (0xFFFFFFFFu >> (32u - bit_count));
+
+    exi_bitstream_advance(stream, bit_count);
+
+    return EXI_ERROR__NO_ERROR;
 }
 
 int exi_bitstream_read_octet(exi_bitstream_t* stream, uint8_t* value)
 {
     *value = 0;
 
-    int error = EXI_ERROR__NO_ERROR;
+    size_t pos = exi_bitstream_bit_pos(stream);
 
-    for (int n = 0; n < 8; n++)
+    // fast path for byte aligned octets
+    if ((pos % EXI_BITSTREAM_MAX_BIT_COUNT) == 0 && !exi_bitstream_has_overflow(stream, 8))
     {
-        uint8_t bit;
-        error = exi_bitstream_read_bit(stream, &bit);
-        if (error != EXI_ERROR__NO_ERROR)
-        {
-            break;
-        }
-
-        *value = (*value << 1u) | bit;
+        *value = stream->data[pos / EXI_BITSTREAM_MAX_BIT_COUNT];
+        exi_bitstream_advance(stream, 8);
+        return EXI_ERROR__NO_ERROR;
     }
+
+    uint32_t bits;
+    int error = exi_bitstream_read_bits(stream, 8, &bits);
+    *value = (uint8_t)bits;
+
     return error;
 }
-
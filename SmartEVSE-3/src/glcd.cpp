@@ -1392,18 +1392,25 @@ void GLCD_init(void) {
 #endif
 }
 
+#define LCD_IMAGE_WIDTH  128                                                   // Image width in pixels
+#define LCD_IMAGE_HEIGHT 64                                                    // Image height in pixels
+#define LCD_IMAGE_HEADER 62                                                    // Header (14) + DIB (40) + Palette (8)
+
+static uint8_t LCDImage[LCD_IMAGE_HEADER + sizeof(GLCDbuf2)];                  // BMP image of the LCD, reused for every frame
+static uint32_t LCDImageHash = 0;                                              // hash of GLCDbuf2 the image was created from
+
 /**
  * Write header for BMP 1-bit image.
  *
+ * @param header Buffer of LCD_IMAGE_HEADER bytes
  * @param width Width of the BMP image in pixels
  * @param height Height of the BMP image in pixels
  */
-std::vector<uint8_t> createBMPHeader(const int width, const int height) {
+static void createBMPHeader(uint8_t *header, const int width, const int height) {
     const uint32_t rowSize = (width + 31) / 32 * 4;  // Each row must be a multiple of 4 bytes
-    const uint32_t fileSize = 62 /* header bytes*/ + (rowSize * height / 8);
+    const uint32_t fileSize = LCD_IMAGE_HEADER + (rowSize * height / 8);
 
-    std::vector<uint8_t> headerVector(fileSize);
-    headerVector = {
+    const uint8_t bmpHeader[LCD_IMAGE_HEADER] = {
         'B', 'M',                     // 'BM' Signature
         static_cast<uint8_t>(fileSize & 0xFF),      // Byte 1 (Least Significant Byte)
         static_cast<uint8_t>(fileSize >> 8 & 0xFF), // Byte 2
@@ -1428,78 +1435,80 @@ std::vector<uint8_t> createBMPHeader(const int width, const int height) {
         0xFF, 0xFF, 0xFF, 0x00,       // White (0)
         0x00, 0x00, 0xFF, 0x00,       // Red (1)
     };
-    return headerVector;
+    memcpy(header, bmpHeader, LCD_IMAGE_HEADER);
 }
 
 /**
  * Transposes a 8x8 bit matrix stored in a byte array.
  *
- * This function takes an 8-byte input, where each byte represents a row of 8 bits,
- * and transposes it so that each output byte represents a column of 8 bits.
- * This operation is commonly used for graphical displays that store pixel data
- * in a column-major format.
- *
- * @param[in] input  An array of 8 bytes, where each byte represents a row of 8 bits.
- * @param[out] output An array of 8 bytes, where each byte represents a transposed column of 8 bits.
+ * Each input byte represents a row of 8 bits, each output byte a column of 8 bits
+ * (column-major, as used by the GLCD). The matrix is held in two 32-bit words and
+ * transposed with three rounds of bit swaps (Hacker's Delight, transpose8).
  *
+ * @param[in] input  8 bytes, where each byte represents a row of 8 bits.
+ * @param[out] output Receives the transposed columns, 'stride' bytes apart.
+ * @param[in] stride Distance between the output bytes.
  */
-void transpose8x8(const std::array<uint8_t, 8>& input, std::array<uint8_t, 8>& output) {
-    for (int bitPos = 0; bitPos < 8; ++bitPos) {
-        uint8_t newByte = 0;
-        for (int i = 0; i < 8; ++i) {
-            newByte |= (input[i] >> (7 - bitPos) & 0x01) << (7 - i);
-        }
-        output[bitPos] = newByte;
-    }
+static void transpose8x8(const uint8_t *input, uint8_t *output, const size_t stride) {
+    uint32_t x, y, t;
+
+    x = (input[0] << 24) | (input[1] << 16) | (input[2] << 8) | input[3];
+    y = (input[4] << 24) | (input[5] << 16) | (input[6] << 8) | input[7];
+
+    t = (x ^ (x >> 7)) & 0x00AA00AA;  x = x ^ t ^ (t << 7);                  // swap bits in 2x2 blocks
+    t = (y ^ (y >> 7)) & 0x00AA00AA;  y = y ^ t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000CCCC; x = x ^ t ^ (t << 14);                 // swap 2x2 blocks in 4x4 blocks
+    t = (y ^ (y >> 14)) & 0x0000CCCC; y = y ^ t ^ (t << 14);
+    t = (x & 0xF0F0F0F0) | ((y >> 4) & 0x0F0F0F0F);                           // swap 4x4 blocks
+    y = ((x << 4) & 0xF0F0F0F0) | (y & 0x0F0F0F0F);
+    x = t;
+
+    output[0] = x >> 24;          output[stride] = x >> 16;
+    output[2 * stride] = x >> 8;  output[3 * stride] = x;
+    output[4 * stride] = y >> 24; output[5 * stride] = y >> 16;
+    output[6 * stride] = y >> 8;  output[7 * stride] = y;
 }
 
 /**
  * Processes GLCD buffer data and converts it into a BMP-formatted image.
  *
- * This function takes a graphical LCD (GLCD) buffer, processes it by transposing
- * 8x8 pixel blocks, and formats the output as a BMP image. The function reads
- * the buffer in chunks of 128 bytes, rearranges the bits for correct rendering,
- * and appends the processed data to a BMP header.
+ * The 128-byte rows of the GLCD buffer are stored bottom-up, 8x8 pixel blocks are
+ * transposed straight into a static image buffer. The image is only encoded again
+ * when the contents of GLCDbuf2 changed (compared by hash).
  *
- * @return A vector of `uint8_t` containing the BMP-formatted image data.
+ * @param[out] size Size of the BMP image in bytes.
+ * @param[out] frameHash Optional; hash of the LCD contents, to detect unchanged frames.
+ * @return Pointer to the BMP-formatted image data; valid until the next call.
  */
-std::vector<uint8_t> createImageFromGLCDBuffer() {
-    constexpr int WIDTH = 128;        // Image width in pixels
-    constexpr int HEIGHT = 64;        // Image height in pixels
-    constexpr int CHUNK_SIZE = 128;
-    constexpr int BLOCK_SIZE = 8;
+const uint8_t *createImageFromGLCDBuffer(size_t *size, uint32_t *frameHash) {
+    constexpr size_t CHUNK_SIZE = LCD_IMAGE_WIDTH;
+    constexpr size_t BLOCK_SIZE = 8;
+
+    // hash the LCD buffer, a word at a time
+    uint32_t hash = 2166136261u, word;
+    for (size_t i = 0; i < sizeof(GLCDbuf2); i += sizeof(word)) {
+        memcpy(&word, GLCDbuf2 + i, sizeof(word));
+        hash = (hash ^ word) * 16777619u;
+    }
+
+    *size = sizeof(LCDImage);
+    if (frameHash) *frameHash = hash;
+    if (hash == LCDImageHash && LCDImage[0] == 'B') return LCDImage;
+    LCDImageHash = hash;
 
-    // Initialize with BMP header and pre-allocate memory inn the vector.
-    std::vector<uint8_t> imageData = createBMPHeader(WIDTH, HEIGHT);
+    if (LCDImage[0] != 'B') createBMPHeader(LCDImage, LCD_IMAGE_WIDTH, LCD_IMAGE_HEIGHT);
 
+    uint8_t *out = LCDImage + LCD_IMAGE_HEADER;
     for (size_t chunkOffset = sizeof(GLCDbuf2); chunkOffset > 0; chunkOffset -= CHUNK_SIZE) {
-        // Calculate chunk boundaries.
-        const size_t start = chunkOffset >= CHUNK_SIZE ? chunkOffset - CHUNK_SIZE : 0;
-        const size_t end = chunkOffset;
-
-        // Extract chunk.
-        const std::vector<uint8_t> chunk(GLCDbuf2 + start, GLCDbuf2 + end);
-        std::vector<uint8_t> processed(CHUNK_SIZE);
-
-        // Process the 128-byte chunk in groups of 8.
-        for (int byteIndex = 0; byteIndex < CHUNK_SIZE; byteIndex += BLOCK_SIZE) {
-            std::array<uint8_t, BLOCK_SIZE> input{};
-            std::array<uint8_t, BLOCK_SIZE> output{};
-            std::copy_n(chunk.begin() + byteIndex, BLOCK_SIZE, input.begin());
-
-            transpose8x8(input, output);
-
-            // Distribute transposed bytes into the processed buffer
-            const int newByteIndex = byteIndex / BLOCK_SIZE;
-            for (int j = 0; j < BLOCK_SIZE; ++j) {
-                processed[newByteIndex + j * (CHUNK_SIZE / BLOCK_SIZE)] = output[j];
-            }
-        }
+        const uint8_t *chunk = GLCDbuf2 + chunkOffset - CHUNK_SIZE;
 
-        // Append processed chunk to image data.
-        imageData.insert(imageData.end(), processed.begin(), processed.end());
+        // Process the 128-byte chunk in groups of 8, distribute transposed bytes over the output rows
+        for (size_t byteIndex = 0; byteIndex < CHUNK_SIZE; byteIndex += BLOCK_SIZE) {
+            transpose8x8(chunk + byteIndex, out + byteIndex / BLOCK_SIZE, CHUNK_SIZE / BLOCK_SIZE);
+        }
+        out += CHUNK_SIZE;
     }
-    return imageData;
+    return LCDImage;
 }
 
 #endif
@@ -44,7 +44,7 @@ extern void GLCD(void);
 extern void GLCDMenu(unsigned char Buttons);
 extern void GLCD_init(void);
 extern bool GridRelayOpen;
-extern std::vector<uint8_t> createImageFromGLCDBuffer();
+extern const uint8_t *createImageFromGLCDBuffer(size_t *size, uint32_t *frameHash = NULL);
 
 #if SMARTEVSE_VERSION >= 40
 #include <SPI.h>
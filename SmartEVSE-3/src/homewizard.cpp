@@ -0,0 +1,565 @@
+/*
+;    Project:       Smart EVSE
+;
+;    HomeWizard energy meters, see homewizard.h.
+;
+; Permission is hereby granted, free of charge, to any person obtaining a copy
+; of this software and associated documentation files (the "Software"), to deal
+; in the Software without restriction, including without limitation the rights
+; to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+; copies of the Software, and to permit persons to whom the Software is
+; furnished to do so, subject to the following conditions:
+;
+; The above copyright notice and this permission notice shall be included in
+; all copies or substantial portions of the Software.
+;
+; THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+; IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+; FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+; AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+; LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+; OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+; THE SOFTWARE.
+ */
+
+#ifdef SMARTEVSE_VERSION //ESP32
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <HTTPClient.h>
+#include <Preferences.h>
+#include <ArduinoJson.h>
+#include "esp32.h"
+#include "meter.h"
+#include "utils.h"
+#include "network_common.h"
+#include "homewizard.h"
+
+static HTTPClient homeWizardHttpClient[HOMEWIZARD_DEVICES];                    // one client per device, so each keeps its connection alive
+
+// The values we need from the HomeWizard API, currents in dA, power in W and energy in Wh.
+enum { HW_CURRENT_L1, HW_CURRENT_L2, HW_CURRENT_L3, HW_CURRENT, HW_POWER_L1, HW_POWER_L2, HW_POWER_L3, HW_POWER, HW_IMPORT, HW_EXPORT, HW_KEYS, HW_TYPE = HW_KEYS };
+static const JsonKey HomeWizardV1Keys[HW_KEYS] = {
+    {jsonKeyHash("active_current_l1_a"), 1}, {jsonKeyHash("active_current_l2_a"), 1}, {jsonKeyHash("active_current_l3_a"), 1}, {jsonKeyHash("active_current_a"), 1},
+    {jsonKeyHash("active_power_l1_w"), 0}, {jsonKeyHash("active_power_l2_w"), 0}, {jsonKeyHash("active_power_l3_w"), 0}, {jsonKeyHash("active_power_w"), 0},
+    {jsonKeyHash("total_power_import_kwh"), 3}, {jsonKeyHash("total_power_export_kwh"), 3},
+};
+static const JsonKey HomeWizardV2Keys[HW_KEYS + 1] = {
+    {jsonKeyHash("current_l1_a"), 1}, {jsonKeyHash("current_l2_a"), 1}, {jsonKeyHash("current_l3_a"), 1}, {jsonKeyHash("current_a"), 1},
+    {jsonKeyHash("power_l1_w"), 0}, {jsonKeyHash("power_l2_w"), 0}, {jsonKeyHash("power_l3_w"), 0}, {jsonKeyHash("power_w"), 0},
+    {jsonKeyHash("energy_import_kwh"), 3}, {jsonKeyHash("energy_export_kwh"), 3},
+    {jsonKeyHash("type"), 0},                                                   // message type of the websocket feed
+};
+
+static std::pair<int8_t, std::array<std::int32_t, 6> > decodeHomeWizard(const JsonExtractor &json, const int32_t *values);
+
+/**
+ * @brief Retrieves active current values from a HomeWizard V1 API.
+ *
+ * This function sends an HTTP GET request to the specified URL to fetch the active current data
+ * in JSON format, parses the JSON response, and retrieves specific fields for current.
+ * Every device has its own HTTP client, the connection is kept open between requests.
+ *
+ * @param hostname The mDNS hostname of the meter
+ * @param device   The client to use, 0 - HOMEWIZARD_DEVICES-1
+ *
+ * @return A pair containing:
+ *     - A int flag indicating: 0: failure, 1: single phase current, 3: 3 phase current
+ *     - An array of 6 values representing the active current in deci-amps for L1, L2, L3, total, import, and export
+ */
+std::pair<int8_t, std::array<std::int32_t, 6> > getDataFromHomeWizard(const char *hostname, uint8_t device) {
+    _LOG_A("Invocation\n");
+    if (hostname == nullptr || hostname[0] == '\0') {
+        _LOG_A("No hostname provided.\n");
+        return {false, {0, 0, 0, 0, 0, 0}};
+    }
+    char url[64];
+    snprintf(url, sizeof(url), "http://%s/api/v1/data", hostname);
+
+    _LOG_A("Connect to URL %s\n", url);
+
+
+    HTTPClient *httpClient = &homeWizardHttpClient[device];
+    // begin() reuses the open connection when the host did not change. The headers are cleared by begin().
+    httpClient->begin(url);
+    httpClient->setReuse(true);
+    httpClient->setConnectTimeout(1000);
+    httpClient->setTimeout(1500);
+    httpClient->addHeader("User-Agent", "SmartEVSE-v3");
+    httpClient->addHeader("Accept", "application/json");
+
+    // Handle HTTP errors or timeout.
+    const int httpCode = httpClient->GET();
+    if (httpCode != HTTP_CODE_OK) {
+        _LOG_A("Error on HTTP request (httpCode=%i), url=%s.\n", httpCode, url);
+        httpClient->end(); // Always cleanup, a failed connection will not be reused
+        if (httpCode < 0) {
+            lastMdnsQueryTime = 0; // Force immediate rediscovery on next attempt if the error was a connection failure
+            _LOG_A("Connection failed, allowing immediate rediscovery.\n");
+        }
+        return {false, {0, 0, 0, 0, 0, 0}};
+    }
+
+    // Get the response stream, and extract the values while reading it
+    WiFiClient *stream = httpClient->getStreamPtr();
+    int32_t values[HW_KEYS] = {};
+    JsonExtractor json(HomeWizardV1Keys, HW_KEYS, values);
+    int remaining = httpClient->getSize();                                      // -1 if the server did not send the length
+    char buf[128];
+
+    while (!json.done() && remaining) {
+        const int available = stream->available();
+        size_t len = remaining > 0 ? remaining : (available > 0 ? available : 1);
+        len = stream->readBytes(buf, len < sizeof(buf) ? len : sizeof(buf));
+        if (!len || !json.parse(buf, len)) break;
+        if (remaining > 0) remaining -= len;
+    }
+    httpClient->end();
+
+    // Handle JSON parsing errors.
+    if (!json.done()) {
+        _LOG_A("JSON parsing failed\n");
+        return {false, {0, 0, 0, 0, 0, 0}};
+    }
+
+    return decodeHomeWizard(json, values);
+}
+
+/**
+ * @brief Convert the currents, power and energy totals of a HomeWizard measurement.
+ *
+ * The V1 and V2 API use the same units, only the names of the fields differ.
+ *
+ * @return See getDataFromHomeWizard()
+ */
+static std::pair<int8_t, std::array<std::int32_t, 6> > decodeHomeWizard(const JsonExtractor &json, const int32_t *values) {
+    // A three phase meter reports the current per phase, and may add the total; a single phase meter reports
+    // either the total current, or the current of the phase it is connected to.
+    int8_t phases = 0;
+    uint8_t currentKey = HW_CURRENT;
+    for (uint8_t i = HW_CURRENT_L1; i <= HW_CURRENT_L3; i++) {
+        if (json.found(i)) {
+            phases++;
+            currentKey = i;
+        }
+    }
+    if (!phases && json.found(HW_CURRENT))
+        phases = 1;
+
+    if (!phases) {
+        // Early return on missing data.
+        _LOG_A("Required JSON fields 'active_current_a' not found\n");
+        return {phases, {0, 0, 0, 0, 0, 0}};
+    }
+
+    std::array<int32_t, 6> evdata{};
+    _LOG_A("Reading %u-phase data\n", phases);
+
+    // Determine grid direction based on power: negative indicates feed-in, positive indicates usage.
+    auto getCorrection = [&json, values](uint8_t powerKey) -> int8_t {
+        return json.found(powerKey) && values[powerKey] < 0 ? -1 : 1;
+    };
+
+    if (phases == 1) {
+        // Single phase case: use the current that was found, and the power of the same phase for correction
+        uint8_t powerKey = currentKey == HW_CURRENT ? HW_POWER : HW_POWER_L1 + currentKey - HW_CURRENT_L1;
+        if (!json.found(powerKey))
+            powerKey = HW_POWER;
+        evdata[0] = std::abs(values[currentKey]) * getCorrection(powerKey);
+    }
+    else{
+        // Process all three phases, a phase that is not reported reads 0A.
+        for (size_t i = 0; i < 3; ++i) {
+            int32_t rawCurrent = json.found(HW_CURRENT_L1 + i) ? values[HW_CURRENT_L1 + i] : 0;
+            evdata[i] = std::abs(rawCurrent) * getCorrection(HW_POWER_L1 + i);
+        }
+        phases = 3;
+    }
+    evdata[3] = json.found(HW_IMPORT) ? values[HW_IMPORT] : 0; // total import in Wh
+    evdata[4] = json.found(HW_EXPORT) ? values[HW_EXPORT] : 0; // total export in Wh
+    evdata[5] = json.found(HW_POWER) ? values[HW_POWER] : 0; // total power in Watts
+
+return {phases, evdata};
+}
+
+/*
+ * HomeWizard V2 API push feed
+ *
+ * Meters that are paired with the V2 API stream their measurements over a websocket, wss://<ip>/api/ws.
+ * Pairing: POST /api/user, which is accepted within 30 seconds after the button on the meter is pressed,
+ * and returns a token that we store in the preferences, together with the SHA-256 of the certificate the meter
+ * presented. The feed only sends the token to a meter with that same certificate.
+ * The websocket is authorized with the token and then subscribed to "measurement"; every update is handed
+ * to homewizardUpdate() as soon as it arrives. As long as updates arrive the V1 polling of that meter is paused,
+ * when the feed fails, polling takes over again.
+ */
+struct HomeWizardFeed {
+    struct mg_connection *Conn;
+    uint32_t Ip;                                                                // address in use by the feed, 0 = unknown
+    volatile uint32_t PendingIp;                                                // resolved by the polling task, applied by the timer
+    char Token[40];
+    uint8_t Cert[32];                                                           // SHA-256 of the certificate of the paired meter
+    uint8_t PairCert[32];                                                       // of the meter that pairing is talking to
+    volatile unsigned long LastUpdate;                                          // millis() of the last measurement
+    unsigned long PairUntil;                                                    // pairing is active until this millis()
+    bool Pairing;
+};
+static HomeWizardFeed HomeWizardFeeds[HOMEWIZARD_DEVICES] = {};
+
+static void homewizardUrl(uint8_t device, const char *path, char *url, size_t size) {
+    const uint32_t ip = HomeWizardFeeds[device].Ip;
+    snprintf(url, size, "https://%u.%u.%u.%u%s", ip & 0xff, (ip >> 8) & 0xff, (ip >> 16) & 0xff, ip >> 24, path);
+}
+
+static void homewizardTls(struct mg_connection *c) {
+    // The meters use a certificate signed by the HomeWizard CA, with the serial number as name. That CA is not
+    // included, so the chain is not verified: the certificate is pinned at pairing, see homewizardCertHash().
+    struct mg_tls_opts opts = {.ca = mg_str(""), .cert = mg_str(""), .key = mg_str(""), .name = mg_str(""), .skip_verification = 1};
+    mg_tls_init(c, &opts);
+}
+
+// SHA-256 of the certificate the meter presented, call on MG_EV_TLS_HS. False when there is none.
+static bool homewizardCertHash(struct mg_connection *c, uint8_t hash[32]) {
+    struct mg_tls *tls = (struct mg_tls *) c->tls;
+    if (tls == NULL) return false;
+#if MG_TLS == MG_TLS_MBED
+    const mbedtls_x509_crt *cert = mbedtls_ssl_get_peer_cert(&tls->ssl);
+    if (cert == NULL) return false;
+    mg_sha256(hash, cert->raw.p, cert->raw.len);
+    return true;
+#elif MG_TLS == MG_TLS_OPENSSL                                                  // host builds
+    X509 *cert = SSL_get1_peer_certificate(tls->ssl);
+    unsigned char *der = NULL;
+    const int len = cert ? i2d_X509(cert, &der) : 0;
+    X509_free(cert);
+    if (len <= 0) return false;
+    mg_sha256(hash, der, len);
+    OPENSSL_free(der);
+    return true;
+#else
+    return false;
+#endif
+}
+
+static void fn_homewizard_ws(struct mg_connection *c, int ev, void *ev_data) {
+    const uint8_t device = (uintptr_t)c->fn_data;
+    HomeWizardFeed &feed = HomeWizardFeeds[device];
+
+    if (ev == MG_EV_CONNECT) {
+        homewizardTls(c);
+    } else if (ev == MG_EV_TLS_HS) {
+        uint8_t cert[32];
+        if (!homewizardCertHash(c, cert) || memcmp(cert, feed.Cert, sizeof(cert))) {  // before the token is sent
+            _LOG_A("HomeWizard feed %u: the meter at this address is not the paired meter\n", device);
+            c->is_closing = 1;
+        }
+    } else if (ev == MG_EV_ERROR) {
+        _LOG_A("HomeWizard feed %u error %s\n", device, (char *) ev_data);
+    } else if (ev == MG_EV_WS_OPEN) {
+        mg_ws_printf(c, WEBSOCKET_OP_TEXT, "{%m:%m,%m:%m}", MG_ESC("type"), MG_ESC("authorization"), MG_ESC("data"), MG_ESC(feed.Token));
+    } else if (ev == MG_EV_WS_MSG) {
+        struct mg_ws_message *wm = (struct mg_ws_message *) ev_data;
+        int32_t values[HW_KEYS + 1] = {};
+        JsonExtractor json(HomeWizardV2Keys, HW_KEYS + 1, values);
+        if (!json.parse(wm->data.buf, wm->data.len) || !json.done() || !json.found(HW_TYPE)) return;
+
+        const uint32_t type = values[HW_TYPE];
+        if (type == jsonKeyHash("authorized")) {
+            _LOG_A("HomeWizard feed %u authorized\n", device);
+            mg_ws_printf(c, WEBSOCKET_OP_TEXT, "{%m:%m,%m:%m}", MG_ESC("type"), MG_ESC("subscribe"), MG_ESC("data"), MG_ESC("measurement"));
+        } else if (type == jsonKeyHash("measurement")) {
+            const auto evdata = decodeHomeWizard(json, values);
+            if (evdata.first) {
+                feed.LastUpdate = millis();
+                homewizardUpdate(device, evdata);
+            }
+        } else if (type == jsonKeyHash("error")) {
+            _LOG_A("HomeWizard feed %u: %.*s\n", device, (int) wm->data.len, wm->data.buf);
+        }
+    } else if (ev == MG_EV_CLOSE) {
+        _LOG_A("HomeWizard feed %u closed\n", device);
+        feed.Conn = NULL;
+    }
+}
+
+static void fn_homewizard_pair(struct mg_connection *c, int ev, void *ev_data) {
+    const uint8_t device = (uintptr_t)c->fn_data;
+    HomeWizardFeed &feed = HomeWizardFeeds[device];
+
+    if (ev == MG_EV_CONNECT) {
+        homewizardTls(c);
+        const char *body = "{\"name\":\"local/smartevse\"}";
+        mg_printf(c, "POST /api/user HTTP/1.1\r\nHost: %M\r\nX-Api-Version: 2\r\nContent-Type: application/json\r\nContent-Length: %u\r\n\r\n%s",
+                  mg_print_ip, &c->rem, (unsigned) strlen(body), body);
+    } else if (ev == MG_EV_TLS_HS) {
+        if (!homewizardCertHash(c, feed.PairCert)) {
+            _LOG_A("HomeWizard pairing %u: no certificate\n", device);
+            c->is_closing = 1;
+        }
+    } else if (ev == MG_EV_HTTP_MSG) {
+        struct mg_http_message *hm = (struct mg_http_message *) ev_data;
+        char *token = mg_json_get_str(hm->body, "$.token");
+        if (mg_http_status(hm) == 200 && token && strlen(token) < sizeof(feed.Token)) {
+            strcpy(feed.Token, token);
+            memcpy(feed.Cert, feed.PairCert, sizeof(feed.Cert));
+            feed.Pairing = false;
+            Preferences prefs;                                                  // the global preferences object is used by other tasks
+            if (prefs.begin("settings", false)) {
+                char key[] = "HWToken0", certKey[] = "HWCert0";
+                key[7] += device;
+                certKey[6] += device;
+                prefs.putString(key, feed.Token);
+                prefs.putBytes(certKey, feed.Cert, sizeof(feed.Cert));
+                prefs.end();
+            }
+            _LOG_A("HomeWizard meter %u paired\n", device);
+        }
+        free(token);
+        c->is_draining = 1;
+    } else if (ev == MG_EV_ERROR) {
+        _LOG_A("HomeWizard pairing %u error %s\n", device, (char *) ev_data);
+    }
+}
+
+// (Re)connect the push feeds and retry pairing, runs every 2 seconds from the mongoose event loop.
+void homewizard_timer_fn(void *arg) {
+    struct mg_mgr *mgr = (struct mg_mgr *) arg;
+    char url[48];
+
+    for (uint8_t device = 0; device < HOMEWIZARD_DEVICES; device++) {
+        HomeWizardFeed &feed = HomeWizardFeeds[device];
+        const uint32_t ip = feed.PendingIp;
+        if (ip != feed.Ip) {                                                    // new address, reconnect the feed
+            if (!feed.Token[0]) {
+                Preferences prefs;                                              // the global preferences object is used by other tasks
+                if (prefs.begin("settings", true)) {
+                    char key[] = "HWToken0", certKey[] = "HWCert0";
+                    key[7] += device;
+                    certKey[6] += device;
+                    strncpy(feed.Token, prefs.getString(key, "").c_str(), sizeof(feed.Token) - 1);
+                    if (feed.Token[0] && prefs.getBytes(certKey, feed.Cert, sizeof(feed.Cert)) != sizeof(feed.Cert)) {
+                        _LOG_A("HomeWizard meter %u was paired without its certificate, pair it again\n", device);
+                        feed.Token[0] = '\0';
+                    }
+                    prefs.end();
+                }
+            }
+            feed.Ip = ip;
+            if (feed.Conn) feed.Conn->is_closing = 1;
+        }
+        if (!feed.Ip) continue;
+        if (feed.Pairing) {
+            if ((long)(millis() - feed.PairUntil) > 0) {
+                _LOG_A("HomeWizard pairing %u timed out, was the button pressed?\n", device);
+                feed.Pairing = false;
+            } else {
+                homewizardUrl(device, "/api/user", url, sizeof(url));
+                mg_http_connect(mgr, url, fn_homewizard_pair, (void *)(uintptr_t)device);
+            }
+        } else if (feed.Token[0] && feed.Conn == NULL) {
+            homewizardUrl(device, "/api/ws", url, sizeof(url));
+            feed.Conn = mg_ws_connect(mgr, url, fn_homewizard_ws, (void *)(uintptr_t)device, NULL);
+        }
+    }
+}
+
+/**
+ * @brief Set the IP address of a HomeWizard meter.
+ *
+ * Called by the polling task, which can resolve the mDNS hostname. Mongoose is not thread safe, so the address
+ * is only published here; the timer on the mongoose task loads the token and (re)connects the feed to it.
+ */
+void homewizardSetAddress(uint8_t device, uint32_t ip) {
+    HomeWizardFeeds[device].PendingIp = ip;
+}
+
+/**
+ * @brief True when the V2 push feed of this meter delivered a measurement in the last 5 seconds.
+ */
+bool homewizardPushActive(uint8_t device) {
+    const unsigned long last = HomeWizardFeeds[device].LastUpdate;
+    return last && millis() - last < 5000;
+}
+
+/**
+ * @brief Start pairing with the V2 API, or forget the token when pair is false.
+ *
+ * @return false if the address of the meter is not known yet
+ */
+bool homewizardPair(uint8_t device, bool pair) {
+    HomeWizardFeed &feed = HomeWizardFeeds[device];
+    if (!pair) {
+        feed.Token[0] = '\0';
+        feed.Pairing = false;
+        if (feed.Conn) feed.Conn->is_closing = 1;
+        Preferences prefs;                                                      // the global preferences object is used by other tasks
+        if (prefs.begin("settings", false)) {
+            char key[] = "HWToken0", certKey[] = "HWCert0";
+            key[7] += device;
+            certKey[6] += device;
+            prefs.remove(key);
+            prefs.remove(certKey);
+            prefs.end();
+        }
+        return true;
+    }
+    if (!feed.Ip) return false;
+    feed.Pairing = true;
+    feed.PairUntil = millis() + 30000;
+    return true;
+}
+
+#define HOMEWIZARD_INTERVAL 1950                                                // ms between readings
+#define HOMEWIZARD_BACKOFF 2                                                    // max doublings of the interval of a meter that timed out
+
+/**
+  * Periodically retrieves current measurements from networked energy meters
+  * and updates the meters' currents and energies.
+  *
+  * Every HomeWizard meter has its own long-lived task with its own keep-alive HTTP connection,
+  * so a slow or unreachable device does not delay the readings of the other meters.
+  * The meters are read every 1.95 seconds, so there are 5 attempts before a meter times out after COMM_TIMEOUT.
+  * Only a meter that has timed out is read less often: after every error the interval is doubled, up to 7.8 seconds.
+  */
+struct HomeWizardDevice {
+    Meter *Device;
+    const char *Name;
+    TaskHandle_t Task;
+    unsigned long LastRead;                                                     // millis() of the last valid reading
+    uint32_t Reads;
+    uint32_t Errors;
+    uint16_t Latency;                                                           // ms, duration of the last request
+    uint16_t MaxLatency;
+    uint8_t Backoff;                                                            // consecutive errors
+};
+static HomeWizardDevice HomeWizard[HOMEWIZARD_DEVICES] = {
+    { &MainsMeter, "MainsMeter" },
+    { &CircuitMeter, "CircuitMeter" },
+    { &EVMeter, "EVMeter" },
+};
+
+bool homewizardEnabled(uint8_t device) {
+    if (HomeWizard[device].Device->Type != EM_HOMEWIZARD) return false;
+    return HomeWizard[device].Device != &MainsMeter || LoadBl < 2;
+}
+
+static void homewizardMigrate(void) {
+    if (strlen(MainsMeter.DeviceHostName) == 0 && MainsMeter.Type == EM_HOMEWIZARD && LoadBl < 2) { //Mains Initialize
+        // Prevent existing HomeWizard P1 users from having to reconfigure their meter after updating to a version with the new HomeWizard Kwh implementation.
+        // We can remove this code after a few releases, when we are sure most users have updated at least once.
+        _LOG_A("Migrating HomeWizard P1 implementation");
+        //Old implementation just picked the first p1meter entry discovered, so we do the same here
+        const mDNSServiceEntry *service = getmDNSServiceByIndex(EM_HOMEWIZARD, String("p1meter-"), 0, true);
+        if (service != nullptr) {
+            strncpy(MainsMeter.DeviceHostName, service->HostName.c_str(), sizeof(MainsMeter.DeviceHostName));
+            MainsMeter.DeviceHostName[sizeof(MainsMeter.DeviceHostName) - 1] = '\0';
+            write_settings();
+        }
+    }
+}
+
+/**
+  * Update the meter with a HomeWizard reading, from either the V1 polling task or the V2 push feed.
+  */
+void homewizardUpdate(uint8_t device, const std::pair<int8_t, std::array<std::int32_t, 6>> &evdata) {
+    HomeWizardDevice &hw = HomeWizard[device];
+    Meter &meter = *hw.Device;
+
+    if (evdata.first) {
+        hw.Reads++;
+        hw.Backoff = 0;
+        hw.LastRead = millis();
+    } else {
+        hw.Errors++;
+        if (hw.Backoff < HOMEWIZARD_BACKOFF) hw.Backoff++;
+    }
+#if SMARTEVSE_VERSION < 40 //v3
+    for (int i = 0; i < evdata.first; i++)
+        meter.Irms[i] = evdata.second[i];
+    if (evdata.first) {
+        if (&meter == &MainsMeter) CalcIsum();
+        else meter.CalcImeasured();
+        meter.setTimeout(COMM_TIMEOUT);
+        meter.Import_active_energy = evdata.second[3];
+        meter.Export_active_energy = evdata.second[4];
+        meter.PowerMeasured = evdata.second[5];
+        meter.UpdateEnergies();
+        _LOG_A("Updated %s with Irms: %d, %d, %d, ActiveEnergyImport: %u, ActiveEnergyExport: %u, PowerMeasured: %u.\n", hw.Name, evdata.second[0], evdata.second[1], evdata.second[2], evdata.second[3], evdata.second[4], evdata.second[5]);
+    }
+#else
+    Serial1.printf("@Irms:%03u,%d,%d,%d\n", meter.Address, evdata.second[0], evdata.second[1], evdata.second[2]); //Irms:011,312,123,124 means: the meter on address 11(dec) has Irms[0] 312 dA, Irms[1] of 123 dA, Irms[2] of 124 dA
+#endif
+}
+
+static void homewizard_task(void *parameter) {
+    const uint8_t device = (uintptr_t)parameter;
+    HomeWizardDevice &hw = HomeWizard[device];
+    Meter &meter = *hw.Device;
+    TickType_t lastWake = xTaskGetTickCount();
+    IPAddress ip;
+
+    while (1) {
+        if (!homewizardEnabled(device)) {                                       // meter was reconfigured
+            vTaskDelay(1000 / portTICK_PERIOD_MS);
+            lastWake = xTaskGetTickCount();
+            continue;
+        }
+        if (&meter == &MainsMeter) homewizardMigrate();
+
+        // The V2 push feed connects by IP address, mongoose can not resolve .local names
+        if (meter.DeviceHostName[0] && ((uint32_t)ip == 0 || hw.Backoff)) {
+            String host = String(meter.DeviceHostName);
+            if (host.indexOf(':') > 0) host = host.substring(0, host.indexOf(':'));
+            if (WiFi.hostByName(host.c_str(), ip) == 1) homewizardSetAddress(device, (uint32_t)ip);
+        }
+        if (homewizardPushActive(device)) {                                     // V2 feed is running, no need to poll
+            vTaskDelayUntil(&lastWake, HOMEWIZARD_INTERVAL / portTICK_PERIOD_MS);
+            continue;
+        }
+
+        _LOG_A("Start HomeWizard %s reading.", hw.Name);
+        const unsigned long start = millis();
+        const auto evdata = getDataFromHomeWizard(meter.DeviceHostName, device);
+        hw.Latency = millis() - start;
+        if (hw.Latency > hw.MaxLatency) hw.MaxLatency = hw.Latency;
+        homewizardUpdate(device, evdata);
+        // Errors before the timeout are retried at the normal interval, backing off then would let the meter time out
+        const bool timedOut = !hw.LastRead || millis() - hw.LastRead >= COMM_TIMEOUT * 1000UL;
+        vTaskDelayUntil(&lastWake, (HOMEWIZARD_INTERVAL << (timedOut ? hw.Backoff : 0)) / portTICK_PERIOD_MS);
+    }
+}
+
+void homewizard_loop(void) {
+    for (uint8_t device = 0; device < HOMEWIZARD_DEVICES; device++) {
+        // The task is started once the meter is configured, and keeps running
+        if (HomeWizard[device].Task != NULL || !homewizardEnabled(device)) continue;
+        if (xTaskCreate(
+                homewizard_task,
+                "HomeWizard",
+                3072,
+                (void *)(uintptr_t)device,
+                1,
+                &HomeWizard[device].Task) != pdPASS) {
+            _LOG_A("Failed to create HomeWizard task\n");
+            HomeWizard[device].Task = NULL;
+        }
+    }
+}
+
+/**
+  * Add the statistics of the HomeWizard meter to the json object of that meter
+  * age_ms is the age of the meter reading that the load balancing currently uses.
+  */
+void homewizardStats(JsonObject obj, Meter *meter) {
+    for (const auto &hw : HomeWizard) {
+        if (hw.Device != meter || hw.Task == NULL) continue;
+        obj["reads"] = hw.Reads;
+        obj["errors"] = hw.Errors;
+        obj["latency_ms"] = hw.Latency;
+        obj["max_latency_ms"] = hw.MaxLatency;
+        obj["age_ms"] = hw.LastRead ? millis() - hw.LastRead : 0;
+        obj["push"] = homewizardPushActive(&hw - HomeWizard);
+    }
+}
+
+#endif
@@ -0,0 +1,30 @@
+/*
+ * HomeWizard energy meters
+ *
+ * HomeWizard P1 and kWh meters on the local network can be used as mains, circuit and EV meter. Every configured
+ * meter is read by a task of its own over the V1 HTTP API. A meter that is paired with the V2 API pushes its
+ * measurements over a websocket instead; while that feed delivers, the V1 polling of the meter pauses.
+ */
+
+#ifndef __HOMEWIZARD_H
+#define __HOMEWIZARD_H
+
+#include <array>
+#include <utility>
+#include <ArduinoJson.h>
+
+#define HOMEWIZARD_DEVICES 3                                                    // Mains, Circuit and EV meter
+
+class Meter;
+
+std::pair<int8_t, std::array<std::int32_t, 6>> getDataFromHomeWizard(const char *hostname, uint8_t device);
+void homewizardUpdate(uint8_t device, const std::pair<int8_t, std::array<std::int32_t, 6>> &evdata);
+void homewizardSetAddress(uint8_t device, uint32_t ip);
+bool homewizardPushActive(uint8_t device);
+bool homewizardPair(uint8_t device, bool pair);
+bool homewizardEnabled(uint8_t device);
+void homewizardStats(JsonObject obj, Meter *meter);                            // statistics for /settings
+void homewizard_loop(void);                                                     // starts the task of every configured meter
+void homewizard_timer_fn(void *arg);                                            // V2 push feeds, every 2 s on the mongoose task
+
+#endif
@@ -1,6 +1,7 @@
 #if SMARTEVSE_VERSION >= 40
 #include <Arduino.h>
 #include "qca.h"
+#include "ipv6.h"
 #include "debug.h"
 
 const uint8_t broadcastIPv6[16] = { 0xff, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1};
@@ -22,28 +23,11 @@ uint8_t DiscoveryReqTransportProtocol;
 
 
 
-#define NEXT_UDP 0x11 /* next protocol is UDP */
-#define NEXT_ICMPv6 0x3a /* next protocol is ICMPv6 */
 
 #define UDP_PAYLOAD_LEN 100
 uint8_t udpPayload[UDP_PAYLOAD_LEN];
 uint16_t udpPayloadLen;
 
-#define V2G_FRAME_LEN 100
-uint8_t v2gFrameLen;
-uint8_t V2GFrame[V2G_FRAME_LEN];
-
-#define UDP_RESPONSE_LEN 100
-uint8_t UdpResponseLen;
-uint8_t UdpResponse[UDP_RESPONSE_LEN];
-
-#define IP_RESPONSE_LEN 100
-uint8_t IpResponseLen;
-uint8_t IpResponse[IP_RESPONSE_LEN];
-
-#define PSEUDO_HEADER_LEN 40
-uint8_t pseudoHeader[PSEUDO_HEADER_LEN];
-
 extern void evaluateTcpPacket(void);
 
 void setSeccIp() {
@@ -63,156 +47,126 @@ void setSeccIp() {
 }
 
 
-uint16_t calculateUdpAndTcpChecksumForIPv6(uint8_t *UdpOrTcpframe, uint16_t UdpOrTcpframeLen, const uint8_t *ipv6source, const uint8_t *ipv6dest, uint8_t nxt) {
-	uint16_t evenFrameLen, i, value16, checksum;
-	uint32_t totalSum;
+// One's complement sum (RFC 1071) over a buffer. The 16-bit words are added in native byte order,
+// 32 bits at a time, into a 64-bit accumulator; the carries are folded only once at the end.
+// Every part of the sum must start at an even offset, only the last part may have an odd length.
+static uint64_t checksumAdd(uint64_t sum, const uint8_t *data, uint16_t len) {
+    uint32_t word32;
+    uint16_t word16;
+
+    while (len >= 4) {
+        memcpy(&word32, data, 4);
+        sum += word32;
+        data += 4;
+        len -= 4;
+    }
+    if (len >= 2) {
+        memcpy(&word16, data, 2);
+        sum += word16;
+        data += 2;
+        len -= 2;
+    }
+    if (len) {                                  // odd length, pad with a zero byte
+        uint8_t pad[2] = { *data, 0 };
+        memcpy(&word16, pad, 2);
+        sum += word16;
+    }
+    return sum;
+}
+
+
+uint16_t calculateUdpAndTcpChecksumForIPv6(const uint8_t *UdpOrTcpframe, uint16_t UdpOrTcpframeLen, const uint8_t *ipv6source, const uint8_t *ipv6dest, uint8_t nxt) {
     // Parameters:
     // UdpOrTcpframe: the udp frame or tcp frame, including udp/tcp header and udp/tcp payload
     // ipv6source: the 16 byte IPv6 source address. Must be the same, which is used later for the transmission.
     // ipv6source: the 16 byte IPv6 destination address. Must be the same, which is used later for the transmission.
-	// nxt: The next-protocol. 0x11 for UDP, ... for TCP.
-	//
-    // Goal: construct an array, consisting of a 40-byte-pseudo-ipv6-header, and the udp frame (consisting of udp header and udppayload).
-	// For memory efficienty reason, we do NOT copy the pseudoheader and the udp frame together into one new array. Instead, we are using
-	// a dedicated pseudo-header-array, and the original udp buffer.
-	evenFrameLen = UdpOrTcpframeLen;
-	if ((evenFrameLen & 1)!=0) {
-        /* if we have an odd buffer length, we need to add a padding byte in the end, because the sum calculation
-           will need 16-bit-aligned data. */
-		evenFrameLen++;
-		UdpOrTcpframe[evenFrameLen-1] = 0; /* Fill the padding byte with zero. */
-	}
-    memset(pseudoHeader, 0, PSEUDO_HEADER_LEN);
-    /* fill the pseudo-ipv6-header */
-    for (i=0; i<16; i++) { /* copy 16 bytes IPv6 addresses */
-        pseudoHeader[i] = ipv6source[i]; /* IPv6 source address */
-        pseudoHeader[16+i] = ipv6dest[i]; /* IPv6 destination address */
-	}
-    pseudoHeader[32] = 0; // # high byte of the FOUR byte length is always 0
-    pseudoHeader[33] = 0; // # 2nd byte of the FOUR byte length is always 0
-    pseudoHeader[34] = UdpOrTcpframeLen >> 8; // # 3rd
-    pseudoHeader[35] = UdpOrTcpframeLen & 0xFF; // # low byte of the FOUR byte length
-    pseudoHeader[36] = 0; // # 3 padding bytes with 0x00
-    pseudoHeader[37] = 0;
-    pseudoHeader[38] = 0;
-    pseudoHeader[39] = nxt; // # the nxt is at the end of the pseudo header
-    // pseudo-ipv6-header finished.
-    // Run the checksum over the concatenation of the pseudoheader and the buffer.
-
-
-    totalSum = 0;
-	for (i=0; i<PSEUDO_HEADER_LEN/2; i++) { // running through the pseudo header, in 2-byte-steps
-        value16 = pseudoHeader[2*i] * 256 + pseudoHeader[2*i+1]; // take the current 16-bit-word
-        totalSum += value16; // we start with a normal addition of the value to the totalSum
-        // But we do not want normal addition, we want a 16 bit one's complement sum,
-        // see https://en.wikipedia.org/wiki/User_Datagram_Protocol
-        if (totalSum>=65536) { // On each addition, if a carry-out (17th bit) is produced,
-            totalSum-=65536; // swing that 17th carry bit around
-            totalSum+=1; // and add it to the least significant bit of the running total.
-		}
-	}
-	for (i=0; i<evenFrameLen/2; i++) { // running through the udp buffer, in 2-byte-steps
-        value16 = UdpOrTcpframe[2*i] * 256 + UdpOrTcpframe[2*i+1]; // take the current 16-bit-word
-        totalSum += value16; // we start with a normal addition of the value to the totalSum
-        // But we do not want normal addition, we want a 16 bit one's complement sum,
-        // see https://en.wikipedia.org/wiki/User_Datagram_Protocol
-        if (totalSum>=65536) { // On each addition, if a carry-out (17th bit) is produced,
-            totalSum-=65536; // swing that 17th carry bit around
-            totalSum+=1; // and add it to the least significant bit of the running total.
-		}
-	}
-    // Finally, the sum is then one's complemented to yield the value of the UDP checksum field.
-    checksum = (uint16_t) (totalSum ^ 0xffff);
-
-    return checksum;
+    // nxt: The next-protocol. 0x11 for UDP, ... for TCP.
+    //
+    // The checksum runs over a 40-byte pseudo-ipv6-header followed by the frame. The pseudo header
+    // is not built in memory, its parts are summed directly.
+    // On received frames (checksum field filled in) the result is 0 when the checksum is correct.
+    uint8_t lengthAndNxt[8] = { 0, 0, (uint8_t)(UdpOrTcpframeLen >> 8), (uint8_t)UdpOrTcpframeLen, 0, 0, 0, nxt };
+    uint64_t totalSum = 0;
+    uint16_t checksum;
+
+    totalSum = checksumAdd(totalSum, ipv6source, 16);
+    totalSum = checksumAdd(totalSum, ipv6dest, 16);
+    totalSum = checksumAdd(totalSum, lengthAndNxt, 8);
+    totalSum = checksumAdd(totalSum, UdpOrTcpframe, UdpOrTcpframeLen);
+
+    // swing the carries around, see https://en.wikipedia.org/wiki/User_Datagram_Protocol
+    while (totalSum >> 16) totalSum = (totalSum & 0xffff) + (totalSum >> 16);
+
+    // Finally, the sum is one's complemented, and converted from native to network byte order.
+    checksum = (uint16_t)~totalSum;
+    uint8_t *bytes = (uint8_t *)&checksum;
+    return (bytes[0] << 8) | bytes[1];
 }
 
-void packResponseIntoEthernet() {
-    // packs the IP packet into an ethernet packet
-    uint8_t i;
-    uint16_t EthTxFrameLen;
-
-    EthTxFrameLen = IpResponseLen + 6 + 6 + 2;  // Ethernet header needs 14 bytes:
-                                                //  6 bytes destination MAC
-                                                //  6 bytes source MAC
-                                                //  2 bytes EtherType
-    for (i=0; i<6; i++) {       // fill the destination MAC with the source MAC of the received package
-        txbuffer[i] = rxbuffer[6+i];
-    }
-    setMacAt(myMac,6); // bytes 6 to 11 are the source MAC
+
+// Transmit frames are built in place in txbuffer: the payload is written at its final offset
+// (after ETHERNET_HEADER_LEN + IP6_HEADER_LEN), and the headers are filled in front of it, so no
+// intermediate buffers are needed. Returns the length of the ethernet frame.
+uint16_t packIntoIpv6(const uint8_t *destMac, const uint8_t *destIp, uint8_t nxt, uint8_t hopLimit, uint16_t payloadLen) {
+    uint8_t *IpHeader = txbuffer + ETHERNET_HEADER_LEN;
+
+    setMacAt((uint8_t *)destMac, 0); // bytes 0 to 5 are the destination MAC
+    setMacAt(myMac, 6); // bytes 6 to 11 are the source MAC
     txbuffer[12] = 0x86; // 86dd is IPv6
     txbuffer[13] = 0xdd;
-    for (i=0; i<IpResponseLen; i++) {
-        txbuffer[14+i] = IpResponse[i];
-    }
 
-    qcaspi_write_burst(txbuffer, EthTxFrameLen);
-}
+    IpHeader[0] = 0x60; // traffic class, flow
+    IpHeader[1] = 0;
+    IpHeader[2] = 0;
+    IpHeader[3] = 0;
+    IpHeader[4] = payloadLen >> 8; // length of the payload. Without headers.
+    IpHeader[5] = payloadLen & 0xFF;
+    IpHeader[6] = nxt; // next level protocol
+    IpHeader[7] = hopLimit;
+    // We are the EVSE. So the SeccIp is our own link-local IP address.
+    memcpy(IpHeader+8, SeccIp, 16); // source IP address
+    memcpy(IpHeader+24, destIp, 16); // destination IP address
 
-void packResponseIntoIp(void) {
-  // # embeds the (SDP) response into the lower-layer-protocol: IP, Ethernet
-  uint8_t i;
-  uint16_t plen;
-  IpResponseLen = UdpResponseLen + 8 + 16 + 16; // # IP6 header needs 40 bytes:
-                                              //  #   4 bytes traffic class, flow
-                                              //  #   2 bytes destination port
-                                              //  #   2 bytes length (incl checksum)
-                                              //  #   2 bytes checksum
-  IpResponse[0] = 0x60; // # traffic class, flow
-  IpResponse[1] = 0;
-  IpResponse[2] = 0;
-  IpResponse[3] = 0;
-  plen = UdpResponseLen; // length of the payload. Without headers.
-  IpResponse[4] = plen >> 8;
-  IpResponse[5] = plen & 0xFF;
-  IpResponse[6] = 0x11; // next level protocol, 0x11 = UDP in this case
-  IpResponse[7] = 0x0A; // hop limit
-    for (i=0; i<16; i++) {
-    IpResponse[8+i] = SeccIp[i]; // source IP address
-    IpResponse[24+i] = EvccIp[i]; // destination IP address
-  }
-  for (i=0; i<UdpResponseLen; i++) {
-    IpResponse[40+i] = UdpResponse[i];
-  }
-  packResponseIntoEthernet();
+    return ETHERNET_HEADER_LEN + IP6_HEADER_LEN + payloadLen;
 }
 
 
-void packResponseIntoUdp(void) {
-    //# embeds the (SDP) request into the lower-layer-protocol: UDP
+void packResponseIntoUdp(uint16_t v2gFrameLen) {
+    //# embeds the (SDP) response, already at txbuffer + UDP_PAYLOAD_OFFSET, into the lower-layer-protocol: UDP
     //# Reference: wireshark trace of the ioniq car
-    uint16_t lenInclChecksum;
-    uint16_t checksum;
-    UdpResponseLen = v2gFrameLen + 8; // # UDP header needs 8 bytes:
+    uint8_t *UdpResponse = txbuffer + ETHERNET_HEADER_LEN + IP6_HEADER_LEN;
+    uint16_t UdpResponseLen = v2gFrameLen + UDP_HEADER_LEN; // # UDP header needs 8 bytes:
                                         //           #   2 bytes source port
                                         //           #   2 bytes destination port
                                         //           #   2 bytes length (incl checksum)
                                         //           #   2 bytes checksum
+    uint16_t checksum;
+
     UdpResponse[0] = 15118 >> 8;
     UdpResponse[1] = 15118  & 0xFF;
     UdpResponse[2] = evccPort >> 8;
     UdpResponse[3] = evccPort & 0xFF;
-
-    lenInclChecksum = UdpResponseLen;
-    UdpResponse[4] = lenInclChecksum >> 8;
-    UdpResponse[5] = lenInclChecksum & 0xFF;
+    UdpResponse[4] = UdpResponseLen >> 8;
+    UdpResponse[5] = UdpResponseLen & 0xFF;
     // checksum will be calculated afterwards
     UdpResponse[6] = 0;
     UdpResponse[7] = 0;
-    memcpy(UdpResponse+8, V2GFrame, v2gFrameLen);
     // The content of buffer is ready. We can calculate the checksum. see https://en.wikipedia.org/wiki/User_Datagram_Protocol
-    checksum =calculateUdpAndTcpChecksumForIPv6(UdpResponse, UdpResponseLen, SeccIp, EvccIp, NEXT_UDP);
+    checksum = calculateUdpAndTcpChecksumForIPv6(UdpResponse, UdpResponseLen, SeccIp, EvccIp, NEXT_UDP);
     UdpResponse[6] = checksum >> 8;
     UdpResponse[7] = checksum & 0xFF;
-    packResponseIntoIp();
+
+    // fill the destination MAC with the source MAC of the received package
+    qcaspi_write_burst(txbuffer, packIntoIpv6(rxbuffer+6, EvccIp, NEXT_UDP, 0x0A, UdpResponseLen));
 }
 
 
 // SECC Discovery Response.
 // The response from the charger to the EV, which transfers the IPv6 address of the charger to the car.
 void sendSdpResponse() {
-    uint8_t lenSdp;
-    uint8_t SdpPayload[20]; // SDP response has 20 bytes
+    uint8_t *V2GFrame = txbuffer + UDP_PAYLOAD_OFFSET;
+    uint8_t lenSdp = 20; // SDP response has 20 bytes
+    uint8_t *SdpPayload = V2GFrame + 8;
 
     memcpy(SdpPayload, SeccIp, 16); // 16 bytes IPv6 address of the charger.
                                     // This IP address is based on the MAC of the ESP32, with 0xfffe in the middle.
@@ -228,7 +182,6 @@ void sendSdpResponse() {
     SdpPayload[19] = 0x00; // transport protocol. We only support "TCP, 0x00".
 
     // add the SDP header
-    lenSdp = sizeof(SdpPayload);
     V2GFrame[0] = 0x01; // version
     V2GFrame[1] = 0xfe; // version inverted
     V2GFrame[2] = 0x90; // payload type. 0x9001 is the SDP response message
@@ -237,9 +190,7 @@ void sendSdpResponse() {
     V2GFrame[5] = (lenSdp >> 16) & 0xff;
     V2GFrame[6] = (lenSdp >> 8) & 0xff;
     V2GFrame[7] = lenSdp & 0xff;
-    memcpy(V2GFrame+8, SdpPayload, lenSdp);         // ToDo: Check lenSdp against buffer size!
-    v2gFrameLen = lenSdp + 8;
-    packResponseIntoUdp();
+    packResponseIntoUdp(lenSdp + 8);
 }
 
 
@@ -329,26 +280,7 @@ void evaluateNeighborSolicitation(void) {
     memcpy(NeighborsMac, rxbuffer+6, 6);
 
     /* send a NeighborAdvertisement as response. */
-    // destination MAC = neighbors MAC
-    setMacAt(NeighborsMac, 0); // bytes 0 to 5 are the destination MAC
-    // source MAC = my MAC
-    setMacAt(myMac, 6); // bytes 6 to 11 are the source MAC
-    // Ethertype 86DD
-    txbuffer[12] = 0x86; // # 86dd is IPv6
-    txbuffer[13] = 0xdd;
-    txbuffer[14] = 0x60; // # traffic class, flow
-    txbuffer[15] = 0;
-    txbuffer[16] = 0;
-    txbuffer[17] = 0;
-    // plen
     #define ICMP_LEN 32 /* bytes in the ICMPv6 */
-    txbuffer[18] = 0;
-    txbuffer[19] = ICMP_LEN;
-    txbuffer[20] = NEXT_ICMPv6;
-    txbuffer[21] = 0xff;
-    // We are the EVSE. So the SeccIp is our own link-local IP address.
-    memcpy(txbuffer+22, SeccIp, 16); // source IP address
-    memcpy(txbuffer+38, NeighborsIp, 16); // destination IP address
     /* here starts the ICMPv6 */
     txbuffer[54] = 0x88; /* Neighbor Advertisement */
     txbuffer[55] = 0;
@@ -372,13 +304,13 @@ void evaluateNeighborSolicitation(void) {
 
     _LOG_I("transmitting Neighbor Advertisement\n");
     /* Length of the NeighborAdvertisement = 86*/
-    qcaspi_write_burst(txbuffer, 86);
+    qcaspi_write_burst(txbuffer, packIntoIpv6(NeighborsMac, NeighborsIp, NEXT_ICMPv6, 0xff, ICMP_LEN));
 }
 
 
 void IPv6Manager(uint16_t rxbytes) {
     uint16_t x;
-    uint16_t nextheader;
+    uint16_t nextheader, plen;
     uint8_t icmpv6type;
 
    // _LOG_D("\n[RX] ");
@@ -391,7 +323,16 @@ void IPv6Manager(uint16_t rxbytes) {
         //# extract the source ipv6 address
         memcpy(sourceIp, rxbuffer+22, 16);
         nextheader = rxbuffer[20];
-        if (nextheader == 0x11) { //  it is an UDP frame
+        plen = rxbuffer[18]*256 + rxbuffer[19]; /* length of the IP payload */
+        if (nextheader == NEXT_UDP || nextheader == NEXT_TCP || nextheader == NEXT_ICMPv6) {
+            // A correct checksum over pseudo header and frame (including the checksum field) sums to 0.
+            if (ETHERNET_HEADER_LEN + IP6_HEADER_LEN + plen > rxbytes ||
+                calculateUdpAndTcpChecksumForIPv6(rxbuffer+54, plen, rxbuffer+22, rxbuffer+38, nextheader)) {
+                _LOG_W("[IPv6] checksum error or truncated packet, dropping it.\n");
+                return;
+            }
+        }
+        if (nextheader == NEXT_UDP) { //  it is an UDP frame
             _LOG_I("Its a UDP.\n");
             sourceport = rxbuffer[54]*256 + rxbuffer[55];
             destinationport = rxbuffer[56]*256 + rxbuffer[57];
@@ -412,7 +353,7 @@ void IPv6Manager(uint16_t rxbytes) {
                 evaluateUdpPayload();
             }
         }
-        if (nextheader == 0x06) { // # it is an TCP frame
+        if (nextheader == NEXT_TCP) { // # it is an TCP frame
         //    _LOG_D("TCP received\n");
             evaluateTcpPacket();
         }
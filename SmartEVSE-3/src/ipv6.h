@@ -1,4 +1,16 @@
 #if SMARTEVSE_VERSION >= 40
+#define NEXT_TCP 0x06                               // the next protocol is TCP
+#define NEXT_UDP 0x11                               // next protocol is UDP
+#define NEXT_ICMPv6 0x3a                            // next protocol is ICMPv6
+
+#define ETHERNET_HEADER_LEN 14                      // # Ethernet header needs 14 bytes:
+                                                    // #  6 bytes destination MAC
+                                                    // #  6 bytes source MAC
+                                                    // #  2 bytes EtherType
+#define IP6_HEADER_LEN 40                           // # IP6 header needs 40 bytes: 8 + 16 + 16
+#define UDP_HEADER_LEN 8
+#define UDP_PAYLOAD_OFFSET (ETHERNET_HEADER_LEN + IP6_HEADER_LEN + UDP_HEADER_LEN)
+
 extern uint16_t evccPort;
 extern uint16_t seccPort;
 extern uint16_t evccTcpPort;
@@ -7,5 +19,6 @@ extern uint8_t EvccIp[];
 
 void setSeccIp();
 void IPv6Manager(uint16_t rxbytes);
-uint16_t calculateUdpAndTcpChecksumForIPv6(uint8_t *UdpOrTcpframe, uint16_t UdpOrTcpframeLen, const uint8_t *ipv6source, const uint8_t *ipv6dest, uint8_t nxt);
+uint16_t calculateUdpAndTcpChecksumForIPv6(const uint8_t *UdpOrTcpframe, uint16_t UdpOrTcpframeLen, const uint8_t *ipv6source, const uint8_t *ipv6dest, uint8_t nxt);
+uint16_t packIntoIpv6(const uint8_t *destMac, const uint8_t *destIp, uint8_t nxt, uint8_t hopLimit, uint16_t payloadLen);
 #endif
@@ -639,6 +639,7 @@ void setMode(uint8_t NewMode) {
 
 
     //make mode and start/stoptimes persistent on reboot
+    write_settings_state();
     request_write_settings();
 #else //CH32
     printf("@Mode:%u.\n", NewMode); //a
@@ -973,6 +974,7 @@ void setAccess(AccessStatus_t Access) { //c
     }
 
     //make AccessStatus and CardOffset persistent on reboot
+    write_settings_state();
     request_write_settings();
 
 #if MQTT
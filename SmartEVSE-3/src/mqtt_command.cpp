@@ -0,0 +1,115 @@
+/*
+;    Project:       Smart EVSE
+;
+;    MQTT /Set/ command dispatch, see mqtt_command.h.
+;
+; Permission is hereby granted, free of charge, to any person obtaining a copy
+; of this software and associated documentation files (the "Software"), to deal
+; in the Software without restriction, including without limitation the rights
+; to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+; copies of the Software, and to permit persons to whom the Software is
+; furnished to do so, subject to the following conditions:
+;
+; The above copyright notice and this permission notice shall be included in
+; all copies or substantial portions of the Software.
+;
+; THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+; IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+; FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+; AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+; LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+; OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+; THE SOFTWARE.
+ */
+
+#ifdef SMARTEVSE_VERSION //ESP32
+
+#include <string.h>
+#include "mqtt_command.h"
+
+uint32_t mqttHashLen(const char *s, size_t len) {
+    uint32_t h = 2166136261u;
+    while (len--) h = (h ^ (uint8_t)*s++) * 16777619u;
+    return h;
+}
+
+// compare payload with a literal
+bool mqttIs(const char *payload, size_t len, const char *str) {
+    return strlen(str) == len && !memcmp(payload, str, len);
+}
+
+// Parse a signed decimal integer; returns false if no digits were found.
+// *end (optional) points to the first character after the number.
+bool mqttParseInt(const char *s, size_t len, int32_t *value, const char **end) {
+    const char *p = s, *e = s + len;
+    bool neg = false;
+    int32_t v = 0;
+
+    while (p < e && (*p == ' ' || *p == '\t')) p++;
+    if (p < e && (*p == '-' || *p == '+')) neg = (*p++ == '-');
+    const char *digits = p;
+    while (p < e && *p >= '0' && *p <= '9') v = v * 10 + (*p++ - '0');
+    if (end) *end = p;
+    if (p == digits) return false;
+    *value = neg ? -v : v;
+    return true;
+}
+
+// Same semantics as String::toInt(): returns 0 when the payload is not a number
+int32_t mqttToInt(const char *s, size_t len) {
+    int32_t value = 0;
+    mqttParseInt(s, len, &value);
+    return value;
+}
+
+// Parse up to 'max' integers separated by 'sep' (like sscanf("%d:%d:%d")), returns the number of values parsed
+uint8_t mqttParseList(const char *s, size_t len, char sep, int32_t *values, uint8_t max) {
+    const char *p = s, *e = s + len;
+    uint8_t n = 0;
+
+    while (n < max) {
+        if (!mqttParseInt(p, e - p, &values[n], &p)) break;
+        n++;
+        if (p >= e || *p != sep) break;
+        p++;
+    }
+    return n;
+}
+
+MqttCommands_t::MqttCommands_t(const MqttCommand *commands, uint8_t count) : Commands(commands) {
+    memset(Slot, 0xFF, sizeof(Slot));
+    memset(Last, 0, sizeof(Last));
+    if (count > MQTT_CMD_MAX) count = MQTT_CMD_MAX;
+    for (uint8_t i = 0; i < count; i++) {
+        uint8_t slot = commands[i].hash & (MQTT_CMD_SLOTS - 1);
+        while (Slot[slot] != 0xFF) slot = (slot + 1) & (MQTT_CMD_SLOTS - 1);
+        Slot[slot] = i;
+    }
+}
+
+const MqttCommand *MqttCommands_t::find(const char *suffix, size_t len) const {
+    uint32_t hash = mqttHashLen(suffix, len);
+    uint8_t slot = hash & (MQTT_CMD_SLOTS - 1);
+    while (Slot[slot] != 0xFF) {
+        const MqttCommand *cmd = &Commands[Slot[slot]];
+        if (cmd->hash == hash && mqttIs(suffix, len, cmd->suffix)) return cmd;
+        slot = (slot + 1) & (MQTT_CMD_SLOTS - 1);
+    }
+    return NULL;
+}
+
+// Look up the command and run its handler, unless it is rate limited. *cmd (optional) is the command found.
+MqttDispatch MqttCommands_t::dispatch(const char *suffix, size_t len, const char *payload, size_t payload_len,
+                                      uint32_t now, const MqttCommand **cmd) {
+    const MqttCommand *found = find(suffix, len);
+    if (cmd) *cmd = found;
+    if (!found) return MQTT_CMD_UNKNOWN;
+
+    uint32_t *last = &Last[found - Commands];
+    if (found->minInterval && *last && (now - *last) < found->minInterval) return MQTT_CMD_LIMITED;
+    if (!found->handler(payload, payload_len)) return MQTT_CMD_REJECTED;
+    *last = now ? now : 1;
+    return MQTT_CMD_ACCEPTED;
+}
+
+#endif
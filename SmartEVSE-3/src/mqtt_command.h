@@ -0,0 +1,56 @@
+/*
+ * MQTT /Set/ command dispatch
+ *
+ * The topic prefix is stripped once, the remaining suffix is looked up in a hashed command table and the payload
+ * is parsed in place. Payloads are not null terminated, so every parser takes a length. This keeps the receive
+ * path free of String allocations, which matters when an energy manager pushes /Set/MainsMeter every second.
+ *
+ * A command can be rate limited: it is dropped when it arrives less than minInterval ms after the last command
+ * its handler accepted. A rejected payload does not count, so a malformed message can not hold back the next one.
+ */
+
+#ifndef __MQTT_COMMAND_H
+#define __MQTT_COMMAND_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MQTT_CMD_SLOTS 64                                                       // power of 2
+#define MQTT_CMD_MAX (MQTT_CMD_SLOTS / 2)                                       // keeps the probe sequences short
+
+struct MqttCommand {
+    const char *suffix;                                                         // topic after "<MQTTprefix>/Set/"
+    uint32_t hash;                                                              // mqttHash(suffix)
+    bool (*handler)(const char *payload, size_t len);                           // false when the payload is rejected
+    uint16_t minInterval;                                                       // rate limit in ms, 0 = no limit
+};
+
+#define MQTT_CMD(name, interval) { #name, mqttHash(#name), mqttSet##name, interval }
+
+enum MqttDispatch { MQTT_CMD_UNKNOWN, MQTT_CMD_LIMITED, MQTT_CMD_REJECTED, MQTT_CMD_ACCEPTED };
+
+// FNV-1a hash, usable at compile time so the command table carries precomputed hashes
+static constexpr uint32_t mqttHash(const char *s, uint32_t h = 2166136261u) {
+    return *s ? mqttHash(s + 1, (h ^ (uint8_t)*s) * 16777619u) : h;
+}
+
+uint32_t mqttHashLen(const char *s, size_t len);
+bool mqttIs(const char *payload, size_t len, const char *str);
+bool mqttParseInt(const char *s, size_t len, int32_t *value, const char **end = NULL);
+int32_t mqttToInt(const char *s, size_t len);
+uint8_t mqttParseList(const char *s, size_t len, char sep, int32_t *values, uint8_t max);
+
+class MqttCommands_t {
+public:
+    MqttCommands_t(const MqttCommand *commands, uint8_t count);                 // count <= MQTT_CMD_MAX
+    const MqttCommand *find(const char *suffix, size_t len) const;
+    MqttDispatch dispatch(const char *suffix, size_t len, const char *payload, size_t payload_len, uint32_t now,
+                          const MqttCommand **cmd = NULL);
+
+private:
+    const MqttCommand *Commands;
+    uint8_t Slot[MQTT_CMD_SLOTS];                                               // open addressing index into Commands, 0xFF = empty
+    uint32_t Last[MQTT_CMD_MAX];                                                // millis() of the last accepted command, 0 = never
+};
+
+#endif
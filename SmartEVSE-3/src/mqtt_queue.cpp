@@ -0,0 +1,110 @@
+/*
+;    Project:       Smart EVSE
+;
+;    Outbound MQTT queue, see mqtt_queue.h.
+;
+; Permission is hereby granted, free of charge, to any person obtaining a copy
+; of this software and associated documentation files (the "Software"), to deal
+; in the Software without restriction, including without limitation the rights
+; to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+; copies of the Software, and to permit persons to whom the Software is
+; furnished to do so, subject to the following conditions:
+;
+; The above copyright notice and this permission notice shall be included in
+; all copies or substantial portions of the Software.
+;
+; THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+; IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+; FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+; AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+; LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+; OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+; THE SOFTWARE.
+ */
+
+#ifdef SMARTEVSE_VERSION //ESP32
+
+#include "mqtt_queue.h"
+
+static SemaphoreHandle_t MqttQueueMutex = xSemaphoreCreateMutex();             // publish() runs in several tasks
+
+// Oldest queued message, preferring retained (state) or non retained (telemetry) messages
+MqttQueue_t::queued_t *MqttQueue_t::oldest(bool retained) {
+    queued_t *found = NULL;
+    for (uint8_t i = 0; i < MQTT_QUEUE_SIZE; i++) {
+        queued_t *q = &queue[i];
+        if (!q->topic.length()) continue;
+        if (!found || (q->retained == retained && found->retained != retained) || (q->retained == found->retained && q->seq < found->seq)) found = q;
+    }
+    return found;
+}
+
+void MqttQueue_t::dequeue(queued_t *q) {
+    QueuedBytes -= q->topic.length() + q->payload.length();
+    q->topic = "";
+    q->payload = "";
+    Queued--;
+}
+
+// Queue a message, replacing the queued value of its topic; returns false when it was dropped
+bool MqttQueue_t::push(const String &topic, const String &payload, bool retained, uint8_t qos) {
+    uint16_t size = topic.length() + payload.length();
+    queued_t *slot = NULL, *evict;
+    bool queued = false;
+    xSemaphoreTake(MqttQueueMutex, portMAX_DELAY);
+
+    for (uint8_t i = 0; i < MQTT_QUEUE_SIZE; i++) {
+        if (queue[i].topic == topic) {                                          // same topic queued, replace the value
+            dequeue(&queue[i]);
+            Coalesced++;
+            slot = &queue[i];
+            break;
+        }
+    }
+    for (uint8_t i = 0; !slot && i < MQTT_QUEUE_SIZE; i++) {
+        if (!queue[i].topic.length()) slot = &queue[i];
+    }
+    // make room, but never evict state for telemetry, and nothing for a message that would not fit anyway
+    uint16_t evictable = 0;
+    for (uint8_t i = 0; i < MQTT_QUEUE_SIZE; i++) {
+        if (queue[i].topic.length() && (retained || !queue[i].retained)) evictable += queue[i].topic.length() + queue[i].payload.length();
+    }
+    while (QueuedBytes - evictable + size <= MQTT_QUEUE_BYTES && (!slot || QueuedBytes + size > MQTT_QUEUE_BYTES) &&
+           (evict = oldest(false)) && (retained || !evict->retained)) {
+        dequeue(evict);
+        Dropped++;
+        if (!slot) slot = evict;
+    }
+
+    if (slot && QueuedBytes + size <= MQTT_QUEUE_BYTES) {
+        slot->topic = topic;
+        slot->payload = payload;
+        slot->retained = retained;
+        slot->qos = qos;
+        slot->seq = seq++;
+        QueuedBytes += size;
+        Queued++;
+        queued = true;
+    } else {
+        Dropped++;
+    }
+    xSemaphoreGive(MqttQueueMutex);
+    return queued;
+}
+
+// Take the next message to send: state first, oldest first; returns false when the queue is empty
+bool MqttQueue_t::pop(String &topic, String &payload, bool &retained, uint8_t &qos) {
+    xSemaphoreTake(MqttQueueMutex, portMAX_DELAY);
+    queued_t *next = oldest(true);
+    if (next) {
+        topic = next->topic;
+        payload = next->payload;
+        retained = next->retained;
+        qos = next->qos;
+        dequeue(next);
+    }
+    xSemaphoreGive(MqttQueueMutex);
+    return next != NULL;
+}
+
+#endif
@@ -0,0 +1,41 @@
+/*
+ * Outbound MQTT queue
+ *
+ * MQTTclient_t::publish() queues its messages here, and MQTTclient_t::loop() hands them to the client only while
+ * the connection keeps up. The queue holds one message per topic, a newer value replaces the queued one. It is
+ * bounded in messages and in bytes, so a stalled broker costs at most MQTT_QUEUE_BYTES of heap. Retained (state)
+ * messages are sent before telemetry, and telemetry is dropped first when the queue is full; state is never
+ * dropped to make room for telemetry.
+ */
+
+#ifndef __MQTT_QUEUE_H
+#define __MQTT_QUEUE_H
+
+#include <Arduino.h>
+
+#define MQTT_QUEUE_SIZE   80                                                    // max. number of queued messages (one per topic)
+#define MQTT_QUEUE_BYTES  8192                                                  // max. heap used by queued topics and payloads
+
+class MqttQueue_t {
+public:
+    bool push(const String &topic, const String &payload, bool retained, uint8_t qos);
+    bool pop(String &topic, String &payload, bool &retained, uint8_t &qos);
+    uint32_t Coalesced = 0;                                                     // queued messages replaced by a newer value on the same topic
+    uint32_t Dropped = 0;                                                       // messages dropped because the queue was full
+    uint8_t Queued = 0;
+    uint16_t QueuedBytes = 0;
+private:
+    struct queued_t {
+        String topic;
+        String payload;
+        uint32_t seq;
+        uint8_t qos;
+        bool retained;
+    };
+    queued_t queue[MQTT_QUEUE_SIZE];
+    uint32_t seq = 0;
+    queued_t *oldest(bool retained);
+    void dequeue(queued_t *q);
+};
+
+#endif
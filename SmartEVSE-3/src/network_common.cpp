@@ -7,8 +7,10 @@
 #include "mbedtls/sha256.h"
 #include "utils.h"
 #include "network_common.h"
+#include "delta.h"
 #include "glcd.h"
 #include "esp32.h"
+#include "homewizard.h"
 #include <ArduinoJson.h>
 
 #include <HTTPClient.h>
@@ -23,6 +25,8 @@
 
 #if SMARTEVSE_VERSION >=30
 #include "OneWire.h"
+#include "session.h"
+#include "settings.h"
 #endif
 
 #ifndef DEBUG_DISABLED
@@ -57,6 +61,7 @@ bool MQTTSmartServer = false;               // Use mqtt.smartevse.nl server, can
 bool MQTTSmartServerChanged = false;        // Flag to trigger reconnect from network_loop()
 bool WIFImodeChanged = false;               // Flag to trigger handleWIFImode() from network_loop()
 String MQTTprivatePassword;                 // mqtt.smartevse.nl pre calculated password (hash of ec_private key)
+uint8_t MQTTStateMode = MQTT_STATE_TOPICS;  // Publish state per metric, as JSON document, or both
 #endif
 
 // WebSocket LCD image timer and connection tracking
@@ -132,12 +137,8 @@ void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event
         MQTTclient.connected = false;
         break;
     case MQTT_EVENT_DATA:
-        {
-        String topic2 = String(event->topic).substring(0,event->topic_len);
-        String payload2 = String(event->data).substring(0,event->data_len);
-        //_LOG_A("Received MQTT EVENT DATA: topic=%s, payload=%s.\n", topic2.c_str(), payload2.c_str());
-        mqtt_receive_callback(topic2, payload2);
-        }
+        //_LOG_A("Received MQTT EVENT DATA: topic=%.*s, payload=%.*s.\n", event->topic_len, event->topic, event->data_len, event->data);
+        mqtt_receive_callback(event->topic, event->topic_len, event->data, event->data_len);
         break;
     case MQTT_EVENT_ERROR:
         _LOG_I("MQTT_EVENT_ERROR; Last errno string (%s)", strerror(event->error_handle->esp_transport_sock_errno));
@@ -200,21 +201,71 @@ void MQTTclient_t::disconnect(void) {
 #endif
 
 
-//wrapper so MQTTClient::Publish works
+// Queue a message; it is sent from network_loop() when the client can take it
 void MQTTclient_t::publish(const String &topic, const String &payload, bool retained, int qos) {
+    if (MQTTHost == "") return;                                                 // MQTT not configured
+    Queue.push(topic, payload, retained, qos);
+}
+
+// Backpressure: only hand over messages while the connection keeps up
+bool MQTTclient_t::canSend(void) {
+    if (!connected) return false;
 #if MQTT_ESP == 0
-    if (s_conn && connected) {
-        struct mg_mqtt_opts opts = default_opts;
-        opts.topic = mg_str(topic.c_str());
-        opts.message = mg_str(payload.c_str());
-        opts.qos = qos;
-        opts.retain = retained;
-        mg_mqtt_pub(s_conn, &opts);
-    }
+    return s_conn && s_conn->send.len < MQTT_OUTBOX_LIMIT;
 #else
-    if (connected && client)
-        esp_mqtt_client_publish(client, topic.c_str(), payload.c_str(), payload.length(), qos, retained);
+    return client && esp_mqtt_client_get_outbox_size(client) < MQTT_OUTBOX_LIMIT;
+#endif
+}
+
+void MQTTclient_t::send(const char *topic, const char *payload, uint16_t len, bool retained, int qos) {
+#if MQTT_ESP == 0
+    if (!s_conn || !connected) return;
+    struct mg_mqtt_opts opts = default_opts;
+    opts.topic = mg_str(topic);
+    opts.message = mg_str_n(payload, len);
+    opts.qos = qos;
+    opts.retain = retained;
+    mg_mqtt_pub(s_conn, &opts);
+#else
+    if (!connected || !client) return;
+    // Small messages are stored in the outbox and sent back to back by the MQTT task;
+    // messages larger than the output buffer can only be sent directly (in fragments).
+    if (len < 400)
+        esp_mqtt_client_enqueue(client, topic, payload, len, qos, retained, true);
+    else
+        esp_mqtt_client_publish(client, topic, payload, len, qos, retained);
 #endif
+    TxMessages++;
+    TxBytes += strlen(topic) + len;
+}
+
+// called by network_loop(); sends queued messages, state first, oldest first
+void MQTTclient_t::loop(void) {
+    String topic, payload;
+    bool retained;
+    uint8_t qos;
+    while (Queue.Queued && canSend() && Queue.pop(topic, payload, retained, qos))
+        send(topic.c_str(), payload.c_str(), payload.length(), retained, qos);
+
+    if (!announceEntities) return;
+
+    // announce a few entities per call, in between the state messages
+    for (uint8_t n = 0; n < 4 && announceIndex < announceCount && canSend(); announceIndex++) {
+        const MQTTentity_t &entity = announceEntities[announceIndex];
+        uint8_t condition = entity.flags & MQTT_ENTITY_CONDITIONS;
+        if (condition && !(condition & announceMask)) continue;
+        announce(entity);
+        n++;
+    }
+    if (announceIndex >= announceCount) {
+        announceEntities = NULL;
+        _LOG_A("MQTT: discovery announced in %lu ms, free heap %u, lowest %u.\n", millis() - announceStart, ESP.getFreeHeap(), ESP.getMinFreeHeap());
+        Preferences prefs;                                                      // the global preferences object is used by other tasks
+        if (prefs.begin("settings", false)) {
+            prefs.putULong("MQTTannounce", announceHash);
+            prefs.end();
+        }
+    }
 }
 
 void MQTTclient_t::subscribe(const String &topic, int qos) {
@@ -231,34 +282,103 @@ void MQTTclient_t::subscribe(const String &topic, int qos) {
 #endif
 }
 
+static uint32_t fnv1a(uint32_t h, const char *s) {
+    while (*s) h = (h ^ (uint8_t)*s++) * 16777619u;
+    return h;
+}
 
-void MQTTclient_t::announce(const String& entity_name, const String& domain, const String& optional_payload) {
-    String entity_suffix = entity_name;
-    entity_suffix.replace(" ", "");
-    String topic = "homeassistant/" + domain + "/" + MQTTprefix + "-" + entity_suffix + "/config";
-
-    // Build default_entity_id: must be lowercase, only [a-z0-9_] allowed. See: https://www.home-assistant.io/docs/configuration/customizing-devices/
-    String default_entity_id = domain + "." + MQTTprefix + "_" + entity_suffix;
-    default_entity_id.toLowerCase();
-    default_entity_id.replace("-", "_");
+// Appends to a fixed buffer; output is truncated (and not sent) when it does not fit
+static bool appendf(char *buf, size_t size, size_t *len, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(buf + *len, size - *len, format, args);
+    va_end(args);
+    if (n < 0 || *len + n >= size) return false;
+    *len += n;
+    return true;
+}
 
-    const String config_url = "http://" + WiFi.localIP().toString();
+/*
+ * Write the discovery config of one entity straight from the entity table into a static buffer,
+ * so announcing does not build dozens of temporary Strings on the heap.
+ */
+void MQTTclient_t::announce(const MQTTentity_t &entity) {
+    static char topic[128], payload[1024];
+    char suffix[32], entity_id[96];
+    const char *prefix = MQTTprefix.c_str();
+    size_t i, n = 0, len = 0;
+
+    for (i = 0; entity.name[i] && n < sizeof(suffix) - 1; i++)
+        if (entity.name[i] != ' ') suffix[n++] = entity.name[i];
+    suffix[n] = '\0';
+
+    // default_entity_id: must be lowercase, only [a-z0-9_] allowed
+    snprintf(entity_id, sizeof(entity_id), "%s.%s_%s", entity.domain, prefix, suffix);
+    for (i = 0; entity_id[i]; i++) {
+        entity_id[i] = tolower(entity_id[i]);
+        if (entity_id[i] == '-') entity_id[i] = '_';
+    }
+    snprintf(topic, sizeof(topic), "homeassistant/%s/%s-%s/config", entity.domain, prefix, suffix);
+
+    bool ok = appendf(payload, sizeof(payload), &len,
+        R"({"name" : "%s", "object_id" : "%s-%s", "default_entity_id" : "%s", "unique_id" : "%s-%s", "state_topic" : "%s/%s", "availability_topic" : "%s/connected", )"
+        R"("device": {"model" : "%s", "identifiers" : "%s", "name" : "%s", "manufacturer" : "Stegen", "configuration_url" : "http://%s", "sw_version" : "%s"})",
+        entity.name, prefix, suffix, entity_id, prefix, suffix, prefix, MQTTStateMode == MQTT_STATE_JSON ? "Data" : suffix, prefix,
 #ifndef SENSORBOX_VERSION
-    const String device_payload = String(R"("device": {)") + jsn("model","SmartEVSE v3") + jsna("identifiers", MQTTprefix) + jsna("name", MQTTprefix) + jsna("manufacturer","Stegen") + jsna("configuration_url", config_url) + jsna("sw_version", String(VERSION)) + "}";
+        "SmartEVSE v3",
 #else
-    const String device_payload = String(R"("device": {)") + jsn("model","Sensorbox v2") + jsna("identifiers", MQTTprefix) + jsna("name", MQTTprefix) + jsna("manufacturer","Stegen") + jsna("configuration_url", config_url) + jsna("sw_version", String(VERSION)) + "}";
+        "Sensorbox v2",
 #endif
-    String payload = "{"
-        + jsn("name", entity_name)
-        + jsna("object_id", String(MQTTprefix + "-" + entity_suffix))  // Deprecated for HA 2026.4 - still setting for backwards compatibility. Will not raise error if new default_entity_id is also set: https://github.com/home-assistant/core/pull/151996
-        + jsna("default_entity_id", default_entity_id)  // HA 2025.10 and up: must include domain prefix (e.g. sensor.smartevse_chargecurrent). See: https://community.home-assistant.io/t/mqtt-discovery-wrong-entity-id-names-unnamed-device/945927
-        + jsna("unique_id", String(MQTTprefix + "-" + entity_suffix))
-        + jsna("state_topic", String(MQTTprefix + "/" + entity_suffix))
-        + jsna("availability_topic", String(MQTTprefix + "/connected"))
-        + ", " + device_payload + optional_payload
-        + "}";
-
-    MQTTclient.publish(topic.c_str(), payload.c_str(), true, 0);  // Retain + QoS 0
+        prefix, prefix, WiFi.localIP().toString().c_str(), VERSION);
+
+    if (entity.command)
+        ok = ok && appendf(payload, sizeof(payload), &len, R"(, "command_topic" : "%s/Set/%s")", prefix, entity.command);
+    // In JSON only mode the value is a member of the <prefix>/Data document
+    if (MQTTStateMode == MQTT_STATE_JSON)
+        ok = ok && appendf(payload, sizeof(payload), &len, entity.value_template ? R"(, "value_template" : "{%% set value = value_json.%s %%}%s")" : R"(, "value_template" : "{{ value_json.%s }}")", suffix, entity.value_template);
+    else if (entity.value_template)
+        ok = ok && appendf(payload, sizeof(payload), &len, R"(, "value_template" : "%s")", entity.value_template);
+    if (entity.flags & MQTT_ENTITY_MAX)
+        ok = ok && appendf(payload, sizeof(payload), &len, R"(, "max" : "%u")", announceMax);
+    ok = ok && appendf(payload, sizeof(payload), &len, "%s}", entity.extra ? entity.extra : "");
+
+    if (ok) send(topic, payload, len, true, 0);
+    else _LOG_A("MQTT: discovery config of %s too large.\n", entity.name);
+}
+
+/*
+ * Announce the entity table incrementally from loop().
+ * The discovery configs are retained by the broker, so they are only sent again when anything
+ * that ends up in them changed, or when forced (Home Assistant restarted).
+ */
+void MQTTclient_t::startAnnounce(const MQTTentity_t *entities, uint8_t count, uint8_t version, uint8_t mask, uint16_t max, bool force) {
+    char buf[24];
+    uint32_t hash = 2166136261u;
+
+    snprintf(buf, sizeof(buf), "%u/%u/%u/%u", version, mask, max, MQTTStateMode);
+    hash = fnv1a(hash, buf);
+    hash = fnv1a(hash, MQTTprefix.c_str());
+    hash = fnv1a(hash, MQTTHost.c_str());
+    hash = fnv1a(hash, WiFi.localIP().toString().c_str());
+    hash = fnv1a(hash, VERSION);
+
+    Preferences prefs;                                                          // the global preferences object is used by other tasks
+    if (!force && prefs.begin("settings", true)) {
+        uint32_t stored = prefs.getULong("MQTTannounce", 0);
+        prefs.end();
+        if (stored == hash) {
+            _LOG_I("MQTT: discovery unchanged, not announced.\n");
+            return;
+        }
+    }
+    announceEntities = NULL;                                                    // loop() picks up the new table once it is set below
+    announceMask = mask;
+    announceMax = max;
+    announceHash = hash;
+    announceCount = count;
+    announceIndex = 0;
+    announceStart = millis();
+    announceEntities = entities;
 }
 
 MQTTclient_t MQTTclient;
@@ -544,12 +664,25 @@ bool getLatestVersion(String owner_repo, String asset_name, char *version) {
 
 
 unsigned char *signature = NULL;
+static mbedtls_md_context_t upload_sha;                                         // hash of the firmware uploaded through /update
 #define SIGNATURE_LENGTH 512
 
-// SHA-Verify the OTA partition after it's been written
+#define OTA_CHUNK_SIZE 4096
+#define OTA_RESUME_RETRIES 5
+
+// Start the SHA-256 of a firmware image. It is updated with every chunk that is written to the OTA partition,
+// so the signature can be checked right after the last write, without reading the partition back.
+static void ota_hash_start(mbedtls_md_context_t *sha) {
+    mbedtls_md_free(sha);                                                       // in case a previous update was aborted
+    mbedtls_md_init(sha);
+    mbedtls_md_setup(sha, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 0);
+    mbedtls_md_starts(sha);
+}
+
+// Finish the SHA-256 of the written firmware image, and verify the signature
 // https://techtutorialsx.com/2018/05/10/esp32-arduino-mbed-tls-using-the-sha-256-algorithm/
 // https://github.com/ARMmbed/mbedtls/blob/development/programs/pkey/rsa_verify.c
-bool validate_sig( const esp_partition_t* partition, unsigned char *signature, int size )
+bool validate_sig( mbedtls_md_context_t *sha, unsigned char *signature )
 {
     const char* rsa_key_pub = R"RSA_KEY_PUB(
 -----BEGIN PUBLIC KEY-----
@@ -568,84 +701,46 @@ YtSTUJNSiSwqWt1m0FLOJD0CAwEAAQ==
 -----END PUBLIC KEY-----
 )RSA_KEY_PUB";
 
-    if( !partition ) {
-        _LOG_A( "Could not find update partition!.\n");
+    if( !signature ) {
+        _LOG_A( "No signature!.\n");
+        mbedtls_md_free( sha );
         return false;
     }
+    unsigned char hash[32];
+    mbedtls_md_finish( sha, hash );
+    mbedtls_md_free( sha );
+
     _LOG_D("Creating mbedtls context.\n");
     mbedtls_pk_context pk;
-    mbedtls_md_context_t rsa;
     mbedtls_pk_init( &pk );
     _LOG_D("Parsing public key.\n");
 
     int ret;
     if( ( ret = mbedtls_pk_parse_public_key( &pk, (const unsigned char*)rsa_key_pub, strlen(rsa_key_pub)+1 ) ) != 0 ) {
         _LOG_A( "Parsing public key failed! mbedtls_pk_parse_public_key %d (%d bytes)\n%s", ret, strlen(rsa_key_pub)+1, rsa_key_pub);
+        mbedtls_pk_free( &pk );
         return false;
     }
     if( !mbedtls_pk_can_do( &pk, MBEDTLS_PK_RSA ) ) {
         _LOG_A( "Public key is not an rsa key -0x%x", -ret );
+        mbedtls_pk_free( &pk );
         return false;
     }
-    _LOG_D("Initing mbedtls.\n");
-    const mbedtls_md_info_t *mdinfo = mbedtls_md_info_from_type( MBEDTLS_MD_SHA256 );
-    mbedtls_md_init( &rsa );
-    mbedtls_md_setup( &rsa, mdinfo, 0 );
-    mbedtls_md_starts( &rsa );
-    int bytestoread = SPI_FLASH_SEC_SIZE;
-    int bytesread = 0;
-    uint8_t *_buffer = (uint8_t*)malloc(SPI_FLASH_SEC_SIZE);
-    if(!_buffer){
-        _LOG_A( "malloc failed.\n");
-        return false;
-    }
-    _LOG_D("Parsing content.\n");
-    _LOG_V( "Reading partition (%i sectors, sec_size: %i)", size, bytestoread );
-    while( bytestoread > 0 ) {
-        _LOG_V( "Left: %i (%i)               \r", size, bytestoread );
-
-        if( ESP.partitionRead( partition, bytesread, (uint32_t*)_buffer, bytestoread ) ) {
-            mbedtls_md_update( &rsa, (uint8_t*)_buffer, bytestoread );
-            bytesread = bytesread + bytestoread;
-            size = size - bytestoread;
-            if( size <= SPI_FLASH_SEC_SIZE ) {
-                bytestoread = size;
-            }
-        } else {
-            _LOG_A( "partitionRead failed!.\n");
-            return false;
-        }
-    }
-    free( _buffer );
-
-    unsigned char *hash = (unsigned char*)malloc( mdinfo->size );
-    if(!hash){
-        _LOG_A( "malloc failed.\n");
-        return false;
-    }
-    mbedtls_md_finish( &rsa, hash );
-    ret = mbedtls_pk_verify( &pk, MBEDTLS_MD_SHA256, hash, mdinfo->size, (unsigned char*)signature, SIGNATURE_LENGTH );
-    free( hash );
-    mbedtls_md_free( &rsa );
+    ret = mbedtls_pk_verify( &pk, MBEDTLS_MD_SHA256, hash, sizeof(hash), (unsigned char*)signature, SIGNATURE_LENGTH );
     mbedtls_pk_free( &pk );
-    if( ret == 0 ) {
-        return true;
-    }
-
-    // validation failed, overwrite the first few bytes so this partition won't boot!
-    log_w( "Validation failed, erasing the invalid partition.\n");
-    ESP.partitionEraseRange( partition, 0, ENCRYPTED_BLOCK_SIZE);
-    return false;
+    return ret == 0;
 }
 
 
-bool forceUpdate(const char* firmwareURL, bool validate) {
-    HTTPClient httpClient;
-    //WiFiClientSecure _client;
-    int partition = U_FLASH;
+// Write a part of the new firmware image to the OTA partition, and add it to the hash if there is one
+static bool otaOutput(void *arg, const uint8_t *buf, size_t len) {
+    if (arg) mbedtls_md_update( (mbedtls_md_context_t *)arg, buf, len );
+    return Update.write( (uint8_t *)buf, len ) == len;
+}
 
+// Connect to the firmware URL. When resuming an interrupted download, request the rest of the file from offset.
+static int otaConnect(HTTPClient &httpClient, const char* firmwareURL, uint32_t offset) {
     httpClient.setFollowRedirects(HTTPC_STRICT_FOLLOW_REDIRECTS);
-    _LOG_A("Connecting to: %s.\n", firmwareURL );
     if( String(firmwareURL).startsWith("https") ) {
         //_client.setCACert(root_ca_github); // OR
         //_client.setInsecure(); //not working for github
@@ -656,12 +751,42 @@ bool forceUpdate(const char* firmwareURL, bool validate) {
     httpClient.addHeader("User-Agent", "SmartEVSE-v3");
     httpClient.addHeader("Accept", "application/vnd.github+json");
     httpClient.addHeader("X-GitHub-Api-Version", "2022-11-28" );
+    if (offset) {
+        char range[24];
+        snprintf(range, sizeof(range), "bytes=%u-", (unsigned) offset);
+        httpClient.addHeader("Range", range);
+    }
     const char* get_headers[] = { "Content-Length", "Content-type", "Accept-Ranges" };
     httpClient.collectHeaders( get_headers, sizeof(get_headers)/sizeof(const char*) );
+    return httpClient.GET();
+}
+
+// some network streams (e.g. Ethernet) can be laggy and need to 'breathe'
+static bool otaWaitStream(Stream *stream) {
+    uint32_t timeout = millis() + 10000;
+    while( ! stream->available() ) {
+        if( millis()>timeout ) {
+            _LOG_A("Stream timed out.\n");
+            return false;
+        }
+        vTaskDelay(1);
+    }
+    return true;
+}
 
+
+bool forceUpdate(const char* firmwareURL, bool validate, bool delta) {
+    HTTPClient httpClient;
+    DeltaPatch patch;
+    //WiFiClientSecure _client;
+    int partition = U_FLASH;
+    uint32_t startTime = millis();
+
+    _LOG_A("Connecting to: %s.\n", firmwareURL );
     int updateSize = 0;
-    int httpCode = httpClient.GET();
+    int httpCode = otaConnect(httpClient, firmwareURL, 0);
     String contentType;
+    bool resumable = false;
 
     if( httpCode == HTTP_CODE_OK || httpCode == HTTP_CODE_MOVED_PERMANENTLY ) {
         updateSize = httpClient.getSize();
@@ -669,6 +794,7 @@ bool forceUpdate(const char* firmwareURL, bool validate) {
         String acceptRange = httpClient.header( "Accept-Ranges" );
         if( acceptRange == "bytes" ) {
             _LOG_V("This server supports resume!\n");
+            resumable = true;
         } else {
             _LOG_V("This server does not support resume!\n");
         }
@@ -684,17 +810,7 @@ bool forceUpdate(const char* firmwareURL, bool validate) {
         return false;
     }
 
-    // some network streams (e.g. Ethernet) can be laggy and need to 'breathe'
-    if( ! stream->available() ) {
-        uint32_t timeout = millis() + 10000;
-        while( ! stream->available() ) {
-            if( millis()>timeout ) {
-                _LOG_A("Stream timed out.\n");
-                return false;
-            }
-            vTaskDelay(1);
-        }
-    }
+    if( !otaWaitStream(stream) ) return false;
 
     if( validate ) {
         if( updateSize == UPDATE_SIZE_UNKNOWN || updateSize <= SIGNATURE_LENGTH ) {
@@ -704,7 +820,13 @@ bool forceUpdate(const char* firmwareURL, bool validate) {
         updateSize -= SIGNATURE_LENGTH;
     }
 
-    if( !Update.begin(updateSize, partition) ) {
+    if( delta && !validate ) {
+        _LOG_A("Delta updates must be signed.\n");
+        return false;
+    }
+
+    // a delta file is smaller than the image it rebuilds, the size of which is only known from its header
+    if( !Update.begin(delta ? UPDATE_SIZE_UNKNOWN : updateSize, partition) ) {
         _LOG_A("ERROR Not enough space to begin OTA, partition size mismatch? Update failed!\n");
         Update.abort();
         return false;
@@ -719,29 +841,77 @@ bool forceUpdate(const char* firmwareURL, bool validate) {
       //vTaskDelay(100 / portTICK_PERIOD_MS);
     });
 
-    // read signature
+    // read signature, it is prepended to the firmware
+    mbedtls_md_context_t sha;
+    mbedtls_md_init(&sha);
     if( validate ) {
         signature = (unsigned char *) malloc(SIGNATURE_LENGTH);                       //tried to free in in all exit scenarios, RISK of leakage!!!
-        stream->readBytes( signature, SIGNATURE_LENGTH );
+        if( !signature || stream->readBytes( signature, SIGNATURE_LENGTH ) != SIGNATURE_LENGTH ) {
+            _LOG_A("Could not read signature.\n");
+            Update.abort();
+            FREE(signature);
+            return false;
+        }
+        ota_hash_start(&sha);
+    }
+
+    uint8_t *buffer = (uint8_t *) malloc(OTA_CHUNK_SIZE);
+    if( !buffer || (delta && !patch.begin(otaOutput, &sha)) ) {
+        FREE(buffer);
+        _LOG_A("malloc failed.\n");
+        Update.abort();
+        mbedtls_md_free(&sha);
+        FREE(signature);
+        return false;
     }
 
     _LOG_I("Begin %s OTA. This may take 2 - 5 mins to complete. Things might be quiet for a while.. Patience!\n", partition==U_FLASH?"Firmware":"Filesystem");
 
     // Some activity may appear in the Serial monitor during the update (depends on Update.onProgress)
-    int written = Update.writeStream(*stream);                                 // although writeStream returns size_t, we don't expect >2Gb
+    // Every chunk is hashed before it is written; when the connection drops, the download continues where it stopped.
+    int written = 0;
+    uint8_t retries = 0;
+    while( written < updateSize ) {
+        size_t len = stream->readBytes( buffer, min(updateSize - written, OTA_CHUNK_SIZE) );
+        if( len ) {
+            if( !(delta ? patch.write( buffer, len ) : otaOutput( validate ? &sha : NULL, buffer, len )) ) {
+                _LOG_A("ERROR: Update has error:%s.\n", Update.errorString());
+                break;
+            }
+            written += len;
+            continue;
+        }
+        // no data within the stream timeout, or the connection was closed
+        if( !resumable || ++retries > OTA_RESUME_RETRIES ) break;
+        uint32_t offset = written + (validate ? SIGNATURE_LENGTH : 0);
+        _LOG_W("Download interrupted at %d/%d bytes, resuming (%u/%u).\n", written, updateSize, retries, (unsigned) OTA_RESUME_RETRIES);
+        httpClient.end();
+        httpCode = otaConnect(httpClient, firmwareURL, offset);
+        stream = httpClient.getStreamPtr();
+        if( httpCode != HTTP_CODE_PARTIAL_CONTENT || httpClient.getSize() != updateSize - written || stream == nullptr || !otaWaitStream(stream) ) {
+            _LOG_A("ERROR: Resume failed, server responded with HTTP Status %i.\n", httpCode );
+            break;
+        }
+    }
+    free(buffer);
+    if( delta ) {
+        if( written == updateSize && !patch.finish() ) written = -1;
+        patch.end();
+    }
 
     if ( written == updateSize ) {
         _LOG_D("Written : %d successfully", written);
-        updateSize = written; // flatten value to prevent overflow when checking signature
     } else {
         _LOG_A("Written only : %u/%u Premature end of stream?", written, updateSize);
         Update.abort();
+        mbedtls_md_free(&sha);
         FREE(signature);
         return false;
     }
 
-    if (!Update.end()) {
+    if (!Update.end(delta)) {
         _LOG_A("An Update Error Occurred. Error #: %d", Update.getError());
+        mbedtls_md_free(&sha);
         FREE(signature);
         return false;
     }
@@ -757,6 +927,7 @@ bool forceUpdate(const char* firmwareURL, bool validate) {
 
         if( !_target_partition ) {
             _LOG_A("Can't access partition #%d to check signature!", partition);
+            mbedtls_md_free(&sha);
             FREE(signature);
             return false;
         }
@@ -776,7 +947,7 @@ bool forceUpdate(const char* firmwareURL, bool validate) {
             // during signature validation (crash, oom, power failure).
         }
 
-        if( !validate_sig( _target_partition, signature, updateSize ) ) {
+        if( !validate_sig( &sha, signature ) ) {
             FREE(signature);
             // erase partition
             esp_partition_erase_range( _target_partition, _target_partition->address, _target_partition->size );
@@ -792,6 +963,7 @@ bool forceUpdate(const char* firmwareURL, bool validate) {
         }
     }
     _LOG_D("OTA Update complete!.\n");
+    _LOG_A("Firmware update took %lu ms.\n", millis() - startTime);
     if (Update.isFinished()) {
         _LOG_V("Update succesfully completed at %s partition\n", partition==U_SPIFFS ? "spiffs" : "firmware" );
         return true;
@@ -802,10 +974,27 @@ bool forceUpdate(const char* firmwareURL, bool validate) {
 }
 
 
+// The delta file for the running firmware is stored next to the full firmware, as
+// <name>.delta.<first 16 hex digits of the running image SHA-256>.signed.bin
+static char *deltaUrl(const char *firmwareURL) {
+    const uint8_t *sha = runningImageSha256();
+    const char *ext = strstr(firmwareURL, ".signed.bin");
+    char hex[17], *url = NULL;
+
+    if (!sha || !ext) return NULL;
+    for (int i = 0; i < 8; i++) sprintf(hex + i * 2, "%02x", sha[i]);
+    if (asprintf(&url, "%.*s.delta.%s.signed.bin", (int)(ext - firmwareURL), firmwareURL, hex) < 0) return NULL;
+    return url;
+}
+
 // put firmware update in separate task so we can feed progress to the html page
 void FirmwareUpdate(void *parameter) {
     //_LOG_A("DINGO: url=%s.\n", downloadUrl);
-    if (forceUpdate(downloadUrl, 1)) {
+    char *delta = deltaUrl(downloadUrl);
+    bool updated = delta && forceUpdate(delta, 1, true);                    // try the much smaller delta file first
+    if (delta) free(delta);
+    if (!updated) updated = forceUpdate(downloadUrl, 1);
+    if (updated) {
 #ifndef SENSORBOX_VERSION
         _LOG_A("Firmware update succesfull; rebooting as soon as no EV is charging.\n");
 #else
@@ -898,10 +1087,8 @@ void setTimeZone(void * parameter) {
 
 #ifndef SENSORBOX_VERSION
 std::array<mDNSServiceEntry, 8> mDNSServices = {};
-HTTPClient* homeWizardHttpClient=nullptr;
-bool homeWizardHttpClientInitialized = false;
 static bool mdnsDiscoveryInProgress = false;            // True when async mDNS task is running
-static unsigned long lastMdnsQueryTime = 0;             // Last time mDNS query was attempted
+unsigned long lastMdnsQueryTime = 0;                    // Last time mDNS query was attempted
 static const unsigned long MDNS_RETRY_INTERVAL = 30000; // Retry mDNS discovery every 30 seconds if not found
 
 struct MdnsServiceQuery {
@@ -1193,118 +1380,6 @@ void discoverNetworkMeters() {
     
     return;
 }
-
-/**
- * @brief Retrieves active current values from a HomeWizard V1 API.
- *
- * This function sends an HTTP GET request to the specified URL to fetch the active current data
- * in JSON format, parses the JSON response, and retrieves specific fields for current.
- *
- * @return A pair containing:
- *     - A int flag indicating: 0: failure, 1: single phase current, 3: 3 phase current
- *     - An array of 6 values representing the active current in deci-amps for L1, L2, L3, total, import, and export
- */
-std::pair<int8_t, std::array<std::int32_t, 6> > getDataFromHomeWizard(const char *hostname) {
-    _LOG_A("Invocation\n");
-    if (hostname == nullptr || hostname[0] == '\0') {
-        _LOG_A("No hostname provided.\n");
-        return {false, {0, 0, 0, 0, 0, 0}};
-    }
-    char url[64];
-    snprintf(url, sizeof(url), "http://%s/api/v1/data", hostname);
-
-    _LOG_A("Connect to URL %s\n", url);
-
-
-    if (!homeWizardHttpClientInitialized) {
-        homeWizardHttpClient = new HTTPClient();
-        homeWizardHttpClient->setTimeout(1500);
-        homeWizardHttpClient->addHeader("User-Agent", "SmartEVSE-v3");
-        homeWizardHttpClient->addHeader("Accept", "application/json");
-        homeWizardHttpClientInitialized = true;
-    }
-
-    homeWizardHttpClient->begin(url);
-
-    // Handle HTTP errors or timeout.
-    const int httpCode = homeWizardHttpClient->GET();
-    if (httpCode != HTTP_CODE_OK) {
-        _LOG_A("Error on HTTP request (httpCode=%i), url=%s.\n", httpCode, url);
-        homeWizardHttpClient->end(); // Always cleanup
-        delete homeWizardHttpClient;
-        homeWizardHttpClient = nullptr;
-        homeWizardHttpClientInitialized = false;
-        if (httpCode < 0) {
-            lastMdnsQueryTime = 0; // Force immediate rediscovery on next attempt if the error was a connection failure
-            _LOG_A("Connection failed, allowing immediate rediscovery.\n");
-        }
-        return {false, {0, 0, 0, 0, 0, 0}};
-    }
-
-    // Get the response stream
-    WiFiClient *stream = homeWizardHttpClient->getStreamPtr();
-
-    const char* currentKeys[] = {"active_current_l1_a", "active_current_l2_a", "active_current_l3_a","active_current_a"};
-    const char* powerKeys[] = { "active_power_l1_w", "active_power_l2_w", "active_power_l3_w","active_power_w"};
-    const char* totalsKeys[] = {"total_power_import_kwh", "total_power_export_kwh"};
-
-    // Create a filter to parse only specific fields.
-    StaticJsonDocument<256> filter;
-    for (const auto* key : currentKeys) filter[key] = true;
-    for (const auto* key : powerKeys) filter[key] = true;
-    for (const auto* key : totalsKeys) filter[key] = true;
-
-    // Create a filtered JSON document to hold the parsed data.
-    DynamicJsonDocument doc(256);
-    const DeserializationError error = deserializeJson(doc, *stream, DeserializationOption::Filter(filter));
-    homeWizardHttpClient->end();
-
-    // Handle JSON parsing errors.
-    if (error) {
-        _LOG_A("JSON deserialization failed: %s\n", error.c_str());
-        return {false, {0, 0, 0, 0, 0, 0}};
-    }
-
-    uint8_t phases = 0;
-    // Verify all required keys exist.
-    for (const auto* key : currentKeys) {
-        if (doc.containsKey(key))
-            phases++;
-    }
-
-    if (!phases) {
-        // Early return on missing data.
-        _LOG_A("Required JSON fields 'active_current_a' not found\n");
-        return {phases, {0, 0, 0, 0, 0, 0}};
-    }
-
-    std::array<int32_t, 6> evdata{};
-    _LOG_A("Reading %u-phase data\n", phases);
-
-    // Determine grid direction based on power: negative indicates feed-in, positive indicates usage.
-    auto getCorrection = [&doc](const char* powerKey) -> int8_t {
-        return doc[powerKey].as<int>() < 0 ? -1 : 1;
-    };
-
-    if (phases == 1) {
-        // Single phase case: use 'active_current_a' and 'active_power_w' for correction
-        int16_t rawCurrent = doc[currentKeys[3]].as<float>() * 10;
-        int8_t correction = getCorrection(powerKeys[3]);
-        evdata[0] = std::abs(rawCurrent) * correction;
-    }
-    else{
-        // Process all three phases.
-        for (size_t i = 0; i < 3; ++i) {
-            int16_t rawCurrent = doc[currentKeys[i]].as<float>() * 10;
-            evdata[i] = std::abs(rawCurrent) * getCorrection(powerKeys[i]);
-        }
-    }
-    evdata[3] = doc[totalsKeys[0]].as<float>() * 1000; // total import in Wh
-    evdata[4] = doc[totalsKeys[1]].as<float>() * 1000; // total export in Wh
-    evdata[5] = doc[powerKeys[3]].as<float>() * 1; // total power in Watts
-
-return {phases, evdata};
-}
 #endif
 
 void webServerRequest::setMessage(struct mg_http_message *hm) {
@@ -1356,9 +1431,8 @@ static void fn_mqtt(struct mg_connection *c, int ev, void *ev_data) {
         // When we get echo response, print it
         struct mg_mqtt_message *mm = (struct mg_mqtt_message *) ev_data;
         _LOG_V("%lu RECEIVED %.*s <- %.*s\n", c->id, (int) mm->data.len, mm->data.buf, (int) mm->topic.len, mm->topic.buf);
-        //somehow topic is not null terminated
-        String topic2 = String(mm->topic.buf).substring(0,mm->topic.len);
-        mqtt_receive_callback(topic2, mm->data.buf);
+        //topic and data are not null terminated
+        mqtt_receive_callback(mm->topic.buf, mm->topic.len, mm->data.buf, mm->data.len);
     } else if (ev == MG_EV_CLOSE) {
         _LOG_V("%lu CLOSED\n", c->id);
         MQTTclient.connected = false;
@@ -1414,12 +1488,17 @@ static void lcd_image_timer_fn(void *arg) {
         return;
     }
 
-    // Generate BMP image from LCD buffer
-    const std::vector<uint8_t> bmpImage = createImageFromGLCDBuffer();
+    // Generate BMP image from LCD buffer; nothing to send when the LCD did not change
+    static uint32_t lastFrameHash = 0;
+    size_t bmpImageSize;
+    uint32_t frameHash;
+    const uint8_t *bmpImage = createImageFromGLCDBuffer(&bmpImageSize, &frameHash);
+    if (frameHash == lastFrameHash) return;
+    lastFrameHash = frameHash;
 
     // Send to all connected websocket clients
     for (auto *c : wsLcdConnections) {
-        mg_ws_send(c, bmpImage.data(), bmpImage.size(), WEBSOCKET_OP_BINARY);
+        mg_ws_send(c, bmpImage, bmpImageSize, WEBSOCKET_OP_BINARY);
     }
 }
 
@@ -1588,6 +1667,9 @@ static void fn_http_server(struct mg_connection *c, int ev, void *ev_data) {
     mg_tls_init(c, &opts);
     }
   } else if (ev == MG_EV_CLOSE) {
+#if SMARTEVSE_VERSION >=30
+    SessionExportClose(c);
+#endif
     if (c == HttpListener80) {
         _LOG_A("Free HTTP port 80");
         HttpListener80 = nullptr;
@@ -1615,9 +1697,14 @@ static void fn_http_server(struct mg_connection *c, int ev, void *ev_data) {
         wsLcdConnections.push_back(c);
         _LOG_V("New websocket LCD connection, total: %d\n", wsLcdConnections.size());
 
+        // The timer only sends changed frames, so send the current one to the new viewer
+        size_t bmpImageSize;
+        const uint8_t *bmpImage = createImageFromGLCDBuffer(&bmpImageSize);
+        mg_ws_send(c, bmpImage, bmpImageSize, WEBSOCKET_OP_BINARY);
+
         // Start timer if this is the first connection
         if (wsLcdConnections.size() == 1 && LCDImageTimer == nullptr) {
-            LCDImageTimer = mg_timer_add(&mgr, 1000, MG_TIMER_REPEAT | MG_TIMER_RUN_NOW, lcd_image_timer_fn, &mgr);
+            LCDImageTimer = mg_timer_add(&mgr, 250, MG_TIMER_REPEAT, lcd_image_timer_fn, &mgr);
             _LOG_V("Started LCD image timer\n");
         }
     }
@@ -1631,6 +1718,10 @@ static void fn_http_server(struct mg_connection *c, int ev, void *ev_data) {
         handleButtonCommand(c, (const char*)wm->data.buf, wm->data.len);
     }
     // Binary messages are ignored (only server sends binary BMP images)
+#if SMARTEVSE_VERSION >=30
+  } else if (ev == MG_EV_POLL) {
+    SessionExportPoll(c);                                                       // continue a /sessions.csv download
+#endif
   } else if (ev == MG_EV_HTTP_MSG) {  // New HTTP request received
     struct mg_http_message *hm = (struct mg_http_message *) ev_data;            // Parsed HTTP request
 
@@ -1664,10 +1755,14 @@ static void fn_http_server(struct mg_connection *c, int ev, void *ev_data) {
     // handles URI and response, returns true if handled, false if not
     if (!handle_URI(c, hm, request)) {
         if (mg_match(hm->uri, mg_str("/erasesettings"), NULL)) {
+#ifndef SENSORBOX_VERSION
+            erase_settings();                                     // our own settings
+#else
             if ( preferences.begin("settings", false) ) {         // our own settings
               preferences.clear();
               preferences.end();
             }
+#endif
             if (preferences.begin("nvs.net80211", false) ) {      // WiFi settings used by ESP
               preferences.clear();
               preferences.end();       
@@ -1786,23 +1881,30 @@ static void fn_http_server(struct mg_connection *c, int ev, void *ev_data) {
                         }
                     }
                 } else //end of firmware.bin
-                if (!memcmp(file,"firmware.signed.bin", sizeof("firmware.signed.bin")) || !memcmp(file,"firmware.debug.signed.bin", sizeof("firmware.debug.signed.bin"))) {
+                if (!memcmp(file,"firmware.signed.bin", sizeof("firmware.signed.bin")) || !memcmp(file,"firmware.debug.signed.bin", sizeof("firmware.debug.signed.bin")) || !memcmp(file,"firmware.delta.signed.bin", sizeof("firmware.delta.signed.bin"))) {
+                    static DeltaPatch uploadPatch;                              // rebuilds the firmware from a delta file made by make_delta.py
+                    bool delta = !memcmp(file,"firmware.delta.signed.bin", sizeof("firmware.delta.signed.bin"));
     #define dump(X)   for (int i= 0; i< SIGNATURE_LENGTH; i++) _LOG_A_NO_FUNC("%02x", X[i]); _LOG_A_NO_FUNC(".\n");
                     if(!offset) {
                         _LOG_A("Update Start: %s\n", file);
+                        FREE(signature);                                            // in case a previous upload was aborted
                         signature = (unsigned char *) malloc(SIGNATURE_LENGTH);                       //tried to free in in all exit scenarios, RISK of leakage!!!
                         memcpy(signature, hm->body.buf, SIGNATURE_LENGTH);          //signature is prepended to firmware.bin
+                        ota_hash_start(&upload_sha);
                         hm->body.buf = hm->body.buf + SIGNATURE_LENGTH;
                         hm->body.len = hm->body.len - SIGNATURE_LENGTH;
                         _LOG_A("Firmware signature:");
                         dump(signature);
+                        if (delta && !uploadPatch.begin(otaOutput, &upload_sha)) {
+                            FREE(signature);                                    // makes the verification fail
+                        }
                         if(!Update.begin((ESP.getFreeSketchSpace() - 0x1000) & 0xFFFFF000), U_FLASH) {
                             _LOG_A("ERROR: Update has error:%s.\n", Update.errorString());
                             Update.printError(Serial);
                         }
                     }
                     if(!Update.hasError()) {
-                        if(Update.write((uint8_t*) hm->body.buf, hm->body.len) != hm->body.len) {
+                        if(!(delta ? uploadPatch.write((uint8_t*) hm->body.buf, hm->body.len) : otaOutput(&upload_sha, (uint8_t*) hm->body.buf, hm->body.len))) {
                             _LOG_A("ERROR: Update has error:%s.\n", Update.errorString());
                             Update.printError(Serial);
                             FREE(signature);
@@ -1822,8 +1924,10 @@ static void fn_http_server(struct mg_connection *c, int ev, void *ev_data) {
                         esp_ota_set_boot_partition( running_partition );            // make sure we have not switched boot partitions
     
                         bool verification_result = false;
-                        if(Update.end(true)) {
-                            verification_result = validate_sig( target_partition, signature, size - SIGNATURE_LENGTH);
+                        bool rebuilt = !delta || uploadPatch.finish();
+                        if (delta) uploadPatch.end();
+                        if(rebuilt && Update.end(true)) {
+                            verification_result = validate_sig( &upload_sha, signature );
                             FREE(signature);
                             if (verification_result) {
                                 _LOG_A("Signature is valid!\n");
@@ -1849,44 +1953,12 @@ static void fn_http_server(struct mg_connection *c, int ev, void *ev_data) {
                 } else //end of firmware.signed.bin
 #if SMARTEVSE_VERSION >=30
                 if (!memcmp(file,"rfid.txt", sizeof("rfid.txt"))) {
-                    if (offset != 0) {
-                        mg_http_reply(c, 400, "", "rfid.txt too big, only 100 rfid's allowed!");
-                    }
-                    else {
-                        //we are overwriting all stored RFID's with the ones uploaded
-                        DeleteAllRFID();
-                        res = offset + hm->body.len;
-                        unsigned int RFID_UID[8] = {1, 0, 0, 0, 0, 0, 0, 0};
-                        char RFIDtxtstring[20];                                     // 17 characters + NULL terminator
-                        int r, pos = 0;
-                        int beginpos = 0;
-                        while (pos <= hm->body.len) {
-                            char c;
-                            c = *(hm->body.buf + pos);
-                            //_LOG_A_NO_FUNC("%c", c);
-                            if (c == '\n' || pos == hm->body.len) {
-                                strncpy(RFIDtxtstring, hm->body.buf + beginpos, 19);         // in case of DOS the 0x0D is stripped off here
-                                RFIDtxtstring[19] = '\0';
-                                r = sscanf(RFIDtxtstring,"%02x%02x%02x%02x%02x%02x%02x", &RFID_UID[0], &RFID_UID[1], &RFID_UID[2], &RFID_UID[3], &RFID_UID[4], &RFID_UID[5], &RFID_UID[6]);
-                                RFID_UID[7]=crc8((unsigned char *) RFID_UID,7);
-                                if (r == 7) {
-                                    _LOG_A("Store RFID_UID %02x%02x%02x%02x%02x%02x%02x, crc=%02x.\n", RFID_UID[0], RFID_UID[1], RFID_UID[2], RFID_UID[3], RFID_UID[4], RFID_UID[5], RFID_UID[6], RFID_UID[7]);
-                                    LoadandStoreRFID(RFID_UID);
-                                } else {
-                                    strncpy(RFIDtxtstring, hm->body.buf + beginpos, 17);         // in case of DOS the 0x0D is stripped off here
-                                    RFIDtxtstring[17] = '\0';
-                                    RFID_UID[0] = 0x01;
-                                    r = sscanf(RFIDtxtstring,"%02x%02x%02x%02x%02x%02x", &RFID_UID[1], &RFID_UID[2], &RFID_UID[3], &RFID_UID[4], &RFID_UID[5], &RFID_UID[6]);
-                                    RFID_UID[7]=crc8((unsigned char *) RFID_UID,7);
-                                    if (r == 6) {
-                                        _LOG_A("Store RFID_UID %02x%02x%02x%02x%02x%02x, crc=%02x.\n", RFID_UID[1], RFID_UID[2], RFID_UID[3], RFID_UID[4], RFID_UID[5], RFID_UID[6], RFID_UID[7]);
-                                        LoadandStoreRFID(RFID_UID);
-                                    }
-                                }
-                                beginpos = pos + 1;
-                            }
-                            pos++;
-                        }
+                    //we are overwriting all stored RFID's with the ones uploaded
+                    if (!offset) ImportRFIDBegin();
+                    ImportRFIDData(hm->body.buf, hm->body.len);
+                    res = offset + hm->body.len;
+                    if (res >= size && ImportRFIDEnd() < 0) {
+                        mg_http_reply(c, 400, "", "rfid.txt could not be stored!");
                     }
                 } else //end of rfid.txt
                     mg_http_reply(c, 400, "", "only allowed to flash firmware.bin, firmware.debug.bin, firmware.signed.bin, firmware.debug.signed.bin or rfid.txt");
@@ -1951,6 +2023,12 @@ static void fn_http_server(struct mg_connection *c, int ev, void *ev_data) {
                     doc["mqtt_tls"] = MQTTtls;
                 }
 
+                if (request->hasParam("mqtt_state_mode")) {
+                    uint8_t mode = request->getParam("mqtt_state_mode")->value().toInt();
+                    if (mode <= MQTT_STATE_JSON) MQTTStateMode = mode;
+                    doc["mqtt_state_mode"] = MQTTStateMode;
+                }
+
                 if(request->hasParam("mqtt_ca_cert")) {
                     String cert = request->getParam("mqtt_ca_cert")->value();
                     writeMqttCaCert(cert);                      // Save to LittleFS
@@ -1970,6 +2048,7 @@ static void fn_http_server(struct mg_connection *c, int ev, void *ev_data) {
                     preferences.putString("MQTTHost", MQTTHost);
                     preferences.putUShort("MQTTPort", MQTTPort);
                     preferences.putBool("MQTTtls", MQTTtls);
+                    preferences.putUChar("MQTTStateMode", MQTTStateMode);
                     preferences.end();
                 }
             }
@@ -2304,6 +2383,9 @@ void WiFiSetup(void) {
     }
 
     mg_mgr_init(&mgr);
+#ifndef SENSORBOX_VERSION
+    mg_timer_add(&mgr, 2000, MG_TIMER_REPEAT, homewizard_timer_fn, &mgr);      // HomeWizard V2 push feeds
+#endif
 
     WiFi.setAutoReconnect(true);                                                // Required for Arduino 3
     //WiFi.persistent(true);
@@ -2327,6 +2409,7 @@ void WiFiSetup(void) {
         MQTTHost = preferences.getString("MQTTHost", "");
         MQTTPort = preferences.getUShort("MQTTPort", 1883);
         MQTTtls = preferences.getBool("MQTTtls", false);
+        MQTTStateMode = preferences.getUChar("MQTTStateMode", MQTT_STATE_TOPICS);
 #endif //MQTT
         preferences.end();
     }
@@ -2378,6 +2461,10 @@ void network_loop() {
 
     mg_mgr_poll(&mgr, 100);                                                     // TODO increase this parameter to up to 1000 to make loop() less greedy
 
+#if MQTT
+    MQTTclient.loop();                                                          // send queued MQTT messages
+#endif
+
     if (NetworkConnected() && getmDNSServiceCount() == 0 &&
             (MainsMeter.Type == EM_HOMEWIZARD ||
              EVMeter.Type == EM_HOMEWIZARD ||
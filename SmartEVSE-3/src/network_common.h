@@ -28,6 +28,7 @@
 #include "main.h" //so SENSORBOX_VERSION is read in Sensorbox
 #include "mongoose.h"
 #include "ch390.h"
+#include "mqtt_queue.h"
 #include <ArduinoJson.h>
 
 #ifndef MQTT
@@ -62,6 +63,30 @@ extern bool MQTTSmartServer;
 extern bool MQTTSmartServerChanged;        // Flag to trigger reconnect from network_loop()
 extern bool WIFImodeChanged;               // Flag to trigger handleWIFImode() from network_loop()
 extern String MQTTprivatePassword;   
+extern uint8_t MQTTStateMode;
+
+// MQTTStateMode: how the state is published
+#define MQTT_STATE_TOPICS 0                                                     // one topic per metric (default)
+#define MQTT_STATE_BOTH   1                                                     // per metric topics, and one JSON document on <prefix>/Data
+#define MQTT_STATE_JSON   2                                                     // only the JSON document on <prefix>/Data
+
+#define MQTT_OUTBOX_LIMIT 4096                                                  // stop handing messages to the client while its outbox holds more than this
+
+// Home Assistant discovery entity; its state topic is <prefix>/<name without spaces>
+struct MQTTentity_t {
+    const char *name;
+    const char *domain;                                                         // sensor, select, text or number
+    const char *command;                                                        // command topic <prefix>/Set/<command>, or NULL
+    const char *value_template;                                                 // or NULL
+    const char *extra;                                                          // other JSON members, each starting with ", "
+    uint8_t flags;                                                              // MQTT_ENTITY_*
+};
+#define MQTT_ENTITY_MAINS      0x01                                             // conditions: only announced when set in the announce mask
+#define MQTT_ENTITY_EV         0x02
+#define MQTT_ENTITY_CIRCUIT    0x04
+#define MQTT_ENTITY_BATTERY    0x08
+#define MQTT_ENTITY_CONDITIONS 0x0F
+#define MQTT_ENTITY_MAX        0x80                                             // add "max" : <max> (number entities)
 
 class MQTTclient_t {
 #if MQTT_ESP == 0
@@ -82,28 +107,34 @@ public:
     void disconnect(void);
     esp_mqtt_client_handle_t client = nullptr;
 #endif
-private:
-    //jsn(device_class, current) expands to:
-    // "device_class" : "current"
-    String jsn(const String& key, const String& value) { return "\"" + key + "\" : \"" + value + "\""; }
-    template<typename T>
-    String jsn(const String& key, T value) { return "\"" + key + "\" : \"" + String(value) + "\""; }
-    //jsna(device_class, current) expands to:
-    // , "device_class" : "current"
 public:
-    String jsna(const String& key, const String& value) { return ", " + jsn(key, value); }
-    template<typename T>
-    String jsna(const String& key, T value) { return ", " + jsn(key, value); }
     void publish(const String &topic, const int32_t &payload, bool retained, int qos) { publish(topic, String(payload), retained, qos); };
     void publish(const String &topic, const String &payload, bool retained, int qos);
     void subscribe(const String &topic, int qos);
-    void announce(const String& entity_name, const String& domain, const String& optional_payload);
+    void announce(const MQTTentity_t &entity);
+    void startAnnounce(const MQTTentity_t *entities, uint8_t count, uint8_t version, uint8_t mask, uint16_t max, bool force);
+    void loop(void);
     bool connected;
+    uint32_t TxMessages = 0;                                                    // statistics, since boot
+    uint32_t TxBytes = 0;
+    MqttQueue_t Queue;                                                          // outbound messages, see mqtt_queue.h
+private:
+    bool canSend(void);
+    void send(const char *topic, const char *payload, uint16_t len, bool retained, int qos);
+    // Discovery is sent a few entities per loop(), and only when something changed since the last time
+    const MQTTentity_t *announceEntities = NULL;
+    uint8_t announceCount = 0;
+    uint8_t announceIndex = 0;
+    uint8_t announceMask = 0;
+    uint16_t announceMax = 0;
+    uint32_t announceHash = 0;
+    unsigned long announceStart = 0;
 };
 
 extern MQTTclient_t MQTTclient;
 extern void SetupMQTTClient();
-extern void mqtt_receive_callback(const String topic, const String payload);
+extern void mqtt_receive_callback(const char *topic, size_t topic_len, const char *payload, size_t payload_len);
+inline void mqtt_receive_callback(const String &topic, const String &payload) { mqtt_receive_callback(topic.c_str(), topic.length(), payload.c_str(), payload.length()); }
 extern String readMqttCaCert();
 extern void writeMqttCaCert(const String& cert);
 extern const char* root_ca_letsencrypt;
@@ -151,7 +182,7 @@ extern uint8_t WIFImode;
 extern char *downloadUrl;
 extern uint32_t serialnr;
 extern void RunFirmwareUpdate(void);
-extern bool forceUpdate(const char* firmwareURL, bool validate);
+extern bool forceUpdate(const char* firmwareURL, bool validate, bool delta = false);
 extern int downloadProgress;
 extern void WiFiSetup(void);
 extern void handleWIFImode(void);
@@ -164,7 +195,7 @@ struct mDNSServiceEntry {
     String HostName;
 };
 
-extern std::pair<int8_t, std::array<std::int32_t, 6>> getDataFromHomeWizard(const char *hostname);
+extern unsigned long lastMdnsQueryTime;                                         // 0: discover again on the next attempt
 extern std::array<mDNSServiceEntry, 8> mDNSServices;                            // Allow discovery of up to 8 mDNS services for now
                                                                                 // if there is a use case for more we can always increase this
 #endif
@@ -1,19 +1,21 @@
 #if SMARTEVSE_VERSION >= 40
 #include <Arduino.h>
 #include <SPI.h>
+#include <ArduinoJson.h>
 #include "esp32.h"
 #include "qca.h"
 #include "ipv6.h"
 
 //TODO: check if I need all this:
-uint8_t txbuffer[3164], rxbuffer[3164];
+uint8_t txbuffer[3164];
+uint8_t qcaRxBuffer[QCA7K_BUFFER_SIZE+1];   // all frames of one SPI burst read
+uint8_t *rxbuffer = qcaRxBuffer;            // the ethernet frame being parsed, points into qcaRxBuffer
 uint8_t modem_state, old_modem_state;
 uint8_t myMac[6]; // the MAC of the EVSE (derived from the ESP32's MAC).
 uint8_t pevMac[6]; // the MAC of the PEV (most likely the same as EVCCID?) //YES for Volkswagen's rotating EVCCID equals pevMac every time
 uint8_t myModemMac[6]; // our own modem's MAC (this is different from myMAC !). Unused.
 uint8_t pevModemMac[6]; // the MAC of the PEV's modem (obtained with GetSwReq). Could this be used to identify the EV? //NO for Volkswagen I got an Porsche vendor MAC id, but the MAC id ends in 00:00, so I suspect multiple EVs share this MAC address
 uint8_t pevRunId[8]; // pev RunId. Received from the PEV in the CM_SLAC_PARAM.REQ message.
-uint16_t AvgACVar[58]; // Average AC Variable Field. (used in CM_ATTEN_PROFILE.IND)
 uint8_t NMK[16]; // Network Key. Will be initialized with a random key on each session.
 uint8_t NID[] = {1, 2, 3, 4, 5, 6, 7}; // a default network ID. MSB bits 6 and 7 need to be 0.
 unsigned long SoundsTimer = 0;
@@ -26,8 +28,103 @@ unsigned long TTMatchJoin = 0;          // 12000s timeout
 uint8_t CEVMatchRetry = 0;      // retry counter to send CM_ATTEN_CHAR.IND
 uint8_t LinkReady = 0;
 uint8_t ModemsFound = 0;
-uint8_t ReceivedSounds = 0;
 uint8_t EVCCID2[6];  // Mac address or ID from the PEV, used in V2G communication
+unsigned long SlacParamTime = 0;        // millis() of the last CM_SLAC_PARAM.REQ
+
+// On shared PLC couplings we can hear the SLAC requests and soundings of EVs that are connected
+// to other charge points. Every PEV that sends a CM_SLAC_PARAM.REQ is tracked as a candidate,
+// and the one we hear with the lowest attenuation is the EV that is plugged into this EVSE.
+#define SLAC_CANDIDATES 4
+struct SlacCandidate {
+    uint8_t Mac[6];
+    uint8_t RunId[8];
+    uint16_t AttenSum[58];              // group attenuation, summed over the received CM_ATTEN_PROFILE.IND messages
+    uint8_t Sounds;                     // received CM_MNBC_SOUND.IND
+    uint8_t Profiles;                   // received CM_ATTEN_PROFILE.IND
+    bool Sounding;                      // CM_START_ATTEN_CHAR.IND received
+};
+static SlacCandidate Candidates[SLAC_CANDIDATES];
+static uint8_t NumCandidates = 0;
+static SlacCandidate *Matched = Candidates; // the candidate we send CM_ATTEN_CHAR.IND to
+static unsigned long SoundsStart = 0;   // millis() of the first CM_START_ATTEN_CHAR.IND
+static TaskHandle_t ModemTaskHandle = NULL;
+
+struct TimelineEntry {
+    uint32_t Time;                      // millis()
+    uint32_t Duration;
+    uint16_t Code;
+    uint16_t Len;
+    uint8_t Type;
+    uint8_t State;
+};
+static TimelineEntry Timeline[TIMELINE_SIZE];
+static uint16_t TimelineHead = 0, TimelineCount = 0;
+static portMUX_TYPE TimelineMux = portMUX_INITIALIZER_UNLOCKED;
+
+
+void modemTimeline(uint8_t Type, uint8_t State, uint16_t Code, uint16_t Len, uint32_t Duration) {
+    portENTER_CRITICAL(&TimelineMux);
+    TimelineEntry &e = Timeline[TimelineHead];
+    e.Time = millis();
+    e.Duration = Duration;
+    e.Code = Code;
+    e.Len = Len;
+    e.Type = Type;
+    e.State = State;
+    TimelineHead = (TimelineHead + 1) % TIMELINE_SIZE;
+    if (TimelineCount < TIMELINE_SIZE) TimelineCount++;
+    portEXIT_CRITICAL(&TimelineMux);
+}
+
+
+// Called from the webserver task, so the entries are copied while the modem task is locked out
+void modemTimelineJson(String &json) {
+    const char *TypeStr[] = {"mme_rx", "mme_tx", "slac", "tcp", "v2g_req", "v2g_res"};
+    uint16_t first, count;
+
+    TimelineEntry *copy = (TimelineEntry *)malloc(sizeof(Timeline));
+    if (!copy) {
+        json = "{\"error\":\"out of memory\"}";
+        return;
+    }
+    portENTER_CRITICAL(&TimelineMux);
+    memcpy(copy, Timeline, sizeof(Timeline));
+    count = TimelineCount;
+    first = (TimelineHead + TIMELINE_SIZE - count) % TIMELINE_SIZE;
+    portEXIT_CRITICAL(&TimelineMux);
+
+    DynamicJsonDocument doc(512 + JSON_ARRAY_SIZE(count) + count * JSON_OBJECT_SIZE(6));
+    doc["now"] = millis();
+    doc["slac_param_time"] = SlacParamTime;
+    JsonArray events = doc.createNestedArray("events");
+    for (uint16_t n = 0; n < count; n++) {
+        TimelineEntry &e = copy[(first + n) % TIMELINE_SIZE];
+        JsonObject event = events.createNestedObject();
+        event["t"] = e.Time;
+        event["type"] = TypeStr[e.Type];
+        switch (e.Type) {
+            case TL_MME_RX:
+            case TL_MME_TX:
+                event["mmtype"] = e.Code;
+                event["modem_state"] = e.State;
+                event["len"] = e.Len;
+                break;
+            case TL_SLAC:
+            case TL_TCP:
+                event["from"] = e.Code;
+                event["to"] = e.State;
+                break;
+            default:
+                event["fsm_state"] = e.Code;
+                event["protocol"] = e.State;
+                event["len"] = e.Len;
+                event["us"] = e.Duration;
+                break;
+        }
+    }
+    free(copy);
+    serializeJson(doc, json);
+}
 
 uint16_t qcaspi_read_register16(uint16_t reg) {
     uint16_t tx_data;
@@ -68,6 +165,9 @@ void qcaspi_write_burst(uint8_t *src, uint32_t len) {
 	buf[6] = 0;
 	buf[7] = 0;
 
+    if (src[12] == (FRAME_HOMEPLUG >> 8) && src[13] == (FRAME_HOMEPLUG & 0xff))
+        modemTimeline(TL_MME_TX, modem_state, src[16]*256 + src[15], len);
+
     total_len = len + 10;
     // Write nr of bytes to write to SPI_REG_BFR_SIZE
     qcaspi_write_register(SPI_REG_BFR_SIZE, total_len);
@@ -237,9 +337,11 @@ void composeSlacParamCnf() {
 
     txbuffer[52]=0x00; // 52 - 68 response_id, 17 bytes 0x00. (defined in ISO15118-3 table A.4)
 
-    txbuffer[69]=ReceivedSounds; // Number of sounds. 10 in normal case.
+    txbuffer[69]=Matched->Sounds; // Number of sounds. 10 in normal case.
     txbuffer[70]=0x3A; // Number of groups = 58. (defined in ISO15118-3 table A.4)
-    memcpy(&txbuffer[71], AvgACVar, 58); // 71 to 128: The group attenuation for the 58 announced groups.
+    for (uint8_t x=0; x<58; x++) {      // 71 to 128: The average group attenuation for the 58 announced groups.
+        txbuffer[71+x] = Matched->Profiles ? Matched->AttenSum[x] / Matched->Profiles : 0;
+    }
  }
 
 
@@ -311,103 +413,315 @@ void composeLinkStatus() {
     txbuffer[19]=0x52;
 }
 
-// Received SLAC messages from the PEV are handled here
-void SlacManager(uint16_t rxbytes) {
-    uint16_t mnt, x;
-
-    mnt = getManagementMessageType();
+// Views on the received management messages. All fields are bytes, so the views can be laid
+// over rxbuffer at any alignment; multi byte fields are in the byte order of the HomePlug spec.
+struct __attribute__((packed)) MmeHeader {
+    uint8_t Dest[6];
+    uint8_t Source[6];
+    uint8_t EtherType[2];           // 0x88E1, big endian
+    uint8_t MMV;                    // management message version
+    uint8_t MMType[2];              // little endian
+    uint8_t FMI[2];                 // fragmentation information
+};
+
+struct __attribute__((packed)) MmeSetKeyCnf {
+    MmeHeader Hdr;
+    uint8_t Result;                 // 0x01 = success
+};
+
+struct __attribute__((packed)) MmeSlacParamReq {
+    MmeHeader Hdr;
+    uint8_t AppType;
+    uint8_t SecurityType;
+    uint8_t RunId[8];
+};
+
+struct __attribute__((packed)) MmeStartAttenCharInd {
+    MmeHeader Hdr;
+    uint8_t AppType;
+    uint8_t SecurityType;
+    uint8_t NumSounds;
+    uint8_t TimeOut;                // in 100ms units
+    uint8_t RespType;
+    uint8_t ForwardingSta[6];
+    uint8_t RunId[8];
+};
+
+struct __attribute__((packed)) MmeMnbcSoundInd {
+    MmeHeader Hdr;
+    uint8_t AppType;
+    uint8_t SecurityType;
+    uint8_t SenderId[17];
+    uint8_t Cnt;                    // remaining number of sounds
+    uint8_t RunId[8];
+};
+
+struct __attribute__((packed)) MmeAttenProfileInd {
+    MmeHeader Hdr;
+    uint8_t PevMac[6];
+    uint8_t NumGroups;
+    uint8_t Reserved;
+    uint8_t AAG[58];                // average attenuation per group
+};
+
+struct __attribute__((packed)) MmeAttenCharRsp {
+    MmeHeader Hdr;
+    uint8_t AppType;
+    uint8_t SecurityType;
+    uint8_t SourceAddress[6];
+    uint8_t RunId[8];
+    uint8_t SourceId[17];
+    uint8_t RespId[17];
+    uint8_t Result;                 // 0 = success
+};
+
+struct __attribute__((packed)) MmeSlacMatchReq {
+    MmeHeader Hdr;
+    uint8_t AppType;
+    uint8_t SecurityType;
+    uint8_t MVFLength[2];           // little endian, 0x3e
+    uint8_t PevId[17];
+    uint8_t PevMac[6];
+    uint8_t EvseId[17];
+    uint8_t EvseMac[6];
+    uint8_t RunId[8];
+    uint8_t Reserved[8];
+};
+
+static_assert(sizeof(MmeHeader) == 19, "MME header layout");
+static_assert(offsetof(MmeStartAttenCharInd, RunId) == 30, "CM_START_ATTEN_CHAR.IND layout");
+static_assert(offsetof(MmeMnbcSoundInd, RunId) == 39, "CM_MNBC_SOUND.IND layout");
+static_assert(offsetof(MmeAttenProfileInd, AAG) == 27, "CM_ATTEN_PROFILE.IND layout");
+static_assert(offsetof(MmeAttenCharRsp, Result) == 69, "CM_ATTEN_CHAR.RSP layout");
+static_assert(offsetof(MmeSlacMatchReq, PevMac) == 40 && offsetof(MmeSlacMatchReq, RunId) == 69, "CM_SLAC_MATCH.REQ layout");
+
+
+static void mmeSetKeyCnf(const uint8_t *frame) {
+    const MmeSetKeyCnf *mme = (const MmeSetKeyCnf *)frame;
+    _LOG_I("received SET_KEY.CNF\n");
+    if (mme->Result == 0x01) {
+        modem_state = MODEM_CONFIGURED;
+        //SetLED(CRGB::Green);
+        // copy MAC from the EVSE modem to myModemMac. This MAC is not used for communication.
+        memcpy(myModemMac, mme->Hdr.Source, 6);
+        _LOG_I("NMK set\n");
+    } else {
+        _LOG_W("NMK -NOT- set\n");
+    }
+}
 
-   // _LOG_D("[RX] ");
-   // for (x=0; x<rxbytes; x++) _LOG_D("%02x ",rxbuffer[x]);
-   // _LOG_D("\n");
+static SlacCandidate *findCandidate(const uint8_t *mac, const uint8_t *runId = NULL) {
+    for (uint8_t i = 0; i < NumCandidates; i++) {
+        if (memcmp(Candidates[i].Mac, mac, 6) == 0 && (runId == NULL || memcmp(Candidates[i].RunId, runId, 8) == 0)) return &Candidates[i];
+    }
+    return NULL;
+}
 
-    if (mnt == (CM_SET_KEY + MMTYPE_CNF)) {
-        _LOG_I("received SET_KEY.CNF\n");
-        if (rxbuffer[19] == 0x01) {
-            modem_state = MODEM_CONFIGURED;
-            //SetLED(CRGB::Green);
-            // copy MAC from the EVSE modem to myModemMac. This MAC is not used for communication.
-            memcpy(myModemMac, rxbuffer+6, 6);
-            _LOG_I("NMK set\n");
-        } else {
-            _LOG_W("NMK -NOT- set\n");
-        }
+// Accepted while the first PEV is still in its matching sequence; a PEV that repeats its request gets a new RunId.
+static void mmeSlacParamReq(const uint8_t *frame) {
+    const MmeSlacParamReq *mme = (const MmeSlacParamReq *)frame;
+    SlacCandidate *c;
 
-    } else if (mnt == (CM_SLAC_PARAM + MMTYPE_REQ) && modem_state == MODEM_CONFIGURED) {
-        _LOG_I("received CM_SLAC_PARAM.REQ\n");
-        // We received a SLAC_PARAM request from the PEV. This is the initiation of a SLAC procedure.
-        // We extract the pev MAC from it.
-        memcpy(pevMac, rxbuffer+6, 6);
-        // extract the RunId from the SlacParamReq, and store it for later use
-        memcpy(pevRunId, rxbuffer+21, 8);
-        // We are EVSE, we want to answer.
-        composeSlacParamCnf();
-        qcaspi_write_burst(txbuffer, 60); // Send data to modem
-        modem_state = SLAC_PARAM_CNF;
+    _LOG_I("received CM_SLAC_PARAM.REQ\n");
+    if (modem_state == MODEM_CONFIGURED) {
+        // This is the initiation of a SLAC procedure.
+        NumCandidates = 0;
+        SlacParamTime = millis();
         TTMatchSequence = millis();
         CEVMatchRetry = 0;                // reset retry counter
-        _LOG_I("transmitting CM_SLAC_PARAM.CNF\n");
+        modem_state = SLAC_PARAM_CNF;
+    }
+    c = findCandidate(mme->Hdr.Source);
+    if (c == NULL) {
+        if (NumCandidates == SLAC_CANDIDATES) {
+            _LOG_W("Too many PEVs in SLAC, ignoring..\n");
+            return;
+        }
+        c = &Candidates[NumCandidates++];
+    }
+    memset(c, 0, sizeof(SlacCandidate));
+    // We extract the pev MAC and the RunId from it, and store it for later use
+    memcpy(c->Mac, mme->Hdr.Source, 6);
+    memcpy(c->RunId, mme->RunId, 8);
+    _LOG_I("PEV %u: %02x:%02x:%02x:%02x:%02x:%02x\n", (uint8_t)(c - Candidates), c->Mac[0], c->Mac[1], c->Mac[2], c->Mac[3], c->Mac[4], c->Mac[5]);
+    // We are EVSE, we want to answer.
+    memcpy(pevMac, c->Mac, 6);
+    memcpy(pevRunId, c->RunId, 8);
+    composeSlacParamCnf();
+    qcaspi_write_burst(txbuffer, 60); // Send data to modem
+    _LOG_I("transmitting CM_SLAC_PARAM.CNF\n");
+}
 
-    } else if (mnt == (CM_START_ATTEN_CHAR + MMTYPE_IND) && modem_state == SLAC_PARAM_CNF) {
-        _LOG_I("received CM_START_ATTEN_CHAR.IND\n");
-        SoundsTimer = millis(); // start timer
+static void mmeStartAttenCharInd(const uint8_t *frame) {
+    const MmeStartAttenCharInd *mme = (const MmeStartAttenCharInd *)frame;
+    SlacCandidate *c = findCandidate(mme->Hdr.Source, mme->RunId);
+
+    _LOG_I("received CM_START_ATTEN_CHAR.IND\n");
+    if (c == NULL || c->Sounding) return;
+    c->Sounding = true;
+    if (modem_state == SLAC_PARAM_CNF) {
+        SoundsStart = millis();
         TTMatchSequence = 0;    // reset timer
-        memset(AvgACVar, 0, sizeof(AvgACVar)); // reset averages.
-        ReceivedSounds = 0;
         modem_state = MNBC_SOUND;
+    }
+    SoundsTimer = millis(); // (re)start timer, the sounds of this PEV take up to 600ms
+}
 
-    } else if (mnt == (CM_MNBC_SOUND + MMTYPE_IND) && modem_state == MNBC_SOUND) {
-        _LOG_I("received CM_MNBC_SOUND.IND\n");
-        ReceivedSounds++;
+static void mmeMnbcSoundInd(const uint8_t *frame) {
+    const MmeMnbcSoundInd *mme = (const MmeMnbcSoundInd *)frame;
+    SlacCandidate *c = findCandidate(mme->Hdr.Source, mme->RunId);
 
-    } else if (mnt == (CM_ATTEN_PROFILE + MMTYPE_IND) && modem_state == MNBC_SOUND) {
-        _LOG_I("received CM_ATTEN_PROFILE.IND\n");
-        for (x=0; x<58; x++) AvgACVar[x] += rxbuffer[27+x];
+    _LOG_I("received CM_MNBC_SOUND.IND\n");
+    if (c) c->Sounds++;
+}
 
-        if (ReceivedSounds == 10) {
-            _LOG_I("Start Average Calculation\n");
-            for (x=0; x<58; x++) AvgACVar[x] = AvgACVar[x] / ReceivedSounds;
-        }
+// Sums are kept per group, composeAttenCharInd() divides them by the number of profiles.
+// The restrict qualifiers tell the compiler that the received bytes do not alias the sums.
+static void attenAccumulate(uint16_t * __restrict sum, const uint8_t * __restrict aag) {
+    for (uint8_t x = 0; x < 58; x++) sum[x] += aag[x];
+}
 
-    } else if (mnt == (CM_ATTEN_CHAR + MMTYPE_RSP) && modem_state == ATTEN_CHAR_RSP) {
-        _LOG_I("received CM_ATTEN_CHAR.RSP\n");
-        // verify pevMac, RunID, and succesful Slac fields
-        if (memcmp(pevMac, rxbuffer+21, 6) == 0 && memcmp(pevRunId, rxbuffer+27, 8) == 0 && rxbuffer[69] == 0) {
-            _LOG_I("Successful SLAC process\n");
-            modem_state = SLAC_MATCH_REQ;
-        } else {
-            _LOG_W("Incorrect CM_ATTEN_CHAR.RSP received, ignoring..\n");
-            modem_state = ATTEN_CHAR_IND; // ignore data, and retransmit CM_ATTEN_CHAR.IND
-        }
+static void mmeAttenProfileInd(const uint8_t *frame) {
+    const MmeAttenProfileInd *mme = (const MmeAttenProfileInd *)frame;
+    SlacCandidate *c = findCandidate(mme->PevMac);
+
+    _LOG_I("received CM_ATTEN_PROFILE.IND\n");
+    if (c == NULL || !c->Sounding) return;
+    attenAccumulate(c->AttenSum, mme->AAG);
+    c->Profiles++;
+}
 
-    } else if (mnt == (CM_SLAC_MATCH + MMTYPE_REQ) && modem_state == SLAC_MATCH_REQ) {
-        _LOG_I("received CM_SLAC_MATCH.REQ\n");
-        // Verify pevMac, RunID and MVFLength fields
-        if (memcmp(pevMac, rxbuffer+40, 6) == 0 && memcmp(pevRunId, rxbuffer+69, 8) == 0 && rxbuffer[21] == 0x3e) {
-            composeSlacMatchCnf();
-            qcaspi_write_burst(txbuffer, 109); // Send data to modem
-            _LOG_I("transmitting CM_SLAC_MATCH.CNF\n");
-            TTMatchJoin = millis();
-            modem_state = MODEM_GET_SW_REQ;
+// All PEVs that sent CM_SLAC_PARAM.REQ have sent the 10 sounds we asked for in CM_SLAC_PARAM.CNF.
+static bool soundingComplete() {
+    for (uint8_t i = 0; i < NumCandidates; i++) {
+        if (Candidates[i].Profiles < 10) return false;
+    }
+    return true;
+}
+
+// All PEVs that sent CM_SLAC_PARAM.REQ have started sounding.
+static bool allSounding() {
+    for (uint8_t i = 0; i < NumCandidates; i++) {
+        if (!Candidates[i].Sounding) return false;
+    }
+    return true;
+}
+
+// Select the PEV with the lowest average attenuation, and make it the PEV we match with.
+// PEVs that were not heard at all can only be selected when no other PEV was heard.
+static void selectCandidate() {
+    uint32_t total, bestTotal = UINT32_MAX;
+    uint8_t x, i;
+
+    Matched = NULL;
+    for (i = 0; i < NumCandidates; i++) {
+        SlacCandidate *c = &Candidates[i];
+        for (total = 0, x = 0; x < 58; x++) total += c->AttenSum[x];
+        _LOG_D("PEV %u: %u sounds, %u profiles, attenuation %u\n", i, c->Sounds, c->Profiles, c->Profiles ? total / (58 * c->Profiles) : 0);
+        if (c->Profiles == 0) continue;
+        // compare total/Profiles without dividing
+        if (Matched == NULL || total * Matched->Profiles < bestTotal * c->Profiles) {
+            Matched = c;
+            bestTotal = total;
         }
-//    } else if (mnt == (CM_LINK_STATUS + MMTYPE_CNF) && modem_state == MODEM_WAIT_LINK) {
-//        // We request the link status from the modem, it's the same as the GPIO_0 output.
-//        // 1 = Link Ready, 0 = No Link
-//        LinkReady = rxbuffer[21];
-
-    } else if (mnt == (CM_GET_SW + MMTYPE_CNF) && modem_state == MODEM_WAIT_SW) {
-        // Both the local and Pev modem will send their software version.
-        // check if the MAC of the modem is the same as our local modem.
-        if (memcmp(rxbuffer+6, myModemMac, 6) != 0) {
-            // Store the Pev modem MAC, as long as it is not random, we can use it for identifying the EV (Autocharge / Plug N Charge)
-            memcpy(pevModemMac, rxbuffer+6, 6);
+    }
+    if (Matched == NULL) Matched = Candidates;                                  // no PEV was heard, answer the first one
+    memcpy(pevMac, Matched->Mac, 6);
+    memcpy(pevRunId, Matched->RunId, 8);
+    if (NumCandidates > 1) _LOG_I("Matching PEV %u of %u\n", (uint8_t)(Matched - Candidates), NumCandidates);
+}
+
+static void mmeAttenCharRsp(const uint8_t *frame) {
+    const MmeAttenCharRsp *mme = (const MmeAttenCharRsp *)frame;
+    _LOG_I("received CM_ATTEN_CHAR.RSP\n");
+    // verify pevMac, RunID, and succesful Slac fields
+    if (memcmp(pevMac, mme->SourceAddress, 6) == 0 && memcmp(pevRunId, mme->RunId, 8) == 0 && mme->Result == 0) {
+        _LOG_I("Successful SLAC process\n");
+        modem_state = SLAC_MATCH_REQ;
+    } else {
+        _LOG_W("Incorrect CM_ATTEN_CHAR.RSP received, ignoring..\n");
+        modem_state = ATTEN_CHAR_IND; // ignore data, and retransmit CM_ATTEN_CHAR.IND
+    }
+}
+
+static void mmeSlacMatchReq(const uint8_t *frame) {
+    const MmeSlacMatchReq *mme = (const MmeSlacMatchReq *)frame;
+    _LOG_I("received CM_SLAC_MATCH.REQ\n");
+    // Verify pevMac, RunID and MVFLength fields
+    if (memcmp(pevMac, mme->PevMac, 6) == 0 && memcmp(pevRunId, mme->RunId, 8) == 0 && mme->MVFLength[0] == 0x3e) {
+        composeSlacMatchCnf();
+        qcaspi_write_burst(txbuffer, 109); // Send data to modem
+        _LOG_I("transmitting CM_SLAC_MATCH.CNF, %lu ms after CM_SLAC_PARAM.REQ\n", millis() - SlacParamTime);
+        TTMatchJoin = millis();
+        modem_state = MODEM_GET_SW_REQ;
+    }
+}
+
+static void mmeGetSwCnf(const uint8_t *frame) {
+    const MmeHeader *hdr = (const MmeHeader *)frame;
+    // Both the local and Pev modem will send their software version.
+    // check if the MAC of the modem is the same as our local modem.
+    if (memcmp(hdr->Source, myModemMac, 6) != 0) {
+        // Store the Pev modem MAC, as long as it is not random, we can use it for identifying the EV (Autocharge / Plug N Charge)
+        memcpy(pevModemMac, hdr->Source, 6);
+    }
+    ModemsFound++;
+    _LOG_I("received GET_SW.CNF, ModemsFound=%u.\n", ModemsFound);
+}
+
+#define ANY_MODEM_STATE 0xff
+
+// Each MME is only accepted in the modem_state where we expect it, and only when the frame
+// is long enough for its view; anything else is ignored.
+static const struct {
+    uint16_t MMType;
+    uint8_t State;
+    uint8_t MinLen;
+    void (*Handler)(const uint8_t *frame);
+} MmeTable[] = {
+    { CM_SET_KEY + MMTYPE_CNF,          ANY_MODEM_STATE,  sizeof(MmeSetKeyCnf),       mmeSetKeyCnf },
+    { CM_SLAC_PARAM + MMTYPE_REQ,       MODEM_CONFIGURED, sizeof(MmeSlacParamReq),    mmeSlacParamReq },
+    { CM_SLAC_PARAM + MMTYPE_REQ,       SLAC_PARAM_CNF,   sizeof(MmeSlacParamReq),    mmeSlacParamReq },
+    { CM_SLAC_PARAM + MMTYPE_REQ,       MNBC_SOUND,       sizeof(MmeSlacParamReq),    mmeSlacParamReq },
+    { CM_START_ATTEN_CHAR + MMTYPE_IND, SLAC_PARAM_CNF,   sizeof(MmeStartAttenCharInd), mmeStartAttenCharInd },
+    { CM_START_ATTEN_CHAR + MMTYPE_IND, MNBC_SOUND,       sizeof(MmeStartAttenCharInd), mmeStartAttenCharInd },
+    { CM_MNBC_SOUND + MMTYPE_IND,       MNBC_SOUND,       sizeof(MmeMnbcSoundInd),    mmeMnbcSoundInd },
+    { CM_ATTEN_PROFILE + MMTYPE_IND,    MNBC_SOUND,       sizeof(MmeAttenProfileInd), mmeAttenProfileInd },
+    { CM_ATTEN_CHAR + MMTYPE_RSP,       ATTEN_CHAR_RSP,   sizeof(MmeAttenCharRsp),    mmeAttenCharRsp },
+    { CM_SLAC_MATCH + MMTYPE_REQ,       SLAC_MATCH_REQ,   sizeof(MmeSlacMatchReq),    mmeSlacMatchReq },
+    { CM_GET_SW + MMTYPE_CNF,           MODEM_WAIT_SW,    sizeof(MmeHeader),          mmeGetSwCnf },
+//  { CM_LINK_STATUS + MMTYPE_CNF,      MODEM_WAIT_LINK,  ... } We request the link status from the modem, it's the same as the GPIO_0 output.
+};
+
+// Received SLAC messages from the PEV are handled here
+void SlacManager(uint16_t rxbytes) {
+    uint16_t mnt;
+
+    mnt = getManagementMessageType();
+    if (mnt == (CM_SLAC_PARAM + MMTYPE_REQ) && modem_state == MODEM_CONFIGURED) {
+        portENTER_CRITICAL(&TimelineMux);       // a new session starts
+        TimelineHead = TimelineCount = 0;
+        portEXIT_CRITICAL(&TimelineMux);
+    }
+    modemTimeline(TL_MME_RX, modem_state, mnt, rxbytes);
+
+   // _LOG_D("[RX] ");
+   // for (x=0; x<rxbytes; x++) _LOG_D("%02x ",rxbuffer[x]);
+   // _LOG_D("\n");
+
+    for (const auto &mme : MmeTable) {
+        if (mme.MMType != mnt || (mme.State != ANY_MODEM_STATE && mme.State != modem_state)) continue;
+        if (rxbytes < mme.MinLen) {
+            _LOG_W("MME %04x truncated, %u of %u bytes, ignoring..\n", mnt, rxbytes, mme.MinLen);
+        } else {
+            mme.Handler(rxbuffer);
         }
-        ModemsFound++;
-        _LOG_I("received GET_SW.CNF, ModemsFound=%u.\n", ModemsFound);
+        break;
     }
 
     if (modem_state != old_modem_state) {
         _LOG_D("SlacManager: modem_state %u -> %u.\n", old_modem_state, modem_state);
+        modemTimeline(TL_SLAC, modem_state, old_modem_state, 0);
         old_modem_state = modem_state;
     }
 
@@ -416,29 +730,56 @@ void SlacManager(uint16_t rxbytes) {
 static bool Modem_NMK_Is_Preset = false;
 static unsigned long lastSearch = millis();
 
+extern void tcp_timer(void);
+
+// The QCA700X raises its interrupt line when a frame is available, wake up the modem task.
+static void IRAM_ATTR QcaInterruptHandler(void) {
+    BaseType_t woken = pdFALSE;
+
+    if (ModemTaskHandle) vTaskNotifyGiveFromISR(ModemTaskHandle, &woken);
+    if (woken) portYIELD_FROM_ISR();
+}
+
+// Acknowledge pending QCA700X interrupts, so the next received frame raises the line again.
+static void qcaspi_ack_interrupts(void) {
+    uint16_t cause = qcaspi_read_register16(SPI_REG_INTR_CAUSE);
+    if (cause) qcaspi_write_register(SPI_REG_INTR_CAUSE, cause);
+}
+
 // Task
 //
 // called every 20ms
 //
 void Timer20ms(void * parameter) {
 
-    uint16_t reg16, rxbytes;
+    uint16_t reg16, rxbytes, offset;
     uint16_t FrameType;
     uint8_t SetKeyRetryCount = 0;
+    uint8_t *frame;
+    UBaseType_t StackFree, StackLow = MODEM_TASK_STACK;
+
+    ModemTaskHandle = xTaskGetCurrentTaskHandle();
+    attachInterrupt(digitalPinToInterrupt(PIN_QCA700X_INT), QcaInterruptHandler, RISING);
 
     while(1)  // infinite loop
     {
-        // poll modem for data
-        reg16 = qcaspi_read_burst(rxbuffer);
+        if (modem_state > MODEM_WRITESPACE) qcaspi_ack_interrupts();
 
-        while (reg16 && modem_state > MODEM_WRITESPACE) {
-            // we received data, read the length of the first packet.
-            rxbytes = rxbuffer[8] + (rxbuffer[9] << 8);
+        // read all frames the modem has for us
+        reg16 = qcaspi_read_burst(qcaRxBuffer);
+
+        // Each frame in the burst is: 4 bytes length, 4 bytes 0xAA SOF, 2 bytes frame length, 2 reserved,
+        // the ethernet frame, and a 2 byte 0x55 EOF. The frames are parsed in place, rxbuffer points
+        // to the ethernet frame currently being handled.
+        offset = 0;
+        while (reg16 - offset >= 74 && modem_state > MODEM_WRITESPACE) {
+            frame = qcaRxBuffer + offset;
+            // we received data, read the length of the packet.
+            rxbytes = frame[8] + (frame[9] << 8);
 
             // check if the header exists and a minimum of 60 bytes are available
-            if (rxbuffer[4] == 0xaa && rxbuffer[5] == 0xaa && rxbuffer[6] == 0xaa && rxbuffer[7] == 0xaa && rxbytes >= 60) {
-                // now remove the header, and footer.
-                memcpy(rxbuffer, rxbuffer+12, reg16-14);
+            if (frame[4] == 0xaa && frame[5] == 0xaa && frame[6] == 0xaa && frame[7] == 0xaa && rxbytes >= 60 && rxbytes + 14 <= reg16 - offset) {
+                rxbuffer = frame + 12;
                 //_LOG_D("available: %u rxbuffer bytes: %u\n",reg16, rxbytes);
 
                 FrameType = getFrameType();
@@ -446,21 +787,18 @@ void Timer20ms(void * parameter) {
                 else if (FrameType == FRAME_IPV6) IPv6Manager(rxbytes);
 
                 // there might be more data still in the buffer. Check if there is another packet.
-                if ((int16_t)reg16-rxbytes-14 >= 74) {
-                    reg16 = reg16-rxbytes-14;
-                    // move data forward.
-                    memcpy(rxbuffer, rxbuffer+2+rxbytes, reg16);
-                } else reg16 = 0;
-
+                offset += rxbytes + 14;
             } else {
                 _LOG_W("Invalid data!\n");
                 ModemReset();
                 modem_state = MODEM_POWERUP;
             }
         }
+        rxbuffer = qcaRxBuffer;
 
         if (modem_state != old_modem_state) {
             _LOG_D("modem_state %u -> %u.\n", old_modem_state, modem_state);
+            modemTimeline(TL_SLAC, modem_state, old_modem_state, 0);
             old_modem_state = modem_state;
         }
 
@@ -474,6 +812,8 @@ void Timer20ms(void * parameter) {
                     reg16 = qcaspi_read_register16(SPI_REG_SIGNATURE); //do it twice following the application notes
                     if (reg16 == QCASPI_GOOD_SIGNATURE) {
                         _LOG_I("QCA700X modem found\n");
+                        // (re)enable the packet available interrupt, it is cleared by a modem reset
+                        qcaspi_write_register(SPI_REG_INTR_ENABLE, SPI_INT_PKT_AVLBL);
                         if (Modem_NMK_Is_Preset) {
                             Modem_NMK_Is_Preset = false;
                             modem_state = MODEM_CONFIGURED;
@@ -519,9 +859,12 @@ void Timer20ms(void * parameter) {
                 break;
 
             case MNBC_SOUND:
-                if ((SoundsTimer + 600) < millis() ) {
-                    _LOG_D("SOUND timer expired\n");
+                // Wait until all PEVs have sounded, or, when all PEVs have started sounding, 600ms after the last one started.
+                // The first PEV expects our CM_ATTEN_CHAR.IND within 1200ms, so we never wait longer than 1000ms.
+                if (soundingComplete() || (allSounding() && (SoundsTimer + 600) < millis()) || (SoundsStart + 1000) < millis()) {
+                    if (!soundingComplete()) _LOG_D("SOUND timer expired\n");
                     // Send CM_ATTEN_CHAR_IND, even if no Sounds were received.
+                    selectCandidate();
                     modem_state = ATTEN_CHAR_IND;
                 }
                 break;
@@ -574,6 +917,7 @@ void Timer20ms(void * parameter) {
 
         if (modem_state != old_modem_state) {
             _LOG_D("modem_state2 %u -> %u.\n", old_modem_state, modem_state);
+            modemTimeline(TL_SLAC, modem_state, old_modem_state, 0);
             old_modem_state = modem_state;
         }
 
@@ -620,12 +964,22 @@ void Timer20ms(void * parameter) {
 
         if (modem_state != old_modem_state) {
             _LOG_D("modem_state3 %u -> %u.\n", old_modem_state, modem_state);
+            modemTimeline(TL_SLAC, modem_state, old_modem_state, 0);
             old_modem_state = modem_state;
         }
 
-        // Pause the task for 20ms
-        vTaskDelay(20 / portTICK_PERIOD_MS);
-        //_LOG_A("Timer20ms task free ram: %u\n", uxTaskGetStackHighWaterMark( NULL ));
+        tcp_timer();                                        // retransmit unacknowledged V2G data
+
+        // Sleep until the modem signals a received frame, or at most 20ms for the state machine timers.
+        ulTaskNotifyTake(pdTRUE, 20 / portTICK_PERIOD_MS);
+
+        // Log the stack that was never used, each time it is less than before
+        StackFree = uxTaskGetStackHighWaterMark(NULL);
+        if (StackFree < StackLow) {
+            StackLow = StackFree;
+            if (StackFree < MODEM_TASK_STACK_MARGIN) _LOG_W("Timer20ms task: only %u of %u bytes stack never used!\n", StackFree, MODEM_TASK_STACK);
+            else _LOG_I("Timer20ms task: %u of %u bytes stack never used.\n", StackFree, MODEM_TASK_STACK);
+        }
 
     } // while(1)
 }
@@ -39,6 +39,12 @@ uint32_t qcaspi_read_burst(uint8_t *dst);
 #define SPI_INT_RDBUF_ERR      (1 << 1)
 #define SPI_INT_PKT_AVLBL      (1 << 0)
 
+// Stack of the Timer20ms task, in bytes. The EXI documents are static (tcp.cpp); the 40000 bytes this task
+// had before left ~15.6 KB for the rest, after the ~24 KB iso2 document, and this keeps that room.
+// Timer20ms() logs the stack it never used, and warns when less than MODEM_TASK_STACK_MARGIN is left.
+#define MODEM_TASK_STACK        16384
+#define MODEM_TASK_STACK_MARGIN 2048
+
 /*====================================================================*
  *   States
  *--------------------------------------------------------------------*/
@@ -106,10 +112,24 @@ uint32_t qcaspi_read_burst(uint8_t *dst);
 #define FRAME_IPV6 0x86DD
 #define FRAME_HOMEPLUG 0x88E1
 
-extern uint8_t txbuffer[3164], rxbuffer[3164];
+extern uint8_t txbuffer[3164];
+extern uint8_t *rxbuffer;
 extern uint8_t myMac[];
 extern uint8_t pevMac[];
 extern uint8_t EVCCID2[];
 void qcaspi_write_burst(uint8_t *src, uint32_t len);
 void setMacAt(uint8_t *mac, uint16_t offset);
+
+// Session timeline; every MME, SLAC and TCP state change and V2G message of the current session
+// is recorded in a RAM ring buffer, which can be downloaded with GET /modem_timeline
+#define TIMELINE_SIZE 512
+#define TL_MME_RX 0         // Code = MMTYPE, State = modem_state, Len = frame length
+#define TL_MME_TX 1
+#define TL_SLAC 2           // Code = previous modem_state, State = new modem_state
+#define TL_TCP 3            // Code = previous tcpState, State = new tcpState
+#define TL_V2G_REQ 4        // Code = fsmState, State = Charging_Protocol, Len = EXI length, Duration = decode time (us)
+#define TL_V2G_RES 5        // Code = fsmState, State = Charging_Protocol, Len = EXI length, Duration = encode time (us)
+
+void modemTimeline(uint8_t Type, uint8_t State, uint16_t Code, uint16_t Len, uint32_t Duration = 0);
+void modemTimelineJson(String &json);
 #endif
@@ -0,0 +1,585 @@
+/*
+;    Project:       Smart EVSE
+;
+;    Charging session journal, see session.h for the storage layout.
+;
+; Permission is hereby granted, free of charge, to any person obtaining a copy
+; of this software and associated documentation files (the "Software"), to deal
+; in the Software without restriction, including without limitation the rights
+; to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+; copies of the Software, and to permit persons to whom the Software is
+; furnished to do so, subject to the following conditions:
+;
+; The above copyright notice and this permission notice shall be included in
+; all copies or substantial portions of the Software.
+;
+; THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+; IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+; FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+; AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+; LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+; OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+; THE SOFTWARE.
+ */
+
+#ifdef SMARTEVSE_VERSION //ESP32
+
+#include <string.h>
+#include <time.h>
+#include <LittleFS.h>
+#include "esp_rom_crc.h"
+#include "esp32.h"
+#include "mongoose.h"
+#include "session.h"
+
+#define SESSION_DIR "/sessions"
+#define SESSION_TMP SESSION_DIR "/tmp"                                          // repaired segment, replaces it when complete
+#define SESSION_CURRENT "/session.cur"                                          // session in progress
+#define SESSION_BLOCKS (SESSION_SEGMENTS * SESSION_SEGMENT_SIZE / SESSION_BLOCK)
+#define SESSION_ALL 0xffffffff                                                  // no upper limit of the start time
+
+static_assert(sizeof(SessionRecord) == 96, "SessionRecord must be 96 bytes");
+static_assert(SESSION_SEGMENT_SIZE % SESSION_BLOCK == 0, "a block must not span segments");
+
+extern char EVCCID[32];
+
+struct SessionBlock {
+    uint64_t Cards;                                                             // cardBits() of all cards and idTags
+    uint32_t FirstStart;                                                        // lowest known start time, SESSION_ALL when none is known
+    uint32_t LastStart;                                                         // highest known start time
+    uint8_t Sessions;                                                           // valid records
+    uint8_t Timed;                                                              // valid records with a known start time
+};
+
+struct SessionFilter {
+    uint32_t From, To;                                                          // start time
+    uint64_t Cards;                                                             // cardBits() of Card, 0 when any card matches
+    char Card[SESSION_IDTAG_LEN + 2];                                           // a longer card is truncated to one that matches nothing
+};
+
+static SessionBlock SessionIndex[SESSION_BLOCKS];                               // ring, block b is at b % SESSION_BLOCKS
+static uint32_t FirstId = 0, NextId = 0;                                        // sessions kept in the journal
+static bool SessionReady = false;
+
+static SessionRecord Cache[SESSION_BLOCK];                                      // the last block that was read
+static uint32_t CacheBlock = SESSION_ALL;
+static uint8_t CacheCount = 0;
+
+// session in progress
+static SessionRecord Current;
+static bool SessionActive = false;
+static unsigned long SessionStarted = 0, SessionCheckpoint = 0;
+static uint8_t PendingUid[7];                                                   // card that enabled access, set by CheckRFID()
+static bool PendingCard = false;
+static portMUX_TYPE SessionMux = portMUX_INITIALIZER_UNLOCKED;
+
+// CSV export, one at a time
+static struct mg_connection *ExportConn = NULL;
+static uint32_t ExportPos;
+static SessionFilter ExportFilter;
+
+static const char *const SessionModes[3] = {"Normal", "Smart", "Solar"};
+
+
+static uint32_t sessionCrc(const SessionRecord *rec) {
+    return esp_rom_crc32_le(0, (const uint8_t *) rec, offsetof(SessionRecord, Crc));
+}
+
+static bool validSession(const SessionRecord *rec, uint32_t id) {
+    return rec->Id == id && rec->Crc == sessionCrc(rec);
+}
+
+static void segmentPath(uint32_t segment, char *path) {
+    sprintf(path, SESSION_DIR "/%u.bin", segment);
+}
+
+// Two bits of a 64 bit mask for a card. UIDs and idTags are compared without case.
+static uint64_t cardBits(const char *card) {
+    uint32_t hash = 2166136261UL;                                               // FNV-1a
+
+    for (; *card; card++) hash = (hash ^ toupper((unsigned char) *card)) * 16777619UL;
+    return (1ULL << (hash & 63)) | (1ULL << ((hash >> 6) & 63));
+}
+
+// The RFID card of a session as 12 or 14 hex digits, empty when there is none
+void SessionFormatCard(const SessionRecord *rec, char *str) {
+    uint8_t len = rec->Uid[6] == 0xff ? 6 : 7;
+
+    str[0] = '\0';
+    if (rec->Flags & SESSION_RFID) {
+        for (uint8_t i = 0; i < len; i++) sprintf(str + i * 2, "%02X", rec->Uid[i]);
+    }
+}
+
+static void clearBlock(uint32_t block) {
+    SessionBlock *b = &SessionIndex[block % SESSION_BLOCKS];
+
+    b->Cards = 0;
+    b->FirstStart = SESSION_ALL;
+    b->LastStart = 0;
+    b->Sessions = b->Timed = 0;
+}
+
+static void indexSession(const SessionRecord *rec) {
+    SessionBlock *b = &SessionIndex[(rec->Id / SESSION_BLOCK) % SESSION_BLOCKS];
+    char uid[15];
+
+    b->Sessions++;
+    if (rec->Start) {
+        if (rec->Start < b->FirstStart) b->FirstStart = rec->Start;
+        if (rec->Start > b->LastStart) b->LastStart = rec->Start;
+        b->Timed++;
+    }
+    SessionFormatCard(rec, uid);
+    if (uid[0]) b->Cards |= cardBits(uid);
+    if (rec->IdTag[0]) b->Cards |= cardBits(rec->IdTag);
+}
+
+// Read a block of sessions into the cache, returns the number of records read
+static uint8_t readBlock(uint32_t block) {
+    char path[24];
+    File file;
+
+    if (block == CacheBlock) return CacheCount;
+    CacheBlock = block;
+    CacheCount = 0;
+    segmentPath(block * SESSION_BLOCK / SESSION_SEGMENT_SIZE, path);
+    file = LittleFS.open(path, "r");
+    if (file) {
+        if (file.seek((block * SESSION_BLOCK % SESSION_SEGMENT_SIZE) * sizeof(SessionRecord)))
+            CacheCount = file.read((uint8_t *) Cache, sizeof(Cache)) / sizeof(SessionRecord);
+        file.close();
+    }
+    return CacheCount;
+}
+
+// The session with this id, NULL when it is not kept or damaged. Valid until the next read.
+static const SessionRecord *readSession(uint32_t id) {
+    uint8_t i = id % SESSION_BLOCK;
+
+    if (id < FirstId || id >= NextId || i >= readBlock(id / SESSION_BLOCK) || !validSession(&Cache[i], id)) return NULL;
+    return &Cache[i];
+}
+
+/**
+ * Make a segment exactly records long: a write that failed or was torn leaves a partial record,
+ * and a missing record would move the ones after it. Missing records are written as zeros, which are not valid.
+ */
+static bool resizeSegment(const char *path, uint32_t records) {
+    File in = LittleFS.open(path, "r"), out = LittleFS.open(SESSION_TMP, "w");
+    uint32_t available = in ? in.size() / sizeof(SessionRecord) : 0;
+    bool ok = (bool) out;
+
+    CacheBlock = SESSION_ALL;                                                   // the cache is used as buffer
+    for (uint32_t i = 0; ok && i < records; i += SESSION_BLOCK) {
+        size_t n = (records - i < SESSION_BLOCK ? records - i : SESSION_BLOCK) * sizeof(SessionRecord);
+        size_t read = i < available ? in.read((uint8_t *) Cache, n) : 0;
+        if (read < n) memset((uint8_t *) Cache + read, 0, n - read);
+        ok = out.write((const uint8_t *) Cache, n) == n;
+    }
+    if (in) in.close();
+    if (out) out.close();
+    if (ok) ok = LittleFS.rename(SESSION_TMP, path);
+    if (!ok) {
+        _LOG_A("Session: can not repair %s.\n", path);
+        LittleFS.remove(SESSION_TMP);
+        return false;
+    }
+    _LOG_A("Session: %s repaired, %u of %u records kept.\n", path, available < records ? available : records, records);
+    return true;
+}
+
+static bool appendSession(SessionRecord *rec) {
+    uint32_t segment = NextId / SESSION_SEGMENT_SIZE, records = NextId % SESSION_SEGMENT_SIZE;
+    char path[24];
+    File file;
+    bool ok;
+
+    rec->Id = NextId;
+    rec->Crc = sessionCrc(rec);
+    if (!records && segment >= SESSION_SEGMENTS) {                              // a new segment replaces the oldest
+        segmentPath(segment - SESSION_SEGMENTS, path);
+        LittleFS.remove(path);
+        FirstId = (segment - SESSION_SEGMENTS + 1) * SESSION_SEGMENT_SIZE;
+    }
+    segmentPath(segment, path);
+    file = LittleFS.open(path, "a");
+    if (file && file.size() != records * sizeof(SessionRecord)) {
+        file.close();
+        file = resizeSegment(path, records) ? LittleFS.open(path, "a") : File();
+    }
+    ok = file && file.write((const uint8_t *) rec, sizeof(SessionRecord)) == sizeof(SessionRecord);
+    if (file) file.close();
+    if (!ok) {
+        _LOG_A("Session: can not write %s.\n", path);
+        return false;
+    }
+    if (NextId % SESSION_BLOCK == 0) clearBlock(NextId / SESSION_BLOCK);
+    indexSession(rec);
+    if (NextId / SESSION_BLOCK == CacheBlock) CacheBlock = SESSION_ALL;
+    NextId++;
+    return true;
+}
+
+static void initFilter(SessionFilter *filter, uint32_t from, uint32_t to, const char *card) {
+    filter->From = from;
+    filter->To = to;
+    strncpy(filter->Card, card ? card : "", sizeof(filter->Card) - 1);
+    filter->Card[sizeof(filter->Card) - 1] = '\0';
+    filter->Cards = filter->Card[0] ? cardBits(filter->Card) : 0;
+}
+
+static bool timeFilter(const SessionFilter *filter) {
+    return filter->From || filter->To != SESSION_ALL;
+}
+
+static bool blockMatches(uint32_t block, const SessionFilter *filter) {
+    const SessionBlock *b = &SessionIndex[block % SESSION_BLOCKS];
+
+    if (timeFilter(filter) && (b->LastStart < filter->From || b->FirstStart > filter->To)) return false;
+    return (b->Cards & filter->Cards) == filter->Cards;
+}
+
+// Sessions without a known start time only match when there is no time filter
+static bool sessionMatches(const SessionRecord *rec, const SessionFilter *filter) {
+    char uid[15];
+
+    if (timeFilter(filter) && (!rec->Start || rec->Start < filter->From || rec->Start > filter->To)) return false;
+    if (!filter->Card[0]) return true;
+    SessionFormatCard(rec, uid);
+    return !strcasecmp(uid, filter->Card) || !strcasecmp(rec->IdTag, filter->Card);
+}
+
+/**
+ * Find the next session that matches, skipping blocks that can not match
+ *
+ * @param pos id to continue from, updated. Going back, the session before pos is the next one.
+ * @param reverse newest first
+ * @return the session, valid until the next read, or NULL when there are no more
+ */
+static const SessionRecord *nextSession(uint32_t *pos, const SessionFilter *filter, bool reverse) {
+    const SessionRecord *rec;
+
+    if (!reverse && *pos < FirstId) *pos = FirstId;                             // sessions were removed meanwhile
+    if (reverse && *pos > NextId) *pos = NextId;
+    while (reverse ? *pos > FirstId : *pos < NextId) {
+        uint32_t id = reverse ? *pos - 1 : *pos, block = id / SESSION_BLOCK;
+
+        if (!blockMatches(block, filter)) {
+            *pos = reverse ? block * SESSION_BLOCK : (block + 1) * SESSION_BLOCK;
+            continue;
+        }
+        *pos = reverse ? id : id + 1;
+        rec = readSession(id);
+        if (rec && sessionMatches(rec, filter)) return rec;
+    }
+    return NULL;
+}
+
+// Number of sessions in a block that match, when the index knows it without reading the block
+static bool countBlock(uint32_t block, const SessionFilter *filter, uint32_t *count) {
+    const SessionBlock *b = &SessionIndex[block % SESSION_BLOCKS];
+
+    if (!blockMatches(block, filter)) *count = 0;
+    else if (filter->Card[0]) return false;
+    else if (!timeFilter(filter)) *count = b->Sessions;
+    else if (b->FirstStart >= filter->From && b->LastStart <= filter->To) *count = b->Timed;
+    else return false;
+    return true;
+}
+
+/**
+ * Find sessions, newest first
+ *
+ * @param from, to range of the start time, 0 and 0xffffffff for all sessions
+ * @param card RFID UID or OCPP idTag, NULL or empty for all cards
+ * @param skip, count the callback is called for count sessions after the first skip
+ * @return the number of sessions that match
+ */
+uint32_t SessionQuery(uint32_t from, uint32_t to, const char *card, uint32_t skip, uint32_t count, SessionCallback callback, void *arg) {
+    SessionFilter filter;
+    const SessionRecord *rec;
+    uint32_t pos = NextId, total = 0;
+
+    initFilter(&filter, from, to, card);
+    while (pos > FirstId) {
+        uint32_t block = (pos - 1) / SESSION_BLOCK, n;
+
+        // whole blocks before or after the requested sessions are counted from the index when possible
+        if ((pos % SESSION_BLOCK == 0 || pos == NextId) && countBlock(block, &filter, &n) && (total + n <= skip || (total >= skip && total - skip >= count))) {
+            total += n;
+            pos = block * SESSION_BLOCK;
+        } else if ((rec = nextSession(&pos, &filter, true))) {
+            if (total >= skip && total - skip < count && !callback(arg, rec)) count = 0;
+            total++;
+        }
+    }
+    return total;
+}
+
+
+// ############################## Session in progress ##############################
+
+static uint32_t sessionTime(void) {
+    return LocalTimeSet ? time(NULL) : 0;
+}
+
+static void writeCurrent(void) {
+    File file = LittleFS.open(SESSION_CURRENT, "w");
+    bool ok;
+
+    Current.Crc = sessionCrc(&Current);
+    ok = file && file.write((const uint8_t *) &Current, sizeof(Current)) == sizeof(Current);
+    if (file) file.close();
+    if (!ok) _LOG_A("Session: can not write %s.\n", SESSION_CURRENT);
+}
+
+static void updateSession(void) {
+    uint32_t now = sessionTime();
+    int16_t current = Balanced[0];
+
+    if (State == STATE_C) {
+        if (EVMeter.Type) current = max(EVMeter.Irms[0], max(EVMeter.Irms[1], EVMeter.Irms[2]));
+        if (current > Current.PeakCurrent) Current.PeakCurrent = current;
+        if (Nr_Of_Phases_Charging > Current.Phases) Current.Phases = Nr_Of_Phases_Charging;
+    }
+    if (EVMeter.Type) {
+        if (!(Current.Flags & SESSION_EV_METER)) {                              // also when the EV meter is configured during the session
+            Current.Flags |= SESSION_EV_METER;
+            Current.MeterStart = EVMeter.Energy;
+        }
+        Current.Energy = EVMeter.Energy - Current.MeterStart;
+    }
+    if (EVCCID[0]) strncpy(Current.EVCCID, EVCCID, SESSION_EVCCID_LEN);
+    if (now) {
+        if (!Current.Start) Current.Start = now - (millis() - SessionStarted) / 1000;   // also when the time became known during the session
+        Current.Stop = now;
+    }
+    portENTER_CRITICAL(&SessionMux);
+    if (PendingCard && !(Current.Flags & SESSION_RFID)) {
+        memcpy(Current.Uid, PendingUid, 7);
+        Current.Flags |= SESSION_RFID;
+        PendingCard = false;
+    }
+    portEXIT_CRITICAL(&SessionMux);
+}
+
+static void startSession(void) {
+    memset(&Current, 0, sizeof(Current));
+    Current.Id = NextId;                                                        // sessions do not overlap, so this is the id it will get
+    Current.Mode = Mode;
+    SessionStarted = SessionCheckpoint = millis();
+    SessionActive = true;
+    updateSession();
+    writeCurrent();
+    _LOG_I("Session: %u started.\n", Current.Id);
+}
+
+static void stopSession(void) {
+    updateSession();
+    SessionActive = false;
+    portENTER_CRITICAL(&SessionMux);
+    PendingCard = false;
+    portEXIT_CRITICAL(&SessionMux);
+    if (appendSession(&Current)) LittleFS.remove(SESSION_CURRENT);              // else it is added at the next start
+    _LOG_I("Session: %u stopped after %lu s, %i Wh.\n", Current.Id, (millis() - SessionStarted) / 1000, Current.Energy);
+}
+
+/**
+ * Follow the EVSE state, called every second
+ *
+ * A session starts when the EV starts charging, and stops when the EV is disconnected or access is switched off.
+ */
+void SessionTick(void) {
+    if (!SessionReady) return;
+    if (!SessionActive) {
+        if (State == STATE_C && AccessStatus != OFF) startSession();
+        else if (AccessStatus == OFF) {                                         // the card locked the EVSE again before charging
+            portENTER_CRITICAL(&SessionMux);
+            PendingCard = false;
+            portEXIT_CRITICAL(&SessionMux);
+        }
+        return;
+    }
+    updateSession();
+    if (State == STATE_A || AccessStatus == OFF) stopSession();
+    else if (millis() - SessionCheckpoint >= SESSION_CHECKPOINT * 1000UL) {
+        SessionCheckpoint = millis();
+        writeCurrent();
+    }
+}
+
+// The card that enabled access is stored with the session it starts, or the one in progress
+void SessionSetCard(const uint8_t *uid) {
+    portENTER_CRITICAL(&SessionMux);
+    memcpy(PendingUid, uid, 7);
+    PendingCard = true;
+    portEXIT_CRITICAL(&SessionMux);
+}
+
+// idTag of the OCPP transaction, called while there is one
+void SessionSetIdTag(const char *idTag) {
+    if (SessionActive && idTag && !Current.IdTag[0]) strncpy(Current.IdTag, idTag, SESSION_IDTAG_LEN);
+}
+
+
+// ############################## Load at boot ##############################
+
+// Segment number of a file name "<n>.bin", false for other files
+static bool segmentNumber(const char *name, uint32_t *segment) {
+    char *end;
+
+    if (!isdigit((unsigned char) name[0])) return false;
+    *segment = strtoul(name, &end, 10);
+    return !strcmp(end, ".bin");
+}
+
+// Add the session that was in progress when the EVSE restarted
+static void recoverSession(void) {
+    File file;
+    SessionRecord rec;
+    bool ok;
+
+    if (!LittleFS.exists(SESSION_CURRENT)) return;
+    file = LittleFS.open(SESSION_CURRENT, "r");
+    ok = file && file.read((uint8_t *) &rec, sizeof(rec)) == sizeof(rec) && validSession(&rec, rec.Id);
+    if (file) file.close();
+    if (ok && rec.Id == NextId) {                                               // else it was added just before the restart
+        rec.Flags |= SESSION_INTERRUPTED;
+        if (!appendSession(&rec)) return;
+        _LOG_A("Session: %u was interrupted, %i Wh.\n", rec.Id, rec.Energy);
+    }
+    LittleFS.remove(SESSION_CURRENT);
+}
+
+void SessionInit(void) {
+    File dir, file;
+    uint32_t first = SESSION_ALL, last = 0, segment, records = 0, sessions = 0;
+    char path[24];
+    unsigned long start = millis();
+
+    if (!LittleFS.exists(SESSION_DIR)) LittleFS.mkdir(SESSION_DIR);
+    dir = LittleFS.open(SESSION_DIR);
+    while (dir && (file = dir.openNextFile())) {
+        if (segmentNumber(file.name(), &segment)) {
+            if (segment < first) first = segment;
+            if (segment >= last) {
+                last = segment;
+                records = file.size() / sizeof(SessionRecord);
+                if (file.size() % sizeof(SessionRecord) || records > SESSION_SEGMENT_SIZE) records = SESSION_ALL;
+            }
+        }
+        file.close();
+    }
+    if (dir) dir.close();
+    if (LittleFS.exists(SESSION_TMP)) LittleFS.remove(SESSION_TMP);
+
+    if (first != SESSION_ALL) {
+        for (; first + SESSION_SEGMENTS <= last; first++) {                     // left over when SESSION_SEGMENTS was larger
+            segmentPath(first, path);
+            LittleFS.remove(path);
+        }
+        segmentPath(last, path);
+        if (records == SESSION_ALL) {                                           // torn write at the end
+            file = LittleFS.open(path, "r");
+            records = file ? file.size() / sizeof(SessionRecord) : 0;
+            if (file) file.close();
+            if (records > SESSION_SEGMENT_SIZE) records = SESSION_SEGMENT_SIZE;
+            resizeSegment(path, records);
+        }
+        FirstId = first * SESSION_SEGMENT_SIZE;
+        NextId = last * SESSION_SEGMENT_SIZE + records;
+    }
+
+    for (uint32_t id = FirstId; id < NextId; id++) {
+        const SessionRecord *rec;
+
+        if (id % SESSION_BLOCK == 0) clearBlock(id / SESSION_BLOCK);
+        if ((rec = readSession(id))) {
+            indexSession(rec);
+            sessions++;
+        }
+    }
+    _LOG_I("Session: %u sessions loaded from %u records in %lu ms.\n", sessions, NextId - FirstId, millis() - start);
+    recoverSession();
+    SessionReady = true;
+}
+
+
+// ############################## CSV export ##############################
+
+/**
+ * Start sending the sessions that match as CSV, oldest first
+ *
+ * The rows are sent from SessionExportPoll() while earlier ones are sent, so the export does not need RAM for all sessions.
+ * @return false when another export is in progress
+ */
+bool SessionExportBegin(struct mg_connection *c, uint32_t from, uint32_t to, const char *card) {
+    if (ExportConn) return false;
+    ExportConn = c;
+    ExportPos = FirstId;
+    initFilter(&ExportFilter, from, to, card);
+    mg_printf(c, "HTTP/1.1 200 OK\r\n"
+                 "Content-Type: text/csv\r\n"
+                 "Content-Disposition: attachment; filename=\"sessions.csv\"\r\n"
+                 "Connection: close\r\n"
+                 "Transfer-Encoding: chunked\r\n"
+                 "\r\n");
+    mg_http_printf_chunk(c, "id,start,stop,duration,meter_start_wh,energy_wh,peak_current,phases,mode,rfid,idtag,evccid,interrupted\r\n");
+    return true;
+}
+
+static void formatTime(uint32_t t, char *str) {
+    time_t time = t;
+    struct tm tm;
+
+    if (!t) str[0] = '\0';
+    else strftime(str, 21, "%Y-%m-%dT%H:%M:%SZ", gmtime_r(&time, &tm));
+}
+
+// A text field, quoted when needed
+static void csvField(const char *value, char *str) {
+    if (!strpbrk(value, ",\"\r\n")) {
+        strcpy(str, value);
+        return;
+    }
+    *str++ = '"';
+    for (; *value; value++) {
+        if (*value == '"') *str++ = '"';
+        *str++ = *value;
+    }
+    *str++ = '"';
+    *str = '\0';
+}
+
+// Called on every poll of the connection; sends a block of rows when the previous rows are sent
+void SessionExportPoll(struct mg_connection *c) {
+    const SessionRecord *rec;
+    char start[21], stop[21], uid[15], idTag[SESSION_IDTAG_LEN * 2 + 3], evccid[SESSION_EVCCID_LEN * 2 + 3];
+
+    if (c != ExportConn || c->send.len >= MG_IO_SIZE) return;
+    for (uint8_t i = 0; i < SESSION_BLOCK; i++) {
+        if (!(rec = nextSession(&ExportPos, &ExportFilter, false))) {
+            mg_http_write_chunk(c, "", 0);
+            c->is_draining = 1;
+            ExportConn = NULL;
+            return;
+        }
+        formatTime(rec->Start, start);
+        formatTime(rec->Stop, stop);
+        SessionFormatCard(rec, uid);
+        csvField(rec->IdTag, idTag);
+        csvField(rec->EVCCID, evccid);
+        mg_http_printf_chunk(c, "%u,%s,%s,%u,%d,%d,%u,%u,%s,%s,%s,%s,%u\r\n", rec->Id, start, stop,
+                             rec->Start && rec->Stop >= rec->Start ? rec->Stop - rec->Start : 0,
+                             rec->MeterStart, rec->Energy, rec->PeakCurrent, rec->Phases,
+                             rec->Mode < 3 ? SessionModes[rec->Mode] : "", uid, idTag, evccid,
+                             rec->Flags & SESSION_INTERRUPTED ? 1 : 0);
+    }
+}
+
+void SessionExportClose(struct mg_connection *c) {
+    if (c == ExportConn) ExportConn = NULL;
+}
+
+#endif
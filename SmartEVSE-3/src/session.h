@@ -0,0 +1,65 @@
+/*
+ * Charging session journal
+ *
+ * Every charging session, from the moment the EV starts charging until it is disconnected or access is switched
+ * off, is stored as one fixed size record on LittleFS. The records are appended to segment files
+ * /sessions/<n>.bin of SESSION_SEGMENT_SIZE records; session id i is record i % SESSION_SEGMENT_SIZE of segment
+ * i / SESSION_SEGMENT_SIZE, so a session is read with one seek. When a new segment is started, the oldest is removed
+ * when more than SESSION_SEGMENTS would be kept.
+ *
+ * The session in progress is written to /session.cur when it starts and every SESSION_CHECKPOINT seconds. When the
+ * EVSE restarts during a session, that record is added to the journal, marked as interrupted.
+ *
+ * A small index in RAM keeps, per block of SESSION_BLOCK records, the first and last start time and a bit mask of
+ * the cards, so queries only read the blocks that can match.
+ */
+
+#ifndef __SESSION_H
+#define __SESSION_H
+
+#include <Arduino.h>
+
+#define SESSION_SEGMENT_SIZE    256                                             // records per segment file
+#define SESSION_SEGMENTS        6                                               // segments kept, 144 KB
+#define SESSION_BLOCK           16                                              // records per index entry
+#define SESSION_CHECKPOINT      900                                             // seconds between writes of the session in progress
+#define SESSION_IDTAG_LEN       20                                              // OCPP idTag
+#define SESSION_EVCCID_LEN      31
+
+#define SESSION_RFID            0x01                                            // Uid holds the card that enabled access
+#define SESSION_EV_METER        0x02                                            // energy is measured by the EV meter
+#define SESSION_INTERRUPTED     0x04                                            // EVSE restarted, stop time and energy of the last checkpoint
+
+struct __attribute__((packed)) SessionRecord {                                  // 96 bytes
+    uint32_t Id;
+    uint32_t Start;                                                             // UTC, seconds since 1/1/1970; 0 = time was not known
+    uint32_t Stop;
+    int32_t MeterStart;                                                         // EV meter reading at the start (Wh)
+    int32_t Energy;                                                             // charged (Wh)
+    uint16_t PeakCurrent;                                                       // highest current of a phase (Amps *10)
+    uint8_t Phases;                                                             // most phases used
+    uint8_t Mode;                                                               // MODE_NORMAL, MODE_SMART or MODE_SOLAR at the start
+    uint8_t Flags;
+    uint8_t Uid[7];                                                             // RFID card, 6 byte UIDs of the old reader end with 0xff
+    char IdTag[SESSION_IDTAG_LEN + 1];
+    char EVCCID[SESSION_EVCCID_LEN + 1];
+    uint8_t Reserved[7];
+    uint32_t Crc;                                                               // crc32 of the bytes above
+};
+
+// Called for every session that matches a query, return false to stop
+typedef bool (*SessionCallback)(void *arg, const SessionRecord *rec);
+
+struct mg_connection;
+
+void SessionInit(void);
+void SessionTick(void);
+void SessionSetCard(const uint8_t *uid);
+void SessionSetIdTag(const char *idTag);
+uint32_t SessionQuery(uint32_t from, uint32_t to, const char *card, uint32_t skip, uint32_t count, SessionCallback callback, void *arg);
+void SessionFormatCard(const SessionRecord *rec, char *str);
+bool SessionExportBegin(struct mg_connection *c, uint32_t from, uint32_t to, const char *card);
+void SessionExportPoll(struct mg_connection *c);
+void SessionExportClose(struct mg_connection *c);
+
+#endif
@@ -0,0 +1,245 @@
+/*
+;    Project:       Smart EVSE
+;
+;    Settings store, see settings.h for the layout in NVS.
+;
+; Permission is hereby granted, free of charge, to any person obtaining a copy
+; of this software and associated documentation files (the "Software"), to deal
+; in the Software without restriction, including without limitation the rights
+; to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+; copies of the Software, and to permit persons to whom the Software is
+; furnished to do so, subject to the following conditions:
+;
+; The above copyright notice and this permission notice shall be included in
+; all copies or substantial portions of the Software.
+;
+; THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+; IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+; FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+; AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+; LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+; OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+; THE SOFTWARE.
+ */
+
+#ifdef SMARTEVSE_VERSION //ESP32
+
+#include <stddef.h>
+#include <string.h>
+#include "esp_rom_crc.h"
+#include "esp32.h"
+#include "settings.h"
+
+static SettingsCache settingsCache;                                             // settings as stored (or about to be stored) in NVS
+static SettingsState settingsState;                                             // state as stored in NVS
+static bool SettingsPending = false;                                            // settingsCache is not written to NVS yet
+static bool SettingsErased = false;                                             // settings are erased, do not write them again before the reboot
+static portMUX_TYPE SettingsMux = portMUX_INITIALIZER_UNLOCKED;                 // protects the four above
+static SemaphoreHandle_t SettingsFlushLock = NULL;
+static TaskHandle_t SettingsTask = NULL;
+
+static struct {
+    uint32_t Changes;                                                           // settings_store_put() calls that changed a setting
+    uint32_t Writes;                                                            // blob writes, after coalescing
+    uint32_t BytesWritten;
+    uint32_t StateWrites;                                                       // state keys written
+} SettingsStats;
+
+
+/**
+ * Read the settings blob
+ *
+ * @param prefs the settings namespace, opened by the caller
+ * @param data filled with the stored settings
+ * @return number of bytes of data that were read, 0 when there is no valid blob
+ */
+size_t read_settings_blob(Preferences &prefs, SettingsCache &data) {
+    SettingsBlob *blob;
+    size_t len = prefs.getBytesLength(SETTINGS_BLOB_KEY), n = 0;
+
+    if (len < offsetof(SettingsBlob, Data)) return 0;                           // not stored yet
+    blob = (SettingsBlob *) malloc(len);                                        // newer firmware may have stored a longer blob
+    if (blob && prefs.getBytes(SETTINGS_BLOB_KEY, blob, len) == len) {
+        if (blob->Version == SETTINGS_BLOB_VERSION && blob->Length == len - offsetof(SettingsBlob, Data) &&
+            esp_rom_crc32_le(0, (uint8_t *) &blob->Data, blob->Length) == blob->Crc) {
+            n = blob->Length < sizeof(data) ? blob->Length : sizeof(data);
+            memcpy(&data, &blob->Data, n);
+        } else _LOG_A("Stored settings are invalid (version %u, %u bytes)!\n", blob->Version, len);
+    }
+    free(blob);
+    // the strings were terminated when they were stored, unless the blob is damaged in a way the CRC missed
+    data.MainsMeterDeviceHostName[sizeof(data.MainsMeterDeviceHostName) - 1] = '\0';
+    data.EVMeterDeviceHostName[sizeof(data.EVMeterDeviceHostName) - 1] = '\0';
+    data.CircuitMeterDeviceHostName[sizeof(data.CircuitMeterDeviceHostName) - 1] = '\0';
+    data.intervals_json[sizeof(data.intervals_json) - 1] = '\0';
+    data.RequiredEVCCID[sizeof(data.RequiredEVCCID) - 1] = '\0';
+    return n;
+}
+
+// Write the settings to NVS, when they changed since the last write
+static void flush_settings(void) {
+    SettingsBlob blob;
+    bool pending;
+
+    if (!SettingsFlushLock) return;                                             // not loaded yet
+    if (xSemaphoreTake(SettingsFlushLock, pdMS_TO_TICKS(1000)) != pdTRUE) {
+        _LOG_A("Settings are busy, not saved!\n");                              // still pending, written after the next change
+        return;
+    }
+    portENTER_CRITICAL(&SettingsMux);
+    pending = SettingsPending && !SettingsErased;
+    memcpy(&blob.Data, &settingsCache, sizeof(blob.Data));
+    SettingsPending = false;
+    portEXIT_CRITICAL(&SettingsMux);
+
+    if (pending) {
+        Preferences prefs;                                                      // the global preferences object is used by other tasks
+        unsigned long start = micros();
+        bool ok = false;
+
+        blob.Version = SETTINGS_BLOB_VERSION;
+        blob.Length = sizeof(blob.Data);
+        blob.Crc = esp_rom_crc32_le(0, (uint8_t *) &blob.Data, sizeof(blob.Data));
+        if (prefs.begin("settings", false)) {
+            ok = prefs.putBytes(SETTINGS_BLOB_KEY, &blob, sizeof(blob)) == sizeof(blob);
+            prefs.end();
+        }
+        if (ok) {
+            SettingsStats.Writes++;
+            SettingsStats.BytesWritten += sizeof(blob);
+            _LOG_I("settings saved in %lu us (%u changes in %u writes, %u bytes since boot)\n", micros() - start,
+                   SettingsStats.Changes, SettingsStats.Writes, SettingsStats.BytesWritten);
+        } else {
+            _LOG_A("Can not write settings!\n");
+            portENTER_CRITICAL(&SettingsMux);
+            SettingsPending = true;                                             // try again with the next change
+            portEXIT_CRITICAL(&SettingsMux);
+        }
+    }
+    xSemaphoreGive(SettingsFlushLock);
+}
+
+/* Write the state keys that changed, before returning.
+ * The state is not part of the settings blob, so it is not lost when the power fails right after a change.
+ */
+void settings_store_state(const SettingsState &next) {
+    Preferences prefs;                                                          // the global preferences object is used by other tasks
+    bool erased, ok = true;
+    uint8_t keys = 0;
+
+    if (!SettingsFlushLock) return;                                             // not loaded yet
+    if (xSemaphoreTake(SettingsFlushLock, pdMS_TO_TICKS(1000)) != pdTRUE) {
+        _LOG_A("Settings are busy, state not saved!\n");                        // tried again with the next change
+        return;
+    }
+    portENTER_CRITICAL(&SettingsMux);
+    erased = SettingsErased;
+    portEXIT_CRITICAL(&SettingsMux);
+
+    if (!erased && memcmp(&next, &settingsState, sizeof(next))) {
+        unsigned long start = micros();
+
+        if (prefs.begin("settings", false)) {
+            if (next.Mode != settingsState.Mode) {
+                ok &= prefs.putUChar("Mode", next.Mode) > 0;
+                keys++;
+            }
+            if (next.AccessStatus != settingsState.AccessStatus) {
+                ok &= prefs.putUChar("Access", next.AccessStatus) > 0;
+                keys++;
+            }
+            if (next.CardOffset != settingsState.CardOffset) {
+                ok &= prefs.putUShort("CardOffs16", next.CardOffset) > 0;
+                keys++;
+            }
+            if (next.DelayedStartTime != settingsState.DelayedStartTime) {
+                ok &= prefs.putULong("DelayedStartTim", next.DelayedStartTime) > 0;
+                keys++;
+            }
+            if (next.DelayedStopTime != settingsState.DelayedStopTime) {
+                ok &= prefs.putULong("DelayedStopTime", next.DelayedStopTime) > 0;
+                keys++;
+            }
+            prefs.end();
+        } else ok = false;
+        if (ok) {
+            portENTER_CRITICAL(&SettingsMux);
+            settingsState = next;
+            portEXIT_CRITICAL(&SettingsMux);
+            SettingsStats.StateWrites += keys;
+            _LOG_I("%u state keys saved in %lu us (%u since boot)\n", keys, micros() - start, SettingsStats.StateWrites);
+        } else _LOG_A("Can not write settings state!\n");                       // tried again with the next change
+    }
+    xSemaphoreGive(SettingsFlushLock);
+}
+
+// Writes the settings when they did not change for SETTINGS_DEBOUNCE ms, so a burst of changes is one flash write
+static void settings_task(void *param) {
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        unsigned long first = millis();
+        while (millis() - first < SETTINGS_MAX_DELAY && ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(SETTINGS_DEBOUNCE)));
+        flush_settings();
+    }
+}
+
+/* Start the store with the settings and state read at boot
+ * @param pending the stored settings differ from stored, write them
+ */
+void settings_store_begin(const SettingsCache &stored, const SettingsState &state, bool pending) {
+    memcpy(&settingsCache, &stored, sizeof(settingsCache));
+    settingsState = state;
+    SettingsPending = pending;
+    SettingsFlushLock = xSemaphoreCreateMutex();
+    xTaskCreate(settings_task, "Settings", 3072, NULL, 1, &SettingsTask);
+    esp_register_shutdown_handler(flush_settings);                              // write pending settings on ESP.restart()
+    if (pending) xTaskNotifyGive(SettingsTask);
+}
+
+// The settings and state as stored, or about to be stored
+void settings_store_get(SettingsCache &stored, SettingsState &state) {
+    portENTER_CRITICAL(&SettingsMux);
+    memcpy(&stored, &settingsCache, sizeof(stored));
+    state = settingsState;
+    portEXIT_CRITICAL(&SettingsMux);
+}
+
+/* Store the settings, when they changed.
+ * The flash write is done by the settings task, this returns without waiting for it.
+ * @return true when a setting changed
+ */
+bool settings_store_put(const SettingsCache &next) {
+    bool changed;
+
+    portENTER_CRITICAL(&SettingsMux);
+    changed = memcmp(&next, &settingsCache, sizeof(next)) != 0;
+    if (changed) {
+        memcpy(&settingsCache, &next, sizeof(next));
+        SettingsPending = true;
+    }
+    portEXIT_CRITICAL(&SettingsMux);
+
+    if (changed) {
+        SettingsStats.Changes++;
+        if (SettingsTask) xTaskNotifyGive(SettingsTask);
+    }
+    return changed;
+}
+
+// Erase our settings namespace, a pending write is dropped and no settings are written until the reboot
+void erase_settings(void) {
+    Preferences prefs;
+    bool locked = SettingsFlushLock && xSemaphoreTake(SettingsFlushLock, pdMS_TO_TICKS(1000)) == pdTRUE;
+
+    portENTER_CRITICAL(&SettingsMux);
+    SettingsErased = true;
+    SettingsPending = false;
+    portEXIT_CRITICAL(&SettingsMux);
+    if (prefs.begin("settings", false)) {
+        prefs.clear();
+        prefs.end();
+    }
+    if (locked) xSemaphoreGive(SettingsFlushLock);
+}
+
+#endif
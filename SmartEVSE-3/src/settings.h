@@ -0,0 +1,80 @@
+/*
+ * Settings store
+ *
+ * All settings of SettingsCache are stored as one blob, so they are read at boot with a single NVS lookup,
+ * and a change costs one flash write. Fields are only added at the end: a shorter blob from older
+ * firmware is completed from the old per-key layout. Raise SETTINGS_BLOB_VERSION when the meaning
+ * of an existing field changes. The layout is the same for every build, whether MODEM or OCPP is enabled or not.
+ *
+ * The blob is written by the settings task, SETTINGS_DEBOUNCE ms after the last change and at most
+ * SETTINGS_MAX_DELAY ms after the first. A change made in that window is lost when the power fails
+ * (ESP.restart() writes it first), the EVSE then starts with the previous value. So the state that is
+ * changed in normal use, Mode, AccessStatus, the delayed charging times and CardOffset, is not in the blob.
+ * It is kept in its own keys and written as soon as it changes, see settings_store_state().
+ *
+ * Wear: NVS appends every write to a log of 32 byte entries, and erases a 4 KB page (126 entries) when the
+ * log wraps. A state key costs one entry, the blob 13. test/host/settings replays busy days against a model of
+ * the 20 KB partition: 96 mode changes, 3 sessions, a delayed start, 24 MQTT changes of the mains limit and a
+ * visit to the menu. That is 461 entries and 3.6 page erases a day, against 141 and 1.0 with every setting in
+ * a key of its own. The most worn page then reaches 100000 erase cycles after 228 years, instead of 747.
+ */
+
+#ifndef __SETTINGS_H
+#define __SETTINGS_H
+
+#include <Arduino.h>
+#include <Preferences.h>
+
+#define SETTINGS_BLOB_KEY "SettingsBlob"
+#define SETTINGS_BLOB_VERSION 2                                                 // 2: without the state of SettingsState
+#define SETTINGS_DEBOUNCE 2000                                                  // ms without changes before the settings are written
+#define SETTINGS_MAX_DELAY 10000                                                // ms, write anyway when the settings keep changing
+
+struct SettingsState {                                                          // stored as separate keys
+    uint8_t Mode, AccessStatus;
+    uint16_t CardOffset;
+    uint32_t DelayedStartTime, DelayedStopTime;
+};
+
+struct __attribute__((packed)) SettingsCache {
+    uint8_t Config, Lock;
+    uint16_t DelayedRepeat;
+    uint8_t LoadBl;
+    uint16_t MaxMains, MaxSumMains, MaxSumMainsTime, MaxCurrent, MinCurrent, MaxCircuit;
+    uint8_t Switch, RCmon;
+    uint16_t StartCurrent, StopTime, ImportCurrent;
+    uint8_t Grid, SB2_WIFImode, RFIDReader;
+    uint8_t MainsMeterType, MainsMeterAddress, EVMeterType, EVMeterAddress, CircuitMeterType, CircuitMeterAddress;
+    char MainsMeterDeviceHostName[32];
+    char EVMeterDeviceHostName[32];
+    char CircuitMeterDeviceHostName[32];
+    uint8_t EMEndianness, EMIDivisor, EMUDivisor, EMPDivisor, EMEDivisor, EMDataType, EMFunction;
+    uint16_t EMIRegister, EMURegister, EMPRegister, EMERegister;
+    uint8_t WIFImode;
+    uint8_t CapacityMode;
+    uint16_t EnableC2;
+    char intervals_json[128];
+    char RequiredEVCCID[32];
+    uint16_t maxTemp;
+    uint8_t AutoUpdate, LCDlock, CableLock;
+    uint16_t LCDPin;
+    bool MQTTSmartServer;
+    uint8_t LedMode;
+    uint8_t OcppMode;
+};
+
+struct __attribute__((packed)) SettingsBlob {
+    uint16_t Version;
+    uint16_t Length;                                                            // of Data
+    uint32_t Crc;                                                               // CRC32 of Data
+    SettingsCache Data;
+};
+
+size_t read_settings_blob(Preferences &prefs, SettingsCache &data);
+void settings_store_begin(const SettingsCache &stored, const SettingsState &state, bool pending);
+void settings_store_get(SettingsCache &stored, SettingsState &state);
+bool settings_store_put(const SettingsCache &next);
+void settings_store_state(const SettingsState &next);
+void erase_settings(void);
+
+#endif
@@ -16,29 +16,29 @@ extern "C" {
 #include "exi2/iso20_AC_Datatypes.h"
 #include "exi2/iso20_AC_Decoder.h"
 #include "exi2/iso20_AC_Encoder.h"
+#include "exi2/iso20_CommonMessages_Datatypes.h"
+#include "exi2/iso20_CommonMessages_Decoder.h"
+#include "exi2/iso20_CommonMessages_Encoder.h"
 }
+#include <esp_heap_caps.h>
 #include "debug.h"
 #include "esp32.h"
 
-/* Todo: implement a retry strategy, to cover the situation that single packets are lost on the way. */
-
-#define NEXT_TCP 0x06  // the next protocol is TCP
-
 #define TCP_FLAG_FIN 0x01
 #define TCP_FLAG_SYN 0x02
 #define TCP_FLAG_RST 0x04
 #define TCP_FLAG_PSH 0x08
 #define TCP_FLAG_ACK 0x10
 
-//in correct order:
-#define ETHERNET_HEADER_LEN 14                      // # Ethernet header needs 14 bytes:
-                                                    // #  6 bytes destination MAC
-                                                    // #  6 bytes source MAC
-                                                    // #  2 bytes EtherType
-#define IP6_HEADER_LEN 40 // # IP6 header needs 40 bytes: 8 + 16 + 16
+//in correct order: ETHERNET_HEADER_LEN, IP6_HEADER_LEN (ipv6.h)
 #define TCP_HEADER_LEN 20 // 20 bytes normal header, no options
 #define V2GTP_HEADER_LEN 8 /* header has 8 bytes */
 
+// V2GTP payload types; ISO 15118-20 uses a separate type per message namespace
+#define V2GTP_PAYLOAD_EXI 0x8001          // SupportedAppProtocol, DIN 70121 and ISO 15118-2
+#define V2GTP_PAYLOAD_ISO20_COMMON 0x8002 // ISO 15118-20 CommonMessages
+#define V2GTP_PAYLOAD_ISO20_AC 0x8003     // ISO 15118-20 AC
+
 #define EXI_OFFSET ETHERNET_HEADER_LEN + IP6_HEADER_LEN + TCP_HEADER_LEN + V2GTP_HEADER_LEN
 
 #define TCP_ACTIVITY_TIMER_START (5*33) /* 5 seconds */
@@ -51,15 +51,46 @@ uint16_t tcpActivityTimer;
 #define TCP_STATE_FIN_WAIT_2 4
 #define TCP_STATE_LAST_ACK 5
 
-#define TCP_RECEIVE_WINDOW 1000 /* number of octets we are able to receive */
-
 uint8_t tcpState = TCP_STATE_CLOSED;
-uint32_t TcpSeqNr;
-uint32_t TcpAckNr;
-
-#define TCP_RX_DATA_LEN 1000
-uint8_t tcp_rxdataLen=0;
+uint32_t TcpSeqNr;                          // next sequence number we will send
+uint32_t TcpAckNr;                          // next sequence number we expect from the EV
+
+// Segments are reassembled in order into tcp_rxdata until a complete V2GTP message is available.
+// The free space is advertised as receive window, out-of-order segments are dropped and answered
+// with a duplicate ACK, so the EV retransmits them.
+#define TCP_RX_DATA_LEN 2048
+uint16_t tcp_rxdataLen=0;
 uint8_t tcp_rxdata[TCP_RX_DATA_LEN];
+uint32_t tcp_rxdiscard = 0;                 // remaining bytes of a V2GTP message too large for tcp_rxdata
+// No V2G message comes near this, a longer V2GTP message is a corrupt stream and resets the connection
+#define V2GTP_MAX_MESSAGE_LEN 65535
+
+// Everything that consumes sequence space (data, SYN, FIN) is kept until the EV acknowledges it,
+// and retransmitted from TcpUnackedSeqNr on a timeout or after three duplicate ACKs.
+#define TCP_TX_DATA_LEN 1024
+uint8_t tcp_txdata[TCP_TX_DATA_LEN];
+uint16_t tcp_txdataLen = 0;                 // bytes sent but not yet acknowledged
+uint8_t tcp_txFlags = 0;                    // SYN and/or FIN sent but not yet acknowledged
+uint32_t TcpUnackedSeqNr;                   // oldest unacknowledged sequence number
+
+#define TCP_RTO_INITIAL 1000                // ms, RFC 6298
+#define TCP_RTO_MIN 200                     // ms, V2G message timeouts are only a few seconds
+#define TCP_RTO_MAX 3000                    // ms
+#define TCP_MAX_RETRIES 5
+#define TCP_DUPACK_THRESHOLD 3
+
+uint32_t tcpRetransmitTimer;                // millis() when the oldest unacknowledged segment was (re)sent
+uint16_t tcpRto = TCP_RTO_INITIAL;
+uint16_t tcpSrtt = 0, tcpRttVar = 0;        // smoothed round trip time and its variation, 0 = no sample yet
+uint32_t tcpRttSeqNr, tcpRttStart;          // segment being timed, Karn's algorithm: never a retransmitted one
+bool tcpRttTiming = false;
+uint8_t tcpRetries = 0, tcpDupAcks = 0;
+
+// per connection counters, logged when the connection closes
+struct {
+    uint16_t Segments, DupSegments, OutOfOrder, Overflows;
+    uint16_t DupAcks, Retransmits, FastRetransmits, Timeouts;
+} tcpStats;
 
 #define stateWaitForSupportedApplicationProtocolRequest 0
 #define stateWaitForSessionSetupRequest 1
@@ -73,9 +104,30 @@ uint8_t tcp_rxdata[TCP_RX_DATA_LEN];
 #define stateWaitForChargingStatusRequest 9
 #define stateWaitForMeteringReceipt 10
 #define stateChargeLoop 11
+#define stateWaitForAuthorizationSetupRequest 12
+#define stateWaitForServiceDetailRequest 13
+#define stateWaitForServiceSelectionRequest 14
+#define stateWaitForScheduleExchangeRequest 15
 
 uint8_t fsmState = stateWaitForSupportedApplicationProtocolRequest;
 
+// Only one V2G message is decoded and answered at a time, so the request and its
+// response share a single statically allocated document. The iso2 document alone
+// is ~24 KB, far too much for the Timer20ms stack.
+static union {
+    struct appHand_exiDocument appHand;
+    struct din_exiDocument din;
+    struct iso2_exiDocument iso2;
+    struct iso20_ac_exiDocument iso20ac;
+} exiDocArena;
+
+// The ISO 15118-20 CommonMessages document is ~300 KB because of the schedule and price tables
+// it can hold, so it is allocated in PSRAM the first time an EV offers -20, and kept.
+static struct iso20_exiDocument *iso20Doc = NULL;
+static uint8_t iso20SessionId[8];
+static uint16_t iso20Target = 0;            // last Balanced[0] sent as EVSETargetActivePower
+static unsigned long iso20LoopTime = 0;     // millis() of the previous AC_ChargeLoopReq or PowerDeliveryReq
+
 extern char EVCCID[32];
 extern int8_t InitialSoC, ComputedSoC, FullSoC;
 extern void setState(uint8_t NewState);
@@ -84,12 +136,18 @@ extern int32_t EnergyCapacity, EnergyRequest;
 extern uint16_t MaxCurrent;
 extern Charging_Protocol_t Charging_Protocol;
 extern bool CPDutyOverride;
+extern unsigned long SlacParamTime;
 
-void tcp_prepareTcpHeader(uint8_t tcpFlag, uint16_t tcpPayloadLen) {
+static void tcp_setState(uint8_t state) {
+    if (state != tcpState) modemTimeline(TL_TCP, state, tcpState, 0);
+    tcpState = state;
+}
+
+static void tcp_sendSegment(uint32_t seqNr, uint8_t tcpFlag, uint16_t tcpPayloadLen) {
     uint16_t checksum;
+    uint16_t window = TCP_RX_DATA_LEN - tcp_rxdataLen;
     uint16_t TcpTransmitPacketLen = TCP_HEADER_LEN + tcpPayloadLen;
-    uint8_t *TcpIpRequest = txbuffer + ETHERNET_HEADER_LEN;
-    uint8_t *TcpTransmitPacket = TcpIpRequest + IP6_HEADER_LEN;
+    uint8_t *TcpTransmitPacket = txbuffer + ETHERNET_HEADER_LEN + IP6_HEADER_LEN;
     //uint8_t *tcpPayload = txbuffer + ETHERNET_HEADER_LEN + IP6_HEADER_LEN + TCP_HEADER_LEN;
 
     // # TCP header needs at least 24 bytes:
@@ -106,10 +164,10 @@ void tcp_prepareTcpHeader(uint8_t tcpFlag, uint16_t tcpPayloadLen) {
     TcpTransmitPacket[2] = (uint8_t)(evccTcpPort >> 8); /* destination port */
     TcpTransmitPacket[3] = (uint8_t)(evccTcpPort);
 
-    TcpTransmitPacket[4] = (uint8_t)(TcpSeqNr>>24); /* sequence number */
-    TcpTransmitPacket[5] = (uint8_t)(TcpSeqNr>>16);
-    TcpTransmitPacket[6] = (uint8_t)(TcpSeqNr>>8);
-    TcpTransmitPacket[7] = (uint8_t)(TcpSeqNr);
+    TcpTransmitPacket[4] = (uint8_t)(seqNr>>24); /* sequence number */
+    TcpTransmitPacket[5] = (uint8_t)(seqNr>>16);
+    TcpTransmitPacket[6] = (uint8_t)(seqNr>>8);
+    TcpTransmitPacket[7] = (uint8_t)(seqNr);
 
     TcpTransmitPacket[8] = (uint8_t)(TcpAckNr>>24); /* ack number */
     TcpTransmitPacket[9] = (uint8_t)(TcpAckNr>>16);
@@ -118,8 +176,8 @@ void tcp_prepareTcpHeader(uint8_t tcpFlag, uint16_t tcpPayloadLen) {
     TcpTransmitPacket[12] = (TCP_HEADER_LEN/4) << 4; /* 70 High-nibble: DataOffset in 4-byte-steps. Low-nibble: Reserved=0. */
 
     TcpTransmitPacket[13] = tcpFlag;
-    TcpTransmitPacket[14] = (uint8_t)(TCP_RECEIVE_WINDOW>>8);
-    TcpTransmitPacket[15] = (uint8_t)(TCP_RECEIVE_WINDOW);
+    TcpTransmitPacket[14] = (uint8_t)(window>>8); /* free space in tcp_rxdata */
+    TcpTransmitPacket[15] = (uint8_t)(window);
 
     // checksum will be calculated afterwards
     TcpTransmitPacket[16] = 0;
@@ -132,36 +190,11 @@ void tcp_prepareTcpHeader(uint8_t tcpFlag, uint16_t tcpPayloadLen) {
     TcpTransmitPacket[16] = (uint8_t)(checksum >> 8);
     TcpTransmitPacket[17] = (uint8_t)(checksum);
 
-    //_LOG_D("Source:%u Dest:%u Seqnr:%08x Acknr:%08x\n", seccPort, evccTcpPort, TcpSeqNr, TcpAckNr);
-
-    //tcp_packRequestIntoIp():
-    // # embeds the TCP into the lower-layer-protocol: IP, Ethernet
-    uint16_t TcpIpRequestLen = TcpTransmitPacketLen + IP6_HEADER_LEN;
-
-    //# fill the destination MAC with the MAC of the charger
-    setMacAt(pevMac, 0);
-    setMacAt(myMac, 6); // bytes 6 to 11 are the source MAC
-    txbuffer[12] = 0x86; // # 86dd is IPv6
-    txbuffer[13] = 0xdd;
-
-    TcpIpRequest[0] = 0x60; // traffic class, flow
-    TcpIpRequest[1] = 0x00;
-    TcpIpRequest[2] = 0x00;
-    TcpIpRequest[3] = 0x00;
-    TcpIpRequest[4] = TcpTransmitPacketLen >> 8; // length of the payload. Without headers.
-    TcpIpRequest[5] = TcpTransmitPacketLen & 0xFF;
-    TcpIpRequest[6] = NEXT_TCP; // next level protocol, 0x06 = TCP in this case
-    TcpIpRequest[7] = 0x40; // hop limit
-    //
-    // We are the EVSE. So the PevIp is our own link-local IP address.
-    memcpy(TcpIpRequest+8, SeccIp, 16);         // source IP address
-    memcpy(TcpIpRequest+24, EvccIp, 16);        // destination IP address
-
-    //# packs the IP packet into an ethernet packet
-    uint16_t length = TcpIpRequestLen + ETHERNET_HEADER_LEN;
-                                                    // #  6 bytes destination MAC
-                                                    // #  6 bytes source MAC
-                                                    // #  2 bytes EtherType
+    //_LOG_D("Source:%u Dest:%u Seqnr:%08x Acknr:%08x\n", seccPort, evccTcpPort, seqNr, TcpAckNr);
+
+    //# embeds the TCP into the lower-layer-protocol: IP, Ethernet. The headers are written in front of
+    //# the TCP frame in txbuffer, nothing is copied.
+    uint16_t length = packIntoIpv6(pevMac, EvccIp, NEXT_TCP, 0x40, TcpTransmitPacketLen);
 
     _LOG_D("[TX:%u]", length);
     for(int x=0; x<length; x++) _LOG_D_NO_FUNC("%02x",txbuffer[x]);
@@ -171,7 +204,137 @@ void tcp_prepareTcpHeader(uint8_t tcpFlag, uint16_t tcpPayloadLen) {
 }
 
 
-void addV2GTPHeaderAndTransmit(uint16_t exiBufferLen) {
+// Sends everything from TcpUnackedSeqNr up to TcpSeqNr again, as a single segment.
+static void tcp_retransmit(void) {
+    uint8_t flags = TCP_FLAG_ACK;
+
+    if (tcp_txFlags & TCP_FLAG_SYN) flags |= TCP_FLAG_SYN;
+    if (tcp_txdataLen) {
+        flags |= TCP_FLAG_PSH;
+        memcpy(txbuffer + ETHERNET_HEADER_LEN + IP6_HEADER_LEN + TCP_HEADER_LEN, tcp_txdata, tcp_txdataLen);
+    }
+    if (tcp_txFlags & TCP_FLAG_FIN) flags |= TCP_FLAG_FIN;
+
+    tcpStats.Retransmits++;
+    tcpRttTiming = false;                       // no RTT samples from retransmitted data
+    tcpRetransmitTimer = millis();
+    tcp_sendSegment(TcpUnackedSeqNr, flags, tcp_txdataLen);
+}
+
+
+// Sends a segment with the TCP payload that is already in txbuffer, and keeps a copy of it
+// for retransmission when it consumes sequence space.
+void tcp_prepareTcpHeader(uint8_t tcpFlag, uint16_t tcpPayloadLen) {
+    uint16_t seqLen = tcpPayloadLen + ((tcpFlag & TCP_FLAG_SYN) ? 1 : 0) + ((tcpFlag & TCP_FLAG_FIN) ? 1 : 0);
+
+    if (seqLen) {
+        if (TcpUnackedSeqNr == TcpSeqNr) tcpRetransmitTimer = millis();
+        if (!tcpRttTiming) {
+            tcpRttTiming = true;
+            tcpRttSeqNr = TcpSeqNr;
+            tcpRttStart = millis();
+        }
+        if (tcpPayloadLen <= TCP_TX_DATA_LEN - tcp_txdataLen) {
+            memcpy(tcp_txdata + tcp_txdataLen, txbuffer + ETHERNET_HEADER_LEN + IP6_HEADER_LEN + TCP_HEADER_LEN, tcpPayloadLen);
+            tcp_txdataLen += tcpPayloadLen;
+            tcp_txFlags |= tcpFlag & (TCP_FLAG_SYN | TCP_FLAG_FIN);
+        } else {
+            _LOG_W("[TCP] %u bytes do not fit the retransmit buffer, sending without retransmission.\n", tcpPayloadLen);
+            if (TcpUnackedSeqNr == TcpSeqNr) TcpUnackedSeqNr += seqLen;
+        }
+    }
+    tcp_sendSegment(TcpSeqNr, tcpFlag, tcpPayloadLen);
+    TcpSeqNr += seqLen;
+}
+
+
+static void tcp_close(void) {
+    if (tcpState != TCP_STATE_CLOSED) {
+        _LOG_I("[TCP] connection closed. segments:%u dup:%u ooo:%u overflow:%u dupacks:%u retransmits:%u fast:%u timeouts:%u srtt:%ums\n",
+               tcpStats.Segments, tcpStats.DupSegments, tcpStats.OutOfOrder, tcpStats.Overflows,
+               tcpStats.DupAcks, tcpStats.Retransmits, tcpStats.FastRetransmits, tcpStats.Timeouts, tcpSrtt);
+    }
+    tcp_setState(TCP_STATE_CLOSED);
+    fsmState = stateWaitForSupportedApplicationProtocolRequest;
+    tcp_rxdataLen = 0;
+    tcp_rxdiscard = 0;
+    tcp_txdataLen = 0;
+    tcp_txFlags = 0;
+    TcpUnackedSeqNr = TcpSeqNr;
+    tcpRttTiming = false;
+}
+
+
+// Called every 20ms from the modem task, retransmits unacknowledged data when the RTO expires.
+void tcp_timer(void) {
+    if (tcpState == TCP_STATE_CLOSED || TcpUnackedSeqNr == TcpSeqNr) return;
+    if (millis() - tcpRetransmitTimer < tcpRto) return;
+
+    if (++tcpRetries > TCP_MAX_RETRIES) {
+        _LOG_W("[TCP] no ACK after %u retransmissions, resetting connection.\n", TCP_MAX_RETRIES);
+        tcp_sendSegment(TcpSeqNr, TCP_FLAG_RST | TCP_FLAG_ACK, 0);
+        tcp_close();
+        return;
+    }
+    tcpStats.Timeouts++;
+    tcpRto = min(tcpRto * 2, TCP_RTO_MAX);      // exponential backoff
+    _LOG_I("[TCP] timeout, retransmitting %u bytes, rto=%ums.\n", tcp_txdataLen, tcpRto);
+    tcp_retransmit();
+}
+
+
+// RFC 6298 round trip time estimation, in ms.
+static void tcp_updateRto(uint32_t rtt) {
+    if (rtt > TCP_RTO_MAX) rtt = TCP_RTO_MAX;
+    if (tcpSrtt == 0) {
+        tcpSrtt = rtt ? rtt : 1;
+        tcpRttVar = rtt / 2;
+    } else {
+        uint16_t delta = (tcpSrtt > rtt) ? tcpSrtt - rtt : rtt - tcpSrtt;
+        tcpRttVar = (3 * tcpRttVar + delta) / 4;
+        tcpSrtt = (7 * tcpSrtt + rtt) / 8;
+    }
+    tcpRto = constrain(tcpSrtt + max(20, 4 * tcpRttVar), TCP_RTO_MIN, TCP_RTO_MAX);
+}
+
+
+// Processes the acknowledgement number of a received segment.
+static void tcp_processAck(uint32_t remoteAckNr, uint16_t payloadLen, uint8_t flags) {
+    int32_t acked = remoteAckNr - TcpUnackedSeqNr;
+    int32_t inFlight = TcpSeqNr - TcpUnackedSeqNr;
+
+    if (acked > 0 && acked <= inFlight) {
+        if (tcpRttTiming && (int32_t)(remoteAckNr - tcpRttSeqNr) > 0) {
+            tcp_updateRto(millis() - tcpRttStart);
+            tcpRttTiming = false;
+        }
+        if (tcp_txFlags & TCP_FLAG_SYN) {
+            tcp_txFlags &= ~TCP_FLAG_SYN;
+            acked--;
+        }
+        uint16_t dataAcked = min((uint32_t)acked, (uint32_t)tcp_txdataLen);
+        memmove(tcp_txdata, tcp_txdata + dataAcked, tcp_txdataLen - dataAcked);
+        tcp_txdataLen -= dataAcked;
+        acked -= dataAcked;
+        if (acked && (tcp_txFlags & TCP_FLAG_FIN)) tcp_txFlags &= ~TCP_FLAG_FIN;
+
+        TcpUnackedSeqNr = remoteAckNr;
+        tcpRetransmitTimer = millis();
+        tcpRetries = 0;
+        tcpDupAcks = 0;
+    } else if (acked == 0 && inFlight > 0 && payloadLen == 0 && !(flags & (TCP_FLAG_SYN | TCP_FLAG_FIN))) {
+        // the EV acknowledges the same data again; it probably misses our next segment
+        tcpStats.DupAcks++;
+        if (++tcpDupAcks == TCP_DUPACK_THRESHOLD) {
+            _LOG_I("[TCP] %u duplicate ACKs, fast retransmit.\n", TCP_DUPACK_THRESHOLD);
+            tcpStats.FastRetransmits++;
+            tcp_retransmit();
+        }
+    }
+}
+
+
+void addV2GTPHeaderAndTransmit(uint16_t exiBufferLen, uint16_t payloadType = V2GTP_PAYLOAD_EXI) {
     // takes the bytearray with exidata, and adds a header to it, according to the Vehicle-to-Grid-Transport-Protocol
     // V2GTP header has 8 bytes
     // 1 byte protocol version
@@ -182,8 +345,8 @@ void addV2GTPHeaderAndTransmit(uint16_t exiBufferLen) {
 
     tcpPayload[0] = 0x01; // version
     tcpPayload[1] = 0xfe; // version inverted
-    tcpPayload[2] = 0x80; // payload type. 0x8001 means "EXI data"
-    tcpPayload[3] = 0x01; //
+    tcpPayload[2] = (uint8_t)(payloadType >> 8); // payload type. 0x8001 means "EXI data"
+    tcpPayload[3] = (uint8_t)payloadType;
     tcpPayload[4] = (uint8_t)(exiBufferLen >> 24); // length 4 byte.
     tcpPayload[5] = (uint8_t)(exiBufferLen >> 16);
     tcpPayload[6] = (uint8_t)(exiBufferLen >> 8);
@@ -204,7 +367,9 @@ void EncodeAndTransmit(struct appHand_exiDocument* exiDoc) {
     int16_t g_errn;
     exi_bitstream_t tx_stream; //TODO perhaps reuse stream?
     exi_bitstream_init(&tx_stream, txbuffer + EXI_OFFSET, sizeof(txbuffer) - EXI_OFFSET, 0, NULL);
+    uint32_t start = micros();
     g_errn = encode_appHand_exiDocument(&tx_stream, exiDoc);
+    modemTimeline(TL_V2G_RES, Charging_Protocol, fsmState, g_errn ? 0 : tx_stream.byte_pos + 1, micros() - start);
     // Send supportedAppProtocolRes to EV
     if (!g_errn)
         //data_size=256, bit_count=4, byte_pos=3, flag_byte=0 for appHand
@@ -216,7 +381,9 @@ void EncodeAndTransmit(struct din_exiDocument* dinDoc) {
     int16_t g_errn;
     exi_bitstream_t tx_stream; //TODO perhaps reuse stream?
     exi_bitstream_init(&tx_stream, txbuffer + EXI_OFFSET, sizeof(txbuffer) - EXI_OFFSET, 0, NULL);
+    uint32_t start = micros();
     g_errn = encode_din_exiDocument(&tx_stream, dinDoc);
+    modemTimeline(TL_V2G_RES, Charging_Protocol, fsmState, g_errn ? 0 : tx_stream.byte_pos + 1, micros() - start);
     // Send supportedAppProtocolRes to EV
     if (!g_errn)
         //data_size=256, bit_count=4, byte_pos=3, flag_byte=0 for appHand
@@ -228,7 +395,9 @@ void EncodeAndTransmit(struct iso2_exiDocument* dinDoc) {
     int16_t g_errn;
     exi_bitstream_t tx_stream; //TODO perhaps reuse stream?
     exi_bitstream_init(&tx_stream, txbuffer + EXI_OFFSET, sizeof(txbuffer) - EXI_OFFSET, 0, NULL);
+    uint32_t start = micros();
     g_errn = encode_iso2_exiDocument(&tx_stream, dinDoc);
+    modemTimeline(TL_V2G_RES, Charging_Protocol, fsmState, g_errn ? 0 : tx_stream.byte_pos + 1, micros() - start);
     // Send supportedAppProtocolRes to EV
     if (!g_errn) {
         _LOG_A("DINGO: transmitting iso2 exiDocument.\n");
@@ -239,21 +408,91 @@ void EncodeAndTransmit(struct iso2_exiDocument* dinDoc) {
 }
 
 
-void decodeV2GTP(void) {
+void EncodeAndTransmit(struct iso20_exiDocument* exiDoc) {
+    int16_t g_errn;
+    exi_bitstream_t tx_stream;
+    exi_bitstream_init(&tx_stream, txbuffer + EXI_OFFSET, sizeof(txbuffer) - EXI_OFFSET, 0, NULL);
+    uint32_t start = micros();
+    g_errn = encode_iso20_exiDocument(&tx_stream, exiDoc);
+    modemTimeline(TL_V2G_RES, Charging_Protocol, fsmState, g_errn ? 0 : tx_stream.byte_pos + 1, micros() - start);
+    if (!g_errn)
+        addV2GTPHeaderAndTransmit(tx_stream.byte_pos + 1, V2GTP_PAYLOAD_ISO20_COMMON);
+    else
+        _LOG_A("ERROR no %d: Could not encode iso20 document, not transmitting response!\n", g_errn);
+}
+
+
+void EncodeAndTransmit(struct iso20_ac_exiDocument* exiDoc) {
+    int16_t g_errn;
+    exi_bitstream_t tx_stream;
+    exi_bitstream_init(&tx_stream, txbuffer + EXI_OFFSET, sizeof(txbuffer) - EXI_OFFSET, 0, NULL);
+    uint32_t start = micros();
+    g_errn = encode_iso20_ac_exiDocument(&tx_stream, exiDoc);
+    modemTimeline(TL_V2G_RES, Charging_Protocol, fsmState, g_errn ? 0 : tx_stream.byte_pos + 1, micros() - start);
+    if (!g_errn)
+        addV2GTPHeaderAndTransmit(tx_stream.byte_pos + 1, V2GTP_PAYLOAD_ISO20_AC);
+    else
+        _LOG_A("ERROR no %d: Could not encode iso20 AC document, not transmitting response!\n", g_errn);
+}
+
+
+// -20 has no unit field, power is Value * 10^Exponent Watt with a 16 bit Value
+static void iso20_setPower(struct iso20_ac_RationalNumberType *power, uint32_t watts) {
+    power->Exponent = 0;
+    while (watts > INT16_MAX) {
+        watts /= 10;
+        power->Exponent++;
+    }
+    power->Value = watts;
+}
+
+
+// current in 0.1A, at the nominal 230V on every phase we charge with
+static uint32_t iso20_power(uint16_t current) {
+    return (uint32_t)current * 23 * Nr_Of_Phases_Charging;
+}
+
+
+static void iso20_addParameter(struct iso20_ParameterSetType *set, const char *name, int32_t value) {
+    struct iso20_ParameterType *param = &set->Parameter.array[set->Parameter.arrayLen++];
+    init_iso20_ParameterType(param);
+    param->Name.charactersLen = strlen(name);
+    memcpy(param->Name.characters, name, param->Name.charactersLen);
+    param->intValue_isUsed = 1;
+    param->intValue = value;
+}
+
+
+void decodeV2GTP(uint16_t exiLen) {
     exi_bitstream_t stream;
-    exi_bitstream_init(&stream, &tcp_rxdata[V2GTP_HEADER_LEN], tcp_rxdataLen - V2GTP_HEADER_LEN, 0, NULL);
+    exi_bitstream_init(&stream, &tcp_rxdata[V2GTP_HEADER_LEN], exiLen, 0, NULL);
     uint8_t g_errn;
-    tcp_rxdataLen = 0; /* mark the input data as "consumed" */
+    uint32_t start = micros();
 
     if (fsmState == stateWaitForSupportedApplicationProtocolRequest) {
-        struct appHand_exiDocument exiDoc;
+        struct appHand_exiDocument &exiDoc = exiDocArena.appHand;
         g_errn = decode_appHand_exiDocument(&stream, &exiDoc);
+        modemTimeline(TL_V2G_REQ, Charging_Protocol, fsmState, exiLen, micros() - start);
 
         // Check if we have received the correct message
         if (g_errn == 0 && exiDoc.supportedAppProtocolReq_isUsed) {
 
             _LOG_I("SupportedApplicationProtocolRequest\n");
             _LOG_I("The car supports %u schemas.\n", exiDoc.supportedAppProtocolReq.AppProtocol.arrayLen);
+
+#define ISO_15118_2013_MSG_DEF "urn:iso:15118:2:2013:MsgDef"
+#define ISO_15118_2013_MAJOR   2
+#define ISO_15118_2010_MSG_DEF "urn:iso:15118:2:2010:MsgDef"
+#define ISO_15118_2010_MAJOR   1
+#define DIN_70121_MSG_DEF "urn:din:70121:2012:MsgDef"
+#define DIN_70121_MAJOR   2
+#define ISO_15118_20_AC_MSG_DEF "urn:iso:std:iso:15118:-20:AC"
+#define ISO_15118_20_MAJOR   1
+
+            // Of the protocols we support, select the one the car prefers: Priority 1 is the highest.
+            // The list is not sorted, so it is scanned completely first.
+            struct appHand_AppProtocolType* selected = NULL;
+            Charging_Protocol_t protocol = IEC;
             for (uint16_t i=0; i< exiDoc.supportedAppProtocolReq.AppProtocol.arrayLen; i++) {
                 struct appHand_AppProtocolType* app_proto = &exiDoc.supportedAppProtocolReq.AppProtocol.array[i];
                 char* proto_ns = strndup(static_cast<const char*>(app_proto->ProtocolNamespace.characters),
@@ -264,45 +503,44 @@ void decodeV2GTP(void) {
                 }
                 _LOG_A("The car supports: %s, Version: %" PRIu32 ".%" PRIu32 ", SchemaID: %" PRIu8 ", Priority: %" PRIu8 ".\n", proto_ns, app_proto->VersionNumberMajor, app_proto->VersionNumberMinor, app_proto->SchemaID, app_proto->Priority);
 
-#define ISO_15118_2013_MSG_DEF "urn:iso:15118:2:2013:MsgDef"
-#define ISO_15118_2013_MAJOR   2
-#define ISO_15118_2010_MSG_DEF "urn:iso:15118:2:2010:MsgDef"
-#define ISO_15118_2010_MAJOR   1
-#define DIN_70121_MSG_DEF "urn:din:70121:2012:MsgDef"
-#define DIN_70121_MAJOR   2
-
+                Charging_Protocol_t candidate = IEC;
                 if (!strcmp(proto_ns, ISO_15118_2013_MSG_DEF)  && app_proto->VersionNumberMajor == ISO_15118_2013_MAJOR) {
-                    if (Charging_Protocol == IEC || Charging_Protocol == DIN) { // FIXME allow promoting from DIN to ISO2 FOR TESTBENCH PURPOSES ONLY!!
-                    //if (Charging_Protocol == IEC) {
-                        _LOG_I("Selecting ISO15118:2.0\n"); //TODO also implement ISO_15118_2010
-                                                            //TODO also take into account the EV priority
-                                                            //for now we determine the priority
-                        init_appHand_exiDocument(&exiDoc);
-                        exiDoc.supportedAppProtocolRes_isUsed = 1;
-                        //exiDoc.supportedAppProtocolRes.ResponseCode = appHand_responseCodeType_Failed_NoNegotiation; // [V2G2-172]
-                        exiDoc.supportedAppProtocolRes.ResponseCode = appHand_responseCodeType_OK_SuccessfulNegotiation;
-                        exiDoc.supportedAppProtocolRes.SchemaID_isUsed = (unsigned int)1;
-                        exiDoc.supportedAppProtocolRes.SchemaID = app_proto->SchemaID;
-                        EncodeAndTransmit(&exiDoc);
-                        Charging_Protocol = ISO2;
-                        fsmState = stateWaitForSessionSetupRequest;
-                    }
+                    if (Charging_Protocol == IEC || Charging_Protocol == DIN) // FIXME allow promoting from DIN to ISO2 FOR TESTBENCH PURPOSES ONLY!!
+                    //if (Charging_Protocol == IEC)
+                        candidate = ISO2;                                       //TODO also implement ISO_15118_2010
+                } else if (!strcmp(proto_ns, ISO_15118_20_AC_MSG_DEF) && app_proto->VersionNumberMajor == ISO_15118_20_MAJOR) {
+                    if (Charging_Protocol == IEC)
+                        candidate = ISO20;
                 } else if (!strcmp(proto_ns, DIN_70121_MSG_DEF) && app_proto->VersionNumberMajor == DIN_70121_MAJOR) {
-                    if (Charging_Protocol == IEC) {
-                        _LOG_A("Selecting DIN70121.\n");
-                        init_appHand_exiDocument(&exiDoc);
-                        exiDoc.supportedAppProtocolRes_isUsed = 1;
-                        //exiDoc.supportedAppProtocolRes.ResponseCode = appHand_responseCodeType_Failed_NoNegotiation; // [V2G2-172]
-                        exiDoc.supportedAppProtocolRes.ResponseCode = appHand_responseCodeType_OK_SuccessfulNegotiation;
-                        exiDoc.supportedAppProtocolRes.SchemaID_isUsed = (unsigned int)1;
-                        exiDoc.supportedAppProtocolRes.SchemaID = app_proto->SchemaID;
-                        EncodeAndTransmit(&exiDoc);
-                        Charging_Protocol = DIN;
-                        fsmState = stateWaitForSessionSetupRequest;
+                    if (Charging_Protocol == IEC)
+                        candidate = DIN;
+                }
+                free(proto_ns);
+                if (candidate == IEC || (selected && app_proto->Priority >= selected->Priority)) continue;
+
+                if (candidate == ISO20) {
+                    if (!iso20Doc) iso20Doc = (struct iso20_exiDocument *)heap_caps_malloc(sizeof(struct iso20_exiDocument), MALLOC_CAP_SPIRAM);
+                    if (!iso20Doc) {
+                        _LOG_A("Not enough PSRAM for ISO15118-20.\n");
+                        continue;
                     }
                 }
+                selected = app_proto;
+                protocol = candidate;
             } //for
-            if (Charging_Protocol == IEC) { //we failed negotiating a protocol, signal that back to the EV
+
+            if (selected) {
+                _LOG_A("Selecting %s.\n", protocol == ISO2 ? "ISO15118:2.0" : protocol == ISO20 ? "ISO15118-20 AC" : "DIN70121");
+                uint8_t SchemaID = selected->SchemaID;
+                init_appHand_exiDocument(&exiDoc);
+                exiDoc.supportedAppProtocolRes_isUsed = 1;
+                exiDoc.supportedAppProtocolRes.ResponseCode = appHand_responseCodeType_OK_SuccessfulNegotiation;
+                exiDoc.supportedAppProtocolRes.SchemaID_isUsed = (unsigned int)1;
+                exiDoc.supportedAppProtocolRes.SchemaID = SchemaID;
+                EncodeAndTransmit(&exiDoc);
+                Charging_Protocol = protocol;
+                fsmState = stateWaitForSessionSetupRequest;
+            } else if (Charging_Protocol == IEC) { //we failed negotiating a protocol, signal that back to the EV
                 _LOG_A("No V2G protocol selected.\n");
                 init_appHand_exiDocument(&exiDoc);
                 exiDoc.supportedAppProtocolRes_isUsed = 1;
@@ -314,9 +552,10 @@ void decodeV2GTP(void) {
         return;
     }
     if (Charging_Protocol == DIN) {
-        struct din_exiDocument dinDoc;
+        struct din_exiDocument &dinDoc = exiDocArena.din;
         memset(&dinDoc, 0, sizeof(struct din_exiDocument));
         decode_din_exiDocument(&stream, &dinDoc);
+        modemTimeline(TL_V2G_REQ, Charging_Protocol, fsmState, exiLen, micros() - start);
         if (fsmState == stateWaitForSessionSetupRequest) {
             // Check if we have received the correct message
             if (dinDoc.V2G_Message.Body.SessionSetupReq_isUsed) {
@@ -465,7 +704,7 @@ void decodeV2GTP(void) {
         if (fsmState == stateWaitForChargeParameterDiscoveryRequest) {
             // Check if we have received the correct message
             if (dinDoc.V2G_Message.Body.ChargeParameterDiscoveryReq_isUsed) {
-                _LOG_I("ChargeParameterDiscoveryRequest\n");
+                _LOG_I("ChargeParameterDiscoveryRequest, %lu ms after CM_SLAC_PARAM.REQ\n", millis() - SlacParamTime);
 
                 // Read the SOC from the EVRESSOC data
                 ComputedSoC = dinDoc.V2G_Message.Body.ChargeParameterDiscoveryReq.DC_EVChargeParameter.DC_EVStatus.EVRESSSOC;
@@ -531,7 +770,7 @@ void decodeV2GTP(void) {
                     if (State == STATE_MODEM_REQUEST || State == STATE_MODEM_WAIT || State == STATE_MODEM_DONE){
                         _LOG_A("Received SoC via Modem. Shortcut to State Modem Done\n");
                         setState(STATE_MODEM_DONE); // Go to State B, which means in this case setting PWM
-                        tcpState = TCP_STATE_CLOSED; //if we dont close the TCP connection the  next replug wont work TODO is this the right place, the right way?
+                        tcp_close(); //if we dont close the TCP connection the  next replug wont work TODO is this the right place, the right way?
                     }
                     if (InitialSoC < 0) //not initialized yet
                         InitialSoC = ComputedSoC;
@@ -567,9 +806,10 @@ void decodeV2GTP(void) {
         return;
     } //DIN
     if (Charging_Protocol == ISO2) {
-        struct iso2_exiDocument exiDoc;
+        struct iso2_exiDocument &exiDoc = exiDocArena.iso2;
         memset(&exiDoc, 0, sizeof(struct iso2_exiDocument));
         decode_iso2_exiDocument(&stream, &exiDoc);
+        modemTimeline(TL_V2G_REQ, Charging_Protocol, fsmState, exiLen, micros() - start);
 
         //if (fsmState == stateWaitForSessionSetupRequest) {
             // Check if we have received the correct message
@@ -717,7 +957,7 @@ void decodeV2GTP(void) {
         //if (fsmState == stateWaitForChargeParameterDiscoveryRequest) {
             // Check if we have received the correct message
             if (exiDoc.V2G_Message.Body.ChargeParameterDiscoveryReq_isUsed) {
-                _LOG_I("ChargeParameterDiscoveryRequest\n");
+                _LOG_I("ChargeParameterDiscoveryRequest, %lu ms after CM_SLAC_PARAM.REQ\n", millis() - SlacParamTime);
 
                 // Read the SOC from the EVRESSOC data
                 ComputedSoC = exiDoc.V2G_Message.Body.ChargeParameterDiscoveryReq.DC_EVChargeParameter.DC_EVStatus.EVRESSSOC;
@@ -944,7 +1184,9 @@ void decodeV2GTP(void) {
 //example PowerDeliveryRequest:
 //{"V2G_Message": {"Header": {"SessionID": "E73110994DA0BF54"}, "Body": {"PowerDeliveryReq": {"ChargeProgress": "Start", "SAScheduleTupleID": 1, "ChargingProfile": {"ProfileEntry": [{"ChargingProfileEntryStart": 0, "ChargingProfileEntryMaxPower": {"Value": 11000, "Multiplier": 0, "Unit": "W"}}, {"ChargingProfileEntryStart": 86400, "ChargingProfileEntryMaxPower": {"Value": 0, "Multiplier": 0, "Unit": "W"}}]}}}}}
                 const char ChargeProgressStr[][12] = {"Start" , "Stop" , "Renegotiate"};
-                _LOG_I("PowerDeliveryRequest, ChargeProgress: %s.\n", ChargeProgressStr[exiDoc.V2G_Message.Body.PowerDeliveryReq.ChargeProgress]);
+                // the request and the response share a union, read it before the response is set up
+                iso2_chargeProgressType ChargeProgress = exiDoc.V2G_Message.Body.PowerDeliveryReq.ChargeProgress;
+                _LOG_I("PowerDeliveryRequest, ChargeProgress: %s.\n", ChargeProgressStr[ChargeProgress]);
 
 //example PowerDeliveryResponse:
 // {"V2G_Message": {"Header": {"SessionID": "E73110994DA0BF54"}, "Body": {"PowerDeliveryRes": {"ResponseCode": "OK", "AC_EVSEStatus": {"NotificationMaxDelay": 0, "EVSENotification": "None", "RCD": false}}}}}
@@ -971,7 +1213,7 @@ void decodeV2GTP(void) {
                 exiDoc.V2G_Message.Body.PowerDeliveryRes.EVSEStatus.AC_EVSEStatus.RCD = (ErrorFlags & RCM_TRIPPED); //FIXME RCM_TEST
 */
 
-                switch (exiDoc.V2G_Message.Body.PowerDeliveryReq.ChargeProgress) {
+                switch (ChargeProgress) {
                     case iso2_chargeProgressType_Start:
                         fsmState = stateChargeLoop;
                         //we have to close contactors now
@@ -1051,24 +1293,285 @@ void decodeV2GTP(void) {
             EncodeAndTransmit(&exiDoc);
             //now the V2G communication layer needs to be terminated:
             tcp_prepareTcpHeader(TCP_FLAG_FIN | TCP_FLAG_ACK, 0);
-            tcpState = TCP_STATE_FIN_WAIT_1;
+            tcp_setState(TCP_STATE_FIN_WAIT_1);
             //FIXME quick and dirty termination without all that FIN/ACK stuff; better implement the lwIP stack instead of rebuilding it ourselves
             //fsmState = stateWaitForSessionSetupRequest;
             fsmState = stateWaitForSupportedApplicationProtocolRequest;
             return;
         } //SessionStopReq_isUsed
     } //ISO2
+    if (Charging_Protocol == ISO20) {
+#define ISO20_HEADER(H) \
+    H.Signature_isUsed = 0; \
+    H.SessionID.bytesLen = sizeof(iso20SessionId); \
+    memcpy(H.SessionID.bytes, iso20SessionId, sizeof(iso20SessionId)); \
+    H.TimeStamp = time(NULL);
+#define INIT_ISO20_RESPONSE(X) \
+    init_iso20_exiDocument(&exiDoc); \
+    init_iso20_##X##ResType(&exiDoc.X##Res); \
+    exiDoc.X##Res_isUsed = 1; \
+    exiDoc.X##Res.ResponseCode = iso20_responseCodeType_OK; \
+    ISO20_HEADER(exiDoc.X##Res.Header)
+#define INIT_ISO20_AC_RESPONSE(X) \
+    init_iso20_ac_exiDocument(&acDoc); \
+    init_iso20_ac_##X##ResType(&acDoc.X##Res); \
+    acDoc.X##Res_isUsed = 1; \
+    acDoc.X##Res.ResponseCode = iso20_ac_responseCodeType_OK; \
+    ISO20_HEADER(acDoc.X##Res.Header)
+
+        uint16_t payloadType = (tcp_rxdata[2] << 8) | tcp_rxdata[3];
+        if (payloadType == V2GTP_PAYLOAD_ISO20_AC) {
+            struct iso20_ac_exiDocument &acDoc = exiDocArena.iso20ac;
+            memset(&acDoc, 0, sizeof(struct iso20_ac_exiDocument));
+            decode_iso20_ac_exiDocument(&stream, &acDoc);
+            modemTimeline(TL_V2G_REQ, Charging_Protocol, fsmState, exiLen, micros() - start);
+
+            if (acDoc.AC_ChargeParameterDiscoveryReq_isUsed) {
+                _LOG_I("AC_ChargeParameterDiscoveryRequest, %lu ms after CM_SLAC_PARAM.REQ\n", millis() - SlacParamTime);
+                if (acDoc.AC_ChargeParameterDiscoveryReq.AC_CPDReqEnergyTransferMode_isUsed) {
+                    struct iso20_ac_AC_CPDReqEnergyTransferModeType &Req = acDoc.AC_ChargeParameterDiscoveryReq.AC_CPDReqEnergyTransferMode;
+                    _LOG_A("Modem: EVMaximumChargePower=%.0f W.\n", Req.EVMaximumChargePower.Value * pow(10, Req.EVMaximumChargePower.Exponent));
+                    _LOG_A("Modem: EVMinimumChargePower=%.0f W.\n", Req.EVMinimumChargePower.Value * pow(10, Req.EVMinimumChargePower.Exponent));
+                }
+
+                INIT_ISO20_AC_RESPONSE(AC_ChargeParameterDiscovery)
+                struct iso20_ac_AC_CPDResEnergyTransferModeType &Res = acDoc.AC_ChargeParameterDiscoveryRes.AC_CPDResEnergyTransferMode;
+                acDoc.AC_ChargeParameterDiscoveryRes.AC_CPDResEnergyTransferMode_isUsed = 1;
+                acDoc.AC_ChargeParameterDiscoveryRes.BPT_AC_CPDResEnergyTransferMode_isUsed = 0;
+                init_iso20_ac_AC_CPDResEnergyTransferModeType(&Res);
+                iso20_setPower(&Res.EVSEMaximumChargePower, iso20_power(MaxCurrent * 10));
+                iso20_setPower(&Res.EVSEMinimumChargePower, iso20_power(MinCurrent * 10));
+                iso20_setPower(&Res.EVSENominalFrequency, 50);
+                EncodeAndTransmit(&acDoc);
+                fsmState = stateWaitForScheduleExchangeRequest;
+                return;
+            }
+
+            // In dynamic mode the EV follows EVSETargetActivePower, so every loop carries the
+            // current that the load balancing assigned to us, typically a few times per second.
+            if (acDoc.AC_ChargeLoopReq_isUsed) {
+                unsigned long now = millis();
+                if (acDoc.AC_ChargeLoopReq.Dynamic_AC_CLReqControlMode_isUsed) {
+                    struct iso20_ac_RationalNumberType &Present = acDoc.AC_ChargeLoopReq.Dynamic_AC_CLReqControlMode.EVPresentActivePower;
+                    _LOG_V("AC_ChargeLoopRequest, EVPresentActivePower=%.0f W.\n", Present.Value * pow(10, Present.Exponent));
+                }
+                if (Balanced[0] != iso20Target) {
+                    _LOG_I("AC_ChargeLoop: target %u.%uA, %lu ms after the previous loop.\n", Balanced[0] / 10, Balanced[0] % 10, now - iso20LoopTime);
+                    iso20Target = Balanced[0];
+                }
+                iso20LoopTime = now;
+
+                INIT_ISO20_AC_RESPONSE(AC_ChargeLoop)
+                acDoc.AC_ChargeLoopRes.Dynamic_AC_CLResControlMode_isUsed = 1;
+                init_iso20_ac_Dynamic_AC_CLResControlModeType(&acDoc.AC_ChargeLoopRes.Dynamic_AC_CLResControlMode);
+                iso20_setPower(&acDoc.AC_ChargeLoopRes.Dynamic_AC_CLResControlMode.EVSETargetActivePower, iso20_power(iso20Target));
+                EncodeAndTransmit(&acDoc);
+                fsmState = stateChargeLoop;
+                return;
+            }
+        } else {
+            struct iso20_exiDocument &exiDoc = *iso20Doc;
+            memset(&exiDoc, 0, sizeof(struct iso20_exiDocument));
+            decode_iso20_exiDocument(&stream, &exiDoc);
+            modemTimeline(TL_V2G_REQ, Charging_Protocol, fsmState, exiLen, micros() - start);
+
+            if (exiDoc.SessionSetupReq_isUsed) {
+                uint16_t n = exiDoc.SessionSetupReq.EVCCID.charactersLen;
+                if (n >= sizeof(EVCCID)) n = sizeof(EVCCID) - 1;
+                memcpy(EVCCID, exiDoc.SessionSetupReq.EVCCID.characters, n);
+                EVCCID[n] = '\0';
+                _LOG_I("SessionSetupRequest, EVCCID=%s.\n", EVCCID);
+                Serial1.printf("@EVCCID:%s\n", EVCCID);  //send to CH32
+
+                // -20 requires a session ID of 8 bytes
+                uint32_t r = esp_random();
+                memcpy(iso20SessionId, &r, 4);
+                r = esp_random();
+                memcpy(iso20SessionId + 4, &r, 4);
+
+                INIT_ISO20_RESPONSE(SessionSetup)
+                exiDoc.SessionSetupRes.ResponseCode = iso20_responseCodeType_OK_NewSessionEstablished;
+                char EVSEID[24]; // 23 characters + 1 for null terminator
+                snprintf(EVSEID, sizeof(EVSEID), "SEV*01*SmartEVSE-%06u", serialnr);
+                memcpy(exiDoc.SessionSetupRes.EVSEID.characters, &EVSEID, 23);
+                exiDoc.SessionSetupRes.EVSEID.charactersLen = 23;
+                EncodeAndTransmit(&exiDoc);
+                iso20Target = 0;
+                fsmState = stateWaitForAuthorizationSetupRequest;
+                return;
+            }
+
+            if (exiDoc.AuthorizationSetupReq_isUsed) {
+                _LOG_I("AuthorizationSetupRequest\n");
+                INIT_ISO20_RESPONSE(AuthorizationSetup)
+                exiDoc.AuthorizationSetupRes.AuthorizationServices.array[0] = iso20_authorizationType_EIM; // EVSE handles the authorization
+                exiDoc.AuthorizationSetupRes.AuthorizationServices.arrayLen = 1;
+                exiDoc.AuthorizationSetupRes.CertificateInstallationService = 0;
+                exiDoc.AuthorizationSetupRes.EIM_ASResAuthorizationMode_isUsed = 1;
+                EncodeAndTransmit(&exiDoc);
+                fsmState = stateWaitForContractAuthenticationRequest;
+                return;
+            }
+
+            if (exiDoc.AuthorizationReq_isUsed) {
+                _LOG_I("AuthorizationRequest\n");
+                INIT_ISO20_RESPONSE(Authorization)
+                exiDoc.AuthorizationRes.EVSEProcessing = iso20_processingType_Finished;
+                EncodeAndTransmit(&exiDoc);
+                fsmState = stateWaitForServiceDiscoveryRequest;
+                return;
+            }
+
+#define ISO20_SERVICE_AC 1
+            if (exiDoc.ServiceDiscoveryReq_isUsed) {
+                _LOG_I("ServiceDiscoveryRequest\n");
+                INIT_ISO20_RESPONSE(ServiceDiscovery)
+                exiDoc.ServiceDiscoveryRes.ServiceRenegotiationSupported = 0;
+                exiDoc.ServiceDiscoveryRes.EnergyTransferServiceList.Service.array[0].ServiceID = ISO20_SERVICE_AC;
+                exiDoc.ServiceDiscoveryRes.EnergyTransferServiceList.Service.array[0].FreeService = 1;
+                exiDoc.ServiceDiscoveryRes.EnergyTransferServiceList.Service.arrayLen = 1;
+                exiDoc.ServiceDiscoveryRes.VASList_isUsed = 0;
+                EncodeAndTransmit(&exiDoc);
+                fsmState = stateWaitForServiceDetailRequest;
+                return;
+            }
+
+            // We only offer dynamic control mode, so the EV cannot select scheduled mode
+            if (exiDoc.ServiceDetailReq_isUsed) {
+                uint16_t ServiceID = exiDoc.ServiceDetailReq.ServiceID;
+                _LOG_I("ServiceDetailRequest, ServiceID=%u\n", ServiceID);
+                INIT_ISO20_RESPONSE(ServiceDetail)
+                exiDoc.ServiceDetailRes.ServiceID = ServiceID;
+                struct iso20_ParameterSetType *set = &exiDoc.ServiceDetailRes.ServiceParameterList.ParameterSet.array[0];
+                exiDoc.ServiceDetailRes.ServiceParameterList.ParameterSet.arrayLen = 1;
+                init_iso20_ParameterSetType(set);
+                set->ParameterSetID = 1;
+                set->Parameter.arrayLen = 0;
+                iso20_addParameter(set, "Connector", Nr_Of_Phases_Charging == 1 ? 1 : 2); // 1 = SinglePhase, 2 = ThreePhase
+                iso20_addParameter(set, "ControlMode", 2);                                // 2 = Dynamic
+                iso20_addParameter(set, "EVSENominalVoltage", 230);
+                iso20_addParameter(set, "MobilityNeedsMode", 1);                          // 1 = ProvidedByEvcc
+                iso20_addParameter(set, "Pricing", 0);                                    // 0 = NoPricing
+                if (ServiceID != ISO20_SERVICE_AC)
+                    exiDoc.ServiceDetailRes.ResponseCode = iso20_responseCodeType_FAILED_ServiceIDInvalid;
+                EncodeAndTransmit(&exiDoc);
+                fsmState = stateWaitForServiceSelectionRequest;
+                return;
+            }
+
+            if (exiDoc.ServiceSelectionReq_isUsed) {
+                _LOG_I("ServiceSelectionRequest, ServiceID=%u ParameterSetID=%u\n", exiDoc.ServiceSelectionReq.SelectedEnergyTransferService.ServiceID,
+                       exiDoc.ServiceSelectionReq.SelectedEnergyTransferService.ParameterSetID);
+                INIT_ISO20_RESPONSE(ServiceSelection)
+                EncodeAndTransmit(&exiDoc);
+                fsmState = stateWaitForChargeParameterDiscoveryRequest;
+                return;
+            }
+
+            if (exiDoc.ScheduleExchangeReq_isUsed) {
+                _LOG_I("ScheduleExchangeRequest\n");
+                if (exiDoc.ScheduleExchangeReq.Dynamic_SEReqControlMode_isUsed) {
+                    struct iso20_Dynamic_SEReqControlModeType &Req = exiDoc.ScheduleExchangeReq.Dynamic_SEReqControlMode;
+                    _LOG_A("Modem: Departure Time=%u.\n", Req.DepartureTime);
+                    if (Req.TargetSOC_isUsed) {
+                        FullSoC = Req.TargetSOC;
+                        _LOG_A("Modem: set FullSoC=%d.\n", FullSoC);
+                    }
+                    EnergyRequest = Req.EVTargetEnergyRequest.Value * pow(10, Req.EVTargetEnergyRequest.Exponent);
+                    _LOG_A("Modem: set EVTargetEnergyRequest=%d Wh.\n", EnergyRequest);
+                }
+                INIT_ISO20_RESPONSE(ScheduleExchange)
+                exiDoc.ScheduleExchangeRes.EVSEProcessing = iso20_processingType_Finished;
+                exiDoc.ScheduleExchangeRes.Dynamic_SEResControlMode_isUsed = 1;
+                init_iso20_Dynamic_SEResControlModeType(&exiDoc.ScheduleExchangeRes.Dynamic_SEResControlMode);
+                EncodeAndTransmit(&exiDoc);
+                fsmState = stateWaitForPowerDeliveryRequest;
+                return;
+            }
+
+            if (exiDoc.PowerDeliveryReq_isUsed) {
+                const char ChargeProgressStr[][22] = {"Start" , "Stop" , "Standby", "ScheduleRenegotiation"};
+                iso20_chargeProgressType ChargeProgress = exiDoc.PowerDeliveryReq.ChargeProgress;
+                _LOG_I("PowerDeliveryRequest, ChargeProgress: %s.\n", ChargeProgressStr[ChargeProgress]);
+                INIT_ISO20_RESPONSE(PowerDelivery)
+                EncodeAndTransmit(&exiDoc);
+                switch (ChargeProgress) {
+                    case iso20_chargeProgressType_Start:
+                        fsmState = stateChargeLoop;
+                        iso20LoopTime = millis();
+                        SetCPDuty(51); //5% if not already there
+                        CPDutyOverride = true;
+                        setState(STATE_C);
+                        break;
+                    case iso20_chargeProgressType_Stop:
+                        setState(STATE_C1);
+                        fsmState = stateWaitForPowerDeliveryRequest;
+                        break;
+                    default:
+                        break;
+                }
+                return;
+            }
+
+            if (exiDoc.SessionStopReq_isUsed) {
+                _LOG_I("SessionStopRequest received.\n");
+                if (exiDoc.SessionStopReq.ChargingSession == iso20_chargingSessionType_Pause) {
+                    _LOG_I("Pausing session.\n");
+                    setAccess(PAUSE);
+                }
+                INIT_ISO20_RESPONSE(SessionStop)
+                EncodeAndTransmit(&exiDoc);
+                tcp_prepareTcpHeader(TCP_FLAG_FIN | TCP_FLAG_ACK, 0);
+                tcp_setState(TCP_STATE_FIN_WAIT_1);
+                fsmState = stateWaitForSupportedApplicationProtocolRequest;
+                return;
+            }
+        }
+    } //ISO20
     _LOG_A("Modem: fsmState=%u, unknown message received.\n", fsmState);
 }
 
 
+// Passes all complete V2GTP messages in tcp_rxdata to the decoder.
+static void tcp_deliverMessages(void) {
+    while (tcp_rxdataLen >= V2GTP_HEADER_LEN && tcpState == TCP_STATE_ESTABLISHED) {
+        if (tcp_rxdata[0] != 0x01 || tcp_rxdata[1] != 0xfe) {
+            _LOG_W("[TCP] invalid V2GTP header, dropping %u bytes.\n", tcp_rxdataLen);
+            tcp_rxdataLen = 0;
+            return;
+        }
+        uint32_t exiLen = ((uint32_t)tcp_rxdata[4] << 24) | ((uint32_t)tcp_rxdata[5] << 16) | ((uint32_t)tcp_rxdata[6] << 8) | tcp_rxdata[7];
+        if (exiLen > V2GTP_MAX_MESSAGE_LEN - V2GTP_HEADER_LEN) {
+            _LOG_W("[TCP] invalid V2GTP length %u, resetting connection.\n", exiLen);
+            tcp_sendSegment(TcpSeqNr, TCP_FLAG_RST | TCP_FLAG_ACK, 0);
+            tcp_close();
+            return;
+        }
+        if (exiLen > TCP_RX_DATA_LEN - V2GTP_HEADER_LEN) {
+            _LOG_W("[TCP] V2GTP message of %u bytes does not fit, dropping it.\n", exiLen);
+            tcpStats.Overflows++;
+            tcp_rxdiscard = V2GTP_HEADER_LEN + exiLen - tcp_rxdataLen;
+            tcp_rxdataLen = 0;
+            return;
+        }
+        uint16_t msgLen = V2GTP_HEADER_LEN + exiLen;
+        if (tcp_rxdataLen < msgLen) return;     // wait for the next segment
+
+        decodeV2GTP(exiLen);
+        if (tcp_rxdataLen < msgLen) return;     // connection was closed while decoding
+        tcp_rxdataLen -= msgLen;
+        memmove(tcp_rxdata, tcp_rxdata + msgLen, tcp_rxdataLen);
+    }
+}
+
+
 void evaluateTcpPacket(void) {
     uint8_t flags;
     uint32_t remoteSeqNr;
     uint32_t remoteAckNr;
     uint16_t SourcePort, DestinationPort, pLen, hdrLen, tmpPayloadLen;
 
-    /* todo: check the IP addresses, checksum etc */
+    /* todo: check the IP addresses. The checksum is verified by IPv6Manager() */
     //nTcpPacketsReceived++;
     pLen =  rxbuffer[18]*256 + rxbuffer[19]; /* length of the IP payload */
     hdrLen = (rxbuffer[66]>>4) * 4; /* header length in byte */
@@ -1100,61 +1603,31 @@ void evaluateTcpPacket(void) {
     _LOG_D("TcpState=%u.\n", tcpState);
     if (flags & TCP_FLAG_RST) { // EV wants to immediately close the TCP connection
         _LOG_D("Received TCP RST, closing connection.\n");
-        tcpState = TCP_STATE_CLOSED;
-        fsmState = stateWaitForSupportedApplicationProtocolRequest;
+        tcp_close();
         return;
     }
 
-    //we are closing the TCP connection
-    if (flags & TCP_FLAG_ACK && tcpState == TCP_STATE_FIN_WAIT_1) {
-        tcp_prepareTcpHeader(TCP_FLAG_ACK, 0);
-        tcpState = TCP_STATE_FIN_WAIT_2;
-    }
-    if ((flags & TCP_FLAG_FIN) && tcpState == TCP_STATE_FIN_WAIT_2) {
-        tcp_prepareTcpHeader(TCP_FLAG_ACK, 0);
-        tcpState = TCP_STATE_CLOSED; //skipping TIME_WAIT
-        fsmState = stateWaitForSupportedApplicationProtocolRequest;
-        return;
-    }
-
-/*    //EV wants to close the TCP connection gracefully
-    if ((flags & TCP_FLAG_FIN) && tcpState == TCP_STATE_ESTABLISHED) {
-        _LOG_D("Received TCP FIN, closing connection.\n");
-        tcp_prepareTcpHeader(TCP_FLAG_ACK | TCP_FLAG_FIN, 0);
-        tcpState = TCP_STATE_LAST_ACK;
-        return;
-        //_LOG_A("Received SoC via Modem. Shortcut to State Modem Done\n");
-        //setState(STATE_MODEM_DONE); // Go to State B, which means in this case setting PWM
-    }
-    if ((flags & TCP_FLAG_ACK) && tcpState == TCP_STATE_LAST_ACK) {
-        tcpState = TCP_STATE_CLOSED;
-        fsmState = stateWaitForSupportedApplicationProtocolRequest;
-        return;
-        //_LOG_A("Received SoC via Modem. Shortcut to State Modem Done\n");
-        //setState(STATE_MODEM_DONE); // Go to State B, which means in this case setting PWM
-    }
-*/
-    //normal TCP traffic
-    if (flags == TCP_FLAG_SYN) { /* This is the connection setup reqest from the EV. */
-        if (tcpState == TCP_STATE_CLOSED) {
-            evccTcpPort = SourcePort; // update the evccTcpPort to the new TCP port
-            TcpSeqNr = 0x01020304; // We start with a 'random' sequence nr
-            TcpAckNr = remoteSeqNr+1; // The ACK number of our next transmit packet is one more than the received seq number.
-            tcpState = TCP_STATE_SYN_ACK;
-            //send flags:
-            tcp_prepareTcpHeader(TCP_FLAG_ACK | TCP_FLAG_SYN, 0);
-        }
-        return;
-    }
-    if (flags == TCP_FLAG_ACK && tcpState == TCP_STATE_SYN_ACK) {
-        if (remoteAckNr == (TcpSeqNr + 1) ) {
-            _LOG_I("-------------- TCP connection established ---------------\n\n");
-            tcpState = TCP_STATE_ESTABLISHED;
+    if ((flags & (TCP_FLAG_SYN | TCP_FLAG_ACK)) == TCP_FLAG_SYN) { /* This is the connection setup reqest from the EV. */
+        if (tcpState != TCP_STATE_CLOSED && SourcePort == evccTcpPort && remoteSeqNr + 1 == TcpAckNr) {
+            // the EV did not receive our SYN+ACK, and sends the same SYN again
+            if (tcpState == TCP_STATE_SYN_ACK) tcp_retransmit();
+            return;
         }
+        tcp_close();                            // a new connection replaces the old one
+        memset(&tcpStats, 0, sizeof(tcpStats));
+        evccTcpPort = SourcePort; // update the evccTcpPort to the new TCP port
+        TcpSeqNr = 0x01020304; // We start with a 'random' sequence nr
+        TcpUnackedSeqNr = TcpSeqNr;
+        TcpAckNr = remoteSeqNr+1; // The ACK number of our next transmit packet is one more than the received seq number.
+        tcpRto = TCP_RTO_INITIAL;
+        tcpSrtt = tcpRttVar = 0;
+        tcpRetries = tcpDupAcks = 0;
+        tcp_setState(TCP_STATE_SYN_ACK);
+        //send flags:
+        tcp_prepareTcpHeader(TCP_FLAG_ACK | TCP_FLAG_SYN, 0);
         return;
     }
-    /* It is no connection setup. We can have the following situations here: */
-    if (tcpState != TCP_STATE_ESTABLISHED) {
+    if (tcpState == TCP_STATE_CLOSED || SourcePort != evccTcpPort) {
         /* received something while the connection is closed. Just ignore it. */
         _LOG_I("[TCP] ignore, not connected.\n");
         return;
@@ -1162,19 +1635,65 @@ void evaluateTcpPacket(void) {
 
     // It can be an ACK, or a data package, or a combination of both. We treat the ACK and the data independent from each other,
     // to treat each combination.
-   if ((tmpPayloadLen>0) && (tmpPayloadLen< TCP_RX_DATA_LEN)) {
+    if (flags & TCP_FLAG_ACK) tcp_processAck(remoteAckNr, tmpPayloadLen, flags);
+
+    if (tcpState == TCP_STATE_SYN_ACK && !(tcp_txFlags & TCP_FLAG_SYN)) {
+        _LOG_I("-------------- TCP connection established ---------------\n\n");
+        tcp_setState(TCP_STATE_ESTABLISHED);
+    }
+    if (tcpState == TCP_STATE_FIN_WAIT_1 && !(tcp_txFlags & TCP_FLAG_FIN)) tcp_setState(TCP_STATE_FIN_WAIT_2);
+    if (tcpState == TCP_STATE_LAST_ACK && !(tcp_txFlags & TCP_FLAG_FIN)) {
+        tcp_close();
+        return;
+    }
+
+    if (tmpPayloadLen > 0 && tcpState == TCP_STATE_ESTABLISHED) {
         /* This is a data transfer packet. */
-        // flag bit PSH should also be set.
-        tcp_rxdataLen = tmpPayloadLen;
-        TcpAckNr = remoteSeqNr + tcp_rxdataLen; // The ACK number of our next transmit packet is tcp_rxdataLen more than the received seq number.
-        TcpSeqNr = remoteAckNr;                 // tcp_rxdatalen will be cleared later.
-        /* rxbuffer[74] is the first payload byte. */
-        memcpy(tcp_rxdata, rxbuffer+74, tcp_rxdataLen);  /* provide the received data to the application */
+        int32_t offset = TcpAckNr - remoteSeqNr;    // number of bytes of this segment we already have
+        if (offset < 0) {
+            tcpStats.OutOfOrder++;              // a segment before this one got lost
+            tcp_prepareTcpHeader(TCP_FLAG_ACK, 0);
+            return;
+        }
+        if (offset >= tmpPayloadLen) {
+            tcpStats.DupSegments++;             // our ACK got lost, acknowledge again
+            tcp_prepareTcpHeader(TCP_FLAG_ACK, 0);
+            return;
+        }
+        tcpStats.Segments++;
+        /* rxbuffer[54 + hdrLen] is the first payload byte. */
+        uint8_t *payload = rxbuffer + 54 + hdrLen + offset;
+        uint16_t newLen = tmpPayloadLen - offset;
+        if (tcp_rxdiscard) {                    // skip the rest of a message that is too large
+            uint16_t skip = min((uint32_t)newLen, tcp_rxdiscard);
+            tcp_rxdiscard -= skip;
+            TcpAckNr += skip;
+            payload += skip;
+            newLen -= skip;
+        }
+        if (newLen > TCP_RX_DATA_LEN - tcp_rxdataLen) {
+            tcpStats.Overflows++;               // beyond our window, the EV will send it again
+            newLen = TCP_RX_DATA_LEN - tcp_rxdataLen;
+        }
+        memcpy(tcp_rxdata + tcp_rxdataLen, payload, newLen);  /* provide the received data to the application */
+        tcp_rxdataLen += newLen;
+        TcpAckNr += newLen;
         //     connMgr_TcpOk();
         tcp_prepareTcpHeader(TCP_FLAG_ACK, 0);  // Send Ack, then process data
-        decodeV2GTP();
-        return;
+        tcp_deliverMessages();
     }
 
+    // FIN from the EV, only when all data before it has been received
+    if ((flags & TCP_FLAG_FIN) && TcpAckNr == remoteSeqNr + tmpPayloadLen) {
+        TcpAckNr++;
+        if (tcpState == TCP_STATE_ESTABLISHED) { // EV wants to close the TCP connection gracefully
+            _LOG_D("Received TCP FIN, closing connection.\n");
+            tcp_prepareTcpHeader(TCP_FLAG_ACK | TCP_FLAG_FIN, 0);
+            tcp_setState(TCP_STATE_LAST_ACK);
+        } else if (tcpState == TCP_STATE_FIN_WAIT_1 || tcpState == TCP_STATE_FIN_WAIT_2) {
+            tcp_prepareTcpHeader(TCP_FLAG_ACK, 0);
+            tcp_close(); //skipping TIME_WAIT
+        }
+    }
 }
 #endif
@@ -122,6 +122,170 @@ void sprintfl(char *str, const char *Format, signed long Value, unsigned char Di
     else sprintf(str, Format, (signed int) val);
 }
 
+
+enum : uint8_t { NUM_NEG = 1, NUM_DIGITS = 2, NUM_DOT = 4, NUM_FRAC = 8, NUM_EXP = 16, NUM_EXP_NEG = 32, NUM_EXP_DIGITS = 64, NUM_EXP_SIGN = 128 };
+
+JsonExtractor::JsonExtractor(const JsonKey *keys, uint8_t count, int32_t *values) :
+    Found(0), Keys(keys), Values(values), Count(count), State(VALUE), Depth(0), Objects(0), Key(-1), IsKey(false), Escape(false) {
+}
+
+void JsonExtractor::setValue(int32_t value) {
+    if (Key >= 0) {
+        Values[Key] = value;
+        Found |= 1UL << Key;
+    }
+    Key = -1;
+    State = Depth ? AFTER : DONE;
+}
+
+// Scale the mantissa to the requested number of decimals, fraction digits that do not fit are truncated
+bool JsonExtractor::endNumber() {
+    if (!(NumFlags & NUM_DIGITS) || ((NumFlags & NUM_DOT) && !(NumFlags & NUM_FRAC)) || ((NumFlags & NUM_EXP) && !(NumFlags & NUM_EXP_DIGITS))) return false;
+    if (Key >= 0) {
+        int32_t scale = Exponent + (NumFlags & NUM_EXP_NEG ? -ExpValue : ExpValue) + Keys[Key].Decimals;
+        int64_t value = Mantissa;
+        for (; scale > 0 && value < INT32_MAX; scale--) value *= 10;
+        for (; scale < 0 && value; scale++) value /= 10;
+        if (value > INT32_MAX) value = INT32_MAX;
+        setValue(NumFlags & NUM_NEG ? -(int32_t)value : (int32_t)value);
+    } else setValue(0);
+    return true;
+}
+
+/**
+ * Parse the next chunk of the document
+ *
+ * @param buf pointer to the chunk
+ * @param len length of the chunk
+ * @return false when the document is malformed, or when there is data after the top level value
+ */
+bool JsonExtractor::parse(const char *buf, size_t len) {
+    for (size_t i = 0; i < len && State != ERROR; i++) {
+        const char ch = buf[i];
+
+        if (State == STRING) {
+            if (Escape) Escape = false;
+            else if (ch == '\\') Escape = true;
+            else if (ch == '"') {
+                if (IsKey) {
+                    Key = -1;
+                    for (uint8_t k = 0; k < Count; k++) {
+                        if (Keys[k].Hash == Hash) Key = k;
+                    }
+                    State = COLON;
+                } else setValue(Hash);
+                continue;
+            } else if ((uint8_t)ch < 0x20) {
+                State = ERROR;
+                break;
+            }
+            Hash = (Hash ^ (uint8_t)ch) * 16777619u;
+            continue;
+        }
+        if (State == NUMBER) {
+            if (ch >= '0' && ch <= '9') {
+                if (NumFlags & NUM_EXP) {
+                    if (ExpValue < 1000) ExpValue = ExpValue * 10 + ch - '0';
+                    NumFlags |= NUM_EXP_DIGITS;
+                } else {
+                    if (Mantissa < 100000000000000000LL) {
+                        Mantissa = Mantissa * 10 + ch - '0';
+                        if (NumFlags & NUM_DOT) Exponent--;
+                    } else if (!(NumFlags & NUM_DOT) && Exponent < 1000) Exponent++;   // too many digits, drop the least significant ones
+                    NumFlags |= NumFlags & NUM_DOT ? NUM_FRAC : NUM_DIGITS;
+                }
+                continue;
+            }
+            if (ch == '.' && !(NumFlags & (NUM_DOT | NUM_EXP)) && (NumFlags & NUM_DIGITS)) {
+                NumFlags |= NUM_DOT;
+                continue;
+            }
+            if ((ch == 'e' || ch == 'E') && !(NumFlags & NUM_EXP) && (NumFlags & NUM_DIGITS)) {
+                NumFlags |= NUM_EXP;
+                continue;
+            }
+            if ((ch == '-' || ch == '+') && (NumFlags & NUM_EXP) && !(NumFlags & (NUM_EXP_DIGITS | NUM_EXP_SIGN))) {
+                NumFlags |= ch == '-' ? NUM_EXP_SIGN | NUM_EXP_NEG : NUM_EXP_SIGN;
+                continue;
+            }
+            if (!endNumber()) {
+                State = ERROR;
+                break;
+            }
+            // the character after the number is handled below
+        }
+        if (State == LITERAL) {
+            if (ch >= 'a' && ch <= 'z') {
+                Hash = (Hash ^ (uint8_t)ch) * 16777619u;
+                continue;
+            }
+            if (Hash == jsonKeyHash("true")) setValue(1);
+            else if (Hash == jsonKeyHash("false") || Hash == jsonKeyHash("null")) setValue(0);
+            else {
+                State = ERROR;
+                break;
+            }
+        }
+        if (ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n') continue;
+
+        switch (State) {
+            case VALUE:
+                if (ch == '{' || ch == '[') {
+                    if (Depth == 32) {
+                        State = ERROR;
+                        break;
+                    }
+                    if (ch == '{') Objects |= 1UL << Depth;
+                    else Objects &= ~(1UL << Depth);
+                    Depth++;
+                    Key = -1;
+                    State = ch == '{' ? KEY : VALUE;
+                } else if (ch == ']' && Depth && !(Objects & (1UL << (Depth - 1)))) {
+                    Depth--;                                                    // empty array (or trailing comma)
+                    setValue(0);
+                } else if (ch == '"') {
+                    IsKey = false;
+                    Hash = 2166136261u;
+                    State = STRING;
+                } else if (ch == '-' || (ch >= '0' && ch <= '9')) {
+                    Mantissa = ch == '-' ? 0 : ch - '0';
+                    Exponent = 0;
+                    ExpValue = 0;
+                    NumFlags = ch == '-' ? NUM_NEG : NUM_DIGITS;
+                    State = NUMBER;
+                } else if (ch >= 'a' && ch <= 'z') {
+                    Hash = (2166136261u ^ (uint8_t)ch) * 16777619u;
+                    State = LITERAL;
+                } else State = ERROR;
+                break;
+            case KEY:
+                if (ch == '"') {
+                    IsKey = true;
+                    Hash = 2166136261u;
+                    State = STRING;
+                } else if (ch == '}') {                                         // empty object
+                    Depth--;
+                    setValue(0);
+                } else State = ERROR;
+                break;
+            case COLON:
+                State = ch == ':' ? VALUE : ERROR;
+                break;
+            case AFTER:
+                if (ch == ',') State = Objects & (1UL << (Depth - 1)) ? KEY : VALUE;
+                else if (ch == (Objects & (1UL << (Depth - 1)) ? '}' : ']')) {
+                    Depth--;
+                    setValue(0);
+                } else State = ERROR;
+                break;
+            default:                                                            // DONE, data after the top level value
+                State = ERROR;
+                break;
+        }
+    }
+    return State != ERROR;
+}
+
 #else //CH32
 #include "ch32v003fun.h"
 #include "ch32.h"
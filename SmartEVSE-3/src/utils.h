@@ -36,6 +36,46 @@ uint8_t ease8InOutQuad(uint8_t i);
 #ifdef SMARTEVSE_VERSION //ESP32
 uint32_t MacId();
 void sprintfl(char *str, const char *Format, signed long Value, unsigned char Divisor, unsigned char Decimal);
+
+// FNV-1a hash of a JSON key, usable at compile time
+constexpr uint32_t jsonKeyHash(const char *s, uint32_t h = 2166136261u) {
+    return *s ? jsonKeyHash(s + 1, (h ^ (uint8_t)*s) * 16777619u) : h;
+}
+
+struct JsonKey {
+    uint32_t Hash;                                                              // jsonKeyHash() of the key
+    uint8_t Decimals;                                                           // numbers are stored as value * 10^Decimals
+};
+
+// Single pass extractor for the values of known keys in a JSON document, that can be fed in chunks.
+// Numbers are converted to fixed point integers, strings are stored as their jsonKeyHash(),
+// true/false/null as 1/0/0. Keys are matched at any depth.
+class JsonExtractor {
+  public:
+    JsonExtractor(const JsonKey *keys, uint8_t count, int32_t *values);
+    bool parse(const char *buf, size_t len);                                    // false on malformed JSON
+    bool done() const { return State == DONE; }                                 // the top level value is complete
+    bool found(uint8_t key) const { return Found & (1UL << key); }
+    uint32_t Found;                                                             // bit n set when Keys[n] was found
+  private:
+    enum : uint8_t { VALUE, KEY, COLON, AFTER, STRING, NUMBER, LITERAL, DONE, ERROR };
+    void setValue(int32_t value);
+    bool endNumber();
+    const JsonKey *Keys;
+    int32_t *Values;
+    uint8_t Count;
+    uint8_t State;
+    uint8_t Depth;
+    uint32_t Objects;                                                           // bit n set when level n is an object
+    uint32_t Hash;
+    int8_t Key;                                                                 // index of the key of the current value, or -1
+    bool IsKey, Escape;
+    // number being parsed
+    int64_t Mantissa;
+    int16_t Exponent;
+    int16_t ExpValue;
+    uint8_t NumFlags;
+};
 unsigned char triwave8(unsigned char in);
 unsigned char scale8(unsigned char i, unsigned char scale);
 unsigned char ease8InOutQuad(unsigned char i);
@@ -55,6 +55,7 @@ const uint8_t wch_write_option[] = {0x07, 0x00, 0xa5, 0x5a, 0x3f, 0xc0, 0x00, 0x
 const uint8_t wch_set_key[] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
 const uint8_t wch_erase_flash[] = {0xe0, 0x00, 0x00, 0x00};     // Size of Full Flash Erase, set to 224kB for a CH32V203 with 64kB flash?
 const uint8_t wch_stop[] = {0x01};      // this will also soft reset the CPU
+const uint8_t wch_set_baudrate[] = {WCH_FAST_BAUD & 0xff, (WCH_FAST_BAUD >> 8) & 0xff, (WCH_FAST_BAUD >> 16) & 0xff, (WCH_FAST_BAUD >> 24) & 0xff};
 
 uint8_t WchUID[8];
 unsigned long WchTimeout;
@@ -120,12 +121,19 @@ void WchSendData(const uint8_t * command_data, uint16_t len, uint8_t wch_cmd ) {
 
 struct mg_fs *filesystem = &mg_fs_packed;
 
+// Program the CH32 flash with the file.
+// The flash is first compared with the file using the verify command, and only erased and programmed when it differs,
+// so a CH32 that already runs this firmware is left alone. The bootloader can only erase from the start of the flash,
+// so a partial reprogram is not possible.
 void WchProgram(void *fp, size_t filesize) {
     uint8_t WchState = WCH_START, RXbyte, RXlen=0, x, sum, XorKey=0;
     uint16_t len;
-    uint8_t filebuffer[100];
+    uint8_t filebuffer[WCH_CHUNK_SIZE + 5];
     uint8_t WchRXbuf[200];
     uint32_t filepointer=0;
+    bool Comparing = false;                                     // verifying the flash before erasing it
+    uint8_t Progress = 0;
+    unsigned long StartTime = millis();
 
     WchEnterBootloader();
 
@@ -140,6 +148,9 @@ void WchProgram(void *fp, size_t filesize) {
                 case WCH_START:
                     WchSendData(wch_start, sizeof(wch_start), WCH_START); 
                     break;
+                case WCH_SET_BAUDRATE:
+                    WchSendData(wch_set_baudrate, sizeof(wch_set_baudrate), WCH_SET_BAUDRATE);
+                    break;
                 case WCH_READ_OPTION:
                     WchSendData(wch_read_option, sizeof(wch_read_option), WCH_READ_OPTION);
                     break;    
@@ -155,7 +166,7 @@ void WchProgram(void *fp, size_t filesize) {
                 case WCH_PROGRAM_FLASH:
                 case WCH_VERIFY_FLASH:
                     filesystem->sk(fp, filepointer);
-                    len = filesystem->rd(fp, filebuffer+5, 56);                         // we read one line at a time
+                    len = filesystem->rd(fp, filebuffer+5, WCH_CHUNK_SIZE);             // we read one line at a time
                     for(x=0; x< len; x++) {
                         if ((x & 7) == 7) filebuffer[x+5] ^= (XorKey + 0x31);           // 8th byte is special
                         else filebuffer[x+5] ^= XorKey;                                 // 'encrypt' with XorKey
@@ -191,7 +202,7 @@ void WchProgram(void *fp, size_t filesize) {
             if (++RXlen >= 200) RXlen = 199;
         }
 
-        if (RXlen >= 8) {                                       // minimal 8 bytes in reply
+        if (RXlen >= 8 && RXlen >= WchRXbuf[4] + 7) {           // minimal 8 bytes in reply, wait for the complete reply
 #ifdef WCHDEBUG
             Serial.printf("\r\n");
 #endif
@@ -210,10 +221,20 @@ void WchProgram(void *fp, size_t filesize) {
                     switch (WchState) {
                         case WCH_START:
                             if (WchRXbuf[6] == 0x31 && WchRXbuf[7] == 0x19) {
-                                WchState = WCH_READ_OPTION;
+                                WchState = WCH_SET_BAUDRATE;
                             } else log_e("Start Error");    
                             break;
 
+                        case WCH_SET_BAUDRATE:                                      // the reply is sent at the old baudrate
+                            if (WchRXbuf[6] == 0 && WchRXbuf[7] == 0) {
+                                Serial1.flush();
+                                Serial1.updateBaudRate(WCH_FAST_BAUD);
+                                delay(5);
+                                log_d("Baudrate %u", WCH_FAST_BAUD);
+                            } else log_e("Baudrate Error, staying at 115200");
+                            WchState = WCH_READ_OPTION;
+                            break;
+
                         case WCH_READ_OPTION:
                             memcpy(WchUID, WchRXbuf+24, 8);                         // Store chip UID (unused)
                             XorKey = 0;
@@ -229,8 +250,10 @@ void WchProgram(void *fp, size_t filesize) {
 
                         case WCH_SET_KEY:                                           // BTVER 2.6 reports 0x09. BTVER 2.7 reports 0x89 ot 0x57 here
                             if (((WchRXbuf[6] & 0x0f) == 0x09) && WchRXbuf[7] == 0) {
-                                WchState = WCH_ERASE_FLASH;
-                                log_d("Erasing...");
+                                WchState = WCH_VERIFY_FLASH;
+                                Comparing = true;
+                                filepointer = 0;
+                                log_d("Comparing...");
                             } else log_e("Key Error");
                             break;
 
@@ -243,7 +266,11 @@ void WchProgram(void *fp, size_t filesize) {
 
                         case WCH_PROGRAM_FLASH:
                             if (WchRXbuf[6] == 0 && WchRXbuf[7] == 0) {
-                                filepointer += 56;                          // point to next data in file
+                                filepointer += WCH_CHUNK_SIZE;              // point to next data in file
+                                if (filepointer * 10 / (filesize + 1) > Progress) {
+                                    Progress = filepointer * 10 / (filesize + 1);
+                                    log_d("Programming %u%%, %lu ms", Progress * 10, millis() - StartTime);
+                                }
                                 if (filepointer > filesize) {
                                     log_d("Verifying...");
                                     WchState = WCH_VERIFY_FLASH;
@@ -253,8 +280,21 @@ void WchProgram(void *fp, size_t filesize) {
                             break;
 
                         case WCH_VERIFY_FLASH:
-                            if (WchRXbuf[7] == 0) {     // (WchRXbuf[6] == 0 && WchRXbuf[7] == 0)      TODO: NEEDS FIX!
-                                filepointer += 56;
+                            if (Comparing) {                                // only a reply with both status bytes 0 is a match, anything else reprograms
+                                if (WchRXbuf[6] == 0 && WchRXbuf[7] == 0) {
+                                    filepointer += WCH_CHUNK_SIZE;
+                                    if (filepointer > filesize) {
+                                        _LOG_A("CH32 flash already contains this firmware, not programming.\n");
+                                        WchState = WCH_STOP;
+                                    }
+                                } else {
+                                    log_d("Flash differs at %u, erasing...", filepointer);
+                                    Comparing = false;
+                                    filepointer = 0;
+                                    WchState = WCH_ERASE_FLASH;
+                                }
+                            } else if (WchRXbuf[7] == 0) {     // (WchRXbuf[6] == 0 && WchRXbuf[7] == 0)      TODO: NEEDS FIX!
+                                filepointer += WCH_CHUNK_SIZE;
                                 if (filepointer > filesize) WchState = WCH_STOP;
                             } else log_e("Verify Error");
                             break;
@@ -279,10 +319,14 @@ void WchProgram(void *fp, size_t filesize) {
         if (WchTimeout < millis() && WchWaitRX) {
             log_e("Timeout");
             WchWaitRX = 0;
+            RXlen = 0;
+            if (WchState == WCH_SET_BAUDRATE) WchState = WCH_READ_OPTION;     // older bootloader, stay at 115200
         }
 
 
     } while (WchState != WCH_EXIT);             // keep looping until 0
+
+    _LOG_A("CH32 done in %lu ms.\n", millis() - StartTime);
 }
 
 /*
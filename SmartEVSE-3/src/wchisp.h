@@ -18,6 +18,9 @@
 #define WCH_TX_HEADER       0x57
 #define WCH_RX_HEADER       0x5A
 
+#define WCH_CHUNK_SIZE      56          // program/verify data per packet, the most the bootloader accepts
+#define WCH_FAST_BAUD       1000000     // baudrate requested from the bootloader, stays at 115200 if it refuses
+
 //#define WCHDEBUG           // Display serial comm
 
 
@@ -0,0 +1,45 @@
+/*
+ * Host build of the CH32 reflash (wchisp.cpp)
+ *
+ * The parts of the Arduino core the reflash uses. Serial1 is the UART to the emulated CH32 bootloader, millis()
+ * and delay() run on the simulated clock of the emulator, so the reported times include the UART at the set
+ * baudrate.
+ */
+
+#ifndef __HOST_ARDUINO_H
+#define __HOST_ARDUINO_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#define LOW 0
+#define HIGH 1
+#define INPUT 0
+#define OUTPUT 1
+
+unsigned long millis(void);
+void delay(unsigned long ms);
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+
+class HardwareSerial {
+public:
+    size_t write(const uint8_t *buf, size_t len);
+    int available(void);
+    int read(void);
+    void flush(void);
+    void updateBaudRate(unsigned long baud);
+};
+
+extern HardwareSerial Serial1;
+
+extern int hostLogLevel;                                                        // 1 = errors .. 4 = debug
+void hostLog(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+#define log_e(fmt, ...) hostLog(1, fmt "\n", ##__VA_ARGS__)
+#define log_d(fmt, ...) hostLog(4, fmt "\n", ##__VA_ARGS__)
+
+#endif
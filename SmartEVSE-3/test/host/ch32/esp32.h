@@ -0,0 +1,17 @@
+/*
+ * Host build of the CH32 reflash: the part of esp32.h the reflash uses.
+ */
+
+#ifndef __EVSE_ESP32
+#define __EVSE_ESP32
+
+#include <Arduino.h>
+#include "funconfig.h"
+
+#define WCH_NRST 8                                                              // drive the bootloader entry of the emulator
+#define WCH_SWCLK 18
+
+#define _LOG_A(fmt, ...) hostLog(2, fmt, ##__VA_ARGS__)
+#define _LOG_D(fmt, ...) hostLog(4, fmt "\n", ##__VA_ARGS__)
+
+#endif
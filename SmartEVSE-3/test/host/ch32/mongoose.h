@@ -0,0 +1,23 @@
+/*
+ * Host build of the CH32 reflash: the packed filesystem holds the one firmware image set by the test.
+ */
+
+#ifndef __HOST_MONGOOSE_H
+#define __HOST_MONGOOSE_H
+
+#include <cstddef>
+#include <ctime>
+
+enum { MG_FS_READ = 1, MG_FS_WRITE = 2, MG_FS_DIR = 4 };
+
+struct mg_fs {
+    int (*st)(const char *path, size_t *size, time_t *mtime);
+    void *(*op)(const char *path, int flags);
+    void (*cl)(void *fd);
+    size_t (*rd)(void *fd, void *buf, size_t len);
+    size_t (*sk)(void *fd, size_t offset);
+};
+
+extern struct mg_fs mg_fs_packed;
+
+#endif
@@ -0,0 +1,406 @@
+/*
+ * Host test of the CH32 reflash
+ *
+ * Runs the unmodified wchisp.cpp of the v4 firmware against an emulated CH32V203 serial bootloader. The
+ * emulator implements the request/reply framing, the baudrate switch, the XOR key and a 64 KB flash that can
+ * only be erased as a whole and programmed from 0xff. Each scenario starts the CH32 with some flash content and
+ * checks what the reflash did to it: erased or left alone, the final flash content, and the commands it took.
+ *
+ * Time is simulated: the UART costs 10 bit times per byte at the baudrate in use, and erase, program and verify
+ * take the times below, so the reported durations compare baudrates and the compare pass, not host speed.
+ *
+ * usage: ch32_reflash [-v level] scenario|list
+ */
+
+#include <cstdarg>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+#include "esp32.h"
+#include "mongoose.h"
+#include "wchisp.h"
+
+#define FLASH_SIZE 65536
+#define IMAGE_SIZE 23552                                                        // 23 KB, the size of a current CH32 build
+#define IMAGE_TIME 1700000000
+#define SIMULATION_TIMEOUT 120000000ULL                                         // us
+
+#define ERASE_US 48000                                                          // 16 pages of 4 KB at 3 ms
+#define PROGRAM_US 200                                                          // per 56 byte packet
+#define VERIFY_US 50
+
+int hostLogLevel = 2;
+static uint64_t hostUs = 0;
+
+struct SimulationEnd {
+    std::string Reason;
+};
+
+void hostLog(int level, const char *fmt, ...) {
+    va_list args;
+
+    if (level > hostLogLevel) return;
+    printf("%10.3f ", hostUs / 1000.0);
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+}
+
+unsigned long millis(void) {
+    return hostUs / 1000;
+}
+
+void delay(unsigned long ms) {
+    hostUs += ms * 1000ULL;
+}
+
+// The firmware draws the progress on the LCD
+void glcd_clrln(unsigned char ln, unsigned char data) { (void)ln; (void)data; }
+void GLCD_print_buf2(unsigned char y, const char *str) { (void)y; (void)str; }
+
+/*
+ * The CH32V203 serial bootloader
+ */
+
+struct Bootloader {
+    uint8_t Flash[FLASH_SIZE];
+    uint8_t Uid[8] = {0xcd, 0xab, 0x1f, 0x59, 0x3c, 0x6b, 0x95, 0x12};
+    bool SetBaudrate = true;                                                    // false: an older bootloader, no reply
+    bool RefuseBaudrate = false;                                                // replies with an error status
+    bool Running = true;                                                        // the application runs, not the bootloader
+    unsigned long Baud = 115200;
+    uint8_t XorKey = 0;
+
+    std::vector<uint8_t> Request;
+    std::deque<uint8_t> Reply;
+    uint64_t ReplyAt = 0;                                                       // the reply has arrived at the ESP32
+
+    unsigned Frames = 0, Garbled = 0, Erases = 0, Programs = 0, Verifies = 0, Mismatches = 0, Stops = 0;
+    unsigned long HostBaud = 115200;
+    unsigned long ProgramBaud = 0;                                              // baudrate of the last program or verify
+
+    void reset(bool boot0) {
+        Running = !boot0;
+        Baud = 115200;
+        XorKey = 0;
+        Request.clear();
+        Reply.clear();
+    }
+
+    void reply(uint8_t cmd, const uint8_t *data, uint8_t len, unsigned processUs) {
+        std::vector<uint8_t> frame = {0x55, 0xaa, cmd, 0, len, 0};
+        uint8_t sum = 0;
+
+        frame.insert(frame.end(), data, data + len);
+        for (size_t i = 2; i < frame.size(); i++) sum += frame[i];
+        frame.push_back(sum);
+        Reply.assign(frame.begin(), frame.end());
+        ReplyAt = hostUs + processUs + frame.size() * 10000000ULL / Baud;
+    }
+
+    void status(uint8_t cmd, uint8_t status, unsigned processUs) {
+        const uint8_t data[2] = {status, 0};
+
+        reply(cmd, data, 2, processUs);
+    }
+
+    // A complete request from the ESP32
+    void handle(uint8_t cmd, const uint8_t *data, uint16_t len) {
+        uint32_t address;
+
+        Frames++;
+        switch (cmd) {
+            case WCH_START: {
+                const uint8_t id[2] = {0x31, 0x19};                             // CH32V203
+                reply(cmd, id, 2, 100);
+                break;
+            }
+            case WCH_SET_BAUDRATE:
+                if (!SetBaudrate) break;
+                if (RefuseBaudrate || len != 4) {
+                    status(cmd, 0xfe, 100);
+                    break;
+                }
+                status(cmd, 0, 100);                                            // sent at the old baudrate
+                Baud = data[0] | data[1] << 8 | data[2] << 16 | (uint32_t)data[3] << 24;
+                break;
+            case WCH_READ_OPTION: {
+                uint8_t option[26] = {0};
+                memcpy(option + 18, Uid, 8);                                    // at WchRXbuf[24]
+                XorKey = 0;
+                for (uint8_t b : Uid) XorKey += b;
+                reply(cmd, option, sizeof(option), 100);
+                break;
+            }
+            case WCH_WRITE_OPTION:
+                status(cmd, 0, 2000);
+                break;
+            case WCH_SET_KEY:
+                status(cmd, 0x89, 100);                                         // BTVER 2.7
+                break;
+            case WCH_ERASE_FLASH:
+                memset(Flash, 0xff, sizeof(Flash));
+                Erases++;
+                status(cmd, 0, ERASE_US);
+                break;
+            case WCH_PROGRAM_FLASH:
+            case WCH_VERIFY_FLASH: {
+                bool match = true;
+
+                if (len < 5) {
+                    status(cmd, 0xfe, 10);
+                    break;
+                }
+                address = data[0] | data[1] << 8 | data[2] << 16 | (uint32_t)data[3] << 24;
+                ProgramBaud = Baud;
+                for (uint16_t x = 0; x < len - 5; x++) {
+                    uint8_t b = data[5 + x] ^ ((x & 7) == 7 ? (uint8_t)(XorKey + 0x31) : XorKey);
+                    if (address + x >= FLASH_SIZE) {
+                        match = false;
+                        continue;
+                    }
+                    if (cmd == WCH_PROGRAM_FLASH) Flash[address + x] &= b;      // bits can only be cleared
+                    else if (Flash[address + x] != b) match = false;
+                }
+                if (cmd == WCH_PROGRAM_FLASH) {
+                    Programs++;
+                    status(cmd, match ? 0 : 0xfe, PROGRAM_US);
+                } else {
+                    Verifies++;
+                    if (!match) Mismatches++;
+                    status(cmd, match ? 0 : 0xf5, VERIFY_US);                   // the verify status is byte 6
+                }
+                break;
+            }
+            case WCH_STOP:
+                Stops++;
+                status(cmd, 0, 100);
+                break;
+            default:
+                status(cmd, 0xfe, 10);
+                break;
+        }
+    }
+
+    // Bytes from the ESP32, at the baudrate the ESP32 uses
+    void receive(const uint8_t *buf, size_t len) {
+        hostUs += len * 10000000ULL / HostBaud;
+        if (Running) return;
+        if (HostBaud != Baud) {
+            Garbled++;
+            return;
+        }
+        Request.insert(Request.end(), buf, buf + len);
+        while (Request.size() >= 6) {
+            uint16_t n = Request[3] | Request[4] << 8;
+            uint8_t sum = 0;
+
+            if (Request[0] != 0x57 || Request[1] != 0xab) {
+                Request.erase(Request.begin());
+                Garbled++;
+                continue;
+            }
+            if (Request.size() < (size_t)n + 6) break;
+            for (size_t i = 2; i < (size_t)n + 5; i++) sum += Request[i];
+            if (sum == Request[n + 5]) handle(Request[2], &Request[5], n);
+            else Garbled++;
+            Request.erase(Request.begin(), Request.begin() + n + 6);
+        }
+    }
+};
+
+static Bootloader ch32;
+static bool boot0 = false;
+
+void pinMode(uint8_t pin, uint8_t mode) {
+    if (pin == WCH_NRST && mode == INPUT) ch32.reset(boot0);                    // out of reset, into the bootloader or the application
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+    if (pin == WCH_SWCLK) boot0 = value;
+}
+
+HardwareSerial Serial1;
+
+size_t HardwareSerial::write(const uint8_t *buf, size_t len) {
+    ch32.receive(buf, len);
+    return len;
+}
+
+int HardwareSerial::available(void) {
+    if (hostUs > SIMULATION_TIMEOUT) throw SimulationEnd{"the reflash did not finish"};
+    if (!ch32.Reply.empty() && hostUs >= ch32.ReplyAt) return ch32.Reply.size();
+    hostUs += 10;                                                               // the firmware polls in a loop
+    return 0;
+}
+
+int HardwareSerial::read(void) {
+    int b;
+
+    if (ch32.Reply.empty() || hostUs < ch32.ReplyAt) return -1;
+    b = ch32.Reply.front();
+    ch32.Reply.pop_front();
+    return b;
+}
+
+void HardwareSerial::flush(void) {}
+
+void HardwareSerial::updateBaudRate(unsigned long baud) {
+    ch32.HostBaud = baud;
+}
+
+/*
+ * The firmware image in the packed filesystem
+ */
+
+static std::vector<uint8_t> image;
+static size_t imagePos;
+
+struct mg_fs mg_fs_packed = {
+    [](const char *path, size_t *size, time_t *mtime) {
+        if (strcmp(path, "/data/CH32V203.bin")) return 0;
+        *size = image.size();
+        *mtime = IMAGE_TIME;
+        return 1;
+    },
+    [](const char *path, int flags) -> void * {
+        (void)flags;
+        imagePos = 0;
+        return strcmp(path, "/data/CH32V203.bin") ? NULL : &image;
+    },
+    [](void *fd) { (void)fd; },
+    [](void *fd, void *buf, size_t len) {
+        (void)fd;
+        len = imagePos < image.size() ? std::min(len, image.size() - imagePos) : 0;
+        memcpy(buf, image.data() + imagePos, len);
+        imagePos += len;
+        return len;
+    },
+    [](void *fd, size_t offset) {
+        (void)fd;
+        imagePos = offset;
+        return offset;
+    },
+};
+
+/*
+ * Scenarios
+ */
+
+struct Scenario {
+    const char *Name;
+    const char *Description;
+    unsigned long RunningVersion;                                               // as reported by the CH32
+    std::function<void(void)> Setup;
+    std::function<void(std::vector<std::string> &errors)> Check;
+};
+
+static void expect(std::vector<std::string> &errors, bool ok, const char *fmt, ...) {
+    char buf[200];
+    va_list args;
+
+    if (ok) return;
+    va_start(args, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    errors.push_back(buf);
+}
+
+static void checkFlashed(std::vector<std::string> &errors) {
+    expect(errors, ch32.Erases == 1, "%u erases", ch32.Erases);
+    expect(errors, memcmp(ch32.Flash, image.data(), image.size()) == 0, "the flash does not hold the image");
+    expect(errors, ch32.Stops == 1, "%u stop commands", ch32.Stops);
+}
+
+static void checkUntouched(std::vector<std::string> &errors) {
+    expect(errors, ch32.Erases == 0, "%u erases", ch32.Erases);
+    expect(errors, ch32.Programs == 0, "%u program commands", ch32.Programs);
+    expect(errors, memcmp(ch32.Flash, image.data(), image.size()) == 0, "the flash does not hold the image");
+    expect(errors, ch32.Stops == 1, "%u stop commands", ch32.Stops);
+}
+
+static const Scenario Scenarios[] = {
+    {"blank", "Erased CH32: the compare fails on the first packet, the image is programmed at 1 Mbaud",
+     IMAGE_TIME - 3600, NULL,
+     [](std::vector<std::string> &errors) {
+         checkFlashed(errors);
+         expect(errors, ch32.ProgramBaud == WCH_FAST_BAUD, "programmed at %lu baud", ch32.ProgramBaud);
+     }},
+
+    {"unchanged", "The CH32 already holds the image: compared, not erased or programmed",
+     IMAGE_TIME - 3600, []() { memcpy(ch32.Flash, image.data(), image.size()); }, checkUntouched},
+
+    {"changed-last", "Only the last packet differs: the compare runs to the end, then the CH32 is reflashed",
+     IMAGE_TIME - 3600,
+     []() {
+         memcpy(ch32.Flash, image.data(), image.size());
+         ch32.Flash[image.size() - 1] ^= 0x01;
+     },
+     checkFlashed},
+
+    {"old-bootloader", "The bootloader does not answer the baudrate command: the reflash stays at 115200",
+     IMAGE_TIME - 3600, []() { ch32.SetBaudrate = false; },
+     [](std::vector<std::string> &errors) {
+         checkFlashed(errors);
+         expect(errors, ch32.ProgramBaud == 115200, "programmed at %lu baud", ch32.ProgramBaud);
+     }},
+
+    {"refused-baud", "The bootloader refuses 1 Mbaud: the reflash stays at 115200",
+     IMAGE_TIME - 3600, []() { ch32.RefuseBaudrate = true; },
+     [](std::vector<std::string> &errors) {
+         checkFlashed(errors);
+         expect(errors, ch32.ProgramBaud == 115200, "programmed at %lu baud", ch32.ProgramBaud);
+     }},
+
+    {"up-to-date", "The CH32 runs a build at least as new as the image: the bootloader is not entered",
+     IMAGE_TIME, NULL,
+     [](std::vector<std::string> &errors) {
+         expect(errors, ch32.Frames == 0, "%u commands sent", ch32.Frames);
+     }},
+};
+
+static void usage(void) {
+    fprintf(stderr, "usage: ch32_reflash [-v level] scenario|list\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[]) {
+    const Scenario *scenario = NULL;
+    const char *name = NULL;
+    std::vector<std::string> errors;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-v") && i + 1 < argc) hostLogLevel = atoi(argv[++i]);
+        else if (argv[i][0] == '-' || name) usage();
+        else name = argv[i];
+    }
+    if (!name) usage();
+    for (const Scenario &s : Scenarios) {
+        if (!strcmp(name, "list")) printf("%-14s %s\n", s.Name, s.Description);
+        else if (!strcmp(name, s.Name)) scenario = &s;
+    }
+    if (!strcmp(name, "list")) return 0;
+    if (!scenario) usage();
+
+    srand(1);
+    image.resize(IMAGE_SIZE);
+    for (uint8_t &b : image) b = rand();
+    memset(ch32.Flash, 0xff, sizeof(ch32.Flash));
+    if (scenario->Setup) scenario->Setup();
+
+    try {
+        WchFirmwareUpdate(scenario->RunningVersion);
+    } catch (const SimulationEnd &e) {
+        errors.push_back(e.Reason);
+    }
+    if (ch32.Garbled) errors.push_back(std::to_string(ch32.Garbled) + " garbled requests");
+    scenario->Check(errors);
+
+    printf("%s: %s\n", scenario->Name, scenario->Description);
+    printf("  %.0f ms, %u commands: %u verify (%u mismatch), %u erase, %u program\n", hostUs / 1000.0,
+           ch32.Frames, ch32.Verifies, ch32.Mismatches, ch32.Erases, ch32.Programs);
+    for (const std::string &e : errors) printf("  FAIL: %s\n", e.c_str());
+    printf("%s: %s\n\n", scenario->Name, errors.empty() ? "PASS" : "FAIL");
+    return errors.empty() ? 0 : 1;
+}
@@ -0,0 +1,281 @@
+/*
+ * Host test and benchmark of the EXI bitstream reader and writer (exi2/exi_bitstream.c)
+ *
+ * exi_bitstream.c reads and writes a bit field a word at a time. reference.c is the bit-by-bit version it
+ * replaced. Both run the same accesses on copies of the same buffer.
+ *
+ *   random     200000 streams of random reads and writes of 0..33 bits and octets, at random offsets: values,
+ *              buffer, position and length match the reference while the access fits in data_size bytes;
+ *              an access that does not fit fails, and leaves the stream and buffer as they were
+ *   overflow   the last bits of a buffer: an access past data_size fails, and the byte after the buffer,
+ *              which the reference wrote, is not touched
+ *   speed      ns per field of a mix like the codec's, against the reference
+ *
+ * usage: exi_bitstream list|random|overflow|speed
+ */
+
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include "exi_bitstream.h"
+#include "exi_error_codes.h"
+
+extern "C" {
+void ref_exi_bitstream_init(exi_bitstream_t *stream, uint8_t *data, size_t data_size, size_t data_offset, exi_status_callback status_callback);
+void ref_exi_bitstream_reset(exi_bitstream_t *stream);
+size_t ref_exi_bitstream_get_length(const exi_bitstream_t *stream);
+int ref_exi_bitstream_write_bits(exi_bitstream_t *stream, size_t bit_count, uint32_t value);
+int ref_exi_bitstream_write_octet(exi_bitstream_t *stream, uint8_t value);
+int ref_exi_bitstream_read_bits(exi_bitstream_t *stream, size_t bit_count, uint32_t *value);
+int ref_exi_bitstream_read_octet(exi_bitstream_t *stream, uint8_t *value);
+}
+
+#define GUARD 8                                                                 // bytes after the buffer that must stay untouched
+#define GUARD_BYTE 0xa5
+
+enum Op { WRITE_BITS, WRITE_OCTET, READ_BITS, READ_OCTET, RESET };
+static const char *OpNames[] = {"write_bits", "write_octet", "read_bits", "read_octet", "reset"};
+
+/*
+ * Checks
+ */
+
+static void expect(std::vector<std::string> &errors, bool ok, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+static void expect(std::vector<std::string> &errors, bool ok, const char *fmt, ...) {
+    char buf[256];
+    va_list args;
+
+    if (ok) return;
+    va_start(args, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    if (errors.size() < 20) errors.push_back(buf);
+    else if (errors.size() == 20) errors.push_back("...");
+}
+
+static bool report(const char *name, const std::vector<std::string> &errors) {
+    for (const std::string &e : errors) printf("  FAIL: %s\n", e.c_str());
+    printf("%s: %s\n\n", name, errors.empty() ? "PASS" : "FAIL");
+    return errors.empty();
+}
+
+static size_t bitPos(const exi_bitstream_t &s) { return s.byte_pos * 8 + s.bit_count; }
+
+static bool sameStream(const exi_bitstream_t &a, const exi_bitstream_t &b) {
+    return a.byte_pos == b.byte_pos && a.bit_count == b.bit_count;
+}
+
+static bool guardIntact(const std::vector<uint8_t> &buf, size_t size) {
+    for (size_t i = size; i < buf.size(); i++)
+        if (buf[i] != GUARD_BYTE) return false;
+    return true;
+}
+
+// One access on both streams; returns false when the stream can not go on
+static bool step(std::vector<std::string> &errors, unsigned trial, Op op, size_t bits, uint32_t value, exi_bitstream_t &fast,
+                 exi_bitstream_t &ref, std::vector<uint8_t> &fastBuf, std::vector<uint8_t> &refBuf, size_t size) {
+    const exi_bitstream_t before = fast;
+    const std::vector<uint8_t> bufBefore = fastBuf;
+    uint32_t fastValue = 0, refValue = 0;
+    uint8_t fastOctet = 0, refOctet = 0;
+    int fastError = 0, refError = 0;
+
+    if (op == WRITE_OCTET || op == READ_OCTET) bits = 8;
+    const bool fits = bits > 32 || op == RESET || bitPos(fast) + bits <= size * 8;
+
+    switch (op) {
+        case WRITE_BITS:
+            fastError = exi_bitstream_write_bits(&fast, bits, value);
+            refError = fits ? ref_exi_bitstream_write_bits(&ref, bits, value) : 0;
+            break;
+        case WRITE_OCTET:
+            fastError = exi_bitstream_write_octet(&fast, value);
+            refError = fits ? ref_exi_bitstream_write_octet(&ref, value) : 0;
+            break;
+        case READ_BITS:
+            fastError = exi_bitstream_read_bits(&fast, bits, &fastValue);
+            refError = fits ? ref_exi_bitstream_read_bits(&ref, bits, &refValue) : 0;
+            break;
+        case READ_OCTET:
+            fastError = exi_bitstream_read_octet(&fast, &fastOctet);
+            refError = fits ? ref_exi_bitstream_read_octet(&ref, &refOctet) : 0;
+            break;
+        case RESET:
+            exi_bitstream_reset(&fast);
+            ref_exi_bitstream_reset(&ref);
+            break;
+    }
+
+    expect(errors, guardIntact(fastBuf, size), "trial %u: %s of %zu bits at %zu wrote past the buffer", trial, OpNames[op], bits, bitPos(before));
+    if (!fits) {
+        expect(errors, fastError == EXI_ERROR__BITSTREAM_OVERFLOW, "trial %u: %s of %zu bits at %zu of %zu: error %d, not overflow",
+               trial, OpNames[op], bits, bitPos(before), size * 8, fastError);
+        expect(errors, sameStream(fast, before) && fastBuf == bufBefore, "trial %u: failed %s changed the stream", trial, OpNames[op]);
+        return false;
+    }
+    expect(errors, fastError == refError, "trial %u: %s of %zu bits: error %d, reference %d", trial, OpNames[op], bits, fastError, refError);
+    expect(errors, fastValue == refValue && fastOctet == refOctet, "trial %u: %s of %zu bits at %zu: %x, reference %x", trial,
+           OpNames[op], bits, bitPos(before), fastValue | fastOctet, refValue | refOctet);
+    expect(errors, !memcmp(fastBuf.data(), refBuf.data(), size), "trial %u: %s of %zu bits at %zu: buffer differs", trial, OpNames[op],
+           bits, bitPos(before));
+    expect(errors, sameStream(fast, ref) && exi_bitstream_get_length(&fast) == ref_exi_bitstream_get_length(&ref),
+           "trial %u: %s of %zu bits: at %zu.%u, reference %zu.%u", trial, OpNames[op], bits, fast.byte_pos, fast.bit_count,
+           ref.byte_pos, ref.bit_count);
+    return !fastError || fastError == EXI_ERROR__BIT_COUNT_LARGER_THAN_TYPE_SIZE;
+}
+
+/*
+ * Scenarios
+ */
+
+static bool randomStreams(void) {
+    std::vector<std::string> errors;
+    std::mt19937 rng(1);
+    const unsigned trials = 200000;
+    unsigned accesses = 0, failed = 0;
+
+    for (unsigned trial = 0; trial < trials; trial++) {
+        const size_t size = 1 + rng() % 40, offset = rng() % 4 % size;
+        std::vector<uint8_t> fastBuf(size + GUARD, GUARD_BYTE), refBuf;
+        for (size_t i = 0; i < size; i++) fastBuf[i] = rng();
+        refBuf = fastBuf;
+
+        exi_bitstream_t fast, ref;
+        exi_bitstream_init(&fast, fastBuf.data(), size, offset, NULL);
+        ref_exi_bitstream_init(&ref, refBuf.data(), size, offset, NULL);
+
+        for (unsigned n = 0; n < 64; n++) {
+            const unsigned r = rng() % 100;
+            const Op op = r < 40 ? WRITE_BITS : r < 50 ? WRITE_OCTET : r < 88 ? READ_BITS : r < 98 ? READ_OCTET : RESET;
+            accesses++;
+            if (!step(errors, trial, op, rng() % 34, rng(), fast, ref, fastBuf, refBuf, size)) {
+                failed++;
+                break;
+            }
+        }
+    }
+    printf("random: %u streams, %u accesses, %u ended on an access past the buffer\n", trials, accesses, failed);
+    return report("random", errors);
+}
+
+static bool overflow(void) {
+    std::vector<std::string> errors;
+    const size_t size = 4;
+    std::vector<uint8_t> fastBuf(size + GUARD, GUARD_BYTE), refBuf(size + GUARD, GUARD_BYTE);
+    exi_bitstream_t fast, ref;
+
+    exi_bitstream_init(&fast, fastBuf.data(), size, 0, NULL);
+    ref_exi_bitstream_init(&ref, refBuf.data(), size, 0, NULL);
+
+    expect(errors, step(errors, 0, WRITE_BITS, 30, 0x2aaaaaaa, fast, ref, fastBuf, refBuf, size), "30 bits of 32 not written");
+    expect(errors, !step(errors, 0, WRITE_BITS, 3, 7, fast, ref, fastBuf, refBuf, size), "3 bits written in the last 2");
+    expect(errors, step(errors, 0, WRITE_BITS, 2, 3, fast, ref, fastBuf, refBuf, size), "the last 2 bits not written");
+    expect(errors, exi_bitstream_get_length(&fast) == size, "length %zu of a full buffer", exi_bitstream_get_length(&fast));
+    expect(errors, !step(errors, 0, WRITE_OCTET, 8, 0, fast, ref, fastBuf, refBuf, size), "octet written past the buffer");
+    expect(errors, !step(errors, 0, WRITE_BITS, 1, 1, fast, ref, fastBuf, refBuf, size), "bit written past the buffer");
+
+    exi_bitstream_reset(&fast);
+    ref_exi_bitstream_reset(&ref);
+    uint32_t value;
+    expect(errors, !exi_bitstream_read_bits(&fast, 32, &value) && value == 0xaaaaaaab, "read back %08x", value);
+    expect(errors, exi_bitstream_read_bits(&fast, 1, &value) == EXI_ERROR__BITSTREAM_OVERFLOW, "bit read past the buffer");
+    expect(errors, guardIntact(fastBuf, size), "the byte after the buffer was written");
+
+    // The reference wrote the byte after the buffer before it reported the overflow
+    ref_exi_bitstream_write_bits(&ref, 32, 0);
+    ref_exi_bitstream_write_bits(&ref, 1, 0);
+    expect(errors, !guardIntact(refBuf, size), "the check of the byte after the buffer misses the reference's overrun");
+    return report("overflow", errors);
+}
+
+struct Codec {
+    const char *Name;
+    void (*Init)(exi_bitstream_t *, uint8_t *, size_t, size_t, exi_status_callback);
+    int (*WriteBits)(exi_bitstream_t *, size_t, uint32_t);
+    int (*ReadBits)(exi_bitstream_t *, size_t, uint32_t *);
+};
+
+static bool speed(void) {
+    std::vector<std::string> errors;
+    std::mt19937 rng(1);
+    std::vector<uint8_t> buf(1024);
+    std::vector<uint8_t> fields;
+    size_t totalBits = 0;
+
+    // Mostly event codes and 7-bit chunks of unsigned integers, some octets of strings, now and then a 16 or 32 bit field
+    while (totalBits < buf.size() * 8 - 32) {
+        const unsigned r = rng() % 100;
+        const uint8_t bits = r < 45 ? 1 + rng() % 6 : r < 75 ? 7 : r < 95 ? 8 : r < 98 ? 16 : 32;
+        fields.push_back(bits);
+        totalBits += bits;
+    }
+
+    const Codec codecs[] = {
+        {"word", exi_bitstream_init, exi_bitstream_write_bits, exi_bitstream_read_bits},
+        {"reference", ref_exi_bitstream_init, ref_exi_bitstream_write_bits, ref_exi_bitstream_read_bits},
+    };
+    double ns[2][2];
+    const unsigned rounds = 200;
+
+    for (unsigned c = 0; c < 2; c++) {
+        const Codec &codec = codecs[c];
+        exi_bitstream_t stream;
+        uint32_t sum = 0, value;
+
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned r = 0; r < rounds; r++) {
+            codec.Init(&stream, buf.data(), buf.size(), 0, NULL);
+            for (size_t i = 0; i < fields.size(); i++) codec.WriteBits(&stream, fields[i], i * 2654435761u);
+        }
+        auto mid = std::chrono::steady_clock::now();
+        for (unsigned r = 0; r < rounds; r++) {
+            codec.Init(&stream, buf.data(), buf.size(), 0, NULL);
+            for (size_t i = 0; i < fields.size(); i++) {
+                codec.ReadBits(&stream, fields[i], &value);
+                sum += value;
+            }
+        }
+        auto end = std::chrono::steady_clock::now();
+        ns[c][0] = std::chrono::duration<double, std::nano>(mid - start).count() / (rounds * fields.size());
+        ns[c][1] = std::chrono::duration<double, std::nano>(end - mid).count() / (rounds * fields.size());
+
+        uint32_t expected = 0;
+        for (size_t i = 0; i < fields.size(); i++)
+            expected += (uint32_t)(i * 2654435761u) & (0xffffffffu >> (32 - fields[i]));
+        expect(errors, sum == expected * rounds, "%s: read back other values than written", codec.Name);
+    }
+    printf("speed: %zu fields of %.1f bits on average\n", fields.size(), (double)totalBits / fields.size());
+    printf("  write %.1f ns per field, reference %.1f ns\n", ns[0][0], ns[1][0]);
+    printf("  read  %.1f ns per field, reference %.1f ns\n", ns[0][1], ns[1][1]);
+    return report("speed", errors);
+}
+
+static const struct {
+    const char *Name;
+    bool (*Run)(void);
+} Scenarios[] = {
+    {"random", randomStreams},
+    {"overflow", overflow},
+    {"speed", speed},
+};
+
+static void usage(void) {
+    printf("usage: exi_bitstream list|random|overflow|speed\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) usage();
+    if (!strcmp(argv[1], "list")) {
+        for (const auto &s : Scenarios) printf("%s\n", s.Name);
+        return 0;
+    }
+    for (const auto &s : Scenarios)
+        if (!strcmp(argv[1], s.Name)) return s.Run() ? 0 : 1;
+    usage();
+}
@@ -0,0 +1,60 @@
+/*
+ * Host build of the HomeWizard meter client (homewizard.cpp)
+ *
+ * The parts of the Arduino core and FreeRTOS the client uses. The tasks are threads, and millis() runs
+ * hostSpeed times faster than the host clock, so a few seconds of test cover minutes of polling while the
+ * HTTP requests still go over real sockets to the stand-in meters.
+ */
+
+#ifndef __HOST_ARDUINO_H
+#define __HOST_ARDUINO_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdarg>
+#include <string>
+
+unsigned long millis(void);
+void delay(unsigned long ms);
+
+extern int hostLogLevel;                                                        // 1 = errors .. 4 = debug
+void hostLog(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+class String : public std::string {
+public:
+    String(const char *str = "") : std::string(str) {}
+    String(const std::string &str) : std::string(str) {}
+    int indexOf(char c) const {
+        const size_t pos = find(c);
+        return pos == npos ? -1 : (int)pos;
+    }
+    String substring(size_t from, size_t to) const { return String(substr(from, to - from)); }
+};
+
+class IPAddress {
+    uint32_t Address = 0;
+public:
+    IPAddress() {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : Address(a | b << 8 | c << 16 | (uint32_t)d << 24) {}
+    operator uint32_t() const { return Address; }
+};
+
+struct HostEsp {
+    uint64_t getEfuseMac(void) { return 0x0000a1b2c3d4e5f6ULL; }
+};
+extern HostEsp ESP;
+
+// FreeRTOS, every task is a thread
+typedef uint32_t TickType_t;
+typedef void *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+#define portTICK_PERIOD_MS 1
+#define pdPASS 1
+int xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack, void *param, int priority, TaskHandle_t *handle);
+static inline TickType_t xTaskGetTickCount(void) { return millis(); }
+static inline void vTaskDelay(TickType_t ticks) { delay(ticks); }
+void vTaskDelayUntil(TickType_t *previous, TickType_t increment);
+
+#endif
@@ -0,0 +1,18 @@
+/*
+ * Host build of the HomeWizard meter client: just enough of ArduinoJson for homewizardStats().
+ */
+
+#ifndef __HOST_ARDUINOJSON_H
+#define __HOST_ARDUINOJSON_H
+
+#include <map>
+#include <string>
+
+class JsonObject {
+    std::map<std::string, long> *Values;
+public:
+    explicit JsonObject(std::map<std::string, long> *values) : Values(values) {}
+    long &operator[](const char *key) { return (*Values)[key]; }
+};
+
+#endif
@@ -0,0 +1,55 @@
+/*
+ * Host build of the HomeWizard meter client: an HTTP/1.1 client over real sockets, with the connection reuse,
+ * timeouts and error codes of the ESP32 HTTPClient. Host names are looked up in the stand-in meters.
+ */
+
+#ifndef __HOST_HTTPCLIENT_H
+#define __HOST_HTTPCLIENT_H
+
+#include <Arduino.h>
+
+#define HTTP_CODE_OK 200
+#define HTTPC_ERROR_CONNECTION_REFUSED (-1)
+#define HTTPC_ERROR_SEND_HEADER_FAILED (-2)
+#define HTTPC_ERROR_NOT_CONNECTED (-4)
+#define HTTPC_ERROR_CONNECTION_LOST (-5)
+#define HTTPC_ERROR_NO_HTTP_SERVER (-7)
+#define HTTPC_ERROR_READ_TIMEOUT (-11)
+
+class WiFiClient {
+public:
+    int Fd = -1;
+    std::string Rx;                                                             // received, not read yet
+    unsigned long Timeout = 5000;                                               // ms
+
+    bool connect(uint16_t port, unsigned long timeout);
+    void stop(void);
+    bool receive(unsigned long timeout);                                        // wait for more data, false on timeout or close
+    int available(void);
+    size_t readBytes(char *buf, size_t len);
+};
+
+class HTTPClient {
+public:
+    static bool Legacy;                                                         // before mode: the connect timeout stays at 5 s
+
+    bool begin(const char *url);
+    void setReuse(bool reuse) { Reuse = reuse; }
+    void setConnectTimeout(int32_t ms) { if (!Legacy) ConnectTimeout = ms; }
+    void setTimeout(uint16_t ms) { Timeout = ms; }
+    void addHeader(const char *name, const char *value);
+    int GET(void);
+    void end(void);
+    WiFiClient *getStreamPtr(void) { return &Client; }
+    int getSize(void) { return Size; }
+
+private:
+    WiFiClient Client;
+    std::string Host, ConnectedHost, Path, Headers;
+    bool Reuse = true, CanReuse = false;
+    int32_t ConnectTimeout = 5000;
+    uint16_t Timeout = 5000;
+    int Size = -1;
+};
+
+#endif
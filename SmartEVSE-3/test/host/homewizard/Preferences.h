@@ -0,0 +1,30 @@
+/*
+ * Host build of the HomeWizard meter client: the settings namespace is a map in memory.
+ */
+
+#ifndef __HOST_PREFERENCES_H
+#define __HOST_PREFERENCES_H
+
+#include <map>
+#include <Arduino.h>
+
+class Preferences {
+public:
+    static std::map<std::string, std::string> Store;
+    bool begin(const char *name, bool readOnly) { (void)name; (void)readOnly; return true; }
+    void end(void) {}
+    String getString(const char *key, const char *def) { return Store.count(key) ? String(Store[key]) : String(def); }
+    size_t putString(const char *key, const char *value) { Store[key] = value; return strlen(value); }
+    size_t putBytes(const char *key, const void *value, size_t len) {
+        Store[key].assign((const char *)value, len);
+        return len;
+    }
+    size_t getBytes(const char *key, void *buf, size_t maxLen) {
+        if (!Store.count(key) || Store[key].size() > maxLen) return 0;
+        memcpy(buf, Store[key].data(), Store[key].size());
+        return Store[key].size();
+    }
+    bool remove(const char *key) { return Store.erase(key); }
+};
+
+#endif
@@ -0,0 +1,19 @@
+/*
+ * Host build of the HomeWizard meter client: every host name resolves to the stand-in meters on the loopback.
+ */
+
+#ifndef __HOST_WIFI_H
+#define __HOST_WIFI_H
+
+#include <Arduino.h>
+
+struct HostWiFi {
+    int hostByName(const char *host, IPAddress &ip) {
+        (void)host;
+        ip = IPAddress(127, 0, 0, 1);
+        return 1;
+    }
+};
+extern HostWiFi WiFi;
+
+#endif
@@ -0,0 +1,20 @@
+/*
+ * Host build of the HomeWizard meter client: the part of esp32.h and main.h the client uses.
+ */
+
+#ifndef __EVSE_ESP32
+#define __EVSE_ESP32
+
+#include <Arduino.h>
+#include "meter.h"
+
+#define COMM_TIMEOUT 11                                                         // as in main.h
+
+extern uint8_t LoadBl;
+void CalcIsum(void);
+void write_settings(void);
+
+#define _LOG_A(fmt, ...) hostLog(3, fmt, ##__VA_ARGS__)
+#define _LOG_D(fmt, ...) hostLog(4, fmt, ##__VA_ARGS__)
+
+#endif
@@ -0,0 +1,145 @@
+/*
+ * Host build of the HomeWizard meter client: the HTTPClient, see HTTPClient.h.
+ */
+
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "HTTPClient.h"
+#include "standin.h"
+
+bool HTTPClient::Legacy = false;
+
+bool WiFiClient::connect(uint16_t port, unsigned long timeout) {
+    struct sockaddr_in addr = {};
+    int err = 0;
+    socklen_t len = sizeof(err);
+
+    Fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (Fd < 0) return false;
+    fcntl(Fd, F_SETFL, O_NONBLOCK);
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (::connect(Fd, (struct sockaddr *)&addr, sizeof(addr)) && errno != EINPROGRESS) err = errno;
+    else if (!hostWait(Fd, POLLOUT, timeout)) err = ETIMEDOUT;
+    else getsockopt(Fd, SOL_SOCKET, SO_ERROR, &err, &len);
+    if (err) {
+        stop();
+        return false;
+    }
+    const int one = 1;
+    setsockopt(Fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return true;
+}
+
+void WiFiClient::stop(void) {
+    if (Fd >= 0) close(Fd);
+    Fd = -1;
+    Rx.clear();
+}
+
+bool WiFiClient::receive(unsigned long timeout) {
+    char buf[1024];
+
+    if (Fd < 0 || !hostWait(Fd, POLLIN, timeout)) return false;
+    const ssize_t n = recv(Fd, buf, sizeof(buf), 0);
+    if (n <= 0) {
+        close(Fd);
+        Fd = -1;
+        return false;
+    }
+    Rx.append(buf, n);
+    return true;
+}
+
+int WiFiClient::available(void) {
+    while (Fd >= 0 && hostWait(Fd, POLLIN, 0) && receive(0));
+    return Rx.size();
+}
+
+size_t WiFiClient::readBytes(char *buf, size_t len) {
+    const unsigned long start = millis();
+
+    while (Rx.size() < len && millis() - start < Timeout && receive(Timeout - (millis() - start)));
+    len = len < Rx.size() ? len : Rx.size();
+    memcpy(buf, Rx.data(), len);
+    Rx.erase(0, len);
+    return len;
+}
+
+bool HTTPClient::begin(const char *url) {
+    const char *host = strstr(url, "://");
+    if (!host) return false;
+    host += 3;
+    const char *path = strchr(host, '/');
+    Host.assign(host, path ? path - host : strlen(host));
+    Path = path ? path : "/";
+    Headers.clear();
+    Size = -1;
+    if (Client.Fd >= 0 && Host != ConnectedHost) Client.stop();                 // another host, as the ESP32 client does
+    return true;
+}
+
+void HTTPClient::addHeader(const char *name, const char *value) {
+    Headers += std::string(name) + ": " + value + "\r\n";
+}
+
+int HTTPClient::GET(void) {
+    if (Client.Fd < 0) {
+        const int port = standinPort(Host.c_str());
+        if (port < 0) {                                                         // no answer to the SYN
+            delay(ConnectTimeout);
+            return HTTPC_ERROR_CONNECTION_REFUSED;
+        }
+        if (!port || !Client.connect(port, ConnectTimeout)) return HTTPC_ERROR_CONNECTION_REFUSED;
+        ConnectedHost = Host;
+    }
+    Client.Timeout = Timeout;
+    Client.Rx.clear();
+
+    const std::string request = "GET " + Path + " HTTP/1.1\r\nHost: " + Host + "\r\n" + Headers
+        + "Connection: " + (Reuse ? "keep-alive" : "close") + "\r\n\r\n";
+    if (send(Client.Fd, request.data(), request.size(), MSG_NOSIGNAL) != (ssize_t)request.size()) {
+        Client.stop();
+        return HTTPC_ERROR_SEND_HEADER_FAILED;
+    }
+
+    // Status line and headers
+    const unsigned long start = millis();
+    size_t end;
+    while ((end = Client.Rx.find("\r\n\r\n")) == std::string::npos) {
+        const unsigned long elapsed = millis() - start;
+        if (elapsed >= Timeout) {
+            Client.stop();
+            return HTTPC_ERROR_READ_TIMEOUT;
+        }
+        if (!Client.receive(Timeout - elapsed)) {
+            const bool lost = Client.Fd < 0;
+            Client.stop();
+            return lost ? HTTPC_ERROR_CONNECTION_LOST : HTTPC_ERROR_READ_TIMEOUT;
+        }
+    }
+    const std::string head = Client.Rx.substr(0, end);
+    Client.Rx.erase(0, end + 4);
+
+    int code = 0;
+    if (sscanf(head.c_str(), "HTTP/1.%*d %d", &code) != 1) {
+        Client.stop();
+        return HTTPC_ERROR_NO_HTTP_SERVER;
+    }
+    const char *length = strcasestr(head.c_str(), "\r\nContent-Length:");
+    Size = length ? atoi(length + 17) : -1;
+    CanReuse = Reuse && !strcasestr(head.c_str(), "\r\nConnection: close");
+    return code;
+}
+
+void HTTPClient::end(void) {
+    if (Client.Fd < 0) return;
+    if (CanReuse && Client.available() == 0) Client.Rx.clear();                 // keep the connection for the next request
+    else Client.stop();
+    CanReuse = false;
+}
@@ -0,0 +1,33 @@
+/*
+ * Host build of the HomeWizard meter client: the fields of the v3 Meter that a HomeWizard reading updates.
+ */
+
+#ifndef __EVSE_METER
+#define __EVSE_METER
+
+#include <cstdint>
+
+#define EM_HOMEWIZARD 13
+
+class Meter {
+  public:
+    uint8_t Type;
+    uint8_t Address;
+    char DeviceHostName[32];
+    int16_t Irms[3];
+    int16_t Imeasured;
+    int16_t PowerMeasured;
+    volatile uint8_t Timeout;                                                   // seconds, counted down by the harness
+    int32_t Import_active_energy;
+    int32_t Export_active_energy;
+
+    void UpdateEnergies(void) {}
+    void CalcImeasured(void);
+    void setTimeout(uint8_t timeout) { Timeout = timeout; }
+};
+
+extern Meter MainsMeter;
+extern Meter EVMeter;
+extern Meter CircuitMeter;
+
+#endif
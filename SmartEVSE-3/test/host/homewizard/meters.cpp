@@ -0,0 +1,550 @@
+/*
+ * Host test of the HomeWizard meter client
+ *
+ * Runs the unmodified homewizard.cpp of the v3 firmware against stand-in HomeWizard meters (standin.cpp) over
+ * real loopback sockets. Once per simulated second, as the 1 s timer of the firmware does before
+ * CalcBalancedCurrent(), the harness takes the age of the reading every meter holds and counts down its
+ * Timeout; a meter at 0 has no reading the load balancing may use.
+ *
+ * Most scenarios are run twice, at the same time in two processes:
+ *  - before: the polling as it was before the per-meter tasks. One pass every 1.95 s reads the meters one
+ *    after another through one shared HTTPClient, with the default connect timeout of 5 s.
+ *  - after: homewizard_loop(), one task per meter.
+ * The V2 scenarios also run the mongoose task with homewizard_timer_fn(), against the V2 API of the stand-in
+ * (v2.cpp); push compares its readings with V1 polling. The checks are on the after run, the report shows both.
+ *
+ * The decode scenario serves a table of V1 replies instead, each at once and in pieces of 5 bytes, and checks
+ * what getDataFromHomeWizard() makes of them.
+ *
+ * usage: homewizard_meters [-v level] scenario|decode|list
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "esp32.h"
+#include "network_common.h"
+#include "homewizard.h"
+#include "HTTPClient.h"
+#include "WiFi.h"
+#include "Preferences.h"
+#include "standin.h"
+
+#define DURATION 60000                                                          // simulated ms per run
+#define WARMUP 3000                                                             // before the first sample
+
+int hostLogLevel = 1;
+int hostSpeed = 20;
+
+static const std::chrono::steady_clock::time_point hostStart = std::chrono::steady_clock::now();
+static std::mutex logLock;
+
+void hostLog(int level, const char *fmt, ...) {
+    va_list args;
+
+    if (level > hostLogLevel) return;
+    std::lock_guard<std::mutex> lock(logLock);
+    fprintf(stderr, "%6lu ", millis());
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+}
+
+unsigned long millis(void) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - hostStart).count()
+        * hostSpeed / 1000;
+}
+
+void delay(unsigned long ms) {
+    std::this_thread::sleep_for(std::chrono::microseconds(ms * 1000ULL / hostSpeed));
+}
+
+int xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack, void *param, int priority, TaskHandle_t *handle) {
+    (void)name; (void)stack; (void)priority;
+    std::thread(fn, param).detach();
+    *handle = (TaskHandle_t)fn;
+    return pdPASS;
+}
+
+void vTaskDelayUntil(TickType_t *previous, TickType_t increment) {
+    *previous += increment;
+    const long wait = (long)(*previous - millis());
+    if (wait > 0) delay(wait);
+}
+
+uint64_t mg_millis(void) {
+    return millis();
+}
+
+HostEsp ESP;
+HostWiFi WiFi;
+std::map<std::string, std::string> Preferences::Store;
+
+/*
+ * The rest of the firmware
+ */
+
+Meter MainsMeter, EVMeter, CircuitMeter;
+uint8_t LoadBl = 0;
+unsigned long lastMdnsQueryTime = 0;
+
+void CalcIsum(void) {}
+void Meter::CalcImeasured(void) {}
+void write_settings(void) {}
+
+const mDNSServiceEntry *getmDNSServiceByIndex(int type, const String &hostnamePattern, uint8_t index, bool strict) {
+    (void)type; (void)hostnamePattern; (void)index; (void)strict;
+    return NULL;
+}
+
+static Meter *const Meters[HOMEWIZARD_DEVICES] = {&MainsMeter, &CircuitMeter, &EVMeter};
+static const char *const MeterNames[HOMEWIZARD_DEVICES] = {"mains", "circuit", "ev"};
+static StandIn StandIns[HOMEWIZARD_DEVICES] = {{"mains.local"}, {"circuit.local"}, {"ev.local"}};
+static StandInV2 Genuine = {"5c2fafabcdef", "1E8B3A2F7C6D4E5A9B0C1D2E3F405162"};
+static StandInV2 Impostor = {"5c2fafabcdef", "00000000000000000000000000000000"};
+static std::atomic<uint16_t> httpsPort;
+
+// The feed connects to port 443 of the meter, which the harness can not listen on: connect to the stand-in
+extern "C" int connect(int fd, const struct sockaddr *addr, socklen_t len) {
+    struct sockaddr_in redirected;
+
+    if (addr->sa_family == AF_INET && len >= sizeof(redirected) && ntohs(((const sockaddr_in *)addr)->sin_port) == 443) {
+        memcpy(&redirected, addr, sizeof(redirected));
+        redirected.sin_port = htons(httpsPort);
+        addr = (const struct sockaddr *)&redirected;
+    }
+    return syscall(SYS_connect, fd, addr, len);
+}
+
+/*
+ * The mongoose task: the HomeWizard timer of network_common.cpp, and the steps of a scenario that the firmware
+ * runs on this task, such as the pairing request from the web server
+ */
+static std::function<void(void)> mongooseScript;
+
+static void mongooseScriptFn(void *arg) {
+    (void)arg;
+    if (mongooseScript) mongooseScript();
+}
+
+static void mongooseTask(void) {
+    struct mg_mgr mgr;
+
+    mg_mgr_init(&mgr);
+    mg_timer_add(&mgr, 2000, MG_TIMER_REPEAT, homewizard_timer_fn, &mgr);
+    mg_timer_add(&mgr, 500, MG_TIMER_REPEAT, mongooseScriptFn, NULL);
+    while (1) mg_mgr_poll(&mgr, 1);
+}
+
+// Start the V2 stand-in and the mongoose task, with a token and certificate stored when the meter was paired
+static void startV2(StandInV2 &serving, const char *token, const uint8_t *cert) {
+    standinV2Start(&Genuine);
+    standinV2Start(&Impostor);
+    httpsPort = serving.Port;
+    if (token) Preferences::Store["HWToken0"] = token;
+    if (cert) Preferences::Store["HWCert0"].assign((const char *)cert, 32);
+    std::thread(mongooseTask).detach();
+}
+
+/*
+ * Scenarios
+ */
+
+struct MeterResult {
+    uint32_t Samples;                                                           // seconds with a valid reading
+    uint32_t NoComm;                                                            // seconds at Timeout 0
+    uint32_t AgeP50, AgeP95, AgeMax;                                            // ms
+    uint32_t Requests, Connections;                                             // as seen by the stand-in
+    int32_t Recovery;                                                           // ms from RecoverAt to the first new reading, -1: none
+};
+
+struct Result {
+    MeterResult Meter[HOMEWIZARD_DEVICES];
+};
+
+struct Scenario {
+    const char *Name;
+    const char *Description;
+    const char *Before, *After;                                                 // labels of the two runs, Before NULL: after only
+    uint8_t Meters;                                                             // bit n: meter n is a HomeWizard meter
+    unsigned long RecoverAt;                                                    // ms, end of an outage
+    std::function<StandInReply(uint8_t device, unsigned long now)> Behaviour;
+    std::function<void(bool before)> Start;                                     // NULL: the old polling before, the tasks after
+    std::function<void(std::vector<std::string> &errors, const Result &before, const Result &after)> Check;
+};
+
+static void expect(std::vector<std::string> &errors, bool ok, const char *fmt, ...) {
+    char buf[200];
+    va_list args;
+
+    if (ok) return;
+    va_start(args, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    errors.push_back(buf);
+}
+
+#define LATENCY 40                                                              // ms, a meter on a good WiFi link
+
+static const StandInReply Ok = {STANDIN_OK, LATENCY};
+
+// Every meter is read at least every 1.95 s, plus its latency and the jitter of the host
+static void checkFresh(std::vector<std::string> &errors, const Result &after, uint8_t device) {
+    const MeterResult &m = after.Meter[device];
+    expect(errors, m.NoComm == 0, "%s: %u s without a valid reading", MeterNames[device], m.NoComm);
+    expect(errors, m.AgeMax < 2400, "%s: reading up to %u ms old", MeterNames[device], m.AgeMax);
+}
+
+static const Scenario Scenarios[] = {
+    {"healthy", "Three meters at 40 ms: every reading is at most 1.95 s old, one connection per meter",
+     "before", "after", 7, 0,
+     [](uint8_t device, unsigned long now) { (void)device; (void)now; return Ok; },
+     NULL,
+     [](std::vector<std::string> &errors, const Result &before, const Result &after) {
+         (void)before;
+         for (uint8_t device = 0; device < HOMEWIZARD_DEVICES; device++) {
+             checkFresh(errors, after, device);
+             expect(errors, after.Meter[device].Connections == 1, "%s: %u connections, the connection is not kept alive",
+                    MeterNames[device], after.Meter[device].Connections);
+         }
+     }},
+
+    {"unreachable-ev", "The EV meter does not answer connects: the mains and circuit meter are not delayed",
+     "before", "after", 7, 0,
+     [](uint8_t device, unsigned long now) {
+         (void)now;
+         return device == 2 ? StandInReply{STANDIN_UNREACHABLE, 0} : Ok;
+     },
+     NULL,
+     [](std::vector<std::string> &errors, const Result &before, const Result &after) {
+         (void)before;
+         checkFresh(errors, after, 0);
+         checkFresh(errors, after, 1);
+     }},
+
+    {"hung-mains", "The mains meter accepts requests but never replies: the others are not delayed",
+     "before", "after", 7, 0,
+     [](uint8_t device, unsigned long now) {
+         (void)now;
+         return device == 0 ? StandInReply{STANDIN_HANG, 0} : Ok;
+     },
+     NULL,
+     [](std::vector<std::string> &errors, const Result &before, const Result &after) {
+         (void)before;
+         checkFresh(errors, after, 1);
+         checkFresh(errors, after, 2);
+     }},
+
+    // Three failed requests in a row: not enough to time out, as long as the retries are not slowed down
+    {"flaky-mains", "The mains meter drops every request for 6 s out of 10: it never times out",
+     "before", "after", 1, 0,
+     [](uint8_t device, unsigned long now) {
+         (void)device;
+         return now / 1000 % 10 >= 4 ? StandInReply{STANDIN_CLOSE, 0} : Ok;
+     },
+     NULL,
+     [](std::vector<std::string> &errors, const Result &before, const Result &after) {
+         (void)before;
+         const MeterResult &m = after.Meter[0];
+         expect(errors, m.NoComm == 0, "mains: %u s without a valid reading", m.NoComm);
+         expect(errors, m.AgeMax < 9000, "mains: reading up to %u ms old", m.AgeMax);
+     }},
+
+    // After COMM_TIMEOUT the mains meter is read every 7.8 s, the first good reading follows within one interval
+    {"outage", "The mains meter is unreachable from 10 to 40 s: backed off, read again within 9 s",
+     "before", "after", 1, 40000,
+     [](uint8_t device, unsigned long now) {
+         (void)device;
+         return now >= 10000 && now < 40000 ? StandInReply{STANDIN_UNREACHABLE, 0} : Ok;
+     },
+     NULL,
+     [](std::vector<std::string> &errors, const Result &before, const Result &after) {
+         (void)before;
+         const MeterResult &m = after.Meter[0];
+         expect(errors, m.Recovery >= 0 && m.Recovery < 9000, "mains: first reading %d ms after the outage", m.Recovery);
+         expect(errors, m.NoComm <= 30, "mains: %u s without a valid reading", m.NoComm);
+     }},
+
+    // The meter pushes every second, the V1 polling pauses while the feed delivers
+    {"push", "Paired mains meter on the V2 websocket: readings at most 1 s old, against 1.95 s polled",
+     "poll", "push", 1, 0,
+     [](uint8_t device, unsigned long now) { (void)device; (void)now; return Ok; },
+     [](bool before) {
+         if (!before) startV2(Genuine, Genuine.Token, Genuine.CertHash);
+         homewizard_loop();
+     },
+     [](std::vector<std::string> &errors, const Result &before, const Result &after) {
+         (void)before;
+         const MeterResult &m = after.Meter[0];
+         expect(errors, Genuine.Authorizations == 1, "%u authorizations", Genuine.Authorizations.load());
+         expect(errors, m.AgeP95 < 1100, "mains: reading up to %u ms old at p95", m.AgeP95);
+         expect(errors, m.NoComm == 0, "mains: %u s without a valid reading", m.NoComm);
+         expect(errors, m.Requests < 5, "mains: polled %u times while the feed was running", m.Requests);
+     }},
+
+    {"pair", "Pairing: refused until the button is pressed at 10 s, then the token and certificate are stored",
+     NULL, "after", 1, 0,
+     [](uint8_t device, unsigned long now) { (void)device; (void)now; return Ok; },
+     [](bool before) {
+         (void)before;
+         startV2(Genuine, NULL, NULL);
+         mongooseScript = []() {
+             static bool pairing = false;
+             if (!pairing && millis() >= 4000) pairing = homewizardPair(0, true);
+             if (millis() >= 10000 && !Genuine.ButtonUntil) Genuine.ButtonUntil = millis() + 30000;
+         };
+         homewizard_loop();
+     },
+     [](std::vector<std::string> &errors, const Result &before, const Result &after) {
+         (void)before; (void)after;
+         std::map<std::string, std::string> &store = Preferences::Store;
+         expect(errors, Genuine.Pairings >= 3, "%u pairing requests, expected some before the button", Genuine.Pairings.load());
+         expect(errors, store["HWToken0"] == Genuine.Token, "token \"%s\" stored", store["HWToken0"].c_str());
+         expect(errors, store["HWCert0"] == std::string((const char *)Genuine.CertHash, 32), "wrong certificate stored");
+         expect(errors, Genuine.Authorizations == 1 && Genuine.Measurements > 20, "%u authorizations, %u measurements",
+                Genuine.Authorizations.load(), Genuine.Measurements.load());
+     }},
+
+    // Another device at the address of the meter, such as after a DHCP change: it must not get the token
+    {"impostor", "The address of the paired meter serves another certificate: the token is not sent, polling goes on",
+     NULL, "after", 1, 0,
+     [](uint8_t device, unsigned long now) { (void)device; (void)now; return Ok; },
+     [](bool before) {
+         (void)before;
+         startV2(Impostor, Genuine.Token, Genuine.CertHash);
+         homewizard_loop();
+     },
+     [](std::vector<std::string> &errors, const Result &before, const Result &after) {
+         (void)before;
+         expect(errors, Impostor.Connections > 0, "the feed did not connect");
+         expect(errors, Impostor.Authorizations == 0, "the token was sent %u times", Impostor.Authorizations.load());
+         checkFresh(errors, after, 0);
+     }},
+
+    {"unpinned", "A token stored without certificate, by an older version: no feed until paired again",
+     NULL, "after", 1, 0,
+     [](uint8_t device, unsigned long now) { (void)device; (void)now; return Ok; },
+     [](bool before) {
+         (void)before;
+         startV2(Genuine, Genuine.Token, NULL);
+         homewizard_loop();
+     },
+     [](std::vector<std::string> &errors, const Result &before, const Result &after) {
+         (void)before;
+         expect(errors, Genuine.Connections == 0, "the feed connected %u times", Genuine.Connections.load());
+         checkFresh(errors, after, 0);
+     }},
+};
+
+/*
+ * Decoding: V1 replies of other meters, and replies that are cut short or malformed
+ */
+
+struct Payload {
+    const char *Name;
+    const char *Body;
+    int Length;                                                                 // Content-Length, 0: the length of Body
+    int8_t Phases;                                                              // expected, 0: the reading is rejected
+    int32_t Irms[3];                                                            // dA
+    int32_t Import, Export, Power;                                              // Wh, Wh, W
+};
+
+static const Payload Payloads[] = {
+    // Newer P1 meters add the total current to the three phases
+    {"3-phase", "{\"total_power_import_kwh\":13779.338,\"total_power_export_kwh\":1234.5,\"active_power_w\":1150,"
+     "\"active_power_l1_w\":2300,\"active_power_l2_w\":-1610,\"active_power_l3_w\":460,\"active_current_a\":19.0,"
+     "\"active_current_l1_a\":10.0,\"active_current_l2_a\":7.0,\"active_current_l3_a\":2.0}",
+     0, 3, {100, -70, 20}, 13779338, 1234500, 1150},
+    {"reordered", "{\"active_current_l3_a\":2.04,\"active_current_l2_a\":7,\"active_current_l1_a\":1.26e1,"
+     "\"wifi_ssid\":\"{\\\"active_current_l1_a\\\":99}\",\"external\":[{\"unique_id\":\"3335\",\"type\":\"gas_meter\","
+     "\"value\":2569.646,\"unit\":\"m3\"}],\"active_power_l3_w\":469,\"active_power_l2_w\":1610,\"active_power_l1_w\":-2898,"
+     "\"active_power_w\":-819,\"total_power_export_kwh\":0,\"total_power_import_kwh\":0.001}",
+     0, 3, {-126, 70, 20}, 1, 0, -819},
+    {"2-phase", "{\"active_power_l1_w\":2300,\"active_power_l3_w\":460,\"active_current_l1_a\":10.0,\"active_current_l3_a\":2.0}",
+     0, 3, {100, 0, 20}, 0, 0, 0},
+    // kWh meters report the total current, single phase P1 meters the current of their phase
+    {"kwh-1-phase", "{\"wifi_ssid\":\"home\",\"total_power_import_kwh\":2.5,\"total_power_export_kwh\":0.75,"
+     "\"active_power_w\":-1725,\"active_power_l1_w\":-1725,\"active_voltage_v\":230,\"active_current_a\":7.5}",
+     0, 1, {-75, 0, 0}, 2500, 750, -1725},
+    {"p1-1-phase", "{\"active_power_w\":-920,\"active_power_l1_w\":-920,\"active_current_l1_a\":4.0}",
+     0, 1, {-40, 0, 0}, 0, 0, -920},
+    {"p1-l2-only", "{\"active_power_w\":690,\"active_power_l2_w\":-690,\"active_current_l2_a\":3.0}",
+     0, 1, {-30, 0, 0}, 0, 0, 690},
+    {"no-current", "{\"active_power_w\":690,\"total_power_import_kwh\":2.5}", 0, 0, {}, 0, 0, 0},
+    {"truncated", "{\"active_power_w\":690,\"active_current_l1_a\":3.0,\"active_curr", 0, 0, {}, 0, 0, 0},
+    {"cut-short", "{\"active_power_w\":690,\"active_current_l1_a\":3.0,", 200, 0, {}, 0, 0, 0},
+    {"malformed", "{\"active_power_w\":690,,\"active_current_l1_a\":3.0}", 0, 0, {}, 0, 0, 0},
+};
+
+static int decode(void) {
+    std::vector<std::string> errors;
+
+    MainsMeter.Type = EM_HOMEWIZARD;
+    strcpy(MainsMeter.DeviceHostName, StandIns[0].Host);
+    standinStart(StandIns, 1);
+    printf("decode: V1 replies of other meters, cut short or malformed, sent at once and in pieces\n");
+    for (const size_t chunk : {0, 5}) {
+        for (const Payload &p : Payloads) {
+            StandIns[0].Behaviour = [&p, chunk](unsigned long now) {
+                (void)now;
+                return StandInReply{STANDIN_OK, 0, p.Body, p.Length, chunk};
+            };
+            const std::pair<int8_t, std::array<int32_t, 6>> r = getDataFromHomeWizard(StandIns[0].Host, 0);
+            const std::array<int32_t, 6> expected = {p.Irms[0], p.Irms[1], p.Irms[2], p.Import, p.Export, p.Power};
+            const bool ok = r.first == p.Phases && (!p.Phases || r.second == expected);
+            printf("  %-12s %-8s %d-phase %5d %5d %5d dA, %8d %8d Wh, %5d W\n", p.Name, chunk ? "5 bytes" : "at once",
+                   r.first, r.second[0], r.second[1], r.second[2], r.second[3], r.second[4], r.second[5]);
+            expect(errors, ok, "%s %s: expected %d-phase %d %d %d dA, %d %d Wh, %d W", p.Name, chunk ? "in pieces" : "at once",
+                   p.Phases, p.Irms[0], p.Irms[1], p.Irms[2], p.Import, p.Export, p.Power);
+        }
+    }
+    for (const std::string &e : errors) printf("  FAIL: %s\n", e.c_str());
+    printf("decode: %s\n\n", errors.empty() ? "PASS" : "FAIL");
+    fflush(stdout);
+    _exit(errors.empty() ? 0 : 1);
+}
+
+/*
+ * The polling before the per-meter tasks: one pass every 1.95 s, the meters one after another
+ */
+static void legacyTask(void) {
+    HTTPClient::Legacy = true;
+    while (1) {
+        const unsigned long start = millis();
+        for (uint8_t device = 0; device < HOMEWIZARD_DEVICES; device++) {
+            if (!homewizardEnabled(device)) continue;
+            homewizardUpdate(device, getDataFromHomeWizard(Meters[device]->DeviceHostName, 0));
+        }
+        const long wait = (long)(start + 1950 - millis());
+        if (wait > 0) delay(wait);
+    }
+}
+
+static uint32_t percentile(std::vector<uint32_t> &ages, unsigned p) {
+    if (ages.empty()) return 0;
+    std::sort(ages.begin(), ages.end());
+    return ages[(ages.size() - 1) * p / 100];
+}
+
+// Run one scenario, in the before or after mode
+static Result run(const Scenario &scenario, bool before) {
+    std::vector<uint32_t> ages[HOMEWIZARD_DEVICES];
+    Result result = {};
+
+    for (uint8_t device = 0; device < HOMEWIZARD_DEVICES; device++) {
+        Meter &meter = *Meters[device];
+        meter.Type = scenario.Meters & 1 << device ? EM_HOMEWIZARD : 0;
+        strcpy(meter.DeviceHostName, StandIns[device].Host);
+        meter.Timeout = COMM_TIMEOUT;
+        StandIns[device].Behaviour = [&scenario, device](unsigned long now) { return scenario.Behaviour(device, now); };
+        result.Meter[device].Recovery = -1;
+    }
+    standinStart(StandIns, HOMEWIZARD_DEVICES);
+    if (scenario.Start) scenario.Start(before);
+    else if (before) std::thread(legacyTask).detach();
+    else homewizard_loop();
+
+    // The 1 s timer: sample the readings the load balancing would use, then count down the timeouts
+    TickType_t wake = WARMUP;
+    delay(WARMUP);
+    while (wake < DURATION) {
+        for (uint8_t device = 0; device < HOMEWIZARD_DEVICES; device++) {
+            Meter &meter = *Meters[device];
+            MeterResult &m = result.Meter[device];
+            if (!meter.Type) continue;
+
+            const unsigned long sampled = meter.Export_active_energy;           // reply time of the stand-in, 0: no reading yet
+            if (meter.Timeout && sampled) {
+                m.Samples++;
+                ages[device].push_back(millis() - sampled);
+            } else if (!meter.Timeout) m.NoComm++;
+            if (scenario.RecoverAt && m.Recovery < 0 && sampled >= scenario.RecoverAt)
+                m.Recovery = sampled - scenario.RecoverAt;
+            if (meter.Timeout) meter.Timeout--;
+        }
+        vTaskDelayUntil(&wake, 1000);
+    }
+
+    for (uint8_t device = 0; device < HOMEWIZARD_DEVICES; device++) {
+        MeterResult &m = result.Meter[device];
+        m.AgeP50 = percentile(ages[device], 50);
+        m.AgeP95 = percentile(ages[device], 95);
+        m.AgeMax = ages[device].empty() ? 0 : ages[device].back();
+        m.Requests = StandIns[device].Requests;
+        m.Connections = StandIns[device].Connections;
+    }
+    return result;
+}
+
+static void report(const Scenario &scenario, const char *mode, const Result &result) {
+    for (uint8_t device = 0; device < HOMEWIZARD_DEVICES; device++) {
+        const MeterResult &m = result.Meter[device];
+        if (!(scenario.Meters & 1 << device)) continue;
+        printf("  %-6s %-7s age p50 %4u p95 %5u max %5u ms, %2u s no reading, %3u requests, %2u connections",
+               mode, MeterNames[device], m.AgeP50, m.AgeP95, m.AgeMax, m.NoComm, m.Requests, m.Connections);
+        if (scenario.RecoverAt) printf(", recovered after %d ms", m.Recovery);
+        printf("\n");
+    }
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: homewizard_meters [-v level] scenario|decode|list\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[]) {
+    const Scenario *scenario = NULL;
+    const char *name = NULL;
+    std::vector<std::string> errors;
+    Result before = {}, after;
+    int fds[2];
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-v") && i + 1 < argc) hostLogLevel = atoi(argv[++i]);
+        else if (argv[i][0] == '-' || name) usage();
+        else name = argv[i];
+    }
+    if (!name) usage();
+    if (!strcmp(name, "decode")) return decode();
+    for (const Scenario &s : Scenarios) {
+        if (!strcmp(name, "list")) printf("%-14s %s\n", s.Name, s.Description);
+        else if (!strcmp(name, s.Name)) scenario = &s;
+    }
+    if (!strcmp(name, "list")) {
+        printf("%-14s %s\n", "decode", "V1 replies of other meters, cut short or malformed: decoded or rejected");
+        return 0;
+    }
+    if (!scenario) usage();
+
+    // The tasks never end, so each mode runs in a process of its own
+    fflush(stdout);
+    pid_t child = 0;
+    if (scenario->Before) {
+        if (pipe(fds) || (child = fork()) < 0) return 2;
+        if (child == 0) {
+            before = run(*scenario, true);
+            if (write(fds[1], &before, sizeof(before)) != sizeof(before)) _exit(2);
+            _exit(0);
+        }
+    }
+    after = run(*scenario, false);
+    if (child) {
+        if (read(fds[0], &before, sizeof(before)) != sizeof(before)) return 2;
+        waitpid(child, NULL, 0);
+    }
+
+    scenario->Check(errors, before, after);
+    printf("%s: %s\n", scenario->Name, scenario->Description);
+    if (scenario->Before) report(*scenario, scenario->Before, before);
+    report(*scenario, scenario->After, after);
+    for (const std::string &e : errors) printf("  FAIL: %s\n", e.c_str());
+    printf("%s: %s\n\n", scenario->Name, errors.empty() ? "PASS" : "FAIL");
+    fflush(stdout);
+    _exit(errors.empty() ? 0 : 1);                                              // the tasks are still running
+}
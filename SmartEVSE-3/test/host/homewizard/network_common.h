@@ -0,0 +1,20 @@
+/*
+ * Host build of the HomeWizard meter client: mDNS discovery is not simulated, the meters are configured by
+ * host name. Mongoose is the real one.
+ */
+
+#ifndef __EVSE_NETWORK
+#define __EVSE_NETWORK
+
+#include <Arduino.h>
+#include "mongoose.h"
+
+struct mDNSServiceEntry {
+    int ServiceType;
+    String HostName;
+};
+
+extern unsigned long lastMdnsQueryTime;
+const mDNSServiceEntry *getmDNSServiceByIndex(int type, const String &hostnamePattern, uint8_t index, bool strict = false);
+
+#endif
@@ -0,0 +1,120 @@
+/*
+ * Stand-in HomeWizard meters, see standin.h.
+ */
+
+#include <thread>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <Arduino.h>
+#include "standin.h"
+
+static StandIn *Meters;
+static size_t MeterCount;
+
+bool hostWait(int fd, short events, unsigned long ms) {
+    struct pollfd p = {fd, events, 0};
+    const unsigned long long us = ms * 1000ULL / hostSpeed;
+    struct timespec ts = {(time_t)(us / 1000000), (long)(us % 1000000) * 1000};
+    return ppoll(&p, 1, &ts, NULL) > 0;
+}
+
+int standinPort(const char *host) {
+    for (size_t i = 0; i < MeterCount; i++) {
+        if (strcmp(Meters[i].Host, host)) continue;
+        return Meters[i].Behaviour(millis()).Mode == STANDIN_UNREACHABLE ? -1 : Meters[i].Port;
+    }
+    return 0;
+}
+
+static void reply(int fd, bool close, const StandInReply &r) {
+    const unsigned long now = millis();
+    const int l1 = 10 + now / 1000 % 7, l2 = 20 + now / 1000 % 5, l3 = 5;     // A, changes every second
+    char body[512], head[160];
+
+    int len = snprintf(body, sizeof(body),
+        "{\"wifi_ssid\":\"stand-in\",\"wifi_strength\":86,\"smr_version\":50,\"meter_model\":\"stand-in\","
+        "\"unique_id\":\"00112233445566778899AABBCCDDEEFF\",\"active_tariff\":2,"
+        "\"total_power_import_kwh\":13779.338,\"total_power_export_kwh\":%lu.%03lu,"
+        "\"active_power_w\":%d,\"active_power_l1_w\":%d,\"active_power_l2_w\":%d,\"active_power_l3_w\":%d,"
+        "\"active_voltage_l1_v\":230.1,\"active_voltage_l2_v\":229.8,\"active_voltage_l3_v\":231.0,"
+        "\"active_current_l1_a\":%d.0,\"active_current_l2_a\":%d.0,\"active_current_l3_a\":%d.0,"
+        "\"external\":[]}",
+        now / 1000, now % 1000, (l1 + l2 + l3) * 230, l1 * 230, l2 * 230, l3 * 230, l1, l2, l3);
+    const char *data = body;
+    if (r.Body) {
+        data = r.Body;
+        len = strlen(r.Body);
+    }
+    const int headLen = snprintf(head, sizeof(head),
+        "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: %d\r\nConnection: %s\r\n\r\n",
+        r.Length ? r.Length : len, close ? "close" : "keep-alive");
+    send(fd, head, headLen, MSG_NOSIGNAL);
+    for (int sent = 0; sent < len; ) {
+        const int n = r.Chunk && (int)r.Chunk < len - sent ? r.Chunk : len - sent;
+        send(fd, data + sent, n, MSG_NOSIGNAL);
+        sent += n;
+        if (sent < len) delay(1);
+    }
+}
+
+static void serve(StandIn *meter, int fd) {
+    std::string rx;
+    char buf[512];
+
+    while (1) {
+        const ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0) break;
+        rx.append(buf, n);
+        const size_t end = rx.find("\r\n\r\n");
+        if (end == std::string::npos) continue;
+        const std::string request = rx.substr(0, end);
+        rx.erase(0, end + 4);
+        meter->Requests++;
+
+        const StandInReply r = meter->Behaviour(millis());
+        if (r.Mode == STANDIN_CLOSE) break;
+        if (r.Mode == STANDIN_HANG || r.Mode == STANDIN_UNREACHABLE) {          // until the client gives up
+            while (recv(fd, buf, sizeof(buf), 0) > 0);
+            break;
+        }
+        if (r.Latency) delay(r.Latency);
+        const bool close = request.find("Connection: close") != std::string::npos;
+        reply(fd, close, r);
+        if (close || (r.Body && r.Length)) break;                               // a body cut short ends with the connection
+    }
+    ::close(fd);
+}
+
+static void listener(StandIn *meter, int listenFd) {
+    while (1) {
+        const int fd = accept(listenFd, NULL, NULL);
+        if (fd < 0) continue;
+        const int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        meter->Connections++;
+        std::thread(serve, meter, fd).detach();
+    }
+}
+
+void standinStart(StandIn *meters, size_t count) {
+    Meters = meters;
+    MeterCount = count;
+    for (size_t i = 0; i < count; i++) {
+        struct sockaddr_in addr = {};
+        socklen_t len = sizeof(addr);
+        const int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(fd, 8)
+            || getsockname(fd, (struct sockaddr *)&addr, &len)) {
+            perror("stand-in meter");
+            exit(2);
+        }
+        meters[i].Port = ntohs(addr.sin_port);
+        std::thread(listener, &meters[i], fd).detach();
+    }
+}
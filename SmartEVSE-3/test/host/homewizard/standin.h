@@ -0,0 +1,57 @@
+/*
+ * Stand-in HomeWizard meters
+ *
+ * Every meter listens on a loopback port and answers GET /api/v1/data like the V1 API of a 3-phase P1 meter.
+ * What a request gets is decided by the scenario, per meter and per simulated time: a reply after some latency,
+ * no reply at all, a closed connection, or no connection (an unreachable meter, the connect times out).
+ *
+ * The reply carries the simulated time at which it was sent in total_power_export_kwh, so the client side can
+ * tell the age of the reading it uses. A scenario can also set the body, and send it in pieces.
+ */
+
+#ifndef __HOST_STANDIN_H
+#define __HOST_STANDIN_H
+
+#include <atomic>
+#include <functional>
+#include <poll.h>
+
+enum StandInMode { STANDIN_OK, STANDIN_HANG, STANDIN_CLOSE, STANDIN_UNREACHABLE };
+
+struct StandInReply {
+    StandInMode Mode;
+    unsigned long Latency;                                                      // ms until the reply is sent
+    const char *Body;                                                           // NULL: a measurement of a 3-phase P1 meter
+    int Length;                                                                 // Content-Length sent with Body, 0: its length
+    size_t Chunk;                                                               // bytes per send, 1 ms apart, 0: at once
+};
+
+struct StandIn {
+    const char *Host;
+    std::function<StandInReply(unsigned long now)> Behaviour;
+    uint16_t Port;
+    std::atomic<uint32_t> Connections, Requests;
+};
+
+/*
+ * The V2 API of a stand-in meter: https with a certificate made at start, pairing on POST /api/user while the
+ * button is pressed, and the websocket /api/ws that pushes a measurement every second once it is authorized
+ * with the token and subscribed. The firmware connects to port 443, which the harness redirects to Port.
+ */
+struct StandInV2 {
+    const char *Serial;                                                         // name in the certificate
+    const char *Token;
+    uint16_t Port;
+    uint8_t CertHash[32];                                                       // SHA-256 of the DER certificate
+    std::atomic<unsigned long> ButtonUntil;                                     // pairing is accepted until this millis()
+    std::atomic<uint32_t> Connections, Pairings, Authorizations, Measurements;
+};
+
+extern int hostSpeed;                                                           // simulated ms per host ms
+
+void standinStart(StandIn *meters, size_t count);
+int standinPort(const char *host);                                              // 0: unknown host, -1: unreachable
+bool hostWait(int fd, short events, unsigned long ms);                          // poll() on the simulated clock
+void standinV2Start(StandInV2 *meter);
+
+#endif
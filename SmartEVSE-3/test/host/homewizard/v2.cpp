@@ -0,0 +1,135 @@
+/*
+ * Stand-in HomeWizard meters: the V2 API, see standin.h.
+ */
+
+#include <thread>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#include <Arduino.h>
+#include "mongoose.h"
+#include "standin.h"
+
+struct V2Server {
+    StandInV2 *Meter;
+    std::string CertPem, KeyPem;
+};
+
+// A self-signed P-256 certificate with the serial number as name, as the meters have (signed by their CA)
+static void makeCertificate(V2Server &server) {
+    EVP_PKEY *key = EVP_EC_gen("P-256");
+    X509 *cert = X509_new();
+    BIO *bio = BIO_new(BIO_s_mem());
+    unsigned char *der = NULL;
+    char *pem;
+
+    X509_set_version(cert, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+    X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+    X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+    X509_NAME_add_entry_by_txt(X509_get_subject_name(cert), "CN", MBSTRING_ASC, (const unsigned char *)server.Meter->Serial,
+                               -1, -1, 0);
+    X509_set_issuer_name(cert, X509_get_subject_name(cert));
+    X509_set_pubkey(cert, key);
+    X509_sign(cert, key, EVP_sha256());
+
+    PEM_write_bio_X509(bio, cert);
+    long len = BIO_get_mem_data(bio, &pem);
+    server.CertPem.assign(pem, len);
+    BIO_reset(bio);
+    PEM_write_bio_PrivateKey(bio, key, NULL, NULL, 0, NULL, NULL);
+    len = BIO_get_mem_data(bio, &pem);
+    server.KeyPem.assign(pem, len);
+    len = i2d_X509(cert, &der);
+    mg_sha256(server.Meter->CertHash, der, len);
+
+    OPENSSL_free(der);
+    BIO_free(bio);
+    X509_free(cert);
+    EVP_PKEY_free(key);
+}
+
+static void fn_v2(struct mg_connection *c, int ev, void *ev_data) {
+    V2Server &server = *(V2Server *)c->fn_data;
+    StandInV2 &meter = *server.Meter;
+
+    if (ev == MG_EV_ACCEPT) {
+        struct mg_tls_opts opts = {};
+        opts.cert = mg_str(server.CertPem.c_str());
+        opts.key = mg_str(server.KeyPem.c_str());
+        mg_tls_init(c, &opts);
+        meter.Connections++;
+    } else if (ev == MG_EV_HTTP_MSG) {
+        struct mg_http_message *hm = (struct mg_http_message *) ev_data;
+        if (mg_match(hm->uri, mg_str("/api/user"), NULL) && mg_strcmp(hm->method, mg_str("POST")) == 0) {
+            meter.Pairings++;
+            if (millis() < meter.ButtonUntil)
+                mg_http_reply(c, 200, "Content-Type: application/json\r\n", "{%m:%m,%m:%m}", MG_ESC("token"),
+                              MG_ESC(meter.Token), MG_ESC("name"), MG_ESC("local/smartevse"));
+            else
+                mg_http_reply(c, 403, "Content-Type: application/json\r\n", "{%m:%m}", MG_ESC("error"),
+                              MG_ESC("user:creation-not-enabled"));
+        } else if (mg_match(hm->uri, mg_str("/api/ws"), NULL)) {
+            mg_ws_upgrade(c, hm, NULL);
+        } else {
+            mg_http_reply(c, 404, "", "");
+        }
+    } else if (ev == MG_EV_WS_MSG) {
+        struct mg_ws_message *wm = (struct mg_ws_message *) ev_data;
+        char *type = mg_json_get_str(wm->data, "$.type");
+        char *data = mg_json_get_str(wm->data, "$.data");
+        if (type && data && !strcmp(type, "authorization")) {
+            meter.Authorizations++;
+            if (!strcmp(data, meter.Token)) {
+                c->data[0] = 'A';
+                mg_ws_printf(c, WEBSOCKET_OP_TEXT, "{%m:%m}", MG_ESC("type"), MG_ESC("authorized"));
+            } else {
+                mg_ws_printf(c, WEBSOCKET_OP_TEXT, "{%m:%m,%m:{%m:%m}}", MG_ESC("type"), MG_ESC("error"), MG_ESC("data"),
+                             MG_ESC("message"), MG_ESC("user:unauthorized"));
+            }
+        } else if (type && data && !strcmp(type, "subscribe") && !strcmp(data, "measurement") && c->data[0] == 'A') {
+            c->data[1] = 'S';
+        }
+        free(type);
+        free(data);
+    }
+}
+
+// Every second, as a P1 meter does for every telegram of the smart meter. Same values as the V1 API.
+static void pushMeasurements(void *arg) {
+    struct mg_mgr *mgr = (struct mg_mgr *) arg;
+    const unsigned long now = millis();
+    const int l1 = 10 + now / 1000 % 7, l2 = 20 + now / 1000 % 5, l3 = 5;
+
+    for (struct mg_connection *c = mgr->conns; c != NULL; c = c->next) {
+        if (c->data[1] != 'S') continue;
+        ((V2Server *)c->fn_data)->Meter->Measurements++;
+        mg_ws_printf(c, WEBSOCKET_OP_TEXT,
+            "{\"type\":\"measurement\",\"data\":{\"protocol_version\":50,\"meter_model\":\"stand-in\","
+            "\"energy_import_kwh\":13779.338,\"energy_export_kwh\":%lu.%03lu,"
+            "\"power_w\":%d,\"power_l1_w\":%d,\"power_l2_w\":%d,\"power_l3_w\":%d,"
+            "\"voltage_l1_v\":230.1,\"voltage_l2_v\":229.8,\"voltage_l3_v\":231.0,"
+            "\"current_l1_a\":%d.0,\"current_l2_a\":%d.0,\"current_l3_a\":%d.0}}",
+            now / 1000, now % 1000, (l1 + l2 + l3) * 230, l1 * 230, l2 * 230, l3 * 230, l1, l2, l3);
+    }
+}
+
+static void serveV2(V2Server *server, struct mg_mgr *mgr) {
+    mg_timer_add(mgr, 1000, MG_TIMER_REPEAT, pushMeasurements, mgr);
+    while (1) mg_mgr_poll(mgr, 1);
+}
+
+void standinV2Start(StandInV2 *meter) {
+    V2Server *server = new V2Server{meter, "", ""};
+    struct mg_mgr *mgr = new struct mg_mgr;
+
+    makeCertificate(*server);
+    mg_mgr_init(mgr);
+    struct mg_connection *c = mg_http_listen(mgr, "http://127.0.0.1:0", fn_v2, server);
+    if (c == NULL) {
+        fprintf(stderr, "stand-in V2 API: listen failed\n");
+        exit(2);
+    }
+    meter->Port = mg_ntohs(c->loc.port);
+    std::thread(serveV2, server, mgr).detach();
+}
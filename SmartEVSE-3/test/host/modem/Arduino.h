@@ -0,0 +1,77 @@
+/*
+ * Host build of the modem stack (qca.cpp, ipv6.cpp, tcp.cpp)
+ *
+ * The parts of the Arduino core and FreeRTOS the modem stack uses. millis() is the simulated clock of the
+ * replay harness, micros() is the real clock of the host, so the decode and encode times in the session
+ * timeline are real. attachInterrupt(), vTaskNotifyGiveFromISR(), ulTaskNotifyTake(), uxTaskGetStackHighWaterMark()
+ * and digitalWrite() are implemented by the harness.
+ */
+
+#ifndef __HOST_ARDUINO_H
+#define __HOST_ARDUINO_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdarg>
+#include <cmath>
+#include <cinttypes>
+#include <ctime>
+#include <string>
+#include <type_traits>
+
+#define LOW 0
+#define HIGH 1
+#define RISING 1
+#define HEX 16
+#define IRAM_ATTR
+
+template <class A, class B> static inline typename std::common_type<A, B>::type min(A a, B b) { return a < b ? a : b; }
+template <class A, class B> static inline typename std::common_type<A, B>::type max(A a, B b) { return a > b ? a : b; }
+#define constrain(x, low, high) ((x) < (low) ? (low) : ((x) > (high) ? (high) : (x)))
+
+extern unsigned long hostMillis;
+static inline unsigned long millis(void) { return hostMillis; }
+unsigned long micros(void);
+
+void digitalWrite(uint8_t pin, uint8_t val);
+static inline uint8_t digitalPinToInterrupt(uint8_t pin) { return pin; }
+void attachInterrupt(uint8_t pin, void (*isr)(void), int mode);
+void esp_fill_random(void *buf, size_t len);
+uint32_t esp_random(void);
+
+class String : public std::string {
+public:
+    String(const char *str = "") : std::string(str) {}
+    String(const std::string &str) : std::string(str) {}
+    String(unsigned char value, int base) {
+        char buf[12];
+        snprintf(buf, sizeof(buf), base == HEX ? "%x" : "%u", value);
+        assign(buf);
+    }
+};
+
+struct HostSerial {
+    int printf(const char *fmt, ...);
+};
+extern HostSerial Serial1;
+
+// FreeRTOS
+typedef void *TaskHandle_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef int portMUX_TYPE;
+#define pdFALSE 0
+#define pdTRUE 1
+#define portTICK_PERIOD_MS 1
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux) ((void)(mux))
+#define portYIELD_FROM_ISR()
+static inline TaskHandle_t xTaskGetCurrentTaskHandle(void) { return (TaskHandle_t)1; }
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken);
+uint32_t ulTaskNotifyTake(BaseType_t clear, uint32_t ticks);
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task);                     // bytes, as in ESP-IDF
+
+#endif
@@ -0,0 +1,92 @@
+/*
+ * Host build of the modem stack: just enough of ArduinoJson for modemTimelineJson().
+ */
+
+#ifndef __HOST_ARDUINOJSON_H
+#define __HOST_ARDUINOJSON_H
+
+#include <Arduino.h>
+#include <memory>
+#include <vector>
+
+#define JSON_ARRAY_SIZE(n) ((n) * 16)
+#define JSON_OBJECT_SIZE(n) ((n) * 16)
+
+struct JsonNode {
+    std::string Key;
+    std::string Value;                                                          // scalars, serialized
+    char Kind = 0;                                                              // 0 = scalar, '{' or '['
+    std::vector<std::unique_ptr<JsonNode>> Children;
+
+    JsonNode *add(const char *key, char kind) {
+        Children.emplace_back(new JsonNode);
+        Children.back()->Key = key ? key : "";
+        Children.back()->Kind = kind;
+        return Children.back().get();
+    }
+    void serialize(std::string &out) const {
+        if (!Kind) {
+            out += Value.empty() ? "null" : Value;
+            return;
+        }
+        out += Kind;
+        for (size_t i = 0; i < Children.size(); i++) {
+            if (i) out += ',';
+            if (Kind == '{') out += "\"" + Children[i]->Key + "\":";
+            Children[i]->serialize(out);
+        }
+        out += Kind == '{' ? '}' : ']';
+    }
+};
+
+class JsonVariant {
+    JsonNode *Node;
+public:
+    explicit JsonVariant(JsonNode *node) : Node(node) {}
+    template <class T> JsonVariant &operator=(T value) {
+        Node->Value = std::to_string(value);
+        return *this;
+    }
+    JsonVariant &operator=(const char *value) {
+        Node->Value = std::string("\"") + value + "\"";
+        return *this;
+    }
+};
+
+class JsonObject;
+
+class JsonArray {
+    JsonNode *Node;
+public:
+    explicit JsonArray(JsonNode *node) : Node(node) {}
+    JsonObject createNestedObject();
+};
+
+class JsonObject {
+protected:
+    JsonNode *Node;
+public:
+    explicit JsonObject(JsonNode *node) : Node(node) {}
+    JsonVariant operator[](const char *key) {
+        for (auto &child : Node->Children)
+            if (child->Key == key) return JsonVariant(child.get());
+        return JsonVariant(Node->add(key, 0));
+    }
+    JsonArray createNestedArray(const char *key) { return JsonArray(Node->add(key, '[')); }
+    void serialize(std::string &out) const { Node->serialize(out); }
+};
+
+inline JsonObject JsonArray::createNestedObject() { return JsonObject(Node->add(NULL, '{')); }
+
+class DynamicJsonDocument : public JsonObject {
+    std::unique_ptr<JsonNode> Root;
+public:
+    explicit DynamicJsonDocument(size_t capacity) : JsonObject(new JsonNode), Root(Node) { (void)capacity; Root->Kind = '{'; }
+};
+
+static inline void serializeJson(const DynamicJsonDocument &doc, String &out) {
+    out.clear();
+    doc.serialize(out);
+}
+
+#endif
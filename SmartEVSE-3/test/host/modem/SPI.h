@@ -0,0 +1,16 @@
+/*
+ * Host build of the modem stack: the SPI bus to the QCA7000 is connected to the virtual modem (qca7000.cpp).
+ */
+
+#ifndef __HOST_SPI_H
+#define __HOST_SPI_H
+
+#include <Arduino.h>
+
+class SPIClass {
+public:
+    uint16_t transfer16(uint16_t data);
+    void transfer(void *buf, size_t len);
+};
+
+#endif
@@ -0,0 +1,24 @@
+/*
+ * Host build of the modem stack: log to stdout, up to the level set with -v.
+ */
+
+#ifndef __EVSE_DEBUG
+#define __EVSE_DEBUG
+
+#include <cstdio>
+
+extern int hostLogLevel;                                                        // 1 = errors .. 5 = verbose
+void hostLog(int level, bool func, const char *function, const char *fmt, ...) __attribute__((format(printf, 4, 5)));
+
+#define _LOG_A(fmt, ...) hostLog(1, true, __func__, fmt, ##__VA_ARGS__)
+#define _LOG_W(fmt, ...) hostLog(2, true, __func__, fmt, ##__VA_ARGS__)
+#define _LOG_I(fmt, ...) hostLog(3, true, __func__, fmt, ##__VA_ARGS__)
+#define _LOG_D(fmt, ...) hostLog(4, true, __func__, fmt, ##__VA_ARGS__)
+#define _LOG_V(fmt, ...) hostLog(5, true, __func__, fmt, ##__VA_ARGS__)
+#define _LOG_A_NO_FUNC(fmt, ...) hostLog(1, false, __func__, fmt, ##__VA_ARGS__)
+#define _LOG_W_NO_FUNC(fmt, ...) hostLog(2, false, __func__, fmt, ##__VA_ARGS__)
+#define _LOG_I_NO_FUNC(fmt, ...) hostLog(3, false, __func__, fmt, ##__VA_ARGS__)
+#define _LOG_D_NO_FUNC(fmt, ...) hostLog(4, false, __func__, fmt, ##__VA_ARGS__)
+#define _LOG_V_NO_FUNC(fmt, ...) hostLog(5, false, __func__, fmt, ##__VA_ARGS__)
+
+#endif
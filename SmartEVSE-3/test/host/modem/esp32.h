@@ -0,0 +1,27 @@
+/*
+ * Host build of the modem stack: the part of esp32.h the modem stack uses. The EVSE state is kept by the
+ * replay harness, which records every setState() and setAccess() call.
+ */
+
+#ifndef __EVSE_ESP32
+#define __EVSE_ESP32
+
+#include <Arduino.h>
+#include "main_c.h"
+#include "debug.h"
+
+#define PIN_QCA700X_INT 9
+#define PIN_QCA700X_CS 11
+
+enum AccessStatus_t { OFF, ON, PAUSE };
+enum Charging_Protocol_t {IEC, DIN, ISO2, ISO20};
+
+extern uint8_t State;
+extern uint32_t serialnr;
+extern uint8_t Nr_Of_Phases_Charging;
+extern uint16_t MinCurrent;
+extern uint16_t Balanced[];                                                     // Amps value per EVSE, 0.1A
+
+void setAccess(AccessStatus_t Access);
+
+#endif
@@ -0,0 +1,14 @@
+/*
+ * Host build of the modem stack: there is no PSRAM, the ISO 15118-20 document is allocated on the heap.
+ */
+
+#ifndef __HOST_ESP_HEAP_CAPS_H
+#define __HOST_ESP_HEAP_CAPS_H
+
+#include <cstdlib>
+
+#define MALLOC_CAP_SPIRAM 0
+
+static inline void *heap_caps_malloc(size_t size, uint32_t caps) { (void)caps; return malloc(size); }
+
+#endif
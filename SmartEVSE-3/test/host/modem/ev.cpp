@@ -0,0 +1,1007 @@
+/*
+ * Replay harness for the modem stack: scripted EV
+ */
+
+#include <cstring>
+#include "ev.h"
+#include "qca7000.h"
+
+extern "C" {
+#include "exi2/exi_basetypes.h"
+#include "exi2/appHand_Decoder.h"
+#include "exi2/appHand_Encoder.h"
+#include "exi2/din_msgDefDecoder.h"
+#include "exi2/din_msgDefEncoder.h"
+#include "exi2/iso2_msgDefDecoder.h"
+#include "exi2/iso2_msgDefEncoder.h"
+#include "exi2/iso20_AC_Decoder.h"
+#include "exi2/iso20_AC_Encoder.h"
+#include "exi2/iso20_CommonMessages_Decoder.h"
+#include "exi2/iso20_CommonMessages_Encoder.h"
+}
+
+#define TCP_FIN 0x01
+#define TCP_SYN 0x02
+#define TCP_RST 0x04
+#define TCP_PSH 0x08
+#define TCP_ACK 0x10
+
+#define SLAC_PARAM_TIMEOUT 250                                                  // ms, TT_match_response
+#define ATTEN_CHAR_TIMEOUT 1200                                                 // ms from CM_START_ATTEN_CHAR.IND, TT_EV_atten_results
+#define MATCH_TIMEOUT 200                                                       // ms
+#define SDP_TIMEOUT 250                                                         // ms, V2G_SECC_SequenceTimeout of SDP
+#define V2G_TIMEOUT 2000                                                        // ms, V2G message timeout
+#define TCP_RTO 400                                                             // ms, retransmission timeout of the EV
+#define THINK 20                                                                // ms between a response and the next request
+
+static const uint8_t Broadcast[6] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+static const uint8_t AllNodesMac[6] = {0x33, 0x33, 0x00, 0x00, 0x00, 0x01};
+static const uint8_t AllNodesIp[16] = {0xff, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1};
+
+// The documents are large (the iso2 one ~24 KB, the iso20 one ~300 KB), and only used while one request or response is coded.
+static struct appHand_exiDocument AppDoc;
+static struct din_exiDocument DinDoc;
+static struct iso2_exiDocument Iso2Doc;
+static struct iso20_exiDocument Iso20Doc;
+static struct iso20_ac_exiDocument Iso20AcDoc;
+
+Ev::Ev(const EvProfile &profile) : Profile(profile) {
+    linkLocalIp(Profile.Mac, Ip);
+    SdpPort = 49152 + Profile.Mac[5];
+    TcpPort = 50000 + Profile.Mac[5];
+    for (int i = 0; i < 8; i++) RunId[i] = Profile.Mac[i % 6] ^ (0x11 * i);
+
+    if (Profile.Protocol == EV_ISO20) {
+        Script = {APP_HAND, SESSION_SETUP, AUTHORIZATION_SETUP, AUTHORIZATION, SERVICE_DISCOVERY, SERVICE_DETAIL,
+                  PAYMENT_SELECTION, CHARGE_PARAMETER, SCHEDULE_EXCHANGE, POWER_DELIVERY_START};
+        for (int i = 0; i < Profile.ChargingStatus; i++) Script.push_back(CHARGING_STATUS);
+        Script.push_back(POWER_DELIVERY_STOP);
+        Script.push_back(SESSION_STOP);
+        return;
+    }
+    Script = {APP_HAND, SESSION_SETUP, SERVICE_DISCOVERY, PAYMENT_SELECTION, AUTHORIZATION, CHARGE_PARAMETER};
+    if (Profile.Protocol == EV_ISO2) {
+        Script.push_back(POWER_DELIVERY_START);
+        for (int i = 0; i < Profile.ChargingStatus; i++) Script.push_back(CHARGING_STATUS);
+        Script.push_back(POWER_DELIVERY_STOP);
+        Script.push_back(SESSION_STOP);
+    }
+}
+
+void Ev::fail(const std::string &why) {
+    if (finished()) return;
+    Failure = why;
+    State = FINISHED;
+    cancel(0);
+    cancel(1);
+}
+
+void Ev::finish(void) {
+    if (finished()) return;
+    Done = true;
+    TDone = hostMillis;
+    State = FINISHED;
+    cancel(0);
+    cancel(1);
+}
+
+// A timer per slot; starting it again, or cancel(), makes the pending one a no-op.
+void Ev::timer(int slot, unsigned long ms, std::function<void()> fn) {
+    uint32_t id = ++Timers[slot];
+    sim.after(ms, [this, slot, id, fn]() { if (Timers[slot] == id && !finished()) fn(); });
+}
+
+void Ev::send(const Frame &frame) {
+    powerline.toEvse(this, frame);
+}
+
+const char *Ev::name(Message msg) const {
+    static const char *const Din[] = {"supportedAppProtocol", "SessionSetup", "ServiceDiscovery", "ServicePaymentSelection",
+                                      "ContractAuthentication", "ChargeParameterDiscovery"};
+    static const char *const Iso2[] = {"supportedAppProtocol", "SessionSetup", "ServiceDiscovery", "PaymentServiceSelection",
+                                       "Authorization", "ChargeParameterDiscovery", "PowerDelivery(Start)", "ChargingStatus",
+                                       "PowerDelivery(Stop)", "SessionStop"};
+    static const char *const Iso20[] = {"supportedAppProtocol", "SessionSetup", "ServiceDiscovery", "ServiceSelection",
+                                        "Authorization", "AC_ChargeParameterDiscovery", "PowerDelivery(Start)", "AC_ChargeLoop",
+                                        "PowerDelivery(Stop)", "SessionStop", "AuthorizationSetup", "ServiceDetail",
+                                        "ScheduleExchange"};
+    return Profile.Protocol == EV_DIN ? Din[msg] : Profile.Protocol == EV_ISO2 ? Iso2[msg] : Iso20[msg];
+}
+
+// -20 has a V2GTP payload type for its common messages, and one for AC
+uint16_t Ev::payloadType(Message msg) const {
+    if (Profile.Protocol != EV_ISO20 || msg == APP_HAND) return 0x8001;
+    return msg == CHARGE_PARAMETER || msg == CHARGING_STATUS ? 0x8003 : 0x8002;
+}
+
+/*
+ * SLAC, ISO 15118-3
+ */
+
+void Ev::start(void) {
+    TStart = hostMillis;
+    Retries = 0;
+    sendSlacParam();
+}
+
+void Ev::sendSlacParam(void) {
+    Frame f = mmeFrame(Broadcast, Profile.Mac, 0x6064, 1, 60);                 // CM_SLAC_PARAM.REQ
+
+    memcpy(&f[21], RunId, 8);
+    State = SLAC_PARAM;
+    send(f);
+    timer(0, SLAC_PARAM_TIMEOUT, [this]() {
+        if (++Retries == 3) fail("no CM_SLAC_PARAM.CNF");
+        else sendSlacParam();
+    });
+}
+
+// Three CM_START_ATTEN_CHAR.IND, then ten CM_MNBC_SOUND.IND, 20 ms apart.
+void Ev::sound(int n) {
+    Frame f;
+
+    if (State != SOUNDING) return;
+    if (n < 3) {
+        f = mmeFrame(Broadcast, Profile.Mac, 0x606A, 1, 60);                    // CM_START_ATTEN_CHAR.IND
+        f[21] = 10;                                                             // sounds
+        f[22] = 6;                                                              // timeout, 600 ms
+        f[23] = 1;                                                              // response type
+        memcpy(&f[24], Profile.Mac, 6);                                         // forwarding STA
+        memcpy(&f[30], RunId, 8);
+    } else {
+        f = mmeFrame(Broadcast, Profile.Mac, 0x6076, 1, 71);                    // CM_MNBC_SOUND.IND
+        f[38] = 12 - n;                                                         // remaining sounds
+        memcpy(&f[39], RunId, 8);
+        for (int i = 55; i < 71; i++) f[i] = rand();
+    }
+    send(f);
+    if (n < 12) sim.after(20, [this, n]() { sound(n + 1); });
+}
+
+void Ev::sendMatch(void) {
+    Frame f = mmeFrame(EvseMac, Profile.Mac, 0x607C, 1, 85);                    // CM_SLAC_MATCH.REQ
+
+    f[21] = 0x3e;                                                               // MVFLength
+    memcpy(&f[40], Profile.Mac, 6);
+    memcpy(&f[63], EvseMac, 6);
+    memcpy(&f[69], RunId, 8);
+    send(f);
+    timer(0, MATCH_TIMEOUT, [this]() {
+        if (++Retries == 3) fail("no CM_SLAC_MATCH.CNF");
+        else sendMatch();
+    });
+}
+
+void Ev::homePlug(const Frame &f) {
+    bool forUs = memcmp(&f[0], Profile.Mac, 6) == 0;
+
+    switch (mmeType(f)) {
+        case 0x6065:                                                            // CM_SLAC_PARAM.CNF
+            if (!forUs || State != SLAC_PARAM || memcmp(&f[36], RunId, 8) != 0) return;
+            if (f[25] != 10) {
+                fail("CM_SLAC_PARAM.CNF asks for " + std::to_string(f[25]) + " sounds");
+                return;
+            }
+            State = SOUNDING;
+            timer(0, ATTEN_CHAR_TIMEOUT, [this]() {
+                if (Profile.ExpectMatch) fail("no CM_ATTEN_CHAR.IND");
+                else finish();                                                  // not matched, as it should be
+            });
+            sound(0);
+            return;
+
+        case 0x606E: {                                                          // CM_ATTEN_CHAR.IND
+            unsigned sum = 0;
+
+            if (!forUs || State != SOUNDING || memcmp(&f[21], Profile.Mac, 6) != 0 || memcmp(&f[27], RunId, 8) != 0) return;
+            if (!Profile.ExpectMatch) {
+                fail("matched by an EVSE it is not connected to");
+                return;
+            }
+            if (f.size() < 129 || f[70] != 58) {
+                fail("CM_ATTEN_CHAR.IND without 58 groups");
+                return;
+            }
+            for (int i = 0; i < 58; i++) sum += f[71 + i];
+            SoundsReported = f[69];
+            AttenReported = sum / 58;
+            memcpy(EvseMac, &f[6], 6);
+
+            Frame rsp = mmeFrame(EvseMac, Profile.Mac, 0x606F, 1, 70);          // CM_ATTEN_CHAR.RSP
+            memcpy(&rsp[21], Profile.Mac, 6);
+            memcpy(&rsp[27], RunId, 8);
+            rsp[69] = 0;                                                        // success
+            send(rsp);
+            State = MATCH;
+            Retries = 0;
+            cancel(0);
+            sim.after(10, [this]() { if (State == MATCH) sendMatch(); });
+            return;
+        }
+
+        case 0x607D:                                                            // CM_SLAC_MATCH.CNF
+            if (!forUs || State != MATCH || memcmp(&f[40], Profile.Mac, 6) != 0 || memcmp(&f[69], RunId, 8) != 0) return;
+            if (f.size() < 109) {
+                fail("CM_SLAC_MATCH.CNF truncated");
+                return;
+            }
+            memcpy(Nmk, &f[93], 16);
+            Joined = true;                                                      // our modem joins the AVLN of the EVSE
+            TMatched = hostMillis;
+            cancel(0);
+            State = SDP;
+            Retries = 0;
+            sim.after(100, [this]() { sendSdp(); });
+            return;
+
+        case 0xA000:                                                            // GET_SW.REQ
+            // Our modem answers when it is in the same AVLN as the EVSE modem.
+            if (Joined && memcmp(Nmk, powerline.Modem->Nmk, 16) == 0) {
+                Frame cnf = mmeFrame(&f[6], Profile.ModemMac, 0xA001, 0, 60);
+                sim.after(5, [this, cnf]() { send(cnf); });
+            }
+            return;
+    }
+}
+
+/*
+ * SDP, neighbor discovery and TCP
+ */
+
+void Ev::sendSdp(void) {
+    uint8_t udp[18] = {0, 0, 15118 >> 8, 15118 & 0xff, 0, 18, 0, 0, 0x01, 0xfe, 0x90, 0x00, 0, 0, 0, 2, 0x10, 0x00};
+
+    if (State != SDP) return;
+    put16(udp, SdpPort);
+    send(ipv6Frame(AllNodesMac, Profile.Mac, Ip, AllNodesIp, 0x11, 255, udp, sizeof(udp)));
+    timer(0, SDP_TIMEOUT, [this]() {
+        if (++Retries == 20) fail("no SDP response");
+        else sendSdp();
+    });
+}
+
+void Ev::sendNeighborSolicitation(void) {
+    uint8_t icmp[32] = {0x87};
+    uint8_t dstIp[16] = {0xff, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0xff};     // solicited-node multicast
+    uint8_t dstMac[6] = {0x33, 0x33, 0xff};
+
+    memcpy(dstIp + 13, SeccIp + 13, 3);
+    memcpy(dstMac + 3, SeccIp + 13, 3);
+    memcpy(icmp + 8, SeccIp, 16);                                               // target
+    icmp[24] = 1;                                                               // source link-layer address
+    icmp[25] = 1;
+    memcpy(icmp + 26, Profile.Mac, 6);
+    State = NEIGHBOR;
+    send(ipv6Frame(dstMac, Profile.Mac, Ip, dstIp, 0x3a, 255, icmp, sizeof(icmp)));
+    timer(0, 500, [this]() {
+        if (++Retries == 3) fail("no Neighbor Advertisement");
+        else sendNeighborSolicitation();
+    });
+}
+
+void Ev::connect(void) {
+    State = CONNECT;
+    Retries = 0;
+    Iss = 0x10000000 + Profile.Mac[5] * 0x1000;
+    SndUna = Iss;
+    SndNxt = Iss + 1;
+    segment(Iss, TCP_SYN, NULL, 0, true);
+    timer(0, TCP_RTO, [this]() {
+        if (++Retries == 5) fail("no SYN+ACK");
+        else connect();
+    });
+}
+
+void Ev::segment(uint32_t seq, uint8_t flags, const uint8_t *data, size_t len, bool mss) {
+    size_t hdr = mss ? 24 : 20;
+    std::vector<uint8_t> tcp(hdr + len, 0);
+
+    put16(&tcp[0], TcpPort);
+    put16(&tcp[2], SeccPort);
+    put32(&tcp[4], seq);
+    put32(&tcp[8], flags & TCP_ACK ? RcvNxt : 0);
+    tcp[12] = (hdr / 4) << 4;
+    tcp[13] = flags;
+    put16(&tcp[14], 8192);                                                      // window
+    if (mss) {
+        tcp[20] = 2;
+        tcp[21] = 4;
+        put16(&tcp[22], 1220);
+    }
+    if (len) memcpy(&tcp[hdr], data, len);
+    send(ipv6Frame(EvseMac, Profile.Mac, Ip, SeccIp, 0x06, 64, tcp.data(), tcp.size()));
+}
+
+void Ev::sendData(const uint8_t *data, size_t len) {
+    bool idle = SndUna == SndNxt;
+
+    TxUnacked.insert(TxUnacked.end(), data, data + len);
+    segment(SndNxt, TCP_PSH | TCP_ACK, data, len);
+    SndNxt += len;
+    if (idle) timer(1, TCP_RTO, [this]() { retransmit(); });
+}
+
+// Everything unacknowledged as one segment, like the EVSE does.
+void Ev::retransmit(void) {
+    if (SndUna == SndNxt) return;
+    if (++Retries > 6) {
+        fail("no ACK from the EVSE");
+        return;
+    }
+    Retransmits++;
+    if (TxUnacked.size()) segment(SndUna, TCP_PSH | TCP_ACK | (FinSent ? TCP_FIN : 0), TxUnacked.data(), TxUnacked.size());
+    else segment(SndUna, TCP_ACK | TCP_FIN, NULL, 0);
+    timer(1, TCP_RTO, [this]() { retransmit(); });
+}
+
+void Ev::tcp(const Frame &f, uint32_t cpuUs) {
+    size_t hdr = (f[66] >> 4) * 4;
+    size_t len = get16(&f[18]) - hdr;
+    uint32_t seq = get32(&f[58]), ack = get32(&f[62]);
+    uint8_t flags = f[67];
+
+    if (get16(&f[54]) != SeccPort || get16(&f[56]) != TcpPort || State < CONNECT) return;
+    if (flags & TCP_RST) {
+        fail("connection reset by the EVSE");
+        return;
+    }
+    if (State == CONNECT) {
+        if ((flags & (TCP_SYN | TCP_ACK)) != (TCP_SYN | TCP_ACK) || ack != Iss + 1) {
+            fail("expected SYN+ACK");
+            return;
+        }
+        RcvNxt = seq + 1;
+        SndUna = Iss + 1;
+        TConnected = hostMillis;
+        cancel(0);
+        segment(SndNxt, TCP_ACK, NULL, 0);
+        State = V2G;
+        Step = 0;
+        nextRequest();
+        return;
+    }
+    if (flags & TCP_SYN) {                                                      // our ACK of the SYN+ACK was lost
+        segment(SndNxt, TCP_ACK, NULL, 0);
+        return;
+    }
+
+    if ((flags & TCP_ACK) && (int32_t)(ack - SndUna) > 0) {
+        if ((int32_t)(ack - SndNxt) > 0) {
+            fail("EVSE acknowledges data we did not send");
+            return;
+        }
+        uint32_t acked = ack - SndUna;
+        if (FinSent && ack == SndNxt) acked--;
+        TxUnacked.erase(TxUnacked.begin(), TxUnacked.begin() + std::min<size_t>(acked, TxUnacked.size()));
+        SndUna = ack;
+        Retries = 0;
+        if (SndUna == SndNxt) {
+            cancel(1);
+            if (State == CLOSING) {
+                finish();
+                return;
+            }
+        } else timer(1, TCP_RTO, [this]() { retransmit(); });
+    }
+
+    if (len) {
+        if (seq != RcvNxt) {
+            DupSegments++;                                                      // a retransmission, or an earlier segment got lost
+            segment(SndNxt, TCP_ACK, NULL, 0);
+            return;
+        }
+        RxStream.insert(RxStream.end(), &f[54 + hdr], &f[54 + hdr] + len);
+        RcvNxt += len;
+        segment(SndNxt, TCP_ACK, NULL, 0);
+    }
+
+    // complete V2GTP messages
+    while (RxStream.size() >= 8 && State == V2G) {
+        uint32_t exiLen = get32(&RxStream[4]);
+        if (RxStream[0] != 0x01 || RxStream[1] != 0xfe) {
+            fail("invalid V2GTP header");
+            return;
+        }
+        if (RxStream.size() < 8 + exiLen) break;
+        if (Step >= Script.size() || RequestTime == 0) {
+            fail("response without a request");
+            return;
+        }
+        Message msg = Script[Step];
+        if (get16(&RxStream[2]) != payloadType(msg)) {
+            fail(std::string(name(msg)) + "Res with V2GTP payload type " + std::to_string(get16(&RxStream[2])));
+            return;
+        }
+        std::string error = checkResponse(msg, &RxStream[8], exiLen);
+        if (!error.empty()) {
+            fail(std::string(name(msg)) + "Res: " + error);
+            return;
+        }
+        Stats.push_back({name(msg), RequestBytes, (uint16_t)exiLen, hostMillis - RequestTime, cpuUs});
+        if (msg == CHARGE_PARAMETER && !TChargeParameter) TChargeParameter = hostMillis;
+        RxStream.erase(RxStream.begin(), RxStream.begin() + 8 + exiLen);
+        RequestTime = 0;
+        cancel(0);
+        Step++;
+        if (Step < Script.size()) sim.after(Script[Step] == CHARGING_STATUS ? 200 : THINK, [this]() { nextRequest(); });
+        else timer(0, V2G_TIMEOUT, [this]() { fail("EVSE did not close the connection after SessionStop"); });
+    }
+
+    if (flags & TCP_FIN) {
+        if (seq + len != RcvNxt) return;                                        // data before the FIN is missing
+        if (Step < Script.size()) {
+            fail(std::string("connection closed before ") + name(Script[Step]) + "Res");
+            return;
+        }
+        RcvNxt++;
+        if (State == CLOSING) {                                                 // retransmitted FIN, our FIN+ACK was lost
+            segment(SndNxt - 1, TCP_FIN | TCP_ACK, NULL, 0);
+            return;
+        }
+        State = CLOSING;
+        cancel(0);
+        FinSent = true;
+        segment(SndNxt, TCP_FIN | TCP_ACK, NULL, 0);
+        SndNxt++;
+        timer(1, TCP_RTO, [this]() { retransmit(); });
+    }
+}
+
+void Ev::receive(const Frame &f, uint32_t cpuUs) {
+    if (finished() || f.size() < 60) return;
+    if (memcmp(&f[0], Profile.Mac, 6) != 0 && memcmp(&f[0], Broadcast, 6) != 0) return;
+
+    if (frameType(f) == ETHERTYPE_HOMEPLUG) {
+        homePlug(f);
+        return;
+    }
+    if (frameType(f) != ETHERTYPE_IPV6 || State < SDP) return;
+
+    size_t plen = get16(&f[18]);
+    uint8_t next = f[20];
+    if (54 + plen > f.size()) {
+        fail("truncated IPv6 frame");
+        return;
+    }
+    if (memcmp(&f[38], Ip, 16) != 0) return;
+    if (ipv6Checksum(&f[22], &f[38], next, &f[54], plen) != 0) {
+        fail("IPv6 frame with a bad checksum");
+        return;
+    }
+
+    if (next == 0x11 && State == SDP && get16(&f[56]) == SdpPort) {
+        const uint8_t *sdp = &f[62];
+        if (plen < 8 + 28 || sdp[0] != 0x01 || sdp[1] != 0xfe || get16(sdp + 2) != 0x9001 || get32(sdp + 4) != 20) {
+            fail("invalid SDP response");
+            return;
+        }
+        if (sdp[26] != 0x10 || sdp[27] != 0x00) {
+            fail("SDP response without TCP and no TLS");
+            return;
+        }
+        memcpy(SeccIp, sdp + 8, 16);
+        SeccPort = get16(sdp + 24);
+        if (memcmp(&f[6], EvseMac, 6) != 0) {
+            fail("SDP response from another MAC than SLAC");
+            return;
+        }
+        TSdp = hostMillis;
+        cancel(0);
+        Retries = 0;
+        if (Profile.NeighborSolicitation) sendNeighborSolicitation();
+        else connect();
+    } else if (next == 0x3a && State == NEIGHBOR && f[54] == 0x88) {           // Neighbor Advertisement
+        if (memcmp(&f[62], SeccIp, 16) != 0 || f[78] != 2 || memcmp(&f[80], EvseMac, 6) != 0) {
+            fail("invalid Neighbor Advertisement");
+            return;
+        }
+        cancel(0);
+        connect();
+    } else if (next == 0x06) {
+        tcp(f, cpuUs);
+    }
+}
+
+/*
+ * V2G
+ */
+
+void Ev::nextRequest(void) {
+    uint8_t buf[8 + 1024];
+    size_t len;
+
+    if (State != V2G) return;
+    len = encodeRequest(Script[Step], buf + 8, sizeof(buf) - 8);
+    if (!len) {
+        fail(std::string("could not encode ") + name(Script[Step]) + "Req");
+        return;
+    }
+    buf[0] = 0x01;
+    buf[1] = 0xfe;
+    put16(buf + 2, payloadType(Script[Step]));
+    put32(buf + 4, len);
+    if (Profile.SplitV2gtp) {
+        sendData(buf, 8);
+        sendData(buf + 8, len);
+    } else sendData(buf, 8 + len);
+    RequestTime = hostMillis;
+    RequestBytes = len;
+
+    // DIN: with the SoC from ChargeParameterDiscoveryReq the EVSE has what it needs, and ends the session without a response
+    if (Profile.Protocol == EV_DIN && Script[Step] == CHARGE_PARAMETER) {
+        timer(0, 1000, [this]() {
+            Stats.push_back({name(CHARGE_PARAMETER), RequestBytes, 0, 0, 0});
+            Step++;
+            finish();
+        });
+        return;
+    }
+    timer(0, V2G_TIMEOUT, [this]() { fail(std::string("no ") + name(Script[Step]) + "Res"); });
+}
+
+static void protocol(struct appHand_AppProtocolType *p, const char *ns, uint32_t major, uint8_t schemaId, uint8_t priority) {
+    p->ProtocolNamespace.charactersLen = strlen(ns);
+    memcpy(p->ProtocolNamespace.characters, ns, p->ProtocolNamespace.charactersLen);
+    p->VersionNumberMajor = major;
+    p->VersionNumberMinor = 0;
+    p->SchemaID = schemaId;
+    p->Priority = priority;
+}
+
+#define DIN_VALUE(v, unit, multiplier, value) do { (v).Unit = din_unitSymbolType_##unit; (v).Unit_isUsed = 1; (v).Multiplier = multiplier; (v).Value = value; } while (0)
+#define ISO2_VALUE(v, unit, multiplier, value) do { (v).Unit = iso2_unitSymbolType_##unit; (v).Multiplier = multiplier; (v).Value = value; } while (0)
+
+size_t Ev::encodeRequest(Message msg, uint8_t *buf, size_t size) {
+    exi_bitstream_t stream;
+    int err;
+
+    exi_bitstream_init(&stream, buf, size, 0, NULL);
+    if (msg == APP_HAND) {
+        init_appHand_exiDocument(&AppDoc);
+        AppDoc.supportedAppProtocolReq_isUsed = 1;
+        auto &list = AppDoc.supportedAppProtocolReq.AppProtocol;
+        if (Profile.Protocol == EV_ISO20) {                                     // not in the order of Priority
+            protocol(&list.array[list.arrayLen++], "urn:din:70121:2012:MsgDef", 2, 3, 3);
+            protocol(&list.array[list.arrayLen++], "urn:iso:15118:2:2013:MsgDef", 2, 2, 2);
+            protocol(&list.array[list.arrayLen++], "urn:iso:std:iso:15118:-20:AC", 1, 1, 1);
+        } else if (Profile.Protocol == EV_ISO2) {
+            if (Profile.Offers20) protocol(&list.array[list.arrayLen++], "urn:iso:std:iso:15118:-20:AC", 1, 3, 2);
+            protocol(&list.array[list.arrayLen++], "urn:iso:15118:2:2013:MsgDef", 2, 1, 1);
+            protocol(&list.array[list.arrayLen++], "urn:din:70121:2012:MsgDef", 2, 2, Profile.Offers20 ? 3 : 2);
+        } else {
+            protocol(&list.array[list.arrayLen++], "urn:din:70121:2012:MsgDef", 2, 1, 1);
+        }
+        err = encode_appHand_exiDocument(&stream, &AppDoc);
+        return err ? 0 : stream.byte_pos + 1;
+    }
+    if (Profile.Protocol == EV_ISO20) return encodeIso20Request(msg, buf, size);
+
+    if (Profile.Protocol == EV_DIN) {
+        struct din_BodyType &body = DinDoc.V2G_Message.Body;
+
+        init_din_exiDocument(&DinDoc);
+        init_din_MessageHeaderType(&DinDoc.V2G_Message.Header);
+        init_din_BodyType(&body);
+        DinDoc.V2G_Message.Header.SessionID.bytesLen = msg == SESSION_SETUP ? 8 : SessionIdLen;
+        memcpy(DinDoc.V2G_Message.Header.SessionID.bytes, SessionId, msg == SESSION_SETUP ? 0 : SessionIdLen);
+        switch (msg) {
+            case SESSION_SETUP:
+                body.SessionSetupReq_isUsed = 1;
+                body.SessionSetupReq.EVCCID.bytesLen = 6;
+                memcpy(body.SessionSetupReq.EVCCID.bytes, Profile.Mac, 6);
+                break;
+            case SERVICE_DISCOVERY:
+                body.ServiceDiscoveryReq_isUsed = 1;
+                body.ServiceDiscoveryReq.ServiceCategory_isUsed = 1;
+                body.ServiceDiscoveryReq.ServiceCategory = din_serviceCategoryType_EVCharging;
+                break;
+            case PAYMENT_SELECTION:
+                body.ServicePaymentSelectionReq_isUsed = 1;
+                body.ServicePaymentSelectionReq.SelectedPaymentOption = din_paymentOptionType_ExternalPayment;
+                body.ServicePaymentSelectionReq.SelectedServiceList.SelectedService.arrayLen = 1;
+                body.ServicePaymentSelectionReq.SelectedServiceList.SelectedService.array[0].ServiceID = 1;
+                break;
+            case AUTHORIZATION:
+                body.ContractAuthenticationReq_isUsed = 1;
+                break;
+            case CHARGE_PARAMETER: {
+                struct din_DC_EVChargeParameterType &dc = body.ChargeParameterDiscoveryReq.DC_EVChargeParameter;
+                body.ChargeParameterDiscoveryReq_isUsed = 1;
+                body.ChargeParameterDiscoveryReq.EVRequestedEnergyTransferType = din_EVRequestedEnergyTransferType_DC_extended;
+                body.ChargeParameterDiscoveryReq.DC_EVChargeParameter_isUsed = 1;
+                dc.DC_EVStatus.EVReady = 1;
+                dc.DC_EVStatus.EVErrorCode = din_DC_EVErrorCodeType_NO_ERROR;
+                dc.DC_EVStatus.EVRESSSOC = Profile.SoC;
+                DIN_VALUE(dc.EVMaximumCurrentLimit, A, 0, 200);
+                DIN_VALUE(dc.EVMaximumVoltageLimit, V, 0, 450);
+                DIN_VALUE(dc.EVMaximumPowerLimit, W, 3, 100);
+                dc.EVMaximumPowerLimit_isUsed = 1;
+                DIN_VALUE(dc.EVEnergyCapacity, Wh, 3, 77);
+                dc.EVEnergyCapacity_isUsed = 1;
+                DIN_VALUE(dc.EVEnergyRequest, Wh, 3, 50);
+                dc.EVEnergyRequest_isUsed = 1;
+                dc.FullSOC = 100;
+                dc.FullSOC_isUsed = 1;
+                dc.BulkSOC = 80;
+                dc.BulkSOC_isUsed = 1;
+                break;
+            }
+            default:
+                return 0;
+        }
+        err = encode_din_exiDocument(&stream, &DinDoc);
+        return err ? 0 : stream.byte_pos + 1;
+    }
+
+    struct iso2_BodyType &body = Iso2Doc.V2G_Message.Body;
+
+    init_iso2_exiDocument(&Iso2Doc);
+    init_iso2_MessageHeaderType(&Iso2Doc.V2G_Message.Header);
+    init_iso2_BodyType(&body);
+    Iso2Doc.V2G_Message.Header.SessionID.bytesLen = msg == SESSION_SETUP ? 8 : SessionIdLen;
+    memcpy(Iso2Doc.V2G_Message.Header.SessionID.bytes, SessionId, msg == SESSION_SETUP ? 0 : SessionIdLen);
+    switch (msg) {
+        case SESSION_SETUP:
+            body.SessionSetupReq_isUsed = 1;
+            body.SessionSetupReq.EVCCID.bytesLen = 6;
+            memcpy(body.SessionSetupReq.EVCCID.bytes, Profile.Mac, 6);
+            break;
+        case SERVICE_DISCOVERY:
+            body.ServiceDiscoveryReq_isUsed = 1;
+            break;
+        case PAYMENT_SELECTION:
+            body.PaymentServiceSelectionReq_isUsed = 1;
+            body.PaymentServiceSelectionReq.SelectedPaymentOption = iso2_paymentOptionType_ExternalPayment;
+            body.PaymentServiceSelectionReq.SelectedServiceList.SelectedService.arrayLen = 1;
+            body.PaymentServiceSelectionReq.SelectedServiceList.SelectedService.array[0].ServiceID = 1;
+            break;
+        case AUTHORIZATION:
+            body.AuthorizationReq_isUsed = 1;
+            break;
+        case CHARGE_PARAMETER: {
+            struct iso2_AC_EVChargeParameterType &ac = body.ChargeParameterDiscoveryReq.AC_EVChargeParameter;
+            body.ChargeParameterDiscoveryReq_isUsed = 1;
+            body.ChargeParameterDiscoveryReq.RequestedEnergyTransferMode = iso2_EnergyTransferModeType_AC_three_phase_core;
+            body.ChargeParameterDiscoveryReq.AC_EVChargeParameter_isUsed = 1;
+            ISO2_VALUE(ac.EAmount, Wh, 3, 20);
+            ISO2_VALUE(ac.EVMaxVoltage, V, 0, 400);
+            ISO2_VALUE(ac.EVMaxCurrent, A, 0, 32);
+            ISO2_VALUE(ac.EVMinCurrent, A, 0, 6);
+            break;
+        }
+        case POWER_DELIVERY_START:
+        case POWER_DELIVERY_STOP:
+            body.PowerDeliveryReq_isUsed = 1;
+            body.PowerDeliveryReq.ChargeProgress = msg == POWER_DELIVERY_START ? iso2_chargeProgressType_Start : iso2_chargeProgressType_Stop;
+            body.PowerDeliveryReq.SAScheduleTupleID = 1;
+            break;
+        case CHARGING_STATUS:
+            body.ChargingStatusReq_isUsed = 1;
+            break;
+        case SESSION_STOP:
+            body.SessionStopReq_isUsed = 1;
+            body.SessionStopReq.ChargingSession = iso2_chargingSessionType_Terminate;
+            break;
+        default:
+            return 0;
+    }
+    err = encode_iso2_exiDocument(&stream, &Iso2Doc);
+    return err ? 0 : stream.byte_pos + 1;
+}
+
+std::string Ev::checkResponse(Message msg, const uint8_t *exi, size_t len) {
+    exi_bitstream_t stream;
+
+    exi_bitstream_init(&stream, (uint8_t *)exi, len, 0, NULL);
+    if (msg == APP_HAND) {
+        memset(&AppDoc, 0, sizeof(AppDoc));
+        if (decode_appHand_exiDocument(&stream, &AppDoc)) return "decode error";
+        if (!AppDoc.supportedAppProtocolRes_isUsed) return "wrong message";
+        if (AppDoc.supportedAppProtocolRes.ResponseCode != appHand_responseCodeType_OK_SuccessfulNegotiation) return "no protocol negotiated";
+        if (!AppDoc.supportedAppProtocolRes.SchemaID_isUsed || AppDoc.supportedAppProtocolRes.SchemaID != 1) return "not the preferred protocol";
+        return "";
+    }
+    if (Profile.Protocol == EV_ISO20) return checkIso20Response(msg, exi, len);
+
+    if (Profile.Protocol == EV_DIN) {
+        struct din_BodyType &body = DinDoc.V2G_Message.Body;
+
+        memset(&DinDoc, 0, sizeof(DinDoc));
+        if (decode_din_exiDocument(&stream, &DinDoc)) return "decode error";
+        if (msg == SESSION_SETUP) {
+            if (!body.SessionSetupRes_isUsed) return "wrong message";
+            if (body.SessionSetupRes.ResponseCode != din_responseCodeType_OK_NewSessionEstablished) return "no new session";
+            SessionIdLen = DinDoc.V2G_Message.Header.SessionID.bytesLen;
+            memcpy(SessionId, DinDoc.V2G_Message.Header.SessionID.bytes, SessionIdLen);
+            return SessionIdLen ? "" : "no SessionID";
+        }
+        if (DinDoc.V2G_Message.Header.SessionID.bytesLen != SessionIdLen ||
+            memcmp(DinDoc.V2G_Message.Header.SessionID.bytes, SessionId, SessionIdLen) != 0) return "wrong SessionID";
+        switch (msg) {
+            case SERVICE_DISCOVERY:
+                if (!body.ServiceDiscoveryRes_isUsed) return "wrong message";
+                if (body.ServiceDiscoveryRes.ResponseCode != din_responseCodeType_OK) return "not OK";
+                if (body.ServiceDiscoveryRes.PaymentOptions.PaymentOption.arrayLen != 1 ||
+                    body.ServiceDiscoveryRes.PaymentOptions.PaymentOption.array[0] != din_paymentOptionType_ExternalPayment) return "no external payment";
+                return "";
+            case PAYMENT_SELECTION:
+                if (!body.ServicePaymentSelectionRes_isUsed) return "wrong message";
+                return body.ServicePaymentSelectionRes.ResponseCode == din_responseCodeType_OK ? "" : "not OK";
+            case AUTHORIZATION:
+                if (!body.ContractAuthenticationRes_isUsed) return "wrong message";
+                return body.ContractAuthenticationRes.EVSEProcessing == din_EVSEProcessingType_Finished ? "" : "not finished";
+            default:
+                return "unexpected response";
+        }
+    }
+
+    struct iso2_BodyType &body = Iso2Doc.V2G_Message.Body;
+
+    memset(&Iso2Doc, 0, sizeof(Iso2Doc));
+    if (decode_iso2_exiDocument(&stream, &Iso2Doc)) return "decode error";
+    if (msg == SESSION_SETUP) {
+        if (!body.SessionSetupRes_isUsed) return "wrong message";
+        if (body.SessionSetupRes.ResponseCode != iso2_responseCodeType_OK_NewSessionEstablished) return "no new session";
+        if (body.SessionSetupRes.EVSEID.charactersLen != 23 || memcmp(body.SessionSetupRes.EVSEID.characters, "SEV*01*SmartEVSE-", 17) != 0) return "invalid EVSEID";
+        SessionIdLen = Iso2Doc.V2G_Message.Header.SessionID.bytesLen;
+        memcpy(SessionId, Iso2Doc.V2G_Message.Header.SessionID.bytes, SessionIdLen);
+        return SessionIdLen ? "" : "no SessionID";
+    }
+    if (Iso2Doc.V2G_Message.Header.SessionID.bytesLen != SessionIdLen ||
+        memcmp(Iso2Doc.V2G_Message.Header.SessionID.bytes, SessionId, SessionIdLen) != 0) return "wrong SessionID";
+    switch (msg) {
+        case SERVICE_DISCOVERY:
+            if (!body.ServiceDiscoveryRes_isUsed) return "wrong message";
+            if (body.ServiceDiscoveryRes.ResponseCode != iso2_responseCodeType_OK) return "not OK";
+            if (body.ServiceDiscoveryRes.PaymentOptionList.PaymentOption.arrayLen != 1 ||
+                body.ServiceDiscoveryRes.PaymentOptionList.PaymentOption.array[0] != iso2_paymentOptionType_ExternalPayment) return "no external payment";
+            if (body.ServiceDiscoveryRes.ChargeService.ServiceID != 1) return "no charge service";
+            return "";
+        case PAYMENT_SELECTION:
+            if (!body.PaymentServiceSelectionRes_isUsed) return "wrong message";
+            return body.PaymentServiceSelectionRes.ResponseCode == iso2_responseCodeType_OK ? "" : "not OK";
+        case AUTHORIZATION:
+            if (!body.AuthorizationRes_isUsed) return "wrong message";
+            return body.AuthorizationRes.EVSEProcessing == iso2_EVSEProcessingType_Finished ? "" : "not finished";
+        case CHARGE_PARAMETER:
+            if (!body.ChargeParameterDiscoveryRes_isUsed) return "wrong message";
+            if (body.ChargeParameterDiscoveryRes.ResponseCode != iso2_responseCodeType_OK) return "not OK";
+            if (!body.ChargeParameterDiscoveryRes.AC_EVSEChargeParameter_isUsed) return "no AC_EVSEChargeParameter";
+            if (!body.ChargeParameterDiscoveryRes.SAScheduleList_isUsed ||
+                body.ChargeParameterDiscoveryRes.SAScheduleList.SAScheduleTuple.arrayLen != 1 ||
+                body.ChargeParameterDiscoveryRes.SAScheduleList.SAScheduleTuple.array[0].SAScheduleTupleID != 1) return "no SAScheduleTuple 1";
+            return "";
+        case POWER_DELIVERY_START:
+        case POWER_DELIVERY_STOP:
+            if (!body.PowerDeliveryRes_isUsed) return "wrong message";
+            if (body.PowerDeliveryRes.ResponseCode != iso2_responseCodeType_OK) return "not OK";
+            return body.PowerDeliveryRes.AC_EVSEStatus_isUsed ? "" : "no AC_EVSEStatus";
+        case CHARGING_STATUS:
+            if (!body.ChargingStatusRes_isUsed) return "wrong message";
+            if (body.ChargingStatusRes.ResponseCode != iso2_responseCodeType_OK) return "not OK";
+            return body.ChargingStatusRes.EVSEID.charactersLen == 23 ? "" : "invalid EVSEID";
+        case SESSION_STOP:
+            if (!body.SessionStopRes_isUsed) return "wrong message";
+            return body.SessionStopRes.ResponseCode == iso2_responseCodeType_OK ? "" : "not OK";
+        default:
+            return "unexpected response";
+    }
+}
+
+/*
+ * ISO 15118-20 AC, with EIM and dynamic control mode
+ */
+
+#define ISO20_HEADER(h) do { \
+    (h).SessionID.bytesLen = 8; \
+    memcpy((h).SessionID.bytes, SessionId, msg == SESSION_SETUP ? 0 : 8); \
+    (h).TimeStamp = hostMillis / 1000; } while (0)
+#define ISO20_VALUE(v, value, exponent) do { (v).Value = value; (v).Exponent = exponent; } while (0)
+
+size_t Ev::encodeIso20Request(Message msg, uint8_t *buf, size_t size) {
+    exi_bitstream_t stream;
+    int err;
+
+    exi_bitstream_init(&stream, buf, size, 0, NULL);
+    if (msg == CHARGE_PARAMETER || msg == CHARGING_STATUS) {
+        memset(&Iso20AcDoc, 0, sizeof(Iso20AcDoc));
+        if (msg == CHARGE_PARAMETER) {
+            struct iso20_ac_AC_ChargeParameterDiscoveryReqType &req = Iso20AcDoc.AC_ChargeParameterDiscoveryReq;
+            Iso20AcDoc.AC_ChargeParameterDiscoveryReq_isUsed = 1;
+            ISO20_HEADER(req.Header);
+            req.AC_CPDReqEnergyTransferMode_isUsed = 1;
+            ISO20_VALUE(req.AC_CPDReqEnergyTransferMode.EVMaximumChargePower, 11000, 0);
+            ISO20_VALUE(req.AC_CPDReqEnergyTransferMode.EVMinimumChargePower, 4140, 0);
+        } else {
+            struct iso20_ac_AC_ChargeLoopReqType &req = Iso20AcDoc.AC_ChargeLoopReq;
+            struct iso20_ac_Dynamic_AC_CLReqControlModeType &dynamic = req.Dynamic_AC_CLReqControlMode;
+            Iso20AcDoc.AC_ChargeLoopReq_isUsed = 1;
+            ISO20_HEADER(req.Header);
+            req.MeterInfoRequested = 0;
+            req.Dynamic_AC_CLReqControlMode_isUsed = 1;
+            ISO20_VALUE(dynamic.EVTargetEnergyRequest, 20, 3);
+            ISO20_VALUE(dynamic.EVMaximumEnergyRequest, 40, 3);
+            ISO20_VALUE(dynamic.EVMinimumEnergyRequest, 0, 0);
+            ISO20_VALUE(dynamic.EVMaximumChargePower, 11000, 0);
+            ISO20_VALUE(dynamic.EVMinimumChargePower, 4140, 0);
+            ISO20_VALUE(dynamic.EVPresentActivePower, Targets.empty() ? 0 : Targets.back().second, 0);  // the EV follows the target
+            ISO20_VALUE(dynamic.EVPresentReactivePower, 0, 0);
+        }
+        err = encode_iso20_ac_exiDocument(&stream, &Iso20AcDoc);
+        return err ? 0 : stream.byte_pos + 1;
+    }
+
+    memset(&Iso20Doc, 0, sizeof(Iso20Doc));
+    switch (msg) {
+        case SESSION_SETUP: {
+            const std::string evccid = [this]() {
+                char buf[13];
+                for (int i = 0; i < 6; i++) snprintf(buf + 2 * i, 3, "%02x", Profile.Mac[i]);
+                return std::string(buf);
+            }();
+            Iso20Doc.SessionSetupReq_isUsed = 1;
+            ISO20_HEADER(Iso20Doc.SessionSetupReq.Header);
+            Iso20Doc.SessionSetupReq.EVCCID.charactersLen = evccid.size();
+            memcpy(Iso20Doc.SessionSetupReq.EVCCID.characters, evccid.data(), evccid.size());
+            break;
+        }
+        case AUTHORIZATION_SETUP:
+            Iso20Doc.AuthorizationSetupReq_isUsed = 1;
+            ISO20_HEADER(Iso20Doc.AuthorizationSetupReq.Header);
+            break;
+        case AUTHORIZATION:
+            Iso20Doc.AuthorizationReq_isUsed = 1;
+            ISO20_HEADER(Iso20Doc.AuthorizationReq.Header);
+            Iso20Doc.AuthorizationReq.SelectedAuthorizationService = iso20_authorizationType_EIM;
+            Iso20Doc.AuthorizationReq.EIM_AReqAuthorizationMode_isUsed = 1;
+            break;
+        case SERVICE_DISCOVERY:
+            Iso20Doc.ServiceDiscoveryReq_isUsed = 1;
+            ISO20_HEADER(Iso20Doc.ServiceDiscoveryReq.Header);
+            break;
+        case SERVICE_DETAIL:
+            Iso20Doc.ServiceDetailReq_isUsed = 1;
+            ISO20_HEADER(Iso20Doc.ServiceDetailReq.Header);
+            Iso20Doc.ServiceDetailReq.ServiceID = 1;                            // AC
+            break;
+        case PAYMENT_SELECTION:
+            Iso20Doc.ServiceSelectionReq_isUsed = 1;
+            ISO20_HEADER(Iso20Doc.ServiceSelectionReq.Header);
+            Iso20Doc.ServiceSelectionReq.SelectedEnergyTransferService.ServiceID = 1;
+            Iso20Doc.ServiceSelectionReq.SelectedEnergyTransferService.ParameterSetID = 1;
+            break;
+        case SCHEDULE_EXCHANGE: {
+            struct iso20_Dynamic_SEReqControlModeType &dynamic = Iso20Doc.ScheduleExchangeReq.Dynamic_SEReqControlMode;
+            Iso20Doc.ScheduleExchangeReq_isUsed = 1;
+            ISO20_HEADER(Iso20Doc.ScheduleExchangeReq.Header);
+            Iso20Doc.ScheduleExchangeReq.MaximumSupportingPoints = 24;
+            Iso20Doc.ScheduleExchangeReq.Dynamic_SEReqControlMode_isUsed = 1;
+            dynamic.DepartureTime = 7200;
+            dynamic.TargetSOC_isUsed = 1;
+            dynamic.TargetSOC = 80;
+            ISO20_VALUE(dynamic.EVTargetEnergyRequest, 20, 3);
+            ISO20_VALUE(dynamic.EVMaximumEnergyRequest, 40, 3);
+            ISO20_VALUE(dynamic.EVMinimumEnergyRequest, 0, 0);
+            break;
+        }
+        case POWER_DELIVERY_START:
+        case POWER_DELIVERY_STOP:
+            Iso20Doc.PowerDeliveryReq_isUsed = 1;
+            ISO20_HEADER(Iso20Doc.PowerDeliveryReq.Header);
+            Iso20Doc.PowerDeliveryReq.EVProcessing = iso20_processingType_Finished;
+            Iso20Doc.PowerDeliveryReq.ChargeProgress = msg == POWER_DELIVERY_START ? iso20_chargeProgressType_Start : iso20_chargeProgressType_Stop;
+            break;
+        case SESSION_STOP:
+            Iso20Doc.SessionStopReq_isUsed = 1;
+            ISO20_HEADER(Iso20Doc.SessionStopReq.Header);
+            Iso20Doc.SessionStopReq.ChargingSession = iso20_chargingSessionType_Terminate;
+            break;
+        default:
+            return 0;
+    }
+    err = encode_iso20_exiDocument(&stream, &Iso20Doc);
+    return err ? 0 : stream.byte_pos + 1;
+}
+
+#define ISO20_SESSION(h) ((h).SessionID.bytesLen == 8 && memcmp((h).SessionID.bytes, SessionId, 8) == 0)
+
+std::string Ev::checkIso20Response(Message msg, const uint8_t *exi, size_t len) {
+    exi_bitstream_t stream;
+
+    exi_bitstream_init(&stream, (uint8_t *)exi, len, 0, NULL);
+    if (msg == CHARGE_PARAMETER || msg == CHARGING_STATUS) {
+        memset(&Iso20AcDoc, 0, sizeof(Iso20AcDoc));
+        if (decode_iso20_ac_exiDocument(&stream, &Iso20AcDoc)) return "decode error";
+        if (msg == CHARGE_PARAMETER) {
+            struct iso20_ac_AC_ChargeParameterDiscoveryResType &res = Iso20AcDoc.AC_ChargeParameterDiscoveryRes;
+            if (!Iso20AcDoc.AC_ChargeParameterDiscoveryRes_isUsed) return "wrong message";
+            if (!ISO20_SESSION(res.Header)) return "wrong SessionID";
+            if (res.ResponseCode != iso20_ac_responseCodeType_OK) return "not OK";
+            return res.AC_CPDResEnergyTransferMode_isUsed ? "" : "no AC_CPDResEnergyTransferMode";
+        }
+        struct iso20_ac_AC_ChargeLoopResType &res = Iso20AcDoc.AC_ChargeLoopRes;
+        if (!Iso20AcDoc.AC_ChargeLoopRes_isUsed) return "wrong message";
+        if (!ISO20_SESSION(res.Header)) return "wrong SessionID";
+        if (res.ResponseCode != iso20_ac_responseCodeType_OK) return "not OK";
+        if (!res.Dynamic_AC_CLResControlMode_isUsed) return "not in dynamic control mode";
+        struct iso20_ac_RationalNumberType &target = res.Dynamic_AC_CLResControlMode.EVSETargetActivePower;
+        uint32_t watts = target.Value;
+        for (int i = 0; i < target.Exponent; i++) watts *= 10;
+        Targets.push_back({hostMillis, watts});
+        return "";
+    }
+
+    memset(&Iso20Doc, 0, sizeof(Iso20Doc));
+    if (decode_iso20_exiDocument(&stream, &Iso20Doc)) return "decode error";
+    switch (msg) {
+        case SESSION_SETUP: {
+            struct iso20_SessionSetupResType &res = Iso20Doc.SessionSetupRes;
+            if (!Iso20Doc.SessionSetupRes_isUsed) return "wrong message";
+            if (res.ResponseCode != iso20_responseCodeType_OK_NewSessionEstablished) return "no new session";
+            if (res.EVSEID.charactersLen != 23 || memcmp(res.EVSEID.characters, "SEV*01*SmartEVSE-", 17) != 0) return "invalid EVSEID";
+            if (res.Header.SessionID.bytesLen != 8) return "no SessionID of 8 bytes";
+            SessionIdLen = 8;
+            memcpy(SessionId, res.Header.SessionID.bytes, 8);
+            return "";
+        }
+        case AUTHORIZATION_SETUP: {
+            struct iso20_AuthorizationSetupResType &res = Iso20Doc.AuthorizationSetupRes;
+            if (!Iso20Doc.AuthorizationSetupRes_isUsed) return "wrong message";
+            if (!ISO20_SESSION(res.Header)) return "wrong SessionID";
+            if (res.ResponseCode != iso20_responseCodeType_OK) return "not OK";
+            if (res.AuthorizationServices.arrayLen != 1 || res.AuthorizationServices.array[0] != iso20_authorizationType_EIM ||
+                !res.EIM_ASResAuthorizationMode_isUsed) return "no EIM";
+            return "";
+        }
+        case AUTHORIZATION:
+            if (!Iso20Doc.AuthorizationRes_isUsed) return "wrong message";
+            if (!ISO20_SESSION(Iso20Doc.AuthorizationRes.Header)) return "wrong SessionID";
+            if (Iso20Doc.AuthorizationRes.ResponseCode != iso20_responseCodeType_OK) return "not OK";
+            return Iso20Doc.AuthorizationRes.EVSEProcessing == iso20_processingType_Finished ? "" : "not finished";
+        case SERVICE_DISCOVERY: {
+            struct iso20_ServiceDiscoveryResType &res = Iso20Doc.ServiceDiscoveryRes;
+            if (!Iso20Doc.ServiceDiscoveryRes_isUsed) return "wrong message";
+            if (!ISO20_SESSION(res.Header)) return "wrong SessionID";
+            if (res.ResponseCode != iso20_responseCodeType_OK) return "not OK";
+            if (res.EnergyTransferServiceList.Service.arrayLen != 1 || res.EnergyTransferServiceList.Service.array[0].ServiceID != 1) return "no AC service";
+            return "";
+        }
+        case SERVICE_DETAIL: {
+            struct iso20_ServiceDetailResType &res = Iso20Doc.ServiceDetailRes;
+            if (!Iso20Doc.ServiceDetailRes_isUsed) return "wrong message";
+            if (!ISO20_SESSION(res.Header)) return "wrong SessionID";
+            if (res.ResponseCode != iso20_responseCodeType_OK) return "not OK";
+            if (res.ServiceID != 1 || res.ServiceParameterList.ParameterSet.arrayLen != 1) return "no parameter set for AC";
+            const struct iso20_ParameterSetType &set = res.ServiceParameterList.ParameterSet.array[0];
+            for (uint16_t i = 0; i < set.Parameter.arrayLen; i++) {
+                const struct iso20_ParameterType &p = set.Parameter.array[i];
+                if (p.Name.charactersLen == 11 && !memcmp(p.Name.characters, "ControlMode", 11))
+                    return p.intValue_isUsed && p.intValue == 2 ? "" : "not dynamic control mode";
+            }
+            return "no ControlMode";
+        }
+        case PAYMENT_SELECTION:
+            if (!Iso20Doc.ServiceSelectionRes_isUsed) return "wrong message";
+            if (!ISO20_SESSION(Iso20Doc.ServiceSelectionRes.Header)) return "wrong SessionID";
+            return Iso20Doc.ServiceSelectionRes.ResponseCode == iso20_responseCodeType_OK ? "" : "not OK";
+        case SCHEDULE_EXCHANGE: {
+            struct iso20_ScheduleExchangeResType &res = Iso20Doc.ScheduleExchangeRes;
+            if (!Iso20Doc.ScheduleExchangeRes_isUsed) return "wrong message";
+            if (!ISO20_SESSION(res.Header)) return "wrong SessionID";
+            if (res.ResponseCode != iso20_responseCodeType_OK) return "not OK";
+            if (res.EVSEProcessing != iso20_processingType_Finished) return "not finished";
+            return res.Dynamic_SEResControlMode_isUsed ? "" : "not dynamic control mode";
+        }
+        case POWER_DELIVERY_START:
+        case POWER_DELIVERY_STOP:
+            if (!Iso20Doc.PowerDeliveryRes_isUsed) return "wrong message";
+            if (!ISO20_SESSION(Iso20Doc.PowerDeliveryRes.Header)) return "wrong SessionID";
+            return Iso20Doc.PowerDeliveryRes.ResponseCode == iso20_responseCodeType_OK ? "" : "not OK";
+        case SESSION_STOP:
+            if (!Iso20Doc.SessionStopRes_isUsed) return "wrong message";
+            if (!ISO20_SESSION(Iso20Doc.SessionStopRes.Header)) return "wrong SessionID";
+            return Iso20Doc.SessionStopRes.ResponseCode == iso20_responseCodeType_OK ? "" : "not OK";
+        default:
+            return "unexpected response";
+    }
+}
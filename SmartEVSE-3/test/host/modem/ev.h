@@ -0,0 +1,116 @@
+/*
+ * Replay harness for the modem stack: scripted EV
+ *
+ * Plays the EV side of a charging session against the EVSE: SLAC (CM_SLAC_PARAM.REQ, three
+ * CM_START_ATTEN_CHAR.IND and ten CM_MNBC_SOUND.IND, CM_ATTEN_CHAR.RSP, CM_SLAC_MATCH.REQ), joining the AVLN
+ * with the NMK from CM_SLAC_MATCH.CNF, SDP, an optional Neighbor Solicitation, a TCP client, and the V2G
+ * requests of a DIN 70121, ISO 15118-2 or ISO 15118-20 AC session, encoded with the same exi2 codec the firmware
+ * uses.
+ *
+ * Every frame from the EVSE is checked independently of the firmware code: IPv6 checksums, TCP sequence and
+ * acknowledgement numbers, the V2GTP header, the decoded response and its SessionID. The first deviation
+ * ends the EV with a Failure.
+ */
+
+#ifndef __EV_H
+#define __EV_H
+
+#include <string>
+#include <vector>
+#include "powerline.h"
+
+enum EvProtocol { EV_DIN, EV_ISO2, EV_ISO20 };
+
+struct EvProfile {
+    const char *Name;
+    uint8_t Mac[6];                                                             // host MAC, also the EVCCID
+    uint8_t ModemMac[6];
+    uint8_t Attenuation;                                                        // dB, as the EVSE modem hears this EV
+    bool ExpectMatch;                                                           // false for an EV at another charge point
+    unsigned long Start;                                                        // ms after the EVSE modem is configured
+    EvProtocol Protocol;
+    bool NeighborSolicitation;                                                  // resolve the EVSE MAC after SDP
+    bool SplitV2gtp;                                                            // V2GTP header and EXI body in separate segments
+    uint8_t ChargingStatus;                                                     // ChargingStatusReq or AC_ChargeLoopReq in the charge loop
+    int8_t SoC;
+    bool Offers20;                                                              // ISO 15118-2 EV that offers -20 first, at a lower priority
+};
+
+struct MessageStat {
+    const char *Name;
+    uint16_t ReqBytes, ResBytes;                                                // EXI, without the V2GTP header
+    unsigned long Latency;                                                      // simulated ms, request sent to response received
+    uint32_t HostUs;                                                            // host time of the modem task iteration that answered
+};
+
+class Ev {
+public:
+    EvProfile Profile;
+    bool Done = false;
+    std::string Failure;
+    std::vector<MessageStat> Stats;
+    unsigned long TStart = 0, TMatched = 0, TSdp = 0, TConnected = 0, TDone = 0;
+    unsigned long TChargeParameter = 0;                                         // ChargeParameterDiscoveryRes received
+    uint8_t SoundsReported = 0, AttenReported = 0;                              // from CM_ATTEN_CHAR.IND
+    uint32_t Retransmits = 0, DupSegments = 0;
+    std::vector<std::pair<unsigned long, uint32_t>> Targets;                    // when, and the EVSETargetActivePower in W of every AC_ChargeLoopRes
+
+    explicit Ev(const EvProfile &profile);
+    void start(void);
+    void receive(const Frame &frame, uint32_t cpuUs);                           // every frame the EVSE transmits
+    bool finished(void) const { return Done || !Failure.empty(); }
+
+private:
+    enum Phase { IDLE, SLAC_PARAM, SOUNDING, MATCH, SDP, NEIGHBOR, CONNECT, V2G, CLOSING, FINISHED };
+    enum Message { APP_HAND, SESSION_SETUP, SERVICE_DISCOVERY, PAYMENT_SELECTION, AUTHORIZATION, CHARGE_PARAMETER,
+                   POWER_DELIVERY_START, CHARGING_STATUS, POWER_DELIVERY_STOP, SESSION_STOP,
+                   AUTHORIZATION_SETUP, SERVICE_DETAIL, SCHEDULE_EXCHANGE };           // -20 only, its ServiceSelection is PAYMENT_SELECTION
+
+    Phase State = IDLE;
+    uint8_t RunId[8];
+    uint8_t Nmk[16];
+    bool Joined = false;
+    uint8_t EvseMac[6];
+    uint8_t Ip[16], SeccIp[16];
+    uint16_t SdpPort, TcpPort, SeccPort = 0;
+    unsigned Retries = 0;
+    uint32_t Timers[2] = {0, 0};                                                // 0 = protocol timeout, 1 = TCP retransmission
+
+    uint32_t Iss = 0, SndUna = 0, SndNxt = 0, RcvNxt = 0;
+    std::vector<uint8_t> TxUnacked, RxStream;
+    bool FinSent = false;
+
+    std::vector<Message> Script;
+    size_t Step = 0;
+    unsigned long RequestTime = 0;
+    uint16_t RequestBytes = 0;
+    uint8_t SessionId[8];
+    uint16_t SessionIdLen = 0;
+
+    void fail(const std::string &why);
+    void finish(void);
+    void timer(int slot, unsigned long ms, std::function<void()> fn);
+    void cancel(int slot) { Timers[slot]++; }
+    void send(const Frame &frame);
+
+    void sendSlacParam(void);
+    void sound(int n);
+    void sendMatch(void);
+    void homePlug(const Frame &frame);
+    void sendSdp(void);
+    void sendNeighborSolicitation(void);
+    void connect(void);
+    void segment(uint32_t seq, uint8_t flags, const uint8_t *data, size_t len, bool mss = false);
+    void sendData(const uint8_t *data, size_t len);
+    void retransmit(void);
+    void tcp(const Frame &frame, uint32_t cpuUs);
+    void nextRequest(void);
+    size_t encodeRequest(Message msg, uint8_t *buf, size_t size);
+    size_t encodeIso20Request(Message msg, uint8_t *buf, size_t size);
+    std::string checkResponse(Message msg, const uint8_t *exi, size_t len);
+    std::string checkIso20Response(Message msg, const uint8_t *exi, size_t len);
+    uint16_t payloadType(Message msg) const;
+    const char *name(Message msg) const;
+};
+
+#endif
@@ -0,0 +1,131 @@
+/*
+ * Replay harness for the modem stack: simulated time and the powerline
+ */
+
+#include <cstring>
+#include <map>
+#include "powerline.h"
+#include "qca7000.h"
+#include "ev.h"
+
+Sim sim;
+Powerline powerline;
+
+static std::map<std::pair<unsigned long, uint32_t>, std::function<void()>> SimEvents;
+
+void Sim::at(unsigned long time, std::function<void()> fn) {
+    SimEvents.emplace(std::make_pair(time, Seq++), fn);
+}
+
+bool Sim::run(unsigned long deadline, std::function<bool()> wake) {
+    if (wake()) return true;
+    while (!SimEvents.empty()) {
+        auto it = SimEvents.begin();
+        if (it->first.first > deadline) break;
+        if (it->first.first > hostMillis) hostMillis = it->first.first;
+        std::function<void()> fn = it->second;
+        SimEvents.erase(it);
+        fn();
+        if (wake()) return true;
+    }
+    if (deadline > hostMillis) hostMillis = deadline;
+    return false;
+}
+
+void Powerline::fromEvse(const Frame &frame, uint32_t cpuUs) {
+    if (Drop && Drop(frame, false)) {
+        Dropped++;
+        return;
+    }
+    for (Ev *ev : Evs) ev->receive(frame, cpuUs);
+}
+
+void Powerline::toEvse(const Ev *ev, Frame frame) {
+    if (frame.size() < 60) frame.resize(60);                                    // ethernet minimum, without the FCS
+    if (Drop && Drop(frame, true)) {
+        Dropped++;
+        return;
+    }
+    const uint8_t attenuation = ev->Profile.Attenuation;
+    sim.after(POWERLINE_DELAY, [this, frame, attenuation]() { Modem->receive(frame, attenuation); });
+}
+
+bool Powerline::openCapture(const char *path) {
+    const uint32_t header[6] = {0xa1b2c3d4, 0x00040002, 0, 0, 65535, 1};      // pcap, ethernet
+
+    Pcap = fopen(path, "wb");
+    if (Pcap) fwrite(header, sizeof(header), 1, Pcap);
+    return Pcap != NULL;
+}
+
+// Every frame that passes the SPI bus, in both directions
+void Powerline::capture(const Frame &frame) {
+    if (!Pcap) return;
+    const uint32_t record[4] = {(uint32_t)(hostMillis / 1000), (uint32_t)(hostMillis % 1000) * 1000,
+                                (uint32_t)frame.size(), (uint32_t)frame.size()};
+    fwrite(record, sizeof(record), 1, Pcap);
+    fwrite(frame.data(), frame.size(), 1, Pcap);
+}
+
+Frame mmeFrame(const uint8_t *dest, const uint8_t *source, uint16_t mmtype, uint8_t mmv, size_t len) {
+    Frame f(len < 60 ? 60 : len, 0);
+
+    memcpy(&f[0], dest, 6);
+    memcpy(&f[6], source, 6);
+    put16(&f[12], ETHERTYPE_HOMEPLUG);
+    f[14] = mmv;
+    f[15] = mmtype & 0xff;
+    f[16] = mmtype >> 8;
+    return f;
+}
+
+void linkLocalIp(const uint8_t *mac, uint8_t *ip) {
+    memset(ip, 0, 16);
+    ip[0] = 0xfe;
+    ip[1] = 0x80;
+    ip[8] = mac[0] ^ 2;
+    ip[9] = mac[1];
+    ip[10] = mac[2];
+    ip[11] = 0xff;
+    ip[12] = 0xfe;
+    ip[13] = mac[3];
+    ip[14] = mac[4];
+    ip[15] = mac[5];
+}
+
+// RFC 2460 pseudo header and RFC 1071 sum, done bytewise so it does not share code with ipv6.cpp.
+// Over a frame with its checksum filled in, the result is 0.
+uint16_t ipv6Checksum(const uint8_t *source, const uint8_t *dest, uint8_t next, const uint8_t *data, size_t len) {
+    uint32_t sum = 0;
+    size_t i;
+
+    for (i = 0; i < 16; i += 2) sum += get16(source + i) + get16(dest + i);
+    sum += (uint32_t)len >> 16;
+    sum += len & 0xffff;
+    sum += next;
+    for (i = 0; i + 1 < len; i += 2) sum += get16(data + i);
+    if (len & 1) sum += data[len - 1] << 8;
+    while (sum >> 16) sum = (sum & 0xffff) + (sum >> 16);
+    return ~sum & 0xffff;
+}
+
+Frame ipv6Frame(const uint8_t *destMac, const uint8_t *sourceMac, const uint8_t *sourceIp, const uint8_t *destIp,
+                uint8_t next, uint8_t hopLimit, const uint8_t *payload, size_t len) {
+    Frame f(54 + len, 0);
+    uint8_t *p = &f[54];
+    size_t sumOffset = next == 0x06 ? 16 : next == 0x11 ? 6 : 2;              // TCP, UDP, ICMPv6
+
+    memcpy(&f[0], destMac, 6);
+    memcpy(&f[6], sourceMac, 6);
+    put16(&f[12], ETHERTYPE_IPV6);
+    f[14] = 0x60;
+    put16(&f[18], len);
+    f[20] = next;
+    f[21] = hopLimit;
+    memcpy(&f[22], sourceIp, 16);
+    memcpy(&f[38], destIp, 16);
+    memcpy(p, payload, len);
+    put16(p + sumOffset, 0);
+    put16(p + sumOffset, ipv6Checksum(sourceIp, destIp, next, p, len));
+    return f;
+}
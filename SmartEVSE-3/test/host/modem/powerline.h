@@ -0,0 +1,76 @@
+/*
+ * Replay harness for the modem stack: simulated time and the powerline
+ *
+ * Everything that happens outside the modem task (a frame arriving at the QCA7000, an EV timer) is an event at
+ * a simulated millis(). The modem task sleeps in ulTaskNotifyTake(); the harness runs the events up to the
+ * moment a frame is waiting in the QCA7000, or until the sleep times out, and returns.
+ *
+ * The powerline connects the QCA7000 of the EVSE with the EVs. Frames from the EVSE reach every EV at once,
+ * frames from an EV reach the QCA7000 PowerlineDelay ms later. A scenario can drop frames in both directions.
+ */
+
+#ifndef __POWERLINE_H
+#define __POWERLINE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <vector>
+
+typedef std::vector<uint8_t> Frame;
+
+#define ETHERTYPE_HOMEPLUG 0x88E1
+#define ETHERTYPE_IPV6 0x86DD
+#define POWERLINE_DELAY 2                                                       // ms from the EV to the QCA7000
+
+extern unsigned long hostMillis;
+uint32_t hostIterationUs(void);                                                 // host time spent in this modem task iteration
+
+class Ev;
+class VirtualQca7000;
+
+class Sim {
+public:
+    void at(unsigned long time, std::function<void()> fn);
+    void after(unsigned long delay, std::function<void()> fn) { at(hostMillis + delay, fn); }
+    // Runs the events until wake() is true after an event, or until deadline. Returns false when it stopped at the deadline.
+    bool run(unsigned long deadline, std::function<bool()> wake);
+private:
+    uint32_t Seq = 0;                                                           // events at the same time run in order
+};
+
+extern Sim sim;
+
+class Powerline {
+public:
+    std::vector<Ev *> Evs;
+    VirtualQca7000 *Modem = NULL;
+    // Return true to drop a frame; toEvse is the direction.
+    std::function<bool(const Frame &frame, bool toEvse)> Drop;
+    uint32_t Dropped = 0;
+
+    void fromEvse(const Frame &frame, uint32_t cpuUs);                          // transmitted by the EVSE modem
+    void toEvse(const Ev *ev, Frame frame);                                     // transmitted by an EV
+    void capture(const Frame &frame);
+    bool openCapture(const char *path);
+private:
+    FILE *Pcap = NULL;
+};
+
+extern Powerline powerline;
+
+// Frame helpers, network byte order
+static inline uint16_t get16(const uint8_t *p) { return (p[0] << 8) | p[1]; }
+static inline uint32_t get32(const uint8_t *p) { return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; }
+static inline void put16(uint8_t *p, uint16_t v) { p[0] = v >> 8; p[1] = v; }
+static inline void put32(uint8_t *p, uint32_t v) { p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v; }
+static inline uint16_t frameType(const Frame &f) { return f.size() >= 14 ? get16(&f[12]) : 0; }
+static inline uint16_t mmeType(const Frame &f) { return f.size() >= 17 ? f[15] | (f[16] << 8) : 0; }
+
+Frame mmeFrame(const uint8_t *dest, const uint8_t *source, uint16_t mmtype, uint8_t mmv, size_t len);
+void linkLocalIp(const uint8_t *mac, uint8_t *ip);
+uint16_t ipv6Checksum(const uint8_t *source, const uint8_t *dest, uint8_t next, const uint8_t *data, size_t len);
+Frame ipv6Frame(const uint8_t *destMac, const uint8_t *sourceMac, const uint8_t *sourceIp, const uint8_t *destIp,
+                uint8_t next, uint8_t hopLimit, const uint8_t *payload, size_t len);
+
+#endif
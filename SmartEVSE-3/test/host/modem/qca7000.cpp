@@ -0,0 +1,244 @@
+/*
+ * Replay harness for the modem stack: virtual QCA7000
+ */
+
+#include "qca7000.h"
+#include "esp32.h"
+#include "qca.h"
+
+VirtualQca7000 qca7000;
+SPIClass QCA_SPI1;
+
+// The modem stack drives the chip select with digitalWrite(), every SPI transaction starts with LOW.
+void digitalWrite(uint8_t pin, uint8_t val) {
+    if (pin == PIN_QCA700X_CS) qca7000.chipSelect(val == LOW);
+}
+
+uint16_t SPIClass::transfer16(uint16_t data) {
+    return qca7000.transfer16(data);
+}
+
+void SPIClass::transfer(void *buf, size_t count) {
+    qca7000.transfer((uint8_t *)buf, count);
+}
+
+void VirtualQca7000::chipSelect(bool active) {
+    if (active) {
+        if (State != IDLE) BadCommands++;                                       // previous transaction not finished
+        State = COMMAND;
+        Burst.clear();
+        return;
+    }
+    if (State == BUF_WRITE) endBurst();
+    else if (State == COMMAND || State == REG_READ || State == REG_WRITE) BadCommands++;   // no data phase
+    State = IDLE;
+}
+
+uint16_t VirtualQca7000::transfer16(uint16_t data) {
+    uint16_t value = 0;
+
+    switch (State) {
+        case COMMAND:
+            Reg = data & 0x3fff;
+            if (data & QCA7K_SPI_INTERNAL) State = data & QCA7K_SPI_READ ? REG_READ : REG_WRITE;
+            else State = data & QCA7K_SPI_READ ? BUF_READ : BUF_WRITE;
+            break;
+        case REG_READ:
+            value = readRegister(Reg);
+            State = DONE;
+            break;
+        case REG_WRITE:
+            writeRegister(Reg, data);
+            State = DONE;
+            break;
+        case BUF_WRITE:
+            Burst.push_back(data >> 8);
+            Burst.push_back(data & 0xff);
+            break;
+        default:
+            BadCommands++;
+            break;
+    }
+    return value;
+}
+
+void VirtualQca7000::transfer(uint8_t *buf, size_t len) {
+    if (State == BUF_WRITE) {
+        Burst.insert(Burst.end(), buf, buf + len);
+        return;
+    }
+    if (State != BUF_READ) {
+        BadCommands++;
+        return;
+    }
+    if (len != BufferSize) BadCommands++;                                       // SPI_REG_BFR_SIZE must be set first
+    for (size_t i = 0; i < len; i++) {
+        if (RxQueue.empty()) {
+            Overruns++;                                                         // more bytes read than available
+            memset(buf + i, 0, len - i);
+            break;
+        }
+        buf[i] = RxQueue.front()[RxOffset++];
+        if (RxOffset == RxQueue.front().size()) {
+            if (hostMillis - RxTimes.front() > MaxRxWait) MaxRxWait = hostMillis - RxTimes.front();
+            RxQueue.pop_front();
+            RxTimes.pop_front();
+            RxOffset = 0;
+        }
+    }
+    State = DONE;
+}
+
+uint16_t VirtualQca7000::readRegister(uint16_t reg) {
+    uint32_t available = 0;
+
+    switch (reg) {
+        case SPI_REG_SIGNATURE:
+            return QCASPI_GOOD_SIGNATURE;
+        case SPI_REG_WRBUF_SPC_AVA:
+            return QCA7K_BUFFER_SIZE;                                           // frames are sent as soon as they are written
+        case SPI_REG_RDBUF_BYTE_AVA:
+            // whole frames only, as much as fits in the read buffer
+            for (const Frame &f : RxQueue) {
+                if (available + f.size() - (&f == &RxQueue.front() ? RxOffset : 0) > QCA7K_BUFFER_SIZE) break;
+                available += f.size() - (&f == &RxQueue.front() ? RxOffset : 0);
+            }
+            return available;
+        case SPI_REG_SPI_CONFIG:
+            return SpiConfig;
+        case SPI_REG_INTR_CAUSE:
+            return IntrCause;
+        case SPI_REG_INTR_ENABLE:
+            return IntrEnable;
+        default:
+            return 0;
+    }
+}
+
+void VirtualQca7000::writeRegister(uint16_t reg, uint16_t value) {
+    switch (reg) {
+        case SPI_REG_BFR_SIZE:
+            BufferSize = value;
+            break;
+        case SPI_REG_SPI_CONFIG:
+            if (value & SPI_INT_CPU_ON) {                                       // reset the modem CPU
+                Resets++;
+                RxQueue.clear();
+                RxTimes.clear();
+                RxOffset = 0;
+                KeySet = false;
+                IntrEnable = IntrCause = 0;
+                interruptLine();
+            } else SpiConfig = value;
+            break;
+        case SPI_REG_INTR_ENABLE:
+            IntrEnable = value;
+            interruptLine();
+            break;
+        case SPI_REG_INTR_CAUSE:                                                // acknowledged
+            IntrCause &= ~value;
+            interruptLine();
+            break;
+    }
+}
+
+// The line follows the enabled causes; the host's ISR runs on the rising edge
+void VirtualQca7000::interruptLine(void) {
+    const bool line = IntrCause & IntrEnable;
+
+    if (line && !Line && IrqConnected && Isr) {
+        Interrupts++;
+        Isr();
+    }
+    Line = line;
+}
+
+// A write burst is 4 bytes 0xAA SOF, 2 bytes length, 2 reserved, the frame and a 2 byte 0x55 EOF.
+void VirtualQca7000::endBurst(void) {
+    size_t len;
+
+    if (Burst.size() < 10) {
+        BadBursts++;
+        return;
+    }
+    len = Burst[4] | (Burst[5] << 8);
+    if (Burst[0] != 0xaa || Burst[1] != 0xaa || Burst[2] != 0xaa || Burst[3] != 0xaa || len < 60
+        || Burst.size() != len + 10 || BufferSize != len + 10 || Burst[len + 8] != 0x55 || Burst[len + 9] != 0x55) {
+        BadBursts++;
+        return;
+    }
+    Frame frame(Burst.begin() + 8, Burst.begin() + 8 + len);
+    FramesOut++;
+    powerline.capture(frame);
+    hostFrame(frame);
+}
+
+// The local modem firmware
+void VirtualQca7000::hostFrame(const Frame &frame) {
+    static const uint8_t localModem[6] = {0x00, 0xb0, 0x52, 0x00, 0x00, 0x01};
+
+    memcpy(HostMac, &frame[6], 6);
+    if (frameType(frame) == ETHERTYPE_HOMEPLUG) {
+        switch (mmeType(frame)) {
+            case CM_SET_KEY + MMTYPE_REQ:
+                if (memcmp(&frame[0], localModem, 6) == 0) {
+                    memcpy(Nmk, &frame[41], 16);
+                    KeySet = true;
+                    Frame cnf = mmeFrame(HostMac, Mac, CM_SET_KEY + MMTYPE_CNF, 1, 60);
+                    cnf[19] = 0x01;                                             // success
+                    toHost(cnf, 5);
+                    return;
+                }
+                break;
+            case CM_GET_SW + MMTYPE_REQ: {
+                Frame cnf = mmeFrame(HostMac, Mac, CM_GET_SW + MMTYPE_CNF, 0, 60);
+                toHost(cnf, 5);
+                break;                                                          // broadcast, the EV modems answer too
+            }
+            case 0xA07C:                                                        // factory defaults
+            case CM_LINK_STATUS + MMTYPE_REQ:
+                return;
+        }
+    }
+    // On the powerline when the modem task sleeps, so the EVs do not run on the stack of the task
+    const uint32_t cpuUs = hostIterationUs();
+    sim.after(0, [frame, cpuUs]() { powerline.fromEvse(frame, cpuUs); });
+}
+
+// From the powerline. The modem measures the attenuation of every sound and reports it to the host.
+void VirtualQca7000::receive(const Frame &frame, uint8_t attenuation) {
+    toHost(frame, 0);
+    if (frameType(frame) != ETHERTYPE_HOMEPLUG || mmeType(frame) != CM_MNBC_SOUND + MMTYPE_IND) return;
+
+    Frame profile = mmeFrame(HostMac, Mac, CM_ATTEN_PROFILE + MMTYPE_IND, 1, 85);
+    memcpy(&profile[19], &frame[6], 6);                                         // PEV MAC
+    profile[25] = 58;
+    for (int i = 0; i < 58; i++) profile[27 + i] = constrain(attenuation + (i % 5) - 2, 0, 255);
+    toHost(profile, 1);
+}
+
+void VirtualQca7000::toHost(Frame frame, unsigned long delay) {
+    if (frame.size() < 60) frame.resize(60);
+    auto queue = [this, frame]() {
+        Frame framed(frame.size() + 14, 0);
+        const size_t len = frame.size();
+
+        framed[0] = (len + 10) & 0xff;                                          // length of what follows
+        framed[1] = (len + 10) >> 8;
+        memset(&framed[4], 0xaa, 4);
+        framed[8] = len & 0xff;
+        framed[9] = len >> 8;
+        memcpy(&framed[12], frame.data(), len);
+        framed[len + 12] = 0x55;
+        framed[len + 13] = 0x55;
+        FramesIn++;
+        powerline.capture(frame);
+        RxQueue.push_back(framed);
+        RxTimes.push_back(hostMillis);
+        IntrCause |= SPI_INT_PKT_AVLBL;
+        interruptLine();
+    };
+
+    if (delay) sim.after(delay, queue);
+    else queue();
+}
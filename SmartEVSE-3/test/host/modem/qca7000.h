@@ -0,0 +1,63 @@
+/*
+ * Replay harness for the modem stack: virtual QCA7000
+ *
+ * Implements the SPI protocol of the QCA7000 as qca.cpp uses it: 16 bit commands with the read/write and
+ * internal/external bits, the internal registers, and the read and write buffers with their SOF/length/EOF
+ * framing. Frames written by the host are checked and handed to the local modem firmware, which answers
+ * CM_SET_KEY.REQ and GET_SW.REQ itself, and passes everything else to the powerline. For every
+ * CM_MNBC_SOUND.IND it receives from the powerline, it reports a CM_ATTEN_PROFILE.IND to the host.
+ *
+ * A frame for the host sets SPI_INT_PKT_AVLBL in SPI_REG_INTR_CAUSE. While that cause is enabled and not
+ * acknowledged the interrupt line stays up, so the host is only interrupted on the rising edge: a frame that
+ * arrives before the host acknowledged the previous one raises no interrupt.
+ */
+
+#ifndef __QCA7000_H
+#define __QCA7000_H
+
+#include <deque>
+#include "powerline.h"
+
+class VirtualQca7000 {
+public:
+    uint8_t Mac[6] = {0x00, 0xb0, 0x52, 0x00, 0x00, 0x10};
+    uint8_t Nmk[16];
+    bool KeySet = false;
+
+    // Statistics, checked by the scenarios
+    uint32_t Resets = 0, BadBursts = 0, BadCommands = 0, Overruns = 0, FramesIn = 0, FramesOut = 0, Interrupts = 0;
+    unsigned long MaxRxWait = 0;                                                // ms a frame waited in the read buffer for the host
+
+    void (*Isr)(void) = NULL;                                                   // attached to the interrupt line by the host
+    bool IrqConnected = true;                                                   // false: the line is not wired, the host has to poll
+
+    void chipSelect(bool active);
+    uint16_t transfer16(uint16_t data);
+    void transfer(uint8_t *buf, size_t len);
+
+    void receive(const Frame &frame, uint8_t attenuation);                      // from the powerline
+    bool pending(void) const { return !RxQueue.empty(); }
+
+private:
+    enum Phase { IDLE, COMMAND, REG_READ, REG_WRITE, BUF_READ, BUF_WRITE, DONE };
+    Phase State = IDLE;
+    uint16_t Reg = 0;
+    uint16_t BufferSize = 0, IntrEnable = 0, IntrCause = 0, SpiConfig = 0;
+    bool Line = false;                                                          // the interrupt line
+    uint8_t HostMac[6] = {0};
+    std::deque<Frame> RxQueue;                                                  // framed for the read buffer
+    std::deque<unsigned long> RxTimes;                                          // when each frame of RxQueue arrived
+    size_t RxOffset = 0;                                                        // bytes of RxQueue.front() already read
+    Frame Burst;
+
+    uint16_t readRegister(uint16_t reg);
+    void writeRegister(uint16_t reg, uint16_t value);
+    void endBurst(void);
+    void interruptLine(void);
+    void hostFrame(const Frame &frame);
+    void toHost(Frame frame, unsigned long delay);
+};
+
+extern VirtualQca7000 qca7000;
+
+#endif
@@ -0,0 +1,896 @@
+/*
+ * Replay harness for the modem stack
+ *
+ * Runs the unmodified qca.cpp, ipv6.cpp and tcp.cpp of the v4 firmware on the host. The modem task
+ * Timer20ms() talks SPI to a virtual QCA7000, which connects it to one or more scripted EVs over a simulated
+ * powerline. Each scenario plays a complete session and checks the EVSE side (state changes, SoC, EVCCID,
+ * matched PEV) as well as the EV side (every response decoded and verified).
+ *
+ * usage: modem_replay [-v level] [-w capture.pcap] [-t timeline.json] scenario|list
+ */
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <pthread.h>
+#include "esp32.h"
+#include "qca.h"
+#include "ipv6.h"
+#include "qca7000.h"
+#include "ev.h"
+
+void Timer20ms(void *parameter);
+void SlacManager(uint16_t rxbytes);
+extern uint8_t modem_state, pevModemMac[6];
+
+#define SIMULATION_TIMEOUT 60000                                                // ms
+#define SIMULATION_LINGER 500                                                   // ms after the last EV finished
+#define TASK_STACK (256 * 1024)                                                 // host stack of the modem task
+#define STACK_PAINT 0xa5                                                        // fills the stack, to find the deepest use
+#define STACK_GAP 1024                                                          // below ulTaskNotifyTake(), counted as used by the task
+
+/*
+ * The EVSE, as far as the modem stack sees it
+ */
+
+unsigned long hostMillis = 0;
+int hostLogLevel = 0;
+HostSerial Serial1;
+
+uint8_t State = STATE_MODEM_WAIT;
+uint32_t serialnr = 123456;
+uint8_t Nr_Of_Phases_Charging = 3;
+uint8_t ErrorFlags = 0;
+uint16_t MaxCurrent = 16, MinCurrent = 6;
+uint16_t Balanced[8] = {160};
+char EVCCID[32];
+int8_t InitialSoC = -1, ComputedSoC = -1, FullSoC = -1;
+int32_t EnergyCapacity = -1, EnergyRequest = -1;
+Charging_Protocol_t Charging_Protocol = IEC;
+bool CPDutyOverride = false;
+
+static std::vector<uint8_t> StateLog;
+static std::vector<uint32_t> DutyLog;
+static std::vector<AccessStatus_t> AccessLog;
+static std::vector<std::string> SerialLog;
+static std::vector<std::string> WarningLog;                                     // _LOG_A and _LOG_W, at any -v level
+
+void setState(uint8_t NewState) {
+    StateLog.push_back(NewState);
+    State = NewState;
+}
+
+void setAccess(AccessStatus_t Access) {
+    AccessLog.push_back(Access);
+}
+
+void SetCPDuty(uint32_t DutyCycle) {
+    DutyLog.push_back(DutyCycle);
+}
+
+void RecomputeSoC(void) {
+}
+
+int HostSerial::printf(const char *fmt, ...) {
+    char buf[256];
+    va_list args;
+
+    va_start(args, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    SerialLog.push_back(buf);
+    if (hostLogLevel >= 3) ::printf("[%6lu] Serial1: %s", hostMillis, buf);
+    return n;
+}
+
+void hostLog(int level, bool func, const char *function, const char *fmt, ...) {
+    va_list args;
+
+    if (level <= 2) {
+        char buf[256];
+        va_start(args, fmt);
+        vsnprintf(buf, sizeof(buf), fmt, args);
+        va_end(args);
+        WarningLog.push_back(buf);
+    }
+    if (level > hostLogLevel) return;
+    if (func) ::printf("[%6lu] (%s) ", hostMillis, function);
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+}
+
+unsigned long micros(void) {
+    static const auto start = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Deterministic, so every run of a scenario is the same
+void esp_fill_random(void *buf, size_t len) {
+    static uint32_t seed = 0x5eed;
+
+    for (size_t i = 0; i < len; i++) {
+        seed = seed * 1103515245 + 12345;
+        ((uint8_t *)buf)[i] = seed >> 16;
+    }
+}
+
+uint32_t esp_random(void) {
+    uint32_t r;
+
+    esp_fill_random(&r, sizeof(r));
+    return r;
+}
+
+/*
+ * The modem task sleeps here. The simulation runs until the interrupt of the QCA7000 notifies the task, or the
+ * sleep times out. The host time spent in the task between two sleeps is what a frame costs the EVSE.
+ */
+
+struct SimulationEnd {
+    std::string Reason;
+};
+
+static std::vector<std::unique_ptr<Ev>> Evs;
+static bool EvsStarted = false;
+static unsigned long AllFinished = 0;
+static unsigned long IterationStart = 0;
+static uint32_t Iterations = 0, IdleWakeups = 0, MaxIterationUs = 0;
+static uint32_t TaskNotified = 0;                                               // notifications given to the modem task
+static uint8_t *TaskStack, *TaskStackTop;                                       // lowest address, and the frame of the task function
+static size_t TaskStackFree = TASK_STACK;
+
+// The modem task runs on a painted stack of its own, larger than MODEM_TASK_STACK. The stack below
+// ulTaskNotifyTake() is painted again after the simulation ran, so only the modem task and the virtual QCA7000
+// are counted. Bytes used, at the deepest.
+static size_t taskStackUsed(void) {
+    size_t free = 0;
+
+    while (free < TaskStackFree && TaskStack[free] == STACK_PAINT) free++;
+    TaskStackFree = free;
+    return TaskStackTop - TaskStack - free;
+}
+
+// As on the ESP32: the part of the MODEM_TASK_STACK bytes that was never used
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) {
+    size_t used = taskStackUsed();
+
+    (void)task;
+    return used < MODEM_TASK_STACK ? MODEM_TASK_STACK - used : 0;
+}
+
+uint32_t hostIterationUs(void) {
+    return micros() - IterationStart;
+}
+
+void attachInterrupt(uint8_t pin, void (*isr)(void), int mode) {
+    if (pin == PIN_QCA700X_INT && mode == RISING) qca7000.Isr = isr;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken) {
+    (void)task;
+    TaskNotified++;
+    *woken = pdTRUE;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, uint32_t ticks) {
+    uint32_t us = hostIterationUs();
+    uint32_t notified;
+    bool woken;
+
+    taskStackUsed();                                                            // the task's use, before the simulation runs
+    Iterations++;
+    if (us > MaxIterationUs) MaxIterationUs = us;
+
+    if (!EvsStarted && modem_state == MODEM_CONFIGURED) {
+        EvsStarted = true;
+        for (auto &ev : Evs) {
+            Ev *e = ev.get();
+            sim.after(e->Profile.Start, [e]() { e->start(); });
+        }
+    }
+    if (EvsStarted && !AllFinished) {
+        bool all = true;
+        for (auto &ev : Evs) all = all && ev->finished();
+        if (all) AllFinished = hostMillis;
+    }
+    if (AllFinished && hostMillis - AllFinished >= SIMULATION_LINGER) throw SimulationEnd{""};
+    if (hostMillis >= SIMULATION_TIMEOUT) throw SimulationEnd{"timeout"};
+
+    const unsigned long before = hostMillis;
+    woken = sim.run(hostMillis + ticks, []() { return TaskNotified != 0; });
+    // A task that is notified again before any time passed does not acknowledge the interrupt
+    if (woken && hostMillis == before) {
+        if (++IdleWakeups > 1000) throw SimulationEnd{"modem task does not acknowledge the QCA7000 interrupt"};
+    } else IdleWakeups = 0;
+    notified = TaskNotified;
+    TaskNotified = clear ? 0 : TaskNotified - (TaskNotified != 0);
+    // The simulation ran below this frame, its use of the stack is not the task's
+    memset(TaskStack, STACK_PAINT, (uint8_t *)__builtin_frame_address(0) - STACK_GAP - TaskStack);
+    IterationStart = micros();
+    return notified;
+}
+
+static void *modemTask(void *end) {
+    TaskStackTop = (uint8_t *)__builtin_frame_address(0);
+    IterationStart = micros();
+    try {
+        Timer20ms(NULL);
+    } catch (const SimulationEnd &e) {
+        *(std::string *)end = e.Reason;
+    }
+    return NULL;
+}
+
+/*
+ * Scenarios
+ */
+
+static const uint8_t EvseMac[6] = {0x02, 0x53, 0x45, 0x56, 0x00, 0x01};
+
+static const EvProfile DinEv = {"din-ev", {0x02, 0x00, 0x00, 0x0d, 0x10, 0x01}, {0x00, 0xb0, 0x52, 0x0d, 0x10, 0x01},
+                                20, true, 50, EV_DIN, false, false, 0, 42};
+static const EvProfile Iso2Ev = {"iso2-ev", {0x02, 0x00, 0x00, 0x15, 0x02, 0x01}, {0x00, 0xb0, 0x52, 0x15, 0x02, 0x01},
+                                 20, true, 50, EV_ISO2, false, false, 3, 0};
+static const EvProfile NeighbourEv = {"neighbour-ev", {0x02, 0x00, 0x00, 0x15, 0x02, 0x02}, {0x00, 0xb0, 0x52, 0x15, 0x02, 0x02},
+                                      45, false, 80, EV_ISO2, false, false, 0, 0};
+static const EvProfile Iso20Ev = {"iso20-ev", {0x02, 0x00, 0x00, 0x15, 0x20, 0x01}, {0x00, 0xb0, 0x52, 0x15, 0x20, 0x01},
+                                  20, true, 50, EV_ISO20, false, false, 24, 0};
+
+struct Scenario {
+    const char *Name;
+    const char *Description;
+    std::vector<EvProfile> Profiles;
+    std::function<void()> Setup;
+    std::function<void(std::vector<std::string> &errors)> Check;
+};
+
+static void expect(std::vector<std::string> &errors, bool ok, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+static void expect(std::vector<std::string> &errors, bool ok, const char *fmt, ...) {
+    char buf[256];
+    va_list args;
+
+    if (ok) return;
+    va_start(args, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    errors.push_back(buf);
+}
+
+static std::string hex(const uint8_t *data, size_t len) {
+    char buf[3];
+    std::string s;
+
+    for (size_t i = 0; i < len; i++) {
+        snprintf(buf, sizeof(buf), "%02x", data[i]);
+        s += buf;
+    }
+    return s;
+}
+
+static std::string states(void) {
+    std::string s;
+
+    for (uint8_t state : StateLog) s += (s.empty() ? "" : ",") + std::to_string(state);
+    return s.empty() ? "none" : s;
+}
+
+// The states in StateLog, in this order; other states may be in between
+static bool stateSequence(std::initializer_list<uint8_t> states) {
+    auto it = StateLog.begin();
+
+    for (uint8_t s : states) {
+        it = std::find(it, StateLog.end(), s);
+        if (it == StateLog.end()) return false;
+        it++;
+    }
+    return true;
+}
+
+static void checkMatched(std::vector<std::string> &errors, const Ev &ev) {
+    expect(errors, memcmp(pevMac, ev.Profile.Mac, 6) == 0, "pevMac is %s, not the EV %s", hex(pevMac, 6).c_str(), hex(ev.Profile.Mac, 6).c_str());
+    expect(errors, memcmp(pevModemMac, ev.Profile.ModemMac, 6) == 0, "pevModemMac is %s", hex(pevModemMac, 6).c_str());
+    expect(errors, modem_state == MODEM_LINK_READY, "modem_state is %u, not MODEM_LINK_READY", modem_state);
+    expect(errors, ev.SoundsReported == 10, "CM_ATTEN_CHAR.IND reports %u sounds", ev.SoundsReported);
+    expect(errors, ev.AttenReported + 3 >= ev.Profile.Attenuation && ev.AttenReported <= ev.Profile.Attenuation + 3,
+           "CM_ATTEN_CHAR.IND reports %u dB, the EV is at %u dB", ev.AttenReported, ev.Profile.Attenuation);
+    expect(errors, std::string(EVCCID) == hex(ev.Profile.Mac, 6), "EVCCID is '%s'", EVCCID);
+    expect(errors, std::find(SerialLog.begin(), SerialLog.end(), "@EVCCID:" + hex(ev.Profile.Mac, 6) + "\n") != SerialLog.end(),
+           "EVCCID not sent to the CH32");
+}
+
+static void checkDin(std::vector<std::string> &errors) {
+    const Ev &ev = *Evs[0];
+
+    checkMatched(errors, ev);
+    expect(errors, Charging_Protocol == DIN, "Charging_Protocol is %u, not DIN", Charging_Protocol);
+    expect(errors, ev.Stats.size() == 6, "%zu of 6 requests done", ev.Stats.size());
+    expect(errors, ComputedSoC == ev.Profile.SoC && InitialSoC == ev.Profile.SoC, "SoC is %d/%d, the EV sent %d", InitialSoC, ComputedSoC, ev.Profile.SoC);
+    expect(errors, FullSoC == 100, "FullSoC is %d", FullSoC);
+    expect(errors, EnergyCapacity == 77000, "EnergyCapacity is %d", EnergyCapacity);
+    expect(errors, State == STATE_MODEM_DONE, "State is %u, not STATE_MODEM_DONE (states %s)", State, states().c_str());
+}
+
+static void checkIso2(std::vector<std::string> &errors) {
+    const Ev &ev = *Evs[0];
+
+    checkMatched(errors, ev);
+    expect(errors, Charging_Protocol == ISO2, "Charging_Protocol is %u, not ISO2", Charging_Protocol);
+    expect(errors, ev.Stats.size() == 9u + ev.Profile.ChargingStatus, "%zu of %u requests done", ev.Stats.size(), 9 + ev.Profile.ChargingStatus);
+    expect(errors, stateSequence({STATE_MODEM_WAIT, STATE_C, STATE_C1}), "states %s, not MODEM_WAIT, C, C1", states().c_str());
+    expect(errors, std::find(DutyLog.begin(), DutyLog.end(), 51) != DutyLog.end() && CPDutyOverride, "CP duty not set to 5%% with override");
+}
+
+static void checkIso20(std::vector<std::string> &errors) {
+    const Ev &ev = *Evs[0];
+
+    checkMatched(errors, ev);
+    expect(errors, Charging_Protocol == ISO20, "Charging_Protocol is %u, not ISO20", Charging_Protocol);
+    expect(errors, ev.Stats.size() == 12u + ev.Profile.ChargingStatus, "%zu of %u requests done", ev.Stats.size(), 12 + ev.Profile.ChargingStatus);
+    expect(errors, stateSequence({STATE_C, STATE_C1}), "states %s, not C, C1", states().c_str());
+    expect(errors, std::find(DutyLog.begin(), DutyLog.end(), 51) != DutyLog.end() && CPDutyOverride, "CP duty not set to 5%% with override");
+    expect(errors, FullSoC == 80 && EnergyRequest == 20000, "FullSoC %d, EnergyRequest %d Wh from ScheduleExchangeReq", FullSoC, EnergyRequest);
+}
+
+/*
+ * Setpoint latency: the load balancing changes Balanced[0] during the charge loop, at moments that are not aligned
+ * with the loop of the EV. With -20 the new current reaches the EV as EVSETargetActivePower in the next
+ * AC_ChargeLoopRes. With PWM the duty cycle changes at once, and IEC 61851-1 gives the EV up to 5 s to follow it.
+ */
+#define SETPOINT_INTERVAL 730                                                   // ms between two changes
+#define PWM_FOLLOW_TIME 5000                                                    // ms, IEC 61851-1
+
+static const uint16_t Setpoints[] = {100, 130, 60, 160};                        // dA
+static std::vector<unsigned long> SetpointTimes;
+
+static void changeSetpoints(void) {
+    const Ev &ev = *Evs[0];
+
+    if (ev.finished() || SetpointTimes.size() == sizeof(Setpoints) / sizeof(Setpoints[0])) return;
+    if (ev.Targets.size() >= 3 && (SetpointTimes.empty() || hostMillis - SetpointTimes.back() >= SETPOINT_INTERVAL)) {
+        Balanced[0] = Setpoints[SetpointTimes.size()];
+        SetpointTimes.push_back(hostMillis);
+    }
+    sim.after(10, changeSetpoints);
+}
+
+static void checkSetpoints(std::vector<std::string> &errors) {
+    const Ev &ev = *Evs[0];
+    unsigned long worst = 0, sum = 0;
+
+    expect(errors, SetpointTimes.size() == sizeof(Setpoints) / sizeof(Setpoints[0]), "%zu setpoint changes made", SetpointTimes.size());
+    for (size_t i = 0; i < SetpointTimes.size(); i++) {
+        const uint32_t watts = Setpoints[i] * 23 * Nr_Of_Phases_Charging;
+        auto it = std::find_if(ev.Targets.begin(), ev.Targets.end(), [&](const std::pair<unsigned long, uint32_t> &t) {
+            return t.first >= SetpointTimes[i] && t.second == watts;
+        });
+        if (it == ev.Targets.end()) {
+            expect(errors, false, "%u.%u A at %lu ms never reached the EV", Setpoints[i] / 10, Setpoints[i] % 10, SetpointTimes[i]);
+            continue;
+        }
+        const unsigned long latency = it->first - SetpointTimes[i];
+        printf("  setpoint %4.1f A at %5lu ms: EVSETargetActivePower %5u W at the EV after %3lu ms, PWM: up to %d ms\n",
+               Setpoints[i] / 10.0, SetpointTimes[i], watts, latency, PWM_FOLLOW_TIME);
+        worst = std::max(worst, latency);
+        sum += latency;
+    }
+    if (!SetpointTimes.empty())
+        printf("  setpoint to EV: %lu ms on average, %lu ms at most, over %zu changes\n", sum / SetpointTimes.size(), worst, SetpointTimes.size());
+    expect(errors, worst <= 200 + 50, "a setpoint took %lu ms to reach the EV, more than one charge loop", worst);
+}
+
+// Frames the EVSE sends more than once: the sequence numbers of its TCP data segments, and ACKs that
+// acknowledge nothing new
+static std::vector<uint32_t> EvseSegments;
+static uint32_t EvseRetransmits = 0, EvseDupAcks = 0, EvseLastAck = 0;
+
+static bool observeEvse(const Frame &f, bool toEvse) {
+    if (toEvse || frameType(f) != ETHERTYPE_IPV6 || f[20] != 0x06) return false;
+    size_t len = get16(&f[18]) - (f[66] >> 4) * 4;
+    uint32_t seq = get32(&f[58]);
+    if (!len) {
+        if (f[67] == 0x10 && get32(&f[62]) == EvseLastAck) EvseDupAcks++;      // a bare ACK
+        EvseLastAck = get32(&f[62]);
+        return false;
+    }
+    if (std::find(EvseSegments.begin(), EvseSegments.end(), seq) != EvseSegments.end()) EvseRetransmits++;
+    else EvseSegments.push_back(seq);
+    return false;
+}
+
+// SLAC with several EVs: the CM_SLAC_PARAM.REQ and CM_SLAC_MATCH.REQ of each EV, and the order of all sounds
+static uint32_t SlacParamReqs[2], SlacMatchReqs[2];
+static std::vector<size_t> SoundOrder;                                          // the EV of every CM_MNBC_SOUND.IND
+static size_t SoundsBeforeParam = SIZE_MAX;                                     // sounds of the other EV before the first CM_SLAC_PARAM.REQ of Evs[0]
+
+static bool observeSlac(const Frame &f, bool toEvse) {
+    if (!toEvse || frameType(f) != ETHERTYPE_HOMEPLUG) return false;
+    for (size_t i = 0; i < Evs.size() && i < 2; i++) {
+        if (memcmp(&f[6], Evs[i]->Profile.Mac, 6) != 0) continue;
+        if (mmeType(f) == CM_SLAC_PARAM + MMTYPE_REQ && !SlacParamReqs[i]++ && i == 0) SoundsBeforeParam = SoundOrder.size();
+        else if (mmeType(f) == CM_SLAC_MATCH + MMTYPE_REQ) SlacMatchReqs[i]++;
+        else if (mmeType(f) == CM_MNBC_SOUND + MMTYPE_IND) SoundOrder.push_back(i);
+    }
+    return false;
+}
+
+// The EV near the EVSE is matched on its first attempt, within TT_EV_atten_results; the neighbour is never matched.
+// With interleaved, the two EVs sound at the same time.
+static void checkSlacMulti(std::vector<std::string> &errors, bool interleaved) {
+    const Ev &ev = *Evs[0];
+    size_t first[2] = {SIZE_MAX, SIZE_MAX}, last[2] = {0, 0};
+
+    checkIso2(errors);
+    expect(errors, Evs[1]->TMatched == 0, "the neighbour EV was matched");
+    for (size_t i = 0; i < SoundOrder.size(); i++) {
+        first[SoundOrder[i]] = min(first[SoundOrder[i]], i);
+        last[SoundOrder[i]] = i;
+    }
+    expect(errors, !interleaved || (first[0] < last[1] && first[1] < last[0]), "the sounds of the two EVs do not interleave");
+    expect(errors, SlacParamReqs[0] == 1 && SlacMatchReqs[0] == 1, "the EV sent %u CM_SLAC_PARAM.REQ and %u CM_SLAC_MATCH.REQ",
+           SlacParamReqs[0], SlacMatchReqs[0]);
+    expect(errors, ev.TMatched && ev.TMatched - ev.TStart <= 1200, "the EV was matched %lu ms after its CM_SLAC_PARAM.REQ",
+           ev.TMatched ? ev.TMatched - ev.TStart : 0);
+    printf("  association: %lu ms from CM_SLAC_PARAM.REQ to CM_SLAC_MATCH.CNF, with %zu sounds of two EVs\n",
+           ev.TMatched ? ev.TMatched - ev.TStart : 0, SoundOrder.size());
+}
+
+// Malformed MMEs from the EV: a copy of CM_ATTEN_CHAR.RSP and of CM_SLAC_MATCH.REQ cut to the ethernet minimum
+// ahead of the real one, and its sounds padded to the maximum ethernet frame
+static bool malformMmes(const Frame &f, bool toEvse) {
+    if (!toEvse || frameType(f) != ETHERTYPE_HOMEPLUG) return false;
+    switch (mmeType(f)) {
+        case CM_ATTEN_CHAR + MMTYPE_RSP:
+        case CM_SLAC_MATCH + MMTYPE_REQ:
+            qca7000.receive(Frame(f.begin(), f.begin() + 60), Iso2Ev.Attenuation);
+            return false;
+        case CM_MNBC_SOUND + MMTYPE_IND: {
+            Frame big(f);
+            big.resize(1514);
+            sim.after(POWERLINE_DELAY, [big]() { qca7000.receive(big, Iso2Ev.Attenuation); });
+            return true;                                                        // replaced by the big one
+        }
+    }
+    return false;
+}
+
+static bool warned(const std::string &warning) {
+    return std::find(WarningLog.begin(), WarningLog.end(), warning) != WarningLog.end();
+}
+
+static void checkMalformed(std::vector<std::string> &errors) {
+    checkIso2(errors);
+    expect(errors, warned("MME 606f truncated, 60 of 70 bytes, ignoring..\n"), "truncated CM_ATTEN_CHAR.RSP not rejected");
+    expect(errors, warned("MME 607c truncated, 60 of 85 bytes, ignoring..\n"), "truncated CM_SLAC_MATCH.REQ not rejected");
+}
+
+// The SLAC MMEs the EV sent, captured on the powerline and replayed through SlacManager() after the session.
+// Each one is dispatched in a session that the captured CM_SLAC_PARAM.REQ has just started, in the modem_state
+// that accepts it: once cut short of its view, once padded to the maximum ethernet frame, and as it was sent.
+// The timing includes the replies, which go over the virtual SPI bus into the QCA7000.
+static std::vector<Frame> EvMmes;
+
+static const struct {
+    uint16_t MMType;
+    const char *Name;
+    uint8_t State, NextState;
+} Transitions[] = {
+    { CM_SLAC_PARAM + MMTYPE_REQ,       "CM_SLAC_PARAM.REQ",       MODEM_CONFIGURED, SLAC_PARAM_CNF },
+    { CM_START_ATTEN_CHAR + MMTYPE_IND, "CM_START_ATTEN_CHAR.IND", SLAC_PARAM_CNF,   MNBC_SOUND },
+    { CM_MNBC_SOUND + MMTYPE_IND,       "CM_MNBC_SOUND.IND",       MNBC_SOUND,       MNBC_SOUND },
+    { CM_ATTEN_CHAR + MMTYPE_RSP,       "CM_ATTEN_CHAR.RSP",       ATTEN_CHAR_RSP,   SLAC_MATCH_REQ },
+    { CM_SLAC_MATCH + MMTYPE_REQ,       "CM_SLAC_MATCH.REQ",       SLAC_MATCH_REQ,   MODEM_GET_SW_REQ },
+    { CM_GET_SW + MMTYPE_CNF,           "GET_SW.CNF",              MODEM_WAIT_SW,    MODEM_WAIT_SW },       // from the EV modem
+};
+
+#define REPLAY_ROUNDS 100000                                                    // dispatches per MME for the timing
+
+static bool captureEvMme(const Frame &f, bool toEvse) {
+    if (toEvse && frameType(f) == ETHERTYPE_HOMEPLUG) EvMmes.push_back(f);
+    return false;
+}
+
+// Dispatches one MME as the modem task does, returns the modem_state it leaves
+static uint8_t dispatch(const Frame &paramReq, Frame frame, uint8_t state) {
+    Frame start(paramReq);
+
+    modem_state = MODEM_CONFIGURED;
+    rxbuffer = start.data();
+    SlacManager(start.size());
+    modem_state = state;
+    rxbuffer = frame.data();
+    SlacManager(frame.size());
+    return modem_state;
+}
+
+static void replayMmes(std::vector<std::string> &errors) {
+    uint8_t *const buffer = rxbuffer;
+    const size_t warnings = WarningLog.size();
+    unsigned replayed = 0;
+
+    checkIso2(errors);
+    powerline.Drop = [](const Frame &f, bool toEvse) { return !toEvse; };      // the EV has left
+    auto paramReq = std::find_if(EvMmes.begin(), EvMmes.end(), [](const Frame &f) { return mmeType(f) == CM_SLAC_PARAM + MMTYPE_REQ; });
+    if (paramReq == EvMmes.end()) {
+        errors.push_back("CM_SLAC_PARAM.REQ not captured");
+        return;
+    }
+    printf("  replayed through SlacManager():\n");
+    for (const auto &t : Transitions) {
+        auto it = std::find_if(EvMmes.begin(), EvMmes.end(), [&t](const Frame &f) { return mmeType(f) == t.MMType; });
+        if (it == EvMmes.end()) {
+            errors.push_back(std::string(t.Name) + " not captured");
+            continue;
+        }
+        const Frame &f = *it;
+        Frame big(f);
+        big.resize(1514);
+
+        uint8_t state = dispatch(*paramReq, Frame(f.begin(), f.begin() + 18), t.State);
+        expect(errors, state == t.State, "%s cut to 18 bytes: modem_state %u -> %u", t.Name, t.State, state);
+        state = dispatch(*paramReq, big, t.State);
+        expect(errors, state == t.NextState, "%s padded to 1514 bytes: modem_state %u -> %u, not %u", t.Name, t.State, state, t.NextState);
+        state = dispatch(*paramReq, f, t.State);
+        expect(errors, state == t.NextState, "%s: modem_state %u -> %u, not %u", t.Name, t.State, state, t.NextState);
+        replayed += std::count_if(EvMmes.begin(), EvMmes.end(), [&t](const Frame &m) { return mmeType(m) == t.MMType; });
+
+        // The handler runs on the frame in rxbuffer, so one copy serves all rounds
+        Frame copy(f);
+        rxbuffer = copy.data();
+        const auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < REPLAY_ROUNDS; i++) {
+            modem_state = t.State;
+            SlacManager(copy.size());
+        }
+        const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        printf("    %-24s %4zu bytes  %6.1f ns\n", t.Name, f.size(), (double)ns / REPLAY_ROUNDS);
+    }
+    rxbuffer = buffer;
+    expect(errors, WarningLog.size() - warnings == sizeof(Transitions) / sizeof(Transitions[0]),
+           "%zu warnings for %zu truncated MMEs", WarningLog.size() - warnings, sizeof(Transitions) / sizeof(Transitions[0]));
+    expect(errors, replayed == EvMmes.size(), "%u of the %zu MMEs from the EV replayed", replayed, EvMmes.size());
+}
+
+static bool evData(const Frame &f) {
+    return frameType(f) == ETHERTYPE_IPV6 && f[20] == 0x06 && get16(&f[18]) > (size_t)(f[66] >> 4) * 4;
+}
+
+// Delivers a frame of the EV to the QCA7000 late, instead of after the powerline delay
+static void toEvseLater(const Frame &f, unsigned long delay) {
+    sim.after(POWERLINE_DELAY + delay, [f]() { qca7000.receive(f, Iso2Ev.Attenuation); });
+}
+
+static unsigned EvSegments = 0;
+
+static void checkReorder(std::vector<std::string> &errors) {
+    checkIso2(errors);
+    expect(errors, EvseDupAcks >= 1, "the EVSE did not ask for the segment it missed");
+    expect(errors, Evs[0]->Retransmits >= 1, "the EV did not retransmit the body");
+}
+
+static void checkDuplicate(std::vector<std::string> &errors) {
+    checkIso2(errors);
+    // the copy of SessionStopReq arrives after the EVSE has closed, and is not acknowledged
+    expect(errors, EvseDupAcks + 1 == EvSegments, "%u duplicate ACKs for %u duplicate segments", EvseDupAcks, EvSegments);
+    expect(errors, Evs[0]->Retransmits == 0, "the EV retransmitted %u times", Evs[0]->Retransmits);
+}
+
+extern uint8_t tcpState;
+extern uint32_t tcp_rxdiscard;
+
+static void checkAbsurdLength(std::vector<std::string> &errors) {
+    auto reset = std::find(errors.begin(), errors.end(), std::string(Iso2Ev.Name) + ": connection reset by the EVSE");
+
+    expect(errors, reset != errors.end(), "the EVSE did not reset the connection");
+    if (reset != errors.end()) errors.erase(reset);
+    expect(errors, warned("[TCP] invalid V2GTP length 4294967280, resetting connection.\n"), "no warning for the V2GTP length");
+    expect(errors, Evs[0]->Stats.size() == 2, "%zu requests answered before the reset, not 2", Evs[0]->Stats.size());
+    expect(errors, tcpState == 0 && tcp_rxdiscard == 0, "tcpState %u, %u bytes left to discard", tcpState, tcp_rxdiscard);
+}
+
+static const Scenario Scenarios[] = {
+    {"din", "DIN 70121 DC EV: SLAC, SDP, SoC from ChargeParameterDiscoveryReq, EVSE ends the session",
+     {DinEv}, NULL, checkDin},
+
+    {"iso2", "ISO 15118-2 AC EV: SLAC, SDP, full session up to SessionStop and the TCP close",
+     {Iso2Ev}, NULL, checkIso2},
+
+    {"iso2-split", "ISO 15118-2, the EV sends the V2GTP header and the EXI body in separate segments",
+     {[]() { EvProfile p = Iso2Ev; p.SplitV2gtp = true; return p; }()}, NULL, checkIso2},
+
+    {"iso2-neighbor", "ISO 15118-2, the EV resolves the EVSE MAC with a Neighbor Solicitation after SDP",
+     {[]() { EvProfile p = Iso2Ev; p.NeighborSolicitation = true; return p; }()}, NULL, checkIso2},
+
+    {"iso2-loss", "ISO 15118-2, one response of the EVSE and one request of the EV are lost",
+     {Iso2Ev},
+     []() {
+         powerline.Drop = [](const Frame &f, bool toEvse) {
+             static int fromEvseData = 0, toEvseData = 0;
+             observeEvse(f, toEvse);
+             if (frameType(f) != ETHERTYPE_IPV6 || f[20] != 0x06 || get16(&f[18]) <= (size_t)(f[66] >> 4) * 4) return false;
+             if (toEvse) return ++toEvseData == 5;                              // AuthorizationReq
+             return ++fromEvseData == 3;                                        // ServiceDiscoveryRes
+         };
+     },
+     [](std::vector<std::string> &errors) {
+         checkIso2(errors);
+         expect(errors, powerline.Dropped == 2, "%u frames dropped", powerline.Dropped);
+         expect(errors, Evs[0]->Retransmits >= 1, "the EV did not retransmit its request");
+         expect(errors, EvseRetransmits >= 1, "the EVSE did not retransmit its response");
+     }},
+
+    {"iso2-reorder", "ISO 15118-2, the V2GTP header of AuthorizationReq arrives after its body",
+     {[]() { EvProfile p = Iso2Ev; p.SplitV2gtp = true; return p; }()},
+     []() {
+         powerline.Drop = [](const Frame &f, bool toEvse) {
+             observeEvse(f, toEvse);
+             if (!toEvse || !evData(f) || ++EvSegments != 9) return false;    // header, body of each request
+             toEvseLater(f, 30);
+             return true;
+         };
+     },
+     checkReorder},
+
+    {"iso2-duplicate", "ISO 15118-2, every segment of the EV arrives twice, the copy after the ACK",
+     {Iso2Ev},
+     []() {
+         powerline.Drop = [](const Frame &f, bool toEvse) {
+             observeEvse(f, toEvse);
+             if (toEvse && evData(f)) {
+                 EvSegments++;
+                 toEvseLater(f, 10);
+             }
+             return false;
+         };
+     },
+     checkDuplicate},
+
+    {"iso2-length", "ISO 15118-2, the V2GTP header of the third request claims 4 GB: the EVSE resets the connection",
+     {Iso2Ev},
+     []() {
+         powerline.Drop = [](const Frame &f, bool toEvse) {
+             if (!toEvse || !evData(f) || ++EvSegments != 3) return false;
+             Frame bad(f);
+             const size_t len = get16(&bad[18]);
+             put32(&bad[54 + (bad[66] >> 4) * 4 + 4], 0xfffffff0);
+             put16(&bad[70], 0);
+             put16(&bad[70], ipv6Checksum(&bad[22], &bad[38], 0x06, &bad[54], len));
+             toEvseLater(bad, 0);
+             return true;
+         };
+     },
+     checkAbsurdLength},
+
+    {"iso20", "ISO 15118-20 AC EV in dynamic mode, listed last but preferred: setpoint latency against PWM",
+     {Iso20Ev},
+     []() { sim.after(0, changeSetpoints); },
+     [](std::vector<std::string> &errors) {
+         checkIso20(errors);
+         checkSetpoints(errors);
+     }},
+
+    {"iso2-polled", "ISO 15118-2 with the QCA7000 interrupt line not connected: the modem task polls every 20 ms",
+     {Iso2Ev},
+     []() { qca7000.IrqConnected = false; },
+     [](std::vector<std::string> &errors) {
+         checkIso2(errors);
+         expect(errors, qca7000.MaxRxWait <= 20, "a frame waited %lu ms in the QCA7000, longer than a poll", qca7000.MaxRxWait);
+     }},
+
+    {"iso2-offers20", "ISO 15118-2 EV that lists -20 first, at a lower priority: ISO 15118-2 is selected",
+     {[]() { EvProfile p = Iso2Ev; p.Offers20 = true; return p; }()}, NULL, checkIso2},
+
+    {"slac-multi", "Two EVs on a shared coupling: the one at 20 dB is matched, the one at 45 dB is not",
+     {[]() { EvProfile p = Iso2Ev; p.ChargingStatus = 1; return p; }(), NeighbourEv},
+     []() { powerline.Drop = observeSlac; },
+     [](std::vector<std::string> &errors) { checkSlacMulti(errors, true); }},
+
+    {"slac-multi-far-first", "Two EVs on a shared coupling, the one at 45 dB starts SLAC first: the one at 20 dB is matched",
+     {[]() { EvProfile p = Iso2Ev; p.ChargingStatus = 1; return p; }(),
+      []() { EvProfile p = NeighbourEv; p.Start = 20; return p; }()},
+     []() { powerline.Drop = observeSlac; },
+     [](std::vector<std::string> &errors) { checkSlacMulti(errors, true); }},
+
+    {"slac-multi-late", "Two EVs on a shared coupling, the one at 20 dB joins before the one at 45 dB ends sounding: it is matched",
+     {[]() { EvProfile p = Iso2Ev; p.ChargingStatus = 1; p.Start = 262; return p; }(),
+      []() { EvProfile p = NeighbourEv; p.Start = 20; return p; }()},
+     []() { powerline.Drop = observeSlac; },
+     [](std::vector<std::string> &errors) {
+         checkSlacMulti(errors, false);
+         // the EVSE has all sounds of the neighbour before the EV starts sounding, and still waits for it
+         expect(errors, SoundsBeforeParam < 10 && SoundOrder.size() == 20 && SoundOrder[9] == 1 && SoundOrder[10] == 0,
+                "the EV joined after %zu sounds of the neighbour, or sounded before its last", SoundsBeforeParam);
+     }},
+
+    {"mme-malformed", "ISO 15118-2, the EV sends truncated SLAC MMEs ahead of the real ones, and oversized sounds",
+     {Iso2Ev}, []() { powerline.Drop = malformMmes; }, checkMalformed},
+
+    {"mme-replay", "ISO 15118-2, the SLAC MMEs of the EV replayed through SlacManager(): truncated, oversized, ns per MME",
+     {Iso2Ev}, []() { powerline.Drop = captureEvMme; }, replayMmes},
+};
+
+/*
+ * Timeline: the events of the session as /modem_timeline serves them, parsed back from the JSON
+ */
+
+#define TCP_STATE_ESTABLISHED 2                                                 // as in tcp.cpp
+
+typedef std::map<std::string, std::string> TimelineEvent;
+
+static std::vector<TimelineEvent> timeline(unsigned long &slacParamTime) {
+    std::vector<TimelineEvent> events;
+    String json;
+    size_t pos;
+
+    modemTimelineJson(json);
+    slacParamTime = (pos = json.find("\"slac_param_time\":")) != std::string::npos ? strtoul(json.c_str() + pos + 18, NULL, 10) : 0;
+    pos = json.find("\"events\":[");
+    while (pos != std::string::npos && (pos = json.find('{', pos)) != std::string::npos) {
+        const size_t end = json.find('}', pos);
+        TimelineEvent event;
+        for (size_t key = json.find('"', pos); key < end; key = json.find('"', key)) {
+            const size_t colon = json.find(':', key);
+            const size_t next = std::min(json.find(',', colon), end);
+            std::string value = json.substr(colon + 1, next - colon - 1);
+            if (value.size() >= 2 && value[0] == '"') value = value.substr(1, value.size() - 2);
+            event[json.substr(key + 1, colon - key - 2)] = value;
+            key = next;
+        }
+        events.push_back(event);
+        pos = end;
+    }
+    return events;
+}
+
+// Every modem_state and tcpState change is recorded, and every V2G response follows its request. A response
+// encoded after the connection was closed is not sent.
+static void checkTimeline(std::vector<std::string> &errors) {
+    unsigned long slacParamTime;
+    const std::vector<TimelineEvent> events = timeline(slacParamTime);
+    std::map<std::string, long> last = {{"slac", -1}, {"tcp", -1}};
+    unsigned long t = 0;
+    unsigned requests = 0, responses = 0, answered = 0;
+    bool open = false;
+
+    if (events.empty()) {
+        errors.push_back("timeline is empty");
+        return;
+    }
+    expect(errors, events[0].at("type") == "mme_rx" && events[0].at("mmtype") == std::to_string(CM_SLAC_PARAM + MMTYPE_REQ) &&
+           strtoul(events[0].at("t").c_str(), NULL, 10) == slacParamTime,
+           "timeline starts with %s %s at %s ms, not CM_SLAC_PARAM.REQ at %lu ms", events[0].at("type").c_str(),
+           events[0].count("mmtype") ? events[0].at("mmtype").c_str() : "", events[0].at("t").c_str(), slacParamTime);
+    for (size_t i = 0; i < events.size(); i++) {
+        const TimelineEvent &e = events[i];
+        const std::string &type = e.at("type");
+        const unsigned long et = strtoul(e.at("t").c_str(), NULL, 10);
+        expect(errors, et >= t, "timeline event %zu at %lu ms, after one at %lu ms", i, et, t);
+        t = et;
+        if (last.count(type)) {                                                 // the changes of a state follow on from each other
+            const long from = atol(e.at("from").c_str()), to = atol(e.at("to").c_str());
+            expect(errors, last[type] < 0 || from == last[type], "timeline %s change %ld -> %ld at %lu ms, the state was %ld",
+                   type.c_str(), from, to, et, last[type]);
+            last[type] = to;
+        } else if (type == "v2g_req") {
+            requests++;
+            open = true;
+        } else if (type == "v2g_res") {
+            responses += last["tcp"] == TCP_STATE_ESTABLISHED;
+            expect(errors, open, "timeline V2G response at %lu ms without a request", et);
+            open = false;
+        }
+    }
+    expect(errors, last["slac"] == modem_state, "timeline ends in modem_state %ld, it is %u", last["slac"], modem_state);
+    expect(errors, last["tcp"] < 0 || last["tcp"] == tcpState, "timeline ends in tcpState %ld, it is %u", last["tcp"], tcpState);
+    for (auto &ev : Evs)
+        for (const MessageStat &s : ev->Stats) answered += s.ResBytes != 0;
+    expect(errors, responses == answered, "timeline has %u V2G responses sent, the EVs received %u", responses, answered);
+    expect(errors, requests >= responses, "timeline has %u V2G requests for %u responses", requests, responses);
+}
+
+/*
+ * Report
+ */
+
+static void report(const Scenario &scenario, const std::string &end, std::vector<std::string> &errors) {
+    printf("%s: %s\n", scenario.Name, scenario.Description);
+    for (auto &ev : Evs) {
+        printf("  %-13s %s  start %lu, matched +%lu, sdp +%lu, connected +%lu, charge parameters +%lu, done +%lu ms; retransmits %u, duplicates %u\n",
+               ev->Profile.Name, ev->Done ? "done  " : "FAILED", ev->TStart,
+               ev->TMatched ? ev->TMatched - ev->TStart : 0, ev->TSdp ? ev->TSdp - ev->TStart : 0,
+               ev->TConnected ? ev->TConnected - ev->TStart : 0, ev->TChargeParameter ? ev->TChargeParameter - ev->TStart : 0,
+               ev->TDone ? ev->TDone - ev->TStart : 0,
+               ev->Retransmits, ev->DupSegments);
+        if (!ev->Failure.empty()) errors.push_back(std::string(ev->Profile.Name) + ": " + ev->Failure);
+        for (const MessageStat &s : ev->Stats) {
+            if (s.ResBytes) printf("    %-26s req %4u  res %4u bytes  %4lu ms  %5u us\n", s.Name, s.ReqBytes, s.ResBytes, s.Latency, s.HostUs);
+            else printf("    %-26s req %4u  no response\n", s.Name, s.ReqBytes);
+        }
+    }
+    printf("  QCA7000: %u frames to the host, %u from the host, %u interrupts, a frame waited at most %lu ms\n",
+           qca7000.FramesIn, qca7000.FramesOut, qca7000.Interrupts, qca7000.MaxRxWait);
+    printf("  modem task: %u iterations, longest %u us\n", Iterations, MaxIterationUs);
+    const size_t stack = TaskStackTop - TaskStack - TaskStackFree;              // before the throw that ended the task
+    printf("  modem task stack: at most %zu of %d bytes used on the host\n", stack, MODEM_TASK_STACK);
+
+    if (!end.empty()) errors.push_back("simulation ended: " + end);
+    expect(errors, qca7000.KeySet, "the NMK was never set");
+    expect(errors, qca7000.BadBursts == 0, "%u invalid write bursts", qca7000.BadBursts);
+    expect(errors, qca7000.BadCommands == 0, "%u invalid SPI commands", qca7000.BadCommands);
+    expect(errors, qca7000.Overruns == 0, "%u read buffer overruns", qca7000.Overruns);
+    expect(errors, qca7000.Resets == 0, "%u modem resets", qca7000.Resets);
+    // With the interrupt line connected, every frame is read in the ms it arrives, not at the next 20 ms poll
+    expect(errors, !qca7000.IrqConnected || qca7000.MaxRxWait == 0, "a frame waited %lu ms in the QCA7000 for the modem task", qca7000.MaxRxWait);
+    expect(errors, stack + MODEM_TASK_STACK_MARGIN <= MODEM_TASK_STACK, "%zu bytes of the modem task stack used", stack);
+    checkTimeline(errors);                                                      // before a check replays MMEs
+    if (scenario.Check) scenario.Check(errors);
+
+    for (const std::string &e : errors) printf("  FAIL: %s\n", e.c_str());
+    printf("%s: %s\n\n", scenario.Name, errors.empty() ? "PASS" : "FAIL");
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: modem_replay [-v level] [-w capture.pcap] [-t timeline.json] scenario|list\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[]) {
+    const char *pcap = NULL, *timeline = NULL, *name = NULL;
+    const Scenario *scenario = NULL;
+    std::vector<std::string> errors;
+    std::string end;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-v") && i + 1 < argc) hostLogLevel = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-w") && i + 1 < argc) pcap = argv[++i];
+        else if (!strcmp(argv[i], "-t") && i + 1 < argc) timeline = argv[++i];
+        else if (argv[i][0] == '-' || name) usage();
+        else name = argv[i];
+    }
+    if (!name) usage();
+    for (const Scenario &s : Scenarios) {
+        if (!strcmp(name, "list")) printf("%-14s %s\n", s.Name, s.Description);
+        else if (!strcmp(name, s.Name)) scenario = &s;
+    }
+    if (!strcmp(name, "list")) return 0;
+    if (!scenario) usage();
+
+    if (pcap && !powerline.openCapture(pcap)) {
+        perror(pcap);
+        return 2;
+    }
+    srand(1);
+    memcpy(myMac, EvseMac, 6);
+    setSeccIp();
+    powerline.Modem = &qca7000;
+    for (const EvProfile &p : scenario->Profiles) {
+        Evs.emplace_back(new Ev(p));
+        powerline.Evs.push_back(Evs.back().get());
+    }
+    if (scenario->Setup) scenario->Setup();
+
+    pthread_attr_t attr;
+    pthread_t task;
+    TaskStack = (uint8_t *)aligned_alloc(4096, TASK_STACK);
+    memset(TaskStack, STACK_PAINT, TASK_STACK);
+    pthread_attr_init(&attr);
+    pthread_attr_setstack(&attr, TaskStack, TASK_STACK);
+    if (pthread_create(&task, &attr, modemTask, &end) != 0) {
+        perror("modem task");
+        return 2;
+    }
+    pthread_join(task, NULL);
+
+    if (timeline) {
+        String json;
+        FILE *f = fopen(timeline, "w");
+        modemTimelineJson(json);
+        if (f) {
+            fputs(json.c_str(), f);
+            fclose(f);
+        } else perror(timeline);
+    }
+    report(*scenario, end, errors);
+    return errors.empty() ? 0 : 1;
+}
@@ -0,0 +1,33 @@
+/*
+ * Host build of the MQTT queue (mqtt_queue.cpp)
+ *
+ * The parts of the Arduino core and FreeRTOS the queue uses.
+ */
+
+#ifndef __HOST_ARDUINO_H
+#define __HOST_ARDUINO_H
+
+#include <cstdint>
+#include <cstring>
+#include <pthread.h>
+#include <string>
+
+class String : public std::string {
+public:
+    String(const char *str = "") : std::string(str) {}
+    String(const std::string &str) : std::string(str) {}
+};
+
+// FreeRTOS
+typedef pthread_mutex_t *SemaphoreHandle_t;
+#define portMAX_DELAY 0xffffffff
+
+static inline SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+    SemaphoreHandle_t mutex = new pthread_mutex_t;
+    pthread_mutex_init(mutex, NULL);
+    return mutex;
+}
+static inline int xSemaphoreTake(SemaphoreHandle_t mutex, uint32_t ticks) { (void)ticks; return pthread_mutex_lock(mutex) == 0; }
+static inline int xSemaphoreGive(SemaphoreHandle_t mutex) { return pthread_mutex_unlock(mutex) == 0; }
+
+#endif
@@ -0,0 +1,208 @@
+/*
+ * Host test of the MQTT /Set/ command dispatch (mqtt_command.cpp)
+ *
+ * The command table is the one of esp32.cpp: the Makefile extracts its MQTT_CMD() lines into commands.inc,
+ * and every entry gets the handler of this test. A payload "bad" is rejected, any other is accepted.
+ *
+ *   table        every command of the firmware is found by its suffix, near misses are not; prints ns per lookup
+ *   rate-limit   a command within minInterval ms of the last accepted one is dropped; a rejected or a dropped
+ *                one does not count
+ *   parse        the payload parsers stop at the length, also when digits follow it
+ *
+ * usage: mqtt_commands list|table|rate-limit|parse
+ */
+
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <string>
+#include <vector>
+#include "mqtt_command.h"
+
+static unsigned HandlerCalls;
+
+static bool mqttSetAny(const char *payload, size_t len) {
+    HandlerCalls++;
+    return !mqttIs(payload, len, "bad");
+}
+
+#undef MQTT_CMD
+#define MQTT_CMD(name, interval) { #name, mqttHash(#name), mqttSetAny, interval }
+
+static const MqttCommand Commands[] = {
+#include "commands.inc"
+};
+
+#define COMMAND_COUNT (sizeof(Commands) / sizeof(Commands[0]))
+static_assert(COMMAND_COUNT <= MQTT_CMD_MAX, "raise MQTT_CMD_SLOTS");
+
+static const MqttCommand *command(const char *suffix) {
+    for (const MqttCommand &cmd : Commands)
+        if (!strcmp(cmd.suffix, suffix)) return &cmd;
+    return NULL;
+}
+
+/*
+ * Checks
+ */
+
+static void expect(std::vector<std::string> &errors, bool ok, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+static void expect(std::vector<std::string> &errors, bool ok, const char *fmt, ...) {
+    char buf[256];
+    va_list args;
+
+    if (ok) return;
+    va_start(args, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    errors.push_back(buf);
+}
+
+static bool report(const char *name, const std::vector<std::string> &errors) {
+    for (const std::string &e : errors) printf("  FAIL: %s\n", e.c_str());
+    printf("%s: %s\n\n", name, errors.empty() ? "PASS" : "FAIL");
+    return errors.empty();
+}
+
+/*
+ * Scenarios
+ */
+
+static bool table(void) {
+    std::vector<std::string> errors;
+    MqttCommands_t dispatcher(Commands, COMMAND_COUNT);
+    std::set<uint32_t> hashes;
+
+    for (const MqttCommand &cmd : Commands) {
+        expect(errors, cmd.hash == mqttHashLen(cmd.suffix, strlen(cmd.suffix)), "%s: hash differs from mqttHashLen()", cmd.suffix);
+        expect(errors, hashes.insert(cmd.hash).second, "%s: hash %08x is not unique", cmd.suffix, cmd.hash);
+
+        // The suffix is not null terminated in the topic
+        std::string topic = std::string(cmd.suffix) + "/x";
+        expect(errors, dispatcher.find(topic.c_str(), strlen(cmd.suffix)) == &cmd, "%s: not found", cmd.suffix);
+
+        std::string shorter(cmd.suffix, strlen(cmd.suffix) - 1), longer = std::string(cmd.suffix) + "X", lower = cmd.suffix;
+        for (char &c : lower) c = tolower(c);
+        for (const std::string *miss : {&shorter, &longer, &lower})
+            if (!command(miss->c_str()))
+                expect(errors, !dispatcher.find(miss->data(), miss->size()), "%s: found for %s", miss->c_str(), cmd.suffix);
+    }
+    expect(errors, !dispatcher.find("", 0), "the empty suffix is found");
+    expect(errors, command("Mode") && command("MainsMeter") && command("RFID"), "commands.inc lacks the firmware table");
+
+    HandlerCalls = 0;
+    expect(errors, dispatcher.dispatch("Unknown", 7, "1", 1, 1000) == MQTT_CMD_UNKNOWN && !HandlerCalls,
+           "an unknown command reaches a handler");
+
+    const unsigned rounds = 100000;
+    unsigned found = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned i = 0; i < rounds; i++)
+        for (const MqttCommand &cmd : Commands) found += dispatcher.find(cmd.suffix, strlen(cmd.suffix)) != NULL;
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    printf("table: %zu commands in %u slots, %.1f ns per lookup\n", COMMAND_COUNT, MQTT_CMD_SLOTS, ns / (rounds * COMMAND_COUNT));
+    expect(errors, found == rounds * COMMAND_COUNT, "%u of %zu lookups found", found, rounds * COMMAND_COUNT);
+    return report("table", errors);
+}
+
+static bool rateLimit(void) {
+    std::vector<std::string> errors;
+    MqttCommands_t dispatcher(Commands, COMMAND_COUNT);
+    const MqttCommand *meter = command("MainsMeter"), *rfid = command("RFID"), *mode = command("Mode");
+
+    if (!meter || !rfid || !mode) {
+        errors.push_back("MainsMeter, RFID or Mode is not in the table");
+        return report("rate-limit", errors);
+    }
+    expect(errors, meter->minInterval && rfid->minInterval && !mode->minInterval, "MainsMeter and RFID are limited, Mode is not");
+
+    struct Step {
+        const MqttCommand *Cmd;
+        uint32_t Now;
+        const char *Payload;
+        MqttDispatch Result;
+    } steps[] = {
+        { meter, 0,                                     "1:2:3",    MQTT_CMD_ACCEPTED },    // millis() 0 counts as 1
+        { meter, meter->minInterval,                    "1:2:3",    MQTT_CMD_LIMITED },
+        { meter, meter->minInterval + 1u,               "1:2:3",    MQTT_CMD_ACCEPTED },
+        { meter, meter->minInterval + 2u,               "1:2:3",    MQTT_CMD_LIMITED },
+        { meter, 3u * meter->minInterval,               "bad",      MQTT_CMD_REJECTED },
+        { meter, 3u * meter->minInterval + 1,           "1:2:3",    MQTT_CMD_ACCEPTED },    // the rejected one did not count
+        { rfid,  10000,                                 "bad",      MQTT_CMD_REJECTED },
+        { rfid,  10001,                                 "bad",      MQTT_CMD_REJECTED },
+        { rfid,  10002,                                 "0102",     MQTT_CMD_ACCEPTED },
+        { rfid,  10002u + rfid->minInterval / 2,        "0102",     MQTT_CMD_LIMITED },
+        { rfid,  10002u + rfid->minInterval - 1,        "0102",     MQTT_CMD_LIMITED },     // the dropped one did not count either
+        { rfid,  10002u + rfid->minInterval,            "0102",     MQTT_CMD_ACCEPTED },
+        { mode,  20000,                                 "Normal",   MQTT_CMD_ACCEPTED },
+        { mode,  20000,                                 "Smart",    MQTT_CMD_ACCEPTED },
+        { meter, 0xffffffffu - 10,                      "1:2:3",    MQTT_CMD_ACCEPTED },    // millis() wraps
+        { meter, 10,                                    "1:2:3",    MQTT_CMD_LIMITED },
+        { meter, meter->minInterval - 11u,              "1:2:3",    MQTT_CMD_ACCEPTED },
+    };
+    static const char *results[] = {"unknown", "limited", "rejected", "accepted"};
+
+    for (const Step &step : steps) {
+        unsigned calls = HandlerCalls;
+        MqttDispatch result = dispatcher.dispatch(step.Cmd->suffix, strlen(step.Cmd->suffix), step.Payload, strlen(step.Payload), step.Now);
+        expect(errors, result == step.Result, "%s %s at %u: %s, not %s", step.Cmd->suffix, step.Payload, step.Now,
+               results[result], results[step.Result]);
+        expect(errors, (HandlerCalls != calls) == (step.Result != MQTT_CMD_LIMITED), "%s at %u: handler %s", step.Cmd->suffix,
+               step.Now, HandlerCalls != calls ? "called" : "not called");
+    }
+    return report("rate-limit", errors);
+}
+
+static bool parse(void) {
+    std::vector<std::string> errors;
+    int32_t v[5], value;
+    const char *end;
+
+    expect(errors, mqttToInt("1234", 2) == 12, "\"1234\" cut at 2 is not 12");
+    expect(errors, mqttToInt(" -42x", 5) == -42, "\" -42x\" is not -42");
+    expect(errors, mqttToInt("+7", 2) == 7, "\"+7\" is not 7");
+    expect(errors, mqttToInt("abc", 3) == 0 && mqttToInt("-", 1) == 0 && mqttToInt("5", 0) == 0, "no number is not 0");
+    expect(errors, !mqttParseInt("-", 1, &value), "\"-\" is a number");
+    expect(errors, mqttParseInt("12:3", 4, &value, &end) && value == 12 && *end == ':', "\"12:3\" does not stop at ':'");
+
+    memset(v, 0, sizeof(v));
+    expect(errors, mqttParseList("10:-20:30", 9, ':', v, 3) == 3 && v[0] == 10 && v[1] == -20 && v[2] == 30, "\"10:-20:30\"");
+    expect(errors, mqttParseList("10:-20:30:40", 12, ':', v, 3) == 3 && v[2] == 30, "more values than max");
+    expect(errors, mqttParseList("10:20:3099", 7, ':', v, 5) == 3 && v[2] == 3, "the list reads past its length");
+    expect(errors, mqttParseList("10:20:", 6, ':', v, 5) == 2, "a trailing separator is a value");
+    expect(errors, mqttParseList("10,20", 5, ':', v, 5) == 1, "another separator is accepted");
+    expect(errors, mqttParseList("", 0, ':', v, 5) == 0, "the empty list has values");
+
+    expect(errors, mqttIs("Normal", 6, "Normal") && !mqttIs("Normal", 4, "Normal") && !mqttIs("NormalX", 7, "Normal"),
+           "mqttIs() does not compare the length");
+    return report("parse", errors);
+}
+
+static const struct {
+    const char *Name;
+    bool (*Run)(void);
+} Scenarios[] = {
+    {"table", table},
+    {"rate-limit", rateLimit},
+    {"parse", parse},
+};
+
+static void usage(void) {
+    printf("usage: mqtt_commands list|table|rate-limit|parse\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) usage();
+    if (!strcmp(argv[1], "list")) {
+        for (const auto &s : Scenarios) printf("%s\n", s.Name);
+        return 0;
+    }
+    for (const auto &s : Scenarios)
+        if (!strcmp(argv[1], s.Name)) return s.Run() ? 0 : 1;
+    usage();
+}
@@ -0,0 +1,226 @@
+/*
+ * Host test of the outbound MQTT queue (mqtt_queue.cpp)
+ *
+ *   stalled   the broker takes nothing for an hour while the state is published every 10 s, as mqttPublishData()
+ *             does: the queue stays within its bounds, and then sends the newest value of every topic, state first
+ *   full      more topics or bytes than fit: the oldest telemetry is dropped, state is never dropped for telemetry,
+ *             and a message that can not fit drops nothing else
+ *   order     state before telemetry, oldest first; a coalesced topic takes the place of its newest value
+ *
+ * usage: mqtt_queue list|stalled|full|order
+ */
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "mqtt_queue.h"
+
+#define PREFIX "SmartEVSE-12345/"
+#define STATE_TOPICS 36                                                         // retained topics of mqttPublishData()
+#define TELEMETRY_TOPICS 27                                                     // and the others
+#define DATA_BYTES 1500                                                         // the JSON document on <prefix>/Data
+
+struct Message {
+    std::string Topic, Payload;
+    bool Retained;
+};
+
+/*
+ * Checks
+ */
+
+static void expect(std::vector<std::string> &errors, bool ok, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+static void expect(std::vector<std::string> &errors, bool ok, const char *fmt, ...) {
+    char buf[256];
+    va_list args;
+
+    if (ok) return;
+    va_start(args, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    errors.push_back(buf);
+}
+
+static bool report(const char *name, const std::vector<std::string> &errors) {
+    for (const std::string &e : errors) printf("  FAIL: %s\n", e.c_str());
+    printf("%s: %s\n\n", name, errors.empty() ? "PASS" : "FAIL");
+    return errors.empty();
+}
+
+static std::vector<Message> drain(MqttQueue_t &queue) {
+    std::vector<Message> sent;
+    String topic, payload;
+    bool retained;
+    uint8_t qos;
+
+    while (queue.pop(topic, payload, retained, qos)) sent.push_back({topic, payload, retained});
+    return sent;
+}
+
+// What is sent: each topic once, state first, and the payload last published on the topic
+static void checkSent(std::vector<std::string> &errors, const std::vector<Message> &sent, const std::map<std::string, Message> &published) {
+    std::set<std::string> topics;
+    bool telemetry = false;
+
+    for (const Message &m : sent) {
+        expect(errors, topics.insert(m.Topic).second, "%s sent twice", m.Topic.c_str());
+        expect(errors, !(m.Retained && telemetry), "state %s sent after telemetry", m.Topic.c_str());
+        telemetry |= !m.Retained;
+        auto p = published.find(m.Topic);
+        expect(errors, p != published.end() && p->second.Payload == m.Payload && p->second.Retained == m.Retained,
+               "%s sent with another payload than the last one published", m.Topic.c_str());
+    }
+    for (const auto &p : published)
+        expect(errors, !p.second.Retained || topics.count(p.first), "state %s not sent", p.first.c_str());
+}
+
+/*
+ * Scenarios
+ */
+
+static bool stalled(void) {
+    std::vector<std::string> errors;
+    MqttQueue_t queue;
+    std::map<std::string, Message> published;
+    const unsigned cycles = 360;                                                // an hour
+    size_t bytes = 0, messages = 0;
+    uint16_t peakBytes = 0;
+
+    auto publish = [&](const std::string &topic, const std::string &payload, bool retained) {
+        queue.push(topic.c_str(), payload.c_str(), retained, 0);
+        published[topic] = {topic, payload, retained};
+        bytes += topic.size() + payload.size();
+        messages++;
+        if (queue.QueuedBytes > peakBytes) peakBytes = queue.QueuedBytes;
+    };
+
+    for (unsigned cycle = 0; cycle < cycles; cycle++) {
+        for (unsigned i = 0; i < STATE_TOPICS; i++)
+            publish(PREFIX "State" + std::to_string(i), std::to_string(cycle / 30 + i), true);
+        for (unsigned i = 0; i < TELEMETRY_TOPICS; i++)
+            publish(PREFIX "Telemetry" + std::to_string(i), std::to_string(cycle * 37 + i), false);
+        publish(PREFIX "Data", std::string(DATA_BYTES - 8, 'x') + std::to_string(10000000 + cycle), false);
+        if (cycle % 60 == 59) publish(PREFIX "Error", cycle % 120 == 59 ? "None" : "Temperature High", true);
+        expect(errors, queue.Queued <= MQTT_QUEUE_SIZE && queue.QueuedBytes <= MQTT_QUEUE_BYTES,
+               "cycle %u: %u messages, %u bytes queued", cycle, queue.Queued, queue.QueuedBytes);
+    }
+
+    const uint16_t queuedBytes = queue.QueuedBytes;
+    const uint32_t dropped = queue.Dropped;
+    std::vector<Message> sent = drain(queue);
+    size_t sentBytes = 0;
+    for (const Message &m : sent) sentBytes += m.Topic.size() + m.Payload.size();
+
+    printf("stalled: %zu messages of %zu bytes published in an hour; queued at most %u bytes, %u coalesced, %u dropped\n",
+           messages, bytes, peakBytes, queue.Coalesced, dropped);
+    printf("  sent after the stall: %zu messages of %zu bytes\n", sent.size(), sentBytes);
+    expect(errors, sentBytes == queuedBytes, "%zu bytes sent, %u were queued", sentBytes, queuedBytes);
+    expect(errors, sent.size() == published.size() && !dropped, "%zu of %zu topics sent, %u dropped", sent.size(), published.size(), dropped);
+    expect(errors, !queue.Queued && !queue.QueuedBytes, "%u messages, %u bytes left after the drain", queue.Queued, queue.QueuedBytes);
+    checkSent(errors, sent, published);
+    return report("stalled", errors);
+}
+
+static bool full(void) {
+    std::vector<std::string> errors;
+
+    {   // more telemetry topics than slots: the oldest goes
+        MqttQueue_t queue;
+        std::map<std::string, Message> published;
+        for (unsigned i = 0; i < MQTT_QUEUE_SIZE + 5; i++) {
+            std::string topic = PREFIX "T" + std::to_string(i);
+            expect(errors, queue.push(topic.c_str(), "1", false, 0), "telemetry %u dropped", i);
+            if (i >= 5) published[topic] = {topic, "1", false};
+        }
+        expect(errors, queue.Queued == MQTT_QUEUE_SIZE && queue.Dropped == 5, "%u queued, %u dropped", queue.Queued, queue.Dropped);
+        std::vector<Message> sent = drain(queue);
+        expect(errors, sent.size() == published.size(), "%zu of %zu sent", sent.size(), published.size());
+        checkSent(errors, sent, published);
+    }
+
+    {   // a queue full of state: telemetry is dropped, newer state replaces the oldest
+        MqttQueue_t queue;
+        for (unsigned i = 0; i < MQTT_QUEUE_SIZE; i++)
+            queue.push((PREFIX "S" + std::to_string(i)).c_str(), "1", true, 0);
+        expect(errors, !queue.push(PREFIX "T", "1", false, 0), "telemetry queued in a queue full of state");
+        expect(errors, queue.push(PREFIX "S-new", "1", true, 0) && queue.Dropped == 2, "new state not queued in place of the oldest");
+        expect(errors, queue.push(PREFIX "S1", "2", true, 0) && queue.Dropped == 2, "state not coalesced in a full queue");
+        std::vector<Message> sent = drain(queue);
+        expect(errors, sent.size() == MQTT_QUEUE_SIZE && sent.front().Topic == PREFIX "S2" && sent.back().Topic == PREFIX "S1" &&
+               sent.back().Payload == "2", "not S2 .. S-new, S1=2 sent");
+    }
+
+    {   // bytes: state evicts telemetry until it fits, telemetry does not evict state; what can not fit evicts nothing
+        MqttQueue_t queue;
+        const std::string big(MQTT_QUEUE_BYTES / 4, 'x');
+        for (unsigned i = 0; i < 3; i++) queue.push((PREFIX "T" + std::to_string(i)).c_str(), big.c_str(), false, 0);
+        expect(errors, queue.push(PREFIX "S0", big.c_str(), true, 0), "state dropped, telemetry kept");
+        expect(errors, queue.Dropped == 1 && queue.Queued == 3, "%u dropped, %u queued for a state", queue.Dropped, queue.Queued);
+        expect(errors, queue.push(PREFIX "S1", big.c_str(), true, 0), "second state dropped");
+        expect(errors, queue.push(PREFIX "T9", big.c_str(), false, 0), "telemetry not queued in place of older telemetry");
+        expect(errors, queue.Dropped == 3 && queue.QueuedBytes <= MQTT_QUEUE_BYTES, "%u dropped, %u bytes queued", queue.Dropped, queue.QueuedBytes);
+        expect(errors, !queue.push(PREFIX "T10", (big + big).c_str(), false, 0), "telemetry queued in place of state");
+        expect(errors, !queue.push(PREFIX "Huge", std::string(MQTT_QUEUE_BYTES, 'x').c_str(), true, 0), "a message over MQTT_QUEUE_BYTES queued");
+        expect(errors, queue.Dropped == 5 && queue.Queued == 3, "%u dropped, %u queued after two that do not fit", queue.Dropped, queue.Queued);
+
+        std::vector<Message> sent = drain(queue);
+        expect(errors, sent.size() == 3 && sent[0].Topic == PREFIX "S0" && sent[1].Topic == PREFIX "S1" && sent[2].Topic == PREFIX "T9",
+               "not S0, S1, T9 sent");
+    }
+    return report("full", errors);
+}
+
+static bool order(void) {
+    std::vector<std::string> errors;
+    MqttQueue_t queue;
+
+    queue.push(PREFIX "T1", "a", false, 0);
+    queue.push(PREFIX "S1", "a", true, 1);
+    queue.push(PREFIX "T2", "a", false, 0);
+    queue.push(PREFIX "S2", "a", true, 0);
+    queue.push(PREFIX "T1", "b", false, 0);                                     // coalesced: T1 now after T2
+    queue.push(PREFIX "S1", "b", true, 1);
+    expect(errors, queue.Queued == 4 && queue.Coalesced == 2, "%u queued, %u coalesced", queue.Queued, queue.Coalesced);
+
+    const char *expected[][2] = {{"S2", "a"}, {"S1", "b"}, {"T2", "a"}, {"T1", "b"}};
+    String topic, payload;
+    bool retained;
+    uint8_t qos;
+    for (const auto &e : expected) {
+        bool ok = queue.pop(topic, payload, retained, qos);
+        expect(errors, ok && topic == std::string(PREFIX) + e[0] && payload == e[1], "%s=%s not next, %s=%s", e[0], e[1],
+               ok ? topic.c_str() : "nothing", ok ? payload.c_str() : "");
+        expect(errors, !ok || qos == (topic == PREFIX "S1" ? 1 : 0), "%s: qos %u", topic.c_str(), qos);
+    }
+    expect(errors, !queue.pop(topic, payload, retained, qos), "the queue is not empty");
+    return report("order", errors);
+}
+
+static const struct {
+    const char *Name;
+    bool (*Run)(void);
+} Scenarios[] = {
+    {"stalled", stalled},
+    {"full", full},
+    {"order", order},
+};
+
+static void usage(void) {
+    printf("usage: mqtt_queue list|stalled|full|order\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) usage();
+    if (!strcmp(argv[1], "list")) {
+        for (const auto &s : Scenarios) printf("%s\n", s.Name);
+        return 0;
+    }
+    for (const auto &s : Scenarios)
+        if (!strcmp(argv[1], s.Name)) return s.Run() ? 0 : 1;
+    usage();
+}
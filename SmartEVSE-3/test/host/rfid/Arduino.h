@@ -0,0 +1,40 @@
+/*
+ * Host build of the RFID cards (OneWire.cpp)
+ *
+ * The parts of the Arduino core and FreeRTOS the cards use. millis() is the host clock. The mutexes are
+ * pthread mutexes, so a card presented to the reader in one thread waits for an upload in another as it would
+ * on the ESP32.
+ */
+
+#ifndef __HOST_ARDUINO_H
+#define __HOST_ARDUINO_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <ctime>
+#include <pthread.h>
+
+unsigned long millis(void);
+
+struct HostEsp {
+    uint64_t getEfuseMac(void) { return 0x0000a1b2c3d4e5f6ULL; }
+};
+extern HostEsp ESP;
+
+// FreeRTOS
+typedef pthread_mutex_t *SemaphoreHandle_t;
+#define portMAX_DELAY 0xffffffff
+#define pdTRUE 1
+
+static inline SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+    SemaphoreHandle_t mutex = new pthread_mutex_t;
+    pthread_mutex_init(mutex, NULL);
+    return mutex;
+}
+static inline int xSemaphoreTake(SemaphoreHandle_t mutex, uint32_t ticks) { (void)ticks; return pthread_mutex_lock(mutex) == 0; }
+static inline int xSemaphoreGive(SemaphoreHandle_t mutex) { return pthread_mutex_unlock(mutex) == 0; }
+
+#endif
@@ -0,0 +1,5 @@
+/*
+ * Host build of the RFID cards: the LittleFS of the session journal.
+ */
+
+#include "../session/LittleFS.h"
@@ -0,0 +1,20 @@
+/*
+ * Host build of the RFID cards: the preferences of older firmware are empty, there is nothing to migrate.
+ */
+
+#ifndef __HOST_PREFERENCES_H
+#define __HOST_PREFERENCES_H
+
+#include <Arduino.h>
+
+class Preferences {
+public:
+    bool begin(const char *name, bool readOnly) { (void)name; (void)readOnly; return true; }
+    void end(void) {}
+    uint8_t getUChar(const char *key, uint8_t def) { (void)key; return def; }
+    size_t putUChar(const char *key, uint8_t value) { (void)key; (void)value; return 1; }
+    size_t getBytes(const char *key, void *buf, size_t maxLen) { (void)key; (void)buf; (void)maxLen; return 0; }
+    bool remove(const char *key) { (void)key; return true; }
+};
+
+#endif
@@ -0,0 +1,323 @@
+/*
+ * Host test and benchmark of the RFID cards
+ *
+ * Runs the unmodified OneWire.cpp of the v4 firmware against the LittleFS of the session journal, with every
+ * write taking FLASH_US_PER_KB. A reader thread presents stored cards to MatchRFID() all the time, as the RFID
+ * reader does, and reports the longest it had to wait while the cards were changed.
+ *
+ *   upload n     start without cards, upload an rfid.txt of n cards, then another one that replaces it
+ *   churn n      load the cards of upload n, then remove and add cards one at a time, which compacts the journal
+ *   load n       load the cards of churn n, as after a restart
+ *   low-memory   an upload that does not fit next to the stored cards fails, and the stored cards are kept
+ *
+ * usage: rfid_cards [-v level] [-d directory] upload n|churn n|load n|low-memory
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include <Preferences.h>
+#include <LittleFS.h>
+#include <esp_heap_caps.h>
+#include "esp32.h"
+#include "OneWire.h"
+#include "session.h"
+
+#define FLASH_US_PER_KB 1000                                                    // 1 MB/s, faster than the flash of the ESP32
+#define KEPT_CARDS 100                                                          // in every upload, never removed: the reader presents these
+#define MAX_WAIT_MS 20                                                          // longest a presented card may wait for a change
+
+namespace fs = std::filesystem;
+
+/*
+ * The EVSE, as far as the cards see it
+ */
+
+int hostLogLevel = 0;
+HostEsp ESP;
+Preferences preferences;
+size_t hostLargestFreeBlock = 4 * 1024 * 1024;
+uint8_t PIN_SW_IN = 0, RFIDstatus = 0;
+uint16_t CardOffset = 0, BacklightTimer = 0;
+bool LocalTimeSet = false;
+AccessStatus_t AccessStatus = OFF;
+extern unsigned char RFID[8];
+uint16_t MatchRFID(void);                                                       // called by CheckRFID(), not in OneWire.h
+
+unsigned long millis(void) {
+    static const auto start = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+void hostLog(int level, const char *fmt, ...) {
+    va_list args;
+
+    if (level > hostLogLevel) return;
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+}
+
+void setAccess(AccessStatus_t Access) { AccessStatus = Access; }
+void BuzzConfirmation(void) {}
+void BuzzError(void) {}
+uint8_t setItemValue(uint8_t nav, uint16_t val) { (void)nav; (void)val; return 0; }
+uint16_t getItemValue(uint8_t nav) { (void)nav; return 1; }
+void SessionSetCard(const uint8_t *uid) { (void)uid; }
+
+/*
+ * The cards
+ */
+
+struct Card {
+    std::string Name, Expiry;
+};
+
+// Card i of a group, the group is the first byte of its UID. The last byte is never 0xff, that would make it
+// the 6 byte UID of an old reader.
+static std::string uid(uint8_t group, int i) {
+    const uint32_t hash = i * 2654435761u;
+    char str[15];
+
+    snprintf(str, sizeof(str), "%02X%08X%02X%02X", group, hash, (i / 255) & 0xff, i % 255);
+    return str;
+}
+
+static std::string expiry(int i) {
+    char str[11] = "";
+
+    if (i % 3 == 0) snprintf(str, sizeof(str), "2030-%02d-%02d", i % 12 + 1, i % 28 + 1);
+    return str;
+}
+
+// The first upload, and the one that replaces it: both hold the KEPT_CARDS
+static std::map<std::string, Card> uploadCards(int n, bool second) {
+    std::map<std::string, Card> cards;
+
+    for (int i = 0; i < n; i++) {
+        const bool kept = i < KEPT_CARDS;
+        const int number = kept || !second ? i : n + i;
+        cards[uid(0x04, number)] = {(kept || !second ? "card " : "new ") + std::to_string(number), expiry(number)};
+    }
+    return cards;
+}
+
+// Each step of the churn removes a card of the second upload, and adds one
+static int churnSteps(int n) {
+    return n > KEPT_CARDS ? n - KEPT_CARDS : 0;
+}
+
+static std::map<std::string, Card> churnedCards(int n) {
+    std::map<std::string, Card> cards = uploadCards(n, true);
+
+    for (int i = 0; i < churnSteps(n); i++) {
+        cards.erase(uid(0x04, n + KEPT_CARDS + i));
+        cards[uid(0x08, i)] = {"churn " + std::to_string(i), expiry(i)};
+    }
+    return cards;
+}
+
+static std::string rfidTxt(const std::map<std::string, Card> &cards) {
+    std::string txt = "# UID,name,expiry\n";
+
+    for (const auto &c : cards) txt += c.first + "," + c.second.Name + "," + c.second.Expiry + "\n";
+    return txt;
+}
+
+static int32_t upload(const std::string &txt) {
+    ImportRFIDBegin();
+    for (size_t pos = 0; pos < txt.size(); pos += 1460) ImportRFIDData(txt.data() + pos, std::min<size_t>(1460, txt.size() - pos));
+    return ImportRFIDEnd();
+}
+
+static void expect(std::vector<std::string> &errors, bool ok, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+static void expect(std::vector<std::string> &errors, bool ok, const char *fmt, ...) {
+    char buf[256];
+    va_list args;
+
+    if (ok) return;
+    va_start(args, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    errors.push_back(buf);
+}
+
+// The stored cards, in UID order, against the expected ones
+static void checkCards(std::vector<std::string> &errors, const std::map<std::string, Card> &cards, const char *when) {
+    char id[15], name[RFID_NAME_LEN + 1], exp[11];
+    auto it = cards.begin();
+    unsigned wrong = 0;
+
+    expect(errors, RFIDCardCount() == cards.size(), "%s: %u cards stored, not %zu", when, RFIDCardCount(), cards.size());
+    for (uint16_t i = 0; i < RFIDCardCount() && it != cards.end(); i++, it++) {
+        if (!GetRFIDCard(i, id, name, exp) || it->first != id || it->second.Name != name || it->second.Expiry != exp) {
+            if (!wrong++) errors.push_back(std::string(when) + ": card " + std::to_string(i) + " is " + id + "," + name + "," + exp +
+                                           ", not " + it->first + "," + it->second.Name + "," + it->second.Expiry);
+        }
+    }
+    expect(errors, wrong <= 1, "%s: %u cards differ", when, wrong);
+}
+
+/*
+ * The RFID reader: presents the KEPT_CARDS one after the other
+ */
+
+static std::atomic<bool> ReaderStop;
+static double ReaderMaxWait;                                                    // ms
+static unsigned long ReaderLookups, ReaderMisses;
+
+// The UIDs start with 0x04, not the family code 0x01 of the old reader
+static void present(const std::string &card) {
+    for (int i = 0; i < 7; i++) RFID[i] = strtol(card.substr(i * 2, 2).c_str(), NULL, 16);
+}
+
+static void reader(void) {
+    for (int i = 0; !ReaderStop; i = (i + 1) % KEPT_CARDS) {
+        present(uid(0x04, i));
+        const auto start = std::chrono::steady_clock::now();
+        const uint16_t slot = MatchRFID();
+        const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (ms > ReaderMaxWait) ReaderMaxWait = ms;
+        if (!slot) ReaderMisses++;
+        ReaderLookups++;
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+}
+
+// Runs a change of the cards with the reader active, and reports it
+template <class F> static void withReader(std::vector<std::string> &errors, const char *what, F change) {
+    const unsigned long written = LittleFS.Stats.Written;
+
+    ReaderStop = false;
+    ReaderMaxWait = 0;
+    ReaderLookups = ReaderMisses = 0;
+    std::thread thread(reader);
+    const auto start = std::chrono::steady_clock::now();
+    change();
+    const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    ReaderStop = true;
+    thread.join();
+
+    printf("  %-26s %7.0f ms, %5lu KB written; reader: %6lu cards, longest wait %6.2f ms\n", what, ms,
+           (LittleFS.Stats.Written - written) / 1024, ReaderLookups, ReaderMaxWait);
+    expect(errors, ReaderMisses == 0, "%s: %lu of %lu presented cards not found", what, ReaderMisses, ReaderLookups);
+    expect(errors, ReaderMaxWait <= MAX_WAIT_MS, "%s: a presented card waited %.1f ms", what, ReaderMaxWait);
+}
+
+/*
+ * Commands
+ */
+
+static bool report(const char *name, const std::vector<std::string> &errors) {
+    for (const std::string &e : errors) printf("  FAIL: %s\n", e.c_str());
+    printf("%s: %s\n\n", name, errors.empty() ? "PASS" : "FAIL");
+    return errors.empty();
+}
+
+static void start(bool empty) {
+    if (empty) {
+        fs::remove_all(LittleFS.Root);
+        fs::create_directories(LittleFS.Root);
+    }
+    ReadRFIDlist();
+}
+
+static bool uploadCommand(int n) {
+    std::vector<std::string> errors;
+    int32_t r1 = 0, r2 = 0;
+
+    printf("upload: rfid.txt of %d cards, then another one that keeps %d of them\n", n, KEPT_CARDS);
+    start(true);
+    r1 = upload(rfidTxt(uploadCards(n, false)));
+    expect(errors, r1 == n, "first upload stored %d cards", r1);
+    withReader(errors, "second upload", [&]() { r2 = upload(rfidTxt(uploadCards(n, true))); });
+    expect(errors, r2 == n, "second upload stored %d cards", r2);
+    checkCards(errors, uploadCards(n, true), "after the uploads");
+    return report("upload", errors);
+}
+
+static bool churnCommand(int n) {
+    std::vector<std::string> errors;
+    double longest = 0;
+    unsigned failed = 0;
+
+    printf("churn: %d cards removed and %d added one at a time, through the web API\n", churnSteps(n), churnSteps(n));
+    start(false);
+    checkCards(errors, uploadCards(n, true), "loaded");
+    withReader(errors, "remove and add", [&]() {
+        for (int i = 0; i < churnSteps(n); i++) {
+            const auto start = std::chrono::steady_clock::now();
+            failed += !RemoveRFIDCard(uid(0x04, n + KEPT_CARDS + i).c_str());
+            failed += SetRFIDCard(uid(0x08, i).c_str(), ("churn " + std::to_string(i)).c_str(), expiry(i).c_str()) != 1;
+            const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            if (ms > longest) longest = ms;
+        }
+    });
+    printf("  longest step, with a compaction of the journal: %.0f ms\n", longest);
+    expect(errors, failed == 0, "%u changes failed", failed);
+    checkCards(errors, churnedCards(n), "after the churn");
+    return report("churn", errors);
+}
+
+static bool loadCommand(int n) {
+    std::vector<std::string> errors;
+
+    printf("load: the journal after churn %d, as after a restart\n", n);
+    const auto start = std::chrono::steady_clock::now();
+    ReadRFIDlist();
+    printf("  loaded in %.1f ms, %lu KB read\n",
+           std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count(), LittleFS.Stats.Read / 1024);
+    checkCards(errors, churnedCards(n), "loaded");
+    return report("load", errors);
+}
+
+static bool lowMemoryCommand(void) {
+    std::vector<std::string> errors;
+    const std::map<std::string, Card> stored = uploadCards(1000, false);
+    int32_t r;
+
+    printf("low-memory: uploads with a largest free block of 48 KB, next to 1000 stored cards\n");
+    start(true);
+    r = upload(rfidTxt(stored));
+    expect(errors, r == 1000, "upload of 1000 cards stored %d cards", r);
+    hostLargestFreeBlock = 48 * 1024;
+    r = upload(rfidTxt(uploadCards(5000, true)));
+    expect(errors, r == -1, "upload of 5000 cards stored %d cards, with no room for them", r);
+    checkCards(errors, stored, "after the failed upload");
+    r = upload(rfidTxt(uploadCards(500, true)));
+    expect(errors, r == 500, "upload of 500 cards stored %d cards", r);
+    checkCards(errors, uploadCards(500, true), "after the small upload");
+    return report("low-memory", errors);
+}
+
+static void usage(void) {
+    printf("usage: rfid_cards [-v level] [-d directory] upload n|churn n|load n|low-memory\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[]) {
+    std::vector<std::string> args;
+    const char *dir = "build/rfid/fs";
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-v") && i + 1 < argc) hostLogLevel = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-d") && i + 1 < argc) dir = argv[++i];
+        else if (argv[i][0] == '-') usage();
+        else args.push_back(argv[i]);
+    }
+    if (args.empty()) usage();
+    LittleFS.Root = dir;
+    LittleFS.FlashUsPerKB = FLASH_US_PER_KB;
+
+    const int n = args.size() == 2 ? atoi(args[1].c_str()) : 0;
+    if (args[0] == "upload" && n > 0) return uploadCommand(n) ? 0 : 1;
+    if (args[0] == "churn" && n > 0) return churnCommand(n) ? 0 : 1;
+    if (args[0] == "load" && n > 0) return loadCommand(n) ? 0 : 1;
+    if (args[0] == "low-memory" && args.size() == 1) return lowMemoryCommand() ? 0 : 1;
+    usage();
+}
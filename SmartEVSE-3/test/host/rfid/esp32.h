@@ -0,0 +1,34 @@
+/*
+ * Host build of the RFID cards: the part of esp32.h and main.h the cards use.
+ */
+
+#ifndef __EVSE_ESP32
+#define __EVSE_ESP32
+
+#include <Arduino.h>
+
+#define EPOCH2_OFFSET 1672531200                                                // as in esp32.h
+#define BACKLIGHT 120                                                           // as in main.h
+#define MENU_RFIDREADER 9
+
+enum AccessStatus_t { OFF, ON, PAUSE };
+
+extern uint8_t RFIDstatus;
+extern uint16_t CardOffset, BacklightTimer;
+extern bool LocalTimeSet;
+extern AccessStatus_t AccessStatus;
+
+void setAccess(AccessStatus_t Access);
+void BuzzConfirmation(void);
+void BuzzError(void);
+uint8_t setItemValue(uint8_t nav, uint16_t val);
+uint16_t getItemValue(uint8_t nav);
+
+extern int hostLogLevel;                                                        // 1 = errors .. 4 = debug
+void hostLog(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+#define _LOG_A(fmt, ...) hostLog(1, fmt, ##__VA_ARGS__)
+#define _LOG_I(fmt, ...) hostLog(3, fmt, ##__VA_ARGS__)
+#define _LOG_A_NO_FUNC(fmt, ...) hostLog(1, fmt, ##__VA_ARGS__)
+
+#endif
@@ -0,0 +1,16 @@
+/*
+ * Host build of the RFID cards: the largest free block of the heap is set by the test.
+ */
+
+#ifndef __HOST_ESP_HEAP_CAPS_H
+#define __HOST_ESP_HEAP_CAPS_H
+
+#include <cstddef>
+#include <cstdint>
+
+#define MALLOC_CAP_8BIT (1 << 2)
+
+extern size_t hostLargestFreeBlock;
+static inline size_t heap_caps_get_largest_free_block(uint32_t caps) { (void)caps; return hostLargestFreeBlock; }
+
+#endif
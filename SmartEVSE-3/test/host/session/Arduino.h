@@ -0,0 +1,34 @@
+/*
+ * Host build of the session journal (session.cpp)
+ *
+ * The parts of the Arduino core and FreeRTOS the journal uses. millis() and time() are the simulated clock of
+ * the test, so a session of hours is written in microseconds.
+ */
+
+#ifndef __HOST_ARDUINO_H
+#define __HOST_ARDUINO_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <ctime>
+#include <strings.h>
+#include <type_traits>
+
+template <class A, class B> static inline typename std::common_type<A, B>::type min(A a, B b) { return a < b ? a : b; }
+template <class A, class B> static inline typename std::common_type<A, B>::type max(A a, B b) { return a > b ? a : b; }
+
+extern unsigned long hostMillis;
+extern time_t hostTime;
+static inline unsigned long millis(void) { return hostMillis; }
+#define time(t) (hostTime)
+
+// FreeRTOS
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux) ((void)(mux))
+
+#endif
@@ -0,0 +1,53 @@
+/*
+ * Host build of the session journal and the RFID cards: LittleFS on a directory of the host. The bytes read and
+ * written and the files opened are counted, so the cost of a query or a session can be compared with the flash of
+ * the ESP32.
+ */
+
+#ifndef __HOST_LITTLEFS_H
+#define __HOST_LITTLEFS_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <dirent.h>
+
+struct HostFsStats {
+    unsigned long Written, Read, Opens;
+};
+
+class File {
+public:
+    File() {}
+    explicit operator bool() const { return Fp || Dir; }
+    size_t write(const uint8_t *buf, size_t len);
+    size_t read(uint8_t *buf, size_t len);
+    bool seek(uint32_t pos) { return fseek(Fp, pos, SEEK_SET) == 0; }
+    size_t size(void);
+    const char *name(void) const { return Name.c_str(); }
+    File openNextFile(void);
+    void close(void);
+
+private:
+    friend class HostFs;
+    FILE *Fp = nullptr;
+    DIR *Dir = nullptr;
+    std::string Path, Name;
+};
+
+class HostFs {
+public:
+    std::string Root;                                                           // host directory that holds the file system
+    HostFsStats Stats = {};
+    unsigned long FlashUsPerKB = 0;                                             // host time a write takes, 0 = as fast as the host
+
+    File open(const char *path, const char *mode = "r");
+    bool exists(const char *path);
+    bool mkdir(const char *path);
+    bool rename(const char *from, const char *to);
+    bool remove(const char *path);
+};
+
+extern HostFs LittleFS;
+
+#endif
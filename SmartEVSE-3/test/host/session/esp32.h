@@ -0,0 +1,30 @@
+/*
+ * Host build of the session journal: the part of esp32.h the journal uses. The EVSE state and the EV meter
+ * are set by the test.
+ */
+
+#ifndef __EVSE_ESP32
+#define __EVSE_ESP32
+
+#include <Arduino.h>
+#include "main_c.h"
+
+enum AccessStatus_t { OFF, ON, PAUSE };
+
+struct Meter {
+    uint8_t Type;
+    int16_t Irms[3];                                                            // 0.1 A
+    int32_t Energy;                                                             // Wh
+};
+
+extern uint8_t State, Mode, Nr_Of_Phases_Charging;
+extern AccessStatus_t AccessStatus;
+extern bool LocalTimeSet;
+extern uint16_t Balanced[];                                                     // Amps value per EVSE, 0.1A
+extern Meter EVMeter;
+
+extern bool hostVerbose;
+#define _LOG_A(...) do { if (hostVerbose) printf(__VA_ARGS__); } while (0)
+#define _LOG_I(...) do { if (hostVerbose) printf(__VA_ARGS__); } while (0)
+
+#endif
@@ -0,0 +1,12 @@
+/*
+ * Host build of the session journal: the ROM crc32 of the ESP32 is the crc32 of zlib.
+ */
+
+#ifndef __HOST_ESP_ROM_CRC_H
+#define __HOST_ESP_ROM_CRC_H
+
+#include <zlib.h>
+
+static inline uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len) { return crc32(crc, buf, len); }
+
+#endif
@@ -0,0 +1,336 @@
+/*
+ * Host test of the charging session journal
+ *
+ * Runs the unmodified session.cpp of the v4 firmware against LittleFS on a host directory. Sessions are played
+ * through SessionSetCard(), SessionSetIdTag() and SessionTick() with a simulated clock, and every query is
+ * compared with a scan of all records on disk.
+ *
+ *   write n              start a new journal and play n sessions, then run the queries
+ *   query [interrupted]  load the journal and run the queries; fails unless that many sessions are interrupted
+ *   crash                start a session and exit without ending it, as a restart during a session
+ *   torn                 append a partial record to the newest segment, as a write cut short by a power loss
+ *
+ * usage: session_journal [-v] [-d directory] write n|query [interrupted]|crash|torn
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <cstddef>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include "esp32.h"
+#include "LittleFS.h"
+#include "esp_rom_crc.h"
+#include "mongoose.h"
+#include "session.h"
+
+#define SESSION_CARDS 200                                                       // distinct RFID cards
+#define RANDOM_QUERIES 3000
+
+namespace fs = std::filesystem;
+
+/*
+ * The EVSE, as far as the journal sees it
+ */
+
+unsigned long hostMillis = 1000;
+time_t hostTime = 1704067200;                                                   // 1/1/2024
+bool hostVerbose = false;
+
+uint8_t State = STATE_A, Mode = 0, Nr_Of_Phases_Charging = 3;
+AccessStatus_t AccessStatus = OFF;
+bool LocalTimeSet = true;
+uint16_t Balanced[1] = {160};
+Meter EVMeter = {1, {0, 0, 0}, 100000};
+char EVCCID[32];
+
+/*
+ * The web server, as far as the CSV export sees it
+ */
+
+static void append(struct mg_connection *c, bool chunk, const char *fmt, va_list ap) {
+    char buf[512];
+    int len = vsnprintf(buf, sizeof(buf), fmt, ap);
+
+    c->out.append(buf, std::min<size_t>(len, sizeof(buf) - 1));
+    if (chunk) c->send.len += len;
+}
+
+void mg_printf(struct mg_connection *c, const char *fmt, ...) {
+    va_list ap;
+
+    va_start(ap, fmt);
+    append(c, false, fmt, ap);
+    va_end(ap);
+}
+
+void mg_http_printf_chunk(struct mg_connection *c, const char *fmt, ...) {
+    va_list ap;
+
+    va_start(ap, fmt);
+    append(c, true, fmt, ap);
+    va_end(ap);
+}
+
+void mg_http_write_chunk(struct mg_connection *c, const char *buf, size_t len) { (void)c; (void)buf; (void)len; }
+
+/*
+ * Sessions
+ */
+
+static double hostUs(void) {
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count() / 1000.0;
+}
+
+static void tick(unsigned seconds) {
+    hostMillis += seconds * 1000UL;
+    hostTime += seconds;
+    SessionTick();
+}
+
+static void card(int n, uint8_t *uid) {
+    for (int i = 0; i < 7; i++) uid[i] = (n * 37 + i * 11) & 0xff;
+    uid[0] = n;
+    uid[6] = 0x10 + n;
+}
+
+// Session n: card n % SESSION_CARDS, an OCPP idTag on every 5th, 10 kWh in about an hour. Without stop, the EV
+// is still charging when the test exits.
+static void playSession(int n, bool stop = true) {
+    uint8_t uid[7];
+
+    card(n % SESSION_CARDS, uid);
+    AccessStatus = ON;
+    SessionSetCard(uid);
+    tick(600);                                                                  // idle between sessions
+    State = STATE_C;
+    tick(1);
+    if (n % 5 == 0) {
+        char tag[21];
+        snprintf(tag, sizeof(tag), "TAG%05d", n % 50);
+        SessionSetIdTag(tag);
+    }
+    snprintf(EVCCID, sizeof(EVCCID), "%012X", 0xA0000 + n % 30);
+    for (int i = 0; i < 4; i++) {
+        EVMeter.Energy += 2500;
+        EVMeter.Irms[i % 3] = 100 + n % 60;
+        tick(1000);
+    }
+    if (!stop) return;
+    State = STATE_A;
+    tick(1);
+    EVCCID[0] = 0;
+}
+
+/*
+ * Queries, against a scan of every valid record on disk
+ */
+
+struct Query {
+    const char *Name;
+    uint32_t From, To;
+    std::string Card;
+    uint32_t Skip, Count;
+};
+
+static std::vector<SessionRecord> Journal;                                      // oldest first
+
+static void loadJournal(void) {
+    std::vector<uint32_t> segments;
+
+    for (const auto &entry : fs::directory_iterator(LittleFS.Root + "/sessions")) {
+        const std::string name = entry.path().filename();
+        if (isdigit((unsigned char)name[0]) && entry.path().extension() == ".bin") segments.push_back(std::stoul(name));
+    }
+    std::sort(segments.begin(), segments.end());
+    Journal.clear();
+    for (uint32_t segment : segments) {
+        FILE *f = fopen((LittleFS.Root + "/sessions/" + std::to_string(segment) + ".bin").c_str(), "rb");
+        SessionRecord rec;
+
+        while (f && fread(&rec, sizeof(rec), 1, f) == 1) {
+            if (rec.Crc == esp_rom_crc32_le(0, (const uint8_t *)&rec, offsetof(SessionRecord, Crc))) Journal.push_back(rec);
+        }
+        if (f) fclose(f);
+    }
+}
+
+static std::vector<uint32_t> expected(const Query &q) {
+    std::vector<uint32_t> ids;
+    bool timed = q.From || q.To != 0xffffffff;
+
+    for (auto rec = Journal.rbegin(); rec != Journal.rend(); ++rec) {
+        char uid[15];
+        SessionFormatCard(&*rec, uid);
+        if (timed && (!rec->Start || rec->Start < q.From || rec->Start > q.To)) continue;
+        if (!q.Card.empty() && strcasecmp(uid, q.Card.c_str()) && strcasecmp(rec->IdTag, q.Card.c_str())) continue;
+        ids.push_back(rec->Id);
+    }
+    return ids;
+}
+
+static bool collect(void *arg, const SessionRecord *rec) {
+    ((std::vector<uint32_t> *)arg)->push_back(rec->Id);
+    return true;
+}
+
+static bool runQuery(const Query &q, bool report) {
+    std::vector<uint32_t> got, want = expected(q);
+    HostFsStats before = LittleFS.Stats;
+    double start = hostUs();
+    uint32_t total = SessionQuery(q.From, q.To, q.Card.c_str(), q.Skip, q.Count, collect, &got);
+    double us = hostUs() - start;
+    size_t page = want.size() > q.Skip ? std::min<size_t>(q.Count, want.size() - q.Skip) : 0;
+    bool ok = total == want.size() && got.size() == page && std::equal(got.begin(), got.end(), want.begin() + q.Skip);
+
+    if (report) {
+        printf("%-14s total %5u, %2zu returned, %7.0f us, %6lu bytes read in %3lu opens: %s\n", q.Name, total, got.size(),
+               us, LittleFS.Stats.Read - before.Read, LittleFS.Stats.Opens - before.Opens, ok ? "OK" : "MISMATCH");
+    }
+    return ok;
+}
+
+static bool runQueries(int interrupted) {
+    bool ok = true;
+    int found = 0, bad = 0;
+
+    loadJournal();
+    if (Journal.empty()) {
+        printf("no sessions on disk\n");
+        return false;
+    }
+    for (const SessionRecord &rec : Journal) found += !!(rec.Flags & SESSION_INTERRUPTED);
+    printf("%zu valid sessions on disk, ids %u..%u, %d interrupted\n", Journal.size(), Journal.front().Id,
+           Journal.back().Id, found);
+    if (interrupted >= 0 && found != interrupted) {
+        printf("expected %d interrupted sessions\n", interrupted);
+        ok = false;
+    }
+
+    const uint32_t mid = Journal[Journal.size() / 2].Start;
+    char uid[15];
+    SessionFormatCard(&Journal[Journal.size() / 3], uid);
+    const Query queries[] = {
+        {"newest page", 0, 0xffffffff, "", 0, 25},
+        {"page 10", 0, 0xffffffff, "", 250, 25},
+        {"one day", mid, mid + 86400, "", 0, 25},
+        {"one week", mid, mid + 7 * 86400, "", 0, 25},
+        {"card", 0, 0xffffffff, uid, 0, 25},
+        {"idTag", 0, 0xffffffff, "tag00010", 0, 25},
+        {"card + week", mid, mid + 7 * 86400, uid, 0, 25},
+        {"unknown card", 0, 0xffffffff, "00112233445566", 0, 25},
+    };
+    for (const Query &q : queries) ok &= runQuery(q, true);
+
+    srand(1);
+    for (int i = 0; i < RANDOM_QUERIES; i++) {
+        const SessionRecord &rec = Journal[rand() % Journal.size()];
+        Query q = {"random", 0, 0xffffffff, "", 0, 0};
+        char str[15];
+
+        if (rand() % 3 == 0) q.From = rec.Start - rand() % 200000;
+        if (rand() % 3 == 0) q.To = q.From + rand() % 2000000;
+        switch (rand() % 4) {
+            case 1: SessionFormatCard(&rec, str); q.Card = str; break;
+            case 2: q.Card = rec.IdTag; break;
+            case 3: q.Card = "tag00030"; break;
+        }
+        q.Skip = rand() % 3 ? rand() % 40 : rand() % 1400;
+        q.Count = rand() % 26;
+        bad += !runQuery(q, false);
+    }
+    printf("%d random queries: %d mismatches\n", RANDOM_QUERIES, bad);
+    ok &= !bad;
+
+    // CSV export of the whole journal, polled as the web server does
+    struct mg_connection c = {};
+    HostFsStats before = LittleFS.Stats;
+    int polls = 0;
+    double start = hostUs();
+    SessionExportBegin(&c, 0, 0xffffffff, "");
+    while (!c.is_draining) {
+        c.send.len = 0;
+        SessionExportPoll(&c);
+        polls++;
+    }
+    double us = hostUs() - start;
+    size_t body = c.out.find("\r\n\r\n") + 4;
+    size_t rows = std::count(c.out.begin() + body, c.out.end(), '\n') - 1;      // without the header
+    printf("csv: %zu rows, %zu bytes, %d polls, %.0f us, %lu bytes read: %s\n", rows, c.out.size(), polls, us,
+           LittleFS.Stats.Read - before.Read, rows == Journal.size() ? "OK" : "MISMATCH");
+    ok &= rows == Journal.size();
+    return ok;
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: session_journal [-v] [-d directory] write n|query [interrupted]|crash|torn\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[]) {
+    std::vector<std::string> args;
+    const char *dir = "build/session/fs";
+    double start;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-v")) hostVerbose = true;
+        else if (!strcmp(argv[i], "-d") && i + 1 < argc) dir = argv[++i];
+        else if (argv[i][0] == '-') usage();
+        else args.push_back(argv[i]);
+    }
+    if (args.empty()) usage();
+    LittleFS.Root = dir;
+
+    if (args[0] == "write" && args.size() == 2) {
+        int sessions = atoi(args[1].c_str());
+
+        fs::remove_all(LittleFS.Root);
+        fs::create_directories(LittleFS.Root);
+        SessionInit();
+        start = hostUs();
+        for (int n = 0; n < sessions; n++) playSession(n);
+        printf("%d sessions: %lu bytes written (%.1f per session), %.1f us per session\n", sessions,
+               LittleFS.Stats.Written, (double)LittleFS.Stats.Written / sessions, (hostUs() - start) / sessions);
+        return runQueries(0) ? 0 : 1;
+    }
+    if (args[0] == "query" && args.size() <= 2) {
+        start = hostUs();
+        SessionInit();
+        printf("init: %.0f us, %lu bytes read\n", hostUs() - start, LittleFS.Stats.Read);
+        return runQueries(args.size() == 2 ? atoi(args[1].c_str()) : -1) ? 0 : 1;
+    }
+    if (args[0] == "crash" && args.size() == 1) {
+        SessionInit();
+        playSession(424242, false);
+        printf("exit with session in progress\n");
+        return 0;
+    }
+    if (args[0] == "torn" && args.size() == 1) {
+        std::string newest;
+        uint32_t last = 0;
+        uint8_t partial[40];
+
+        for (const auto &entry : fs::directory_iterator(LittleFS.Root + "/sessions")) {
+            const std::string name = entry.path().filename();
+            if (!isdigit((unsigned char)name[0]) || entry.path().extension() != ".bin") continue;
+            if (newest.empty() || std::stoul(name) >= last) {
+                last = std::stoul(name);
+                newest = entry.path();
+            }
+        }
+        FILE *f = newest.empty() ? NULL : fopen(newest.c_str(), "ab");
+        if (!f) {
+            printf("no segment to append to\n");
+            return 1;
+        }
+        for (size_t i = 0; i < sizeof(partial); i++) partial[i] = rand();
+        fwrite(partial, 1, sizeof(partial), f);
+        fclose(f);
+        printf("%zu bytes appended to %s\n", sizeof(partial), newest.c_str());
+        return 0;
+    }
+    usage();
+}
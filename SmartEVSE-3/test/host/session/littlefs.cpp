@@ -0,0 +1,72 @@
+/*
+ * LittleFS on a directory of the host, for the session journal and the RFID cards. Every write can be made to
+ * take the time it takes on the flash of the ESP32, so a task that waits for another one sees realistic times.
+ */
+
+#include <cstdint>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "LittleFS.h"
+
+HostFs LittleFS;
+
+size_t File::write(const uint8_t *buf, size_t len) {
+    LittleFS.Stats.Written += len;
+    if (LittleFS.FlashUsPerKB) usleep(len * LittleFS.FlashUsPerKB / 1024);
+    return fwrite(buf, 1, len, Fp);
+}
+
+size_t File::read(uint8_t *buf, size_t len) {
+    size_t n = fread(buf, 1, len, Fp);
+
+    LittleFS.Stats.Read += n;
+    return n;
+}
+
+size_t File::size(void) {
+    long pos = ftell(Fp), size;
+
+    fseek(Fp, 0, SEEK_END);
+    size = ftell(Fp);
+    fseek(Fp, pos, SEEK_SET);
+    return size;
+}
+
+File File::openNextFile(void) {
+    File file;
+    struct dirent *entry;
+
+    while ((entry = readdir(Dir)) && entry->d_name[0] == '.');
+    if (!entry) return file;
+    file.Name = entry->d_name;
+    file.Path = Path + "/" + entry->d_name;
+    file.Fp = fopen(file.Path.c_str(), "rb");
+    return file;
+}
+
+void File::close(void) {
+    if (Fp) fclose(Fp);
+    if (Dir) closedir(Dir);
+    Fp = nullptr;
+    Dir = nullptr;
+}
+
+File HostFs::open(const char *path, const char *mode) {
+    File file;
+    struct stat st;
+
+    Stats.Opens++;
+    file.Path = Root + path;
+    if (stat(file.Path.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) file.Dir = opendir(file.Path.c_str());
+    else file.Fp = fopen(file.Path.c_str(), *mode == 'a' ? "ab" : *mode == 'w' ? "wb" : "rb");
+    return file;
+}
+
+bool HostFs::exists(const char *path) {
+    struct stat st;
+    return stat((Root + path).c_str(), &st) == 0;
+}
+
+bool HostFs::mkdir(const char *path) { return ::mkdir((Root + path).c_str(), 0755) == 0; }
+bool HostFs::rename(const char *from, const char *to) { return ::rename((Root + from).c_str(), (Root + to).c_str()) == 0; }
+bool HostFs::remove(const char *path) { return ::remove((Root + path).c_str()) == 0; }
@@ -0,0 +1,27 @@
+/*
+ * Host build of the session journal: a connection that collects the CSV export. The test empties send.len
+ * between polls, as mongoose does when the data is sent.
+ */
+
+#ifndef __HOST_MONGOOSE_H
+#define __HOST_MONGOOSE_H
+
+#include <string>
+
+#define MG_IO_SIZE 1460
+
+struct mg_iobuf {
+    size_t len;
+};
+
+struct mg_connection {
+    struct mg_iobuf send;
+    unsigned is_draining : 1;
+    std::string out;                                                            // everything that was sent
+};
+
+void mg_printf(struct mg_connection *c, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void mg_http_printf_chunk(struct mg_connection *c, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void mg_http_write_chunk(struct mg_connection *c, const char *buf, size_t len);
+
+#endif
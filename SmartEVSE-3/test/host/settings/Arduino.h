@@ -0,0 +1,48 @@
+/*
+ * Host build of the settings store (settings.cpp)
+ *
+ * The parts of the Arduino core, FreeRTOS and ESP-IDF the store uses. millis() is the simulated clock of the test.
+ * The settings task is a thread, and its ulTaskNotifyTake() sleeps in simulated time: the test advances the
+ * clock only while the task sleeps, so a day of changes is replayed in milliseconds, and every run is the same.
+ */
+
+#ifndef __HOST_ARDUINO_H
+#define __HOST_ARDUINO_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <pthread.h>
+
+unsigned long millis(void);
+static inline unsigned long micros(void) { return millis() * 1000; }
+
+// FreeRTOS
+typedef pthread_mutex_t *SemaphoreHandle_t;
+typedef void *TaskHandle_t;
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(mux) ((void)(mux))                                   // the task and the test never run at once
+#define portEXIT_CRITICAL(mux) ((void)(mux))
+#define portMAX_DELAY 0xffffffff
+#define pdMS_TO_TICKS(ms) (ms)
+#define pdTRUE 1
+
+static inline SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+    SemaphoreHandle_t mutex = new pthread_mutex_t;
+    pthread_mutex_init(mutex, NULL);
+    return mutex;
+}
+static inline int xSemaphoreTake(SemaphoreHandle_t mutex, uint32_t ticks) { (void)ticks; return pthread_mutex_lock(mutex) == 0; }
+static inline int xSemaphoreGive(SemaphoreHandle_t mutex) { return pthread_mutex_unlock(mutex) == 0; }
+
+int xTaskCreate(void (*task)(void *), const char *name, uint32_t stack, void *param, int priority, TaskHandle_t *handle);
+uint32_t ulTaskNotifyTake(int clear, uint32_t ticks);
+void xTaskNotifyGive(TaskHandle_t task);
+
+// ESP-IDF
+typedef void (*shutdown_handler_t)(void);
+int esp_register_shutdown_handler(shutdown_handler_t handler);
+
+#endif
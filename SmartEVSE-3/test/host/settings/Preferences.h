@@ -0,0 +1,68 @@
+/*
+ * Host build of the settings store: the Preferences of the Arduino core, on the NVS model of nvs.h
+ */
+
+#ifndef __HOST_PREFERENCES_H
+#define __HOST_PREFERENCES_H
+
+#include <Arduino.h>
+#include "nvs.h"
+
+class Preferences {
+public:
+    bool begin(const char *name, bool readOnly) {
+        (void)readOnly;
+        Namespace = name;
+        return true;
+    }
+    void end(void) { Namespace.clear(); }
+    bool clear(void) {
+        hostNvs->clear(Namespace);
+        return true;
+    }
+    bool remove(const char *key) { return hostNvs->remove(Namespace, key); }
+    bool isKey(const char *key) {
+        std::string value;
+        return get(key, Nvs::U8, value) || get(key, Nvs::U16, value) || get(key, Nvs::U32, value) ||
+               get(key, Nvs::STR, value) || get(key, Nvs::BLOB, value);
+    }
+
+    size_t putUChar(const char *key, uint8_t value) { return put(key, Nvs::U8, &value, sizeof(value)); }
+    size_t putUShort(const char *key, uint16_t value) { return put(key, Nvs::U16, &value, sizeof(value)); }
+    size_t putULong(const char *key, uint32_t value) { return put(key, Nvs::U32, &value, sizeof(value)); }
+    size_t putString(const char *key, const char *value) { return put(key, Nvs::STR, value, strlen(value)); }
+    size_t putBytes(const char *key, const void *value, size_t len) { return put(key, Nvs::BLOB, value, len); }
+
+    uint8_t getUChar(const char *key, uint8_t def) { return getValue(key, Nvs::U8, def); }
+    uint16_t getUShort(const char *key, uint16_t def) { return getValue(key, Nvs::U16, def); }
+    uint32_t getULong(const char *key, uint32_t def) { return getValue(key, Nvs::U32, def); }
+    size_t getBytesLength(const char *key) {
+        std::string value;
+        return get(key, Nvs::BLOB, value) ? value.size() : 0;
+    }
+    size_t getBytes(const char *key, void *buf, size_t maxLen) {
+        std::string value;
+        if (!get(key, Nvs::BLOB, value) || value.size() > maxLen) return 0;
+        memcpy(buf, value.data(), value.size());
+        return value.size();
+    }
+
+private:
+    std::string Namespace;
+
+    size_t put(const char *key, Nvs::Type type, const void *value, size_t len) {
+        if (Namespace.empty()) return 0;
+        return hostNvs->set(Namespace, key, type, std::string((const char *)value, len)) ? len : 0;
+    }
+    bool get(const char *key, Nvs::Type type, std::string &value) {
+        return !Namespace.empty() && hostNvs->get(Namespace, key, type, value);
+    }
+    template <class T> T getValue(const char *key, Nvs::Type type, T def) {
+        std::string value;
+        if (!get(key, type, value) || value.size() != sizeof(T)) return def;
+        memcpy(&def, value.data(), sizeof(T));
+        return def;
+    }
+};
+
+#endif
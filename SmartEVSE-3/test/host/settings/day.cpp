@@ -0,0 +1,487 @@
+/*
+ * Host test and benchmark of the settings store
+ *
+ * Runs the unmodified settings.cpp against the model of the NVS partition in nvs.h. The partition is 20 KB, as in
+ * partitions_custom.csv, and holds what an EVSE upgraded from the per-key layout holds besides the store: the
+ * PHY calibration, the WiFi configuration, and the keys of the older firmware.
+ *
+ *   busy         30 busy days: the entries written, the pages erased and the years until the most worn page
+ *                reaches FLASH_ERASE_CYCLES, against the same days with every setting in a key of its own
+ *   menu         a visit to the menu is one blob write; settings that keep changing are written every
+ *                SETTINGS_MAX_DELAY ms
+ *   power-loss   a state change is stored at once; a setting is stored SETTINGS_DEBOUNCE ms after the change,
+ *                or when the EVSE restarts
+ *
+ * usage: settings_day [-v level] list|busy|menu|power-loss
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdarg>
+#include <climits>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <Preferences.h>
+#include "esp32.h"
+#include "settings.h"
+
+#define NVS_PAGES 5                                                             // 20 KB
+#define FLASH_ERASE_CYCLES 100000                                               // per sector, from the flash datasheet
+#define DAYS 30
+#define MIN_YEARS 20                                                            // the most worn page lasts at least this long
+#define DAY_MS (24 * 3600 * 1000UL)
+
+enum Mode { MODE_NORMAL, MODE_SMART, MODE_SOLAR };
+
+int hostLogLevel = 0;
+
+void hostLog(int level, const char *fmt, ...) {
+    va_list args;
+
+    if (level > hostLogLevel) return;
+    printf("%9.3f  ", millis() / 1000.0);
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+}
+
+/*
+ * Simulated time, and the settings task
+ */
+
+static std::atomic<unsigned long> SimMillis;
+static std::mutex SimLock;
+static std::condition_variable &SimCond = *new std::condition_variable;       // not destroyed: the task waits on it at exit
+static bool TaskWaiting, TaskNotified;
+static unsigned long TaskDeadline = ULONG_MAX;
+static unsigned TaskSleeps;                                                     // counts the calls that slept
+static shutdown_handler_t ShutdownHandler;
+
+unsigned long millis(void) { return SimMillis; }
+
+int xTaskCreate(void (*task)(void *), const char *name, uint32_t stack, void *param, int priority, TaskHandle_t *handle) {
+    (void)name; (void)stack; (void)priority;
+    std::thread(task, param).detach();
+    *handle = (TaskHandle_t) task;
+    return pdTRUE;
+}
+
+uint32_t ulTaskNotifyTake(int clear, uint32_t ticks) {
+    std::unique_lock<std::mutex> lock(SimLock);
+
+    (void)clear;
+    if (!TaskNotified) {
+        TaskDeadline = ticks == portMAX_DELAY ? ULONG_MAX : SimMillis + ticks;
+        TaskWaiting = true;
+        TaskSleeps++;
+        SimCond.notify_all();
+        SimCond.wait(lock, []() { return TaskNotified || SimMillis >= TaskDeadline; });
+        TaskWaiting = false;
+    }
+    if (!TaskNotified) return 0;
+    TaskNotified = false;
+    return 1;
+}
+
+void xTaskNotifyGive(TaskHandle_t task) {
+    std::lock_guard<std::mutex> lock(SimLock);
+
+    (void)task;
+    TaskNotified = true;
+    SimCond.notify_all();
+}
+
+int esp_register_shutdown_handler(shutdown_handler_t handler) {
+    ShutdownHandler = handler;
+    return 0;
+}
+
+// Waits until the settings task sleeps
+static void settle(void) {
+    std::unique_lock<std::mutex> lock(SimLock);
+
+    SimCond.wait(lock, []() { return TaskWaiting && !TaskNotified; });
+}
+
+// Advances the clock to ms, waking the settings task at each of its timeouts on the way
+static void advance(unsigned long ms) {
+    std::unique_lock<std::mutex> lock(SimLock);
+
+    SimCond.wait(lock, []() { return TaskWaiting && !TaskNotified; });
+    while (TaskDeadline <= ms) {
+        const unsigned sleeps = TaskSleeps;
+        SimMillis = TaskDeadline;
+        SimCond.notify_all();
+        SimCond.wait(lock, [sleeps]() { return TaskSleeps != sleeps && TaskWaiting && !TaskNotified; });
+    }
+    if (ms > SimMillis) SimMillis = ms;
+}
+
+/*
+ * The EVSE, as far as the store sees it
+ */
+
+static SettingsCache Settings;
+static SettingsState State;
+
+static void defaults(void) {
+    memset(&Settings, 0, sizeof(Settings));
+    Settings.Config = 1;
+    Settings.MaxMains = 25;
+    Settings.MaxSumMains = 600;
+    Settings.MaxCurrent = 16;
+    Settings.MinCurrent = 6;
+    Settings.MaxCircuit = 16;
+    Settings.StartCurrent = 4;
+    Settings.StopTime = 10;
+    Settings.ImportCurrent = 0;
+    Settings.EnableC2 = 4;
+    Settings.maxTemp = 65;
+    Settings.LedMode = 1;
+    strcpy(Settings.MainsMeterDeviceHostName, "mains-meter");
+    strcpy(Settings.intervals_json, "[]");
+    State = {MODE_SMART, 1, 0, 0, 0};
+}
+
+static void fill(Preferences &prefs, const char *ns, const char *prefix, int keys) {
+    char key[16];
+
+    prefs.begin(ns, false);
+    for (int i = 0; i < keys; i++) {
+        snprintf(key, sizeof(key), "%s%02d", prefix, i);
+        prefs.putUChar(key, i);
+    }
+    prefs.end();
+}
+
+// An EVSE upgraded from the per-key layout, started with the store
+static void boot(Nvs &nvs) {
+    Preferences prefs;
+    std::string cal(1904, 'c');
+
+    hostNvs = &nvs;
+    prefs.begin("phy", false);                                                  // the PHY calibration of the WiFi
+    prefs.putBytes("cal_data", cal.data(), cal.size());
+    prefs.putULong("cal_version", 1);
+    prefs.putBytes("cal_mac", "\x01\x02\x03\x04\x05\x06", 6);
+    prefs.end();
+    fill(prefs, "nvs.net80211", "wifi", 30);
+    prefs.begin("nvs.net80211", false);
+    prefs.putBytes("sta.ssid", std::string(36, 's').data(), 36);
+    prefs.putBytes("sta.pswd", std::string(65, 'p').data(), 65);
+    prefs.end();
+    fill(prefs, "settings", "old", 70);                                         // the keys before the blob, never removed
+    prefs.begin("settings", false);
+    prefs.putUChar("Mode", State.Mode);
+    prefs.putUChar("Access", State.AccessStatus);
+    prefs.putUShort("CardOffs16", State.CardOffset);
+    prefs.putULong("DelayedStartTim", State.DelayedStartTime);
+    prefs.putULong("DelayedStopTime", State.DelayedStopTime);
+    prefs.end();
+
+    settings_store_begin(Settings, State, true);                               // the keys are stored as a blob
+    advance(SETTINGS_DEBOUNCE);
+}
+
+/*
+ * A busy day: a home with solar panels, a dynamic tariff and home automation
+ */
+
+struct Event {
+    unsigned long At;                                                           // ms since midnight
+    enum { MODE, ACCESS, DELAYED, TARIFF, ENABLE_C2, MENU } What;
+    uint32_t Value;
+};
+
+static std::vector<Event> busyDay(int day) {
+    std::vector<Event> events;
+    const unsigned long h = 3600 * 1000UL, m = 60 * 1000UL;
+
+    for (int i = 0; i < 96; i++)                                                // the automation switches Smart and Solar every 15 minutes
+        events.push_back({i * 15 * m + 7000, Event::MODE, (uint32_t) (i % 2 ? MODE_SOLAR : MODE_SMART)});
+    for (unsigned long start : {7 * h + 10 * m, 12 * h + 30 * m, 18 * h + 45 * m}) {   // three sessions, by RFID
+        events.push_back({start, Event::ACCESS, 1});
+        events.push_back({start + 100 * m, Event::ACCESS, 0});
+    }
+    events.push_back({6 * h, Event::DELAYED, 0});                                       // the delayed start of the night is done
+    events.push_back({22 * h, Event::DELAYED, (uint32_t) (day * 86400 + 23 * 3600)});   // and set again from the app
+    for (int i = 0; i < 24; i++)                                                // the tariff sets the mains limit every hour
+        events.push_back({i * h + 30000, Event::TARIFF, (uint32_t) (400 + (i * 7 + day) % 24 * 10)});
+    events.push_back({9 * h, Event::ENABLE_C2, 3});                             // three phases while the sun shines
+    events.push_back({17 * h, Event::ENABLE_C2, 4});
+    for (int i = 0; i < 8; i++)                                                 // a visit to the menu: 8 settings, 1 s apart
+        events.push_back({19 * h + 30 * m + i * 1000, Event::MENU, (uint32_t) i});
+    std::sort(events.begin(), events.end(), [](const Event &a, const Event &b) { return a.At < b.At; });
+    return events;
+}
+
+// The menu changes a setting up or down, as the buttons do
+static void menuChange(uint32_t item, int day) {
+    const int step = day % 2 ? -1 : 1;
+
+    switch (item) {
+        case 0: Settings.MaxCurrent += step; break;
+        case 1: Settings.MinCurrent += step; break;
+        case 2: Settings.StartCurrent += step; break;
+        case 3: Settings.StopTime += step; break;
+        case 4: Settings.ImportCurrent += step; break;
+        case 5: Settings.LCDlock ^= 1; break;
+        case 6: Settings.CableLock ^= 1; break;
+        default: Settings.LedMode ^= 1; break;
+    }
+}
+
+static const char *MenuKeys[] = {"MaxCurrent", "MinCurrent", "StartCurrent", "StopTime", "ImportCurrent", "LCDlock", "CableLock", "LedMode"};
+
+// Applies an event, and stores it through the store, or as the keys of the per-key layout
+static void apply(const Event &e, int day, Preferences *keys) {
+    switch (e.What) {
+        case Event::MODE:
+            State.Mode = e.Value;
+            if (keys) keys->putUChar("Mode", State.Mode);
+            break;
+        case Event::ACCESS:
+            State.AccessStatus = e.Value;
+            if (keys) keys->putUChar("Access", State.AccessStatus);
+            break;
+        case Event::DELAYED:
+            State.DelayedStartTime = e.Value;
+            State.DelayedStopTime = e.Value ? e.Value + 6 * 3600 : 0;
+            if (keys) {
+                keys->putULong("DelayedStartTim", State.DelayedStartTime);
+                keys->putULong("DelayedStopTime", State.DelayedStopTime);
+            }
+            break;
+        case Event::TARIFF:
+            Settings.MaxSumMains = e.Value;
+            if (keys) keys->putUShort("MaxSumMains", Settings.MaxSumMains);
+            break;
+        case Event::ENABLE_C2:
+            Settings.EnableC2 = e.Value;
+            if (keys) keys->putUShort("EnableC2", Settings.EnableC2);
+            break;
+        case Event::MENU:
+            menuChange(e.Value, day);
+            if (keys) keys->putUShort(MenuKeys[e.Value], 0);
+            break;
+    }
+    if (keys) return;
+    if (e.What == Event::MODE || e.What == Event::ACCESS || e.What == Event::DELAYED) settings_store_state(State);
+    else settings_store_put(Settings);
+    settle();
+}
+
+/*
+ * Checks
+ */
+
+static void expect(std::vector<std::string> &errors, bool ok, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+static void expect(std::vector<std::string> &errors, bool ok, const char *fmt, ...) {
+    char buf[256];
+    va_list args;
+
+    if (ok) return;
+    va_start(args, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    errors.push_back(buf);
+}
+
+// What a restart reads back: the blob and the state keys
+static void checkStored(std::vector<std::string> &errors, const SettingsCache &settings, const SettingsState &state, const char *when) {
+    Preferences prefs;
+    SettingsCache stored;
+
+    memset(&stored, 0, sizeof(stored));
+    prefs.begin("settings", true);
+    const size_t len = read_settings_blob(prefs, stored);
+    expect(errors, len == sizeof(stored), "%s: blob of %zu bytes read", when, len);
+    expect(errors, !memcmp(&stored, &settings, sizeof(stored)), "%s: the stored settings differ", when);
+    expect(errors, prefs.getUChar("Mode", 0xff) == state.Mode, "%s: Mode %u stored, not %u", when, prefs.getUChar("Mode", 0xff), state.Mode);
+    expect(errors, prefs.getUChar("Access", 0xff) == state.AccessStatus, "%s: Access %u stored, not %u", when,
+           prefs.getUChar("Access", 0xff), state.AccessStatus);
+    expect(errors, prefs.getULong("DelayedStartTim", 1) == state.DelayedStartTime && prefs.getULong("DelayedStopTime", 1) == state.DelayedStopTime,
+           "%s: the delayed charging times differ", when);
+    prefs.end();
+}
+
+static bool report(const char *name, const std::vector<std::string> &errors) {
+    for (const std::string &e : errors) printf("  FAIL: %s\n", e.c_str());
+    printf("%s: %s\n\n", name, errors.empty() ? "PASS" : "FAIL");
+    return errors.empty();
+}
+
+/*
+ * Scenarios
+ */
+
+struct Wear {
+    double Entries, Moved, Erases;                                              // per day
+    double Years;                                                               // until the most worn page wears out
+};
+
+static Wear wear(const Nvs &nvs, const Nvs::Stats &start, uint32_t startErased) {
+    const Nvs::Stats &s = nvs.stats();
+    const double worn = (double) (nvs.mostErased() - startErased) / DAYS;
+
+    return {(double) (s.Entries - start.Entries) / DAYS, (double) (s.Moved - start.Moved) / DAYS, (double) (s.Erases - start.Erases) / DAYS,
+            worn ? FLASH_ERASE_CYCLES / worn / 365 : INFINITY};
+}
+
+static bool busy(void) {
+    std::vector<std::string> errors;
+    Nvs nvs(NVS_PAGES), keysNvs(NVS_PAGES);
+    unsigned changes = 0, stateChanges = 0;
+
+    printf("busy: %d days of 96 mode changes, 3 sessions, a delayed start, 24 tariff changes, EnableC2 twice and a visit to the menu\n", DAYS);
+    defaults();
+    boot(nvs);
+    checkStored(errors, Settings, State, "boot");
+    const Nvs::Stats start = nvs.stats();
+    const uint32_t startErased = nvs.mostErased();
+    const unsigned startBlobs = nvs.writes(SETTINGS_BLOB_KEY);
+
+    for (int day = 0; day < DAYS; day++) {
+        for (const Event &e : busyDay(day)) {
+            advance(day * DAY_MS + e.At);
+            apply(e, day, NULL);
+            if (e.What == Event::MODE || e.What == Event::ACCESS || e.What == Event::DELAYED) stateChanges++;
+            else changes++;
+        }
+        advance((day + 1) * DAY_MS);
+        checkStored(errors, Settings, State, ("day " + std::to_string(day + 1)).c_str());
+    }
+    const Wear blob = wear(nvs, start, startErased);
+    const unsigned blobs = nvs.writes(SETTINGS_BLOB_KEY) - startBlobs;
+
+    // The same days on the per-key layout: every change is one key
+    defaults();
+    hostNvs = &keysNvs;
+    {
+        Preferences prefs;
+        fill(prefs, "phy", "cal", 62);                                          // as many entries as the calibration blob
+        fill(prefs, "nvs.net80211", "wifi", 37);
+        fill(prefs, "settings", "old", 75);
+        prefs.begin("settings", false);
+        const Nvs::Stats keysStart = keysNvs.stats();
+        for (int day = 0; day < DAYS; day++)
+            for (const Event &e : busyDay(day)) apply(e, day, &prefs);
+        prefs.end();
+        const Wear keys = wear(keysNvs, keysStart, 0);
+        hostNvs = &nvs;
+
+        printf("  per day: %u setting changes in %u blob writes of %zu bytes, %u state changes\n", changes / DAYS, blobs / DAYS,
+               sizeof(SettingsBlob), stateChanges / DAYS);
+        printf("  %-28s %14s %14s\n", "", "blob + state", "every key");
+        printf("  %-28s %14.0f %14.0f\n", "entries written per day", blob.Entries, keys.Entries);
+        printf("  %-28s %14.0f %14.0f\n", "  of those moved", blob.Moved, keys.Moved);
+        printf("  %-28s %14.2f %14.2f\n", "pages erased per day", blob.Erases, keys.Erases);
+        printf("  %-28s %14.0f %14.0f\n", "years, most worn page", blob.Years, keys.Years);
+        printf("  free entries after %d days: %d of %d\n", DAYS, nvs.freeEntries(), NVS_PAGES * Nvs::PAGE_ENTRIES);
+    }
+    expect(errors, blobs < changes, "%u setting changes were %u blob writes", changes, blobs);
+    expect(errors, blob.Years >= MIN_YEARS, "the most worn page lasts %.0f years", blob.Years);
+    return report("busy", errors);
+}
+
+static bool menu(void) {
+    std::vector<std::string> errors;
+    Nvs nvs(NVS_PAGES);
+
+    printf("menu: 8 settings changed 1 s apart, then a setting that changes every second for 60 s\n");
+    defaults();
+    boot(nvs);
+    unsigned base = nvs.writes(SETTINGS_BLOB_KEY);
+    for (int i = 0; i < 8; i++) {
+        advance(60000 + i * 1000);
+        menuChange(i, 0);
+        settings_store_put(Settings);
+        settle();
+    }
+    advance(60000 + 7 * 1000 + SETTINGS_DEBOUNCE - 1);
+    expect(errors, nvs.writes(SETTINGS_BLOB_KEY) == base, "written before the debounce time");
+    advance(60000 + 7 * 1000 + SETTINGS_DEBOUNCE);
+    expect(errors, nvs.writes(SETTINGS_BLOB_KEY) == base + 1, "8 changes in %u blob writes, not 1", nvs.writes(SETTINGS_BLOB_KEY) - base);
+    checkStored(errors, Settings, State, "after the menu");
+
+    base = nvs.writes(SETTINGS_BLOB_KEY);
+    for (int i = 0; i < 60; i++) {
+        advance(120000 + i * 1000);
+        Settings.MaxSumMains = 400 + i;
+        settings_store_put(Settings);
+        settle();
+    }
+    advance(200000);
+    const unsigned writes = nvs.writes(SETTINGS_BLOB_KEY) - base;
+    printf("  60 changes in %u blob writes\n", writes);
+    expect(errors, writes >= 6 && writes <= 7, "60 changes 1 s apart in %u blob writes, not one per %u ms", writes, SETTINGS_MAX_DELAY);
+    checkStored(errors, Settings, State, "after the changes");
+    return report("menu", errors);
+}
+
+static bool powerLoss(void) {
+    std::vector<std::string> errors;
+    Nvs nvs(NVS_PAGES);
+    SettingsCache before;
+
+    printf("power-loss: what a restart reads right after a change\n");
+    defaults();
+    boot(nvs);
+    memcpy(&before, &Settings, sizeof(before));
+    advance(60000);
+    State.Mode = MODE_SOLAR;
+    settings_store_state(State);
+    settle();
+    checkStored(errors, Settings, State, "mode changed");                      // a power loss now keeps the mode
+
+    Settings.MaxCurrent = 10;
+    settings_store_put(Settings);
+    settle();
+    advance(60000 + SETTINGS_DEBOUNCE - 1);
+    checkStored(errors, before, State, "within the debounce time");             // the documented window: the change is lost
+    advance(60000 + SETTINGS_DEBOUNCE);
+    checkStored(errors, Settings, State, "after the debounce time");
+
+    Settings.MaxCurrent = 12;
+    settings_store_put(Settings);
+    settle();
+    ShutdownHandler();                                                          // ESP.restart()
+    checkStored(errors, Settings, State, "after a restart");
+    return report("power-loss", errors);
+}
+
+static const struct {
+    const char *Name;
+    bool (*Run)(void);
+} Scenarios[] = {
+    {"busy", busy},
+    {"menu", menu},
+    {"power-loss", powerLoss},
+};
+
+static void usage(void) {
+    printf("usage: settings_day [-v level] list|busy|menu|power-loss\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[]) {
+    const char *name = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-v") && i + 1 < argc) hostLogLevel = atoi(argv[++i]);
+        else if (argv[i][0] == '-' || name) usage();
+        else name = argv[i];
+    }
+    if (!name) usage();
+    if (!strcmp(name, "list")) {
+        for (const auto &s : Scenarios) printf("%s\n", s.Name);
+        return 0;
+    }
+    for (const auto &s : Scenarios)
+        if (!strcmp(name, s.Name)) return s.Run() ? 0 : 1;
+    usage();
+}
@@ -0,0 +1,16 @@
+/*
+ * Host build of the settings store: the part of esp32.h the store uses.
+ */
+
+#ifndef __EVSE_ESP32
+#define __EVSE_ESP32
+
+#include <Arduino.h>
+
+extern int hostLogLevel;                                                        // 1 = errors .. 4 = debug
+void hostLog(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+#define _LOG_A(fmt, ...) hostLog(1, fmt, ##__VA_ARGS__)
+#define _LOG_I(fmt, ...) hostLog(3, fmt, ##__VA_ARGS__)
+
+#endif
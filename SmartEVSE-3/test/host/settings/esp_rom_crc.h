@@ -0,0 +1,6 @@
+/*
+ * Host build of the settings store: the crc32 of the session journal.
+ */
+
+#include <cstdint>
+#include "../session/esp_rom_crc.h"
@@ -0,0 +1,153 @@
+/*
+ * Host build of the settings store: a model of the NVS partition, see nvs.h
+ */
+
+#include <algorithm>
+#include "nvs.h"
+
+Nvs *hostNvs;
+
+Nvs::Nvs(int pages) : Pages(pages) {
+    for (int i = 1; i < pages; i++) FreePages.push_back(i);
+    Active = 0;
+    Pages[0].State = ACTIVE;
+}
+
+// Entries of a primitive or a string, or the data of a blob chunk plus its header
+static int span(size_t bytes) {
+    return 1 + (bytes + Nvs::ENTRY_SIZE - 1) / Nvs::ENTRY_SIZE;
+}
+
+// The active page is full: take the next free page, compact one into the last free page first
+bool Nvs::newPage(void) {
+    Pages[Active].State = FULL;
+    if (FreePages.size() >= 2) {
+        Active = FreePages.front();
+        FreePages.pop_front();
+        Pages[Active].State = ACTIVE;
+        return true;
+    }
+
+    int victim = -1;
+    for (size_t i = 0; i < Pages.size(); i++)
+        if (Pages[i].State == FULL && Pages[i].Erased && (victim < 0 || Pages[i].Erased > Pages[victim].Erased)) victim = i;
+    if (victim < 0 || FreePages.empty()) return false;                          // nothing to reclaim, the partition is full
+
+    Active = FreePages.front();
+    FreePages.pop_front();
+    Pages[Active].State = ACTIVE;
+    for (auto &v : Values)
+        for (Chunk &c : v.second.Chunks)
+            if (c.Page == victim) append(c, true);
+    if (Writing)
+        for (Chunk &c : Writing->Chunks)                                        // the chunks of a blob written so far
+            if (c.Page == victim) append(c, true);
+    Pages[victim] = {EMPTY, 0, 0, Pages[victim].Erases + 1};
+    Totals.Erases++;
+    FreePages.push_back(victim);
+    return true;
+}
+
+// Room for span entries on the active page
+bool Nvs::reserve(int span) {
+    while (PAGE_ENTRIES - Pages[Active].Used < span)
+        if (!newPage()) return false;
+    return true;
+}
+
+bool Nvs::append(Chunk &chunk, bool moved) {
+    if (!moved && !reserve(chunk.Span)) return false;
+    chunk.Page = Active;
+    Pages[Active].Used += chunk.Span;
+    Totals.Entries += chunk.Span;
+    if (moved) Totals.Moved += chunk.Span;
+    return true;
+}
+
+void Nvs::release(const Value &value) {
+    for (const Chunk &c : value.Chunks) Pages[c.Page].Erased += c.Span;
+}
+
+bool Nvs::set(const std::string &ns, const std::string &key, Type type, const std::string &value) {
+    Value next = {type, {}};
+    auto old = Values.find({ns, key});
+    bool ok = true;
+
+    if (type != BLOB) {
+        Chunk c = {-1, type == STR ? span(value.size() + 1) : 1, value};
+        if (!append(c, false)) return false;
+        next.Chunks.push_back(c);
+    } else {
+        size_t offset = 0;
+        Writing = &next;
+        do {                                                                    // the data chunks, as much as fits on the page
+            int room = PAGE_ENTRIES - Pages[Active].Used - 1;
+            if (room < 1) {
+                ok = newPage();
+                continue;
+            }
+            size_t size = std::min(value.size() - offset, (size_t) room * ENTRY_SIZE);
+            Chunk c = {-1, span(size), value.substr(offset, size)};
+            if ((ok = append(c, false))) next.Chunks.push_back(c);
+            offset += size;
+        } while (ok && offset < value.size());
+        Chunk index = {-1, 1, ""};
+        if ((ok = ok && append(index, false))) next.Chunks.push_back(index);
+        Writing = NULL;
+        if (!ok) {                                                              // the old value stays
+            release(next);
+            return false;
+        }
+    }
+    if (old != Values.end()) release(old->second);
+    Values[{ns, key}] = next;
+    Writes[key]++;
+    return true;
+}
+
+bool Nvs::get(const std::string &ns, const std::string &key, Type type, std::string &value) const {
+    auto v = Values.find({ns, key});
+
+    if (v == Values.end() || v->second.DataType != type) return false;
+    value.clear();
+    for (const Chunk &c : v->second.Chunks) value += c.Data;
+    return true;
+}
+
+bool Nvs::remove(const std::string &ns, const std::string &key) {
+    auto v = Values.find({ns, key});
+
+    if (v == Values.end()) return false;
+    release(v->second);
+    Values.erase(v);
+    return true;
+}
+
+void Nvs::clear(const std::string &ns) {
+    for (auto v = Values.begin(); v != Values.end();) {
+        if (v->first.first == ns) {
+            release(v->second);
+            v = Values.erase(v);
+        } else v++;
+    }
+}
+
+unsigned Nvs::writes(const std::string &key) const {
+    auto w = Writes.find(key);
+
+    return w == Writes.end() ? 0 : w->second;
+}
+
+uint32_t Nvs::mostErased(void) const {
+    uint32_t most = 0;
+
+    for (const Page &p : Pages) most = std::max(most, p.Erases);
+    return most;
+}
+
+int Nvs::freeEntries(void) const {
+    int used = 0;
+
+    for (const Page &p : Pages) used += p.Used - p.Erased;
+    return (int) Pages.size() * PAGE_ENTRIES - used;
+}
@@ -0,0 +1,82 @@
+/*
+ * Host build of the settings store: a model of the NVS partition
+ *
+ * The partition is a number of 4 KB pages of 126 entries of 32 bytes. A write appends the item to the active page and
+ * marks the entries of the old value erased. A primitive is one entry. A blob is written in chunks of a header entry
+ * and the data entries, split over pages when the active page is nearly full, followed by an index entry. When the
+ * active page is full the next free page is taken. One free page is kept: when it is the last, the page with the most
+ * erased entries is compacted into it and erased, as the PageManager of ESP-IDF does.
+ *
+ * The model keeps the values, so what a reboot reads back is what was written. It counts the entries written, the
+ * entries moved by the compaction, and the erases of every page.
+ */
+
+#ifndef __HOST_NVS_H
+#define __HOST_NVS_H
+
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+class Nvs {
+public:
+    enum Type : uint8_t { U8 = 0x01, U16 = 0x02, U32 = 0x04, STR = 0x21, BLOB = 0x42 };
+
+    static const int PAGE_ENTRIES = 126;
+    static const int ENTRY_SIZE = 32;
+
+    struct Stats {
+        uint64_t Entries;                                                       // written, including the moved ones
+        uint64_t Moved;                                                         // written by the compaction
+        uint64_t Erases;                                                        // pages
+    };
+
+    explicit Nvs(int pages);
+    bool set(const std::string &ns, const std::string &key, Type type, const std::string &value);
+    bool get(const std::string &ns, const std::string &key, Type type, std::string &value) const;
+    bool remove(const std::string &ns, const std::string &key);
+    void clear(const std::string &ns);
+    const Stats &stats(void) const { return Totals; }
+    unsigned writes(const std::string &key) const;                              // successful sets of the key
+    uint32_t mostErased(void) const;                                            // erases of the most worn page
+    int freeEntries(void) const;                                                // not used by a current value
+
+private:
+    enum PageState { EMPTY, ACTIVE, FULL };
+
+    struct Page {
+        PageState State = EMPTY;
+        int Used = 0;                                                           // entries appended since the erase
+        int Erased = 0;                                                         // of those, the ones of old values
+        uint32_t Erases = 0;
+    };
+
+    struct Chunk {                                                              // an item and where it is stored
+        int Page, Span;
+        std::string Data;                                                       // for a blob: its part of the value
+    };
+
+    struct Value {
+        Type DataType;
+        std::vector<Chunk> Chunks;                                              // the index of a blob is the last
+    };
+
+    std::vector<Page> Pages;
+    std::deque<int> FreePages;
+    int Active;
+    std::map<std::pair<std::string, std::string>, Value> Values;
+    std::map<std::string, unsigned> Writes;
+    Value *Writing = NULL;                                                      // blob being written
+    Stats Totals = {};
+
+    bool newPage(void);
+    bool reserve(int span);
+    bool append(Chunk &chunk, bool moved);
+    void release(const Value &value);
+};
+
+extern Nvs *hostNvs;                                                            // the partition Preferences use
+
+#endif